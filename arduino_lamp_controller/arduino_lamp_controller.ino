@@ -21,6 +21,10 @@
  * switch. To change the color or level of the light, send serial commands to
  * the switch.
  *
+ * loop() never waits: the button interrupt only timestamps the edge, serial
+ * input is decoded as far as it has arrived, and Zigbee commands leave from a
+ * queue paced by a timer, so neither input can hold up the other.
+ *
  * By setting the switch to allow multiple binding, so it can bind to multiple
  * lights. Also every 30 seconds, all bound lights are printed to the serial
  * console.
@@ -36,100 +40,512 @@
 
 #include "ZigbeeCore.h"
 #include "ep/ZigbeeColorDimmerSwitch.h"
+#include <lamp_protocol.h> // components/lamp_protocol, see README.md
+#include <light_color.h>   // components/light_color, see README.md
 
 /* Switch configuration */
 #define SWITCH_PIN 9 // ESP32-C6/H2 Boot button
 #define SWITCH_ENDPOINT_NUMBER 5
 
+/* Bound lights that can be addressed one by one, by bind order */
+#define MAX_LIGHTS 8
+
+/* A press is one falling edge; edges until the button reads released this long are bounce */
+#define DEBOUNCE_MS 50
+
+/* Gap between two Zigbee commands leaving the queue, so a burst does not exhaust the stack's buffers */
+#define SEND_INTERVAL_US 4000
+
+/* Serial bytes decoded per loop() pass at most, so a flood cannot starve the button and the queue */
+#define SERIAL_BUDGET 256
+
 /* Zigbee switch */
 ZigbeeColorDimmerSwitch zbSwitch =
     ZigbeeColorDimmerSwitch(SWITCH_ENDPOINT_NUMBER);
 
+/*
+ * Serial protocol v2 (components/lamp_protocol): every message is a framed,
+ * CRC-checked frame, including log lines, so the host never has to tell text
+ * from binary. Frames from the host are answered with an ACK as they are
+ * decoded; the light commands they carry are folded into the pending state
+ * and sent by runQueue(), so a full window of frames costs no more air time
+ * than the newest of them. Frames are applied in sequence only, see
+ * lamp_protocol.h. A frame that does not fit the transmit buffer is dropped
+ * rather than waited for: the host sends again when an ACK goes missing.
+ */
+static lamp_proto_decoder_t decoder;
+static lamp_proto_sequencer_t sequencer;
+static uint8_t tx_seq = 0; /* of our own telemetry and log frames */
+static uint16_t telemetry_period_ms = 0;
+static uint32_t telemetry_sent_ms = 0;
+static lamp_proto_telemetry_t stats;
+
+static void sendFrame(uint8_t type, uint8_t seq, const void *payload,
+                      size_t length) {
+  uint8_t frame[LAMP_PROTO_MAX_FRAME];
+  const size_t size =
+      lamp_proto_encode(frame, sizeof(frame), type, seq, payload, length);
+  if (Serial.availableForWrite() >= (int)size) {
+    Serial.write(frame, size);
+  }
+}
+
+static void logLine(const char *format, ...) {
+  char line[LAMP_PROTO_MAX_PAYLOAD + 1];
+  va_list args;
+  va_start(args, format);
+  const int length = vsnprintf(line, sizeof(line), format, args);
+  va_end(args);
+  if (length > 0) {
+    sendFrame(LAMP_PROTO_LOG, tx_seq++, line,
+              min((size_t)length, (size_t)LAMP_PROTO_MAX_PAYLOAD));
+  }
+}
+
+/* Set by the button interrupt, taken by pollButton() */
+static volatile uint32_t button_edges = 0;
+static volatile uint32_t button_edge_us = 0;
+
+static void IRAM_ATTR onButtonEdge() {
+  button_edge_us = micros();
+  button_edges = button_edges + 1;
+}
+
 /********************* Arduino functions **************************/
 void setup() {
-
+  // Room for a full window of frames while loop() is busy sending
+  Serial.setRxBufferSize(LAMP_PROTO_WINDOW * LAMP_PROTO_MAX_FRAME);
   Serial.begin(115200);
-  while (!Serial) {
-    delay(10);
-  }
+  lamp_proto_decoder_init(&decoder);
+  lamp_proto_sequencer_init(&sequencer);
 
-  // Init button switch
+  // Init button switch, presses are timestamped by the interrupt
   pinMode(SWITCH_PIN, INPUT_PULLUP);
+  attachInterrupt(digitalPinToInterrupt(SWITCH_PIN), onButtonEdge, FALLING);
   // Optional: set Zigbee device name and model
   zbSwitch.setManufacturerAndModel("ggvgc", "LampController");
-  // Optional to allow multiple light to bind to the switch
-  zbSwitch.allowMultipleBinding(false);
+  // Allow multiple lights to bind to the switch, addressed by serial commands
+  zbSwitch.allowMultipleBinding(true);
   // Add endpoint to Zigbee Core
   Zigbee.addEndpoint(&zbSwitch);
   // Open network for 180 seconds after boot
   Zigbee.setRebootOpenNetwork(30);
   // When all EPs are registered, start Zigbee with ZIGBEE_COORDINATOR mode
   Zigbee.begin(ZIGBEE_COORDINATOR);
-  Serial.println("Waiting for light to bind");
-  while (!zbSwitch.isBound()) {
-    Serial.printf(".");
-    delay(500);
-  }
-  Serial.printf("\nLight bound!\n");
+  logLine("Waiting for light to bind");
 }
 
 struct Color {
-  Color(uint8_t r, uint8_t g, uint8_t b, uint8_t level)
-      : r(r), g(g), b(b), level(level) {
-  }
-
-  Color(uint8_t r, uint8_t g, uint8_t b) : Color(r, g, b, 255) {
-  }
-
   uint8_t r;
   uint8_t g;
   uint8_t b;
   uint8_t level;
+  uint16_t x; /* CIE x and y of r, g, b */
+  uint16_t y;
 };
 
-std::vector<Color> colors = {Color(255, 80, 20),   Color(255, 70, 20),
-                             Color(255, 50, 15),   Color(255, 40, 0),
-                             Color(255, 20, 0),    Color(255, 0, 0),
-                             Color(255, 0, 0, 220)};
+/* A preset color, its CIE xy computed by the compiler */
+#define COLOR(r, g, b, level)                                                  \
+  { r, g, b, level, LIGHT_COLOR_RGB_X(r, g, b), LIGHT_COLOR_RGB_Y(r, g, b) }
 
-void loop() {
-  static uint32_t click_count = 0;
-  if (digitalRead(SWITCH_PIN) == LOW) {
-    while (digitalRead(SWITCH_PIN) == LOW) {
-      delay(50);
+static constexpr Color colors[] = {
+    COLOR(255, 80, 20, 255), COLOR(255, 70, 20, 255), COLOR(255, 50, 15, 255),
+    COLOR(255, 40, 0, 255),  COLOR(255, 20, 0, 255),  COLOR(255, 0, 0, 255),
+    COLOR(255, 0, 0, 220)};
+static constexpr size_t color_count = sizeof(colors) / sizeof(colors[0]);
+
+/*
+ * The colors are stored in the bound light as scenes 1..n of the global scene
+ * table, so a button press recalls one with a single frame and the light
+ * changes color and level together. A light that binds gets them queued.
+ */
+#define SCENE_GROUP_ID 0x0000
+
+static_assert(color_count <= 16, "scenes to store are a 16-bit mask");
+
+static void addScene(zb_device_params_t *light, size_t index) {
+  const Color &color = colors[index];
+  const uint16_t x = color.x;
+  const uint16_t y = color.y;
+  uint8_t on_off[] = {1};
+  uint8_t level[] = {color.level < 254 ? color.level : (uint8_t)254};
+  uint8_t color_xy[] = {(uint8_t)x, (uint8_t)(x >> 8), (uint8_t)y,
+                        (uint8_t)(y >> 8)};
+  esp_zb_zcl_scenes_extension_field_t color_field = {
+      ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL, sizeof(color_xy), color_xy,
+      nullptr};
+  esp_zb_zcl_scenes_extension_field_t level_field = {
+      ESP_ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL, sizeof(level), level,
+      &color_field};
+  esp_zb_zcl_scenes_extension_field_t on_off_field = {
+      ESP_ZB_ZCL_CLUSTER_ID_ON_OFF, sizeof(on_off), on_off, &level_field};
+  esp_zb_zcl_scenes_add_scene_cmd_t req = {};
+  req.zcl_basic_cmd.dst_addr_u.addr_short = light->short_addr;
+  req.zcl_basic_cmd.dst_endpoint = light->endpoint;
+  req.zcl_basic_cmd.src_endpoint = SWITCH_ENDPOINT_NUMBER;
+  req.address_mode = ESP_ZB_APS_ADDR_MODE_16_ENDP_PRESENT;
+  req.group_id = SCENE_GROUP_ID;
+  req.scene_id = index + 1;
+  req.extension_field = &on_off_field;
+  esp_zb_zcl_scenes_add_scene_cmd_req(&req);
+}
+
+static void recallScene(zb_device_params_t *light, uint8_t scene_id) {
+  esp_zb_zcl_scenes_recall_scene_cmd_t req = {};
+  req.zcl_basic_cmd.dst_addr_u.addr_short = light->short_addr;
+  req.zcl_basic_cmd.dst_endpoint = light->endpoint;
+  req.zcl_basic_cmd.src_endpoint = SWITCH_ENDPOINT_NUMBER;
+  req.address_mode = ESP_ZB_APS_ADDR_MODE_16_ENDP_PRESENT;
+  req.group_id = SCENE_GROUP_ID;
+  req.scene_id = scene_id;
+  esp_zb_zcl_scenes_recall_scene_cmd_req(&req);
+}
+
+static void setLightXy(zb_device_params_t *light, uint16_t x, uint16_t y) {
+  esp_zb_zcl_color_move_to_color_cmd_t req = {};
+  req.zcl_basic_cmd.dst_addr_u.addr_short = light->short_addr;
+  req.zcl_basic_cmd.dst_endpoint = light->endpoint;
+  req.zcl_basic_cmd.src_endpoint = SWITCH_ENDPOINT_NUMBER;
+  req.address_mode = ESP_ZB_APS_ADDR_MODE_16_ENDP_PRESENT;
+  req.color_x = x;
+  req.color_y = y;
+  req.transition_time = 0;
+  esp_zb_zcl_color_move_to_color_cmd_req(&req);
+}
+
+static void setLightLevel(zb_device_params_t *light, uint8_t level) {
+  esp_zb_zcl_move_to_level_cmd_t req = {};
+  req.zcl_basic_cmd.dst_addr_u.addr_short = light->short_addr;
+  req.zcl_basic_cmd.dst_endpoint = light->endpoint;
+  req.zcl_basic_cmd.src_endpoint = SWITCH_ENDPOINT_NUMBER;
+  req.address_mode = ESP_ZB_APS_ADDR_MODE_16_ENDP_PRESENT;
+  req.level = level;
+  req.transition_time = 0;
+  esp_zb_zcl_level_move_to_level_with_onoff_cmd_req(&req);
+}
+
+/* Newest requested state of a light, sent by runQueue() */
+struct LightState {
+  uint16_t scenes_to_store = 0; /* bit n: scene n + 1 */
+  bool scene_pending = false;
+  bool color_pending = false;
+  bool level_pending = false;
+  size_t scene = 0;
+  uint16_t x = 0; /* colors are kept as CIE xy, whatever they came as */
+  uint16_t y = 0;
+  uint8_t level = 0;
+  /* micros() of the oldest input each pending value stands for */
+  uint32_t scene_input_us = 0;
+  uint32_t color_input_us = 0;
+  uint32_t level_input_us = 0;
+  /* last state put on air, so unchanged values cost no frame */
+  bool color_sent = false;
+  bool level_sent = false;
+  uint16_t sent_x = 0;
+  uint16_t sent_y = 0;
+  uint8_t sent_level = 0;
+};
+
+static LightState lights[MAX_LIGHTS];
+
+static size_t lightCount() {
+  return min(zbSwitch.getBoundDevices().size(), (size_t)MAX_LIGHTS);
+}
+
+static void requestColor(LightState &light, uint16_t x, uint16_t y,
+                         uint32_t input_us) {
+  stats.coalesced += light.color_pending;
+  if (!light.color_pending) {
+    light.color_input_us = input_us;
+  }
+  light.color_pending = true;
+  light.x = x;
+  light.y = y;
+}
+
+static void requestLevel(LightState &light, uint8_t level, uint32_t input_us) {
+  stats.coalesced += light.level_pending;
+  if (!light.level_pending) {
+    light.level_input_us = input_us;
+  }
+  light.level_pending = true;
+  light.level = level;
+}
+
+/* A preset replaces any color or level requested before it */
+static void requestPreset(LightState &light, size_t preset,
+                          uint32_t input_us) {
+  stats.coalesced +=
+      light.scene_pending + light.color_pending + light.level_pending;
+  if (!light.scene_pending) {
+    light.scene_input_us = input_us;
+  }
+  light.scene_pending = true;
+  light.scene = preset;
+  light.color_pending = false;
+  light.level_pending = false;
+}
+
+static void sent(uint32_t input_us) {
+  stats.sent++;
+  stats.latency_last_us = micros() - input_us;
+  stats.latency_max_us = max(stats.latency_max_us, stats.latency_last_us);
+}
+
+/*
+ * Send the light's most urgent pending command: scenes it lacks first, so a
+ * recall finds them, then the preset, color and level. Values the light
+ * already has are dropped without a frame. Returns whether one was sent.
+ */
+static bool sendNext(zb_device_params_t *device, LightState &light) {
+  if (light.scenes_to_store) {
+    const size_t index = __builtin_ctz(light.scenes_to_store);
+    light.scenes_to_store &= light.scenes_to_store - 1;
+    addScene(device, index);
+    return true;
+  }
+  if (light.scene_pending) {
+    light.scene_pending = false;
+    const Color &color = colors[light.scene];
+    recallScene(device, light.scene + 1);
+    sent(light.scene_input_us);
+    light.color_sent = light.level_sent = true;
+    light.sent_x = color.x;
+    light.sent_y = color.y;
+    light.sent_level = color.level;
+    return true;
+  }
+  if (light.color_pending) {
+    light.color_pending = false;
+    if (!light.color_sent || light.x != light.sent_x ||
+        light.y != light.sent_y) {
+      setLightXy(device, light.x, light.y);
+      sent(light.color_input_us);
+      light.color_sent = true;
+      light.sent_x = light.x;
+      light.sent_y = light.y;
+      return true;
+    }
+  }
+  if (light.level_pending) {
+    light.level_pending = false;
+    if (!light.level_sent || light.level != light.sent_level) {
+      setLightLevel(device, light.level);
+      sent(light.level_input_us);
+      light.level_sent = true;
+      light.sent_level = light.level;
+      return true;
+    }
+  }
+  return false;
+}
+
+/*
+ * The command queue: once SEND_INTERVAL_US has passed since the last send,
+ * the next light in turn with something pending sends one command. If the
+ * Zigbee task holds its lock, the queue tries again on the next pass.
+ */
+static void runQueue() {
+  static uint32_t next_send_us = 0;
+  static size_t cursor = 0;
+  if ((int32_t)(micros() - next_send_us) < 0) {
+    return;
+  }
+  if (!esp_zb_lock_acquire(0)) {
+    return;
+  }
+  zb_device_params_t *devices[MAX_LIGHTS];
+  size_t count = 0;
+  for (zb_device_params_t *device : zbSwitch.getBoundDevices()) {
+    if (count == MAX_LIGHTS) {
+      break;
+    }
+    devices[count++] = device;
+  }
+  for (size_t n = 0; n < count; ++n) {
+    const size_t index = (cursor + n) % count;
+    if (sendNext(devices[index], lights[index])) {
+      cursor = index + 1;
+      next_send_us = micros() + SEND_INTERVAL_US;
+      break;
+    }
+  }
+  esp_zb_lock_release();
+}
+
+static void applyRecord(LightState &light, const lamp_proto_record_t &record,
+                        uint32_t input_us) {
+  switch (record.op) {
+  case LAMP_PROTO_OP_LEVEL:
+    requestLevel(light, record.level, input_us);
+    break;
+  case LAMP_PROTO_OP_RGB: {
+    uint16_t x, y;
+    light_color_rgb_to_xy(record.rgb[0], record.rgb[1], record.rgb[2], &x, &y);
+    requestColor(light, x, y, input_us);
+  } break;
+  case LAMP_PROTO_OP_XY:
+    requestColor(light, record.x, record.y, input_us);
+    break;
+  case LAMP_PROTO_OP_MIREDS: {
+    uint16_t x, y;
+    light_color_mireds_to_xy(record.mireds, &x, &y);
+    requestColor(light, x, y, input_us);
+  } break;
+  case LAMP_PROTO_OP_PRESET:
+    requestPreset(light, record.preset, input_us);
+    break;
+  }
+}
+
+/* micros() of the serial read being decoded */
+static uint32_t serial_input_us = 0;
+
+/* Check every record of a batch, then apply them all, so a bad batch changes nothing */
+static uint8_t handleCommands(const uint8_t *payload, size_t length) {
+  const size_t count = lightCount();
+  lamp_proto_record_t record;
+  for (size_t offset = 0, size; offset < length; offset += size) {
+    size = lamp_proto_get_record(payload + offset, length - offset, &record);
+    if (!size) {
+      return LAMP_PROTO_ERR_MALFORMED;
+    }
+    if ((record.target != LAMP_PROTO_TARGET_ALL && record.target >= count) ||
+        (record.op == LAMP_PROTO_OP_PRESET && record.preset >= color_count)) {
+      return LAMP_PROTO_ERR_TARGET;
+    }
+  }
+  for (size_t offset = 0; offset < length;) {
+    offset += lamp_proto_get_record(payload + offset, length - offset, &record);
+    stats.records++;
+    if (record.target != LAMP_PROTO_TARGET_ALL) {
+      applyRecord(lights[record.target], record, serial_input_us);
+      continue;
     }
+    for (size_t i = 0; i < count; ++i) {
+      applyRecord(lights[i], record, serial_input_us);
+    }
+  }
+  return length ? LAMP_PROTO_OK : LAMP_PROTO_ERR_MALFORMED;
+}
+
+static void handleFrame(const lamp_proto_frame_t *frame, void *) {
+  uint8_t ack[1 + LAMP_PROTO_HELLO_ACK_SIZE] = {LAMP_PROTO_OK};
+  size_t ack_length = 1;
+  switch (lamp_proto_sequence_check(&sequencer, frame, &ack[0])) {
+  case LAMP_PROTO_FRAME_DUPLICATE:
+    sendFrame(LAMP_PROTO_ACK, frame->seq, ack, ack_length);
+    return;
+  case LAMP_PROTO_FRAME_OUT_OF_ORDER:
+    ack[0] = LAMP_PROTO_ERR_SEQUENCE;
+    ack[1] = sequencer.expected;
+    sendFrame(LAMP_PROTO_ACK, frame->seq, ack, 2);
+    return;
+  case LAMP_PROTO_FRAME_NEW:
+    break;
+  }
+  switch (frame->type) {
+  case LAMP_PROTO_HELLO:
+    ack[1] = LAMP_PROTO_VERSION;
+    ack[2] = LAMP_PROTO_MAX_PAYLOAD;
+    ack[3] = LAMP_PROTO_WINDOW;
+    ack_length = sizeof(ack);
+    break;
+  case LAMP_PROTO_COMMANDS:
+    ack[0] = handleCommands(frame->payload, frame->length);
+    break;
+  case LAMP_PROTO_TELEMETRY_PERIOD:
+    if (frame->length != 2) {
+      ack[0] = LAMP_PROTO_ERR_MALFORMED;
+      break;
+    }
+    telemetry_period_ms = frame->payload[0] | frame->payload[1] << 8;
+    telemetry_sent_ms = millis() - telemetry_period_ms; /* one right away */
+    break;
+  default:
+    ack[0] = LAMP_PROTO_ERR_TYPE;
+  }
+  lamp_proto_sequence_commit(&sequencer, frame->seq, ack[0]);
+  sendFrame(LAMP_PROTO_ACK, frame->seq, ack, ack_length);
+}
+
+static void sendTelemetry() {
+  uint8_t payload[LAMP_PROTO_TELEMETRY_SIZE];
+  stats.uptime_ms = millis();
+  stats.frames = decoder.frames;
+  stats.bad_frames = decoder.bad_frames;
+  stats.skipped = decoder.skipped;
+  stats.duplicates = sequencer.duplicates;
+  stats.out_of_order = sequencer.out_of_order;
+  stats.lights = lightCount();
+  lamp_proto_put_telemetry(payload, &stats);
+  sendFrame(LAMP_PROTO_TELEMETRY, tx_seq++, payload, sizeof(payload));
+}
+
+/* Queue the preset scenes for lights bound since the last pass */
+static void pollBound() {
+  static size_t bound = 0;
+  const size_t count = lightCount();
+  for (size_t i = bound; i < count; ++i) {
+    lights[i].scenes_to_store = (1U << color_count) - 1;
+    logLine("Light %u bound", (unsigned)i);
+  }
+  bound = count;
+}
 
-    const Color &color = colors[click_count % colors.size()];
-    zbSwitch.setLightColor(color.r, color.g, color.b);
-    delay(100);
-    zbSwitch.setLightLevel(color.level);
-    click_count++;
-  }
-
-  if (Serial.available()) {
-    uint8_t command;
-    const uint8_t bytes_read = Serial.readBytes(&command, 1);
-
-    if (bytes_read == 1) {
-      switch (command) {
-      case 0: {
-        uint8_t colors[3];
-        int bytes_read = Serial.readBytes(colors, 3);
-        uint8_t red = colors[0];
-        uint8_t green = colors[1];
-        uint8_t blue = colors[2];
-        Serial.printf("Set color: %i, %i, %i\n", red, green, blue);
-        zbSwitch.setLightColor(red, green, blue);
-      } break;
-      case 1: {
-        uint8_t level;
-        Serial.readBytes(&level, 1);
-        Serial.printf("Set level: %i\n", level);
-        zbSwitch.setLightLevel(level);
-      } break;
-      default:
-        Serial.printf("Unknown command: %i\n", command);
-      }
+/*
+ * A press acts on its first edge; later edges are bounce until the button
+ * has read released for DEBOUNCE_MS.
+ */
+static void pollButton() {
+  static uint32_t seen_edges = 0;
+  static bool held = false;
+  static uint32_t released_ms = 0;
+  static uint32_t click_count = 0;
+  if (held) {
+    if (digitalRead(SWITCH_PIN) == LOW) {
+      released_ms = millis();
+    } else if (millis() - released_ms >= DEBOUNCE_MS) {
+      held = false;
+      seen_edges = button_edges;
     }
+    return;
+  }
+  if (button_edges == seen_edges) {
+    return;
+  }
+  const uint32_t input_us = button_edge_us;
+  held = true;
+  released_ms = millis();
+  for (size_t i = 0; i < lightCount(); ++i) {
+    requestPreset(lights[i], click_count % color_count, input_us);
+  }
+  click_count++;
+}
+
+/* Decode what has arrived, up to SERIAL_BUDGET bytes */
+static void pollSerial() {
+  uint8_t rx[64];
+  for (size_t budget = SERIAL_BUDGET; budget && Serial.available();) {
+    const size_t length = Serial.read(rx, min(sizeof(rx), budget));
+    serial_input_us = micros();
+    lamp_proto_decoder_feed(&decoder, rx, length, handleFrame, nullptr);
+    budget -= length;
   }
 }
+
+static void pollTelemetry() {
+  if (telemetry_period_ms &&
+      millis() - telemetry_sent_ms >= telemetry_period_ms) {
+    telemetry_sent_ms = millis();
+    sendTelemetry();
+  }
+}
+
+void loop() {
+  pollBound();
+  pollButton();
+  pollSerial();
+  runQueue();
+  pollTelemetry();
+}
@@ -0,0 +1,303 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Lamp controller serial protocol
+ *
+ * This example code is in the Public Domain (or CC0 licensed, at your option.)
+ *
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#include <string.h>
+#include "lamp_protocol.h"
+
+/**
+ * @brief:
+ * The decoder scans received bytes where they are: anything before a sync
+ * byte is skipped, a candidate with a good CRC is handed to the callback
+ * straight out of the caller's buffer, and a bad candidate gives up only its
+ * sync byte, so a frame hidden inside a corrupted one is still found. Only a
+ * candidate cut off at the end of a read is copied, into a buffer of one
+ * frame, and the next read completes it with just the bytes it lacks before
+ * scanning in place again. A partial candidate starts with a sync byte and,
+ * once it has one, a possible length, so it always fits the buffer.
+ *
+ * The sequencer only needs the expected sequence number and the statuses of
+ * the frames just before it: a host never has more than a window outstanding,
+ * so a duplicate is at most a window behind, and twice that tolerates a host
+ * that resends a full window while the ACKs of the previous one are in flight.
+ *
+ * The CRC uses a 16-entry table, two lookups per byte: 32 bytes of flash
+ * instead of 512, and still cheap next to the UART.
+ */
+
+_Static_assert(LAMP_PROTO_MAX_PAYLOAD + 2 <= UINT8_MAX, "length is one byte");
+_Static_assert(LAMP_PROTO_TELEMETRY_SIZE <= LAMP_PROTO_MAX_PAYLOAD, "telemetry fits in a frame");
+_Static_assert(LAMP_PROTO_HISTORY < 128, "duplicates are told from frames ahead by half the sequence space");
+
+static const uint16_t s_crc_nibble[16] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+    0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef,
+};
+
+/* record size by op, including op and target */
+static const uint8_t s_record_size[] = {
+    [LAMP_PROTO_OP_LEVEL] = 3,
+    [LAMP_PROTO_OP_RGB] = 5,
+    [LAMP_PROTO_OP_XY] = 6,
+    [LAMP_PROTO_OP_MIREDS] = 4,
+    [LAMP_PROTO_OP_PRESET] = 3,
+};
+
+uint16_t lamp_proto_crc16(uint16_t crc, const void *data, size_t len)
+{
+    const uint8_t *bytes = data;
+    while (len--) {
+        const uint8_t byte = *bytes++;
+        crc = (uint16_t)(crc << 4) ^ s_crc_nibble[(crc >> 12) ^ (byte >> 4)];
+        crc = (uint16_t)(crc << 4) ^ s_crc_nibble[(crc >> 12) ^ (byte & 0x0f)];
+    }
+    return crc;
+}
+
+static void put_u16(uint8_t *out, uint16_t value)
+{
+    out[0] = (uint8_t)value;
+    out[1] = (uint8_t)(value >> 8);
+}
+
+static void put_u32(uint8_t *out, uint32_t value)
+{
+    put_u16(out, (uint16_t)value);
+    put_u16(out + 2, (uint16_t)(value >> 16));
+}
+
+static uint16_t get_u16(const uint8_t *data)
+{
+    return (uint16_t)(data[0] | data[1] << 8);
+}
+
+static uint32_t get_u32(const uint8_t *data)
+{
+    return get_u16(data) | (uint32_t)get_u16(data + 2) << 16;
+}
+
+size_t lamp_proto_encode(uint8_t *out, size_t size, uint8_t type, uint8_t seq, const void *payload, size_t length)
+{
+    if (length > LAMP_PROTO_MAX_PAYLOAD || size < length + LAMP_PROTO_OVERHEAD) {
+        return 0;
+    }
+    out[0] = LAMP_PROTO_SYNC;
+    out[1] = (uint8_t)(length + 2);
+    out[2] = type;
+    out[3] = seq;
+    if (length) {
+        memcpy(out + 4, payload, length);
+    }
+    put_u16(out + 4 + length, lamp_proto_crc16(LAMP_PROTO_CRC_INIT, out + 1, length + 3));
+    return length + LAMP_PROTO_OVERHEAD;
+}
+
+void lamp_proto_decoder_init(lamp_proto_decoder_t *decoder)
+{
+    memset(decoder, 0, sizeof(*decoder));
+}
+
+/* Hand over every complete frame in buf; returns the bytes consumed, the rest is a partial candidate */
+static size_t decoder_scan(lamp_proto_decoder_t *decoder, const uint8_t *buf, size_t len, lamp_proto_frame_cb_t cb,
+                           void *ctx)
+{
+    size_t start = 0;
+    while (start < len) {
+        if (buf[start] != LAMP_PROTO_SYNC) {
+            start++;
+            decoder->skipped++;
+            continue;
+        }
+        if (len - start < 2) {
+            break;
+        }
+        const uint8_t body = buf[start + 1];
+        if (body < 2 || body > LAMP_PROTO_MAX_PAYLOAD + 2) {
+            start++;
+            decoder->bad_frames++;
+            continue;
+        }
+        if (len - start < (size_t)body + 4) {
+            break;
+        }
+        if (lamp_proto_crc16(LAMP_PROTO_CRC_INIT, buf + start + 1, body + 1) != get_u16(buf + start + 2 + body)) {
+            start++;
+            decoder->bad_frames++;
+            continue;
+        }
+        const lamp_proto_frame_t frame = {
+            .type = buf[start + 2],
+            .seq = buf[start + 3],
+            .length = (uint8_t)(body - 2),
+            .payload = buf + start + 4,
+        };
+        decoder->frames++;
+        cb(&frame, ctx);
+        start += body + 4;
+    }
+    return start;
+}
+
+void lamp_proto_decoder_feed(lamp_proto_decoder_t *decoder, const uint8_t *data, size_t len, lamp_proto_frame_cb_t cb,
+                             void *ctx)
+{
+    while (len) {
+        if (!decoder->len) {
+            const size_t used = decoder_scan(decoder, data, len, cb, ctx);
+            memcpy(decoder->buf, data + used, len - used);
+            decoder->len = (uint16_t)(len - used);
+            return;
+        }
+        /* complete the buffered candidate with just the bytes it lacks */
+        size_t chunk = decoder->len < 2 ? 1 : (size_t)decoder->buf[1] + 4 - decoder->len;
+        if (chunk > len) {
+            chunk = len;
+        }
+        memcpy(decoder->buf + decoder->len, data, chunk);
+        decoder->len += chunk;
+        data += chunk;
+        len -= chunk;
+        const size_t used = decoder_scan(decoder, decoder->buf, decoder->len, cb, ctx);
+        decoder->len -= used;
+        memmove(decoder->buf, decoder->buf + used, decoder->len);
+    }
+}
+
+void lamp_proto_sequencer_init(lamp_proto_sequencer_t *sequencer)
+{
+    memset(sequencer, 0, sizeof(*sequencer));
+}
+
+lamp_proto_order_t lamp_proto_sequence_check(lamp_proto_sequencer_t *sequencer, const lamp_proto_frame_t *frame,
+                                             uint8_t *status)
+{
+    if (!sequencer->synced || frame->type == LAMP_PROTO_HELLO || frame->seq == sequencer->expected) {
+        return LAMP_PROTO_FRAME_NEW;
+    }
+    const uint8_t behind = (uint8_t)(sequencer->expected - frame->seq);
+    if (behind <= LAMP_PROTO_HISTORY) {
+        sequencer->duplicates++;
+        *status = sequencer->status[frame->seq % LAMP_PROTO_HISTORY];
+        return LAMP_PROTO_FRAME_DUPLICATE;
+    }
+    sequencer->out_of_order++;
+    return LAMP_PROTO_FRAME_OUT_OF_ORDER;
+}
+
+void lamp_proto_sequence_commit(lamp_proto_sequencer_t *sequencer, uint8_t seq, uint8_t status)
+{
+    sequencer->synced = true;
+    sequencer->expected = (uint8_t)(seq + 1);
+    sequencer->status[seq % LAMP_PROTO_HISTORY] = status;
+}
+
+size_t lamp_proto_record_size(uint8_t op)
+{
+    return op < sizeof(s_record_size) ? s_record_size[op] : 0;
+}
+
+size_t lamp_proto_put_record(uint8_t *out, size_t size, const lamp_proto_record_t *record)
+{
+    const size_t record_size = lamp_proto_record_size(record->op);
+    if (!record_size || record_size > size) {
+        return 0;
+    }
+    out[0] = record->op;
+    out[1] = record->target;
+    switch (record->op) {
+    case LAMP_PROTO_OP_LEVEL:
+        out[2] = record->level;
+        break;
+    case LAMP_PROTO_OP_RGB:
+        memcpy(out + 2, record->rgb, 3);
+        break;
+    case LAMP_PROTO_OP_XY:
+        put_u16(out + 2, record->x);
+        put_u16(out + 4, record->y);
+        break;
+    case LAMP_PROTO_OP_MIREDS:
+        put_u16(out + 2, record->mireds);
+        break;
+    case LAMP_PROTO_OP_PRESET:
+        out[2] = record->preset;
+        break;
+    }
+    return record_size;
+}
+
+size_t lamp_proto_get_record(const uint8_t *data, size_t len, lamp_proto_record_t *record)
+{
+    if (len < 2) {
+        return 0;
+    }
+    const size_t record_size = lamp_proto_record_size(data[0]);
+    if (!record_size || record_size > len) {
+        return 0;
+    }
+    memset(record, 0, sizeof(*record));
+    record->op = data[0];
+    record->target = data[1];
+    switch (record->op) {
+    case LAMP_PROTO_OP_LEVEL:
+        record->level = data[2];
+        break;
+    case LAMP_PROTO_OP_RGB:
+        memcpy(record->rgb, data + 2, 3);
+        break;
+    case LAMP_PROTO_OP_XY:
+        record->x = get_u16(data + 2);
+        record->y = get_u16(data + 4);
+        break;
+    case LAMP_PROTO_OP_MIREDS:
+        record->mireds = get_u16(data + 2);
+        break;
+    case LAMP_PROTO_OP_PRESET:
+        record->preset = data[2];
+        break;
+    }
+    return record_size;
+}
+
+void lamp_proto_put_telemetry(uint8_t *out, const lamp_proto_telemetry_t *telemetry)
+{
+    put_u32(out, telemetry->uptime_ms);
+    put_u32(out + 4, telemetry->frames);
+    put_u32(out + 8, telemetry->bad_frames);
+    put_u32(out + 12, telemetry->skipped);
+    put_u32(out + 16, telemetry->records);
+    put_u32(out + 20, telemetry->sent);
+    put_u32(out + 24, telemetry->coalesced);
+    put_u32(out + 28, telemetry->duplicates);
+    put_u32(out + 32, telemetry->out_of_order);
+    out[36] = telemetry->lights;
+    put_u32(out + 37, telemetry->latency_last_us);
+    put_u32(out + 41, telemetry->latency_max_us);
+}
+
+bool lamp_proto_get_telemetry(const uint8_t *data, size_t len, lamp_proto_telemetry_t *telemetry)
+{
+    if (len < LAMP_PROTO_TELEMETRY_MIN_SIZE) {
+        return false;
+    }
+    telemetry->uptime_ms = get_u32(data);
+    telemetry->frames = get_u32(data + 4);
+    telemetry->bad_frames = get_u32(data + 8);
+    telemetry->skipped = get_u32(data + 12);
+    telemetry->records = get_u32(data + 16);
+    telemetry->sent = get_u32(data + 20);
+    telemetry->coalesced = get_u32(data + 24);
+    telemetry->duplicates = get_u32(data + 28);
+    telemetry->out_of_order = get_u32(data + 32);
+    telemetry->lights = data[36];
+    telemetry->latency_last_us = len < LAMP_PROTO_TELEMETRY_SIZE ? 0 : get_u32(data + 37);
+    telemetry->latency_max_us = len < LAMP_PROTO_TELEMETRY_SIZE ? 0 : get_u32(data + 41);
+    return true;
+}
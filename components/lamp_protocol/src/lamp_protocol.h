@@ -0,0 +1,243 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Lamp controller serial protocol
+ *
+ * This example code is in the Public Domain (or CC0 licensed, at your option.)
+ *
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Version 2 of the host to controller serial protocol. Every message is a
+ * frame, all integers little endian:
+ *
+ *   sync 0x7e | length | type | sequence | payload (length - 2 bytes) | CRC-16
+ *
+ * length counts type, sequence and payload; the CRC (CCITT, initial 0xffff,
+ * as Python's binascii.crc_hqx(data, 0xffff)) covers length to the end of the
+ * payload. A receiver hunts for the sync byte, and when a candidate frame has
+ * an impossible length or a bad CRC it resumes the hunt one byte after that
+ * sync, so a lost or corrupted byte costs the frame it hit and nothing after.
+ *
+ * The host numbers its frames and may have up to LAMP_PROTO_WINDOW of them
+ * unacknowledged. The controller applies them strictly in sequence, so a
+ * frame sent again after a loss can never undo a newer command, and answers
+ * each with an ACK of the same sequence number:
+ *
+ * - the expected frame is applied and acknowledged with its status;
+ * - a frame seen before (its ACK was lost) is acknowledged again with the
+ *   status it had, and not applied again;
+ * - any other frame follows a lost one; it is acknowledged with
+ *   LAMP_PROTO_ERR_SEQUENCE and the expected sequence number and dropped,
+ *   and the host sends again from the expected frame on (go-back-N).
+ *
+ * A HELLO is always applied and makes its sequence number the current one, as
+ * does whatever frame comes first after a reset; a host starts with a HELLO.
+ */
+
+#define LAMP_PROTO_VERSION          2
+
+#define LAMP_PROTO_SYNC             0x7e
+
+/* payload bytes a frame may carry; keeps the controller's receive buffer small */
+#define LAMP_PROTO_MAX_PAYLOAD      120
+
+/* sync, length, type, sequence and CRC */
+#define LAMP_PROTO_OVERHEAD         6
+#define LAMP_PROTO_MAX_FRAME        (LAMP_PROTO_MAX_PAYLOAD + LAMP_PROTO_OVERHEAD)
+
+/* frames the host may have unacknowledged; the controller's serial receive buffer holds this many */
+#define LAMP_PROTO_WINDOW           8
+
+#define LAMP_PROTO_CRC_INIT         0xffff
+
+/* record target meaning every light */
+#define LAMP_PROTO_TARGET_ALL       0xff
+
+typedef enum {
+    /* host to controller */
+    LAMP_PROTO_HELLO = 0x01,            /* empty, acknowledged with version, max payload and window */
+    LAMP_PROTO_COMMANDS = 0x02,         /* one or more command records, applied all or none */
+    LAMP_PROTO_TELEMETRY_PERIOD = 0x03, /* u16 milliseconds between telemetry frames, 0 stops them */
+    /* controller to host */
+    LAMP_PROTO_ACK = 0x81,              /* status, then data of the acknowledged frame type */
+    LAMP_PROTO_TELEMETRY = 0x82,        /* lamp_proto_telemetry_t, own sequence numbers */
+    LAMP_PROTO_LOG = 0x83,              /* one line of text without newline, own sequence numbers */
+} lamp_proto_type_t;
+
+typedef enum {
+    LAMP_PROTO_OK = 0,
+    LAMP_PROTO_ERR_TYPE,                /* unknown frame type */
+    LAMP_PROTO_ERR_MALFORMED,           /* payload of the wrong size, unknown or truncated record */
+    LAMP_PROTO_ERR_TARGET,              /* a record addresses a light or preset that does not exist */
+    LAMP_PROTO_ERR_SEQUENCE,            /* not the expected frame and dropped; data: expected sequence */
+} lamp_proto_status_t;
+
+/* command records: op, target (light index or LAMP_PROTO_TARGET_ALL), arguments */
+typedef enum {
+    LAMP_PROTO_OP_LEVEL = 0x01,         /* level */
+    LAMP_PROTO_OP_RGB = 0x02,           /* r, g, b */
+    LAMP_PROTO_OP_XY = 0x03,            /* u16 x, u16 y in CIE xy * 65536 */
+    LAMP_PROTO_OP_MIREDS = 0x04,        /* u16 color temperature */
+    LAMP_PROTO_OP_PRESET = 0x05,        /* preset index */
+} lamp_proto_op_t;
+
+typedef struct {
+    uint8_t op;                 /* lamp_proto_op_t */
+    uint8_t target;
+    uint8_t level;
+    uint8_t rgb[3];
+    uint16_t x;
+    uint16_t y;
+    uint16_t mireds;
+    uint8_t preset;
+} lamp_proto_record_t;
+
+/* data of the ACK of a HELLO, after the status */
+#define LAMP_PROTO_HELLO_ACK_SIZE   3   /* version, max payload, window */
+
+typedef struct {
+    uint32_t uptime_ms;
+    uint32_t frames;            /* good frames received */
+    uint32_t bad_frames;        /* candidate frames rejected for their length or CRC */
+    uint32_t skipped;           /* bytes skipped while hunting for a sync byte */
+    uint32_t records;           /* command records accepted */
+    uint32_t sent;              /* Zigbee commands sent */
+    uint32_t coalesced;         /* records overtaken by a newer one before they were sent */
+    uint32_t duplicates;        /* frames received again after their ACK was lost */
+    uint32_t out_of_order;      /* frames dropped because an earlier one was lost */
+    uint8_t lights;             /* lights that can be addressed, indexes 0..lights - 1 */
+    uint32_t latency_last_us;   /* input to Zigbee send of the latest command */
+    uint32_t latency_max_us;    /* worst input to Zigbee send since boot */
+} lamp_proto_telemetry_t;
+
+#define LAMP_PROTO_TELEMETRY_SIZE   45
+/* telemetry without the latency fields, as first sent by version 2 controllers */
+#define LAMP_PROTO_TELEMETRY_MIN_SIZE   37
+
+typedef struct {
+    uint8_t type;               /* lamp_proto_type_t */
+    uint8_t seq;
+    uint8_t length;             /* of the payload */
+    const uint8_t *payload;     /* valid during the callback only */
+} lamp_proto_frame_t;
+
+typedef void (*lamp_proto_frame_cb_t)(const lamp_proto_frame_t *frame, void *ctx);
+
+typedef struct {
+    uint8_t buf[LAMP_PROTO_MAX_FRAME];
+    uint16_t len;
+    uint32_t frames;
+    uint32_t bad_frames;
+    uint32_t skipped;
+} lamp_proto_decoder_t;
+
+typedef enum {
+    LAMP_PROTO_FRAME_NEW,               /* apply it, then lamp_proto_sequence_commit() */
+    LAMP_PROTO_FRAME_DUPLICATE,         /* acknowledge with the remembered status only */
+    LAMP_PROTO_FRAME_OUT_OF_ORDER,      /* acknowledge with LAMP_PROTO_ERR_SEQUENCE only */
+} lamp_proto_order_t;
+
+/* frames behind the expected one that are recognized as duplicates */
+#define LAMP_PROTO_HISTORY          (2 * LAMP_PROTO_WINDOW)
+
+typedef struct {
+    bool synced;
+    uint8_t expected;
+    uint8_t status[LAMP_PROTO_HISTORY]; /* by sequence number modulo the history */
+    uint32_t duplicates;
+    uint32_t out_of_order;
+} lamp_proto_sequencer_t;
+
+/**
+ * @brief Continue a CRC-16/CCITT over more bytes, starting from LAMP_PROTO_CRC_INIT
+ */
+uint16_t lamp_proto_crc16(uint16_t crc, const void *data, size_t len);
+
+/**
+ * @brief Write a frame
+ *
+ * @return bytes written, 0 if the payload is too long or the frame does not fit in size.
+ */
+size_t lamp_proto_encode(uint8_t *out, size_t size, uint8_t type, uint8_t seq, const void *payload, size_t length);
+
+/**
+ * @brief Reset a decoder and its counters
+ */
+void lamp_proto_decoder_init(lamp_proto_decoder_t *decoder);
+
+/**
+ * @brief Decode received bytes, calling cb for every good frame they complete
+ *
+ * Bytes may arrive in pieces of any size; frames are decoded in place in data, only a partial frame at the
+ * end is copied and kept for the next call.
+ */
+void lamp_proto_decoder_feed(lamp_proto_decoder_t *decoder, const uint8_t *data, size_t len, lamp_proto_frame_cb_t cb,
+                             void *ctx);
+
+/**
+ * @brief Forget the sequence, so the next frame sets it
+ */
+void lamp_proto_sequencer_init(lamp_proto_sequencer_t *sequencer);
+
+/**
+ * @brief Decide what to do with a received host frame
+ *
+ * @param status    for a duplicate, the status it was acknowledged with.
+ */
+lamp_proto_order_t lamp_proto_sequence_check(lamp_proto_sequencer_t *sequencer, const lamp_proto_frame_t *frame,
+                                             uint8_t *status);
+
+/**
+ * @brief Remember the status a new frame was acknowledged with and expect the next one
+ */
+void lamp_proto_sequence_commit(lamp_proto_sequencer_t *sequencer, uint8_t seq, uint8_t status);
+
+/**
+ * @brief Bytes a record of this op takes, including op and target; 0 for an unknown op
+ */
+size_t lamp_proto_record_size(uint8_t op);
+
+/**
+ * @brief Append a command record to a COMMANDS payload
+ *
+ * @return bytes written, 0 for an unknown op or if the record does not fit in size.
+ */
+size_t lamp_proto_put_record(uint8_t *out, size_t size, const lamp_proto_record_t *record);
+
+/**
+ * @brief Read the command record at the start of data
+ *
+ * @return bytes read, 0 for an unknown op or a truncated record.
+ */
+size_t lamp_proto_get_record(const uint8_t *data, size_t len, lamp_proto_record_t *record);
+
+/**
+ * @brief Write a TELEMETRY payload of LAMP_PROTO_TELEMETRY_SIZE bytes
+ */
+void lamp_proto_put_telemetry(uint8_t *out, const lamp_proto_telemetry_t *telemetry);
+
+/**
+ * @brief Read a TELEMETRY payload
+ *
+ * @return false if it is shorter than LAMP_PROTO_TELEMETRY_MIN_SIZE; fields it lacks read as 0, longer ones
+ *         come from newer controllers.
+ */
+bool lamp_proto_get_telemetry(const uint8_t *data, size_t len, lamp_proto_telemetry_t *telemetry);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,93 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Lamp controller color conversions
+ *
+ * This example code is in the Public Domain (or CC0 licensed, at your option.)
+ *
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#include "light_color.h"
+
+/**
+ * @brief:
+ * The ESP32-C6 and H2 have no FPU, so everything is integer arithmetic.
+ * Linearizing a channel is 32-bit with divisions by a constant, which the
+ * compiler turns into multiplications. XYZ and the locus cubics take 64-bit
+ * products: shifting the XYZ products down to 32 bits would leave a dark
+ * color like #010000 with a handful of significant bits and a chromaticity
+ * far off. What divides by a variable is the two chromaticities (64-bit,
+ * by the XYZ sum) and, for HSV, the hue and saturation (32-bit).
+ */
+
+void light_color_rgb_to_xy(uint8_t r, uint8_t g, uint8_t b, uint16_t *x, uint16_t *y)
+{
+    const uint32_t lr = LIGHT_COLOR_LINEAR(r);
+    const uint32_t lg = LIGHT_COLOR_LINEAR(g);
+    const uint32_t lb = LIGHT_COLOR_LINEAR(b);
+    const uint64_t cx = LIGHT_COLOR_XYZ_X(lr, lg, lb);
+    const uint64_t cy = LIGHT_COLOR_XYZ_Y(lr, lg, lb);
+    const uint64_t sum = cx + cy + LIGHT_COLOR_XYZ_Z(lr, lg, lb);
+    *x = LIGHT_COLOR_CHROMA(cx, sum, LIGHT_COLOR_WHITE_X);
+    *y = LIGHT_COLOR_CHROMA(cy, sum, LIGHT_COLOR_WHITE_Y);
+}
+
+void light_color_rgb_to_hsv(uint8_t r, uint8_t g, uint8_t b, uint8_t *hue, uint8_t *saturation, uint8_t *value)
+{
+    *hue = LIGHT_COLOR_RGB_HUE(r, g, b);
+    *saturation = LIGHT_COLOR_RGB_SATURATION(r, g, b);
+    *value = LIGHT_COLOR_MAX3_(r, g, b);
+}
+
+void light_color_mireds_to_xy(uint16_t mireds, uint16_t *x, uint16_t *y)
+{
+    const int64_t m = LIGHT_COLOR_MIREDS_CLAMP_(mireds);
+    const int64_t locus_x = LIGHT_COLOR_LOCUS_X_(m);
+    *x = (uint16_t)locus_x;
+    *y = (uint16_t)LIGHT_COLOR_LOCUS_Y_(locus_x, m);
+}
+
+/* Twice the signed area of the triangle a, b, p: positive with p left of a to b */
+static int64_t cross(int32_t ax, int32_t ay, int32_t bx, int32_t by, int32_t px, int32_t py)
+{
+    return (int64_t)(bx - ax) * (py - ay) - (int64_t)(by - ay) * (px - ax);
+}
+
+bool light_color_clamp_xy(const light_color_gamut_t *gamut, uint16_t *x, uint16_t *y)
+{
+    const int32_t px = *x;
+    const int32_t py = *y;
+    int negative = 0;
+    int positive = 0;
+    for (int i = 0; i < 3; ++i) {
+        const int j = (i + 1) % 3;
+        const int64_t side = cross(gamut->x[i], gamut->y[i], gamut->x[j], gamut->y[j], px, py);
+        negative += side < 0;
+        positive += side > 0;
+    }
+    if (!negative || !positive) {
+        return false;
+    }
+    /* outside: the nearest point of the nearest edge */
+    int64_t best_d2 = INT64_MAX;
+    for (int i = 0; i < 3; ++i) {
+        const int j = (i + 1) % 3;
+        const int32_t ax = gamut->x[i], ay = gamut->y[i];
+        const int32_t dx = gamut->x[j] - ax, dy = gamut->y[j] - ay;
+        const int64_t len2 = (int64_t)dx * dx + (int64_t)dy * dy;
+        int64_t t = (int64_t)(px - ax) * dx + (int64_t)(py - ay) * dy;
+        t = t < 0 ? 0 : t > len2 ? len2 : t;
+        const int32_t qx = len2 ? ax + (int32_t)(dx * t / len2) : ax;
+        const int32_t qy = len2 ? ay + (int32_t)(dy * t / len2) : ay;
+        const int64_t d2 = (int64_t)(px - qx) * (px - qx) + (int64_t)(py - qy) * (py - qy);
+        if (d2 < best_d2) {
+            best_d2 = d2;
+            *x = (uint16_t)qx;
+            *y = (uint16_t)qy;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,154 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Lamp controller color conversions
+ *
+ * This example code is in the Public Domain (or CC0 licensed, at your option.)
+ *
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Integer-only conversions to the units of the ZCL Color Control cluster:
+ * CIE x and y times 65536 (at most LIGHT_COLOR_XY_MAX), hue and saturation
+ * 0..254. RGB is 8-bit sRGB. The macros are integer constant expressions, so
+ * preset tables written with them are computed by the compiler; the
+ * functions run the same arithmetic, so both give identical results.
+ *
+ * Accuracy against the exact sRGB curve and matrix, and against the Kim et
+ * al. Planckian locus fit, is measured by the lamp_color_bench host tool.
+ */
+
+#define LIGHT_COLOR_XY_MAX          65279
+
+/* D65 white, used for black, which has no chromaticity */
+#define LIGHT_COLOR_WHITE_X         20493
+#define LIGHT_COLOR_WHITE_Y         21561
+
+/* color temperatures the locus fit covers: 25000 K to 1667 K */
+#define LIGHT_COLOR_MIREDS_MIN      40
+#define LIGHT_COLOR_MIREDS_MAX      600
+
+/*
+ * sRGB channel to linear light, 65536 for full: linear below 11 as the sRGB
+ * curve, a quartic fit above, within 0.4% of the curve.
+ */
+#define LIGHT_COLOR_LINEAR(c)                                                                   \
+    ((uint32_t)((c) <= 10 ? (int32_t)(c) * 5093 / 256                                          \
+                          : ((((-8779 * (int32_t)(c) / 255 + 36149) * (int32_t)(c) / 255 + 36047) \
+                              * (int32_t)(c) / 255 + 1942) * (int32_t)(c) / 255 + 66)))
+
+/* linear sRGB to CIE XYZ (D65), 2^32 for full; kept whole so dark colors keep their chromaticity */
+#define LIGHT_COLOR_XYZ_X(lr, lg, lb)   (27027ULL * (lr) + 23436ULL * (lg) + 11829ULL * (lb))
+#define LIGHT_COLOR_XYZ_Y(lr, lg, lb)   (13933ULL * (lr) + 46871ULL * (lg) + 4732ULL * (lb))
+#define LIGHT_COLOR_XYZ_Z(lr, lg, lb)   (1265ULL * (lr) + 7812ULL * (lg) + 62292ULL * (lb))
+
+/* one chromaticity coordinate from a tristimulus value and the sum of all three */
+#define LIGHT_COLOR_CHROMA(v, sum, white)                                                       \
+    ((uint16_t)((sum) == 0 ? (white)                                                            \
+                : ((uint64_t)(v) << 16) / (sum) > LIGHT_COLOR_XY_MAX ? LIGHT_COLOR_XY_MAX        \
+                : ((uint64_t)(v) << 16) / (sum)))
+
+#define LIGHT_COLOR_RGB_SUM_(lr, lg, lb) \
+    (LIGHT_COLOR_XYZ_X(lr, lg, lb) + LIGHT_COLOR_XYZ_Y(lr, lg, lb) + LIGHT_COLOR_XYZ_Z(lr, lg, lb))
+#define LIGHT_COLOR_LINEAR_X_(lr, lg, lb) \
+    LIGHT_COLOR_CHROMA(LIGHT_COLOR_XYZ_X(lr, lg, lb), LIGHT_COLOR_RGB_SUM_(lr, lg, lb), LIGHT_COLOR_WHITE_X)
+#define LIGHT_COLOR_LINEAR_Y_(lr, lg, lb) \
+    LIGHT_COLOR_CHROMA(LIGHT_COLOR_XYZ_Y(lr, lg, lb), LIGHT_COLOR_RGB_SUM_(lr, lg, lb), LIGHT_COLOR_WHITE_Y)
+
+/* CIE x and y of an sRGB color */
+#define LIGHT_COLOR_RGB_X(r, g, b) \
+    LIGHT_COLOR_LINEAR_X_(LIGHT_COLOR_LINEAR(r), LIGHT_COLOR_LINEAR(g), LIGHT_COLOR_LINEAR(b))
+#define LIGHT_COLOR_RGB_Y(r, g, b) \
+    LIGHT_COLOR_LINEAR_Y_(LIGHT_COLOR_LINEAR(r), LIGHT_COLOR_LINEAR(g), LIGHT_COLOR_LINEAR(b))
+
+#define LIGHT_COLOR_MAX3_(a, b, c)  ((a) > (b) ? ((a) > (c) ? (a) : (c)) : ((b) > (c) ? (b) : (c)))
+#define LIGHT_COLOR_MIN3_(a, b, c)  ((a) < (b) ? ((a) < (c) ? (a) : (c)) : ((b) < (c) ? (b) : (c)))
+
+/* hue in sixths of the circle times the chroma, 0..6 * chroma */
+#define LIGHT_COLOR_HUE6_(r, g, b, max, chroma)                                                 \
+    ((max) == (r) ? ((int32_t)(g) - (int32_t)(b) + 6 * (int32_t)(chroma)) % (6 * (int32_t)(chroma)) \
+     : (max) == (g) ? (int32_t)(b) - (int32_t)(r) + 2 * (int32_t)(chroma)                       \
+     : (int32_t)(r) - (int32_t)(g) + 4 * (int32_t)(chroma))
+
+/* HSV of an sRGB color: hue 0..253 around the circle, saturation 0..254, value is the largest channel */
+#define LIGHT_COLOR_RGB_HUE(r, g, b)                                                            \
+    ((uint8_t)(LIGHT_COLOR_MAX3_(r, g, b) == LIGHT_COLOR_MIN3_(r, g, b) ? 0                     \
+               : ((LIGHT_COLOR_HUE6_(r, g, b, LIGHT_COLOR_MAX3_(r, g, b),                        \
+                                     LIGHT_COLOR_MAX3_(r, g, b) - LIGHT_COLOR_MIN3_(r, g, b)) * 254 \
+                   + 3 * (LIGHT_COLOR_MAX3_(r, g, b) - LIGHT_COLOR_MIN3_(r, g, b)))               \
+                  / (6 * (LIGHT_COLOR_MAX3_(r, g, b) - LIGHT_COLOR_MIN3_(r, g, b)))) % 254))
+#define LIGHT_COLOR_RGB_SATURATION(r, g, b)                                                     \
+    ((uint8_t)(LIGHT_COLOR_MAX3_(r, g, b) == 0 ? 0                                              \
+               : ((LIGHT_COLOR_MAX3_(r, g, b) - LIGHT_COLOR_MIN3_(r, g, b)) * 254                \
+                  + LIGHT_COLOR_MAX3_(r, g, b) / 2) / LIGHT_COLOR_MAX3_(r, g, b)))
+
+/*
+ * Planckian locus, Kim et al. cubic fit, evaluated in mireds: x as a cubic of
+ * the mireds with coefficients scaled by 2^40, y as a cubic of x in 1/65536.
+ */
+#define LIGHT_COLOR_MIREDS_CLAMP_(m)                                                            \
+    ((int64_t)((m) < LIGHT_COLOR_MIREDS_MIN ? LIGHT_COLOR_MIREDS_MIN                            \
+               : (m) > LIGHT_COLOR_MIREDS_MAX ? LIGHT_COLOR_MIREDS_MAX : (m)))
+#define LIGHT_COLOR_LOCUS_X_(m)                                                                 \
+    ((m) >= 250 ? (((-293 * (m) - 257680) * (m) + 965036518) * (m) + 197813136953) / 16777216 \
+                : (((-3327 * (m) + 2316713) * (m) + 244789441) * (m) + 264311600201) / 16777216)
+#define LIGHT_COLOR_LOCUS_Y_(x, m)                                                              \
+    ((m) >= 450 ? (((-72508 * (x) / 65536 - 88350) * (x) / 65536 + 143233) * (x) / 65536 - 13251) \
+     : (m) >= 250 ? (((-62583 * (x) / 65536 - 90059) * (x) / 65536 + 137060) * (x) / 65536 - 10977) \
+                  : (((201966 * (x) / 65536 - 384918) * (x) / 65536 + 245834) * (x) / 65536 - 24249))
+
+/* CIE x and y of a white of this color temperature, in mireds (1e6 / kelvin) */
+#define LIGHT_COLOR_MIREDS_X(mireds) \
+    ((uint16_t)LIGHT_COLOR_LOCUS_X_(LIGHT_COLOR_MIREDS_CLAMP_(mireds)))
+#define LIGHT_COLOR_MIREDS_Y(mireds)                                                            \
+    ((uint16_t)LIGHT_COLOR_LOCUS_Y_(LIGHT_COLOR_LOCUS_X_(LIGHT_COLOR_MIREDS_CLAMP_(mireds)),   \
+                                    LIGHT_COLOR_MIREDS_CLAMP_(mireds)))
+
+/* triangle of the red, green and blue primaries a light can show */
+typedef struct {
+    uint16_t x[3];
+    uint16_t y[3];
+} light_color_gamut_t;
+
+/* sRGB primaries, for lights that do not tell theirs */
+#define LIGHT_COLOR_GAMUT_SRGB      {.x = {41943, 19661, 9830}, .y = {21627, 39322, 3932}}
+
+/**
+ * @brief CIE x and y of an sRGB color, as LIGHT_COLOR_RGB_X() and LIGHT_COLOR_RGB_Y()
+ */
+void light_color_rgb_to_xy(uint8_t r, uint8_t g, uint8_t b, uint16_t *x, uint16_t *y);
+
+/**
+ * @brief Hue and saturation in ZCL units and the HSV value of an sRGB color
+ */
+void light_color_rgb_to_hsv(uint8_t r, uint8_t g, uint8_t b, uint8_t *hue, uint8_t *saturation, uint8_t *value);
+
+/**
+ * @brief CIE x and y of a white, as LIGHT_COLOR_MIREDS_X() and LIGHT_COLOR_MIREDS_Y()
+ *
+ * @param mireds    color temperature, clamped to LIGHT_COLOR_MIREDS_MIN..LIGHT_COLOR_MIREDS_MAX.
+ */
+void light_color_mireds_to_xy(uint16_t mireds, uint16_t *x, uint16_t *y);
+
+/**
+ * @brief Move a color outside a gamut to the nearest color on its edge
+ *
+ * @return true if the color was outside and moved.
+ */
+bool light_color_clamp_xy(const light_color_gamut_t *gamut, uint16_t *x, uint16_t *y);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
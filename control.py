@@ -1,41 +1,259 @@
-import serial
-import time
+"""Drive the lamp controller over serial protocol v2.
+
+Both the Arduino sketch and the ESP-IDF firmware (on its USB serial/JTAG port,
+see main/lamp_serial.h) speak it; give the port as the first argument. This
+script holds the port for as long as it runs; to share the controller between
+several programs run host_bridge's lampd instead, which owns the port and
+serves commands to any number of clients on a Unix socket.
+
+Frames, records and the acknowledgement rules are described in
+components/lamp_protocol/src/lamp_protocol.h. Commands are batched into as
+few frames as fit and pipelined with a window of unacknowledged frames; a
+reader thread handles acknowledgements, sends again from a lost frame on, and
+prints log lines and telemetry from the controller.
+"""
+
+import binascii
 import struct
+import sys
+import threading
+import time
+
+import serial
+
+SYNC = 0x7E
+MAX_PAYLOAD = 120
+
+HELLO, COMMANDS, TELEMETRY_PERIOD = 0x01, 0x02, 0x03
+ACK, TELEMETRY, LOG = 0x81, 0x82, 0x83
+
+OK, ERR_TYPE, ERR_MALFORMED, ERR_TARGET, ERR_SEQUENCE = range(5)
+STATUS_NAMES = ["ok", "unknown type", "malformed", "no such light or preset", "out of sequence"]
+
+OP_LEVEL, OP_RGB, OP_XY, OP_MIREDS, OP_PRESET = range(1, 6)
+ALL = 0xFF
+
+TELEMETRY_FORMAT = "<9IB2I"
+TELEMETRY_FIELDS = ("uptime_ms", "frames", "bad_frames", "skipped", "records", "sent", "coalesced",
+                    "duplicates", "out_of_order", "lights", "latency_last_us", "latency_max_us")
+TELEMETRY_MIN_SIZE = 37
+
+
+def encode(frame_type, seq, payload=b""):
+    body = bytes([len(payload) + 2, frame_type, seq]) + payload
+    return bytes([SYNC]) + body + struct.pack("<H", binascii.crc_hqx(body, 0xFFFF))
+
+
+class Decoder:
+    """Resynchronizing frame decoder, as lamp_proto_decoder_feed()."""
+
+    def __init__(self):
+        self.buf = bytearray()
+        self.bad_frames = 0
+
+    def feed(self, data):
+        self.buf += data
+        frames = []
+        start = 0
+        while True:
+            start = self.buf.find(SYNC, start)
+            if start < 0:
+                start = len(self.buf)
+                break
+            if len(self.buf) - start < 2:
+                break
+            body = self.buf[start + 1]
+            if body < 2 or body > MAX_PAYLOAD + 2:
+                self.bad_frames += 1
+                start += 1
+                continue
+            if len(self.buf) - start < body + 4:
+                break
+            end = start + 2 + body
+            crc, = struct.unpack_from("<H", self.buf, end)
+            if binascii.crc_hqx(bytes(self.buf[start + 1:end]), 0xFFFF) != crc:
+                self.bad_frames += 1
+                start += 1
+                continue
+            frames.append((self.buf[start + 2], self.buf[start + 3], bytes(self.buf[start + 4:end])))
+            start = end + 2
+        del self.buf[:start]
+        return frames
+
+
+def level(value, target=ALL):
+    return struct.pack("<BBB", OP_LEVEL, target, value)
+
+
+def rgb(r, g, b, target=ALL):
+    return struct.pack("<BBBBB", OP_RGB, target, r, g, b)
+
+
+def xy(x, y, target=ALL):
+    return struct.pack("<BBHH", OP_XY, target, x, y)
+
+
+def mireds(value, target=ALL):
+    return struct.pack("<BBH", OP_MIREDS, target, value)
+
+
+def preset(index, target=ALL):
+    return struct.pack("<BBB", OP_PRESET, target, index)
+
+
+class Lamp:
+    def __init__(self, port, timeout=0.2, on_telemetry=None):
+        self.port = port
+        self.timeout = timeout
+        self.on_telemetry = on_telemetry or (lambda t: print("telemetry", t))
+        self.window = 1
+        self.decoder = Decoder()
+        self.lock = threading.Condition()
+        # frames are numbered from 0, sequence numbers are the number modulo 256
+        self.frames = {}  # number -> [encoded frame, time sent]
+        self.base = 0  # oldest unacknowledged
+        self.next = 0  # next to send, lower after a go-back
+        self.built = 0  # frames numbered so far
+        self.goback = None  # (frame gone back to, last frame reporting it)
+        self.hello_reply = None
+        self.closed = False
+        threading.Thread(target=self._reader, daemon=True).start()
+
+    def hello(self):
+        """Start the sequence at a new frame and learn the controller's window."""
+        with self.lock:
+            self.frames.clear()
+            self.base = self.next = self.built
+            self.hello_reply = None
+            seq = self.built & 0xFF
+            while self.hello_reply is None:
+                self.port.write(encode(HELLO, seq))
+                self.lock.wait(self.timeout)
+            version, max_payload, window = self.hello_reply
+            self.base = self.next = self.built = self.built + 1
+            self.window = window
+        return version
+
+    def commands(self, *records):
+        """Send command records, as many to a frame as fit."""
+        payload = b""
+        for record in records:
+            if len(payload) + len(record) > MAX_PAYLOAD:
+                self._send(COMMANDS, payload)
+                payload = b""
+            payload += record
+        if payload:
+            self._send(COMMANDS, payload)
+
+    def telemetry(self, period_ms):
+        self._send(TELEMETRY_PERIOD, struct.pack("<H", period_ms))
+
+    def flush(self):
+        """Wait until every frame sent is acknowledged."""
+        with self.lock:
+            while self.base < self.built:
+                self.lock.wait(self.timeout)
+                self._check_timeout()
+
+    def _send(self, frame_type, payload):
+        with self.lock:
+            while self.built - self.base >= self.window:
+                self.lock.wait(self.timeout)
+                self._check_timeout()
+            number = self.built
+            self.built += 1
+            self.frames[number] = [encode(frame_type, number & 0xFF, payload), 0.0]
+            self._transmit()
+
+    def _transmit(self):
+        while self.next < self.built:
+            frame = self.frames[self.next]
+            frame[1] = time.monotonic()
+            self.port.write(frame[0])
+            self.next += 1
+
+    def _check_timeout(self):
+        if self.base < self.next and time.monotonic() - self.frames[self.base][1] > self.timeout:
+            self._goback(self.base, self.base)
+
+    def _goback(self, number, reported_by):
+        self.next = number
+        self.goback = (number, reported_by)
+        self._transmit()
 
+    def _number(self, seq):
+        """Frame number of an in-flight frame's sequence number, None if none has it."""
+        number = self.base + ((seq - self.base) & 0xFF)
+        return number if number < self.next else None
 
-def wait():
-    time.sleep(2)
+    def _ack(self, seq, payload):
+        if not payload:
+            return
+        status = payload[0]
+        if self.hello_reply is None and status == OK and len(payload) == 4 and seq == self.built & 0xFF:
+            self.hello_reply = tuple(payload[1:])
+            return
+        number = self._number(seq)
+        if number is None:
+            return
+        if status == ERR_SEQUENCE and len(payload) >= 2:
+            expected = self._number(payload[1])
+            # frames sent before a go-back all report the same expected frame, in increasing order
+            stale = self.goback and self.goback[0] == expected and number > self.goback[1]
+            if expected is not None and not stale:
+                self._goback(expected, number)
+            elif self.goback:
+                self.goback = (self.goback[0], number)
+            return
+        if status != OK:
+            print(f"frame {number}: {STATUS_NAMES[status] if status < len(STATUS_NAMES) else status}")
+        # frames are applied in order, so this acknowledges every earlier one too
+        for done in range(self.base, number + 1):
+            self.frames.pop(done, None)
+        self.base = number + 1
 
+    def _reader(self):
+        while not self.closed:
+            data = self.port.read(self.port.in_waiting or 1)
+            for frame_type, seq, payload in self.decoder.feed(data):
+                if frame_type == ACK:
+                    with self.lock:
+                        self._ack(seq, payload)
+                        self.lock.notify_all()
+                elif frame_type == TELEMETRY and len(payload) >= TELEMETRY_MIN_SIZE:
+                    # controllers without the latency fields send the first 37 bytes only
+                    padded = payload.ljust(struct.calcsize(TELEMETRY_FORMAT), b"\0")
+                    values = struct.unpack_from(TELEMETRY_FORMAT, padded)
+                    self.on_telemetry(dict(zip(TELEMETRY_FIELDS, values)))
+                elif frame_type == LOG:
+                    print("controller:", payload.decode(errors="replace"))
 
-with serial.Serial("/dev/ttyACM1", 115200, exclusive=False) as port:
-    def set_color(r, g, b):
-        print(f"Setting color to {r}, {g}, {b}")
-        port.write(struct.pack("<BBBB", 0, r, g, b))
 
-    def set_level(level):
-        print(f"Setting level: {level}")
-        port.write(struct.pack("<BB", 1, level))
+if __name__ == "__main__":
+    with serial.Serial(sys.argv[1] if len(sys.argv) > 1 else "/dev/ttyACM1", 115200, exclusive=False,
+                       timeout=0.05) as port:
+        lamp = Lamp(port)
+        print(f"protocol version {lamp.hello()}, window {lamp.window}")
 
-    # # port.write(b'red')
-    # # wait()
-    # port.write(b"color")
-    # time.sleep(1)
+        # Day?
+        # lamp.commands(rgb(255, 80, 20))
 
-    # Day?
-    # set_color(255, 80, 20)
+        # Warmer day
+        # lamp.commands(rgb(255, 70, 20))
 
-    # Wramer day
-    # set_color(255, 70, 20)
+        # Afternoon
+        # lamp.commands(rgb(255, 50, 20))
 
-    # Afternoon
-    # set_color(255, 50, 20)
+        # Night?
+        # lamp.commands(rgb(255, 0, 0))
 
-    # Night?
-    # set_color(255, 0, 0)
-    set_level(220)
+        # One frame: a warm white on light 0, a red on light 1, every light to 220
+        # lamp.commands(mireds(370, 0), rgb(255, 0, 0, 1), level(220))
 
+        lamp.commands(level(220))
+        lamp.flush()
 
-    print("reading responses")
-    while True:
-        res = port.readline()
-        print(res)
+        lamp.telemetry(1000)
+        print("reading telemetry and logs")
+        while True:
+            time.sleep(1)
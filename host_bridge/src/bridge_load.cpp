@@ -0,0 +1,292 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Load test of the lamp controller host bridge
+ *
+ * Connects --clients clients to a running lampd at once; each sends
+ * --commands level and color requests spread over --lights lights, with up to
+ * --pipeline of them unanswered, then a sync. Once all are done one more
+ * client sets every light to level 200 and 370 mireds, syncs and prints the
+ * bridge's link counters:
+ *
+ *   lamp_sim --lights 8 --presses 0 --serial-pty --wait-ms 20000 &
+ *   lampd --serial /dev/pts/N --socket /tmp/lampd.sock &
+ *   lamp_bridge_load --socket /tmp/lampd.sock --clients 16 --commands 20000 --lights 8
+ *
+ * This example code is in the Public Domain (or CC0 licensed, at your option.)
+ *
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <getopt.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+struct Options {
+    std::string socket_path;
+    unsigned clients = 8;
+    unsigned commands = 5000;
+    unsigned lights = 4;
+    unsigned pipeline = 32;
+    uint32_t seed = 1;
+};
+
+struct ClientResult {
+    unsigned ok = 0;
+    unsigned errors = 0;
+    std::string sync;               /* reply to the final sync */
+    std::vector<int64_t> round_trips_us;
+    std::string failure;
+};
+
+int64_t now_us()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+uint32_t rng_next(uint32_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+class Connection {
+public:
+    bool open(const std::string &path)
+    {
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path.c_str());
+        m_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        return m_fd >= 0 && connect(m_fd, (const sockaddr *)&addr, sizeof(addr)) == 0;
+    }
+    ~Connection()
+    {
+        if (m_fd >= 0) {
+            close(m_fd);
+        }
+    }
+    bool send_all(const std::string &data)
+    {
+        size_t done = 0;
+        while (done < data.size()) {
+            const ssize_t sent = send(m_fd, data.data() + done, data.size() - done, MSG_NOSIGNAL);
+            if (sent < 0 && errno != EINTR) {
+                return false;
+            }
+            done += sent > 0 ? (size_t)sent : 0;
+        }
+        return true;
+    }
+    bool read_line(std::string *line)
+    {
+        for (;;) {
+            const size_t end = m_in.find('\n');
+            if (end != std::string::npos) {
+                line->assign(m_in, 0, end);
+                m_in.erase(0, end + 1);
+                return true;
+            }
+            char buf[4096];
+            const ssize_t got = recv(m_fd, buf, sizeof(buf), 0);
+            if (got <= 0 && !(got < 0 && errno == EINTR)) {
+                return false;
+            }
+            m_in.append(buf, got > 0 ? (size_t)got : 0);
+        }
+    }
+
+private:
+    int m_fd = -1;
+    std::string m_in;
+};
+
+std::string request(unsigned index, uint32_t *rng, unsigned lights)
+{
+    const unsigned light = rng_next(rng) % lights;
+    const uint32_t value = rng_next(rng);
+    char line[64];
+    switch (index % 4) {
+    case 0:
+        snprintf(line, sizeof(line), "level %u %u\n", (unsigned)(value % 254 + 1), light);
+        break;
+    case 1:
+        snprintf(line, sizeof(line), "xy %u %u %u\n", (unsigned)(value % 40000 + 10000),
+                 (unsigned)((value >> 16) % 40000 + 10000), light);
+        break;
+    case 2:
+        snprintf(line, sizeof(line), "mireds %u %u\n", (unsigned)(value % 347 + 153), light);
+        break;
+    default:
+        snprintf(line, sizeof(line), "rgb %u %u %u %u\n", value & 0xff, (value >> 8) & 0xff, (value >> 16) & 0xff,
+                 light);
+        break;
+    }
+    return line;
+}
+
+void run_client(const Options &options, unsigned number, std::atomic<bool> *go, ClientResult *result)
+{
+    Connection connection;
+    if (!connection.open(options.socket_path)) {
+        result->failure = strerror(errno);
+        return;
+    }
+    uint32_t rng = options.seed * 2654435761u + number + 1;
+    while (!go->load()) {
+        std::this_thread::yield();
+    }
+    std::string line;
+    for (unsigned sent = 0; sent < options.commands;) {
+        const unsigned batch = std::min(options.pipeline, options.commands - sent);
+        std::string requests;
+        for (unsigned i = 0; i < batch; ++i) {
+            requests += request(sent + i, &rng, options.lights);
+        }
+        const int64_t start = now_us();
+        if (!connection.send_all(requests)) {
+            result->failure = "send failed";
+            return;
+        }
+        for (unsigned i = 0; i < batch; ++i) {
+            if (!connection.read_line(&line)) {
+                result->failure = "connection closed";
+                return;
+            }
+            if (line == "ok") {
+                result->ok++;
+            } else {
+                result->errors++;
+            }
+        }
+        result->round_trips_us.push_back(now_us() - start);
+        sent += batch;
+    }
+    if (!connection.send_all("sync\n") || !connection.read_line(&result->sync)) {
+        result->failure = "sync failed";
+    }
+}
+
+int64_t percentile(std::vector<int64_t> values, double fraction)
+{
+    if (values.empty()) {
+        return 0;
+    }
+    std::sort(values.begin(), values.end());
+    return values[std::min(values.size() - 1, (size_t)(fraction * values.size()))];
+}
+
+void usage(const char *prog)
+{
+    printf("usage: %s --socket PATH [options]\n"
+           "  --clients N           clients connected at once (default 8)\n"
+           "  --commands N          requests per client (default 5000)\n"
+           "  --lights N            lights the requests address, 0..N-1 (default 4)\n"
+           "  --pipeline N          requests sent before reading their replies (default 32)\n"
+           "  --seed N              random seed (default 1)\n",
+           prog);
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    enum { OPT_SOCKET = 1, OPT_CLIENTS, OPT_COMMANDS, OPT_LIGHTS, OPT_PIPELINE, OPT_SEED, OPT_HELP };
+    static const struct option long_options[] = {
+        {"socket", required_argument, nullptr, OPT_SOCKET},
+        {"clients", required_argument, nullptr, OPT_CLIENTS},
+        {"commands", required_argument, nullptr, OPT_COMMANDS},
+        {"lights", required_argument, nullptr, OPT_LIGHTS},
+        {"pipeline", required_argument, nullptr, OPT_PIPELINE},
+        {"seed", required_argument, nullptr, OPT_SEED},
+        {"help", no_argument, nullptr, OPT_HELP},
+        {nullptr, 0, nullptr, 0},
+    };
+    Options options;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, nullptr)) != -1) {
+        switch (opt) {
+        case OPT_SOCKET: options.socket_path = optarg; break;
+        case OPT_CLIENTS: options.clients = (unsigned)strtoul(optarg, nullptr, 0); break;
+        case OPT_COMMANDS: options.commands = (unsigned)strtoul(optarg, nullptr, 0); break;
+        case OPT_LIGHTS: options.lights = (unsigned)strtoul(optarg, nullptr, 0); break;
+        case OPT_PIPELINE: options.pipeline = (unsigned)strtoul(optarg, nullptr, 0); break;
+        case OPT_SEED: options.seed = (uint32_t)strtoul(optarg, nullptr, 0); break;
+        case OPT_HELP: usage(argv[0]); return 0;
+        default: usage(argv[0]); return 2;
+        }
+    }
+    if (options.socket_path.empty() || !options.clients || !options.lights || !options.pipeline) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    std::vector<ClientResult> results(options.clients);
+    std::vector<std::thread> threads;
+    std::atomic<bool> go(false);
+    for (unsigned i = 0; i < options.clients; ++i) {
+        threads.emplace_back(run_client, std::cref(options), i, &go, &results[i]);
+    }
+    const int64_t start = now_us();
+    go = true;
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    const double seconds = (now_us() - start) / 1e6;
+
+    unsigned ok = 0, errors = 0, synced = 0, failed = 0;
+    std::vector<int64_t> round_trips;
+    for (const ClientResult &result : results) {
+        ok += result.ok;
+        errors += result.errors;
+        synced += result.sync == "ok";
+        if (!result.failure.empty()) {
+            failed++;
+            fprintf(stderr, "client failed: %s\n", result.failure.c_str());
+        } else if (result.sync != "ok") {
+            fprintf(stderr, "sync: %s\n", result.sync.c_str());
+        }
+        round_trips.insert(round_trips.end(), result.round_trips_us.begin(), result.round_trips_us.end());
+    }
+    printf("%u clients, %u requests in %.3f s: %.0f requests/s, %u errors, %u/%u syncs ok, %u failed\n",
+           options.clients, ok + errors, seconds, (ok + errors) / seconds, errors, synced, options.clients, failed);
+    printf("round trip of %u pipelined requests: p50 %lld us, p99 %lld us, max %lld us\n", options.pipeline,
+           (long long)percentile(round_trips, 0.5), (long long)percentile(round_trips, 0.99),
+           (long long)percentile(round_trips, 1.0));
+
+    Connection control;
+    std::string replies[4];
+    if (!control.open(options.socket_path) || !control.send_all("level 200\nmireds 370\nsync\nstats\n")) {
+        fprintf(stderr, "control connection failed\n");
+        return 1;
+    }
+    for (std::string &reply : replies) {
+        if (!control.read_line(&reply)) {
+            fprintf(stderr, "control connection closed\n");
+            return 1;
+        }
+    }
+    printf("final level 200 and 370 mireds on every light: %s\n", replies[2].c_str());
+    printf("link: %s\n", replies[3].c_str() + (replies[3].compare(0, 3, "ok ") ? 0 : 3));
+    return failed || errors || synced != options.clients || replies[2] != "ok";
+}
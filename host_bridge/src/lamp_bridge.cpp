@@ -0,0 +1,541 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Lamp controller host bridge: Unix socket server
+ *
+ * This example code is in the Public Domain (or CC0 licensed, at your option.)
+ *
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#include "lamp_bridge.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <poll.h>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <vector>
+
+/**
+ * @brief:
+ * One thread and one poll loop serve the serial link and every client, so
+ * requests reach the link in the order they were read and nothing needs a
+ * lock. A client's requests are handled as soon as their lines are complete;
+ * only a sync is answered later, and until it is the client's further lines
+ * stay unread in its socket, which keeps its replies in request order and
+ * pushes back on a client that pipelines without bound.
+ *
+ * The link reports rejected frames by submission id; the bridge remembers
+ * which client made each submission until the link is done with it, and
+ * charges the rejection to the client's next sync. When the serial device
+ * goes away the link is dropped with everything queued on it, every client
+ * that had submissions in flight gets an error at its next sync, and the
+ * device is opened again every BRIDGE_REOPEN_US.
+ */
+
+namespace lamp {
+
+namespace {
+
+const char *const STATUS_NAMES[] = {
+    "ok", "unknown type", "malformed", "no such light or preset", "out of sequence",
+};
+
+const char *status_name(uint8_t status)
+{
+    return status < sizeof(STATUS_NAMES) / sizeof(STATUS_NAMES[0]) ? STATUS_NAMES[status] : "unknown status";
+}
+
+bool parse_uint(const std::string &text, unsigned long max, unsigned long *value)
+{
+    if (text.empty() || text[0] == '-' || text[0] == '+') {
+        return false;
+    }
+    char *end;
+    errno = 0;
+    *value = strtoul(text.c_str(), &end, 0);
+    return !errno && !*end && *value <= max;
+}
+
+} // namespace
+
+Bridge::Bridge(const Options &options)
+    : m_options(options)
+{
+}
+
+Bridge::~Bridge()
+{
+    for (auto &entry : m_clients) {
+        close(entry.second.fd);
+    }
+    if (m_listen_fd >= 0) {
+        close(m_listen_fd);
+        unlink(m_options.socket_path.c_str());
+    }
+}
+
+bool Bridge::listen_socket()
+{
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (m_options.socket_path.size() >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "bridge: socket path too long: %s\n", m_options.socket_path.c_str());
+        return false;
+    }
+    strcpy(addr.sun_path, m_options.socket_path.c_str());
+
+    /* a socket file left by a bridge that died is replaced, one still answering is not */
+    struct stat st;
+    if (lstat(addr.sun_path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        const int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        const bool alive = probe >= 0 && connect(probe, (const sockaddr *)&addr, sizeof(addr)) == 0;
+        if (probe >= 0) {
+            close(probe);
+        }
+        if (alive) {
+            fprintf(stderr, "bridge: %s is served by another bridge\n", addr.sun_path);
+            return false;
+        }
+        unlink(addr.sun_path);
+    }
+
+    m_listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (m_listen_fd < 0 || bind(m_listen_fd, (const sockaddr *)&addr, sizeof(addr)) != 0 ||
+            listen(m_listen_fd, 16) != 0) {
+        fprintf(stderr, "bridge: cannot listen on %s: %s\n", addr.sun_path, strerror(errno));
+        if (m_listen_fd >= 0) {
+            close(m_listen_fd);
+            m_listen_fd = -1;
+        }
+        return false;
+    }
+    return true;
+}
+
+void Bridge::open_link()
+{
+    const int fd = Link::open_serial(m_options.serial_path, m_options.baud);
+    if (fd < 0) {
+        if (!m_open_failed) {
+            fprintf(stderr, "bridge: cannot open %s: %s, retrying\n", m_options.serial_path.c_str(), strerror(errno));
+            m_open_failed = true;
+        }
+        m_reopen_us = now_us() + BRIDGE_REOPEN_US;
+        return;
+    }
+    m_open_failed = false;
+    m_link = std::make_unique<Link>(fd);
+    m_link->set_event_handler([this](const Event & event) {
+        on_event(event);
+    });
+    m_link->start();
+    if (m_options.verbose) {
+        fprintf(stderr, "bridge: opened %s\n", m_options.serial_path.c_str());
+    }
+}
+
+void Bridge::close_link()
+{
+    fprintf(stderr, "bridge: lost %s\n", m_options.serial_path.c_str());
+    m_link.reset();
+    m_reopen_us = now_us() + BRIDGE_REOPEN_US;
+    for (const Owner &owner : m_owners) {
+        auto found = m_clients.find(owner.client);
+        if (found != m_clients.end()) {
+            found->second.lost = true;
+        }
+    }
+    m_owners.clear();
+    send_event(EVENTS_LINK, "event link down");
+}
+
+void Bridge::on_event(const Event &event)
+{
+    char line[512];
+    switch (event.type) {
+    case Event::Type::Ready:
+        snprintf(line, sizeof(line), "event link up version=%u window=%u max_payload=%u", event.version, event.window,
+                 event.max_payload);
+        if (m_options.verbose) {
+            fprintf(stderr, "bridge: %s\n", line + 6);
+        }
+        if (m_options.telemetry_ms) {
+            m_link->set_telemetry_period(m_options.telemetry_ms);
+        }
+        send_event(EVENTS_LINK, line);
+        break;
+    case Event::Type::Telemetry: {
+        const lamp_proto_telemetry_t &t = event.telemetry;
+        snprintf(line, sizeof(line),
+                 "event telemetry uptime_ms=%" PRIu32 " frames=%" PRIu32 " bad_frames=%" PRIu32 " skipped=%" PRIu32
+                 " records=%" PRIu32 " sent=%" PRIu32 " coalesced=%" PRIu32 " duplicates=%" PRIu32
+                 " out_of_order=%" PRIu32 " lights=%u latency_last_us=%" PRIu32 " latency_max_us=%" PRIu32,
+                 t.uptime_ms, t.frames, t.bad_frames, t.skipped, t.records, t.sent, t.coalesced, t.duplicates,
+                 t.out_of_order, t.lights, t.latency_last_us, t.latency_max_us);
+        send_event(EVENTS_TELEMETRY, line);
+        break;
+    }
+    case Event::Type::Log:
+        if (m_options.verbose) {
+            fprintf(stderr, "controller: %s\n", event.text.c_str());
+        }
+        /* one event per line whatever the controller sent */
+        send_event(EVENTS_LOG, "event log " + event.text.substr(0, event.text.find_first_of("\r\n")));
+        break;
+    case Event::Type::Rejected: {
+        if (m_options.verbose) {
+            fprintf(stderr, "bridge: submissions %" PRIu64 "..%" PRIu64 " rejected: %s\n", event.first_id,
+                    event.last_id, status_name(event.status));
+        }
+        auto it = std::lower_bound(m_owners.begin(), m_owners.end(), event.first_id,
+        [](const Owner & owner, uint64_t id) {
+            return owner.id < id;
+        });
+        for (; it != m_owners.end() && it->id <= event.last_id; ++it) {
+            auto found = m_clients.find(it->client);
+            if (found != m_clients.end()) {
+                found->second.rejected++;
+                found->second.reject_status = event.status;
+            }
+        }
+        break;
+    }
+    }
+}
+
+void Bridge::send_event(unsigned kind, const std::string &line)
+{
+    for (auto &entry : m_clients) {
+        Client &client = entry.second;
+        if (!(client.events & kind) || client.closing) {
+            continue;
+        }
+        client.out += line;
+        client.out += '\n';
+        if (client.out.size() > BRIDGE_MAX_CLIENT_OUTPUT) {
+            client.closing = true;
+        }
+    }
+}
+
+void Bridge::accept_clients()
+{
+    for (;;) {
+        const int fd = accept4(m_listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            return;
+        }
+        Client client;
+        client.fd = fd;
+        m_clients.emplace(m_next_token++, std::move(client));
+    }
+}
+
+void Bridge::read_client(Client &client)
+{
+    char buf[4096];
+    for (;;) {
+        const ssize_t got = recv(client.fd, buf, sizeof(buf), MSG_DONTWAIT);
+        if (got > 0) {
+            client.in.append(buf, (size_t)got);
+            if (client.in.size() >= sizeof(buf)) {
+                return;     /* the rest when these lines are handled */
+            }
+            continue;
+        }
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got == 0) {
+            client.eof = true;
+        } else if (errno != EAGAIN) {
+            client.closing = true;
+        }
+        return;
+    }
+}
+
+void Bridge::handle_lines(uint64_t token, Client &client)
+{
+    size_t start = 0;
+    while (!client.syncing && !client.closing) {
+        const size_t end = client.in.find('\n', start);
+        if (end == std::string::npos) {
+            break;
+        }
+        std::string line = client.in.substr(start, end - start);
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        start = end + 1;
+        const std::string reply = handle_request(token, client, line);
+        if (!reply.empty()) {
+            client.out += reply;
+            client.out += '\n';
+        }
+    }
+    client.in.erase(0, start);
+    if (client.in.size() > BRIDGE_MAX_LINE && client.in.find('\n') == std::string::npos) {
+        client.closing = true;
+    }
+}
+
+void Bridge::submit(uint64_t token, Client &client, uint64_t id)
+{
+    client.last_id = id;
+    m_owners.push_back({id, token});
+}
+
+std::string Bridge::sync_reply(Client &client)
+{
+    std::string reply = "ok";
+    if (client.lost) {
+        reply = "error link lost before every request took effect";
+    } else if (client.rejected) {
+        reply = "error " + std::to_string(client.rejected) + " rejected: " + status_name(client.reject_status);
+    }
+    client.lost = false;
+    client.rejected = 0;
+    return reply;
+}
+
+std::string Bridge::handle_request(uint64_t token, Client &client, const std::string &line)
+{
+    std::istringstream words(line);
+    std::string command;
+    std::vector<std::string> args;
+    words >> command;
+    for (std::string arg; words >> arg;) {
+        args.push_back(arg);
+    }
+    if (command.empty()) {
+        return "";
+    }
+
+    if (command == "subscribe") {
+        unsigned events = args.empty() ? (unsigned)EVENTS_ALL : 0;
+        for (const std::string &arg : args) {
+            if (arg == "telemetry") {
+                events |= EVENTS_TELEMETRY;
+            } else if (arg == "log") {
+                events |= EVENTS_LOG;
+            } else if (arg == "link") {
+                events |= EVENTS_LINK;
+            } else if (arg == "all") {
+                events |= EVENTS_ALL;
+            } else {
+                return "error unknown event " + arg;
+            }
+        }
+        client.events |= events;
+        return "ok";
+    }
+    if (command == "stats") {
+        if (!m_link) {
+            return "error link down";
+        }
+        const LinkStats s = m_link->stats();
+        char reply[512];
+        snprintf(reply, sizeof(reply),
+                 "ok clients=%zu bytes_tx=%" PRIu64 " bytes_rx=%" PRIu64 " frames_sent=%" PRIu64 " frames_resent=%"
+                 PRIu64 " gobacks=%" PRIu64 " timeouts=%" PRIu64 " records_submitted=%" PRIu64 " records_coalesced=%"
+                 PRIu64 " records_sent=%" PRIu64 " frames_rejected=%" PRIu64 " bad_frames=%" PRIu64 " skipped=%" PRIu64
+                 " srtt_us=%" PRId64,
+                 m_clients.size(), s.bytes_tx, s.bytes_rx, s.frames_sent, s.frames_resent, s.gobacks, s.timeouts,
+                 s.records_submitted, s.records_coalesced, s.records_sent, s.frames_rejected, s.bad_frames, s.skipped,
+                 s.srtt_us);
+        return reply;
+    }
+    if (command == "sync") {
+        if (!args.empty()) {
+            return "error sync takes no arguments";
+        }
+        if (m_link && !m_link->done_through(client.last_id)) {
+            client.syncing = true;
+            return "";
+        }
+        return sync_reply(client);
+    }
+    if (!m_link) {
+        return "error link down";
+    }
+    if (command == "telemetry") {
+        unsigned long period;
+        if (args.size() != 1 || !parse_uint(args[0], UINT16_MAX, &period)) {
+            return "error usage: telemetry <ms>";
+        }
+        m_options.telemetry_ms = (uint16_t)period;
+        submit(token, client, m_link->set_telemetry_period((uint16_t)period));
+        return "ok";
+    }
+
+    struct Op {
+        const char *name;
+        uint8_t op;
+        unsigned long max[3];
+        size_t count;
+        const char *usage;
+    };
+    static const Op ops[] = {
+        {"level", LAMP_PROTO_OP_LEVEL, {UINT8_MAX}, 1, "level <0-255> [light]"},
+        {"rgb", LAMP_PROTO_OP_RGB, {UINT8_MAX, UINT8_MAX, UINT8_MAX}, 3, "rgb <r> <g> <b> [light]"},
+        {"xy", LAMP_PROTO_OP_XY, {UINT16_MAX, UINT16_MAX}, 2, "xy <x> <y> [light]"},
+        {"mireds", LAMP_PROTO_OP_MIREDS, {UINT16_MAX}, 1, "mireds <m> [light]"},
+        {"preset", LAMP_PROTO_OP_PRESET, {UINT8_MAX}, 1, "preset <index> [light]"},
+    };
+    const Op *op = std::find_if(std::begin(ops), std::end(ops), [&command](const Op & candidate) {
+        return command == candidate.name;
+    });
+    if (op == std::end(ops)) {
+        return "error unknown request " + command;
+    }
+    unsigned long values[4] = {0, 0, 0, LAMP_PROTO_TARGET_ALL};
+    if (args.size() != op->count && args.size() != op->count + 1) {
+        return std::string("error usage: ") + op->usage;
+    }
+    for (size_t i = 0; i < args.size(); ++i) {
+        const unsigned long max = i < op->count ? op->max[i] : LAMP_PROTO_TARGET_ALL - 1;
+        if (!parse_uint(args[i], max, &values[i < op->count ? i : 3])) {
+            return std::string("error usage: ") + op->usage;
+        }
+    }
+    /* a bad target would reject every record sharing its frame, so refuse it here once the lights are known */
+    if (values[3] != LAMP_PROTO_TARGET_ALL && m_link->lights() && values[3] >= m_link->lights()) {
+        return "error no such light";
+    }
+    lamp_proto_record_t record = {};
+    record.op = op->op;
+    record.target = (uint8_t)values[3];
+    switch (op->op) {
+    case LAMP_PROTO_OP_LEVEL:
+        record.level = (uint8_t)values[0];
+        break;
+    case LAMP_PROTO_OP_RGB:
+        record.rgb[0] = (uint8_t)values[0];
+        record.rgb[1] = (uint8_t)values[1];
+        record.rgb[2] = (uint8_t)values[2];
+        break;
+    case LAMP_PROTO_OP_XY:
+        record.x = (uint16_t)values[0];
+        record.y = (uint16_t)values[1];
+        break;
+    case LAMP_PROTO_OP_MIREDS:
+        record.mireds = (uint16_t)values[0];
+        break;
+    case LAMP_PROTO_OP_PRESET:
+        record.preset = (uint8_t)values[0];
+        break;
+    }
+    submit(token, client, m_link->submit(record));
+    return "ok";
+}
+
+/* Answer the syncs whose requests all took effect, and forget the owners of finished submissions */
+void Bridge::finish_syncs()
+{
+    while (!m_owners.empty() && (!m_link || m_link->done_through(m_owners.front().id))) {
+        m_owners.pop_front();
+    }
+    for (auto &entry : m_clients) {
+        Client &client = entry.second;
+        if (client.syncing && (!m_link || m_link->done_through(client.last_id))) {
+            client.syncing = false;
+            client.out += sync_reply(client);
+            client.out += '\n';
+        }
+    }
+}
+
+void Bridge::write_client(Client &client)
+{
+    while (!client.out.empty()) {
+        const ssize_t sent = send(client.fd, client.out.data(), client.out.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (sent > 0) {
+            client.out.erase(0, (size_t)sent);
+            continue;
+        }
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent < 0 && errno != EAGAIN) {
+            client.closing = true;
+        }
+        return;
+    }
+}
+
+bool Bridge::run(const volatile std::sig_atomic_t *stop)
+{
+    if (!listen_socket()) {
+        return false;
+    }
+    std::vector<pollfd> fds;
+    std::vector<uint64_t> tokens;
+    while (!*stop) {
+        if (!m_link && now_us() >= m_reopen_us) {
+            open_link();
+        }
+
+        fds.clear();
+        tokens.clear();
+        fds.push_back({m_listen_fd, POLLIN, 0});
+        fds.push_back({m_link ? m_link->fd() : -1, POLLIN, 0});
+        for (auto &entry : m_clients) {
+            const Client &client = entry.second;
+            short events = client.out.empty() ? 0 : POLLOUT;
+            if (!client.syncing && !client.eof) {
+                events |= POLLIN;
+            }
+            fds.push_back({client.fd, events, 0});
+            tokens.push_back(entry.first);
+        }
+        int timeout = m_link ? m_link->timeout_ms() : (int)std::max<int64_t>(0, (m_reopen_us - now_us() + 999) / 1000);
+        if (poll(fds.data(), fds.size(), timeout) < 0 && errno != EINTR) {
+            fprintf(stderr, "bridge: poll: %s\n", strerror(errno));
+            return false;
+        }
+
+        if (m_link && (fds[1].revents & (POLLIN | POLLHUP | POLLERR)) && !m_link->on_readable()) {
+            close_link();
+        }
+        if (m_link) {
+            m_link->on_timer();
+        }
+        if (fds[0].revents & POLLIN) {
+            accept_clients();
+        }
+        for (size_t i = 0; i < tokens.size(); ++i) {
+            if (fds[i + 2].revents & (POLLIN | POLLHUP | POLLERR)) {
+                read_client(m_clients.at(tokens[i]));
+            }
+        }
+        finish_syncs();
+        for (auto it = m_clients.begin(); it != m_clients.end();) {
+            Client &client = it->second;
+            handle_lines(it->first, client);
+            write_client(client);
+            const bool done = client.eof && !client.syncing && client.out.empty() &&
+                              client.in.find('\n') == std::string::npos;
+            if (client.closing || done) {
+                close(client.fd);
+                it = m_clients.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    return true;
+}
+
+} // namespace lamp
@@ -0,0 +1,128 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Lamp controller host bridge: Unix socket server
+ *
+ * This example code is in the Public Domain (or CC0 licensed, at your option.)
+ *
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#pragma once
+
+#include <csignal>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include "lamp_link.hpp"
+
+namespace lamp {
+
+/* the serial device is opened again this long after it failed or went away */
+constexpr int64_t BRIDGE_REOPEN_US = 1000000;
+
+/* a client whose unsent replies and events grow past this is disconnected */
+constexpr size_t BRIDGE_MAX_CLIENT_OUTPUT = 1 << 20;
+
+/* a request line longer than this disconnects its client */
+constexpr size_t BRIDGE_MAX_LINE = 256;
+
+/*
+ * Requests, one per line; every request gets exactly one reply line, in
+ * order, "ok" or "error <reason>", and event lines may come in between:
+ *
+ *   level <0-255> [light]          records, to every light without a light index
+ *   rgb <r> <g> <b> [light]
+ *   xy <x> <y> [light]             CIE xy * 65536
+ *   mireds <m> [light]
+ *   preset <index> [light]
+ *   telemetry <ms>                 controller telemetry period, 0 stops it
+ *   sync                           replies once every earlier request of this client took effect,
+ *                                  "error <n> rejected: <status>" if some were rejected since the last sync
+ *   subscribe [telemetry|log|link|all]...  event lines, all of them without arguments
+ *   stats                          "ok" and the link counters as key=value, on the same line
+ *
+ *   event link up version=2 window=8 max_payload=120
+ *   event link down
+ *   event telemetry uptime_ms=... lights=... latency_max_us=...
+ *   event log <text>
+ *
+ * Records are queued on the link right away and coalesced across clients;
+ * "ok" only means the request was understood, "sync" tells whether it took
+ * effect.
+ */
+class Bridge {
+public:
+    struct Options {
+        std::string serial_path;
+        int baud = 460800;
+        std::string socket_path;
+        uint16_t telemetry_ms = 1000;   /* period asked for whenever the link comes up */
+        bool verbose = false;           /* log link events to stderr */
+    };
+
+    explicit Bridge(const Options &options);
+    ~Bridge();
+    Bridge(const Bridge &) = delete;
+    Bridge &operator=(const Bridge &) = delete;
+
+    /* serve until *stop is set by a signal handler; false if the socket could not be set up */
+    bool run(const volatile std::sig_atomic_t *stop);
+
+private:
+    enum : unsigned {
+        EVENTS_TELEMETRY = 1,
+        EVENTS_LOG = 2,
+        EVENTS_LINK = 4,
+        EVENTS_ALL = EVENTS_TELEMETRY | EVENTS_LOG | EVENTS_LINK,
+    };
+
+    struct Client {
+        int fd;
+        std::string in;                 /* received, not yet handled */
+        std::string out;                /* replies and events not yet written */
+        uint64_t last_id = 0;           /* latest submission */
+        bool syncing = false;           /* requests after a sync wait for its reply */
+        uint64_t rejected = 0;          /* submissions in rejected frames since the last sync */
+        uint8_t reject_status = 0;
+        bool lost = false;              /* submissions dropped with the link since the last sync */
+        unsigned events = 0;
+        bool eof = false;               /* closed for writing, closed once its requests are answered */
+        bool closing = false;           /* closed at once */
+    };
+
+    /* which client made a submission, until the link is done with it */
+    struct Owner {
+        uint64_t id;
+        uint64_t client;
+    };
+
+    bool listen_socket();
+    void open_link();
+    void close_link();
+    void on_event(const Event &event);
+    void accept_clients();
+    void read_client(Client &client);
+    void handle_lines(uint64_t token, Client &client);
+    std::string handle_request(uint64_t token, Client &client, const std::string &line);
+    std::string sync_reply(Client &client);
+    void finish_syncs();
+    void write_client(Client &client);
+    void send_event(unsigned kind, const std::string &line);
+    void submit(uint64_t token, Client &client, uint64_t id);
+
+    Options m_options;
+    int m_listen_fd = -1;
+    std::unique_ptr<Link> m_link;
+    int64_t m_reopen_us = 0;
+    bool m_open_failed = false;     /* already logged */
+    std::map<uint64_t, Client> m_clients;
+    uint64_t m_next_token = 1;
+    std::deque<Owner> m_owners;
+};
+
+} // namespace lamp
@@ -0,0 +1,447 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Lamp controller host bridge: serial link
+ *
+ * This example code is in the Public Domain (or CC0 licensed, at your option.)
+ *
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#include "lamp_link.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+/**
+ * @brief:
+ * The sender is the go-back-N host of lamp_proto_bench and control.py:
+ * frames are built only when the window has room, so records wait in the
+ * queue, where they can still be coalesced, instead of in frames already on
+ * the line. An ACK acknowledges its frame and every earlier one, since the
+ * controller applies frames strictly in order. A sequence error makes the
+ * sender go back to the expected frame once; the errors the rest of the old
+ * window reports afterwards are stale and only remembered. The timeout is
+ * TCP's, smoothed round trip plus four deviations, doubled on every expiry,
+ * measured on frames sent once only (Karn).
+ *
+ * Submission ids order records and TELEMETRY_PERIOD frames alike, so a
+ * caller waits for its own submissions with done_through() whatever frames
+ * they ended up in, or were coalesced away from.
+ */
+
+namespace lamp {
+
+namespace {
+
+enum : unsigned {
+    CHANNEL_LEVEL = 1,
+    CHANNEL_COLOR = 2,
+};
+
+/* what a record sets on its target; a preset recalls a scene, level and color */
+unsigned record_channels(uint8_t op)
+{
+    switch (op) {
+    case LAMP_PROTO_OP_LEVEL:
+        return CHANNEL_LEVEL;
+    case LAMP_PROTO_OP_RGB:
+    case LAMP_PROTO_OP_XY:
+    case LAMP_PROTO_OP_MIREDS:
+        return CHANNEL_COLOR;
+    case LAMP_PROTO_OP_PRESET:
+        return CHANNEL_LEVEL | CHANNEL_COLOR;
+    }
+    return 0;
+}
+
+/* later sets everything earlier would */
+bool covers(const lamp_proto_record_t &later, const lamp_proto_record_t &earlier)
+{
+    if (later.target != LAMP_PROTO_TARGET_ALL && later.target != earlier.target) {
+        return false;
+    }
+    return !(record_channels(earlier.op) & ~record_channels(later.op));
+}
+
+speed_t baud_speed(int baud)
+{
+    switch (baud) {
+    case 9600: return B9600;
+    case 19200: return B19200;
+    case 38400: return B38400;
+    case 57600: return B57600;
+    case 115200: return B115200;
+    case 230400: return B230400;
+    case 460800: return B460800;
+    case 921600: return B921600;
+    }
+    return 0;
+}
+
+} // namespace
+
+int64_t now_us()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+Link::Link(int fd)
+    : m_fd(fd)
+{
+    lamp_proto_decoder_init(&m_decoder);
+}
+
+Link::~Link()
+{
+    close(m_fd);
+}
+
+int Link::open_serial(const std::string &path, int baud)
+{
+    const speed_t speed = baud_speed(baud);
+    if (!speed) {
+        errno = EINVAL;
+        return -1;
+    }
+    const int fd = open(path.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (fd < 0) {
+        return -1;
+    }
+    termios tio;
+    if (tcgetattr(fd, &tio) == 0) {
+        cfmakeraw(&tio);
+        cfsetspeed(&tio, speed);
+        tio.c_cflag |= CLOCAL | CREAD;
+        if (tcsetattr(fd, TCSANOW, &tio) != 0) {
+            const int err = errno;
+            close(fd);
+            errno = err;
+            return -1;
+        }
+        tcflush(fd, TCIOFLUSH);
+    }
+    return fd;
+}
+
+void Link::set_event_handler(EventHandler handler)
+{
+    m_handler = std::move(handler);
+}
+
+void Link::emit(const Event &event)
+{
+    if (m_handler) {
+        m_handler(event);
+    }
+}
+
+void Link::start()
+{
+    send_hello();
+}
+
+void Link::send_hello()
+{
+    uint8_t frame[LAMP_PROTO_MAX_FRAME];
+    write_all(frame, lamp_proto_encode(frame, sizeof(frame), LAMP_PROTO_HELLO, frame_seq(0), nullptr, 0));
+    m_hello_sent_us = now_us();
+}
+
+uint64_t Link::submit(const lamp_proto_record_t &record)
+{
+    const size_t before = m_pending.size();
+    m_pending.erase(std::remove_if(m_pending.begin(), m_pending.end(), [&record](const Pending &pending) {
+        return !pending.control && covers(record, pending.record);
+    }), m_pending.end());
+    m_stats.records_coalesced += before - m_pending.size();
+    m_stats.records_submitted++;
+    m_pending.push_back({m_next_id, false, record, 0});
+    pump();
+    return m_next_id++;
+}
+
+uint64_t Link::set_telemetry_period(uint16_t period_ms)
+{
+    m_pending.erase(std::remove_if(m_pending.begin(), m_pending.end(), [](const Pending &pending) {
+        return pending.control;
+    }), m_pending.end());
+    m_pending.push_back({m_next_id, true, {}, period_ms});
+    pump();
+    return m_next_id++;
+}
+
+bool Link::done_through(uint64_t id) const
+{
+    /* outstanding frames hold lower ids than anything queued */
+    uint64_t lowest = m_next_id;
+    if (!m_outstanding.empty()) {
+        lowest = m_outstanding.front().first_id;
+    } else if (!m_pending.empty()) {
+        lowest = m_pending.front().id;
+    }
+    return id < lowest;
+}
+
+/* Build the next frame out of the queue; false if it is empty */
+bool Link::build_frame()
+{
+    if (m_pending.empty()) {
+        return false;
+    }
+    Outstanding out = {};
+    const uint64_t number = m_base + m_outstanding.size();
+    out.first_id = m_pending.front().id;
+    if (m_pending.front().control) {
+        const uint16_t period = m_pending.front().period_ms;
+        const uint8_t payload[2] = {(uint8_t)period, (uint8_t)(period >> 8)};
+        out.len = lamp_proto_encode(out.frame, sizeof(out.frame), LAMP_PROTO_TELEMETRY_PERIOD, frame_seq(number),
+                                    payload, sizeof(payload));
+        out.last_id = out.first_id;
+        m_pending.pop_front();
+    } else {
+        uint8_t payload[LAMP_PROTO_MAX_PAYLOAD];
+        size_t length = 0;
+        while (!m_pending.empty() && !m_pending.front().control) {
+            const size_t written = lamp_proto_put_record(payload + length, m_max_payload - length,
+                                                         &m_pending.front().record);
+            if (!written) {
+                break;
+            }
+            length += written;
+            out.last_id = m_pending.front().id;
+            m_pending.pop_front();
+            m_stats.records_sent++;
+        }
+        out.len = lamp_proto_encode(out.frame, sizeof(out.frame), LAMP_PROTO_COMMANDS, frame_seq(number), payload,
+                                    length);
+    }
+    m_outstanding.push_back(out);
+    return true;
+}
+
+/* Transmit what the window has room for: frames gone back to first, then new ones */
+void Link::pump()
+{
+    if (!m_ready) {
+        return;
+    }
+    while (m_next - m_base < m_window) {
+        if (m_next == m_base + m_outstanding.size() && !build_frame()) {
+            break;
+        }
+        transmit(m_next++);
+    }
+}
+
+void Link::transmit(uint64_t number)
+{
+    Outstanding &out = m_outstanding[number - m_base];
+    if (out.sent_us) {
+        out.resent = true;
+        m_stats.frames_resent++;
+    } else {
+        m_stats.frames_sent++;
+    }
+    out.sent_us = now_us();
+    write_all(out.frame, out.len);
+}
+
+void Link::go_back(uint64_t number, uint64_t err_number)
+{
+    m_next = number;
+    m_goback_number = number;
+    m_goback_err = err_number;
+    m_goback_valid = true;
+}
+
+void Link::measure_rtt(const Outstanding &out)
+{
+    const int64_t rtt = now_us() - out.sent_us;
+    if (!m_rtt_measured) {
+        m_stats.srtt_us = rtt;
+        m_rttvar_us = rtt / 2;
+        m_rtt_measured = true;
+    } else {
+        m_rttvar_us += (std::abs(rtt - m_stats.srtt_us) - m_rttvar_us) / 4;
+        m_stats.srtt_us += (rtt - m_stats.srtt_us) / 8;
+    }
+    m_rto_us = std::clamp(m_stats.srtt_us + 4 * m_rttvar_us, LINK_MIN_RTO_US, LINK_MAX_RTO_US);
+}
+
+void Link::handle_ack(const lamp_proto_frame_t *frame)
+{
+    if (frame->length < 1) {
+        return;
+    }
+    const uint8_t status = frame->payload[0];
+    if (!m_ready) {
+        if (frame->seq == frame_seq(0) && status == LAMP_PROTO_OK && frame->length >= 1 + LAMP_PROTO_HELLO_ACK_SIZE) {
+            Event event = {Event::Type::Ready};
+            event.version = frame->payload[1];
+            event.max_payload = frame->payload[2];
+            event.window = frame->payload[3];
+            /* at least the largest record, or a frame could hold none */
+            m_max_payload = std::clamp<size_t>(event.max_payload, lamp_proto_record_size(LAMP_PROTO_OP_XY),
+                                               LAMP_PROTO_MAX_PAYLOAD);
+            m_window = std::clamp<unsigned>(event.window, 1, LAMP_PROTO_WINDOW);
+            m_ready = true;
+            emit(event);
+            pump();
+        }
+        return;
+    }
+    /* frames in flight are m_base..m_next - 1, their sequence numbers a contiguous run */
+    const uint64_t acked = frame_number(m_base, frame->seq);
+    if (acked >= m_next) {
+        return;
+    }
+    if (status == LAMP_PROTO_ERR_SEQUENCE) {
+        if (frame->length < 2) {
+            return;
+        }
+        const uint64_t expected = frame_number(m_base, frame->payload[1]);
+        const bool stale = m_goback_valid && m_goback_number == expected && acked > m_goback_err;
+        if (expected < m_next && !stale) {
+            m_stats.gobacks++;
+            go_back(expected, acked);
+            pump();
+        } else {
+            m_goback_err = acked;
+        }
+        return;
+    }
+    /* frames are applied in order, so this acknowledges every earlier one too */
+    const Outstanding &out = m_outstanding[acked - m_base];
+    if (!out.resent) {
+        measure_rtt(out);
+    }
+    Event rejected = {Event::Type::Rejected};
+    if (status != LAMP_PROTO_OK) {
+        m_stats.frames_rejected++;
+        rejected.status = status;
+        rejected.first_id = out.first_id;
+        rejected.last_id = out.last_id;
+    }
+    m_outstanding.erase(m_outstanding.begin(), m_outstanding.begin() + (acked + 1 - m_base));
+    m_base = acked + 1;
+    if (status != LAMP_PROTO_OK) {
+        emit(rejected);
+    }
+    pump();
+}
+
+void Link::frame_cb(const lamp_proto_frame_t *frame, void *ctx)
+{
+    Link *link = static_cast<Link *>(ctx);
+    switch (frame->type) {
+    case LAMP_PROTO_ACK:
+        link->handle_ack(frame);
+        break;
+    case LAMP_PROTO_TELEMETRY: {
+        Event event = {Event::Type::Telemetry};
+        if (lamp_proto_get_telemetry(frame->payload, frame->length, &event.telemetry)) {
+            link->m_lights = event.telemetry.lights;
+            link->emit(event);
+        }
+        break;
+    }
+    case LAMP_PROTO_LOG: {
+        Event event = {Event::Type::Log};
+        event.text.assign(reinterpret_cast<const char *>(frame->payload), frame->length);
+        link->emit(event);
+        break;
+    }
+    }
+}
+
+bool Link::on_readable()
+{
+    uint8_t in[1024];
+    for (;;) {
+        const ssize_t got = read(m_fd, in, sizeof(in));
+        if (got > 0) {
+            m_stats.bytes_rx += (size_t)got;
+            lamp_proto_decoder_feed(&m_decoder, in, (size_t)got, frame_cb, this);
+            continue;
+        }
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        /* a closed pty or an unplugged adapter reads as end of file or EIO */
+        return got < 0 && errno == EAGAIN;
+    }
+}
+
+int Link::timeout_ms() const
+{
+    int64_t due;
+    if (!m_ready) {
+        due = m_hello_sent_us + LINK_HELLO_RETRY_US;
+    } else if (m_next > m_base) {
+        due = m_outstanding.front().sent_us + m_rto_us;
+    } else {
+        return -1;
+    }
+    const int64_t left = due - now_us();
+    return left > 0 ? (int)((left + 999) / 1000) : 0;
+}
+
+void Link::on_timer()
+{
+    const int64_t now = now_us();
+    if (!m_ready) {
+        if (now - m_hello_sent_us >= LINK_HELLO_RETRY_US) {
+            send_hello();
+        }
+        return;
+    }
+    if (m_next > m_base && now - m_outstanding.front().sent_us >= m_rto_us) {
+        m_stats.timeouts++;
+        m_rto_us = std::min(m_rto_us * 2, LINK_MAX_RTO_US);
+        go_back(m_base, m_base);
+        pump();
+    }
+}
+
+/* The device reads continuously; if its buffer stays full the frame is dropped and sent again on timeout */
+void Link::write_all(const uint8_t *data, size_t len)
+{
+    while (len) {
+        const ssize_t written = write(m_fd, data, len);
+        if (written >= 0) {
+            m_stats.bytes_tx += (size_t)written;
+            data += written;
+            len -= (size_t)written;
+            continue;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        pollfd pfd = {m_fd, POLLOUT, 0};
+        if (errno != EAGAIN || poll(&pfd, 1, 100) <= 0) {
+            return;
+        }
+    }
+}
+
+LinkStats Link::stats() const
+{
+    LinkStats stats = m_stats;
+    stats.bad_frames = m_decoder.bad_frames;
+    stats.skipped = m_decoder.skipped;
+    return stats;
+}
+
+} // namespace lamp
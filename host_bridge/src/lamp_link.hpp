@@ -0,0 +1,197 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Lamp controller host bridge: serial link
+ *
+ * This example code is in the Public Domain (or CC0 licensed, at your option.)
+ *
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+#include "lamp_protocol.h"
+
+namespace lamp {
+
+/* retransmission timeout before the first round trip is measured, and its bounds */
+constexpr int64_t LINK_INITIAL_RTO_US = 200000;
+constexpr int64_t LINK_MIN_RTO_US = 5000;
+constexpr int64_t LINK_MAX_RTO_US = 1000000;
+
+/* a HELLO is sent again after this long without its ACK */
+constexpr int64_t LINK_HELLO_RETRY_US = 250000;
+
+struct Event {
+    enum class Type {
+        Ready,          /* HELLO acknowledged: version, max_payload, window */
+        Telemetry,      /* telemetry */
+        Log,            /* text */
+        Rejected,       /* a frame was acknowledged with an error: status, ids first_id..last_id */
+    };
+    Type type;
+    uint8_t version = 0;
+    uint8_t max_payload = 0;
+    uint8_t window = 0;
+    lamp_proto_telemetry_t telemetry = {};
+    std::string text;
+    uint8_t status = LAMP_PROTO_OK;
+    uint64_t first_id = 0;
+    uint64_t last_id = 0;
+};
+
+struct LinkStats {
+    uint64_t bytes_tx = 0;
+    uint64_t bytes_rx = 0;
+    uint64_t frames_sent = 0;       /* first transmissions */
+    uint64_t frames_resent = 0;
+    uint64_t gobacks = 0;           /* sent again from a frame the controller reported missing */
+    uint64_t timeouts = 0;
+    uint64_t records_submitted = 0;
+    uint64_t records_coalesced = 0; /* dropped before sending, a later record sets all they would */
+    uint64_t records_sent = 0;
+    uint64_t frames_rejected = 0;
+    uint64_t bad_frames = 0;        /* received candidates with a bad length or CRC */
+    uint64_t skipped = 0;           /* received bytes skipped while hunting for a sync byte */
+    int64_t srtt_us = 0;            /* smoothed round trip, 0 before the first one */
+};
+
+/*
+ * One serial link to a lamp controller speaking protocol v2
+ * (components/lamp_protocol). A Link never waits: its owner polls fd() for
+ * input and calls on_readable(), and calls on_timer() when timeout_ms() has
+ * passed, so a link, sockets and timers share one poll loop.
+ *
+ * Records from any number of submitters are queued in submission order; a
+ * queued record is dropped as soon as a later one sets everything it would
+ * (same channel, same light or every light). Whenever the controller's
+ * window has room the queue is packed into as few COMMANDS frames as fit, so
+ * under load frames fill up and stale values never reach the serial line.
+ */
+class Link {
+public:
+    using EventHandler = std::function<void(const Event &)>;
+
+    /* takes ownership of fd, an open serial device or pty */
+    explicit Link(int fd);
+    ~Link();
+    Link(const Link &) = delete;
+    Link &operator=(const Link &) = delete;
+
+    /* open a serial device raw and non-blocking at baud; -1 and errno on failure */
+    static int open_serial(const std::string &path, int baud);
+
+    void set_event_handler(EventHandler handler);
+
+    /* send HELLO; submissions queue until it is acknowledged */
+    void start();
+
+    /* queue a command record with a known op; returns its id, ids increase with every submission */
+    uint64_t submit(const lamp_proto_record_t &record);
+
+    /* queue a TELEMETRY_PERIOD frame, replacing one still queued; returns its id */
+    uint64_t set_telemetry_period(uint16_t period_ms);
+
+    /* every submission up to id was acknowledged, rejected or dropped for a later one */
+    bool done_through(uint64_t id) const;
+
+    /* read what the controller sent; false once the device is gone */
+    bool on_readable();
+
+    /* milliseconds until on_timer() is due, -1 if no timer is running */
+    int timeout_ms() const;
+    void on_timer();
+
+    int fd() const
+    {
+        return m_fd;
+    }
+    bool ready() const
+    {
+        return m_ready;
+    }
+    /* lights the controller reported in its latest telemetry, 0 before any */
+    unsigned lights() const
+    {
+        return m_lights;
+    }
+    LinkStats stats() const;
+
+private:
+    struct Pending {
+        uint64_t id;
+        bool control;               /* TELEMETRY_PERIOD rather than a record */
+        lamp_proto_record_t record;
+        uint16_t period_ms;
+    };
+    struct Outstanding {
+        uint8_t frame[LAMP_PROTO_MAX_FRAME];
+        size_t len;
+        uint64_t first_id;
+        uint64_t last_id;
+        int64_t sent_us;
+        bool resent;
+    };
+
+    static void frame_cb(const lamp_proto_frame_t *frame, void *ctx);
+    void handle_ack(const lamp_proto_frame_t *frame);
+    void send_hello();
+    void pump();
+    bool build_frame();
+    void transmit(uint64_t number);
+    void go_back(uint64_t number, uint64_t err_number);
+    void measure_rtt(const Outstanding &out);
+    void write_all(const uint8_t *data, size_t len);
+    void emit(const Event &event);
+
+    int m_fd;
+    EventHandler m_handler;
+    lamp_proto_decoder_t m_decoder;
+    LinkStats m_stats;
+    bool m_ready = false;
+    unsigned m_window = 1;
+    size_t m_max_payload = LAMP_PROTO_MAX_PAYLOAD;
+    unsigned m_lights = 0;
+    int64_t m_hello_sent_us = 0;
+
+    std::deque<Pending> m_pending;
+    uint64_t m_next_id = 1;
+
+    /*
+     * Frames are numbered from 1 (the HELLO is 0) and sent with the number
+     * modulo 256 as sequence number. m_outstanding holds the frames built and
+     * not acknowledged, m_base on; m_next is the next one to transmit, lower
+     * than the last built after a go-back.
+     */
+    std::deque<Outstanding> m_outstanding;
+    uint64_t m_base = 1;
+    uint64_t m_next = 1;
+    uint64_t m_goback_number = 0;   /* frame the last go-back restarted from */
+    uint64_t m_goback_err = 0;      /* frame of the last sequence error reported since */
+    bool m_goback_valid = false;
+    bool m_rtt_measured = false;
+    int64_t m_rttvar_us = 0;
+    int64_t m_rto_us = LINK_INITIAL_RTO_US;
+};
+
+/* microseconds on the monotonic clock */
+int64_t now_us();
+
+/* the sequence number of frame number, and the number of an acknowledged sequence at most 255 frames on from base */
+inline uint8_t frame_seq(uint64_t number)
+{
+    return (uint8_t)number;
+}
+inline uint64_t frame_number(uint64_t base, uint8_t seq)
+{
+    return base + (uint8_t)(seq - frame_seq(base));
+}
+
+} // namespace lamp
@@ -0,0 +1,84 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Lamp controller host bridge daemon
+ *
+ * Owns the serial link to the controller and serves the line requests of
+ * lamp_bridge.hpp on a Unix socket to any number of clients:
+ *
+ *   lampd --serial /dev/ttyACM1 --socket /tmp/lampd.sock
+ *   printf 'level 200\nmireds 370 0\nsync\n' | socat - UNIX-CONNECT:/tmp/lampd.sock
+ *
+ * This example code is in the Public Domain (or CC0 licensed, at your option.)
+ *
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <getopt.h>
+#include "lamp_bridge.hpp"
+
+static volatile std::sig_atomic_t s_stop;
+
+static void on_signal(int)
+{
+    s_stop = 1;
+}
+
+static void usage(const char *prog)
+{
+    printf("usage: %s --serial PATH --socket PATH [options]\n"
+           "  --serial PATH         controller's serial port or pty, opened again whenever it goes away\n"
+           "  --baud N              (default 460800, ignored by USB serial/JTAG and ptys)\n"
+           "  --socket PATH         Unix socket to serve requests on\n"
+           "  --telemetry-ms N      telemetry period asked for when the link comes up, 0 for none\n"
+           "                        (default 1000)\n"
+           "  --verbose             log link events and controller log lines to stderr\n",
+           prog);
+}
+
+int main(int argc, char **argv)
+{
+    enum { OPT_SERIAL = 1, OPT_BAUD, OPT_SOCKET, OPT_TELEMETRY, OPT_VERBOSE, OPT_HELP };
+    static const struct option long_options[] = {
+        {"serial", required_argument, nullptr, OPT_SERIAL},
+        {"baud", required_argument, nullptr, OPT_BAUD},
+        {"socket", required_argument, nullptr, OPT_SOCKET},
+        {"telemetry-ms", required_argument, nullptr, OPT_TELEMETRY},
+        {"verbose", no_argument, nullptr, OPT_VERBOSE},
+        {"help", no_argument, nullptr, OPT_HELP},
+        {nullptr, 0, nullptr, 0},
+    };
+    lamp::Bridge::Options options;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, nullptr)) != -1) {
+        switch (opt) {
+        case OPT_SERIAL: options.serial_path = optarg; break;
+        case OPT_BAUD: options.baud = (int)strtol(optarg, nullptr, 0); break;
+        case OPT_SOCKET: options.socket_path = optarg; break;
+        case OPT_TELEMETRY: options.telemetry_ms = (uint16_t)strtoul(optarg, nullptr, 0); break;
+        case OPT_VERBOSE: options.verbose = true; break;
+        case OPT_HELP: usage(argv[0]); return 0;
+        default: usage(argv[0]); return 2;
+        }
+    }
+    if (options.serial_path.empty() || options.socket_path.empty()) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    /* no SA_RESTART, so a signal wakes the poll loop */
+    struct sigaction action = {};
+    action.sa_handler = on_signal;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+
+    lamp::Bridge bridge(options);
+    return bridge.run(&s_stop) ? 0 : 1;
+}
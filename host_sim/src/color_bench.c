@@ -0,0 +1,208 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Accuracy and throughput of the lamp controller's integer color conversions
+ *
+ * Compares light_color against double precision references over every 8-bit
+ * RGB color and every mired value the locus fit covers, checks that the
+ * compile-time macros agree with the functions, and times both the integer
+ * functions and their floating point counterparts:
+ *
+ *   lamp_color_bench
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "light_color.h"
+
+#define BENCH_CALLS     (1 << 24)
+
+/* evaluated by the compiler, or this file does not build */
+_Static_assert(LIGHT_COLOR_RGB_X(255, 255, 255) > 20000 && LIGHT_COLOR_RGB_X(255, 255, 255) < 21000,
+               "white is near D65");
+_Static_assert(LIGHT_COLOR_MIREDS_X(153) > 20000 && LIGHT_COLOR_MIREDS_X(153) < 21000, "6500 K is near D65");
+_Static_assert(LIGHT_COLOR_RGB_HUE(0, 0, 255) == 169, "blue is two thirds round");
+
+static const uint16_t s_compile_time[][2] = {
+    {LIGHT_COLOR_RGB_X(255, 80, 20), LIGHT_COLOR_RGB_Y(255, 80, 20)},
+    {LIGHT_COLOR_MIREDS_X(370), LIGHT_COLOR_MIREDS_Y(370)},
+};
+
+static double s_linear[256];
+
+static double srgb_linear(unsigned value)
+{
+    const double c = value / 255.0;
+    return c <= 0.04045 ? c / 12.92 : pow((c + 0.055) / 1.055, 2.4);
+}
+
+static void reference_xy(unsigned r, unsigned g, unsigned b, double *x, double *y)
+{
+    const double lr = s_linear[r], lg = s_linear[g], lb = s_linear[b];
+    const double cx = 0.4124 * lr + 0.3576 * lg + 0.1805 * lb;
+    const double cy = 0.2126 * lr + 0.7152 * lg + 0.0722 * lb;
+    const double cz = 0.0193 * lr + 0.1192 * lg + 0.9505 * lb;
+    const double sum = cx + cy + cz;
+    *x = sum > 0 ? cx / sum : 0.3127;
+    *y = sum > 0 ? cy / sum : 0.3290;
+}
+
+static void reference_locus(unsigned mireds, double *x, double *y)
+{
+    const double t = 1e6 / mireds;
+    if (t <= 4000) {
+        *x = -0.2661239e9 / (t * t * t) - 0.2343589e6 / (t * t) + 0.8776956e3 / t + 0.179910;
+    } else {
+        *x = -3.0258469e9 / (t * t * t) + 2.1070379e6 / (t * t) + 0.2226347e3 / t + 0.240390;
+    }
+    const double v = *x;
+    if (t <= 2222) {
+        *y = -1.1063814 * v * v * v - 1.34811020 * v * v + 2.18555832 * v - 0.20219683;
+    } else if (t <= 4000) {
+        *y = -0.9549476 * v * v * v - 1.37418593 * v * v + 2.09137015 * v - 0.16748867;
+    } else {
+        *y = 3.0817580 * v * v * v - 5.87338670 * v * v + 3.75112997 * v - 0.37001483;
+    }
+}
+
+static void reference_hsv(unsigned r, unsigned g, unsigned b, double *hue, double *saturation)
+{
+    const double max = fmax(r, fmax(g, b)), min = fmin(r, fmin(g, b)), chroma = max - min;
+    double h = 0;
+    if (chroma > 0) {
+        h = max == r ? fmod((g - (double)b) / chroma + 6, 6) : max == g ? (b - (double)r) / chroma + 2
+                                                                         : (r - (double)g) / chroma + 4;
+    }
+    *hue = h / 6 * 254;
+    *saturation = max > 0 ? chroma / max * 254 : 0;
+}
+
+static double elapsed_ns(const struct timespec *start, const struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
+
+int main(void)
+{
+    for (unsigned v = 0; v < 256; ++v) {
+        s_linear[v] = srgb_linear(v);
+    }
+
+    /* RGB to xy and HSV over the whole cube */
+    double xy_max = 0, xy_sum = 0, hue_max = 0, sat_max = 0;
+    unsigned worst_rgb = 0;
+    unsigned mismatches = 0;
+    for (unsigned rgb = 0; rgb < (1U << 24); ++rgb) {
+        const unsigned r = rgb >> 16, g = (rgb >> 8) & 0xff, b = rgb & 0xff;
+        uint16_t x, y;
+        light_color_rgb_to_xy(r, g, b, &x, &y);
+        double rx, ry;
+        reference_xy(r, g, b, &rx, &ry);
+        const double error = hypot(x / 65536.0 - rx, y / 65536.0 - ry);
+        xy_sum += error;
+        if (error > xy_max) {
+            xy_max = error;
+            worst_rgb = rgb;
+        }
+        uint8_t hue, saturation, value;
+        light_color_rgb_to_hsv(r, g, b, &hue, &saturation, &value);
+        double rh, rs;
+        reference_hsv(r, g, b, &rh, &rs);
+        double hue_error = fabs(hue - rh);
+        hue_error = fmin(hue_error, 254 - hue_error);
+        hue_max = fmax(hue_max, hue_error);
+        sat_max = fmax(sat_max, fabs(saturation - rs));
+        mismatches += x != LIGHT_COLOR_RGB_X(r, g, b) || y != LIGHT_COLOR_RGB_Y(r, g, b);
+    }
+    printf("rgb->xy: max error %.5f (at #%06x), mean %.5f in CIE xy over all %u colors\n", xy_max, worst_rgb,
+           xy_sum / (1U << 24), 1U << 24);
+    printf("rgb->hsv: max hue error %.2f, max saturation error %.2f in ZCL units\n", hue_max, sat_max);
+
+    /* color temperature */
+    double locus_max = 0;
+    unsigned worst_mireds = 0;
+    for (unsigned mireds = LIGHT_COLOR_MIREDS_MIN; mireds <= LIGHT_COLOR_MIREDS_MAX; ++mireds) {
+        uint16_t x, y;
+        light_color_mireds_to_xy(mireds, &x, &y);
+        double rx, ry;
+        reference_locus(mireds, &rx, &ry);
+        const double error = hypot(x / 65536.0 - rx, y / 65536.0 - ry);
+        if (error > locus_max) {
+            locus_max = error;
+            worst_mireds = mireds;
+        }
+        mismatches += x != LIGHT_COLOR_MIREDS_X(mireds) || y != LIGHT_COLOR_MIREDS_Y(mireds);
+    }
+    printf("mireds->xy: max error %.5f (at %u mireds) in CIE xy against the locus fit\n", locus_max, worst_mireds);
+
+    /* gamut clamp: every clamped color lands on or inside the triangle, inside colors stay */
+    const light_color_gamut_t gamut = LIGHT_COLOR_GAMUT_SRGB;
+    unsigned clamped = 0, escaped = 0;
+    for (uint32_t x = 0; x <= LIGHT_COLOR_XY_MAX; x += 257) {
+        for (uint32_t y = 0; y <= LIGHT_COLOR_XY_MAX; y += 257) {
+            uint16_t cx = (uint16_t)x, cy = (uint16_t)y;
+            if (light_color_clamp_xy(&gamut, &cx, &cy)) {
+                /* clamping again may only round to the edge */
+                const uint16_t ex = cx, ey = cy;
+                clamped++;
+                escaped += light_color_clamp_xy(&gamut, &cx, &cy) && (abs(cx - ex) > 1 || abs(cy - ey) > 1);
+            }
+        }
+    }
+    printf("clamp: %u of %u grid colors outside sRGB moved, %u still outside after a move\n", clamped,
+           (LIGHT_COLOR_XY_MAX / 257 + 1) * (LIGHT_COLOR_XY_MAX / 257 + 1), escaped);
+
+    uint16_t x, y;
+    light_color_rgb_to_xy(255, 80, 20, &x, &y);
+    mismatches += x != s_compile_time[0][0] || y != s_compile_time[0][1];
+    light_color_mireds_to_xy(370, &x, &y);
+    mismatches += x != s_compile_time[1][0] || y != s_compile_time[1][1];
+    printf("macros and functions disagree on %u inputs\n", mismatches);
+
+    /* throughput, over inputs the compiler cannot see in advance */
+    struct timespec start, end;
+    uint32_t sink = 0;
+    uint32_t seed = 12345;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (unsigned i = 0; i < BENCH_CALLS; ++i) {
+        seed = seed * 1664525 + 1013904223;
+        light_color_rgb_to_xy(seed >> 24, seed >> 16, seed >> 8, &x, &y);
+        sink += x + y;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    const double int_ns = elapsed_ns(&start, &end) / BENCH_CALLS;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (unsigned i = 0; i < BENCH_CALLS; ++i) {
+        seed = seed * 1664525 + 1013904223;
+        /* pow() per channel, as a float implementation without a table does */
+        const double lr = srgb_linear((seed >> 24) & 0xff), lg = srgb_linear((seed >> 16) & 0xff),
+                     lb = srgb_linear((seed >> 8) & 0xff);
+        const double cx = 0.4124 * lr + 0.3576 * lg + 0.1805 * lb;
+        const double sum = cx + 0.2126 * lr + 0.7152 * lg + 0.0722 * lb + 0.0193 * lr + 0.1192 * lg + 0.9505 * lb;
+        sink += (uint32_t)(sum > 0 ? cx / sum * 65536 : 0);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    const double float_ns = elapsed_ns(&start, &end) / BENCH_CALLS;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (unsigned i = 0; i < BENCH_CALLS; ++i) {
+        seed = seed * 1664525 + 1013904223;
+        light_color_mireds_to_xy(seed >> 23, &x, &y);
+        sink += x + y;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    const double mireds_ns = elapsed_ns(&start, &end) / BENCH_CALLS;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (unsigned i = 0; i < BENCH_CALLS; ++i) {
+        uint8_t hue, saturation, value;
+        seed = seed * 1664525 + 1013904223;
+        light_color_rgb_to_hsv(seed >> 24, seed >> 16, seed >> 8, &hue, &saturation, &value);
+        sink += hue + saturation;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    const double hsv_ns = elapsed_ns(&start, &end) / BENCH_CALLS;
+    printf("ns per call on this host: rgb->xy %.1f (double with pow() %.1f), rgb->hsv %.1f, mireds->xy %.1f "
+           "(checksum %lu)\n", int_ns, float_ns, hsv_ns, mireds_ns, (unsigned long)sink);
+    return mismatches ? 1 : 0;
+}
@@ -0,0 +1,1145 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Lamp controller host simulation: ESP-IDF system services (log, timer, GPIO,
+ * NVS init, partitions, USB serial/JTAG, heap accounting)
+ */
+
+#include <fcntl.h>
+#include <malloc.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include "driver/gpio.h"
+#include "driver/usb_serial_jtag.h"
+#include "esp_console.h"
+#include "esp_cpu.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_timer.h"
+#include "esp_system.h"
+#include "nvs_flash.h"
+#include "sim.h"
+
+/* ---- time ---- */
+
+static int64_t monotonic_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int64_t s_boot_us;
+static atomic_bool s_clock_virtual;
+static _Atomic int64_t s_clock_us;      /* virtual time, once sim_clock_set() was called */
+
+int64_t sim_now_us(void)
+{
+    if (atomic_load_explicit(&s_clock_virtual, memory_order_acquire)) {
+        return atomic_load_explicit(&s_clock_us, memory_order_relaxed);
+    }
+    if (s_boot_us == 0) {
+        s_boot_us = monotonic_us();
+    }
+    return monotonic_us() - s_boot_us;
+}
+
+void sim_clock_set(int64_t now_us)
+{
+    int64_t clock_us = atomic_load_explicit(&s_clock_us, memory_order_relaxed);
+    while ((now_us > clock_us || !atomic_load(&s_clock_virtual)) &&
+           !atomic_compare_exchange_weak(&s_clock_us, &clock_us, now_us)) {
+    }
+    atomic_store_explicit(&s_clock_virtual, true, memory_order_release);
+}
+
+void sim_sleep_us(int64_t us)
+{
+    if (us <= 0) {
+        return;
+    }
+    struct timespec ts = {
+        .tv_sec = us / 1000000,
+        .tv_nsec = (us % 1000000) * 1000,
+    };
+    while (nanosleep(&ts, &ts) != 0) {
+    }
+}
+
+int64_t esp_timer_get_time(void)
+{
+    return sim_now_us();
+}
+
+esp_cpu_cycle_count_t esp_cpu_get_cycle_count(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (esp_cpu_cycle_count_t)((uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec);
+}
+
+/* ---- esp_timer one-shot timers, dispatched from one thread ---- */
+
+struct esp_timer {
+    esp_timer_create_args_t args;
+    int64_t due_us;                 /* 0 when not armed */
+    struct esp_timer *next;
+};
+
+static struct esp_timer *s_timers;
+static pthread_mutex_t s_timer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_timer_cond;
+static pthread_once_t s_timer_once = PTHREAD_ONCE_INIT;
+
+static void *timer_thread(void *arg)
+{
+    (void)arg;
+    pthread_mutex_lock(&s_timer_mutex);
+    for (;;) {
+        struct esp_timer *due = NULL;
+        for (struct esp_timer *t = s_timers; t; t = t->next) {
+            if (t->due_us && (!due || t->due_us < due->due_us)) {
+                due = t;
+            }
+        }
+        if (!due) {
+            pthread_cond_wait(&s_timer_cond, &s_timer_mutex);
+            continue;
+        }
+        int64_t wait_us = due->due_us - sim_now_us();
+        if (wait_us > 0) {
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            int64_t ns = ts.tv_nsec + wait_us * 1000;
+            ts.tv_sec += ns / 1000000000;
+            ts.tv_nsec = ns % 1000000000;
+            pthread_cond_timedwait(&s_timer_cond, &s_timer_mutex, &ts);
+            continue;
+        }
+        due->due_us = 0;
+        esp_timer_cb_t cb = due->args.callback;
+        void *cb_arg = due->args.arg;
+        pthread_mutex_unlock(&s_timer_mutex);
+        cb(cb_arg);
+        pthread_mutex_lock(&s_timer_mutex);
+    }
+    return NULL;
+}
+
+static void timer_start_thread(void)
+{
+    pthread_condattr_t cattr;
+    pthread_condattr_init(&cattr);
+    pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+    pthread_cond_init(&s_timer_cond, &cattr);
+    pthread_condattr_destroy(&cattr);
+    pthread_t thread;
+    pthread_create(&thread, NULL, timer_thread, NULL);
+    pthread_detach(thread);
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *create_args, esp_timer_handle_t *out_handle)
+{
+    if (!create_args || !create_args->callback || !out_handle) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_once(&s_timer_once, timer_start_thread);
+    /* allocated by the caller's code, as the IDF does */
+    struct esp_timer *timer = calloc(1, sizeof(*timer));
+    if (!timer) {
+        return ESP_ERR_NO_MEM;
+    }
+    timer->args = *create_args;
+    pthread_mutex_lock(&s_timer_mutex);
+    timer->next = s_timers;
+    s_timers = timer;
+    pthread_mutex_unlock(&s_timer_mutex);
+    *out_handle = timer;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+    pthread_mutex_lock(&s_timer_mutex);
+    if (timer->due_us) {
+        pthread_mutex_unlock(&s_timer_mutex);
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer->due_us = sim_now_us() + (int64_t)timeout_us;
+    if (timer->due_us == 0) {
+        timer->due_us = 1;
+    }
+    pthread_cond_signal(&s_timer_cond);
+    pthread_mutex_unlock(&s_timer_mutex);
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+    pthread_mutex_lock(&s_timer_mutex);
+    esp_err_t ret = timer->due_us ? ESP_OK : ESP_ERR_INVALID_STATE;
+    timer->due_us = 0;
+    pthread_mutex_unlock(&s_timer_mutex);
+    return ret;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer)
+{
+    pthread_mutex_lock(&s_timer_mutex);
+    if (timer->due_us) {
+        pthread_mutex_unlock(&s_timer_mutex);
+        return ESP_ERR_INVALID_STATE;
+    }
+    for (struct esp_timer **link = &s_timers; *link; link = &(*link)->next) {
+        if (*link == timer) {
+            *link = timer->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&s_timer_mutex);
+    free(timer);
+    return ESP_OK;
+}
+
+bool esp_timer_is_active(esp_timer_handle_t timer)
+{
+    pthread_mutex_lock(&s_timer_mutex);
+    bool active = timer->due_us != 0;
+    pthread_mutex_unlock(&s_timer_mutex);
+    return active;
+}
+
+/* ---- random ---- */
+
+static uint64_t s_rand_state = 0x853c49e6748fea9bULL;
+static pthread_mutex_t s_rand_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void sim_rand_seed(uint32_t seed)
+{
+    s_rand_state = 0x853c49e6748fea9bULL ^ ((uint64_t)seed * 0x9e3779b97f4a7c15ULL);
+}
+
+uint32_t sim_rand(void)
+{
+    /* xorshift64* */
+    pthread_mutex_lock(&s_rand_mutex);
+    uint64_t x = s_rand_state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    s_rand_state = x;
+    pthread_mutex_unlock(&s_rand_mutex);
+    return (uint32_t)((x * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+double sim_rand_unit(void)
+{
+    return sim_rand() / 4294967296.0;
+}
+
+/* ---- errors ---- */
+
+const char *esp_err_to_name(esp_err_t code)
+{
+    switch (code) {
+    case ESP_OK: return "ESP_OK";
+    case ESP_FAIL: return "ESP_FAIL";
+    case ESP_ERR_NO_MEM: return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG: return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+    case ESP_ERR_INVALID_SIZE: return "ESP_ERR_INVALID_SIZE";
+    case ESP_ERR_NOT_FOUND: return "ESP_ERR_NOT_FOUND";
+    case ESP_ERR_NOT_SUPPORTED: return "ESP_ERR_NOT_SUPPORTED";
+    case ESP_ERR_TIMEOUT: return "ESP_ERR_TIMEOUT";
+    case ESP_ERR_INVALID_RESPONSE: return "ESP_ERR_INVALID_RESPONSE";
+    case ESP_ERR_INVALID_CRC: return "ESP_ERR_INVALID_CRC";
+    case ESP_ERR_INVALID_VERSION: return "ESP_ERR_INVALID_VERSION";
+    case ESP_ERR_NOT_FINISHED: return "ESP_ERR_NOT_FINISHED";
+    case ESP_ERR_NVS_NOT_INITIALIZED: return "ESP_ERR_NVS_NOT_INITIALIZED";
+    case ESP_ERR_NVS_NOT_FOUND: return "ESP_ERR_NVS_NOT_FOUND";
+    case ESP_ERR_NVS_INVALID_LENGTH: return "ESP_ERR_NVS_INVALID_LENGTH";
+    case ESP_ERR_NVS_NO_FREE_PAGES: return "ESP_ERR_NVS_NO_FREE_PAGES";
+    case ESP_ERR_NVS_NEW_VERSION_FOUND: return "ESP_ERR_NVS_NEW_VERSION_FOUND";
+    default: return "UNKNOWN ERROR";
+    }
+}
+
+/* ---- log ---- */
+
+static esp_log_level_t s_log_level = ESP_LOG_INFO;
+static pthread_mutex_t s_log_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void esp_log_level_set(const char *tag, esp_log_level_t level)
+{
+    (void)tag;
+    s_log_level = level;
+}
+
+uint32_t esp_log_timestamp(void)
+{
+    return (uint32_t)(sim_now_us() / 1000);
+}
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...)
+{
+    (void)tag;
+    if (level > s_log_level) {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    pthread_mutex_lock(&s_log_mutex);
+    vfprintf(stdout, format, args);
+    fflush(stdout);
+    pthread_mutex_unlock(&s_log_mutex);
+    va_end(args);
+}
+
+/* ---- NVS ---- */
+
+#define SIM_NVS_MAX_ENTRIES     64
+#define SIM_NVS_NAME_LEN        16
+#define SIM_NVS_MAX_HANDLES     16
+#define SIM_NVS_FILE_MAGIC      0x4e565331u /* "NVS1" */
+
+typedef struct {
+    char namespace_name[SIM_NVS_NAME_LEN];
+    char key[SIM_NVS_NAME_LEN];
+    size_t length;
+    uint8_t *data;
+} sim_nvs_entry_t;
+
+static sim_nvs_entry_t s_nvs[SIM_NVS_MAX_ENTRIES];
+static char s_nvs_handles[SIM_NVS_MAX_HANDLES][SIM_NVS_NAME_LEN];
+static const char *s_nvs_file;
+static bool s_nvs_initialized;
+static pthread_mutex_t s_nvs_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void sim_nvs_set_file(const char *path)
+{
+    s_nvs_file = path;
+}
+
+static void nvs_entry_clear(sim_nvs_entry_t *entry)
+{
+    sim_free(entry->data);
+    memset(entry, 0, sizeof(*entry));
+}
+
+static void nvs_file_load(void)
+{
+    FILE *f = s_nvs_file ? fopen(s_nvs_file, "rb") : NULL;
+    if (!f) {
+        return;
+    }
+    uint32_t magic = 0, count = 0;
+    if (fread(&magic, sizeof(magic), 1, f) == 1 && magic == SIM_NVS_FILE_MAGIC &&
+        fread(&count, sizeof(count), 1, f) == 1) {
+        for (uint32_t i = 0; i < count && i < SIM_NVS_MAX_ENTRIES; ++i) {
+            sim_nvs_entry_t *entry = &s_nvs[i];
+            uint32_t length = 0;
+            if (fread(entry->namespace_name, SIM_NVS_NAME_LEN, 1, f) != 1 ||
+                fread(entry->key, SIM_NVS_NAME_LEN, 1, f) != 1 || fread(&length, sizeof(length), 1, f) != 1) {
+                nvs_entry_clear(entry);
+                break;
+            }
+            entry->data = sim_malloc(length ? length : 1);
+            entry->length = length;
+            if (length && fread(entry->data, length, 1, f) != 1) {
+                nvs_entry_clear(entry);
+                break;
+            }
+        }
+    }
+    fclose(f);
+}
+
+static void nvs_file_store(void)
+{
+    FILE *f = s_nvs_file ? fopen(s_nvs_file, "wb") : NULL;
+    if (!f) {
+        return;
+    }
+    uint32_t magic = SIM_NVS_FILE_MAGIC, count = 0;
+    for (int i = 0; i < SIM_NVS_MAX_ENTRIES; ++i) {
+        count += s_nvs[i].key[0] != 0;
+    }
+    fwrite(&magic, sizeof(magic), 1, f);
+    fwrite(&count, sizeof(count), 1, f);
+    for (int i = 0; i < SIM_NVS_MAX_ENTRIES; ++i) {
+        const sim_nvs_entry_t *entry = &s_nvs[i];
+        if (!entry->key[0]) {
+            continue;
+        }
+        uint32_t length = (uint32_t)entry->length;
+        fwrite(entry->namespace_name, SIM_NVS_NAME_LEN, 1, f);
+        fwrite(entry->key, SIM_NVS_NAME_LEN, 1, f);
+        fwrite(&length, sizeof(length), 1, f);
+        fwrite(entry->data, entry->length, 1, f);
+    }
+    fclose(f);
+}
+
+static sim_nvs_entry_t *nvs_find(nvs_handle_t handle, const char *key, bool create)
+{
+    if (handle == 0 || handle > SIM_NVS_MAX_HANDLES || !key) {
+        return NULL;
+    }
+    const char *ns = s_nvs_handles[handle - 1];
+    sim_nvs_entry_t *free_entry = NULL;
+    for (int i = 0; i < SIM_NVS_MAX_ENTRIES; ++i) {
+        sim_nvs_entry_t *entry = &s_nvs[i];
+        if (!entry->key[0]) {
+            free_entry = free_entry ? free_entry : entry;
+        } else if (strcmp(entry->namespace_name, ns) == 0 && strcmp(entry->key, key) == 0) {
+            return entry;
+        }
+    }
+    if (create && free_entry) {
+        strncpy(free_entry->namespace_name, ns, SIM_NVS_NAME_LEN - 1);
+        strncpy(free_entry->key, key, SIM_NVS_NAME_LEN - 1);
+        return free_entry;
+    }
+    return NULL;
+}
+
+esp_err_t nvs_flash_init(void)
+{
+    pthread_mutex_lock(&s_nvs_mutex);
+    if (!s_nvs_initialized) {
+        nvs_file_load();
+        s_nvs_initialized = true;
+    }
+    pthread_mutex_unlock(&s_nvs_mutex);
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void)
+{
+    pthread_mutex_lock(&s_nvs_mutex);
+    for (int i = 0; i < SIM_NVS_MAX_ENTRIES; ++i) {
+        nvs_entry_clear(&s_nvs[i]);
+    }
+    nvs_file_store();
+    pthread_mutex_unlock(&s_nvs_mutex);
+    return ESP_OK;
+}
+
+esp_err_t nvs_open(const char *namespace_name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle)
+{
+    (void)open_mode;
+    if (!s_nvs_initialized) {
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+    if (!namespace_name || strlen(namespace_name) >= SIM_NVS_NAME_LEN) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&s_nvs_mutex);
+    for (int i = 0; i < SIM_NVS_MAX_HANDLES; ++i) {
+        if (!s_nvs_handles[i][0]) {
+            strcpy(s_nvs_handles[i], namespace_name);
+            *out_handle = (nvs_handle_t)(i + 1);
+            pthread_mutex_unlock(&s_nvs_mutex);
+            return ESP_OK;
+        }
+    }
+    pthread_mutex_unlock(&s_nvs_mutex);
+    return ESP_ERR_NO_MEM;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+    if (handle == 0 || handle > SIM_NVS_MAX_HANDLES) {
+        return;
+    }
+    pthread_mutex_lock(&s_nvs_mutex);
+    s_nvs_handles[handle - 1][0] = 0;
+    pthread_mutex_unlock(&s_nvs_mutex);
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length)
+{
+    pthread_mutex_lock(&s_nvs_mutex);
+    sim_nvs_entry_t *entry = nvs_find(handle, key, false);
+    esp_err_t ret = ESP_OK;
+    if (!entry) {
+        ret = ESP_ERR_NVS_NOT_FOUND;
+    } else if (!out_value) {
+        *length = entry->length;
+    } else if (*length < entry->length) {
+        *length = entry->length;
+        ret = ESP_ERR_NVS_INVALID_LENGTH;
+    } else {
+        memcpy(out_value, entry->data, entry->length);
+        *length = entry->length;
+    }
+    pthread_mutex_unlock(&s_nvs_mutex);
+    return ret;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length)
+{
+    if (!key || strlen(key) >= SIM_NVS_NAME_LEN) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&s_nvs_mutex);
+    sim_nvs_entry_t *entry = nvs_find(handle, key, true);
+    if (!entry) {
+        pthread_mutex_unlock(&s_nvs_mutex);
+        return ESP_ERR_NVS_NO_FREE_PAGES;
+    }
+    sim_free(entry->data);
+    entry->data = sim_malloc(length ? length : 1);
+    memcpy(entry->data, value, length);
+    entry->length = length;
+    pthread_mutex_unlock(&s_nvs_mutex);
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char *key, uint32_t *out_value)
+{
+    size_t length = sizeof(*out_value);
+    return nvs_get_blob(handle, key, out_value, &length);
+}
+
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char *key, uint32_t value)
+{
+    return nvs_set_blob(handle, key, &value, sizeof(value));
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key)
+{
+    pthread_mutex_lock(&s_nvs_mutex);
+    sim_nvs_entry_t *entry = nvs_find(handle, key, false);
+    if (entry) {
+        nvs_entry_clear(entry);
+    }
+    pthread_mutex_unlock(&s_nvs_mutex);
+    return entry ? ESP_OK : ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    (void)handle;
+    pthread_mutex_lock(&s_nvs_mutex);
+    nvs_file_store();
+    pthread_mutex_unlock(&s_nvs_mutex);
+    return ESP_OK;
+}
+
+/* ---- partitions ---- */
+
+#define SIM_MAX_PARTITIONS  4
+#define SIM_MAX_MAPPINGS    8
+
+static esp_partition_t s_partitions[SIM_MAX_PARTITIONS];
+static unsigned s_partition_count;
+
+static struct {
+    void *addr;
+    size_t len;
+} s_mappings[SIM_MAX_MAPPINGS];
+
+void sim_partition_add(const char *label, uint8_t subtype, const char *path)
+{
+    struct stat st;
+    if (s_partition_count == SIM_MAX_PARTITIONS || stat(path, &st) != 0) {
+        fprintf(stderr, "sim: cannot add partition %s from %s\n", label, path);
+        exit(2);
+    }
+    esp_partition_t *partition = &s_partitions[s_partition_count++];
+    *partition = (esp_partition_t){
+        .type = ESP_PARTITION_TYPE_DATA,
+        .subtype = (esp_partition_subtype_t)subtype,
+        .size = (uint32_t)st.st_size,
+        .path = path,
+    };
+    snprintf(partition->label, sizeof(partition->label), "%s", label);
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                const char *label)
+{
+    for (unsigned i = 0; i < s_partition_count; ++i) {
+        const esp_partition_t *partition = &s_partitions[i];
+        if ((type == ESP_PARTITION_TYPE_ANY || partition->type == type) &&
+            (subtype == ESP_PARTITION_SUBTYPE_ANY || partition->subtype == subtype) &&
+            (!label || strcmp(partition->label, label) == 0)) {
+            return partition;
+        }
+    }
+    return NULL;
+}
+
+esp_err_t esp_partition_mmap(const esp_partition_t *partition, size_t offset, size_t size,
+                             esp_partition_mmap_memory_t memory, const void **out_ptr,
+                             esp_partition_mmap_handle_t *out_handle)
+{
+    (void)memory;
+    if (offset + size > partition->size || offset % 4096) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (uint32_t handle = 0; handle < SIM_MAX_MAPPINGS; ++handle) {
+        if (s_mappings[handle].addr) {
+            continue;
+        }
+        const int fd = open(partition->path, O_RDONLY);
+        if (fd < 0) {
+            return ESP_FAIL;
+        }
+        void *addr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, (off_t)offset);
+        close(fd);
+        if (addr == MAP_FAILED) {
+            return ESP_FAIL;
+        }
+        s_mappings[handle].addr = addr;
+        s_mappings[handle].len = size;
+        *out_ptr = addr;
+        *out_handle = handle;
+        return ESP_OK;
+    }
+    return ESP_ERR_NO_MEM;
+}
+
+void esp_partition_munmap(esp_partition_mmap_handle_t handle)
+{
+    if (handle < SIM_MAX_MAPPINGS && s_mappings[handle].addr) {
+        munmap(s_mappings[handle].addr, s_mappings[handle].len);
+        s_mappings[handle].addr = NULL;
+    }
+}
+
+/* ---- GPIO ---- */
+
+typedef struct {
+    int level;
+    gpio_int_type_t intr_type;
+    bool intr_enabled;
+    gpio_isr_t isr;
+    void *arg;
+} sim_gpio_t;
+
+static sim_gpio_t s_gpio[GPIO_NUM_MAX];
+static pthread_mutex_t s_gpio_mutex;
+static pthread_once_t s_gpio_once = PTHREAD_ONCE_INIT;
+
+static void gpio_mutex_init(void)
+{
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&s_gpio_mutex, &attr);
+    for (int i = 0; i < GPIO_NUM_MAX; ++i) {
+        s_gpio[i].level = 1;
+    }
+}
+
+static void gpio_lock(void)
+{
+    pthread_once(&s_gpio_once, gpio_mutex_init);
+    pthread_mutex_lock(&s_gpio_mutex);
+}
+
+static void gpio_unlock(void)
+{
+    pthread_mutex_unlock(&s_gpio_mutex);
+}
+
+static bool gpio_valid(gpio_num_t gpio_num)
+{
+    return gpio_num >= 0 && gpio_num < GPIO_NUM_MAX;
+}
+
+static bool gpio_level_active(const sim_gpio_t *io)
+{
+    return (io->intr_type == GPIO_INTR_LOW_LEVEL && io->level == 0) ||
+           (io->intr_type == GPIO_INTR_HIGH_LEVEL && io->level == 1);
+}
+
+/* Called with the GPIO mutex held; the handler runs in the caller's thread */
+static void gpio_raise(sim_gpio_t *io)
+{
+    if (io->intr_enabled && io->isr) {
+        io->isr(io->arg);
+    }
+}
+
+esp_err_t gpio_config(const gpio_config_t *config)
+{
+    gpio_lock();
+    for (int i = 0; i < GPIO_NUM_MAX; ++i) {
+        if (config->pin_bit_mask & (1ULL << i)) {
+            s_gpio[i].intr_type = config->intr_type;
+            s_gpio[i].intr_enabled = config->intr_type != GPIO_INTR_DISABLE;
+            if (config->pull_down_en && !config->pull_up_en) {
+                s_gpio[i].level = 0;
+            }
+        }
+    }
+    gpio_unlock();
+    return ESP_OK;
+}
+
+int gpio_get_level(gpio_num_t gpio_num)
+{
+    if (!gpio_valid(gpio_num)) {
+        return 0;
+    }
+    gpio_lock();
+    int level = s_gpio[gpio_num].level;
+    gpio_unlock();
+    return level;
+}
+
+esp_err_t gpio_set_intr_type(gpio_num_t gpio_num, gpio_int_type_t intr_type)
+{
+    if (!gpio_valid(gpio_num)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    gpio_lock();
+    s_gpio[gpio_num].intr_type = intr_type;
+    gpio_unlock();
+    return ESP_OK;
+}
+
+esp_err_t gpio_intr_enable(gpio_num_t gpio_num)
+{
+    if (!gpio_valid(gpio_num)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    gpio_lock();
+    sim_gpio_t *io = &s_gpio[gpio_num];
+    bool was_enabled = io->intr_enabled;
+    io->intr_enabled = true;
+    /* a level interrupt fires as soon as it is enabled while the level is active */
+    if (!was_enabled && gpio_level_active(io)) {
+        gpio_raise(io);
+    }
+    gpio_unlock();
+    return ESP_OK;
+}
+
+esp_err_t gpio_intr_disable(gpio_num_t gpio_num)
+{
+    if (!gpio_valid(gpio_num)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    gpio_lock();
+    s_gpio[gpio_num].intr_enabled = false;
+    gpio_unlock();
+    return ESP_OK;
+}
+
+esp_err_t gpio_install_isr_service(int intr_alloc_flags)
+{
+    (void)intr_alloc_flags;
+    return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_add(gpio_num_t gpio_num, gpio_isr_t isr_handler, void *args)
+{
+    if (!gpio_valid(gpio_num)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    gpio_lock();
+    s_gpio[gpio_num].isr = isr_handler;
+    s_gpio[gpio_num].arg = args;
+    gpio_unlock();
+    return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_remove(gpio_num_t gpio_num)
+{
+    if (!gpio_valid(gpio_num)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    gpio_lock();
+    s_gpio[gpio_num].isr = NULL;
+    s_gpio[gpio_num].arg = NULL;
+    gpio_unlock();
+    return ESP_OK;
+}
+
+void sim_gpio_set_level(int pin, int level)
+{
+    if (!gpio_valid(pin)) {
+        return;
+    }
+    gpio_lock();
+    sim_gpio_t *io = &s_gpio[pin];
+    int old = io->level;
+    io->level = level ? 1 : 0;
+    if (old != io->level) {
+        bool falling = io->level == 0;
+        switch (io->intr_type) {
+        case GPIO_INTR_NEGEDGE:
+            if (falling) {
+                gpio_raise(io);
+            }
+            break;
+        case GPIO_INTR_POSEDGE:
+            if (!falling) {
+                gpio_raise(io);
+            }
+            break;
+        case GPIO_INTR_ANYEDGE:
+            gpio_raise(io);
+            break;
+        case GPIO_INTR_LOW_LEVEL:
+        case GPIO_INTR_HIGH_LEVEL:
+            if (gpio_level_active(io)) {
+                gpio_raise(io);
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    gpio_unlock();
+}
+
+static unsigned s_bounce_count;
+static uint32_t s_bounce_period_us;
+
+void sim_gpio_set_bounce(unsigned count, uint32_t period_us)
+{
+    s_bounce_count = count;
+    s_bounce_period_us = period_us;
+}
+
+/* Contact bounce: the new level, then `count` glitches back to the old one */
+static void gpio_bounce_to(int pin, int level)
+{
+    sim_gpio_set_level(pin, level);
+    for (unsigned i = 0; i < s_bounce_count; ++i) {
+        sim_sleep_us(s_bounce_period_us);
+        sim_gpio_set_level(pin, !level);
+        sim_sleep_us(s_bounce_period_us);
+        sim_gpio_set_level(pin, level);
+    }
+}
+
+void sim_gpio_press(int pin, uint32_t hold_us)
+{
+    gpio_bounce_to(pin, 0);
+    sim_sleep_us(hold_us - 2LL * s_bounce_count * s_bounce_period_us);
+    gpio_bounce_to(pin, 1);
+}
+
+/* ---- console: commands run from the scenario thread, no REPL task ---- */
+
+#define SIM_CONSOLE_MAX_CMDS    16
+#define SIM_CONSOLE_MAX_ARGS    8
+
+static esp_console_cmd_t s_console_cmds[SIM_CONSOLE_MAX_CMDS];
+static unsigned s_console_cmd_count;
+
+esp_err_t esp_console_cmd_register(const esp_console_cmd_t *cmd)
+{
+    if (!cmd || !cmd->command || !cmd->func) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (s_console_cmd_count == SIM_CONSOLE_MAX_CMDS) {
+        return ESP_ERR_NO_MEM;
+    }
+    s_console_cmds[s_console_cmd_count++] = *cmd;
+    return ESP_OK;
+}
+
+static int console_help(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+    for (unsigned i = 0; i < s_console_cmd_count; ++i) {
+        printf("%s %s\n  %s\n", s_console_cmds[i].command, s_console_cmds[i].hint ? s_console_cmds[i].hint : "",
+               s_console_cmds[i].help ? s_console_cmds[i].help : "");
+    }
+    return 0;
+}
+
+esp_err_t esp_console_register_help_command(void)
+{
+    const esp_console_cmd_t cmd = {.command = "help", .help = "Print the list of commands", .func = console_help};
+    return esp_console_cmd_register(&cmd);
+}
+
+esp_err_t esp_console_new_repl_uart(const esp_console_dev_uart_config_t *dev_config,
+                                    const esp_console_repl_config_t *repl_config, esp_console_repl_t **ret_repl)
+{
+    (void)dev_config;
+    (void)repl_config;
+    *ret_repl = NULL;
+    return ESP_OK;
+}
+
+esp_err_t esp_console_new_repl_usb_serial_jtag(const esp_console_dev_usb_serial_jtag_config_t *dev_config,
+                                               const esp_console_repl_config_t *repl_config,
+                                               esp_console_repl_t **ret_repl)
+{
+    (void)dev_config;
+    (void)repl_config;
+    *ret_repl = NULL;
+    return ESP_OK;
+}
+
+esp_err_t esp_console_start_repl(esp_console_repl_t *repl)
+{
+    (void)repl;
+    return ESP_OK;
+}
+
+int sim_console_run(const char *line)
+{
+    char buf[256];
+    char *argv[SIM_CONSOLE_MAX_ARGS];
+    int argc = 0;
+    snprintf(buf, sizeof(buf), "%s", line);
+    for (char *save = NULL, *arg = strtok_r(buf, " \t", &save); arg && argc < SIM_CONSOLE_MAX_ARGS;
+         arg = strtok_r(NULL, " \t", &save)) {
+        argv[argc++] = arg;
+    }
+    if (!argc) {
+        return 0;
+    }
+    for (unsigned i = 0; i < s_console_cmd_count; ++i) {
+        if (strcmp(s_console_cmds[i].command, argv[0]) == 0) {
+            return s_console_cmds[i].func(argc, argv);
+        }
+    }
+    printf("Unrecognized command: %s\n", argv[0]);
+    return 1;
+}
+
+/* ---- USB serial/JTAG: the firmware holds the master of a pseudo-terminal ---- */
+
+static int s_serial_master = -1;
+static int s_serial_slave = -1;         /* kept open so the master never sees a hangup between hosts */
+static char s_serial_path[64];
+
+static void serial_open(void)
+{
+    if (s_serial_master >= 0) {
+        return;
+    }
+    s_serial_master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (s_serial_master < 0 || grantpt(s_serial_master) != 0 || unlockpt(s_serial_master) != 0 ||
+        ptsname_r(s_serial_master, s_serial_path, sizeof(s_serial_path)) != 0) {
+        perror("sim serial");
+        exit(1);
+    }
+    s_serial_slave = open(s_serial_path, O_RDWR | O_NOCTTY);
+    struct termios tio;
+    if (s_serial_slave < 0 || tcgetattr(s_serial_slave, &tio) != 0) {
+        perror("sim serial");
+        exit(1);
+    }
+    cfmakeraw(&tio);
+    tcsetattr(s_serial_slave, TCSANOW, &tio);
+}
+
+const char *sim_serial_path(void)
+{
+    serial_open();
+    return s_serial_path;
+}
+
+esp_err_t usb_serial_jtag_driver_install(usb_serial_jtag_driver_config_t *usb_serial_jtag_config)
+{
+    if (!usb_serial_jtag_config) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    serial_open();
+    return ESP_OK;
+}
+
+/* Milliseconds to poll for, -1 for ever */
+static int serial_poll_ms(TickType_t ticks_to_wait)
+{
+    return ticks_to_wait == portMAX_DELAY ? -1 : (int)(ticks_to_wait * portTICK_PERIOD_MS);
+}
+
+int usb_serial_jtag_read_bytes(void *buf, uint32_t length, TickType_t ticks_to_wait)
+{
+    struct pollfd pfd = {.fd = s_serial_master, .events = POLLIN};
+    if (poll(&pfd, 1, serial_poll_ms(ticks_to_wait)) <= 0 || !(pfd.revents & POLLIN)) {
+        return 0;
+    }
+    const ssize_t len = read(s_serial_master, buf, length);
+    return len > 0 ? (int)len : 0;
+}
+
+int usb_serial_jtag_write_bytes(const void *src, size_t size, TickType_t ticks_to_wait)
+{
+    const uint8_t *data = src;
+    size_t written = 0;
+    while (written < size) {
+        struct pollfd pfd = {.fd = s_serial_master, .events = POLLOUT};
+        if (poll(&pfd, 1, serial_poll_ms(ticks_to_wait)) <= 0) {
+            break;
+        }
+        const ssize_t len = write(s_serial_master, data + written, size - written);
+        if (len <= 0) {
+            break;
+        }
+        written += (size_t)len;
+    }
+    return (int)written;
+}
+
+/* ---- heap accounting ----
+ * The simulator is linked with --wrap for the allocator entry points so every
+ * allocation made by firmware code is counted. Simulator internals allocate
+ * through sim_malloc() and stay out of the statistics. Like the IDF with
+ * CONFIG_HEAP_USE_HOOKS, every counted allocation and free calls the
+ * firmware's heap hooks. The mock stack allocates through sim_stack_malloc(),
+ * which calls the hooks as esp-zigbee-lib's allocations would but stays out
+ * of the statistics too.
+ */
+
+/* heap an ESP32-C6 application has left once the Zigbee stack is up, roughly */
+#define SIM_HEAP_BYTES (256 * 1024)
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+static sim_heap_stats_t s_heap;
+static pthread_mutex_t s_heap_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void heap_account(void *ptr, bool alloc)
+{
+    if (!ptr) {
+        return;
+    }
+    size_t size = malloc_usable_size(ptr);
+    pthread_mutex_lock(&s_heap_mutex);
+    if (alloc) {
+        s_heap.allocs++;
+        s_heap.live_bytes += size;
+        if (s_heap.live_bytes > s_heap.peak_bytes) {
+            s_heap.peak_bytes = s_heap.live_bytes;
+        }
+    } else {
+        s_heap.frees++;
+        s_heap.live_bytes -= size;
+    }
+    pthread_mutex_unlock(&s_heap_mutex);
+}
+
+void *__wrap_malloc(size_t size)
+{
+    void *ptr = __real_malloc(size);
+    heap_account(ptr, true);
+    if (ptr) {
+        esp_heap_trace_alloc_hook(ptr, size, MALLOC_CAP_DEFAULT);
+    }
+    return ptr;
+}
+
+void *__wrap_calloc(size_t n, size_t size)
+{
+    void *ptr = __real_calloc(n, size);
+    heap_account(ptr, true);
+    if (ptr) {
+        esp_heap_trace_alloc_hook(ptr, n * size, MALLOC_CAP_DEFAULT);
+    }
+    return ptr;
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    heap_account(ptr, false);
+    if (ptr) {
+        esp_heap_trace_free_hook(ptr);
+    }
+    void *out = __real_realloc(ptr, size);
+    heap_account(out, true);
+    if (out) {
+        esp_heap_trace_alloc_hook(out, size, MALLOC_CAP_DEFAULT);
+    }
+    return out;
+}
+
+void __wrap_free(void *ptr)
+{
+    heap_account(ptr, false);
+    if (ptr) {
+        esp_heap_trace_free_hook(ptr);
+    }
+    __real_free(ptr);
+}
+
+void *sim_malloc(size_t size)
+{
+    return __real_malloc(size);
+}
+
+void sim_free(void *ptr)
+{
+    __real_free(ptr);
+}
+
+void *sim_stack_malloc(size_t size)
+{
+    void *ptr = __real_malloc(size);
+    if (ptr) {
+        esp_heap_trace_alloc_hook(ptr, size, MALLOC_CAP_DEFAULT);
+    }
+    return ptr;
+}
+
+void sim_stack_free(void *ptr)
+{
+    if (ptr) {
+        esp_heap_trace_free_hook(ptr);
+    }
+    __real_free(ptr);
+}
+
+void sim_heap_stats_get(sim_heap_stats_t *out)
+{
+    pthread_mutex_lock(&s_heap_mutex);
+    *out = s_heap;
+    pthread_mutex_unlock(&s_heap_mutex);
+}
+
+uint32_t esp_get_free_heap_size(void)
+{
+    pthread_mutex_lock(&s_heap_mutex);
+    const uint64_t live = s_heap.live_bytes;
+    pthread_mutex_unlock(&s_heap_mutex);
+    return live < SIM_HEAP_BYTES ? (uint32_t)(SIM_HEAP_BYTES - live) : 0;
+}
+
+uint32_t esp_get_minimum_free_heap_size(void)
+{
+    pthread_mutex_lock(&s_heap_mutex);
+    const uint64_t peak = s_heap.peak_bytes;
+    pthread_mutex_unlock(&s_heap_mutex);
+    return peak < SIM_HEAP_BYTES ? (uint32_t)(SIM_HEAP_BYTES - peak) : 0;
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t caps)
+{
+    (void)caps;
+    return esp_get_free_heap_size();
+}
+
+void esp_system_abort(const char *details)
+{
+    fflush(stdout);
+    fprintf(stderr, "abort: %s\n", details);
+    abort();
+}
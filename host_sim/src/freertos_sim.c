@@ -0,0 +1,312 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Lamp controller host simulation: FreeRTOS tasks and queues on pthreads
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "sim.h"
+
+#define SIM_TASK_HOST_STACK (256 * 1024)
+#define SIM_TASK_STACK_FILL 0xa5
+
+struct sim_task_s {
+    pthread_t thread;
+    char name[16];
+    TaskFunction_t code;
+    void *arg;
+    UBaseType_t priority;
+    uint32_t stack_depth;
+    uint8_t *stack;             /* host stack, painted with SIM_TASK_STACK_FILL below the task's first frame */
+    uintptr_t stack_base;       /* frame the task code was called from */
+    void *charge;               /* stand-in for the TCB and stack the IDF takes from the heap, NULL if static */
+};
+
+struct sim_queue_s {
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t head;
+    UBaseType_t count;
+    uint8_t *storage;
+    bool static_storage;
+};
+
+static __thread struct sim_task_s *s_current_task;
+
+static void deadline_after_ticks(struct timespec *ts, TickType_t ticks)
+{
+    clock_gettime(CLOCK_MONOTONIC, ts);
+    int64_t ns = ts->tv_nsec + (int64_t)ticks * portTICK_PERIOD_MS * 1000000;
+    ts->tv_sec += ns / 1000000000;
+    ts->tv_nsec = ns % 1000000000;
+}
+
+static void *task_trampoline(void *param)
+{
+    struct sim_task_s *task = param;
+    s_current_task = task;
+    task->stack_base = (uintptr_t)__builtin_frame_address(0);
+    task->code(task->arg);
+    return NULL;
+}
+
+/*
+ * Every task runs on a host stack of its own, painted before the thread
+ * starts: the depth of the untouched paint is its high-water mark. Host code
+ * needs more stack than the RISC-V build, so the marks err on the low side.
+ */
+static struct sim_task_s *task_start(TaskFunction_t task_code, const char *name, uint32_t stack_depth,
+                                     void *parameters, UBaseType_t priority)
+{
+    struct sim_task_s *task = sim_malloc(sizeof(*task));
+    if (!task) {
+        return NULL;
+    }
+    memset(task, 0, sizeof(*task));
+    task->stack = sim_malloc(SIM_TASK_HOST_STACK);
+    if (!task->stack) {
+        sim_free(task);
+        return NULL;
+    }
+    memset(task->stack, SIM_TASK_STACK_FILL, SIM_TASK_HOST_STACK);
+    strncpy(task->name, name ? name : "", sizeof(task->name) - 1);
+    task->code = task_code;
+    task->arg = parameters;
+    task->priority = priority;
+    task->stack_depth = stack_depth;
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstack(&attr, task->stack, SIM_TASK_HOST_STACK);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int rc = pthread_create(&task->thread, &attr, task_trampoline, task);
+    pthread_attr_destroy(&attr);
+    if (rc != 0) {
+        sim_free(task->stack);
+        sim_free(task);
+        return NULL;
+    }
+    return task;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t task_code, const char *name, uint32_t stack_depth,
+                       void *parameters, UBaseType_t priority, TaskHandle_t *created_task)
+{
+    /* the IDF takes the stack and the TCB from the heap, charge the caller for them */
+    void *charge = malloc(stack_depth + sizeof(StaticTask_t));
+    if (!charge) {
+        return pdFAIL;
+    }
+    struct sim_task_s *task = task_start(task_code, name, stack_depth, parameters, priority);
+    if (!task) {
+        free(charge);
+        return pdFAIL;
+    }
+    task->charge = charge;
+    if (created_task) {
+        *created_task = task;
+    }
+    return pdPASS;
+}
+
+TaskHandle_t xTaskCreateStatic(TaskFunction_t task_code, const char *name, uint32_t stack_depth, void *parameters,
+                               UBaseType_t priority, StackType_t *stack_buffer, StaticTask_t *task_buffer)
+{
+    if (!stack_buffer || !task_buffer) {
+        return NULL;
+    }
+    return task_start(task_code, name, stack_depth, parameters, priority);
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    if (task == NULL) {
+        task = s_current_task;
+    }
+    if (task) {
+        free(task->charge);
+        task->charge = NULL;
+    }
+    if (task == NULL || task == s_current_task) {
+        pthread_exit(NULL);
+    }
+    pthread_cancel(task->thread);
+}
+
+void vTaskDelay(const TickType_t ticks_to_delay)
+{
+    sim_sleep_us((int64_t)ticks_to_delay * portTICK_PERIOD_MS * 1000);
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return (TickType_t)(sim_now_us() / (portTICK_PERIOD_MS * 1000));
+}
+
+TickType_t xTaskGetTickCountFromISR(void)
+{
+    return xTaskGetTickCount();
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return s_current_task;
+}
+
+const char *pcTaskGetName(TaskHandle_t task)
+{
+    if (!task) {
+        task = s_current_task;
+    }
+    return task ? task->name : "main";
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task)
+{
+    if (!task) {
+        task = s_current_task;
+    }
+    if (!task || !task->stack_base) {
+        return 0;
+    }
+    const uint8_t *touched = task->stack;
+    while (touched < task->stack + SIM_TASK_HOST_STACK && *touched == SIM_TASK_STACK_FILL) {
+        ++touched;
+    }
+    const uintptr_t used = task->stack_base > (uintptr_t)touched ? task->stack_base - (uintptr_t)touched : 0;
+    return used < task->stack_depth ? (UBaseType_t)(task->stack_depth - used) : 0;
+}
+
+static QueueHandle_t queue_create(UBaseType_t length, UBaseType_t item_size, uint8_t *storage, bool static_storage)
+{
+    struct sim_queue_s *queue = sim_malloc(sizeof(*queue));
+    if (!queue) {
+        return NULL;
+    }
+    memset(queue, 0, sizeof(*queue));
+    queue->storage = storage;
+    queue->static_storage = static_storage;
+    queue->length = length;
+    queue->item_size = item_size;
+    pthread_mutex_init(&queue->mutex, NULL);
+    pthread_condattr_t cattr;
+    pthread_condattr_init(&cattr);
+    pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+    pthread_cond_init(&queue->not_empty, &cattr);
+    pthread_cond_init(&queue->not_full, &cattr);
+    pthread_condattr_destroy(&cattr);
+    return queue;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    /* the items come from the caller's heap, as on the IDF */
+    uint8_t *storage = malloc((size_t)length * item_size);
+    if (!storage) {
+        return NULL;
+    }
+    QueueHandle_t queue = queue_create(length, item_size, storage, false);
+    if (!queue) {
+        free(storage);
+    }
+    return queue;
+}
+
+QueueHandle_t xQueueCreateStatic(UBaseType_t length, UBaseType_t item_size, uint8_t *storage,
+                                 StaticQueue_t *queue_buffer)
+{
+    if (!storage || !queue_buffer) {
+        return NULL;
+    }
+    return queue_create(length, item_size, storage, true);
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+    if (!queue) {
+        return;
+    }
+    pthread_mutex_destroy(&queue->mutex);
+    pthread_cond_destroy(&queue->not_empty);
+    pthread_cond_destroy(&queue->not_full);
+    if (!queue->static_storage) {
+        free(queue->storage);
+    }
+    sim_free(queue);
+}
+
+static bool queue_wait(pthread_cond_t *cond, pthread_mutex_t *mutex, TickType_t ticks, const struct timespec *deadline)
+{
+    if (ticks == 0) {
+        return false;
+    }
+    if (ticks == portMAX_DELAY) {
+        pthread_cond_wait(cond, mutex);
+        return true;
+    }
+    return pthread_cond_timedwait(cond, mutex, deadline) != ETIMEDOUT;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks_to_wait)
+{
+    struct timespec deadline;
+    deadline_after_ticks(&deadline, ticks_to_wait == portMAX_DELAY ? 0 : ticks_to_wait);
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->count == queue->length) {
+        if (!queue_wait(&queue->not_full, &queue->mutex, ticks_to_wait, &deadline)) {
+            pthread_mutex_unlock(&queue->mutex);
+            return errQUEUE_FULL;
+        }
+    }
+    UBaseType_t tail = (queue->head + queue->count) % queue->length;
+    memcpy(queue->storage + (size_t)tail * queue->item_size, item, queue->item_size);
+    queue->count++;
+    pthread_cond_signal(&queue->not_empty);
+    pthread_mutex_unlock(&queue->mutex);
+    return pdPASS;
+}
+
+BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void *item, BaseType_t *higher_priority_task_woken)
+{
+    if (higher_priority_task_woken) {
+        *higher_priority_task_woken = pdFALSE;
+    }
+    return xQueueSend(queue, item, 0);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *buffer, TickType_t ticks_to_wait)
+{
+    struct timespec deadline;
+    deadline_after_ticks(&deadline, ticks_to_wait == portMAX_DELAY ? 0 : ticks_to_wait);
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->count == 0) {
+        if (!queue_wait(&queue->not_empty, &queue->mutex, ticks_to_wait, &deadline)) {
+            pthread_mutex_unlock(&queue->mutex);
+            return pdFALSE;
+        }
+    }
+    memcpy(buffer, queue->storage + (size_t)queue->head * queue->item_size, queue->item_size);
+    queue->head = (queue->head + 1) % queue->length;
+    queue->count--;
+    pthread_cond_signal(&queue->not_full);
+    pthread_mutex_unlock(&queue->mutex);
+    return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+    pthread_mutex_lock(&queue->mutex);
+    UBaseType_t count = queue->count;
+    pthread_mutex_unlock(&queue->mutex);
+    return count;
+}
@@ -0,0 +1,55 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Decoder for the lamp controller's binary log records
+ *
+ * Reads a console capture (a file or stdin) and prints it with every
+ * LAMP_LOG_HEX_PREFIX record line replaced by the text the firmware would
+ * have printed for it; all other lines pass through unchanged:
+ *
+ *   lamp_log_decode capture.txt
+ *   lamp_sim --log-binary --verbose | lamp_log_decode
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "lamp_log_format.h"
+
+int main(int argc, char **argv)
+{
+    FILE *in = stdin;
+    if (argc > 2 || (argc == 2 && strcmp(argv[1], "--help") == 0)) {
+        fprintf(stderr, "usage: %s [capture file]\n", argv[0]);
+        return 2;
+    }
+    if (argc == 2 && !(in = fopen(argv[1], "r"))) {
+        perror(argv[1]);
+        return 1;
+    }
+    unsigned records = 0;
+    unsigned undecodable = 0;
+    char line[1024];
+    while (fgets(line, sizeof(line), in)) {
+        lamp_log_record_t record;
+        if (!lamp_log_decode_hex(line, &record)) {
+            fputs(line, stdout);
+            continue;
+        }
+        char message[256];
+        const char *tag = lamp_log_tag(record.id);
+        if (!tag || lamp_log_format(message, sizeof(message), &record) < 0) {
+            printf("? (%lu) undecodable record %u with %u arguments, built from a different format table?\n",
+                   (unsigned long)record.time_ms, record.id, record.argc);
+            undecodable++;
+            continue;
+        }
+        printf("%c (%lu) %s: %s\n", record.level <= 5 ? "NEWIDV"[record.level] : '?', (unsigned long)record.time_ms,
+               tag, message);
+        records++;
+    }
+    if (in != stdin) {
+        fclose(in);
+    }
+    fprintf(stderr, "%u records decoded, %u undecodable\n", records, undecodable);
+    return 0;
+}
@@ -0,0 +1,664 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Lamp controller host simulation: scenario driver
+ *
+ * Boots the unmodified firmware (app_main) against the mock stack, waits for
+ * every simulated light to join and bind, then presses the toggle button a
+ * number of times and reports join/bind time, press-to-light latency, radio
+ * traffic and heap use per light.
+ *
+ * With --reboot the coordinator instead restarts on an already formed network
+ * whose lights stay joined and bound, and the first press is made right after
+ * boot; together with --nvs-file (kept from a previous run) this measures how
+ * soon the button works again after a power cycle.
+ *
+ * With --serial-commands the scenario then plays a host on the other end of
+ * the firmware's serial port, pipelining command frames as fast as they are
+ * acknowledged, and reports the command rate and whether the lights ended in
+ * the last commanded state.
+ */
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "esp_log.h"
+#include "lamp_log.h"
+#include "lamp_protocol.h"
+#include "lamp_serial.h"
+#include "light_color.h"
+#include "light_command.h"
+#include "light_schedule.h"
+#include "sim.h"
+#include "switch_driver.h"
+
+void app_main(void);
+
+#define SIM_REBOOT_PRESS_DELAY_US   (20 * 1000)
+#define SIM_MAX_CONSOLE_CMDS        4
+#define SIM_QUIET_US                (300 * 1000)    /* no ZCL requests for this long before pressing */
+#define SIM_SERIAL_ACK_TIMEOUT_MS   1000            /* the pty loses nothing, a missing ACK is a failure */
+#define SIM_SERIAL_FINAL_LEVEL      200             /* last serial frame sets every light to this */
+#define SIM_SERIAL_FINAL_MIREDS     370
+
+typedef struct {
+    sim_config_t sim;
+    unsigned presses;
+    unsigned burst;
+    uint32_t burst_gap_ms;
+    uint32_t press_interval_ms;
+    uint32_t hold_ms;
+    unsigned bounce;
+    int button_pin;
+    uint32_t settle_ms;
+    uint32_t join_timeout_ms;
+    const char *nvs_file;
+    const char *console[SIM_MAX_CONSOLE_CMDS];
+    unsigned console_count;
+    const char *start[SIM_MAX_CONSOLE_CMDS];
+    unsigned start_count;
+    uint32_t wait_ms;
+    const char *schedule_file;
+    bool log_binary;
+    bool verbose;
+    unsigned serial_commands;
+    unsigned serial_batch;
+    unsigned serial_window;
+    bool serial_pty;
+    unsigned background_reads;
+} scenario_t;
+
+static void usage(const char *prog)
+{
+    printf("usage: %s [options]\n"
+           "  --lights N            simulated lights (default 4, max %d)\n"
+           "  --hops N              lights are spread over 1..N hops (default 2)\n"
+           "  --hop-latency-us N    one-way latency per hop (default 4000)\n"
+           "  --hop-jitter-us N     uniform jitter per hop (default 1000)\n"
+           "  --loss P              per-hop transmission loss probability (default 0.02)\n"
+           "  --tx-frame-us N       coordinator radio time per request, requests queue for it (default 2000)\n"
+           "  --join-spacing-ms N   delay between light joins (default 50)\n"
+           "  --group-reject P      fraction of lights that refuse group membership (default 0)\n"
+           "  --presses N           button presses to simulate (default 10)\n"
+           "  --press-interval-ms N time between presses (default 500)\n"
+           "  --burst N             make every press a burst of N quick clicks (default 1)\n"
+           "  --burst-gap-ms N      time between clicks of a burst (default 40)\n"
+           "  --hold-ms N           how long each press is held (default 80)\n"
+           "  --bounce N            contact bounce glitches after each press edge, 300us apart (default 0)\n"
+           "  --button NAME         button to press: toggle, up or down (default toggle)\n"
+           "  --join-timeout-ms N   give up waiting for binds after N ms (default 20000)\n"
+           "  --seed N              random seed (default 1)\n"
+           "  --nvs-file PATH       persist NVS contents in PATH across runs\n"
+           "  --console CMD         run a console command at the end, repeatable (e.g. \"latency\")\n"
+           "  --start CMD           run a console command after joining, before the presses, repeatable\n"
+           "  --wait-ms N           keep running N ms after the presses, e.g. for a fade (default 0)\n"
+           "  --schedule PATH       schedule partition image, built with lamp_schedule\n"
+           "  --log-binary          print deferred log records as hex lines, for lamp_log_decode\n"
+           "  --reboot              start as a rebooted coordinator with lights already joined\n"
+           "  --rejoin              with --reboot, every light announces itself again (spaced by --join-spacing-ms)\n"
+           "  --zdo-slots N         ZDO requests the stack has out at once, more time out unsent (default 0: no limit)\n"
+           "  --serial-commands N   send N command records over the serial protocol after the presses\n"
+           "  --serial-batch N      records per frame (default 1, max %d)\n"
+           "  --serial-window N     frames in flight (default %d)\n"
+           "  --serial-pty          print the serial port's pty, for control.py (with --wait-ms)\n"
+           "  --background-reads N  read an attribute of every light N times per second during the presses\n"
+           "  --verbose             show firmware INFO logs\n",
+           prog, SIM_MAX_LIGHTS, LAMP_PROTO_MAX_PAYLOAD / 6, LAMP_PROTO_WINDOW);
+}
+
+static void parse_args(int argc, char **argv, scenario_t *sc)
+{
+    enum {
+        OPT_LIGHTS = 1, OPT_HOPS, OPT_HOP_LATENCY, OPT_HOP_JITTER, OPT_LOSS, OPT_JOIN_SPACING, OPT_GROUP_REJECT, OPT_PRESSES,
+        OPT_PRESS_INTERVAL, OPT_BURST, OPT_BURST_GAP, OPT_HOLD, OPT_BOUNCE, OPT_BUTTON, OPT_JOIN_TIMEOUT, OPT_SEED, OPT_NVS_FILE,
+        OPT_CONSOLE, OPT_START, OPT_WAIT, OPT_SCHEDULE, OPT_LOG_BINARY, OPT_REBOOT, OPT_VERBOSE,
+        OPT_SERIAL_COMMANDS, OPT_SERIAL_BATCH, OPT_SERIAL_WINDOW, OPT_SERIAL_PTY, OPT_TX_FRAME, OPT_BACKGROUND_READS,
+        OPT_REJOIN, OPT_ZDO_SLOTS, OPT_HELP,
+    };
+    static const struct option options[] = {
+        {"lights", required_argument, NULL, OPT_LIGHTS},
+        {"hops", required_argument, NULL, OPT_HOPS},
+        {"hop-latency-us", required_argument, NULL, OPT_HOP_LATENCY},
+        {"hop-jitter-us", required_argument, NULL, OPT_HOP_JITTER},
+        {"loss", required_argument, NULL, OPT_LOSS},
+        {"join-spacing-ms", required_argument, NULL, OPT_JOIN_SPACING},
+        {"group-reject", required_argument, NULL, OPT_GROUP_REJECT},
+        {"presses", required_argument, NULL, OPT_PRESSES},
+        {"press-interval-ms", required_argument, NULL, OPT_PRESS_INTERVAL},
+        {"burst", required_argument, NULL, OPT_BURST},
+        {"burst-gap-ms", required_argument, NULL, OPT_BURST_GAP},
+        {"hold-ms", required_argument, NULL, OPT_HOLD},
+        {"bounce", required_argument, NULL, OPT_BOUNCE},
+        {"button", required_argument, NULL, OPT_BUTTON},
+        {"join-timeout-ms", required_argument, NULL, OPT_JOIN_TIMEOUT},
+        {"seed", required_argument, NULL, OPT_SEED},
+        {"nvs-file", required_argument, NULL, OPT_NVS_FILE},
+        {"console", required_argument, NULL, OPT_CONSOLE},
+        {"start", required_argument, NULL, OPT_START},
+        {"wait-ms", required_argument, NULL, OPT_WAIT},
+        {"schedule", required_argument, NULL, OPT_SCHEDULE},
+        {"log-binary", no_argument, NULL, OPT_LOG_BINARY},
+        {"reboot", no_argument, NULL, OPT_REBOOT},
+        {"rejoin", no_argument, NULL, OPT_REJOIN},
+        {"zdo-slots", required_argument, NULL, OPT_ZDO_SLOTS},
+        {"verbose", no_argument, NULL, OPT_VERBOSE},
+        {"serial-commands", required_argument, NULL, OPT_SERIAL_COMMANDS},
+        {"serial-batch", required_argument, NULL, OPT_SERIAL_BATCH},
+        {"serial-window", required_argument, NULL, OPT_SERIAL_WINDOW},
+        {"serial-pty", no_argument, NULL, OPT_SERIAL_PTY},
+        {"tx-frame-us", required_argument, NULL, OPT_TX_FRAME},
+        {"background-reads", required_argument, NULL, OPT_BACKGROUND_READS},
+        {"help", no_argument, NULL, OPT_HELP},
+        {NULL, 0, NULL, 0},
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+        switch (opt) {
+        case OPT_LIGHTS: sc->sim.light_count = (unsigned)strtoul(optarg, NULL, 0); break;
+        case OPT_HOPS: sc->sim.max_hops = (unsigned)strtoul(optarg, NULL, 0); break;
+        case OPT_HOP_LATENCY: sc->sim.hop_latency_us = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case OPT_HOP_JITTER: sc->sim.hop_jitter_us = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case OPT_LOSS: sc->sim.hop_loss = strtod(optarg, NULL); break;
+        case OPT_JOIN_SPACING: sc->sim.join_spacing_us = (uint32_t)strtoul(optarg, NULL, 0) * 1000; break;
+        case OPT_GROUP_REJECT: sc->sim.group_reject = strtod(optarg, NULL); break;
+        case OPT_PRESSES: sc->presses = (unsigned)strtoul(optarg, NULL, 0); break;
+        case OPT_PRESS_INTERVAL: sc->press_interval_ms = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case OPT_BURST: sc->burst = (unsigned)strtoul(optarg, NULL, 0); break;
+        case OPT_BURST_GAP: sc->burst_gap_ms = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case OPT_HOLD: sc->hold_ms = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case OPT_BOUNCE: sc->bounce = (unsigned)strtoul(optarg, NULL, 0); break;
+        case OPT_BUTTON:
+            if (strcmp(optarg, "toggle") == 0) {
+                sc->button_pin = GPIO_INPUT_IO_TOGGLE_SWITCH;
+            } else if (strcmp(optarg, "up") == 0) {
+                sc->button_pin = GPIO_INPUT_IO_LEVEL_UP_SWITCH;
+            } else if (strcmp(optarg, "down") == 0) {
+                sc->button_pin = GPIO_INPUT_IO_LEVEL_DOWN_SWITCH;
+            } else {
+                usage(argv[0]);
+                exit(2);
+            }
+            break;
+        case OPT_JOIN_TIMEOUT: sc->join_timeout_ms = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case OPT_SEED: sc->sim.seed = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case OPT_NVS_FILE: sc->nvs_file = optarg; break;
+        case OPT_CONSOLE:
+            if (sc->console_count == SIM_MAX_CONSOLE_CMDS) {
+                usage(argv[0]);
+                exit(2);
+            }
+            sc->console[sc->console_count++] = optarg;
+            break;
+        case OPT_START:
+            if (sc->start_count == SIM_MAX_CONSOLE_CMDS) {
+                usage(argv[0]);
+                exit(2);
+            }
+            sc->start[sc->start_count++] = optarg;
+            break;
+        case OPT_WAIT: sc->wait_ms = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case OPT_SCHEDULE: sc->schedule_file = optarg; break;
+        case OPT_LOG_BINARY: sc->log_binary = true; break;
+        case OPT_REBOOT: sc->sim.rebooted = true; break;
+        case OPT_REJOIN: sc->sim.rejoin = true; break;
+        case OPT_ZDO_SLOTS: sc->sim.zdo_slots = (unsigned)strtoul(optarg, NULL, 0); break;
+        case OPT_VERBOSE: sc->verbose = true; break;
+        case OPT_SERIAL_COMMANDS: sc->serial_commands = (unsigned)strtoul(optarg, NULL, 0); break;
+        case OPT_SERIAL_BATCH: sc->serial_batch = (unsigned)strtoul(optarg, NULL, 0); break;
+        case OPT_SERIAL_WINDOW: sc->serial_window = (unsigned)strtoul(optarg, NULL, 0); break;
+        case OPT_TX_FRAME: sc->sim.tx_frame_us = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case OPT_BACKGROUND_READS: sc->background_reads = (unsigned)strtoul(optarg, NULL, 0); break;
+        case OPT_SERIAL_PTY: sc->serial_pty = true; break;
+        case OPT_HELP: usage(argv[0]); exit(0);
+        default: usage(argv[0]); exit(2);
+        }
+    }
+}
+
+static int compare_i64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void print_distribution(const char *name, int64_t *samples, size_t count)
+{
+    if (count == 0) {
+        printf("%-24s n=0\n", name);
+        return;
+    }
+    qsort(samples, count, sizeof(*samples), compare_i64);
+    int64_t sum = 0;
+    for (size_t i = 0; i < count; ++i) {
+        sum += samples[i];
+    }
+    printf("%-24s n=%zu min=%.2fms p50=%.2fms p95=%.2fms max=%.2fms mean=%.2fms\n", name, count,
+           samples[0] / 1000.0, samples[count / 2] / 1000.0, samples[(count * 95) / 100] / 1000.0,
+           samples[count - 1] / 1000.0, (double)sum / count / 1000.0);
+}
+
+/* ---- background load ---- */
+
+/* bulk traffic next to the presses: reads of the OTA file version, which the attribute cache never answers */
+typedef struct {
+    pthread_t thread;
+    int64_t period_us;
+    atomic_bool stop;
+} background_t;
+
+static void *background_run(void *arg)
+{
+    background_t *bg = arg;
+    int64_t next = sim_now_us();
+    while (!atomic_load(&bg->stop)) {
+        light_cmd_t cmd = {
+            .type = LIGHT_CMD_READ_ATTRS,
+            .targets = ~(light_mask_t)0,
+            .read = {.cluster_id = ESP_ZB_ZCL_CLUSTER_ID_OTA_UPGRADE, .count = 1,
+                     .ids = {ESP_ZB_ZCL_ATTR_OTA_UPGRADE_FILE_VERSION_ID}},
+        };
+        light_command_post(&cmd);
+        next += bg->period_us;
+        sim_sleep_us(next - sim_now_us());
+    }
+    return NULL;
+}
+
+/* ---- serial host ---- */
+
+typedef struct {
+    int fd;
+    lamp_proto_decoder_t decoder;
+    unsigned acks;
+    unsigned errors;
+    uint8_t hello[LAMP_PROTO_HELLO_ACK_SIZE];
+    int64_t sent_us[256];       /* by sequence number */
+    int64_t *rtt_us;
+    size_t rtt_count;
+} serial_host_t;
+
+static void serial_host_frame(const lamp_proto_frame_t *frame, void *ctx)
+{
+    serial_host_t *host = ctx;
+    if (frame->type != LAMP_PROTO_ACK || !frame->length) {
+        return;
+    }
+    host->acks++;
+    host->errors += frame->payload[0] != LAMP_PROTO_OK;
+    if (frame->length == 1 + LAMP_PROTO_HELLO_ACK_SIZE) {
+        memcpy(host->hello, frame->payload + 1, LAMP_PROTO_HELLO_ACK_SIZE);
+    }
+    host->rtt_us[host->rtt_count++] = sim_now_us() - host->sent_us[frame->seq];
+}
+
+static void serial_host_send(serial_host_t *host, uint8_t type, uint8_t seq, const uint8_t *payload, size_t length)
+{
+    uint8_t frame[LAMP_PROTO_MAX_FRAME];
+    const size_t len = lamp_proto_encode(frame, sizeof(frame), type, seq, payload, length);
+    host->sent_us[seq] = sim_now_us();
+    if (write(host->fd, frame, len) != (ssize_t)len) {
+        perror("serial host");
+    }
+}
+
+/* Wait for ACKs until `acks` have arrived; false on timeout */
+static bool serial_host_wait(serial_host_t *host, unsigned acks)
+{
+    while (host->acks < acks) {
+        struct pollfd pfd = {.fd = host->fd, .events = POLLIN};
+        uint8_t buf[512];
+        if (poll(&pfd, 1, SIM_SERIAL_ACK_TIMEOUT_MS) <= 0) {
+            return false;
+        }
+        const ssize_t len = read(host->fd, buf, sizeof(buf));
+        if (len > 0) {
+            lamp_proto_decoder_feed(&host->decoder, buf, (size_t)len, serial_host_frame, host);
+        }
+    }
+    return true;
+}
+
+/* Record i of the load: levels and colors spread over the lights, alternating */
+static void serial_host_record(unsigned i, unsigned lights, lamp_proto_record_t *record)
+{
+    *record = (lamp_proto_record_t){.target = (uint8_t)(i / 2 % lights)};
+    if (i % 2) {
+        record->op = LAMP_PROTO_OP_XY;
+        record->x = (uint16_t)(10000 + i * 97 % 30000);
+        record->y = (uint16_t)(10000 + i * 61 % 30000);
+    } else {
+        record->op = LAMP_PROTO_OP_LEVEL;
+        record->level = (uint8_t)(1 + i % 250);
+    }
+}
+
+static void serial_commands(const scenario_t *sc, unsigned lights)
+{
+    serial_host_t host = {.fd = open(sim_serial_path(), O_RDWR | O_NOCTTY)};
+    if (host.fd < 0) {
+        perror("serial host");
+        return;
+    }
+    const unsigned batch = sc->serial_batch ? sc->serial_batch : 1;
+    const unsigned window = sc->serial_window ? sc->serial_window : LAMP_PROTO_WINDOW;
+    const unsigned frames = (sc->serial_commands + batch - 1) / batch + 1;
+    host.rtt_us = sim_malloc(sizeof(int64_t) * (frames + 1));
+    lamp_proto_decoder_init(&host.decoder);
+
+    serial_host_send(&host, LAMP_PROTO_HELLO, 0, NULL, 0);
+    if (!serial_host_wait(&host, 1)) {
+        printf("serial: no answer to HELLO\n");
+        goto done;
+    }
+    printf("serial: protocol %u, max payload %u, window %u\n", host.hello[0], host.hello[1], host.hello[2]);
+
+    const int64_t t0 = sim_now_us();
+    unsigned record = 0;
+    for (unsigned f = 1; f <= frames; ++f) {
+        uint8_t payload[LAMP_PROTO_MAX_PAYLOAD];
+        size_t length = 0;
+        lamp_proto_record_t r;
+        if (f < frames) {
+            for (unsigned b = 0; b < batch && record < sc->serial_commands; ++b) {
+                serial_host_record(record++, lights, &r);
+                length += lamp_proto_put_record(payload + length, sizeof(payload) - length, &r);
+            }
+        } else {
+            r = (lamp_proto_record_t){.op = LAMP_PROTO_OP_LEVEL, .target = LAMP_PROTO_TARGET_ALL,
+                                      .level = SIM_SERIAL_FINAL_LEVEL};
+            length += lamp_proto_put_record(payload + length, sizeof(payload) - length, &r);
+            r = (lamp_proto_record_t){.op = LAMP_PROTO_OP_MIREDS, .target = LAMP_PROTO_TARGET_ALL,
+                                      .mireds = SIM_SERIAL_FINAL_MIREDS};
+            length += lamp_proto_put_record(payload + length, sizeof(payload) - length, &r);
+        }
+        if (f > window && !serial_host_wait(&host, 1 + f - window)) {
+            break;
+        }
+        serial_host_send(&host, LAMP_PROTO_COMMANDS, (uint8_t)f, payload, length);
+    }
+    const bool answered = serial_host_wait(&host, 1 + frames);
+    const int64_t elapsed_us = sim_now_us() - t0;
+    printf("serial: %u records in %u frames (batch %u, window %u) in %.1fms: %.0f records/s, acks=%u/%u errors=%u%s\n",
+           record + 2, frames, batch, window, elapsed_us / 1000.0, (record + 2) * 1e6 / elapsed_us,
+           host.acks - 1, frames, host.errors, answered ? "" : " (timed out)");
+    print_distribution("serial-ack-rtt", host.rtt_us + 1, host.rtt_count ? host.rtt_count - 1 : 0);
+
+    /* every light ends at the final frame's level and color */
+    uint16_t x, y;
+    light_color_mireds_to_xy(SIM_SERIAL_FINAL_MIREDS, &x, &y);
+    const int64_t deadline = sim_now_us() + (int64_t)sc->settle_ms * 1000;
+    unsigned wrong;
+    do {
+        sim_sleep_us(10 * 1000);
+        wrong = 0;
+        for (unsigned i = 0; i < lights; ++i) {
+            sim_light_t light;
+            sim_light_get(i, &light);
+            wrong += light.bound_us &&
+                     (light.level != SIM_SERIAL_FINAL_LEVEL || light.color_x != x || light.color_y != y);
+        }
+    } while (wrong && sim_now_us() < deadline);
+    printf("serial: final state %s (%u/%u lights wrong)\n", wrong ? "WRONG" : "ok", wrong, lights);
+
+    lamp_serial_stats_t stats;
+    lamp_serial_get_stats(&stats);
+    printf("serial: bytes=%u reads=%u (%.1f bytes/read) frames=%u bad_frames=%u rejected=%u records=%u "
+           "mailbox_waits=%u write_drops=%u\n",
+           (unsigned)stats.bytes, (unsigned)stats.reads, stats.reads ? (double)stats.bytes / stats.reads : 0.0,
+           (unsigned)stats.frames, (unsigned)stats.bad_frames, (unsigned)stats.rejected, (unsigned)stats.records,
+           (unsigned)stats.mailbox_waits, (unsigned)stats.write_drops);
+done:
+    sim_free(host.rtt_us);
+    close(host.fd);
+}
+
+int main(int argc, char **argv)
+{
+    scenario_t sc = {
+        .presses = 10,
+        .burst = 1,
+        .burst_gap_ms = 40,
+        .press_interval_ms = 500,
+        .hold_ms = 80,
+        .button_pin = GPIO_INPUT_IO_TOGGLE_SWITCH,
+        .settle_ms = 2000,
+        .join_timeout_ms = 20000,
+    };
+    sim_config_default(&sc.sim);
+    parse_args(argc, argv, &sc);
+    if (sc.burst == 0) {
+        sc.burst = 1;
+    }
+    esp_log_level_set("*", sc.verbose ? ESP_LOG_INFO : ESP_LOG_WARN);
+    sim_nvs_set_file(sc.nvs_file);
+    if (sc.schedule_file) {
+        sim_partition_add(LIGHT_SCHEDULE_PARTITION_LABEL, LIGHT_SCHEDULE_PARTITION_SUBTYPE, sc.schedule_file);
+    }
+    sim_gpio_set_bounce(sc.bounce, 300);
+    sim_init(&sc.sim);
+    const unsigned lights = sim_light_count();
+
+    printf("lights=%u hops=1..%u hop_latency=%uus jitter=%uus loss=%.3f seed=%u%s\n", lights, sc.sim.max_hops,
+           sc.sim.hop_latency_us, sc.sim.hop_jitter_us, sc.sim.hop_loss, sc.sim.seed,
+           sc.sim.rebooted ? " (reboot)" : "");
+
+    app_main();
+    lamp_log_set_binary(sc.log_binary);
+    if (sc.serial_pty) {
+        printf("serial port: %s\n", sim_serial_path());
+        fflush(stdout);
+    }
+    if (sc.sim.rebooted) {
+        /* leave the stack time to start the switch driver */
+        sim_sleep_us(SIM_REBOOT_PRESS_DELAY_US);
+    }
+
+    /* ---- join and bind ---- */
+    const int64_t join_deadline = sim_now_us() + (int64_t)sc.join_timeout_ms * 1000;
+    while (sim_lights_bound() < lights && sim_now_us() < join_deadline) {
+        sim_sleep_us(10 * 1000);
+    }
+    int64_t *samples = sim_malloc(sizeof(int64_t) * (lights * (sc.presses + 1) + 1));
+    int64_t *final_samples = sim_malloc(sizeof(int64_t) * (lights * sc.presses + 1));
+    size_t final_count = 0;
+    size_t count = 0;
+    int64_t last_bound = 0;
+    for (unsigned i = 0; i < lights; ++i) {
+        sim_light_t light;
+        sim_light_get(i, &light);
+        if (light.bound_us && light.annce_us) {
+            samples[count++] = light.bound_us - light.annce_us;
+            if (light.bound_us > last_bound) {
+                last_bound = light.bound_us;
+            }
+        }
+    }
+    if (sc.sim.rebooted) {
+        printf("rebooted with %u/%u lights already joined and bound\n", sim_lights_bound(), lights);
+    } else {
+        printf("bound %u/%u lights, all bound at %.1fms after boot\n", (unsigned)count, lights, last_bound / 1000.0);
+        print_distribution("annce-to-bound", samples, count);
+    }
+
+    if (!sc.sim.rebooted || sc.sim.rejoin) {
+        /* let post-bind commissioning traffic (group and scene setup) finish first */
+        sim_stats_t quiet;
+        sim_stats_get(&quiet);
+        int64_t quiet_since = sim_now_us();
+        while (sim_now_us() - quiet_since < SIM_QUIET_US && sim_now_us() < join_deadline) {
+            sim_sleep_us(10 * 1000);
+            sim_stats_t now;
+            sim_stats_get(&now);
+            if (now.zcl_requests != quiet.zcl_requests || now.zdo_requests != quiet.zdo_requests) {
+                quiet = now;
+                quiet_since = sim_now_us();
+            }
+        }
+        printf("commissioning traffic ended %.1fms after boot: zdo_requests=%u (%u found no slot) zcl_requests=%u\n",
+               quiet_since / 1000.0, (unsigned)quiet.zdo_requests, (unsigned)quiet.zdo_dropped,
+               (unsigned)quiet.zcl_requests);
+    }
+
+    sim_heap_stats_t heap_join;
+    sim_heap_stats_get(&heap_join);
+    printf("heap after join: live=%llu bytes peak=%llu allocs=%llu frees=%llu (%.1f live bytes/light)\n",
+           (unsigned long long)heap_join.live_bytes, (unsigned long long)heap_join.peak_bytes,
+           (unsigned long long)heap_join.allocs, (unsigned long long)heap_join.frees,
+           lights ? (double)heap_join.live_bytes / lights : 0.0);
+
+    for (unsigned i = 0; i < sc.start_count; ++i) {
+        printf("lamp> %s\n", sc.start[i]);
+        sim_console_run(sc.start[i]);
+    }
+
+    /* ---- button presses ---- */
+    background_t background = {.period_us = sc.background_reads ? 1000000 / sc.background_reads : 0};
+    atomic_init(&background.stop, false);
+    if (sc.background_reads) {
+        pthread_create(&background.thread, NULL, background_run, &background);
+    }
+    sim_stats_t before, after;
+    sim_stats_get(&before);
+    count = 0;
+    unsigned missed = 0;
+    for (unsigned p = 0; p < sc.presses; ++p) {
+        sim_mark();
+        const int64_t t0 = sim_now_us();
+        int64_t t_last = t0;
+        for (unsigned b = 0; b < sc.burst; ++b) {
+            if (b) {
+                sim_sleep_us(t0 + (int64_t)b * sc.burst_gap_ms * 1000 - sim_now_us());
+            }
+            t_last = sim_now_us();
+            sim_gpio_press(sc.button_pin, sc.hold_ms * 1000);
+        }
+        const int64_t settle_deadline = t0 + (int64_t)sc.settle_ms * 1000;
+        unsigned pending;
+        do {
+            sim_sleep_us(2000);
+            pending = 0;
+            for (unsigned i = 0; i < lights; ++i) {
+                sim_light_t light;
+                sim_light_get(i, &light);
+                pending += light.bound_us && light.mark_change_us == 0;
+            }
+        } while (pending && sim_now_us() < settle_deadline);
+        for (unsigned i = 0; i < lights; ++i) {
+            sim_light_t light;
+            sim_light_get(i, &light);
+            if (!light.bound_us) {
+                continue;
+            }
+            if (light.mark_change_us) {
+                samples[count++] = light.mark_change_us - t0;
+            } else {
+                missed++;
+            }
+        }
+        const int64_t next = t0 + (int64_t)sc.press_interval_ms * 1000;
+        sim_sleep_us(next - sim_now_us());
+        if (sc.burst > 1) {
+            /* when each light settled on the value of the burst's last click */
+            for (unsigned i = 0; i < lights; ++i) {
+                sim_light_t light;
+                sim_light_get(i, &light);
+                if (light.bound_us && light.last_change_us >= t_last) {
+                    final_samples[final_count++] = light.last_change_us - t_last;
+                }
+            }
+        }
+    }
+    sim_stats_get(&after);
+    if (sc.background_reads) {
+        atomic_store(&background.stop, true);
+        pthread_join(background.thread, NULL);
+    }
+    sim_sleep_us((int64_t)sc.wait_ms * 1000);
+
+    print_distribution("press-to-light", samples, count);
+    if (sc.burst > 1) {
+        print_distribution("last-click-to-light", final_samples, final_count);
+    }
+    int64_t first_change = 0;
+    for (unsigned i = 0; i < lights; ++i) {
+        sim_light_t light;
+        sim_light_get(i, &light);
+        if (light.first_change_us && (!first_change || light.first_change_us < first_change)) {
+            first_change = light.first_change_us;
+        }
+    }
+    if (first_change) {
+        printf("boot-to-first-light-change: %.2fms\n", first_change / 1000.0);
+    } else {
+        printf("boot-to-first-light-change: never\n");
+    }
+    printf("missed light updates: %u\n", missed);
+    unsigned on = 0, level_min = 255, level_max = 0, x_min = UINT16_MAX, x_max = 0, y_min = UINT16_MAX, y_max = 0;
+    for (unsigned i = 0; i < lights; ++i) {
+        sim_light_t light;
+        sim_light_get(i, &light);
+        on += light.on_off;
+        level_min = light.level < level_min ? light.level : level_min;
+        level_max = light.level > level_max ? light.level : level_max;
+        x_min = light.color_x < x_min ? light.color_x : x_min;
+        x_max = light.color_x > x_max ? light.color_x : x_max;
+        y_min = light.color_y < y_min ? light.color_y : y_min;
+        y_max = light.color_y > y_max ? light.color_y : y_max;
+    }
+    printf("lights at end: on=%u/%u level min=%u max=%u x min=%u max=%u y min=%u max=%u\n", on, lights, level_min,
+           level_max, x_min, x_max, y_min, y_max);
+    if (sc.presses) {
+        printf("per press (burst of %u): zcl_requests=%.2f frames_on_air=%.2f frames_lost=%.2f "
+               "default_responses=%.2f reports=%.2f\n",
+               sc.burst,
+               (double)(after.zcl_requests - before.zcl_requests) / sc.presses,
+               (double)(after.frames_on_air - before.frames_on_air) / sc.presses,
+               (double)(after.frames_lost - before.frames_lost) / sc.presses,
+               (double)(after.default_responses - before.default_responses) / sc.presses,
+               (double)(after.reports - before.reports) / sc.presses);
+    }
+
+    if (sc.serial_commands) {
+        serial_commands(&sc, lights);
+    }
+
+    switch_driver_stats_t button;
+    switch_driver_get_stats(&button);
+    printf("button: presses=%u bounces=%u callbacks=%u (press=%u double=%u hold=%u hold-release=%u) "
+           "decided-to-callback mean=%.3fms max=%.3fms\n",
+           (unsigned)button.presses, (unsigned)button.bounces, (unsigned)button.callbacks,
+           (unsigned)button.gestures[SWITCH_GESTURE_PRESS], (unsigned)button.gestures[SWITCH_GESTURE_DOUBLE_PRESS],
+           (unsigned)button.gestures[SWITCH_GESTURE_HOLD], (unsigned)button.gestures[SWITCH_GESTURE_HOLD_RELEASE],
+           button.callbacks ? (double)button.latency_total_us / button.callbacks / 1000.0 : 0.0,
+           button.latency_max_us / 1000.0);
+    light_command_stats_t mailbox;
+    light_command_get_stats(&mailbox);
+    printf("mailbox: enqueued=%u dropped=%u sent=%u coalesced=%u filtered=%u cached_reads=%u dropped_reads=%u "
+           "max_depth=%u enqueue-to-send mean=%.2fms max=%.2fms\n",
+           (unsigned)mailbox.enqueued, (unsigned)mailbox.dropped, (unsigned)mailbox.sent,
+           (unsigned)mailbox.coalesced, (unsigned)mailbox.filtered, (unsigned)mailbox.cached_reads,
+           (unsigned)mailbox.dropped_reads, mailbox.max_depth,
+           mailbox.sent ? (double)mailbox.latency_total_us / mailbox.sent / 1000.0 : 0.0,
+           mailbox.latency_max_us / 1000.0);
+
+    sim_heap_stats_t heap_end;
+    sim_heap_stats_get(&heap_end);
+    printf("heap at end: live=%llu bytes allocs since join=%llu\n", (unsigned long long)heap_end.live_bytes,
+           (unsigned long long)(heap_end.allocs - heap_join.allocs));
+
+    for (unsigned i = 0; i < sc.console_count; ++i) {
+        printf("lamp> %s\n", sc.console[i]);
+        sim_console_run(sc.console[i]);
+    }
+
+    sim_free(final_samples);
+    sim_free(samples);
+    sim_stop();
+    return 0;
+}
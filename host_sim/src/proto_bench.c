@@ -0,0 +1,645 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Throughput of the lamp controller's serial protocol over a pseudo-terminal
+ *
+ * A controller model on the slave side of a pty decodes frames, applies
+ * command records in sequence and acknowledges them the way the Arduino
+ * sketch does; the host side sends a fixed stream of commands with a window
+ * of unacknowledged frames and a number of records per frame, sends again
+ * from a lost frame on (go-back-N), and at the end checks that the
+ * controller holds the last level and color of every light:
+ *
+ *   lamp_proto_bench                              window x batch matrix
+ *   lamp_proto_bench --window 8 --batch 16 --corrupt 0.001
+ *
+ * The controller reads its input every --poll-us, as a loop polling a USB
+ * serial port would, and --baud limits what it can read per poll as a UART
+ * would; a pty itself has no line rate.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include "lamp_protocol.h"
+
+#define BENCH_LIGHTS        8
+#define TELEMETRY_PERIOD_MS 100
+#define MIN_RTO_NS          5000000
+#define XY_RANGE            65280   /* ZCL color x and y are at most 65279 */
+
+typedef struct {
+    unsigned commands;
+    unsigned window;            /* 0 runs the matrix */
+    unsigned batch;
+    unsigned poll_us;
+    unsigned baud;              /* 0: as fast as the pty goes */
+    unsigned timeout_ms;
+    double corrupt;             /* probability of a bit error per byte, both directions */
+    uint32_t seed;
+} options_t;
+
+/* last level and color of a light, as the host meant them and as the controller holds them */
+typedef struct {
+    bool level_set;
+    bool color_set;
+    uint8_t level;
+    uint16_t x;
+    uint16_t y;
+} light_state_t;
+
+typedef struct {
+    int fd;
+    const options_t *options;
+    atomic_bool stop;
+    atomic_bool corrupting;     /* set once the handshake is done */
+    uint32_t rng;
+    lamp_proto_decoder_t decoder;
+    lamp_proto_sequencer_t sequencer;
+    light_state_t lights[BENCH_LIGHTS];
+    lamp_proto_telemetry_t stats;
+    uint16_t telemetry_period_ms;
+    uint64_t telemetry_sent_ns;
+    uint64_t start_ns;
+    uint8_t tx_seq;
+    uint8_t out[8192];          /* replies of one poll, written at once */
+    size_t out_len;
+} device_t;
+
+typedef struct {
+    uint8_t frame[LAMP_PROTO_MAX_FRAME];
+    size_t len;
+    uint64_t sent_ns;
+    bool resent;
+} outstanding_t;
+
+typedef struct {
+    /* frames are numbered from 0 by the host, seq is the number plus 1 modulo 256: HELLO has 0 */
+    uint32_t base;              /* oldest unacknowledged */
+    uint32_t next;              /* next to send */
+    uint32_t built;             /* frames built so far; lower ones are sent again from their slot */
+    uint32_t total;
+    uint32_t goback_frame;      /* frame the last go-back restarted from */
+    uint32_t goback_err;        /* frame of the last sequence error reported since */
+    bool goback_valid;
+    bool hello_acked;
+    outstanding_t slots[LAMP_PROTO_WINDOW];
+    uint64_t bytes;
+    uint32_t resent;
+    uint32_t gobacks;
+    uint32_t timeouts;
+    uint32_t telemetry;
+    lamp_proto_telemetry_t last_telemetry;
+    uint64_t rtt_ns;
+    uint32_t rtt_count;
+    double srtt_ns;             /* smoothed round trip and its variation, for the timeout */
+    double rttvar_ns;
+    uint64_t rto_ns;
+    uint64_t max_rto_ns;
+    uint32_t errors;            /* ACKs with a status other than OK or a sequence error */
+} host_t;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static uint32_t rng_next(uint32_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+static double rng_unit(uint32_t *state)
+{
+    return rng_next(state) / 4294967296.0;
+}
+
+/* Flip a bit in bytes picked with the line's error probability */
+static void corrupt(uint8_t *data, size_t len, double probability, uint32_t *rng)
+{
+    if (probability <= 0) {
+        return;
+    }
+    for (size_t i = 0; i < len; ++i) {
+        if (rng_unit(rng) < probability) {
+            data[i] ^= (uint8_t)(1u << (rng_next(rng) & 7));
+        }
+    }
+}
+
+static void write_all(int fd, const uint8_t *data, size_t len)
+{
+    while (len) {
+        const ssize_t written = write(fd, data, len);
+        if (written < 0) {
+            if (errno == EINTR || errno == EAGAIN) {
+                continue;
+            }
+            perror("write");
+            exit(1);
+        }
+        data += written;
+        len -= (size_t)written;
+    }
+}
+
+/* ---- controller model, as the Arduino sketch handles frames ---- */
+
+static void device_send(device_t *device, uint8_t type, uint8_t seq, const void *payload, size_t length)
+{
+    device->out_len += lamp_proto_encode(device->out + device->out_len, sizeof(device->out) - device->out_len, type, seq,
+                                         payload, length);
+}
+
+static uint8_t device_commands(device_t *device, const uint8_t *payload, size_t length)
+{
+    lamp_proto_record_t record;
+    for (size_t offset = 0, size; offset < length; offset += size) {
+        size = lamp_proto_get_record(payload + offset, length - offset, &record);
+        if (!size) {
+            return LAMP_PROTO_ERR_MALFORMED;
+        }
+        if (record.target != LAMP_PROTO_TARGET_ALL && record.target >= BENCH_LIGHTS) {
+            return LAMP_PROTO_ERR_TARGET;
+        }
+    }
+    for (size_t offset = 0; offset < length;) {
+        offset += lamp_proto_get_record(payload + offset, length - offset, &record);
+        device->stats.records++;
+        for (unsigned i = 0; i < BENCH_LIGHTS; ++i) {
+            if (record.target != LAMP_PROTO_TARGET_ALL && record.target != i) {
+                continue;
+            }
+            light_state_t *light = &device->lights[i];
+            if (record.op == LAMP_PROTO_OP_LEVEL) {
+                light->level_set = true;
+                light->level = record.level;
+            } else if (record.op == LAMP_PROTO_OP_XY) {
+                light->color_set = true;
+                light->x = record.x;
+                light->y = record.y;
+            }
+        }
+    }
+    return length ? LAMP_PROTO_OK : LAMP_PROTO_ERR_MALFORMED;
+}
+
+static void device_frame(const lamp_proto_frame_t *frame, void *ctx)
+{
+    device_t *device = ctx;
+    uint8_t ack[1 + LAMP_PROTO_HELLO_ACK_SIZE] = {LAMP_PROTO_OK};
+    size_t ack_length = 1;
+    switch (lamp_proto_sequence_check(&device->sequencer, frame, &ack[0])) {
+    case LAMP_PROTO_FRAME_DUPLICATE:
+        device_send(device, LAMP_PROTO_ACK, frame->seq, ack, ack_length);
+        return;
+    case LAMP_PROTO_FRAME_OUT_OF_ORDER:
+        ack[0] = LAMP_PROTO_ERR_SEQUENCE;
+        ack[1] = device->sequencer.expected;
+        device_send(device, LAMP_PROTO_ACK, frame->seq, ack, 2);
+        return;
+    case LAMP_PROTO_FRAME_NEW:
+        break;
+    }
+    switch (frame->type) {
+    case LAMP_PROTO_HELLO:
+        ack[1] = LAMP_PROTO_VERSION;
+        ack[2] = LAMP_PROTO_MAX_PAYLOAD;
+        ack[3] = LAMP_PROTO_WINDOW;
+        ack_length = sizeof(ack);
+        break;
+    case LAMP_PROTO_COMMANDS:
+        ack[0] = device_commands(device, frame->payload, frame->length);
+        break;
+    case LAMP_PROTO_TELEMETRY_PERIOD:
+        if (frame->length != 2) {
+            ack[0] = LAMP_PROTO_ERR_MALFORMED;
+            break;
+        }
+        device->telemetry_period_ms = (uint16_t)(frame->payload[0] | frame->payload[1] << 8);
+        device->telemetry_sent_ns = 0;
+        break;
+    default:
+        ack[0] = LAMP_PROTO_ERR_TYPE;
+    }
+    lamp_proto_sequence_commit(&device->sequencer, frame->seq, ack[0]);
+    device_send(device, LAMP_PROTO_ACK, frame->seq, ack, ack_length);
+}
+
+static void *device_task(void *arg)
+{
+    device_t *device = arg;
+    const options_t *options = device->options;
+    uint8_t in[4096];
+    double budget = 0;
+    while (!atomic_load(&device->stop)) {
+        usleep(options->poll_us);
+        size_t limit = sizeof(in);
+        if (options->baud) {
+            /* 10 bits per byte on the line; what did not fit waits in the UART's buffer */
+            budget += options->baud / 10.0 * options->poll_us / 1e6;
+            limit = budget < sizeof(in) ? (size_t)budget : sizeof(in);
+        }
+        const ssize_t got = limit ? read(device->fd, in, limit) : 0;
+        if (got > 0) {
+            budget -= options->baud ? got : 0;
+            if (atomic_load(&device->corrupting)) {
+                corrupt(in, (size_t)got, options->corrupt, &device->rng);
+            }
+            lamp_proto_decoder_feed(&device->decoder, in, (size_t)got, device_frame, device);
+        }
+        const uint64_t now = now_ns();
+        if (device->telemetry_period_ms &&
+                now - device->telemetry_sent_ns >= device->telemetry_period_ms * 1000000ull) {
+            uint8_t payload[LAMP_PROTO_TELEMETRY_SIZE];
+            device->telemetry_sent_ns = now;
+            device->stats.uptime_ms = (uint32_t)((now - device->start_ns) / 1000000u);
+            device->stats.frames = device->decoder.frames;
+            device->stats.bad_frames = device->decoder.bad_frames;
+            device->stats.skipped = device->decoder.skipped;
+            device->stats.duplicates = device->sequencer.duplicates;
+            device->stats.out_of_order = device->sequencer.out_of_order;
+            device->stats.lights = BENCH_LIGHTS;
+            lamp_proto_put_telemetry(payload, &device->stats);
+            device_send(device, LAMP_PROTO_TELEMETRY, device->tx_seq++, payload, sizeof(payload));
+        }
+        if (device->out_len) {
+            if (atomic_load(&device->corrupting)) {
+                corrupt(device->out, device->out_len, options->corrupt, &device->rng);
+            }
+            write_all(device->fd, device->out, device->out_len);
+            device->out_len = 0;
+        }
+    }
+    return NULL;
+}
+
+/* ---- host ---- */
+
+static lamp_proto_record_t command_record(unsigned index, uint32_t seed)
+{
+    uint32_t rng = (index + 1) * 2654435761u ^ seed;
+    rng_next(&rng);
+    const uint32_t value = rng_next(&rng);
+    lamp_proto_record_t record = {.target = value % BENCH_LIGHTS};
+    if (value & 0x100) {
+        record.op = LAMP_PROTO_OP_LEVEL;
+        record.level = (uint8_t)(value >> 16);
+    } else {
+        record.op = LAMP_PROTO_OP_XY;
+        record.x = (uint16_t)((value >> 9) % XY_RANGE);
+        record.y = (uint16_t)((value >> 17) % XY_RANGE);
+    }
+    return record;
+}
+
+static uint8_t frame_seq(uint32_t frame)
+{
+    return (uint8_t)(frame + 1);
+}
+
+static void host_send(host_t *host, int fd, const options_t *options, uint32_t *rng, uint32_t frame)
+{
+    outstanding_t *slot = &host->slots[frame % LAMP_PROTO_WINDOW];
+    if (frame >= host->built) {
+        host->built = frame + 1;
+        uint8_t payload[LAMP_PROTO_MAX_PAYLOAD];
+        size_t length = 0;
+        for (unsigned i = frame * options->batch; i < (frame + 1) * options->batch && i < options->commands; ++i) {
+            const lamp_proto_record_t record = command_record(i, options->seed);
+            length += lamp_proto_put_record(payload + length, sizeof(payload) - length, &record);
+        }
+        slot->len = lamp_proto_encode(slot->frame, sizeof(slot->frame), LAMP_PROTO_COMMANDS, frame_seq(frame), payload,
+                                      length);
+        slot->resent = false;
+    } else {
+        slot->resent = true;
+        host->resent++;
+    }
+    slot->sent_ns = now_ns();
+    uint8_t line[LAMP_PROTO_MAX_FRAME];
+    memcpy(line, slot->frame, slot->len);
+    corrupt(line, slot->len, options->corrupt, rng);
+    write_all(fd, line, slot->len);
+    host->bytes += slot->len;
+}
+
+static void host_goback(host_t *host, uint32_t frame, uint32_t err_frame)
+{
+    host->next = frame;
+    host->goback_frame = frame;
+    host->goback_err = err_frame;
+    host->goback_valid = true;
+}
+
+static void host_ack(host_t *host, const lamp_proto_frame_t *frame)
+{
+    if (frame->length < 1) {
+        return;
+    }
+    if (!host->hello_acked) {
+        host->hello_acked = frame->seq == 0 && frame->payload[0] == LAMP_PROTO_OK &&
+                            frame->length == 1 + LAMP_PROTO_HELLO_ACK_SIZE;
+        return;
+    }
+    /* frames in flight are base..next-1, their sequence numbers a contiguous run */
+    const uint32_t acked = host->base + (uint8_t)(frame->seq - frame_seq(host->base));
+    if (acked >= host->next) {
+        return;
+    }
+    if (frame->payload[0] == LAMP_PROTO_ERR_SEQUENCE) {
+        if (frame->length < 2) {
+            return;
+        }
+        const uint32_t expected = host->base + (uint8_t)(frame->payload[1] - frame_seq(host->base));
+        /*
+         * Every frame sent before a go-back reports the same expected frame,
+         * in increasing order: go back once for them. An error for a frame at
+         * or before the last one reported comes from the frames sent again,
+         * so the expected frame was lost once more.
+         */
+        const bool stale = host->goback_valid && host->goback_frame == expected && acked > host->goback_err;
+        if (expected < host->next && !stale) {
+            host->gobacks++;
+            host_goback(host, expected, acked);
+        } else {
+            host->goback_err = acked;
+        }
+        return;
+    }
+    if (frame->payload[0] != LAMP_PROTO_OK) {
+        host->errors++;
+    }
+    /* frames are applied in order, so this acknowledges every earlier one too */
+    const outstanding_t *slot = &host->slots[acked % LAMP_PROTO_WINDOW];
+    if (!slot->resent) {
+        /* retransmission timeout as TCP's: smoothed round trip plus four deviations */
+        const double rtt = (double)(now_ns() - slot->sent_ns);
+        if (!host->rtt_count) {
+            host->srtt_ns = rtt;
+            host->rttvar_ns = rtt / 2;
+        } else {
+            host->rttvar_ns += ((rtt > host->srtt_ns ? rtt - host->srtt_ns : host->srtt_ns - rtt) - host->rttvar_ns) / 4;
+            host->srtt_ns += (rtt - host->srtt_ns) / 8;
+        }
+        const double rto = host->srtt_ns + 4 * host->rttvar_ns;
+        host->rto_ns = rto < MIN_RTO_NS ? MIN_RTO_NS : rto < host->max_rto_ns ? (uint64_t)rto : host->max_rto_ns;
+        host->rtt_ns += (uint64_t)rtt;
+        host->rtt_count++;
+    }
+    host->base = acked + 1;
+}
+
+static void host_frame(const lamp_proto_frame_t *frame, void *ctx)
+{
+    host_t *host = ctx;
+    switch (frame->type) {
+    case LAMP_PROTO_ACK:
+        host_ack(host, frame);
+        break;
+    case LAMP_PROTO_TELEMETRY:
+        if (lamp_proto_get_telemetry(frame->payload, frame->length, &host->last_telemetry)) {
+            host->telemetry++;
+        }
+        break;
+    }
+}
+
+typedef struct {
+    double seconds;
+    host_t host;
+    lamp_proto_decoder_t decoder;
+    lamp_proto_telemetry_t device;
+    bool match;
+} result_t;
+
+static void open_pty(int *master, int *slave)
+{
+    *master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (*master < 0 || grantpt(*master) || unlockpt(*master)) {
+        perror("posix_openpt");
+        exit(1);
+    }
+    *slave = open(ptsname(*master), O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (*slave < 0) {
+        perror("open pty");
+        exit(1);
+    }
+    struct termios tio;
+    tcgetattr(*slave, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(*slave, TCSANOW, &tio);
+}
+
+/* Send HELLO until it is acknowledged, then ask for telemetry; both outside the measurement */
+static void host_hello(host_t *host, lamp_proto_decoder_t *decoder, int fd)
+{
+    uint8_t frame[LAMP_PROTO_MAX_FRAME];
+    while (!host->hello_acked) {
+        write_all(fd, frame, lamp_proto_encode(frame, sizeof(frame), LAMP_PROTO_HELLO, 0, NULL, 0));
+        const uint64_t deadline = now_ns() + 100000000u;
+        while (!host->hello_acked && now_ns() < deadline) {
+            struct pollfd pfd = {.fd = fd, .events = POLLIN};
+            uint8_t in[512];
+            if (poll(&pfd, 1, 10) > 0) {
+                const ssize_t got = read(fd, in, sizeof(in));
+                if (got > 0) {
+                    lamp_proto_decoder_feed(decoder, in, (size_t)got, host_frame, host);
+                }
+            }
+        }
+    }
+}
+
+static result_t run(const options_t *options)
+{
+    result_t result = {0};
+    int master, slave;
+    open_pty(&master, &slave);
+
+    static device_t device;
+    memset(&device, 0, sizeof(device));
+    device.fd = slave;
+    device.options = options;
+    device.rng = options->seed * 7919u + 1;
+    device.start_ns = now_ns();
+    lamp_proto_decoder_init(&device.decoder);
+    lamp_proto_sequencer_init(&device.sequencer);
+    /* telemetry streams back during the run; the bench does not ask for it with a frame */
+    device.telemetry_period_ms = TELEMETRY_PERIOD_MS;
+    pthread_t thread;
+    pthread_create(&thread, NULL, device_task, &device);
+
+    host_t *host = &result.host;
+    lamp_proto_decoder_t *decoder = &result.decoder;
+    lamp_proto_decoder_init(decoder);
+    uint32_t rng = options->seed * 104729u + 3;
+    /* the handshake itself is not corrupted, it only sets up the run */
+    host_hello(host, decoder, master);
+    atomic_store(&device.corrupting, true);
+
+    host->total = (options->commands + options->batch - 1) / options->batch;
+    host->rto_ns = host->max_rto_ns = options->timeout_ms * 1000000ull;
+    const uint64_t start = now_ns();
+    while (host->base < host->total) {
+        while (host->next < host->total && host->next < host->base + options->window) {
+            host_send(host, master, options, &rng, host->next++);
+        }
+        struct pollfd pfd = {.fd = master, .events = POLLIN};
+        if (poll(&pfd, 1, 1) > 0) {
+            uint8_t in[4096];
+            const ssize_t got = read(master, in, sizeof(in));
+            if (got > 0) {
+                lamp_proto_decoder_feed(decoder, in, (size_t)got, host_frame, host);
+            }
+        }
+        if (host->base < host->next &&
+                now_ns() - host->slots[host->base % LAMP_PROTO_WINDOW].sent_ns > host->rto_ns) {
+            host->timeouts++;
+            host->rto_ns = host->rto_ns * 2 < host->max_rto_ns ? host->rto_ns * 2 : host->max_rto_ns;
+            host_goback(host, host->base, host->base);
+        }
+    }
+    result.seconds = (now_ns() - start) / 1e9;
+
+    atomic_store(&device.stop, true);
+    pthread_join(thread, NULL);
+
+    /* the last level and color sent to every light must be what the controller holds */
+    light_state_t expected[BENCH_LIGHTS] = {0};
+    for (unsigned i = 0; i < options->commands; ++i) {
+        const lamp_proto_record_t record = command_record(i, options->seed);
+        light_state_t *light = &expected[record.target];
+        if (record.op == LAMP_PROTO_OP_LEVEL) {
+            light->level_set = true;
+            light->level = record.level;
+        } else {
+            light->color_set = true;
+            light->x = record.x;
+            light->y = record.y;
+        }
+    }
+    result.match = memcmp(expected, device.lights, sizeof(expected)) == 0;
+    result.device = device.stats;
+    result.device.frames = device.decoder.frames;
+    result.device.bad_frames = device.decoder.bad_frames;
+    result.device.duplicates = device.sequencer.duplicates;
+    result.device.out_of_order = device.sequencer.out_of_order;
+    close(slave);
+    close(master);
+    return result;
+}
+
+static void print_header(void)
+{
+    printf("%6s %5s %9s %8s %9s %7s %7s %6s %6s %6s %5s %5s %5s\n", "window", "batch", "cmds/s", "frames/s",
+           "line_B/s", "rtt_ms", "resent", "goback", "tmo", "badcrc", "dup", "ooo", "state");
+}
+
+static void print_result(const options_t *options, const result_t *result)
+{
+    const host_t *host = &result->host;
+    printf("%6u %5u %9.0f %8.0f %9.0f %7.2f %7u %6u %6u %6u %5u %5u %5s\n", options->window, options->batch,
+           options->commands / result->seconds, host->total / result->seconds, host->bytes / result->seconds,
+           host->rtt_count ? host->rtt_ns / 1e6 / host->rtt_count : 0.0, (unsigned)host->resent,
+           (unsigned)host->gobacks, (unsigned)host->timeouts,
+           (unsigned)(result->device.bad_frames + result->decoder.bad_frames), (unsigned)result->device.duplicates,
+           (unsigned)result->device.out_of_order, result->match ? "ok" : "WRONG");
+}
+
+static void usage(const char *prog)
+{
+    printf("usage: %s [options]\n"
+           "  --commands N          command records to send (default 4000)\n"
+           "  --window N            unacknowledged frames, 1..%d (default: run a matrix)\n"
+           "  --batch N             records per frame, 1..%d (default 1 with --window)\n"
+           "  --poll-us N           controller reads its input every N us (default 1000)\n"
+           "  --baud N              controller reads at most N/10 bytes per second (default: no limit)\n"
+           "  --timeout-ms N        longest wait for an ACK before sending again; shorter once round trips\n"
+           "                        are measured (default 50)\n"
+           "  --corrupt P           bit error probability per byte, both directions (default 0)\n"
+           "  --seed N              random seed (default 1)\n",
+           prog, LAMP_PROTO_WINDOW, LAMP_PROTO_MAX_PAYLOAD / 6);
+}
+
+int main(int argc, char **argv)
+{
+    enum { OPT_COMMANDS = 1, OPT_WINDOW, OPT_BATCH, OPT_POLL, OPT_BAUD, OPT_TIMEOUT, OPT_CORRUPT, OPT_SEED, OPT_HELP };
+    static const struct option long_options[] = {
+        {"commands", required_argument, NULL, OPT_COMMANDS},
+        {"window", required_argument, NULL, OPT_WINDOW},
+        {"batch", required_argument, NULL, OPT_BATCH},
+        {"poll-us", required_argument, NULL, OPT_POLL},
+        {"baud", required_argument, NULL, OPT_BAUD},
+        {"timeout-ms", required_argument, NULL, OPT_TIMEOUT},
+        {"corrupt", required_argument, NULL, OPT_CORRUPT},
+        {"seed", required_argument, NULL, OPT_SEED},
+        {"help", no_argument, NULL, OPT_HELP},
+        {NULL, 0, NULL, 0},
+    };
+    options_t options = {.commands = 4000, .poll_us = 1000, .timeout_ms = 50, .seed = 1};
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (opt) {
+        case OPT_COMMANDS: options.commands = (unsigned)strtoul(optarg, NULL, 0); break;
+        case OPT_WINDOW: options.window = (unsigned)strtoul(optarg, NULL, 0); break;
+        case OPT_BATCH: options.batch = (unsigned)strtoul(optarg, NULL, 0); break;
+        case OPT_POLL: options.poll_us = (unsigned)strtoul(optarg, NULL, 0); break;
+        case OPT_BAUD: options.baud = (unsigned)strtoul(optarg, NULL, 0); break;
+        case OPT_TIMEOUT: options.timeout_ms = (unsigned)strtoul(optarg, NULL, 0); break;
+        case OPT_CORRUPT: options.corrupt = strtod(optarg, NULL); break;
+        case OPT_SEED: options.seed = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case OPT_HELP: usage(argv[0]); return 0;
+        default: usage(argv[0]); return 2;
+        }
+    }
+    /* the widest record is 6 bytes */
+    if (options.window > LAMP_PROTO_WINDOW || options.batch > LAMP_PROTO_MAX_PAYLOAD / 6 || !options.commands) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    bool all_match = true;
+    print_header();
+    if (options.window) {
+        options.batch = options.batch ? options.batch : 1;
+        const result_t result = run(&options);
+        print_result(&options, &result);
+        all_match = result.match;
+        printf("telemetry: %u frames received, last one: %u frames %u records uptime %u ms\n",
+               (unsigned)result.host.telemetry, (unsigned)result.host.last_telemetry.frames,
+               (unsigned)result.host.last_telemetry.records, (unsigned)result.host.last_telemetry.uptime_ms);
+    } else {
+        static const unsigned windows[] = {1, 4, LAMP_PROTO_WINDOW};
+        static const unsigned batches[] = {1, 4, 16};
+        for (size_t w = 0; w < sizeof(windows) / sizeof(windows[0]); ++w) {
+            for (size_t b = 0; b < sizeof(batches) / sizeof(batches[0]); ++b) {
+                options_t cell = options;
+                cell.window = windows[w];
+                cell.batch = options.batch ? options.batch : batches[b];
+                const result_t result = run(&cell);
+                print_result(&cell, &result);
+                all_match &= result.match;
+                if (options.batch) {
+                    break;
+                }
+            }
+        }
+    }
+    return all_match ? 0 : 1;
+}
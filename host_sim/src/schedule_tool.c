@@ -0,0 +1,377 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Builder and checker for the lamp controller's schedule partition image
+ *
+ * Builds an image from a text schedule, checks an image and evaluates it at
+ * given times of day, reading it through mmap() with the firmware's own
+ * evaluator:
+ *
+ *   lamp_schedule build schedule.txt schedule.bin
+ *   lamp_schedule check schedule.bin
+ *   lamp_schedule eval schedule.bin 06:30 12:00 23:59:59
+ *   lamp_schedule bench schedule.bin
+ *
+ * The text schedule has one item per line, '#' starts a comment:
+ *
+ *   revision N                 stored in the image, shown on the console
+ *   room all | room 0-3,7      start a room of all lights or of these light slots
+ *   HH:MM[:SS] [level N] [xy X Y | rgb R G B] [fade S]
+ *                              a segment of the current room, in order of time
+ *
+ * Write the image to the device with
+ *
+ *   parttool.py write_partition --partition-name schedule --input schedule.bin
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "light_color.h"
+#include "light_schedule_image.h"
+
+/* size of the schedule entry in partitions.csv */
+#define SCHEDULE_PARTITION_SIZE     4096
+#define SCHEDULE_MAX_SEGMENTS       ((SCHEDULE_PARTITION_SIZE - sizeof(light_schedule_header_t)) / \
+                                     sizeof(light_schedule_segment_t))
+#define BENCH_LOOKUPS               10000000
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s build SOURCE IMAGE\n"
+            "       %s check IMAGE\n"
+            "       %s eval IMAGE HH:MM[:SS]...\n"
+            "       %s bench IMAGE\n",
+            prog, prog, prog, prog);
+}
+
+static bool parse_time(const char *text, uint32_t *day_s)
+{
+    unsigned hours, minutes, seconds = 0;
+    char end;
+    const int fields = sscanf(text, "%u:%u:%u%c", &hours, &minutes, &seconds, &end);
+    if ((fields != 2 && fields != 3) || hours > 23 || minutes > 59 || seconds > 59) {
+        return false;
+    }
+    *day_s = hours * 3600 + minutes * 60 + seconds;
+    return true;
+}
+
+/* "all" or a comma separated list of slots and slot ranges */
+static bool parse_lights(const char *text, uint64_t *lights)
+{
+    if (strcmp(text, "all") == 0) {
+        *lights = UINT64_MAX;
+        return true;
+    }
+    *lights = 0;
+    while (*text) {
+        char *end;
+        const unsigned long first = strtoul(text, &end, 10);
+        unsigned long last = first;
+        if (end == text) {
+            return false;
+        }
+        if (*end == '-') {
+            text = end + 1;
+            last = strtoul(text, &end, 10);
+            if (end == text) {
+                return false;
+            }
+        }
+        if (first > last || last > 63) {
+            return false;
+        }
+        for (unsigned long slot = first; slot <= last; ++slot) {
+            *lights |= 1ULL << slot;
+        }
+        text = *end == ',' ? end + 1 : end;
+        if (*end && *end != ',') {
+            return false;
+        }
+    }
+    return *lights != 0;
+}
+
+static bool parse_segment(char *line, light_schedule_segment_t *segment)
+{
+    char *save;
+    char *word = strtok_r(line, " \t", &save);
+    *segment = (light_schedule_segment_t){0};
+    if (!parse_time(word, &segment->start_s)) {
+        return false;
+    }
+    while ((word = strtok_r(NULL, " \t", &save))) {
+        char *args[3] = {0};
+        const int argc = strcmp(word, "xy") == 0 ? 2 : strcmp(word, "rgb") == 0 ? 3 : 1;
+        for (int i = 0; i < argc; ++i) {
+            if (!(args[i] = strtok_r(NULL, " \t", &save))) {
+                return false;
+            }
+        }
+        if (strcmp(word, "level") == 0) {
+            const unsigned long level = strtoul(args[0], NULL, 0);
+            if (level < 1 || level > 254) {
+                return false;
+            }
+            segment->level = (uint8_t)level;
+        } else if (strcmp(word, "xy") == 0) {
+            segment->color_x = (uint16_t)strtoul(args[0], NULL, 0);
+            segment->color_y = (uint16_t)strtoul(args[1], NULL, 0);
+            segment->flags |= LIGHT_SCHEDULE_SEGMENT_COLOR;
+        } else if (strcmp(word, "rgb") == 0) {
+            light_color_rgb_to_xy(strtoul(args[0], NULL, 0) & 0xff, strtoul(args[1], NULL, 0) & 0xff,
+                                  strtoul(args[2], NULL, 0) & 0xff, &segment->color_x, &segment->color_y);
+            segment->flags |= LIGHT_SCHEDULE_SEGMENT_COLOR;
+        } else if (strcmp(word, "fade") == 0) {
+            const unsigned long fade_s = strtoul(args[0], NULL, 0);
+            if (fade_s > UINT16_MAX) {
+                return false;
+            }
+            segment->fade_s = (uint16_t)fade_s;
+        } else {
+            return false;
+        }
+    }
+    return segment->level || (segment->flags & LIGHT_SCHEDULE_SEGMENT_COLOR);
+}
+
+static int build(const char *source, const char *output)
+{
+    FILE *in = fopen(source, "r");
+    if (!in) {
+        perror(source);
+        return 1;
+    }
+    static light_schedule_room_t rooms[LIGHT_SCHEDULE_MAX_ROOMS];
+    static light_schedule_segment_t segments[SCHEDULE_MAX_SEGMENTS];
+    unsigned room_count = 0;
+    unsigned segment_count = 0;
+    uint32_t revision = (uint32_t)time(NULL);
+    char line[256];
+    unsigned line_no = 0;
+    int result = 0;
+    while (!result && fgets(line, sizeof(line), in)) {
+        line_no++;
+        *strchrnul(line, '#') = '\0';
+        line[strcspn(line, "\r\n")] = '\0';
+        char word[16];
+        char arg[128];
+        const int fields = sscanf(line, " %15s %127s", word, arg);
+        if (fields <= 0) {
+            continue;
+        }
+        if (strcmp(word, "revision") == 0 && fields == 2) {
+            revision = (uint32_t)strtoul(arg, NULL, 0);
+        } else if (strcmp(word, "room") == 0 && fields == 2) {
+            if (room_count == LIGHT_SCHEDULE_MAX_ROOMS) {
+                fprintf(stderr, "%s:%u: more than %d rooms\n", source, line_no, LIGHT_SCHEDULE_MAX_ROOMS);
+                result = 1;
+            } else if (!parse_lights(arg, &rooms[room_count].lights)) {
+                fprintf(stderr, "%s:%u: bad light list '%s'\n", source, line_no, arg);
+                result = 1;
+            } else {
+                rooms[room_count].first = (uint16_t)segment_count;
+                room_count++;
+            }
+        } else if (!room_count) {
+            fprintf(stderr, "%s:%u: segment before the first room\n", source, line_no);
+            result = 1;
+        } else if (segment_count == SCHEDULE_MAX_SEGMENTS) {
+            fprintf(stderr, "%s:%u: more segments than fit the partition\n", source, line_no);
+            result = 1;
+        } else if (!parse_segment(line, &segments[segment_count])) {
+            fprintf(stderr, "%s:%u: bad segment\n", source, line_no);
+            result = 1;
+        } else {
+            light_schedule_room_t *room = &rooms[room_count - 1];
+            if (room->count && segments[segment_count].start_s <= segments[segment_count - 1].start_s) {
+                fprintf(stderr, "%s:%u: segments of a room must be in order of time\n", source, line_no);
+                result = 1;
+            }
+            room->count++;
+            segment_count++;
+        }
+    }
+    fclose(in);
+    for (unsigned r = 0; r < room_count && !result; ++r) {
+        if (!rooms[r].count) {
+            fprintf(stderr, "%s: room %u has no segments\n", source, r);
+            result = 1;
+        }
+    }
+    if (result) {
+        return result;
+    }
+    if (!room_count) {
+        fprintf(stderr, "%s: no rooms\n", source);
+        return 1;
+    }
+
+    const size_t rooms_len = room_count * sizeof(light_schedule_room_t);
+    const size_t segments_len = segment_count * sizeof(light_schedule_segment_t);
+    const size_t length = sizeof(light_schedule_header_t) + rooms_len + segments_len;
+    if (length > SCHEDULE_PARTITION_SIZE) {
+        fprintf(stderr, "%s: image of %zu bytes does not fit the %d byte partition\n", source, length,
+                SCHEDULE_PARTITION_SIZE);
+        return 1;
+    }
+    uint8_t *image = calloc(1, length);
+    memcpy(image + sizeof(light_schedule_header_t), rooms, rooms_len);
+    memcpy(image + sizeof(light_schedule_header_t) + rooms_len, segments, segments_len);
+    const light_schedule_header_t header = {
+        .magic = LIGHT_SCHEDULE_MAGIC,
+        .version = LIGHT_SCHEDULE_VERSION,
+        .room_count = (uint8_t)room_count,
+        .segment_count = (uint16_t)segment_count,
+        .length = (uint32_t)length,
+        .crc32 = light_schedule_crc32(image + sizeof(header), length - sizeof(header)),
+        .revision = revision,
+    };
+    memcpy(image, &header, sizeof(header));
+
+    light_schedule_image_t check;
+    const char *error;
+    if (!light_schedule_image_open(&check, image, length, &error)) {
+        fprintf(stderr, "%s: built an invalid image: %s\n", source, error);
+        free(image);
+        return 1;
+    }
+    FILE *out = fopen(output, "wb");
+    if (!out || fwrite(image, 1, length, out) != length || fclose(out) != 0) {
+        perror(output);
+        free(image);
+        return 1;
+    }
+    free(image);
+    printf("%s: revision %lu, %u rooms, %u segments, %zu of %d bytes\n", output, (unsigned long)revision,
+           room_count, segment_count, length, SCHEDULE_PARTITION_SIZE);
+    return 0;
+}
+
+/* Map an image file read-only, the way the firmware maps the partition */
+static bool map_image(const char *path, light_schedule_image_t *image, void **addr, size_t *len)
+{
+    const int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0) {
+        fprintf(stderr, "%s: %s\n", path, fd < 0 ? strerror(errno) : "empty");
+        if (fd >= 0) {
+            close(fd);
+        }
+        return false;
+    }
+    *len = (size_t)st.st_size;
+    *addr = mmap(NULL, *len, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (*addr == MAP_FAILED) {
+        perror(path);
+        return false;
+    }
+    const char *error;
+    if (!light_schedule_image_open(image, *addr, *len, &error)) {
+        fprintf(stderr, "%s: %s\n", path, error);
+        munmap(*addr, *len);
+        return false;
+    }
+    return true;
+}
+
+static void print_segment(const light_schedule_segment_t *segment)
+{
+    printf("%02lu:%02lu:%02lu", (unsigned long)segment->start_s / 3600, (unsigned long)segment->start_s / 60 % 60,
+           (unsigned long)segment->start_s % 60);
+    if (segment->level) {
+        printf(" level %u", segment->level);
+    }
+    if (segment->flags & LIGHT_SCHEDULE_SEGMENT_COLOR) {
+        printf(" xy %u %u", segment->color_x, segment->color_y);
+    }
+    printf(" fade %u\n", segment->fade_s);
+}
+
+static void check(const char *path, const light_schedule_image_t *image)
+{
+    const light_schedule_header_t *header = image->header;
+    printf("%s: revision %lu, %u rooms, %u segments, %lu bytes\n", path, (unsigned long)header->revision,
+           header->room_count, header->segment_count, (unsigned long)header->length);
+    for (unsigned r = 0; r < header->room_count; ++r) {
+        const light_schedule_room_t *room = &image->rooms[r];
+        printf("room %u: lights 0x%016llx\n", r, (unsigned long long)room->lights);
+        for (unsigned s = room->first; s < (unsigned)room->first + room->count; ++s) {
+            printf("  ");
+            print_segment(&image->segments[s]);
+        }
+    }
+}
+
+static int eval(const light_schedule_image_t *image, int count, char **times)
+{
+    for (int i = 0; i < count; ++i) {
+        uint32_t day_s;
+        if (!parse_time(times[i], &day_s)) {
+            fprintf(stderr, "bad time '%s'\n", times[i]);
+            return 1;
+        }
+        for (uint8_t r = 0; r < image->header->room_count; ++r) {
+            const uint16_t active = light_schedule_image_active(image, r, day_s);
+            printf("%s room %u: segment %u from ", times[i], r, active - image->rooms[r].first);
+            print_segment(&image->segments[active]);
+        }
+    }
+    return 0;
+}
+
+static void bench(const light_schedule_image_t *image)
+{
+    struct timespec start, end;
+    uint32_t day_s = 12345;
+    uint32_t sum = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (unsigned i = 0; i < BENCH_LOOKUPS; ++i) {
+        /* walk the day in uneven steps so the searches take different paths */
+        day_s = (day_s + 7919) % LIGHT_SCHEDULE_DAY_S;
+        sum += light_schedule_image_active(image, (uint8_t)(i % image->header->room_count), day_s);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    const double ns = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / BENCH_LOOKUPS;
+    printf("%d lookups over %u segments: %.1f ns each (checksum %lu)\n", BENCH_LOOKUPS,
+           image->header->segment_count, ns, (unsigned long)sum);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc == 4 && strcmp(argv[1], "build") == 0) {
+        return build(argv[2], argv[3]);
+    }
+    const bool is_check = argc == 3 && strcmp(argv[1], "check") == 0;
+    const bool is_eval = argc >= 4 && strcmp(argv[1], "eval") == 0;
+    const bool is_bench = argc == 3 && strcmp(argv[1], "bench") == 0;
+    if (!is_check && !is_eval && !is_bench) {
+        usage(argv[0]);
+        return 2;
+    }
+    light_schedule_image_t image;
+    void *addr;
+    size_t len;
+    if (!map_image(argv[2], &image, &addr, &len)) {
+        return 1;
+    }
+    int result = 0;
+    if (is_check) {
+        check(argv[2], &image);
+    } else if (is_eval) {
+        result = eval(&image, argc - 3, argv + 3);
+    } else {
+        bench(&image);
+    }
+    munmap(addr, len);
+    return result;
+}
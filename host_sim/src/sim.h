@@ -0,0 +1,200 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Lamp controller host simulation: simulated network, lights and GPIO
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_zigbee_core.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SIM_MAX_LIGHTS 256
+#define SIM_LIGHT_MAX_GROUPS 4
+#define SIM_LIGHT_MAX_SCENES 16
+#define SIM_LIGHT_MAX_REPORTS 8
+
+/* sim_scene_t.fields bits, one per extension field set the scene carries */
+#define SIM_SCENE_ON_OFF    (1U << 0)
+#define SIM_SCENE_LEVEL     (1U << 1)
+#define SIM_SCENE_COLOR_XY  (1U << 2)
+
+typedef struct {
+    uint16_t group_id;
+    uint8_t scene_id;
+    uint8_t fields;             /* SIM_SCENE_* bits */
+    bool on_off;
+    uint8_t level;
+    uint16_t color_x;
+    uint16_t color_y;
+} sim_scene_t;
+
+/* one attribute reporting configuration, as set by configure reporting */
+typedef struct {
+    uint16_t cluster;
+    uint16_t attr_id;
+    uint16_t min_interval;      /* seconds */
+    uint16_t max_interval;      /* seconds, 0 or 0xffff: no periodic reports */
+    uint32_t change;            /* reportable change, 0 for discrete attributes */
+    uint32_t reported;          /* value in the last report */
+    int64_t reported_us;        /* time of the last report */
+} sim_report_t;
+
+typedef struct {
+    unsigned light_count;       /* number of simulated color dimmable lights */
+    unsigned max_hops;          /* lights are spread evenly over 1..max_hops */
+    uint32_t hop_latency_us;    /* one-way latency of a single hop */
+    uint32_t hop_jitter_us;     /* uniform jitter added per hop */
+    double hop_loss;            /* probability a single transmission on one hop is lost */
+    unsigned mac_retries;       /* per-hop retransmissions before the hop fails */
+    unsigned aps_retries;       /* end-to-end retransmissions for acknowledged unicast */
+    uint32_t aps_ack_timeout_us;
+    uint32_t tx_frame_us;       /* coordinator radio time per request, requests queue for it in order */
+    uint32_t join_spacing_us;   /* delay between consecutive light joins */
+    uint32_t seed;
+    bool rebooted;              /* coordinator restarts on an existing network with lights joined and bound */
+    bool rejoin;                /* with rebooted: every light announces itself again, as after a power cut of the room */
+    unsigned zdo_slots;         /* ZDO requests the stack has out at once, 0 for no limit; one more is never sent and times out */
+    double group_reject;        /* fraction of lights whose group table is full */
+    void (*replay)(void);       /* replay mode: runs in the Zigbee task instead of the event loop (sim_replay_*) */
+} sim_config_t;
+
+typedef struct {
+    esp_zb_ieee_addr_t ieee_addr;
+    uint16_t short_addr;
+    uint8_t endpoint;
+    uint8_t hops;
+    /* ZCL attribute state */
+    bool on_off;
+    uint8_t level;
+    int16_t level_rate;         /* levels per second of a running move, negative down, 0 if none */
+    uint8_t level_from;         /* level when the move started */
+    bool level_move_on_off;     /* move with on/off: turns off at the bottom of the range */
+    int64_t level_move_us;      /* when the move started */
+    uint8_t color_mode;
+    uint16_t color_x;
+    uint16_t color_y;
+    uint8_t hue;
+    uint8_t saturation;
+    uint16_t enhanced_hue;
+    uint16_t color_temperature;
+    uint16_t color_capabilities;
+    /* groups cluster */
+    uint16_t groups[SIM_LIGHT_MAX_GROUPS];
+    uint8_t group_count;
+    bool rejects_groups;        /* answers add group with INSUFFICIENT_SPACE */
+    /* scenes cluster */
+    sim_scene_t scenes[SIM_LIGHT_MAX_SCENES];
+    uint8_t scene_count;
+    /* attribute reporting */
+    sim_report_t reports[SIM_LIGHT_MAX_REPORTS];
+    uint8_t report_count;
+    int64_t report_due_us;      /* next reporting check, 0 if none is scheduled */
+    /* bookkeeping */
+    bool joined;
+    uint32_t bound_clusters;    /* bit 0: level control, bit 1: color control */
+    int64_t annce_us;
+    int64_t bound_us;
+    int64_t first_change_us;    /* first state change since boot */
+    int64_t mark_change_us;     /* first state change after sim_mark() */
+    int64_t last_change_us;
+    uint32_t frames_rx;
+    uint32_t frames_tx;
+    uint32_t cmds_applied;
+} sim_light_t;
+
+typedef struct {
+    uint32_t zcl_requests;      /* ZCL command requests issued by the application */
+    uint32_t zdo_requests;
+    uint32_t zdo_dropped;       /* ZDO requests that found every transaction slot taken */
+    uint32_t frames_on_air;     /* every transmission attempt on every hop */
+    uint32_t frames_lost;       /* frames that never reached their destination */
+    uint32_t default_responses;
+    uint32_t reports;           /* attribute report frames sent by lights */
+} sim_stats_t;
+
+typedef struct {
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t live_bytes;
+    uint64_t peak_bytes;
+} sim_heap_stats_t;
+
+void sim_config_default(sim_config_t *config);
+void sim_init(const sim_config_t *config);
+int64_t sim_now_us(void);
+void sim_sleep_us(int64_t us);
+
+/* Snapshot helpers, safe to call from the scenario thread */
+unsigned sim_light_count(void);
+void sim_light_get(unsigned index, sim_light_t *out);
+unsigned sim_lights_bound(void);
+void sim_stats_get(sim_stats_t *out);
+void sim_mark(void);
+void sim_stop(void);
+
+/* GPIO */
+void sim_gpio_set_level(int pin, int level);
+void sim_gpio_press(int pin, uint32_t hold_us);
+/* every later press edge is followed by `count` glitches of period_us each way */
+void sim_gpio_set_bounce(unsigned count, uint32_t period_us);
+
+/* Console: run one command line registered with esp_console_cmd_register(), returns its exit code */
+int sim_console_run(const char *line);
+
+/* USB serial/JTAG: path of the pseudo-terminal hosts open to talk to the firmware's serial port */
+const char *sim_serial_path(void);
+
+/* NVS persistence: entries are loaded from and committed to this file */
+void sim_nvs_set_file(const char *path);
+
+/* Data partition backed by a file, found by esp_partition_find_first() and mapped in place */
+void sim_partition_add(const char *label, uint8_t subtype, const char *path);
+
+/* Application heap accounting (allocations made by firmware code) */
+void sim_heap_stats_get(sim_heap_stats_t *out);
+void *sim_malloc(size_t size);
+void sim_free(void *ptr);
+/* Heap use of the mock stack itself: seen by the firmware's heap hooks, not counted above */
+void *sim_stack_malloc(size_t size);
+void sim_stack_free(void *ptr);
+
+/* Virtual time: from the first call on sim_now_us() returns the latest time set, never going back */
+void sim_clock_set(int64_t now_us);
+
+/*
+ * Replay mode (sim_config_t.replay): the stack raises no signals and answers
+ * no ZDO request by itself, the replay feeds every input in through these.
+ * Call them from the replay function, they take the locks the main loop takes.
+ */
+/* run the earliest event due at or before until_us, moving the clock to it; false if there is none */
+bool sim_replay_step(int64_t until_us);
+void sim_replay_signal(esp_zb_app_signal_type_t type, esp_err_t status, const void *params, size_t len);
+void sim_replay_action(esp_zb_core_action_callback_id_t callback_id, const void *message);
+/* answer the oldest pending request for `addr` or `user_ctx`; false if none is pending */
+bool sim_replay_match_desc(esp_zb_zdp_status_t status, uint16_t addr, uint8_t endpoint);
+bool sim_replay_bind(esp_zb_zdp_status_t status, void *user_ctx);
+void sim_replay_send_status(const esp_zb_zcl_command_send_status_message_t *message);
+/* alarms of `cb` are recorded inputs: the stack drops them, and the replay runs each with sim_replay_alarm() */
+void sim_replay_hold_alarm(esp_zb_callback_t cb);
+void sim_replay_alarm(esp_zb_callback_t cb, uint8_t param);
+/* teach esp_zb_ieee_address_by_short() a device, the replay has no simulated lights */
+void sim_replay_address(uint16_t short_addr, const esp_zb_ieee_addr_t ieee_addr);
+/* sequence number of the next ZCL request, and what esp_zb_bdb_is_factory_new() says */
+void sim_replay_set_tsn(uint8_t tsn);
+void sim_replay_set_factory_new(bool factory_new);
+
+/* Random numbers, deterministic per seed */
+void sim_rand_seed(uint32_t seed);
+uint32_t sim_rand(void);
+double sim_rand_unit(void);
+
+#ifdef __cplusplus
+}
+#endif
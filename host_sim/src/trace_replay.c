@@ -0,0 +1,969 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Lamp controller host simulation: Zigbee trace replay
+ *
+ * Reads a console capture holding a `trace dump` (LAMP_TRACE_HEX_PREFIX
+ * lines, from the device or from lamp_sim --console "trace dump"), boots the
+ * unmodified firmware against the mock stack in replay mode and feeds every
+ * recorded input back through the same handlers, in order, on a virtual
+ * clock that jumps from one record to the next instead of waiting:
+ *
+ *   lamp_replay capture.txt
+ *   lamp_replay --nvs-file nvs.bin capture.txt     start from a saved light table
+ *   lamp_replay --print capture.txt                only print the records
+ *
+ * Inputs are app signals, ZCL action callbacks, ZDO responses, commands
+ * other tasks posted to the mailbox, and the alarms that drain the mailbox or
+ * free a place in the transmit scheduler, which run where they were recorded;
+ * other alarms the handlers schedule run when the clock passes them. The requests the replayed firmware issues are
+ * compared with the recorded ones, and the report gives the time and the heap
+ * allocations per input kind. The exit status is 1 when the requests diverge.
+ *
+ * The replay starts from a freshly booted controller, so it reproduces a
+ * capture only if the capture starts at boot (its first record is BOOT)
+ * with the light table the controller had then (--nvs-file).
+ */
+
+#include <getopt.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "esp_log.h"
+#include "esp_zigbee_core.h"
+#include "lamp_trace.h"
+#include "light_command.h"
+#include "light_tx.h"
+#include "sim.h"
+
+void app_main(void);
+
+#define REPLAY_MAX_VARIABLES        64      /* more than a record can hold */
+#define REPLAY_LOOKAHEAD            8       /* requests skipped looking for the next match */
+#define REPLAY_MAX_DIVERGENCES      10      /* printed */
+#define REPLAY_TEXT_MAX             512
+
+/* records as read from the capture or the replayed firmware, back to back */
+typedef struct {
+    uint8_t *bytes;
+    size_t size;
+    size_t capacity;
+    size_t *offsets;
+    size_t count;
+    size_t offsets_capacity;
+} record_list_t;
+
+typedef struct {
+    uint64_t count;
+    uint64_t ns;
+    uint64_t allocs;
+} kind_stats_t;
+
+/* a parsed ACTION record, the message points into it */
+typedef struct {
+    esp_zb_core_action_callback_id_t id;
+    union {
+        esp_zb_zcl_report_attr_message_t report;
+        esp_zb_zcl_cmd_read_attr_resp_message_t read;
+        esp_zb_zcl_cmd_config_report_resp_message_t config;
+        esp_zb_zcl_cmd_default_resp_message_t default_resp;
+        esp_zb_zcl_groups_operate_group_resp_message_t group;
+        esp_zb_zcl_scenes_operate_scene_resp_message_t scene;
+        uint8_t unknown[64];    /* handed to the handler zeroed */
+    } u;
+    uint8_t count;
+    esp_zb_zcl_read_attr_resp_variable_t read_variables[REPLAY_MAX_VARIABLES];
+    esp_zb_zcl_config_report_resp_variable_t config_variables[REPLAY_MAX_VARIABLES];
+    uint8_t values[REPLAY_MAX_VARIABLES][LAMP_TRACE_VALUE_MAX];
+} replay_action_t;
+
+static struct {
+    record_list_t capture;
+    int64_t *times_us;          /* per capture record, unwrapped */
+    int *next_tsn;              /* per capture record: tsn of the next recorded ZCL request, -1 if none */
+    size_t end;                 /* capture records replayed: up to a second BOOT */
+    record_list_t expected;     /* recorded requests */
+    record_list_t actual;       /* requests of the replayed firmware */
+    uint32_t read_pos;          /* in the replayed firmware's trace ring */
+    kind_stats_t kinds[LAMP_TRACE_KIND_COUNT];
+    kind_stats_t alarms;
+    unsigned unanswered;        /* ZDO responses to requests the replay never made */
+    unsigned bad_records;
+    uint64_t run_ns;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    bool started;
+    bool done;
+} s_replay = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/* ---- record lists ---- */
+
+static void *grow(void *ptr, size_t *capacity, size_t needed, size_t item)
+{
+    if (needed <= *capacity) {
+        return ptr;
+    }
+    size_t capacity_new = *capacity ? *capacity * 2 : 256;
+    while (capacity_new < needed) {
+        capacity_new *= 2;
+    }
+    void *grown = sim_malloc(capacity_new * item);
+    if (ptr) {
+        memcpy(grown, ptr, *capacity * item);
+        sim_free(ptr);
+    }
+    *capacity = capacity_new;
+    return grown;
+}
+
+static void record_list_add(record_list_t *list, const uint8_t *record)
+{
+    list->bytes = grow(list->bytes, &list->capacity, list->size + record[0], 1);
+    list->offsets = grow(list->offsets, &list->offsets_capacity, list->count + 1, sizeof(size_t));
+    memcpy(list->bytes + list->size, record, record[0]);
+    list->offsets[list->count++] = list->size;
+    list->size += record[0];
+}
+
+static const uint8_t *record_get(const record_list_t *list, size_t index)
+{
+    return list->bytes + list->offsets[index];
+}
+
+static void record_list_free(record_list_t *list)
+{
+    sim_free(list->bytes);
+    sim_free(list->offsets);
+    memset(list, 0, sizeof(*list));
+}
+
+static bool is_request(uint8_t kind)
+{
+    return kind == LAMP_TRACE_COMMAND || kind == LAMP_TRACE_ZCL_REQUEST || kind == LAMP_TRACE_ZDO_REQUEST;
+}
+
+/* Offset of the ZCL sequence number in a request record, 0 if it has none */
+static size_t request_tsn_offset(uint8_t kind)
+{
+    /* fields before the tsn: mode, dst, endpoint; cluster, command, mode, dst, endpoint */
+    return kind == LAMP_TRACE_COMMAND ? LAMP_TRACE_HEADER_SIZE + 4 :
+           kind == LAMP_TRACE_ZCL_REQUEST ? LAMP_TRACE_HEADER_SIZE + 7 : 0;
+}
+
+/*
+ * Same request, whenever it was made and whatever its sequence number: the
+ * replay numbers requests in the order it makes them
+ */
+static bool request_equal(const uint8_t *a, const uint8_t *b)
+{
+    if (a[0] != b[0] || a[1] != b[1]) {
+        return false;
+    }
+    const size_t tsn = request_tsn_offset(a[1]);
+    for (size_t i = LAMP_TRACE_HEADER_SIZE; i < a[0]; ++i) {
+        if (i != tsn && a[i] != b[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static lamp_trace_cursor_t record_body(const uint8_t *record)
+{
+    return (lamp_trace_cursor_t){
+        .data = (uint8_t *)record, .size = record[0], .pos = LAMP_TRACE_HEADER_SIZE
+    };
+}
+
+/* ---- parsing ---- */
+
+static void get_source(lamp_trace_cursor_t *c, esp_zb_zcl_addr_t *address, uint8_t *src_endpoint,
+                       uint8_t *dst_endpoint)
+{
+    address->addr_type = lamp_trace_get_u8(c);
+    address->u.short_addr = lamp_trace_get_u16(c);
+    *src_endpoint = lamp_trace_get_u8(c);
+    *dst_endpoint = lamp_trace_get_u8(c);
+}
+
+static void get_info(lamp_trace_cursor_t *c, esp_zb_zcl_cmd_info_t *info)
+{
+    info->status = lamp_trace_get_u8(c);
+    get_source(c, &info->src_address, &info->src_endpoint, &info->dst_endpoint);
+    info->cluster = lamp_trace_get_u16(c);
+    info->profile = lamp_trace_get_u16(c);
+    info->command = lamp_trace_get_u8(c);
+    info->header.tsn = lamp_trace_get_u8(c);
+    info->header.rssi = (int8_t)lamp_trace_get_u8(c);
+}
+
+static void get_attribute(lamp_trace_cursor_t *c, esp_zb_zcl_attribute_t *attribute, uint8_t *value)
+{
+    attribute->id = lamp_trace_get_u16(c);
+    attribute->data.type = lamp_trace_get_u8(c);
+    attribute->data.size = lamp_trace_get_u8(c);
+    if (attribute->data.size > LAMP_TRACE_VALUE_MAX) {
+        c->overflow = true;
+        return;
+    }
+    lamp_trace_get(c, value, attribute->data.size);
+    attribute->data.value = attribute->data.size ? value : NULL;
+}
+
+static bool parse_action(const uint8_t *record, replay_action_t *action)
+{
+    memset(action, 0, sizeof(*action));
+    lamp_trace_cursor_t c = record_body(record);
+    action->id = lamp_trace_get_u16(&c);
+    switch (action->id) {
+    case ESP_ZB_CORE_REPORT_ATTR_CB_ID: {
+        esp_zb_zcl_report_attr_message_t *report = &action->u.report;
+        report->status = lamp_trace_get_u8(&c);
+        get_source(&c, &report->src_address, &report->src_endpoint, &report->dst_endpoint);
+        report->cluster = lamp_trace_get_u16(&c);
+        get_attribute(&c, &report->attribute, action->values[0]);
+        break;
+    }
+    case ESP_ZB_CORE_CMD_READ_ATTR_RESP_CB_ID:
+        get_info(&c, &action->u.read.info);
+        action->count = lamp_trace_get_u8(&c);
+        for (uint8_t i = 0; i < action->count && i < REPLAY_MAX_VARIABLES; ++i) {
+            esp_zb_zcl_read_attr_resp_variable_t *v = &action->read_variables[i];
+            v->status = lamp_trace_get_u8(&c);
+            get_attribute(&c, &v->attribute, action->values[i]);
+            v->next = i + 1 < action->count ? v + 1 : NULL;
+        }
+        action->u.read.variables = action->count ? action->read_variables : NULL;
+        break;
+    case ESP_ZB_CORE_CMD_REPORT_CONFIG_RESP_CB_ID:
+        get_info(&c, &action->u.config.info);
+        action->count = lamp_trace_get_u8(&c);
+        for (uint8_t i = 0; i < action->count && i < REPLAY_MAX_VARIABLES; ++i) {
+            esp_zb_zcl_config_report_resp_variable_t *v = &action->config_variables[i];
+            v->status = lamp_trace_get_u8(&c);
+            v->direction = lamp_trace_get_u8(&c);
+            v->attribute_id = lamp_trace_get_u16(&c);
+            v->next = i + 1 < action->count ? v + 1 : NULL;
+        }
+        action->u.config.variables = action->count ? action->config_variables : NULL;
+        break;
+    case ESP_ZB_CORE_CMD_DEFAULT_RESP_CB_ID:
+        get_info(&c, &action->u.default_resp.info);
+        action->u.default_resp.resp_to_cmd = lamp_trace_get_u8(&c);
+        action->u.default_resp.status_code = lamp_trace_get_u8(&c);
+        break;
+    case ESP_ZB_CORE_CMD_OPERATE_GROUP_RESP_CB_ID:
+        get_info(&c, &action->u.group.info);
+        action->u.group.group_id = lamp_trace_get_u16(&c);
+        break;
+    case ESP_ZB_CORE_CMD_OPERATE_SCENE_RESP_CB_ID:
+        get_info(&c, &action->u.scene.info);
+        action->u.scene.group_id = lamp_trace_get_u16(&c);
+        action->u.scene.scene_id = lamp_trace_get_u8(&c);
+        break;
+    default:
+        break;
+    }
+    return !c.overflow && action->count <= REPLAY_MAX_VARIABLES;
+}
+
+/* ---- printing ---- */
+
+static void append(char *buf, size_t *len, const char *format, ...)
+{
+    if (*len >= REPLAY_TEXT_MAX) {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    const int n = vsnprintf(buf + *len, REPLAY_TEXT_MAX - *len, format, args);
+    va_end(args);
+    if (n > 0) {
+        *len += (size_t)n;
+    }
+}
+
+static void append_cmd(char *buf, size_t *len, lamp_trace_cursor_t *c)
+{
+    light_cmd_t cmd;
+    lamp_trace_get_cmd(c, &cmd);
+    append(buf, len, " cmd=%u flags=0x%02x transition=%u", cmd.type, cmd.flags, cmd.transition_time);
+    switch (cmd.type) {
+    case LIGHT_CMD_LEVEL:
+        append(buf, len, " level=%u", cmd.level);
+        break;
+    case LIGHT_CMD_COLOR_XY:
+        append(buf, len, " x=%u y=%u", cmd.xy.x, cmd.xy.y);
+        break;
+    case LIGHT_CMD_HUE_SAT:
+        append(buf, len, " hue=%u sat=%u", cmd.hue_sat.hue, cmd.hue_sat.saturation);
+        break;
+    case LIGHT_CMD_ENHANCED_HUE:
+        append(buf, len, " hue=%u direction=%u", cmd.enhanced_hue.hue, cmd.enhanced_hue.direction);
+        break;
+    case LIGHT_CMD_COLOR_TEMP:
+        append(buf, len, " mireds=%u", cmd.color_temperature);
+        break;
+    case LIGHT_CMD_RECALL_SCENE:
+        append(buf, len, " preset=%u", cmd.preset);
+        break;
+    case LIGHT_CMD_MOVE_LEVEL:
+        append(buf, len, " mode=%u rate=%u", cmd.move.mode, cmd.move.rate);
+        break;
+    case LIGHT_CMD_STEP_LEVEL:
+        append(buf, len, " mode=%u size=%u", cmd.step.mode, cmd.step.size);
+        break;
+    case LIGHT_CMD_READ_ATTRS:
+        append(buf, len, " cluster=0x%04x attrs=", cmd.read.cluster_id);
+        for (uint8_t i = 0; i < cmd.read.count; ++i) {
+            append(buf, len, "%s0x%04x", i ? "," : "", cmd.read.ids[i]);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+static void append_info(char *buf, size_t *len, const esp_zb_zcl_cmd_info_t *info)
+{
+    append(buf, len, " src=0x%04x/%u cluster=0x%04x cmd=0x%02x tsn=%u status=0x%02x", info->src_address.u.short_addr,
+           info->src_endpoint, info->cluster, info->command, info->header.tsn, info->status);
+}
+
+static void append_attribute(char *buf, size_t *len, const esp_zb_zcl_attribute_t *attribute)
+{
+    append(buf, len, " attr=0x%04x type=0x%02x value=", attribute->id, attribute->data.type);
+    for (uint16_t i = 0; i < attribute->data.size; ++i) {
+        append(buf, len, "%02x", ((const uint8_t *)attribute->data.value)[i]);
+    }
+}
+
+/* One line of text for a record */
+static const char *record_text(const uint8_t *record, char *buf)
+{
+    size_t len = 0;
+    lamp_trace_cursor_t c = record_body(record);
+    append(buf, &len, "%-11s", lamp_trace_kind_name(record[1]));
+    switch (record[1]) {
+    case LAMP_TRACE_BOOT:
+        append(buf, &len, " version=%u", lamp_trace_get_u8(&c));
+        break;
+    case LAMP_TRACE_SIGNAL: {
+        const esp_zb_app_signal_type_t type = lamp_trace_get_u16(&c);
+        const int32_t status = (int32_t)lamp_trace_get_u32(&c);
+        append(buf, &len, " %s status=%d", esp_zb_zdo_signal_to_string(type), (int)status);
+        if (type == ESP_ZB_ZDO_SIGNAL_DEVICE_ANNCE) {
+            const uint16_t short_addr = lamp_trace_get_u16(&c);
+            esp_zb_ieee_addr_t ieee_addr;
+            lamp_trace_get(&c, ieee_addr, sizeof(ieee_addr));
+            append(buf, &len, " short=0x%04x ieee=", short_addr);
+            for (int i = sizeof(ieee_addr) - 1; i >= 0; --i) {
+                append(buf, &len, "%02x", ieee_addr[i]);
+            }
+            append(buf, &len, " capability=0x%02x", lamp_trace_get_u8(&c));
+        } else if (c.pos < c.size) {
+            append(buf, &len, " param=%u", lamp_trace_get_u8(&c));
+        }
+        break;
+    }
+    case LAMP_TRACE_ACTION: {
+        static replay_action_t action;
+        parse_action(record, &action);
+        append(buf, &len, " id=0x%04x", action.id);
+        switch (action.id) {
+        case ESP_ZB_CORE_REPORT_ATTR_CB_ID:
+            append(buf, &len, " src=0x%04x/%u cluster=0x%04x", action.u.report.src_address.u.short_addr,
+                   action.u.report.src_endpoint, action.u.report.cluster);
+            append_attribute(buf, &len, &action.u.report.attribute);
+            break;
+        case ESP_ZB_CORE_CMD_READ_ATTR_RESP_CB_ID:
+            append_info(buf, &len, &action.u.read.info);
+            for (uint8_t i = 0; i < action.count; ++i) {
+                append(buf, &len, " [0x%02x", action.read_variables[i].status);
+                append_attribute(buf, &len, &action.read_variables[i].attribute);
+                append(buf, &len, "]");
+            }
+            break;
+        case ESP_ZB_CORE_CMD_REPORT_CONFIG_RESP_CB_ID:
+            append_info(buf, &len, &action.u.config.info);
+            for (uint8_t i = 0; i < action.count; ++i) {
+                append(buf, &len, " [0x%02x attr=0x%04x]", action.config_variables[i].status,
+                       action.config_variables[i].attribute_id);
+            }
+            break;
+        case ESP_ZB_CORE_CMD_DEFAULT_RESP_CB_ID:
+            append_info(buf, &len, &action.u.default_resp.info);
+            append(buf, &len, " to_cmd=0x%02x result=0x%02x", action.u.default_resp.resp_to_cmd,
+                   action.u.default_resp.status_code);
+            break;
+        case ESP_ZB_CORE_CMD_OPERATE_GROUP_RESP_CB_ID:
+            append_info(buf, &len, &action.u.group.info);
+            append(buf, &len, " group=0x%04x", action.u.group.group_id);
+            break;
+        case ESP_ZB_CORE_CMD_OPERATE_SCENE_RESP_CB_ID:
+            append_info(buf, &len, &action.u.scene.info);
+            append(buf, &len, " group=0x%04x scene=%u", action.u.scene.group_id, action.u.scene.scene_id);
+            break;
+        default:
+            break;
+        }
+        return buf;
+    }
+    case LAMP_TRACE_MATCH_DESC: {
+        const uint8_t status = lamp_trace_get_u8(&c);
+        const uint16_t addr = lamp_trace_get_u16(&c);
+        append(buf, &len, " status=0x%02x addr=0x%04x endpoint=%u", status, addr, lamp_trace_get_u8(&c));
+        break;
+    }
+    case LAMP_TRACE_BIND: {
+        const uint8_t status = lamp_trace_get_u8(&c);
+        append(buf, &len, " status=0x%02x ctx=0x%08lx", status, (unsigned long)lamp_trace_get_u32(&c));
+        break;
+    }
+    case LAMP_TRACE_POST: {
+        const uint32_t age = lamp_trace_get_u32(&c);
+        append(buf, &len, " age=%luus targets=0x%llx", (unsigned long)age,
+               (unsigned long long)lamp_trace_get_u64(&c));
+        append_cmd(buf, &len, &c);
+        break;
+    }
+    case LAMP_TRACE_COMMAND: {
+        const uint8_t mode = lamp_trace_get_u8(&c);
+        const uint16_t dst = lamp_trace_get_u16(&c);
+        const uint8_t endpoint = lamp_trace_get_u8(&c);
+        append(buf, &len, " mode=%u dst=0x%04x/%u tsn=%u", mode, dst, endpoint, lamp_trace_get_u8(&c));
+        append_cmd(buf, &len, &c);
+        break;
+    }
+    case LAMP_TRACE_ZCL_REQUEST: {
+        const uint16_t cluster = lamp_trace_get_u16(&c);
+        const uint8_t command = lamp_trace_get_u8(&c);
+        const uint8_t mode = lamp_trace_get_u8(&c);
+        const uint16_t dst = lamp_trace_get_u16(&c);
+        const uint8_t endpoint = lamp_trace_get_u8(&c);
+        const uint8_t tsn = lamp_trace_get_u8(&c);
+        append(buf, &len, " cluster=0x%04x cmd=0x%02x mode=%u dst=0x%04x/%u tsn=%u arg=%u", cluster, command, mode,
+               dst, endpoint, tsn, lamp_trace_get_u16(&c));
+        break;
+    }
+    case LAMP_TRACE_ZDO_REQUEST: {
+        const uint16_t request = lamp_trace_get_u16(&c);
+        const uint16_t dst = lamp_trace_get_u16(&c);
+        append(buf, &len, " %s dst=0x%04x arg=0x%04x",
+               request == LAMP_TRACE_ZDO_MATCH_DESC ? "match_desc" : request == LAMP_TRACE_ZDO_BIND ? "bind" : "?",
+               dst, lamp_trace_get_u16(&c));
+        break;
+    }
+    case LAMP_TRACE_SEND_STATUS: {
+        const int32_t status = (int32_t)lamp_trace_get_u32(&c);
+        const uint8_t type = lamp_trace_get_u8(&c);
+        const uint16_t dst = lamp_trace_get_u16(&c);
+        const uint8_t endpoint = lamp_trace_get_u8(&c);
+        append(buf, &len, " status=%d type=%u dst=0x%04x/%u tsn=%u", (int)status, type, dst, endpoint,
+               lamp_trace_get_u8(&c));
+        break;
+    }
+    case LAMP_TRACE_TX_EXPIRE:
+        append(buf, &len, " param=0x%02x", lamp_trace_get_u8(&c));
+        break;
+    default:
+        break;
+    }
+    if (c.overflow) {
+        append(buf, &len, " (truncated)");
+    }
+    return buf;
+}
+
+/* ---- replay ---- */
+
+/* Collect the requests the replayed firmware recorded since the last call */
+static void collect_requests(void)
+{
+    uint8_t chunk[LAMP_TRACE_DUMP_CHUNK];
+    for (;;) {
+        esp_zb_lock_acquire(portMAX_DELAY);
+        const size_t len = lamp_trace_read(&s_replay.read_pos, chunk, sizeof(chunk));
+        esp_zb_lock_release();
+        if (!len) {
+            return;
+        }
+        for (size_t at = 0; at < len; at += chunk[at]) {
+            if (is_request(chunk[at + 1])) {
+                record_list_add(&s_replay.actual, chunk + at);
+            }
+        }
+    }
+}
+
+static void run_alarms(int64_t until_us)
+{
+    for (;;) {
+        sim_heap_stats_t heap_before, heap_after;
+        sim_heap_stats_get(&heap_before);
+        const uint64_t start_ns = monotonic_ns();
+        if (!sim_replay_step(until_us)) {
+            return;
+        }
+        s_replay.alarms.ns += monotonic_ns() - start_ns;
+        sim_heap_stats_get(&heap_after);
+        s_replay.alarms.allocs += heap_after.allocs - heap_before.allocs;
+        s_replay.alarms.count++;
+        collect_requests();
+    }
+}
+
+static bool deliver_signal(const uint8_t *record)
+{
+    lamp_trace_cursor_t c = record_body(record);
+    const esp_zb_app_signal_type_t type = lamp_trace_get_u16(&c);
+    const esp_err_t status = (esp_err_t)(int32_t)lamp_trace_get_u32(&c);
+    switch (type) {
+    case ESP_ZB_ZDO_SIGNAL_DEVICE_ANNCE: {
+        esp_zb_zdo_signal_device_annce_params_t params = {.device_short_addr = lamp_trace_get_u16(&c)};
+        lamp_trace_get(&c, params.ieee_addr, sizeof(params.ieee_addr));
+        params.capability = lamp_trace_get_u8(&c);
+        if (c.overflow) {
+            return false;
+        }
+        sim_replay_address(params.device_short_addr, params.ieee_addr);
+        sim_replay_signal(type, status, &params, sizeof(params));
+        return true;
+    }
+    case ESP_ZB_BDB_SIGNAL_DEVICE_FIRST_START:
+    case ESP_ZB_BDB_SIGNAL_DEVICE_REBOOT:
+        sim_replay_set_factory_new(lamp_trace_get_u8(&c));
+        sim_replay_signal(type, status, NULL, 0);
+        return !c.overflow;
+    default: {
+        /* one byte parameter, if any */
+        uint8_t param = 0;
+        const size_t len = c.pos < c.size ? 1 : 0;
+        if (len) {
+            param = lamp_trace_get_u8(&c);
+        }
+        sim_replay_signal(type, status, &param, len);
+        return true;
+    }
+    }
+}
+
+static bool deliver(const uint8_t *record, int64_t time_us)
+{
+    lamp_trace_cursor_t c = record_body(record);
+    switch (record[1]) {
+    case LAMP_TRACE_SIGNAL:
+        return deliver_signal(record);
+    case LAMP_TRACE_ACTION: {
+        static replay_action_t action;
+        if (!parse_action(record, &action)) {
+            return false;
+        }
+        sim_replay_action(action.id, &action.u);
+        return true;
+    }
+    case LAMP_TRACE_MATCH_DESC: {
+        const esp_zb_zdp_status_t status = lamp_trace_get_u8(&c);
+        const uint16_t addr = lamp_trace_get_u16(&c);
+        const uint8_t endpoint = lamp_trace_get_u8(&c);
+        esp_zb_ieee_addr_t ieee_addr;
+        static const esp_zb_ieee_addr_t unknown = {0};
+        lamp_trace_get(&c, ieee_addr, sizeof(ieee_addr));
+        if (c.overflow) {
+            return false;
+        }
+        if (memcmp(ieee_addr, unknown, sizeof(ieee_addr)) != 0) {
+            sim_replay_address(addr, ieee_addr);
+        }
+        if (!sim_replay_match_desc(status, addr, endpoint)) {
+            s_replay.unanswered++;
+        }
+        return true;
+    }
+    case LAMP_TRACE_BIND: {
+        const esp_zb_zdp_status_t status = lamp_trace_get_u8(&c);
+        void *user_ctx = (void *)(uintptr_t)lamp_trace_get_u32(&c);
+        if (c.overflow) {
+            return false;
+        }
+        if (!sim_replay_bind(status, user_ctx)) {
+            s_replay.unanswered++;
+        }
+        return true;
+    }
+    case LAMP_TRACE_SEND_STATUS: {
+        esp_zb_zcl_command_send_status_message_t message = {.status = (esp_err_t)(int32_t)lamp_trace_get_u32(&c)};
+        message.dst_addr.addr_type = lamp_trace_get_u8(&c);
+        message.dst_addr.u.short_addr = lamp_trace_get_u16(&c);
+        message.dst_endpoint = lamp_trace_get_u8(&c);
+        message.tsn = lamp_trace_get_u8(&c);
+        if (c.overflow) {
+            return false;
+        }
+        sim_replay_send_status(&message);
+        return true;
+    }
+    case LAMP_TRACE_DRAIN:
+        sim_replay_alarm(light_command_drain_cb, 0);
+        return true;
+    case LAMP_TRACE_TX_EXPIRE: {
+        const uint8_t param = lamp_trace_get_u8(&c);
+        if (c.overflow) {
+            return false;
+        }
+        sim_replay_alarm(light_tx_expire_cb, param);
+        return true;
+    }
+    case LAMP_TRACE_POST: {
+        const uint32_t age = lamp_trace_get_u32(&c);
+        const light_mask_t targets = lamp_trace_get_u64(&c);
+        light_cmd_t cmd;
+        if (!lamp_trace_get_cmd(&c, &cmd)) {
+            return false;
+        }
+        cmd.targets = targets;
+        cmd.origin_us = time_us - age;
+        light_command_post(&cmd);
+        return true;
+    }
+    default:
+        return true;
+    }
+}
+
+/* Feed one capture record in, or keep it as expected if it is a request */
+static void replay_record(size_t i)
+{
+    const uint8_t *record = record_get(&s_replay.capture, i);
+    const uint8_t kind = record[1];
+    const int64_t time_us = s_replay.times_us[i];
+    sim_clock_set(time_us);
+    kind_stats_t *stats = &s_replay.kinds[kind < LAMP_TRACE_KIND_COUNT ? kind : 0];
+    stats->count++;
+    if (is_request(kind)) {
+        record_list_add(&s_replay.expected, record);
+        return;
+    }
+    sim_heap_stats_t heap_before, heap_after;
+    sim_heap_stats_get(&heap_before);
+    const uint64_t deliver_ns = monotonic_ns();
+    if (!deliver(record, time_us)) {
+        s_replay.bad_records++;
+    }
+    stats->ns += monotonic_ns() - deliver_ns;
+    sim_heap_stats_get(&heap_after);
+    stats->allocs += heap_after.allocs - heap_before.allocs;
+    collect_requests();
+}
+
+static void replay_run(void)
+{
+    pthread_mutex_lock(&s_replay.mutex);
+    while (!s_replay.started) {
+        pthread_cond_wait(&s_replay.cond, &s_replay.mutex);
+    }
+    pthread_mutex_unlock(&s_replay.mutex);
+
+    const uint64_t start_ns = monotonic_ns();
+    for (size_t i = 0; i < s_replay.end; ++i) {
+        if (s_replay.next_tsn[i] >= 0) {
+            sim_replay_set_tsn((uint8_t)s_replay.next_tsn[i]);
+        }
+        run_alarms(s_replay.times_us[i]);
+        /* a drain takes the commands recorded after it, they are in the mailbox before it runs */
+        const size_t drain = i;
+        if (record_get(&s_replay.capture, drain)[1] == LAMP_TRACE_DRAIN) {
+            while (i + 1 < s_replay.end && record_get(&s_replay.capture, i + 1)[1] == LAMP_TRACE_POST) {
+                replay_record(++i);
+            }
+        }
+        replay_record(drain);
+    }
+    /* what the last inputs set off */
+    if (s_replay.end) {
+        run_alarms(s_replay.times_us[s_replay.end - 1]);
+    }
+    s_replay.run_ns = monotonic_ns() - start_ns;
+
+    pthread_mutex_lock(&s_replay.mutex);
+    s_replay.done = true;
+    pthread_cond_broadcast(&s_replay.cond);
+    pthread_mutex_unlock(&s_replay.mutex);
+}
+
+/*
+ * Count the recorded requests the replay made, missed or added, returns the
+ * number missed or added. Inputs are replayed at the time their handler ran,
+ * while alarms that are not recorded run when they are due: an alarm the
+ * stack ran behind an input that had been waiting runs ahead of it in the
+ * replay. Requests made within
+ * REPLAY_LOOKAHEAD of their recorded place are therefore only counted as
+ * reordered.
+ */
+static unsigned compare_requests(void)
+{
+    const record_list_t *expected = &s_replay.expected;
+    const record_list_t *actual = &s_replay.actual;
+    bool *used = sim_malloc(actual->count + 1);
+    memset(used, 0, actual->count + 1);
+    unsigned matched = 0, reordered = 0, missing = 0, extra = 0, printed = 0;
+    char text[REPLAY_TEXT_MAX];
+    size_t first = 0;   /* oldest replayed request not matched yet */
+    for (size_t i = 0; i < expected->count; ++i) {
+        while (first < actual->count && used[first]) {
+            first++;
+        }
+        size_t j = first;
+        for (unsigned seen = 0; j < actual->count && seen <= REPLAY_LOOKAHEAD; ++j) {
+            if (used[j]) {
+                continue;
+            }
+            if (request_equal(record_get(expected, i), record_get(actual, j))) {
+                break;
+            }
+            seen++;
+        }
+        if (j < actual->count && !used[j] && request_equal(record_get(expected, i), record_get(actual, j))) {
+            used[j] = true;
+            matched++;
+            reordered += j != first;
+            continue;
+        }
+        if (printed++ < REPLAY_MAX_DIVERGENCES) {
+            printf("  missing  #%zu %s\n", i, record_text(record_get(expected, i), text));
+        }
+        missing++;
+    }
+    for (size_t j = 0; j < actual->count; ++j) {
+        if (used[j]) {
+            continue;
+        }
+        if (printed++ < REPLAY_MAX_DIVERGENCES) {
+            printf("  extra    #%zu %s\n", j, record_text(record_get(actual, j), text));
+        }
+        extra++;
+    }
+    sim_free(used);
+    printf("requests: recorded %zu, replayed %zu, matched %u (%u reordered), missing %u, extra %u\n",
+           expected->count, actual->count, matched, reordered, missing, extra);
+    return missing + extra;
+}
+
+/* ---- capture ---- */
+
+static bool load_capture(FILE *in, unsigned *bad_lines)
+{
+    char line[LAMP_TRACE_HEX_MAX + 64];
+    uint8_t record[LAMP_TRACE_RECORD_MAX];
+    while (fgets(line, sizeof(line), in)) {
+        if (!strstr(line, LAMP_TRACE_HEX_PREFIX)) {
+            continue;
+        }
+        if (!lamp_trace_decode_hex(line, record)) {
+            (*bad_lines)++;
+            continue;
+        }
+        record_list_add(&s_replay.capture, record);
+    }
+    const size_t count = s_replay.capture.count;
+    if (!count) {
+        return false;
+    }
+    s_replay.times_us = sim_malloc(sizeof(int64_t) * count);
+    s_replay.next_tsn = sim_malloc(sizeof(int) * count);
+    /* record times are 32 bit microseconds */
+    uint32_t previous = 0;
+    int64_t time_us = 0;
+    s_replay.end = count;
+    for (size_t i = 0; i < count; ++i) {
+        const uint8_t *r = record_get(&s_replay.capture, i);
+        const uint32_t stamp = (uint32_t)r[2] | (uint32_t)r[3] << 8 | (uint32_t)r[4] << 16 | (uint32_t)r[5] << 24;
+        time_us = i ? time_us + (uint32_t)(stamp - previous) : stamp;
+        previous = stamp;
+        s_replay.times_us[i] = time_us;
+        if (i && r[1] == LAMP_TRACE_BOOT && s_replay.end == count) {
+            s_replay.end = i;
+        }
+    }
+    int next_tsn = -1;
+    for (size_t i = count; i-- > 0;) {
+        const uint8_t *r = record_get(&s_replay.capture, i);
+        if (r[1] == LAMP_TRACE_COMMAND || r[1] == LAMP_TRACE_ZCL_REQUEST) {
+            next_tsn = r[request_tsn_offset(r[1])];
+        }
+        s_replay.next_tsn[i] = next_tsn;
+    }
+    return true;
+}
+
+static void usage(const char *prog)
+{
+    printf("usage: %s [options] [capture file]\n"
+           "  --print               print the records as text, do not replay them\n"
+           "  --nvs-file PATH       start from the NVS contents in PATH (read only, e.g. from lamp_sim --nvs-file)\n"
+           "  --verbose             show firmware INFO logs\n",
+           prog);
+}
+
+int main(int argc, char **argv)
+{
+    enum {
+        OPT_PRINT = 1, OPT_NVS_FILE, OPT_VERBOSE, OPT_HELP,
+    };
+    static const struct option options[] = {
+        {"print", no_argument, NULL, OPT_PRINT},
+        {"nvs-file", required_argument, NULL, OPT_NVS_FILE},
+        {"verbose", no_argument, NULL, OPT_VERBOSE},
+        {"help", no_argument, NULL, OPT_HELP},
+        {NULL, 0, NULL, 0},
+    };
+    bool print = false, verbose = false;
+    const char *nvs_file = NULL;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+        switch (opt) {
+        case OPT_PRINT:
+            print = true;
+            break;
+        case OPT_NVS_FILE:
+            nvs_file = optarg;
+            break;
+        case OPT_VERBOSE:
+            verbose = true;
+            break;
+        case OPT_HELP:
+            usage(argv[0]);
+            exit(0);
+        default:
+            usage(argv[0]);
+            exit(2);
+        }
+    }
+    if (argc - optind > 1) {
+        usage(argv[0]);
+        return 2;
+    }
+    FILE *in = stdin;
+    if (optind < argc && !(in = fopen(argv[optind], "r"))) {
+        perror(argv[optind]);
+        return 1;
+    }
+    unsigned bad_lines = 0;
+    const bool loaded = load_capture(in, &bad_lines);
+    if (in != stdin) {
+        fclose(in);
+    }
+    if (bad_lines) {
+        fprintf(stderr, "%u undecodable trace lines skipped\n", bad_lines);
+    }
+    if (!loaded) {
+        fprintf(stderr, "no trace records in the capture\n");
+        return 1;
+    }
+    const record_list_t *capture = &s_replay.capture;
+    char text[REPLAY_TEXT_MAX];
+    if (print) {
+        for (size_t i = 0; i < capture->count; ++i) {
+            printf("%12.6f %s\n", s_replay.times_us[i] / 1e6, record_text(record_get(capture, i), text));
+        }
+        return 0;
+    }
+    if (record_get(capture, 0)[1] != LAMP_TRACE_BOOT) {
+        printf("warning: the capture does not start at boot (the ring wrapped), the replay may diverge early\n");
+    } else if (record_get(capture, 0)[LAMP_TRACE_HEADER_SIZE] != LAMP_TRACE_VERSION) {
+        printf("warning: trace version %u, this replay reads version %u\n", record_get(capture, 0)[LAMP_TRACE_HEADER_SIZE],
+               LAMP_TRACE_VERSION);
+    }
+    if (s_replay.end < capture->count) {
+        printf("warning: the capture holds more than one boot, replaying the first %zu records\n", s_replay.end);
+    }
+
+    /* the firmware may save its light table, keep the given file as it is */
+    char nvs_copy[] = "/tmp/lamp_replay_nvs_XXXXXX";
+    if (nvs_file) {
+        FILE *src = fopen(nvs_file, "rb");
+        const int fd = mkstemp(nvs_copy);
+        if (!src || fd < 0) {
+            perror(nvs_file);
+            return 1;
+        }
+        char buf[4096];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), src)) > 0) {
+            if (write(fd, buf, n) != (ssize_t)n) {
+                perror(nvs_copy);
+                return 1;
+            }
+        }
+        fclose(src);
+        close(fd);
+        sim_nvs_set_file(nvs_copy);
+    }
+
+    esp_log_level_set("*", verbose ? ESP_LOG_INFO : ESP_LOG_WARN);
+    sim_config_t config;
+    sim_config_default(&config);
+    config.light_count = 0;
+    config.replay = replay_run;
+    sim_clock_set(s_replay.times_us[0]);
+    sim_init(&config);
+    sim_replay_hold_alarm(light_command_drain_cb);
+    sim_replay_hold_alarm(light_tx_expire_cb);
+    app_main();
+
+    pthread_mutex_lock(&s_replay.mutex);
+    s_replay.started = true;
+    pthread_cond_broadcast(&s_replay.cond);
+    while (!s_replay.done) {
+        pthread_cond_wait(&s_replay.cond, &s_replay.mutex);
+    }
+    pthread_mutex_unlock(&s_replay.mutex);
+
+    const double span_s = (s_replay.times_us[s_replay.end - 1] - s_replay.times_us[0]) / 1e6;
+    printf("replayed %zu records (%.3f s of trace) in %.3f ms: %.0f records/s, %.0fx real time\n", s_replay.end,
+           span_s, s_replay.run_ns / 1e6, s_replay.run_ns ? s_replay.end * 1e9 / s_replay.run_ns : 0.0,
+           s_replay.run_ns ? span_s * 1e9 / s_replay.run_ns : 0.0);
+    printf("%-12s %8s %12s %8s\n", "input", "count", "ns/record", "allocs");
+    for (uint8_t kind = 1; kind < LAMP_TRACE_KIND_COUNT; ++kind) {
+        const kind_stats_t *stats = &s_replay.kinds[kind];
+        if (!stats->count || is_request(kind) || kind == LAMP_TRACE_BOOT) {
+            continue;
+        }
+        printf("%-12s %8llu %12.0f %8llu\n", lamp_trace_kind_name(kind), (unsigned long long)stats->count,
+               (double)stats->ns / stats->count, (unsigned long long)stats->allocs);
+    }
+    if (s_replay.alarms.count) {
+        printf("%-12s %8llu %12.0f %8llu\n", "alarms", (unsigned long long)s_replay.alarms.count,
+               (double)s_replay.alarms.ns / s_replay.alarms.count, (unsigned long long)s_replay.alarms.allocs);
+    }
+    if (s_replay.bad_records || s_replay.unanswered) {
+        printf("%u malformed records, %u ZDO responses to requests the replay did not make\n", s_replay.bad_records,
+               s_replay.unanswered);
+    }
+    const unsigned divergences = compare_requests();
+
+    sim_stop();
+    if (nvs_file) {
+        unlink(nvs_copy);
+    }
+    record_list_free(&s_replay.actual);
+    record_list_free(&s_replay.expected);
+    record_list_free(&s_replay.capture);
+    sim_free(s_replay.next_tsn);
+    sim_free(s_replay.times_us);
+    return divergences ? 1 : 0;
+}
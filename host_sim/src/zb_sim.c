@@ -0,0 +1,2162 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Lamp controller host simulation: mock esp-zigbee-lib coordinator stack and
+ * simulated color dimmable lights.
+ *
+ * Everything the stack does is an event on a time-ordered queue that is
+ * drained by esp_zb_stack_main_loop() in the Zigbee task, so application
+ * callbacks run in the same task context as on the target. Frames between the
+ * coordinator and a light travel over `hops` hops; every hop costs
+ * hop_latency_us (+ jitter) per transmission attempt and loses an attempt with
+ * probability hop_loss, with MAC retries per hop and APS retries end to end.
+ *
+ * In replay mode (sim_config_t.replay) there are no lights: the stack raises
+ * no signals and answers no ZDO request itself, and the replay drives the
+ * queue and the clock, feeding a recorded trace in through sim_replay_*().
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include "esp_log.h"
+#include "esp_zigbee_core.h"
+#include "ha/esp_zigbee_ha_standard.h"
+#include "sim.h"
+
+#define SIM_COORDINATOR_SHORT       0x0000
+#define SIM_LIGHT_ENDPOINT          11
+#define SIM_MAX_BINDINGS            1024
+#define SIM_MAX_FRAME_ATTRS         16
+#define SIM_ZDO_TIMEOUT_US          (5 * 1000 * 1000)
+#define SIM_LOCAL_DELAY_US          1000
+#define SIM_FORMATION_DELAY_US      (200 * 1000)
+#define SIM_LIGHT_CAPABILITIES      0x001f
+#define SIM_BCAST_JITTER_US         (64 * 1000) /* nwkcMaxBroadcastJitter, applied by every relay */
+#define SIM_BCAST_RETRIES           2           /* nwkMaxBroadcastRetries */
+#define SIM_RESTORED_GROUP_ID       0x0001      /* group the firmware put lights in on the previous run */
+#define SIM_MOVE_POLL_US            (100 * 1000) /* reporting check period of a light whose level moves */
+#define SIM_REPLAY_MAX_PENDING      64          /* ZDO requests waiting for their answer from a replay */
+#define SIM_REPLAY_MAX_HELD         4           /* alarm callbacks a replay runs itself */
+#define SIM_REPLAY_MAX_ADDRESSES    256
+
+#define SIM_BOUND_LEVEL             (1U << 0)
+#define SIM_BOUND_COLOR             (1U << 1)
+
+static const char *TAG = "ZB_SIM";
+
+typedef enum {
+    SIM_FRAME_CMD,              /* cluster specific command to a light */
+    SIM_FRAME_READ,             /* read attributes request to a light */
+    SIM_FRAME_DEFAULT_RESP,     /* default response to the coordinator */
+    SIM_FRAME_READ_RESP,        /* read attributes response to the coordinator */
+    SIM_FRAME_GROUP_RESP,       /* add group response to the coordinator */
+    SIM_FRAME_SCENE_RESP,       /* add scene response to the coordinator */
+    SIM_FRAME_CONFIG_REPORT,    /* configure reporting request to a light */
+    SIM_FRAME_CONFIG_REPORT_RESP, /* configure reporting response to the coordinator */
+    SIM_FRAME_REPORT,           /* attribute report to the coordinator */
+} sim_frame_kind_t;
+
+typedef struct {
+    uint16_t id;
+    uint8_t type;
+    uint8_t status;
+    uint32_t value;             /* reportable change in a configure reporting request */
+    uint16_t min_interval;      /* configure reporting only */
+    uint16_t max_interval;
+} sim_attr_t;
+
+typedef struct {
+    sim_frame_kind_t kind;
+    unsigned light;
+    uint16_t cluster;
+    uint8_t cmd_id;
+    uint8_t tsn;
+    uint8_t src_endpoint;       /* coordinator endpoint */
+    uint8_t status;
+    uint8_t count;
+    bool groupcast;             /* group addressed, never answered */
+    uint16_t arg[8];
+    sim_attr_t attrs[SIM_MAX_FRAME_ATTRS];
+} sim_frame_t;
+
+typedef enum {
+    SIM_EV_ALARM,
+    SIM_EV_SIGNAL,
+    SIM_EV_LIGHT_ANNCE,
+    SIM_EV_MATCH_DESC,
+    SIM_EV_BIND,
+    SIM_EV_FRAME_TO_LIGHT,
+    SIM_EV_FRAME_TO_COORD,
+    SIM_EV_REPORT,
+    SIM_EV_SEND_STATUS,
+} sim_event_type_t;
+
+typedef struct {
+    int64_t due_us;
+    uint64_t seq;
+    sim_event_type_t type;
+    union {
+        struct {
+            esp_zb_callback_t cb;
+            uint8_t param;
+        } alarm;
+        struct {
+            esp_zb_app_signal_type_t type;
+            esp_err_t status;
+            uint8_t params[16];
+        } signal;
+        struct {
+            unsigned light;
+        } annce;
+        struct {
+            esp_zb_zdo_match_desc_callback_t cb;
+            void *user_ctx;
+            esp_zb_zdp_status_t status;
+            uint16_t addr;
+            uint8_t endpoint;
+            bool slot;          /* holds one of the stack's ZDO transaction slots */
+        } match;
+        struct {
+            esp_zb_zdo_bind_callback_t cb;
+            void *user_ctx;
+            esp_zb_zdp_status_t status;
+            bool slot;
+        } bind;
+        struct {
+            unsigned light;
+            int64_t due_us;
+        } report;
+        esp_zb_zcl_command_send_status_message_t send_status;
+        sim_frame_t frame;
+    } u;
+} sim_event_t;
+
+typedef struct {
+    uint16_t cluster_id;
+    uint8_t src_endp;
+    uint8_t dst_addr_mode;
+    esp_zb_addr_u dst_address_u;
+    uint8_t dst_endp;
+} sim_binding_t;
+
+struct esp_zb_attribute_list_s {
+    uint16_t cluster_id;
+};
+
+struct esp_zb_cluster_list_s {
+    esp_zb_attribute_list_t *basic;
+    esp_zb_attribute_list_t *identify;
+};
+
+struct esp_zb_ep_list_s {
+    uint8_t endpoint;
+    esp_zb_cluster_list_t *cluster_list;
+};
+
+/* ---- simulator state ---- */
+
+static sim_config_t s_cfg;
+static sim_light_t *s_lights;
+static unsigned s_light_count;
+static sim_binding_t *s_bindings;
+static unsigned s_binding_count;
+static sim_stats_t s_stats;
+
+static pthread_mutex_t s_state_mutex;   /* protects everything above */
+static pthread_mutex_t s_zb_lock;       /* esp_zb_lock_acquire() */
+
+static pthread_mutex_t s_ev_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_ev_cond;
+static sim_event_t *s_events;           /* binary min-heap on (due_us, seq) */
+static unsigned s_event_count;
+static unsigned s_event_capacity;
+static uint64_t s_event_seq;
+static bool s_stopping;
+
+static esp_zb_core_action_callback_t s_action_cb;
+static esp_zb_zcl_command_send_status_callback_t s_send_status_cb;
+static bool s_factory_new = true;
+static bool s_steering_started;
+static uint16_t s_pan_id;
+static uint8_t s_channel = 13;
+static uint8_t s_tsn;
+static int64_t s_radio_free_us;     /* when the coordinator's radio has sent every request issued so far */
+static int64_t s_tx_wait_us;        /* how long the request being sent waits for the radio */
+static unsigned s_zdo_inflight;     /* ZDO requests waiting for their answer */
+static esp_zb_ieee_addr_t s_coordinator_ieee = {0x01, 0x00, 0x00, 0xfe, 0xff, 0x6c, 0xc6, 0x40};
+
+/* replay mode: ZDO requests the replay answers, the devices it told about and the alarms it runs itself */
+typedef struct {
+    esp_zb_zdo_match_desc_callback_t match_cb;  /* one of the two callbacks is set */
+    esp_zb_zdo_bind_callback_t bind_cb;
+    void *user_ctx;
+    uint16_t addr;              /* address of interest of a match descriptor request */
+} sim_replay_pending_t;
+
+typedef struct {
+    uint16_t short_addr;
+    esp_zb_ieee_addr_t ieee_addr;
+} sim_replay_address_t;
+
+static sim_replay_pending_t s_replay_pending[SIM_REPLAY_MAX_PENDING];
+static unsigned s_replay_pending_count;
+static sim_replay_address_t s_replay_addresses[SIM_REPLAY_MAX_ADDRESSES];
+static unsigned s_replay_address_count;
+static esp_zb_callback_t s_replay_held[SIM_REPLAY_MAX_HELD];
+static unsigned s_replay_held_count;
+
+static void state_lock(void)
+{
+    pthread_mutex_lock(&s_state_mutex);
+}
+
+static void state_unlock(void)
+{
+    pthread_mutex_unlock(&s_state_mutex);
+}
+
+static void binding_add(const esp_zb_zdo_bind_req_param_t *req);
+
+/* ---- configuration ---- */
+
+void sim_config_default(sim_config_t *config)
+{
+    memset(config, 0, sizeof(*config));
+    config->light_count = 4;
+    config->max_hops = 2;
+    config->hop_latency_us = 4000;
+    config->hop_jitter_us = 1000;
+    config->hop_loss = 0.02;
+    config->mac_retries = 3;
+    config->aps_retries = 3;
+    config->aps_ack_timeout_us = 150 * 1000;
+    config->tx_frame_us = 2000;
+    config->join_spacing_us = 50 * 1000;
+    config->seed = 1;
+}
+
+static uint32_t light_attr_value(const sim_light_t *light, uint16_t cluster, uint16_t attr_id);
+static void light_report_run(sim_light_t *light);
+static void schedule_joins(bool rejoin);
+
+/* reporting the firmware configured on the previous run */
+static const sim_report_t s_restored_reports[] = {
+    {ESP_ZB_ZCL_CLUSTER_ID_ON_OFF, ESP_ZB_ZCL_ATTR_ON_OFF_ON_OFF_ID, 0, 300, 0},
+    {ESP_ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL, ESP_ZB_ZCL_ATTR_LEVEL_CONTROL_CURRENT_LEVEL_ID, 1, 300, 1},
+    {ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL, ESP_ZB_ZCL_ATTR_COLOR_CONTROL_CURRENT_X_ID, 1, 300, 16},
+    {ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL, ESP_ZB_ZCL_ATTR_COLOR_CONTROL_CURRENT_Y_ID, 1, 300, 16},
+    {ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL, ESP_ZB_ZCL_ATTR_COLOR_CONTROL_COLOR_MODE_ID, 1, 300, 0},
+};
+
+/* Network state a rebooted coordinator finds in its zb_storage partition */
+static void restore_network(void)
+{
+    s_factory_new = false;
+    s_steering_started = true;
+    s_pan_id = (uint16_t)(sim_rand() & 0x3fff) | 0x1000;
+    for (unsigned i = 0; i < s_light_count; ++i) {
+        sim_light_t *light = &s_lights[i];
+        light->joined = true;
+        light->bound_us = 1; /* bound before this boot */
+        if (!light->rejects_groups) {
+            light->groups[light->group_count++] = SIM_RESTORED_GROUP_ID;
+        }
+        esp_zb_zdo_bind_req_param_t req = {
+            .src_endp = 1,
+            .dst_addr_mode = ESP_ZB_ZDO_BIND_DST_ADDR_MODE_64_BIT_EXTENDED,
+            .dst_endp = light->endpoint,
+        };
+        memcpy(req.dst_address_u.addr_long, light->ieee_addr, sizeof(esp_zb_ieee_addr_t));
+        req.cluster_id = ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL;
+        binding_add(&req);
+        req.cluster_id = ESP_ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL;
+        binding_add(&req);
+        for (unsigned r = 0; r < sizeof(s_restored_reports) / sizeof(s_restored_reports[0]); ++r) {
+            light->reports[light->report_count] = s_restored_reports[r];
+            sim_report_t *report = &light->reports[light->report_count++];
+            report->reported = light_attr_value(light, report->cluster, report->attr_id);
+            report->reported_us = sim_now_us();
+        }
+        light_report_run(light);
+    }
+}
+
+void sim_init(const sim_config_t *config)
+{
+    s_cfg = *config;
+    if (s_cfg.light_count > SIM_MAX_LIGHTS) {
+        s_cfg.light_count = SIM_MAX_LIGHTS;
+    }
+    if (s_cfg.max_hops == 0) {
+        s_cfg.max_hops = 1;
+    }
+    sim_rand_seed(s_cfg.seed);
+    (void)sim_now_us();
+
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&s_state_mutex, &attr);
+    pthread_mutex_init(&s_zb_lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    pthread_condattr_t cattr;
+    pthread_condattr_init(&cattr);
+    pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+    pthread_cond_init(&s_ev_cond, &cattr);
+    pthread_condattr_destroy(&cattr);
+
+    s_lights = sim_malloc(sizeof(sim_light_t) * SIM_MAX_LIGHTS);
+    memset(s_lights, 0, sizeof(sim_light_t) * SIM_MAX_LIGHTS);
+    s_bindings = sim_malloc(sizeof(sim_binding_t) * SIM_MAX_BINDINGS);
+    s_light_count = s_cfg.light_count;
+    for (unsigned i = 0; i < s_light_count; ++i) {
+        sim_light_t *light = &s_lights[i];
+        static const uint8_t oui[3] = {0x17, 0x88, 0x01};
+        light->ieee_addr[7] = oui[0];
+        light->ieee_addr[6] = oui[1];
+        light->ieee_addr[5] = oui[2];
+        light->ieee_addr[4] = 0x0b;
+        light->ieee_addr[3] = (uint8_t)(i >> 8);
+        light->ieee_addr[2] = (uint8_t)i;
+        light->ieee_addr[1] = (uint8_t)sim_rand();
+        light->ieee_addr[0] = (uint8_t)sim_rand();
+        do {
+            light->short_addr = (uint16_t)(sim_rand() % 0xfff0) + 1;
+            for (unsigned j = 0; j < i; ++j) {
+                if (s_lights[j].short_addr == light->short_addr) {
+                    light->short_addr = 0;
+                    break;
+                }
+            }
+        } while (light->short_addr == 0);
+        light->endpoint = SIM_LIGHT_ENDPOINT;
+        light->hops = (uint8_t)(1 + i % s_cfg.max_hops);
+        light->on_off = true;
+        light->level = 254;
+        light->color_mode = 1;
+        light->color_x = 0x6000;
+        light->color_y = 0x6000;
+        light->color_temperature = 370;
+        light->color_capabilities = SIM_LIGHT_CAPABILITIES;
+        light->rejects_groups = sim_rand_unit() < s_cfg.group_reject;
+    }
+    if (s_cfg.rebooted) {
+        restore_network();
+        if (s_cfg.rejoin) {
+            schedule_joins(true);
+        }
+    }
+}
+
+/* ---- event queue ---- */
+
+static bool event_before(const sim_event_t *a, const sim_event_t *b)
+{
+    return a->due_us < b->due_us || (a->due_us == b->due_us && a->seq < b->seq);
+}
+
+static void event_swap(unsigned a, unsigned b)
+{
+    sim_event_t tmp = s_events[a];
+    s_events[a] = s_events[b];
+    s_events[b] = tmp;
+}
+
+static void event_sift_down(unsigned i)
+{
+    for (;;) {
+        unsigned l = 2 * i + 1, r = l + 1, m = i;
+        if (l < s_event_count && event_before(&s_events[l], &s_events[m])) {
+            m = l;
+        }
+        if (r < s_event_count && event_before(&s_events[r], &s_events[m])) {
+            m = r;
+        }
+        if (m == i) {
+            return;
+        }
+        event_swap(i, m);
+        i = m;
+    }
+}
+
+static void event_post(sim_event_t *ev, int64_t delay_us)
+{
+    pthread_mutex_lock(&s_ev_mutex);
+    if (s_event_count == s_event_capacity) {
+        unsigned capacity = s_event_capacity ? s_event_capacity * 2 : 256;
+        sim_event_t *events = sim_malloc(sizeof(sim_event_t) * capacity);
+        if (s_event_count) {
+            memcpy(events, s_events, sizeof(sim_event_t) * s_event_count);
+        }
+        sim_free(s_events);
+        s_events = events;
+        s_event_capacity = capacity;
+    }
+    ev->due_us = sim_now_us() + (delay_us > 0 ? delay_us : 0);
+    ev->seq = s_event_seq++;
+    unsigned i = s_event_count++;
+    s_events[i] = *ev;
+    while (i > 0 && event_before(&s_events[i], &s_events[(i - 1) / 2])) {
+        event_swap(i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+    pthread_cond_signal(&s_ev_cond);
+    pthread_mutex_unlock(&s_ev_mutex);
+}
+
+/* Wait for the next due event; returns false when the simulation stops */
+static bool event_take(sim_event_t *out)
+{
+    pthread_mutex_lock(&s_ev_mutex);
+    for (;;) {
+        if (s_stopping) {
+            pthread_mutex_unlock(&s_ev_mutex);
+            return false;
+        }
+        if (s_event_count == 0) {
+            pthread_cond_wait(&s_ev_cond, &s_ev_mutex);
+            continue;
+        }
+        int64_t wait_us = s_events[0].due_us - sim_now_us();
+        if (wait_us <= 0) {
+            break;
+        }
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        int64_t ns = ts.tv_nsec + wait_us * 1000;
+        ts.tv_sec += ns / 1000000000;
+        ts.tv_nsec = ns % 1000000000;
+        pthread_cond_timedwait(&s_ev_cond, &s_ev_mutex, &ts);
+    }
+    *out = s_events[0];
+    s_events[0] = s_events[--s_event_count];
+    event_sift_down(0);
+    pthread_mutex_unlock(&s_ev_mutex);
+    return true;
+}
+
+void sim_stop(void)
+{
+    pthread_mutex_lock(&s_ev_mutex);
+    s_stopping = true;
+    pthread_cond_broadcast(&s_ev_cond);
+    pthread_mutex_unlock(&s_ev_mutex);
+}
+
+static void signal_post(esp_zb_app_signal_type_t type, esp_err_t status, const void *params, size_t len,
+                        int64_t delay_us)
+{
+    if (s_cfg.replay) {
+        /* every signal comes from the trace */
+        return;
+    }
+    sim_event_t ev = {.type = SIM_EV_SIGNAL};
+    ev.u.signal.type = type;
+    ev.u.signal.status = status;
+    if (params && len <= sizeof(ev.u.signal.params)) {
+        memcpy(ev.u.signal.params, params, len);
+    }
+    event_post(&ev, delay_us);
+}
+
+/* ---- radio path model ---- */
+
+/* Returns true when the frame arrives; *delay_us is the time until it does */
+static bool path_transmit(unsigned hops, bool acked, int64_t *delay_us)
+{
+    int64_t total = 0;
+    unsigned attempts = acked ? 1 + s_cfg.aps_retries : 1;
+    for (unsigned attempt = 0; attempt < attempts; ++attempt) {
+        bool delivered = true;
+        for (unsigned hop = 0; hop < hops && delivered; ++hop) {
+            bool hop_ok = false;
+            for (unsigned tx = 0; tx <= s_cfg.mac_retries; ++tx) {
+                s_stats.frames_on_air++;
+                total += s_cfg.hop_latency_us;
+                if (s_cfg.hop_jitter_us) {
+                    total += sim_rand() % s_cfg.hop_jitter_us;
+                }
+                if (sim_rand_unit() >= s_cfg.hop_loss) {
+                    hop_ok = true;
+                    break;
+                }
+            }
+            delivered = hop_ok;
+        }
+        if (delivered) {
+            if (acked) {
+                s_stats.frames_on_air += hops; /* APS acknowledgement */
+            }
+            *delay_us = total;
+            return true;
+        }
+        total += s_cfg.aps_ack_timeout_us;
+    }
+    s_stats.frames_lost++;
+    *delay_us = total;
+    return false;
+}
+
+/* ---- lookup ---- */
+
+static sim_light_t *light_by_short(uint16_t short_addr)
+{
+    for (unsigned i = 0; i < s_light_count; ++i) {
+        if (s_lights[i].joined && s_lights[i].short_addr == short_addr) {
+            return &s_lights[i];
+        }
+    }
+    return NULL;
+}
+
+static sim_light_t *light_by_ieee(const esp_zb_ieee_addr_t ieee_addr)
+{
+    for (unsigned i = 0; i < s_light_count; ++i) {
+        if (s_lights[i].joined && memcmp(s_lights[i].ieee_addr, ieee_addr, sizeof(esp_zb_ieee_addr_t)) == 0) {
+            return &s_lights[i];
+        }
+    }
+    return NULL;
+}
+
+/* ---- snapshot API ---- */
+
+unsigned sim_light_count(void)
+{
+    return s_light_count;
+}
+
+static void light_level_update(sim_light_t *light);
+
+void sim_light_get(unsigned index, sim_light_t *out)
+{
+    state_lock();
+    light_level_update(&s_lights[index]);
+    *out = s_lights[index];
+    state_unlock();
+}
+
+unsigned sim_lights_bound(void)
+{
+    unsigned bound = 0;
+    state_lock();
+    for (unsigned i = 0; i < s_light_count; ++i) {
+        bound += s_lights[i].bound_us != 0;
+    }
+    state_unlock();
+    return bound;
+}
+
+void sim_stats_get(sim_stats_t *out)
+{
+    state_lock();
+    *out = s_stats;
+    state_unlock();
+}
+
+void sim_mark(void)
+{
+    state_lock();
+    for (unsigned i = 0; i < s_light_count; ++i) {
+        s_lights[i].mark_change_us = 0;
+    }
+    state_unlock();
+}
+
+/* ---- data model ---- */
+
+esp_zb_ep_list_t *esp_zb_ep_list_create(void)
+{
+    esp_zb_ep_list_t *ep_list = sim_malloc(sizeof(*ep_list));
+    memset(ep_list, 0, sizeof(*ep_list));
+    return ep_list;
+}
+
+esp_zb_cluster_list_t *esp_zb_zcl_cluster_list_create(void)
+{
+    esp_zb_cluster_list_t *cluster_list = sim_malloc(sizeof(*cluster_list));
+    memset(cluster_list, 0, sizeof(*cluster_list));
+    return cluster_list;
+}
+
+esp_err_t esp_zb_ep_list_add_gateway_ep(esp_zb_ep_list_t *ep_list, esp_zb_cluster_list_t *cluster_list,
+                                        esp_zb_endpoint_config_t endpoint_config)
+{
+    ep_list->endpoint = endpoint_config.endpoint;
+    ep_list->cluster_list = cluster_list;
+    return ESP_OK;
+}
+
+esp_zb_cluster_list_t *esp_zb_ep_list_get_ep(const esp_zb_ep_list_t *ep_list, uint8_t ep_id)
+{
+    return ep_list && ep_list->endpoint == ep_id ? ep_list->cluster_list : NULL;
+}
+
+esp_zb_attribute_list_t *esp_zb_cluster_list_get_cluster(const esp_zb_cluster_list_t *cluster_list,
+                                                         uint16_t cluster_id, uint8_t role_mask)
+{
+    (void)role_mask;
+    if (!cluster_list) {
+        return NULL;
+    }
+    switch (cluster_id) {
+    case ESP_ZB_ZCL_CLUSTER_ID_BASIC:
+        return cluster_list->basic;
+    case ESP_ZB_ZCL_CLUSTER_ID_IDENTIFY:
+        return cluster_list->identify;
+    default:
+        return NULL;
+    }
+}
+
+static esp_zb_attribute_list_t *attribute_list_create(uint16_t cluster_id)
+{
+    esp_zb_attribute_list_t *attr_list = sim_malloc(sizeof(*attr_list));
+    attr_list->cluster_id = cluster_id;
+    return attr_list;
+}
+
+esp_zb_attribute_list_t *esp_zb_basic_cluster_create(void *basic_cfg)
+{
+    (void)basic_cfg;
+    return attribute_list_create(ESP_ZB_ZCL_CLUSTER_ID_BASIC);
+}
+
+esp_zb_attribute_list_t *esp_zb_identify_cluster_create(void *identify_cfg)
+{
+    (void)identify_cfg;
+    return attribute_list_create(ESP_ZB_ZCL_CLUSTER_ID_IDENTIFY);
+}
+
+esp_err_t esp_zb_basic_cluster_add_attr(esp_zb_attribute_list_t *attr_list, uint16_t attr_id, void *value_p)
+{
+    (void)attr_id;
+    return attr_list && value_p ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t esp_zb_cluster_list_add_basic_cluster(esp_zb_cluster_list_t *cluster_list,
+                                                esp_zb_attribute_list_t *attr_list, uint8_t role_mask)
+{
+    (void)role_mask;
+    cluster_list->basic = attr_list;
+    return ESP_OK;
+}
+
+esp_err_t esp_zb_cluster_list_add_identify_cluster(esp_zb_cluster_list_t *cluster_list,
+                                                   esp_zb_attribute_list_t *attr_list, uint8_t role_mask)
+{
+    (void)role_mask;
+    cluster_list->identify = attr_list;
+    return ESP_OK;
+}
+
+esp_err_t esp_zb_device_register(esp_zb_ep_list_t *ep_list)
+{
+    return ep_list ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+/* ---- stack lifecycle ---- */
+
+esp_err_t esp_zb_platform_config(esp_zb_platform_config_t *config)
+{
+    return config ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+void esp_zb_init(esp_zb_cfg_t *nwk_cfg)
+{
+    (void)nwk_cfg;
+}
+
+esp_err_t esp_zb_start(bool autostart)
+{
+    if (autostart) {
+        return esp_zb_bdb_start_top_level_commissioning(ESP_ZB_BDB_MODE_INITIALIZATION);
+    }
+    signal_post(ESP_ZB_ZDO_SIGNAL_SKIP_STARTUP, ESP_OK, NULL, 0, SIM_LOCAL_DELAY_US);
+    return ESP_OK;
+}
+
+esp_err_t esp_zb_set_primary_network_channel_set(uint32_t channel_mask)
+{
+    for (uint8_t ch = 11; ch <= 26; ++ch) {
+        if (channel_mask & (1UL << ch)) {
+            s_channel = ch;
+            break;
+        }
+    }
+    return ESP_OK;
+}
+
+bool esp_zb_lock_acquire(TickType_t block_ticks)
+{
+    if (block_ticks == portMAX_DELAY) {
+        return pthread_mutex_lock(&s_zb_lock) == 0;
+    }
+    if (block_ticks == 0) {
+        return pthread_mutex_trylock(&s_zb_lock) == 0;
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    int64_t ns = ts.tv_nsec + (int64_t)block_ticks * portTICK_PERIOD_MS * 1000000;
+    ts.tv_sec += ns / 1000000000;
+    ts.tv_nsec = ns % 1000000000;
+    return pthread_mutex_timedlock(&s_zb_lock, &ts) == 0;
+}
+
+void esp_zb_lock_release(void)
+{
+    pthread_mutex_unlock(&s_zb_lock);
+}
+
+void esp_zb_scheduler_alarm(esp_zb_callback_t cb, uint8_t param, uint32_t time)
+{
+    for (unsigned i = 0; s_cfg.replay && i < s_replay_held_count; ++i) {
+        if (s_replay_held[i] == cb) {
+            return;
+        }
+    }
+    sim_event_t ev = {.type = SIM_EV_ALARM};
+    ev.u.alarm.cb = cb;
+    ev.u.alarm.param = param;
+    event_post(&ev, (int64_t)time * 1000);
+}
+
+void esp_zb_scheduler_alarm_cancel(esp_zb_callback_t cb, uint8_t param)
+{
+    pthread_mutex_lock(&s_ev_mutex);
+    unsigned kept = 0;
+    for (unsigned i = 0; i < s_event_count; ++i) {
+        const sim_event_t *ev = &s_events[i];
+        if (ev->type == SIM_EV_ALARM && ev->u.alarm.cb == cb && ev->u.alarm.param == param) {
+            continue;
+        }
+        s_events[kept++] = *ev;
+    }
+    s_event_count = kept;
+    for (unsigned i = s_event_count / 2; i-- > 0;) {
+        event_sift_down(i);
+    }
+    pthread_mutex_unlock(&s_ev_mutex);
+}
+
+/* Announcements of the lights not joined yet, or of every light when they all rejoin */
+static void schedule_joins(bool rejoin)
+{
+    for (unsigned i = 0; i < s_light_count; ++i) {
+        if (s_lights[i].joined && !rejoin) {
+            continue;
+        }
+        int64_t delay_us = 0;
+        path_transmit(s_lights[i].hops, false, &delay_us);
+        sim_event_t ev = {.type = SIM_EV_LIGHT_ANNCE};
+        ev.u.annce.light = i;
+        event_post(&ev, (int64_t)s_cfg.join_spacing_us * (i + 1) + delay_us);
+    }
+}
+
+esp_err_t esp_zb_bdb_start_top_level_commissioning(uint8_t mode_mask)
+{
+    state_lock();
+    switch (mode_mask) {
+    case ESP_ZB_BDB_MODE_INITIALIZATION:
+        signal_post(s_factory_new ? ESP_ZB_BDB_SIGNAL_DEVICE_FIRST_START : ESP_ZB_BDB_SIGNAL_DEVICE_REBOOT, ESP_OK,
+                    NULL, 0, SIM_LOCAL_DELAY_US);
+        break;
+    case ESP_ZB_BDB_MODE_NETWORK_FORMATION:
+        s_factory_new = false;
+        s_pan_id = (uint16_t)(sim_rand() & 0x3fff) | 0x1000;
+        signal_post(ESP_ZB_BDB_SIGNAL_FORMATION, ESP_OK, NULL, 0, SIM_FORMATION_DELAY_US);
+        break;
+    case ESP_ZB_BDB_MODE_NETWORK_STEERING: {
+        uint8_t duration = 180;
+        signal_post(ESP_ZB_BDB_SIGNAL_STEERING, ESP_OK, NULL, 0, SIM_LOCAL_DELAY_US);
+        signal_post(ESP_ZB_NWK_SIGNAL_PERMIT_JOIN_STATUS, ESP_OK, &duration, sizeof(duration), SIM_LOCAL_DELAY_US);
+        if (!s_steering_started) {
+            s_steering_started = true;
+            schedule_joins(false);
+        }
+        break;
+    }
+    default:
+        state_unlock();
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    state_unlock();
+    return ESP_OK;
+}
+
+bool esp_zb_bdb_is_factory_new(void)
+{
+    return s_factory_new;
+}
+
+esp_err_t esp_zb_bdb_open_network(uint8_t permit_duration)
+{
+    signal_post(ESP_ZB_NWK_SIGNAL_PERMIT_JOIN_STATUS, ESP_OK, &permit_duration, sizeof(permit_duration),
+                SIM_LOCAL_DELAY_US);
+    return ESP_OK;
+}
+
+void esp_zb_get_long_address(esp_zb_ieee_addr_t addr)
+{
+    memcpy(addr, s_coordinator_ieee, sizeof(esp_zb_ieee_addr_t));
+}
+
+uint16_t esp_zb_get_short_address(void)
+{
+    return SIM_COORDINATOR_SHORT;
+}
+
+uint16_t esp_zb_get_pan_id(void)
+{
+    return s_pan_id;
+}
+
+uint8_t esp_zb_get_current_channel(void)
+{
+    return s_channel;
+}
+
+esp_err_t esp_zb_ieee_address_by_short(uint16_t short_addr, uint8_t *ieee_addr)
+{
+    state_lock();
+    sim_light_t *light = light_by_short(short_addr);
+    bool found = light != NULL;
+    if (light) {
+        memcpy(ieee_addr, light->ieee_addr, sizeof(esp_zb_ieee_addr_t));
+    }
+    for (unsigned i = 0; !found && i < s_replay_address_count; ++i) {
+        if (s_replay_addresses[i].short_addr == short_addr) {
+            memcpy(ieee_addr, s_replay_addresses[i].ieee_addr, sizeof(esp_zb_ieee_addr_t));
+            found = true;
+        }
+    }
+    state_unlock();
+    return found ? ESP_OK : ESP_FAIL;
+}
+
+/* RSSI the coordinator hears a light's frames with, from the last hop */
+static int8_t light_rssi(const sim_light_t *light)
+{
+    return (int8_t)(-38 - 9 * (int)light->hops);
+}
+
+/*
+ * Lights one hop away are the coordinator's neighbors. Their LQI follows the
+ * RSSI (-100 dBm maps to 0, -30 dBm to 255) and drops with the loss rate.
+ */
+esp_err_t esp_zb_nwk_get_next_neighbor(esp_zb_nwk_info_iterator_t *iterator, esp_zb_nwk_neighbor_info_t *nbr_info)
+{
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    state_lock();
+    while (*iterator < s_light_count) {
+        const sim_light_t *light = &s_lights[(*iterator)++];
+        if (!light->joined || light->hops != 1) {
+            continue;
+        }
+        const int8_t rssi = light_rssi(light);
+        int lqi = (rssi + 100) * 255 / 70;
+        lqi = (int)(lqi * (1.0 - s_cfg.hop_loss));
+        *nbr_info = (esp_zb_nwk_neighbor_info_t){
+            .short_addr = light->short_addr,
+            .device_type = ESP_ZB_DEVICE_TYPE_ROUTER,
+            .depth = 1,
+            .rx_on_when_idle = 1,
+            .relationship = 1, /* child */
+            .lqi = (uint8_t)(lqi < 0 ? 0 : lqi > 255 ? 255 : lqi),
+            .rssi = rssi,
+            .outgoing_cost = 1,
+        };
+        memcpy(nbr_info->ieee_addr, light->ieee_addr, sizeof(esp_zb_ieee_addr_t));
+        err = ESP_OK;
+        break;
+    }
+    state_unlock();
+    return err;
+}
+
+uint16_t esp_zb_address_short_by_ieee(esp_zb_ieee_addr_t ieee_addr)
+{
+    state_lock();
+    sim_light_t *light = light_by_ieee(ieee_addr);
+    uint16_t short_addr = light ? light->short_addr : 0xffff;
+    state_unlock();
+    return short_addr;
+}
+
+void esp_zb_set_node_descriptor_manufacturer_code(uint16_t manufacturer_code)
+{
+    (void)manufacturer_code;
+}
+
+void *esp_zb_app_signal_get_params(uint32_t *signal_p)
+{
+    return signal_p + 1;
+}
+
+const char *esp_zb_zdo_signal_to_string(esp_zb_app_signal_type_t signal)
+{
+    switch (signal) {
+    case ESP_ZB_ZDO_SIGNAL_DEFAULT_START: return "ZDO_SIGNAL_DEFAULT_START";
+    case ESP_ZB_ZDO_SIGNAL_SKIP_STARTUP: return "ZDO_SIGNAL_SKIP_STARTUP";
+    case ESP_ZB_ZDO_SIGNAL_DEVICE_ANNCE: return "ZDO_SIGNAL_DEVICE_ANNCE";
+    case ESP_ZB_ZDO_SIGNAL_LEAVE: return "ZDO_SIGNAL_LEAVE";
+    case ESP_ZB_ZDO_SIGNAL_ERROR: return "ZDO_SIGNAL_ERROR";
+    case ESP_ZB_BDB_SIGNAL_DEVICE_FIRST_START: return "BDB_SIGNAL_DEVICE_FIRST_START";
+    case ESP_ZB_BDB_SIGNAL_DEVICE_REBOOT: return "BDB_SIGNAL_DEVICE_REBOOT";
+    case ESP_ZB_BDB_SIGNAL_STEERING: return "BDB_SIGNAL_STEERING";
+    case ESP_ZB_BDB_SIGNAL_FORMATION: return "BDB_SIGNAL_FORMATION";
+    case ESP_ZB_ZDO_SIGNAL_LEAVE_INDICATION: return "ZDO_SIGNAL_LEAVE_INDICATION";
+    case ESP_ZB_ZDO_SIGNAL_PRODUCTION_CONFIG_READY: return "ZDO_SIGNAL_PRODUCTION_CONFIG_READY";
+    case ESP_ZB_NWK_SIGNAL_DEVICE_ASSOCIATED: return "NWK_SIGNAL_DEVICE_ASSOCIATED";
+    case ESP_ZB_ZDO_SIGNAL_DEVICE_AUTHORIZED: return "ZDO_SIGNAL_DEVICE_AUTHORIZED";
+    case ESP_ZB_ZDO_SIGNAL_DEVICE_UPDATE: return "ZDO_SIGNAL_DEVICE_UPDATE";
+    case ESP_ZB_NWK_SIGNAL_PERMIT_JOIN_STATUS: return "NWK_SIGNAL_PERMIT_JOIN_STATUS";
+    default: return "UNKNOWN_SIGNAL";
+    }
+}
+
+void esp_zb_core_action_handler_register(esp_zb_core_action_callback_t cb)
+{
+    s_action_cb = cb;
+}
+
+void esp_zb_zcl_command_send_status_handler_register(esp_zb_zcl_command_send_status_callback_t cb)
+{
+    s_send_status_cb = cb;
+}
+
+/* The stack hands its radio one request at a time, in the order they were issued: how long this one waits */
+static int64_t radio_queue(void)
+{
+    const int64_t now_us = sim_now_us();
+    if (s_radio_free_us < now_us) {
+        s_radio_free_us = now_us;
+    }
+    const int64_t wait_us = s_radio_free_us - now_us;
+    s_radio_free_us += s_cfg.tx_frame_us;
+    return wait_us;
+}
+
+/* ---- ZDO ---- */
+
+/* Take a ZDO transaction slot; without one the stack never sends the request and reports a timeout */
+static bool zdo_slot_take(void)
+{
+    if (s_cfg.zdo_slots && s_zdo_inflight >= s_cfg.zdo_slots) {
+        s_stats.zdo_dropped++;
+        return false;
+    }
+    s_zdo_inflight++;
+    return true;
+}
+
+/* Replay mode: keep a request until the replay answers it, false when not replaying */
+static bool replay_pending_add(const sim_replay_pending_t *pending)
+{
+    if (!s_cfg.replay) {
+        return false;
+    }
+    if (s_replay_pending_count == SIM_REPLAY_MAX_PENDING) {
+        ESP_LOGW(TAG, "Replay: too many ZDO requests pending, dropping one");
+        return true;
+    }
+    s_replay_pending[s_replay_pending_count++] = *pending;
+    return true;
+}
+
+void esp_zb_zdo_find_color_dimmable_light(esp_zb_zdo_match_desc_req_param_t *cmd_req,
+                                          esp_zb_zdo_match_desc_callback_t user_cb, void *user_ctx)
+{
+    state_lock();
+    s_stats.zdo_requests++;
+    if (replay_pending_add(&(sim_replay_pending_t){
+            .match_cb = user_cb, .user_ctx = user_ctx, .addr = cmd_req->addr_of_interest})) {
+        state_unlock();
+        return;
+    }
+    sim_event_t ev = {.type = SIM_EV_MATCH_DESC};
+    ev.u.match.cb = user_cb;
+    ev.u.match.user_ctx = user_ctx;
+    ev.u.match.addr = cmd_req->addr_of_interest;
+    ev.u.match.slot = zdo_slot_take();
+    int64_t delay_us = SIM_ZDO_TIMEOUT_US;
+    sim_light_t *light = light_by_short(cmd_req->dst_nwk_addr);
+    if (!ev.u.match.slot) {
+        ev.u.match.status = ESP_ZB_ZDP_STATUS_TIMEOUT;
+    } else if (!light) {
+        ev.u.match.status = ESP_ZB_ZDP_STATUS_DEVICE_NOT_FOUND;
+    } else {
+        int64_t there = 0, back = 0;
+        const int64_t wait_us = radio_queue();
+        if (path_transmit(light->hops, true, &there) && path_transmit(light->hops, true, &back)) {
+            light->frames_rx++;
+            light->frames_tx++;
+            ev.u.match.status = ESP_ZB_ZDP_STATUS_SUCCESS;
+            ev.u.match.endpoint = light->endpoint;
+            delay_us = wait_us + there + back;
+        } else {
+            ev.u.match.status = ESP_ZB_ZDP_STATUS_TIMEOUT;
+        }
+    }
+    event_post(&ev, delay_us);
+    state_unlock();
+}
+
+static void binding_add(const esp_zb_zdo_bind_req_param_t *req)
+{
+    for (unsigned i = 0; i < s_binding_count; ++i) {
+        sim_binding_t *b = &s_bindings[i];
+        if (b->cluster_id == req->cluster_id && b->src_endp == req->src_endp && b->dst_endp == req->dst_endp &&
+            b->dst_addr_mode == req->dst_addr_mode &&
+            memcmp(&b->dst_address_u, &req->dst_address_u, sizeof(esp_zb_addr_u)) == 0) {
+            return;
+        }
+    }
+    if (s_binding_count == SIM_MAX_BINDINGS) {
+        return;
+    }
+    sim_binding_t *b = &s_bindings[s_binding_count++];
+    b->cluster_id = req->cluster_id;
+    b->src_endp = req->src_endp;
+    b->dst_addr_mode = req->dst_addr_mode;
+    b->dst_address_u = req->dst_address_u;
+    b->dst_endp = req->dst_endp;
+
+    if (req->dst_addr_mode == ESP_ZB_ZDO_BIND_DST_ADDR_MODE_64_BIT_EXTENDED) {
+        sim_light_t *light = light_by_ieee(req->dst_address_u.addr_long);
+        if (light) {
+            if (req->cluster_id == ESP_ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL) {
+                light->bound_clusters |= SIM_BOUND_LEVEL;
+            } else if (req->cluster_id == ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL) {
+                light->bound_clusters |= SIM_BOUND_COLOR;
+            }
+            if (light->bound_clusters == (SIM_BOUND_LEVEL | SIM_BOUND_COLOR) && light->bound_us == 0) {
+                light->bound_us = sim_now_us();
+            }
+        }
+    }
+}
+
+void esp_zb_zdo_device_bind_req(esp_zb_zdo_bind_req_param_t *cmd_req, esp_zb_zdo_bind_callback_t user_cb,
+                                void *user_ctx)
+{
+    state_lock();
+    s_stats.zdo_requests++;
+    if (replay_pending_add(&(sim_replay_pending_t){.bind_cb = user_cb, .user_ctx = user_ctx})) {
+        state_unlock();
+        return;
+    }
+    sim_event_t ev = {.type = SIM_EV_BIND};
+    ev.u.bind.cb = user_cb;
+    ev.u.bind.user_ctx = user_ctx;
+    ev.u.bind.slot = zdo_slot_take();
+    int64_t delay_us = SIM_LOCAL_DELAY_US;
+    if (!ev.u.bind.slot) {
+        ev.u.bind.status = ESP_ZB_ZDP_STATUS_TIMEOUT;
+        delay_us = SIM_ZDO_TIMEOUT_US;
+    } else if (cmd_req->req_dst_addr == SIM_COORDINATOR_SHORT) {
+        if (s_binding_count < SIM_MAX_BINDINGS) {
+            binding_add(cmd_req);
+            ev.u.bind.status = ESP_ZB_ZDP_STATUS_SUCCESS;
+        } else {
+            ev.u.bind.status = ESP_ZB_ZDP_STATUS_TABLE_FULL;
+        }
+    } else {
+        /* binding tables on remote devices are not modelled */
+        sim_light_t *light = light_by_short(cmd_req->req_dst_addr);
+        int64_t there = 0, back = 0;
+        const int64_t wait_us = radio_queue();
+        if (light && path_transmit(light->hops, true, &there) && path_transmit(light->hops, true, &back)) {
+            ev.u.bind.status = ESP_ZB_ZDP_STATUS_SUCCESS;
+            delay_us = wait_us + there + back;
+        } else {
+            ev.u.bind.status = ESP_ZB_ZDP_STATUS_TIMEOUT;
+            delay_us = SIM_ZDO_TIMEOUT_US;
+        }
+    }
+    event_post(&ev, delay_us);
+    state_unlock();
+}
+
+/* ---- ZCL ---- */
+
+/* Send status of a unicast, once it is acknowledged or the last APS retry timed out */
+static void send_status_post(uint16_t short_addr, uint8_t endpoint, const sim_frame_t *frame, esp_err_t status,
+                             int64_t delay_us)
+{
+    sim_event_t ev = {.type = SIM_EV_SEND_STATUS};
+    ev.u.send_status = (esp_zb_zcl_command_send_status_message_t){
+        .tsn = frame->tsn,
+        .dst_addr = {.addr_type = ESP_ZB_ZCL_ADDR_TYPE_SHORT, .u.short_addr = short_addr},
+        .dst_endpoint = endpoint,
+        .src_endpoint = frame->src_endpoint,
+        .status = status,
+    };
+    event_post(&ev, delay_us);
+}
+
+static void frame_to_light(sim_light_t *light, const sim_frame_t *proto)
+{
+    int64_t delay_us = 0;
+    const bool delivered = path_transmit(light->hops, true, &delay_us);
+    delay_us += s_tx_wait_us;
+    if (!delivered) {
+        send_status_post(light->short_addr, light->endpoint, proto, ESP_FAIL, delay_us);
+        return;
+    }
+    /* the APS acknowledgement travels back over the same hops */
+    send_status_post(light->short_addr, light->endpoint, proto, ESP_OK,
+                     delay_us + (int64_t)light->hops * s_cfg.hop_latency_us);
+    sim_event_t ev = {.type = SIM_EV_FRAME_TO_LIGHT};
+    ev.u.frame = *proto;
+    ev.u.frame.light = (unsigned)(light - s_lights);
+    event_post(&ev, delay_us);
+}
+
+static bool light_in_group(const sim_light_t *light, uint16_t group_id)
+{
+    for (unsigned i = 0; i < light->group_count; ++i) {
+        if (light->groups[i] == group_id) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Group addressed frames travel as NWK broadcasts: the coordinator transmits
+ * once and every joined router (every light) relays once after a random
+ * jitter. Broadcasts are not acknowledged; a hop is retried on missing passive
+ * acknowledgements, which is folded into the per-hop delivery probability.
+ */
+static void frame_to_group(uint16_t group_id, const sim_frame_t *proto)
+{
+    s_stats.frames_on_air++;
+    for (unsigned i = 0; i < s_light_count; ++i) {
+        sim_light_t *light = &s_lights[i];
+        if (!light->joined) {
+            continue;
+        }
+        s_stats.frames_on_air++; /* relay */
+        if (!light_in_group(light, group_id)) {
+            continue;
+        }
+        int64_t delay_us = s_tx_wait_us;
+        bool delivered = true;
+        for (unsigned hop = 0; hop < light->hops && delivered; ++hop) {
+            if (hop) {
+                delay_us += sim_rand() % SIM_BCAST_JITTER_US;
+            }
+            delay_us += s_cfg.hop_latency_us;
+            if (s_cfg.hop_jitter_us) {
+                delay_us += sim_rand() % s_cfg.hop_jitter_us;
+            }
+            delivered = false;
+            for (unsigned tx = 0; tx <= SIM_BCAST_RETRIES && !delivered; ++tx) {
+                delivered = sim_rand_unit() >= s_cfg.hop_loss;
+            }
+        }
+        if (!delivered) {
+            s_stats.frames_lost++;
+            continue;
+        }
+        sim_event_t ev = {.type = SIM_EV_FRAME_TO_LIGHT};
+        ev.u.frame = *proto;
+        ev.u.frame.light = i;
+        ev.u.frame.groupcast = true;
+        event_post(&ev, delay_us);
+    }
+}
+
+static uint8_t zcl_send(const esp_zb_zcl_basic_cmd_t *basic, esp_zb_zcl_address_mode_t address_mode,
+                        sim_frame_t *frame)
+{
+    state_lock();
+    uint8_t tsn = s_tsn++;
+    s_stats.zcl_requests++;
+    frame->tsn = tsn;
+    s_tx_wait_us = radio_queue();
+    frame->src_endpoint = basic->src_endpoint;
+    switch (address_mode) {
+    case ESP_ZB_APS_ADDR_MODE_DST_ADDR_ENDP_NOT_PRESENT:
+        for (unsigned i = 0; i < s_binding_count; ++i) {
+            const sim_binding_t *b = &s_bindings[i];
+            if (b->cluster_id != frame->cluster || b->src_endp != basic->src_endpoint ||
+                b->dst_addr_mode != ESP_ZB_ZDO_BIND_DST_ADDR_MODE_64_BIT_EXTENDED) {
+                continue;
+            }
+            sim_light_t *light = light_by_ieee(b->dst_address_u.addr_long);
+            if (light) {
+                frame_to_light(light, frame);
+            }
+        }
+        break;
+    case ESP_ZB_APS_ADDR_MODE_16_ENDP_PRESENT: {
+        sim_light_t *light = light_by_short(basic->dst_addr_u.addr_short);
+        if (light && light->endpoint == basic->dst_endpoint) {
+            frame_to_light(light, frame);
+        } else if (!s_cfg.replay) {
+            /* nobody acknowledges, the stack gives up after its last retry */
+            send_status_post(basic->dst_addr_u.addr_short, basic->dst_endpoint, frame, ESP_FAIL,
+                             s_tx_wait_us + (1 + (int64_t)s_cfg.aps_retries) * s_cfg.aps_ack_timeout_us);
+        }
+        break;
+    }
+    case ESP_ZB_APS_ADDR_MODE_16_GROUP_ENDP_NOT_PRESENT:
+        frame_to_group(basic->dst_addr_u.addr_short, frame);
+        break;
+    case ESP_ZB_APS_ADDR_MODE_64_ENDP_PRESENT: {
+        sim_light_t *light = light_by_ieee(basic->dst_addr_u.addr_long);
+        if (light && light->endpoint == basic->dst_endpoint) {
+            frame_to_light(light, frame);
+        }
+        break;
+    }
+    default:
+        ESP_LOGW(TAG, "Unsupported address mode %d for cluster 0x%04x command 0x%02x", (int)address_mode,
+                 frame->cluster, frame->cmd_id);
+        break;
+    }
+    state_unlock();
+    return tsn;
+}
+
+static uint8_t zcl_command(const esp_zb_zcl_basic_cmd_t *basic, esp_zb_zcl_address_mode_t address_mode,
+                          uint16_t cluster, uint8_t cmd_id, uint16_t a0, uint16_t a1, uint16_t a2)
+{
+    sim_frame_t frame = {.kind = SIM_FRAME_CMD, .cluster = cluster, .cmd_id = cmd_id};
+    frame.arg[0] = a0;
+    frame.arg[1] = a1;
+    frame.arg[2] = a2;
+    return zcl_send(basic, address_mode, &frame);
+}
+
+uint8_t esp_zb_zcl_level_move_to_level_cmd_req(esp_zb_zcl_move_to_level_cmd_t *cmd_req)
+{
+    return zcl_command(&cmd_req->zcl_basic_cmd, cmd_req->address_mode, ESP_ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL,
+                       ESP_ZB_ZCL_CMD_LEVEL_CONTROL_MOVE_TO_LEVEL, cmd_req->level, cmd_req->transition_time, 0);
+}
+
+uint8_t esp_zb_zcl_level_move_to_level_with_onoff_cmd_req(esp_zb_zcl_move_to_level_cmd_t *cmd_req)
+{
+    return zcl_command(&cmd_req->zcl_basic_cmd, cmd_req->address_mode, ESP_ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL,
+                       ESP_ZB_ZCL_CMD_LEVEL_CONTROL_MOVE_TO_LEVEL_WITH_ON_OFF, cmd_req->level,
+                       cmd_req->transition_time, 0);
+}
+
+uint8_t esp_zb_zcl_level_move_cmd_req(esp_zb_zcl_level_move_cmd_t *cmd_req)
+{
+    return zcl_command(&cmd_req->zcl_basic_cmd, cmd_req->address_mode, ESP_ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL,
+                       ESP_ZB_ZCL_CMD_LEVEL_CONTROL_MOVE, cmd_req->move_mode, cmd_req->rate, 0);
+}
+
+uint8_t esp_zb_zcl_level_move_with_onoff_cmd_req(esp_zb_zcl_level_move_cmd_t *cmd_req)
+{
+    return zcl_command(&cmd_req->zcl_basic_cmd, cmd_req->address_mode, ESP_ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL,
+                       ESP_ZB_ZCL_CMD_LEVEL_CONTROL_MOVE_WITH_ON_OFF, cmd_req->move_mode, cmd_req->rate, 0);
+}
+
+uint8_t esp_zb_zcl_level_step_cmd_req(esp_zb_zcl_level_step_cmd_t *cmd_req)
+{
+    return zcl_command(&cmd_req->zcl_basic_cmd, cmd_req->address_mode, ESP_ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL,
+                       ESP_ZB_ZCL_CMD_LEVEL_CONTROL_STEP, cmd_req->step_mode, cmd_req->step_size,
+                       cmd_req->transition_time);
+}
+
+uint8_t esp_zb_zcl_level_step_with_onoff_cmd_req(esp_zb_zcl_level_step_cmd_t *cmd_req)
+{
+    return zcl_command(&cmd_req->zcl_basic_cmd, cmd_req->address_mode, ESP_ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL,
+                       ESP_ZB_ZCL_CMD_LEVEL_CONTROL_STEP_WITH_ON_OFF, cmd_req->step_mode, cmd_req->step_size,
+                       cmd_req->transition_time);
+}
+
+uint8_t esp_zb_zcl_level_stop_cmd_req(esp_zb_zcl_level_stop_cmd_t *cmd_req)
+{
+    return zcl_command(&cmd_req->zcl_basic_cmd, cmd_req->address_mode, ESP_ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL,
+                       ESP_ZB_ZCL_CMD_LEVEL_CONTROL_STOP, 0, 0, 0);
+}
+
+uint8_t esp_zb_zcl_color_move_to_color_cmd_req(esp_zb_zcl_color_move_to_color_cmd_t *cmd_req)
+{
+    return zcl_command(&cmd_req->zcl_basic_cmd, cmd_req->address_mode, ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL,
+                       ESP_ZB_ZCL_CMD_COLOR_CONTROL_MOVE_TO_COLOR, cmd_req->color_x, cmd_req->color_y,
+                       cmd_req->transition_time);
+}
+
+uint8_t esp_zb_zcl_color_move_to_hue_and_saturation_cmd_req(esp_zb_color_move_to_hue_saturation_cmd_t *cmd_req)
+{
+    return zcl_command(&cmd_req->zcl_basic_cmd, cmd_req->address_mode, ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL,
+                       ESP_ZB_ZCL_CMD_COLOR_CONTROL_MOVE_TO_HUE_SATURATION, cmd_req->hue, cmd_req->saturation,
+                       cmd_req->transition_time);
+}
+
+uint8_t esp_zb_zcl_color_enhanced_move_to_hue_cmd_req(esp_zb_zcl_color_enhanced_move_to_hue_cmd_t *cmd_req)
+{
+    return zcl_command(&cmd_req->zcl_basic_cmd, cmd_req->address_mode, ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL,
+                       ESP_ZB_ZCL_CMD_COLOR_CONTROL_ENHANCED_MOVE_TO_HUE, cmd_req->enhanced_hue, cmd_req->direction,
+                       cmd_req->transition_time);
+}
+
+uint8_t esp_zb_zcl_color_move_to_color_temperature_cmd_req(esp_zb_zcl_color_move_to_color_temperature_cmd_t *cmd_req)
+{
+    return zcl_command(&cmd_req->zcl_basic_cmd, cmd_req->address_mode, ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL,
+                       ESP_ZB_ZCL_CMD_COLOR_CONTROL_MOVE_TO_COLOR_TEMPERATURE, cmd_req->color_temperature,
+                       cmd_req->transition_time, 0);
+}
+
+uint8_t esp_zb_zcl_read_attr_cmd_req(esp_zb_zcl_read_attr_cmd_t *cmd_req)
+{
+    sim_frame_t frame = {.kind = SIM_FRAME_READ, .cluster = cmd_req->clusterID};
+    unsigned count = cmd_req->attr_number < SIM_MAX_FRAME_ATTRS ? cmd_req->attr_number : SIM_MAX_FRAME_ATTRS;
+    for (unsigned i = 0; i < count; ++i) {
+        frame.attrs[i].id = cmd_req->attr_field[i];
+    }
+    frame.count = (uint8_t)count;
+    return zcl_send(&cmd_req->zcl_basic_cmd, cmd_req->address_mode, &frame);
+}
+
+uint8_t esp_zb_zcl_config_report_cmd_req(esp_zb_zcl_config_report_cmd_t *cmd_req)
+{
+    sim_frame_t frame = {.kind = SIM_FRAME_CONFIG_REPORT, .cluster = cmd_req->clusterID};
+    unsigned count = cmd_req->record_number < SIM_MAX_FRAME_ATTRS ? cmd_req->record_number : SIM_MAX_FRAME_ATTRS;
+    for (unsigned i = 0; i < count; ++i) {
+        const esp_zb_zcl_config_report_record_t *record = &cmd_req->record_field[i];
+        sim_attr_t *attr = &frame.attrs[i];
+        attr->id = record->attributeID;
+        attr->type = record->attrType;
+        attr->min_interval = record->min_interval;
+        attr->max_interval = record->max_interval;
+        if (record->reportable_change) {
+            attr->value = record->attrType == ESP_ZB_ZCL_ATTR_TYPE_U16 ? *(const uint16_t *)record->reportable_change
+                                                                       : *(const uint8_t *)record->reportable_change;
+        }
+    }
+    frame.count = (uint8_t)count;
+    return zcl_send(&cmd_req->zcl_basic_cmd, cmd_req->address_mode, &frame);
+}
+
+uint8_t esp_zb_zcl_groups_add_group_cmd_req(esp_zb_zcl_groups_add_group_cmd_t *cmd_req)
+{
+    return zcl_command(&cmd_req->zcl_basic_cmd, cmd_req->address_mode, ESP_ZB_ZCL_CLUSTER_ID_GROUPS,
+                       ESP_ZB_ZCL_CMD_GROUPS_ADD_GROUP, cmd_req->group_id, 0, 0);
+}
+
+/* Only the on/off, level and color XY extension fields are understood */
+uint8_t esp_zb_zcl_scenes_add_scene_cmd_req(esp_zb_zcl_scenes_add_scene_cmd_t *cmd_req)
+{
+    sim_frame_t frame = {
+        .kind = SIM_FRAME_CMD,
+        .cluster = ESP_ZB_ZCL_CLUSTER_ID_SCENES,
+        .cmd_id = ESP_ZB_ZCL_CMD_SCENES_ADD_SCENE,
+    };
+    frame.arg[0] = cmd_req->group_id;
+    frame.arg[1] = cmd_req->scene_id;
+    for (const esp_zb_zcl_scenes_extension_field_t *field = cmd_req->extension_field; field; field = field->next) {
+        const uint8_t *value = field->extension_field_attribute_value_list;
+        if (field->cluster_id == ESP_ZB_ZCL_CLUSTER_ID_ON_OFF && field->length >= 1) {
+            frame.arg[2] |= SIM_SCENE_ON_OFF;
+            frame.arg[3] = value[0];
+        } else if (field->cluster_id == ESP_ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL && field->length >= 1) {
+            frame.arg[2] |= SIM_SCENE_LEVEL;
+            frame.arg[4] = value[0];
+        } else if (field->cluster_id == ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL && field->length >= 4) {
+            frame.arg[2] |= SIM_SCENE_COLOR_XY;
+            frame.arg[5] = (uint16_t)(value[0] | value[1] << 8);
+            frame.arg[6] = (uint16_t)(value[2] | value[3] << 8);
+        }
+    }
+    return zcl_send(&cmd_req->zcl_basic_cmd, cmd_req->address_mode, &frame);
+}
+
+uint8_t esp_zb_zcl_scenes_recall_scene_cmd_req(esp_zb_zcl_scenes_recall_scene_cmd_t *cmd_req)
+{
+    return zcl_command(&cmd_req->zcl_basic_cmd, cmd_req->address_mode, ESP_ZB_ZCL_CLUSTER_ID_SCENES,
+                       ESP_ZB_ZCL_CMD_SCENES_RECALL_SCENE, cmd_req->group_id, cmd_req->scene_id, 0);
+}
+
+/* ---- light behaviour ---- */
+
+static sim_scene_t *light_find_scene(sim_light_t *light, uint16_t group_id, uint8_t scene_id)
+{
+    for (unsigned i = 0; i < light->scene_count; ++i) {
+        if (light->scenes[i].group_id == group_id && light->scenes[i].scene_id == scene_id) {
+            return &light->scenes[i];
+        }
+    }
+    return NULL;
+}
+
+static void light_read_attr(const sim_light_t *light, uint16_t cluster, sim_attr_t *attr)
+{
+    attr->status = ESP_ZB_ZCL_STATUS_SUCCESS;
+    switch (cluster) {
+    case ESP_ZB_ZCL_CLUSTER_ID_ON_OFF:
+        if (attr->id == ESP_ZB_ZCL_ATTR_ON_OFF_ON_OFF_ID) {
+            attr->type = ESP_ZB_ZCL_ATTR_TYPE_BOOL;
+            attr->value = light->on_off;
+            return;
+        }
+        break;
+    case ESP_ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL:
+        if (attr->id == ESP_ZB_ZCL_ATTR_LEVEL_CONTROL_CURRENT_LEVEL_ID) {
+            attr->type = ESP_ZB_ZCL_ATTR_TYPE_U8;
+            attr->value = light->level;
+            return;
+        }
+        break;
+    case ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL:
+        switch (attr->id) {
+        case ESP_ZB_ZCL_ATTR_COLOR_CONTROL_CURRENT_HUE_ID:
+            attr->type = ESP_ZB_ZCL_ATTR_TYPE_U8;
+            attr->value = light->hue;
+            return;
+        case ESP_ZB_ZCL_ATTR_COLOR_CONTROL_CURRENT_SATURATION_ID:
+            attr->type = ESP_ZB_ZCL_ATTR_TYPE_U8;
+            attr->value = light->saturation;
+            return;
+        case ESP_ZB_ZCL_ATTR_COLOR_CONTROL_CURRENT_X_ID:
+            attr->type = ESP_ZB_ZCL_ATTR_TYPE_U16;
+            attr->value = light->color_x;
+            return;
+        case ESP_ZB_ZCL_ATTR_COLOR_CONTROL_CURRENT_Y_ID:
+            attr->type = ESP_ZB_ZCL_ATTR_TYPE_U16;
+            attr->value = light->color_y;
+            return;
+        case ESP_ZB_ZCL_ATTR_COLOR_CONTROL_COLOR_TEMPERATURE_ID:
+            attr->type = ESP_ZB_ZCL_ATTR_TYPE_U16;
+            attr->value = light->color_temperature;
+            return;
+        case ESP_ZB_ZCL_ATTR_COLOR_CONTROL_COLOR_MODE_ID:
+            attr->type = ESP_ZB_ZCL_ATTR_TYPE_8BIT_ENUM;
+            attr->value = light->color_mode;
+            return;
+        case ESP_ZB_ZCL_ATTR_COLOR_CONTROL_ENHANCED_CURRENT_HUE_ID:
+            attr->type = ESP_ZB_ZCL_ATTR_TYPE_U16;
+            attr->value = light->enhanced_hue;
+            return;
+        case ESP_ZB_ZCL_ATTR_COLOR_CONTROL_COLOR_LOOP_ACTIVE_ID:
+            attr->type = ESP_ZB_ZCL_ATTR_TYPE_U8;
+            attr->value = 0;
+            return;
+        case ESP_ZB_ZCL_ATTR_COLOR_CONTROL_COLOR_CAPABILITIES_ID:
+            attr->type = ESP_ZB_ZCL_ATTR_TYPE_16BITMAP;
+            attr->value = light->color_capabilities;
+            return;
+        default:
+            break;
+        }
+        break;
+    default:
+        break;
+    }
+    attr->status = ESP_ZB_ZCL_STATUS_UNSUP_ATTRIB;
+    attr->type = ESP_ZB_ZCL_ATTR_TYPE_NULL;
+    attr->value = 0;
+}
+
+static uint32_t light_attr_value(const sim_light_t *light, uint16_t cluster, uint16_t attr_id)
+{
+    sim_attr_t attr = {.id = attr_id};
+    light_read_attr(light, cluster, &attr);
+    return attr.value;
+}
+
+/* Stores the accepted records and returns the number of failed ones, listed in resp */
+static unsigned light_configure_reporting(sim_light_t *light, const sim_frame_t *frame, sim_frame_t *resp)
+{
+    unsigned failed = 0;
+    for (unsigned i = 0; i < frame->count; ++i) {
+        const sim_attr_t *record = &frame->attrs[i];
+        sim_attr_t probe = {.id = record->id};
+        light_read_attr(light, frame->cluster, &probe);
+        uint8_t status = probe.status;
+        sim_report_t *report = NULL;
+        for (unsigned r = 0; r < light->report_count && status == ESP_ZB_ZCL_STATUS_SUCCESS; ++r) {
+            if (light->reports[r].cluster == frame->cluster && light->reports[r].attr_id == record->id) {
+                report = &light->reports[r];
+            }
+        }
+        if (status == ESP_ZB_ZCL_STATUS_SUCCESS && !report) {
+            if (light->report_count == SIM_LIGHT_MAX_REPORTS) {
+                status = ESP_ZB_ZCL_STATUS_INSUFF_SPACE;
+            } else {
+                report = &light->reports[light->report_count++];
+            }
+        }
+        if (status != ESP_ZB_ZCL_STATUS_SUCCESS) {
+            resp->attrs[failed].id = record->id;
+            resp->attrs[failed++].status = status == ESP_ZB_ZCL_STATUS_UNSUP_ATTRIB ?
+                                           ESP_ZB_ZCL_STATUS_UNREPORTABLE_ATTRIB : status;
+            continue;
+        }
+        *report = (sim_report_t){
+            .cluster = frame->cluster,
+            .attr_id = record->id,
+            .min_interval = record->min_interval,
+            .max_interval = record->max_interval,
+            .change = record->value,
+            .reported = probe.value,
+            .reported_us = sim_now_us(),
+        };
+    }
+    return failed;
+}
+
+static bool report_changed(const sim_report_t *report, uint32_t value)
+{
+    uint32_t delta = value > report->reported ? value - report->reported : report->reported - value;
+    return report->change ? delta >= report->change : delta != 0;
+}
+
+/* Bring the level of a moving light up to date, the move ends at either end of the range */
+static void light_level_update(sim_light_t *light)
+{
+    if (!light->level_rate) {
+        return;
+    }
+    int64_t level = light->level_from + light->level_rate * (sim_now_us() - light->level_move_us) / 1000000;
+    if (level <= 1 && light->level_rate < 0) {
+        level = 1;
+        light->level_rate = 0;
+        if (light->level_move_on_off) {
+            light->on_off = false;
+        }
+    } else if (level >= 254 && light->level_rate > 0) {
+        level = 254;
+        light->level_rate = 0;
+    }
+    light->level = (uint8_t)level;
+}
+
+static uint8_t level_clamp(int level)
+{
+    return (uint8_t)(level < 1 ? 1 : level > 254 ? 254 : level);
+}
+
+static void light_report_schedule(sim_light_t *light, int64_t due_us)
+{
+    if (light->report_due_us && light->report_due_us <= due_us) {
+        return;
+    }
+    int64_t now = sim_now_us();
+    light->report_due_us = due_us > now ? due_us : now;
+    sim_event_t ev = {.type = SIM_EV_REPORT};
+    ev.u.report.light = (unsigned)(light - s_lights);
+    ev.u.report.due_us = light->report_due_us;
+    event_post(&ev, light->report_due_us - now);
+}
+
+/*
+ * Sends every report that is due, one frame per cluster, and schedules the
+ * next check: a throttled change after its min interval, or the earliest
+ * periodic report. Reports go to the coordinator; the binding on the light
+ * that directs them there is not modelled.
+ */
+static void light_report_run(sim_light_t *light)
+{
+    const int64_t now = sim_now_us();
+    int64_t next_us = 0;
+    sim_frame_t frames[3];
+    unsigned frame_count = 0;
+    light->report_due_us = 0;
+    light_level_update(light);
+    for (unsigned r = 0; r < light->report_count; ++r) {
+        sim_report_t *report = &light->reports[r];
+        const uint32_t value = light_attr_value(light, report->cluster, report->attr_id);
+        const int64_t min_due = report->reported_us + (int64_t)report->min_interval * 1000000;
+        const bool periodic = report->max_interval != 0 && report->max_interval != 0xffff;
+        const int64_t max_due = report->reported_us + (int64_t)report->max_interval * 1000000;
+        const bool changed = report_changed(report, value);
+        if ((changed && now >= min_due) || (periodic && now >= max_due)) {
+            sim_frame_t *frame = NULL;
+            for (unsigned f = 0; f < frame_count; ++f) {
+                if (frames[f].cluster == report->cluster) {
+                    frame = &frames[f];
+                }
+            }
+            if (!frame && frame_count < sizeof(frames) / sizeof(frames[0])) {
+                frame = &frames[frame_count++];
+                *frame = (sim_frame_t){
+                    .kind = SIM_FRAME_REPORT,
+                    .light = (unsigned)(light - s_lights),
+                    .cluster = report->cluster,
+                    .src_endpoint = 1,
+                };
+            }
+            if (!frame || frame->count == SIM_MAX_FRAME_ATTRS) {
+                continue;
+            }
+            sim_attr_t *attr = &frame->attrs[frame->count++];
+            attr->id = report->attr_id;
+            light_read_attr(light, report->cluster, attr);
+            report->reported = value;
+            report->reported_us = now;
+            if (periodic) {
+                next_us = next_us && next_us < now + report->max_interval * 1000000LL ?
+                          next_us : now + report->max_interval * 1000000LL;
+            }
+            continue;
+        }
+        int64_t due_us = changed ? min_due : (periodic ? max_due : 0);
+        if (due_us && (!next_us || due_us < next_us)) {
+            next_us = due_us;
+        }
+    }
+    for (unsigned f = 0; f < frame_count; ++f) {
+        int64_t delay_us = 0;
+        s_stats.reports++;
+        light->frames_tx++;
+        if (path_transmit(light->hops, true, &delay_us)) {
+            sim_event_t ev = {.type = SIM_EV_FRAME_TO_COORD};
+            ev.u.frame = frames[f];
+            event_post(&ev, delay_us);
+        }
+    }
+    if (light->level_rate && (!next_us || now + SIM_MOVE_POLL_US < next_us)) {
+        /* the level keeps changing without frames */
+        next_us = now + SIM_MOVE_POLL_US;
+    }
+    if (next_us) {
+        light_report_schedule(light, next_us);
+    }
+}
+
+/* Applies a command and returns the ZCL status for the default response */
+static uint8_t light_apply(sim_light_t *light, const sim_frame_t *frame)
+{
+    switch (frame->cluster) {
+    case ESP_ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL: {
+        /* every level command ends a running move */
+        light_level_update(light);
+        light->level_rate = 0;
+        const bool down = frame->arg[0] != 0;
+        switch (frame->cmd_id) {
+        case ESP_ZB_ZCL_CMD_LEVEL_CONTROL_MOVE_TO_LEVEL:
+            light->level = (uint8_t)frame->arg[0];
+            return ESP_ZB_ZCL_STATUS_SUCCESS;
+        case ESP_ZB_ZCL_CMD_LEVEL_CONTROL_MOVE_TO_LEVEL_WITH_ON_OFF:
+            light->level = (uint8_t)frame->arg[0];
+            light->on_off = light->level > 1;
+            return ESP_ZB_ZCL_STATUS_SUCCESS;
+        case ESP_ZB_ZCL_CMD_LEVEL_CONTROL_MOVE:
+        case ESP_ZB_ZCL_CMD_LEVEL_CONTROL_MOVE_WITH_ON_OFF:
+            light->level_move_on_off = frame->cmd_id == ESP_ZB_ZCL_CMD_LEVEL_CONTROL_MOVE_WITH_ON_OFF;
+            if (light->level_move_on_off && !down) {
+                light->on_off = true;
+            }
+            light->level_from = light->level;
+            light->level_move_us = sim_now_us();
+            light->level_rate = (int16_t)(down ? -frame->arg[1] : frame->arg[1]);
+            return ESP_ZB_ZCL_STATUS_SUCCESS;
+        case ESP_ZB_ZCL_CMD_LEVEL_CONTROL_STEP:
+        case ESP_ZB_ZCL_CMD_LEVEL_CONTROL_STEP_WITH_ON_OFF:
+            /* the transition is not modelled */
+            light->level = level_clamp(light->level + (down ? -frame->arg[1] : frame->arg[1]));
+            if (frame->cmd_id == ESP_ZB_ZCL_CMD_LEVEL_CONTROL_STEP_WITH_ON_OFF) {
+                light->on_off = light->level > 1;
+            }
+            return ESP_ZB_ZCL_STATUS_SUCCESS;
+        case ESP_ZB_ZCL_CMD_LEVEL_CONTROL_STOP:
+        case ESP_ZB_ZCL_CMD_LEVEL_CONTROL_STOP_WITH_ON_OFF:
+            return ESP_ZB_ZCL_STATUS_SUCCESS;
+        default:
+            break;
+        }
+        break;
+    }
+    case ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL:
+        switch (frame->cmd_id) {
+        case ESP_ZB_ZCL_CMD_COLOR_CONTROL_MOVE_TO_COLOR:
+            light->color_x = frame->arg[0];
+            light->color_y = frame->arg[1];
+            light->color_mode = 1;
+            return ESP_ZB_ZCL_STATUS_SUCCESS;
+        case ESP_ZB_ZCL_CMD_COLOR_CONTROL_MOVE_TO_HUE_SATURATION:
+            light->hue = (uint8_t)frame->arg[0];
+            light->saturation = (uint8_t)frame->arg[1];
+            light->enhanced_hue = (uint16_t)(light->hue << 8);
+            light->color_mode = 0;
+            return ESP_ZB_ZCL_STATUS_SUCCESS;
+        case ESP_ZB_ZCL_CMD_COLOR_CONTROL_ENHANCED_MOVE_TO_HUE:
+            light->enhanced_hue = frame->arg[0];
+            light->hue = (uint8_t)(light->enhanced_hue >> 8);
+            light->color_mode = 0;
+            return ESP_ZB_ZCL_STATUS_SUCCESS;
+        case ESP_ZB_ZCL_CMD_COLOR_CONTROL_MOVE_TO_COLOR_TEMPERATURE:
+            light->color_temperature = frame->arg[0];
+            light->color_mode = 2;
+            return ESP_ZB_ZCL_STATUS_SUCCESS;
+        default:
+            break;
+        }
+        break;
+    case ESP_ZB_ZCL_CLUSTER_ID_GROUPS:
+        if (frame->cmd_id == ESP_ZB_ZCL_CMD_GROUPS_ADD_GROUP) {
+            if (light_in_group(light, frame->arg[0])) {
+                return ESP_ZB_ZCL_STATUS_DUPE_EXISTS;
+            }
+            if (light->rejects_groups || light->group_count == SIM_LIGHT_MAX_GROUPS) {
+                return ESP_ZB_ZCL_STATUS_INSUFF_SPACE;
+            }
+            light->groups[light->group_count++] = frame->arg[0];
+            return ESP_ZB_ZCL_STATUS_SUCCESS;
+        }
+        break;
+    case ESP_ZB_ZCL_CLUSTER_ID_SCENES: {
+        const uint16_t group_id = frame->arg[0];
+        const uint8_t scene_id = (uint8_t)frame->arg[1];
+        if (group_id != 0 && !light_in_group(light, group_id)) {
+            return ESP_ZB_ZCL_STATUS_INVALID_FIELD;
+        }
+        sim_scene_t *scene = light_find_scene(light, group_id, scene_id);
+        if (frame->cmd_id == ESP_ZB_ZCL_CMD_SCENES_ADD_SCENE) {
+            if (!scene) {
+                if (light->scene_count == SIM_LIGHT_MAX_SCENES) {
+                    return ESP_ZB_ZCL_STATUS_INSUFF_SPACE;
+                }
+                scene = &light->scenes[light->scene_count++];
+            }
+            *scene = (sim_scene_t){
+                .group_id = group_id,
+                .scene_id = scene_id,
+                .fields = (uint8_t)frame->arg[2],
+                .on_off = frame->arg[3] != 0,
+                .level = (uint8_t)frame->arg[4],
+                .color_x = frame->arg[5],
+                .color_y = frame->arg[6],
+            };
+            return ESP_ZB_ZCL_STATUS_SUCCESS;
+        }
+        if (frame->cmd_id == ESP_ZB_ZCL_CMD_SCENES_RECALL_SCENE) {
+            if (!scene) {
+                return ESP_ZB_ZCL_STATUS_NOT_FOUND;
+            }
+            if (scene->fields & SIM_SCENE_ON_OFF) {
+                light->on_off = scene->on_off;
+            }
+            if (scene->fields & SIM_SCENE_LEVEL) {
+                light->level_rate = 0;
+                light->level = scene->level;
+            }
+            if (scene->fields & SIM_SCENE_COLOR_XY) {
+                light->color_x = scene->color_x;
+                light->color_y = scene->color_y;
+                light->color_mode = 1;
+            }
+            return ESP_ZB_ZCL_STATUS_SUCCESS;
+        }
+        break;
+    }
+    default:
+        break;
+    }
+    return ESP_ZB_ZCL_STATUS_UNSUP_CLUST_CMD;
+}
+
+static void light_receive(sim_light_t *light, const sim_frame_t *frame)
+{
+    light->frames_rx++;
+    light_level_update(light);
+    sim_frame_t resp = {
+        .light = frame->light,
+        .cluster = frame->cluster,
+        .cmd_id = frame->cmd_id,
+        .tsn = frame->tsn,
+        .src_endpoint = frame->src_endpoint,
+    };
+    if (frame->kind == SIM_FRAME_READ) {
+        resp.kind = SIM_FRAME_READ_RESP;
+        resp.count = frame->count;
+        for (unsigned i = 0; i < frame->count; ++i) {
+            resp.attrs[i].id = frame->attrs[i].id;
+            light_read_attr(light, frame->cluster, &resp.attrs[i]);
+        }
+    } else if (frame->kind == SIM_FRAME_CONFIG_REPORT) {
+        resp.kind = SIM_FRAME_CONFIG_REPORT_RESP;
+        resp.count = (uint8_t)light_configure_reporting(light, frame, &resp);
+        light_report_run(light);
+    } else if (frame->cluster == ESP_ZB_ZCL_CLUSTER_ID_GROUPS) {
+        resp.kind = SIM_FRAME_GROUP_RESP;
+        resp.status = light_apply(light, frame);
+        resp.arg[0] = frame->arg[0];
+    } else if (frame->cluster == ESP_ZB_ZCL_CLUSTER_ID_SCENES && frame->cmd_id == ESP_ZB_ZCL_CMD_SCENES_ADD_SCENE) {
+        resp.kind = SIM_FRAME_SCENE_RESP;
+        resp.status = light_apply(light, frame);
+        resp.arg[0] = frame->arg[0];
+        resp.arg[1] = frame->arg[1];
+    } else {
+        resp.kind = SIM_FRAME_DEFAULT_RESP;
+        resp.status = light_apply(light, frame);
+        if (resp.status == ESP_ZB_ZCL_STATUS_SUCCESS) {
+            int64_t now = sim_now_us();
+            light->cmds_applied++;
+            light->last_change_us = now;
+            if (light->first_change_us == 0) {
+                light->first_change_us = now;
+            }
+            if (light->mark_change_us == 0) {
+                light->mark_change_us = now;
+            }
+            if (light->report_count) {
+                light_report_run(light);
+            }
+        }
+    }
+    if (frame->groupcast) {
+        return;
+    }
+    light->frames_tx++;
+    int64_t delay_us = 0;
+    if (path_transmit(light->hops, true, &delay_us)) {
+        sim_event_t ev = {.type = SIM_EV_FRAME_TO_COORD};
+        ev.u.frame = resp;
+        event_post(&ev, delay_us);
+    }
+}
+
+/* ---- coordinator receive path ---- */
+
+static void cmd_info_fill(esp_zb_zcl_cmd_info_t *info, const sim_light_t *light, const sim_frame_t *frame)
+{
+    memset(info, 0, sizeof(*info));
+    info->status = ESP_ZB_ZCL_STATUS_SUCCESS;
+    info->header.tsn = frame->tsn;
+    info->header.rssi = light_rssi(light);
+    info->src_address.addr_type = ESP_ZB_ZCL_ADDR_TYPE_SHORT;
+    info->src_address.u.short_addr = light->short_addr;
+    info->dst_address = SIM_COORDINATOR_SHORT;
+    info->src_endpoint = light->endpoint;
+    info->dst_endpoint = frame->src_endpoint;
+    info->cluster = frame->cluster;
+    info->profile = ESP_ZB_AF_HA_PROFILE_ID;
+}
+
+static void coordinator_receive(const sim_frame_t *frame)
+{
+    const sim_light_t *light = &s_lights[frame->light];
+    if (!s_action_cb) {
+        return;
+    }
+    if (frame->kind == SIM_FRAME_DEFAULT_RESP) {
+        esp_zb_zcl_cmd_default_resp_message_t msg;
+        cmd_info_fill(&msg.info, light, frame);
+        msg.info.command = 0x0b;
+        msg.resp_to_cmd = frame->cmd_id;
+        msg.status_code = frame->status;
+        s_stats.default_responses++;
+        s_action_cb(ESP_ZB_CORE_CMD_DEFAULT_RESP_CB_ID, &msg);
+    } else if (frame->kind == SIM_FRAME_READ_RESP) {
+        /* esp-zigbee-lib builds the list on the heap and frees it after the callback */
+        esp_zb_zcl_cmd_read_attr_resp_message_t msg;
+        esp_zb_zcl_read_attr_resp_variable_t *variables =
+            frame->count ? sim_stack_malloc(sizeof(*variables) * frame->count) : NULL;
+        if (frame->count && !variables) {
+            return;
+        }
+        uint32_t values[SIM_MAX_FRAME_ATTRS];
+        cmd_info_fill(&msg.info, light, frame);
+        msg.info.command = 0x01;
+        msg.variables = variables;
+        for (unsigned i = 0; i < frame->count; ++i) {
+            const sim_attr_t *attr = &frame->attrs[i];
+            values[i] = attr->value;
+            variables[i].status = attr->status;
+            variables[i].attribute.id = attr->id;
+            variables[i].attribute.data.type = attr->type;
+            variables[i].attribute.data.size = attr->status == ESP_ZB_ZCL_STATUS_SUCCESS ?
+                                               (attr->type == ESP_ZB_ZCL_ATTR_TYPE_U16 ||
+                                                attr->type == ESP_ZB_ZCL_ATTR_TYPE_16BITMAP ? 2 : 1) : 0;
+            variables[i].attribute.data.value = attr->status == ESP_ZB_ZCL_STATUS_SUCCESS ? &values[i] : NULL;
+            variables[i].next = i + 1 < frame->count ? &variables[i + 1] : NULL;
+        }
+        s_action_cb(ESP_ZB_CORE_CMD_READ_ATTR_RESP_CB_ID, &msg);
+        sim_stack_free(variables);
+    } else if (frame->kind == SIM_FRAME_GROUP_RESP) {
+        esp_zb_zcl_groups_operate_group_resp_message_t msg;
+        cmd_info_fill(&msg.info, light, frame);
+        msg.info.status = frame->status;
+        msg.info.command = 0x00;
+        msg.group_id = frame->arg[0];
+        s_action_cb(ESP_ZB_CORE_CMD_OPERATE_GROUP_RESP_CB_ID, &msg);
+    } else if (frame->kind == SIM_FRAME_SCENE_RESP) {
+        esp_zb_zcl_scenes_operate_scene_resp_message_t msg;
+        cmd_info_fill(&msg.info, light, frame);
+        msg.info.status = frame->status;
+        msg.info.command = 0x00;
+        msg.group_id = frame->arg[0];
+        msg.scene_id = (uint8_t)frame->arg[1];
+        s_action_cb(ESP_ZB_CORE_CMD_OPERATE_SCENE_RESP_CB_ID, &msg);
+    } else if (frame->kind == SIM_FRAME_CONFIG_REPORT_RESP) {
+        /* all records accepted: a single success record, otherwise only the failed ones */
+        esp_zb_zcl_cmd_config_report_resp_message_t msg;
+        esp_zb_zcl_config_report_resp_variable_t variables[SIM_MAX_FRAME_ATTRS];
+        cmd_info_fill(&msg.info, light, frame);
+        msg.info.command = 0x07;
+        unsigned count = frame->count ? frame->count : 1;
+        for (unsigned i = 0; i < count; ++i) {
+            variables[i].status = frame->count ? frame->attrs[i].status : ESP_ZB_ZCL_STATUS_SUCCESS;
+            variables[i].direction = ESP_ZB_ZCL_REPORT_DIRECTION_SEND;
+            variables[i].attribute_id = frame->count ? frame->attrs[i].id : 0;
+            variables[i].next = i + 1 < count ? &variables[i + 1] : NULL;
+        }
+        msg.variables = variables;
+        s_action_cb(ESP_ZB_CORE_CMD_REPORT_CONFIG_RESP_CB_ID, &msg);
+    } else if (frame->kind == SIM_FRAME_REPORT) {
+        /* the stack hands reports over one attribute at a time */
+        for (unsigned i = 0; i < frame->count; ++i) {
+            const sim_attr_t *attr = &frame->attrs[i];
+            uint32_t value = attr->value;
+            esp_zb_zcl_report_attr_message_t msg = {
+                .status = ESP_ZB_ZCL_STATUS_SUCCESS,
+                .src_address = {.addr_type = ESP_ZB_ZCL_ADDR_TYPE_SHORT, .u.short_addr = light->short_addr},
+                .src_endpoint = light->endpoint,
+                .dst_endpoint = frame->src_endpoint,
+                .cluster = frame->cluster,
+                .attribute = {
+                    .id = attr->id,
+                    .data = {
+                        .type = attr->type,
+                        .size = attr->type == ESP_ZB_ZCL_ATTR_TYPE_U16 ? 2 : 1,
+                        .value = &value,
+                    },
+                },
+            };
+            s_action_cb(ESP_ZB_CORE_REPORT_ATTR_CB_ID, &msg);
+        }
+    }
+}
+
+/* ---- main loop ---- */
+
+static void dispatch(const sim_event_t *ev)
+{
+    switch (ev->type) {
+    case SIM_EV_ALARM:
+        ev->u.alarm.cb(ev->u.alarm.param);
+        break;
+    case SIM_EV_SIGNAL: {
+        struct {
+            uint32_t type;
+            uint8_t params[16];
+        } __attribute__((aligned(4))) buffer;
+        buffer.type = ev->u.signal.type;
+        memcpy(buffer.params, ev->u.signal.params, sizeof(buffer.params));
+        esp_zb_app_signal_t signal = {
+            .p_app_signal = &buffer.type,
+            .esp_err_status = ev->u.signal.status,
+        };
+        esp_zb_app_signal_handler(&signal);
+        break;
+    }
+    case SIM_EV_LIGHT_ANNCE: {
+        sim_light_t *light = &s_lights[ev->u.annce.light];
+        light->joined = true;
+        light->annce_us = sim_now_us();
+        esp_zb_zdo_signal_device_annce_params_t params = {
+            .device_short_addr = light->short_addr,
+            .capability = 0x8e,
+        };
+        memcpy(params.ieee_addr, light->ieee_addr, sizeof(esp_zb_ieee_addr_t));
+        signal_post(ESP_ZB_ZDO_SIGNAL_DEVICE_ANNCE, ESP_OK, &params, sizeof(params), 0);
+        break;
+    }
+    case SIM_EV_MATCH_DESC:
+        s_zdo_inflight -= ev->u.match.slot;
+        ev->u.match.cb(ev->u.match.status, ev->u.match.addr, ev->u.match.endpoint, ev->u.match.user_ctx);
+        break;
+    case SIM_EV_BIND:
+        s_zdo_inflight -= ev->u.bind.slot;
+        if (ev->u.bind.cb) {
+            ev->u.bind.cb(ev->u.bind.status, ev->u.bind.user_ctx);
+        }
+        break;
+    case SIM_EV_FRAME_TO_LIGHT:
+        light_receive(&s_lights[ev->u.frame.light], &ev->u.frame);
+        break;
+    case SIM_EV_FRAME_TO_COORD:
+        coordinator_receive(&ev->u.frame);
+        break;
+    case SIM_EV_REPORT: {
+        sim_light_t *light = &s_lights[ev->u.report.light];
+        /* superseded by an earlier check */
+        if (light->report_due_us == ev->u.report.due_us) {
+            light_report_run(light);
+        }
+        break;
+    }
+    case SIM_EV_SEND_STATUS:
+        if (s_send_status_cb) {
+            s_send_status_cb(ev->u.send_status);
+        }
+        break;
+    }
+}
+
+static void dispatch_locked(const sim_event_t *ev)
+{
+    esp_zb_lock_acquire(portMAX_DELAY);
+    state_lock();
+    dispatch(ev);
+    state_unlock();
+    esp_zb_lock_release();
+}
+
+void esp_zb_stack_main_loop(void)
+{
+    if (s_cfg.replay) {
+        s_cfg.replay();
+        return;
+    }
+    sim_event_t ev;
+    while (event_take(&ev)) {
+        dispatch_locked(&ev);
+    }
+}
+
+/* ---- replay ---- */
+
+bool sim_replay_step(int64_t until_us)
+{
+    pthread_mutex_lock(&s_ev_mutex);
+    if (s_event_count == 0 || s_events[0].due_us > until_us) {
+        pthread_mutex_unlock(&s_ev_mutex);
+        return false;
+    }
+    sim_event_t ev = s_events[0];
+    s_events[0] = s_events[--s_event_count];
+    event_sift_down(0);
+    pthread_mutex_unlock(&s_ev_mutex);
+    sim_clock_set(ev.due_us);
+    dispatch_locked(&ev);
+    return true;
+}
+
+void sim_replay_signal(esp_zb_app_signal_type_t type, esp_err_t status, const void *params, size_t len)
+{
+    sim_event_t ev = {.type = SIM_EV_SIGNAL};
+    ev.u.signal.type = type;
+    ev.u.signal.status = status;
+    if (params && len <= sizeof(ev.u.signal.params)) {
+        memcpy(ev.u.signal.params, params, len);
+    }
+    dispatch_locked(&ev);
+}
+
+void sim_replay_action(esp_zb_core_action_callback_id_t callback_id, const void *message)
+{
+    if (!s_action_cb) {
+        return;
+    }
+    esp_zb_lock_acquire(portMAX_DELAY);
+    state_lock();
+    s_action_cb(callback_id, message);
+    state_unlock();
+    esp_zb_lock_release();
+}
+
+/* Take the oldest pending request a match descriptor (addr) or bind (user_ctx) answer is for */
+static bool replay_pending_take(bool match, uint16_t addr, void *user_ctx, sim_replay_pending_t *out)
+{
+    state_lock();
+    for (unsigned i = 0; i < s_replay_pending_count; ++i) {
+        const sim_replay_pending_t *p = &s_replay_pending[i];
+        if (match ? (p->match_cb && p->addr == addr) : (p->bind_cb && p->user_ctx == user_ctx)) {
+            *out = *p;
+            memmove(&s_replay_pending[i], &s_replay_pending[i + 1],
+                    sizeof(s_replay_pending[0]) * (s_replay_pending_count - i - 1));
+            s_replay_pending_count--;
+            state_unlock();
+            return true;
+        }
+    }
+    state_unlock();
+    return false;
+}
+
+bool sim_replay_match_desc(esp_zb_zdp_status_t status, uint16_t addr, uint8_t endpoint)
+{
+    sim_replay_pending_t pending;
+    if (!replay_pending_take(true, addr, NULL, &pending)) {
+        return false;
+    }
+    sim_event_t ev = {.type = SIM_EV_MATCH_DESC};
+    ev.u.match.cb = pending.match_cb;
+    ev.u.match.user_ctx = pending.user_ctx;
+    ev.u.match.status = status;
+    ev.u.match.addr = addr;
+    ev.u.match.endpoint = endpoint;
+    dispatch_locked(&ev);
+    return true;
+}
+
+bool sim_replay_bind(esp_zb_zdp_status_t status, void *user_ctx)
+{
+    sim_replay_pending_t pending;
+    if (!replay_pending_take(false, 0, user_ctx, &pending)) {
+        return false;
+    }
+    sim_event_t ev = {.type = SIM_EV_BIND};
+    ev.u.bind.cb = pending.bind_cb;
+    ev.u.bind.user_ctx = user_ctx;
+    ev.u.bind.status = status;
+    dispatch_locked(&ev);
+    return true;
+}
+
+void sim_replay_send_status(const esp_zb_zcl_command_send_status_message_t *message)
+{
+    sim_event_t ev = {.type = SIM_EV_SEND_STATUS};
+    ev.u.send_status = *message;
+    dispatch_locked(&ev);
+}
+
+void sim_replay_hold_alarm(esp_zb_callback_t cb)
+{
+    if (s_replay_held_count < SIM_REPLAY_MAX_HELD) {
+        s_replay_held[s_replay_held_count++] = cb;
+    }
+}
+
+void sim_replay_alarm(esp_zb_callback_t cb, uint8_t param)
+{
+    sim_event_t ev = {.type = SIM_EV_ALARM};
+    ev.u.alarm.cb = cb;
+    ev.u.alarm.param = param;
+    dispatch_locked(&ev);
+}
+
+void sim_replay_address(uint16_t short_addr, const esp_zb_ieee_addr_t ieee_addr)
+{
+    state_lock();
+    unsigned i = 0;
+    while (i < s_replay_address_count && s_replay_addresses[i].short_addr != short_addr) {
+        ++i;
+    }
+    if (i < SIM_REPLAY_MAX_ADDRESSES) {
+        s_replay_addresses[i].short_addr = short_addr;
+        memcpy(s_replay_addresses[i].ieee_addr, ieee_addr, sizeof(esp_zb_ieee_addr_t));
+        if (i == s_replay_address_count) {
+            s_replay_address_count++;
+        }
+    }
+    state_unlock();
+}
+
+void sim_replay_set_tsn(uint8_t tsn)
+{
+    state_lock();
+    s_tsn = tsn;
+    state_unlock();
+}
+
+void sim_replay_set_factory_new(bool factory_new)
+{
+    state_lock();
+    s_factory_new = factory_new;
+    state_unlock();
+}
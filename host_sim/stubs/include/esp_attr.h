@@ -0,0 +1,11 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Host simulation stand-in for esp_attr.h
+ */
+
+#pragma once
+
+#define IRAM_ATTR
+#define DRAM_ATTR
+#define RTC_NOINIT_ATTR
@@ -0,0 +1,31 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Host simulation stand-in for esp_heap_caps.h
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MALLOC_CAP_8BIT     (1 << 2)
+#define MALLOC_CAP_DEFAULT  (1 << 12)
+
+/* the simulated heap does not fragment: the largest block is the free heap */
+size_t heap_caps_get_largest_free_block(uint32_t caps);
+
+/*
+ * With CONFIG_HEAP_USE_HOOKS the application defines these, and the heap
+ * calls them on every allocation and free of firmware code.
+ */
+void esp_heap_trace_alloc_hook(void *ptr, size_t size, uint32_t caps);
+void esp_heap_trace_free_hook(void *ptr);
+
+#ifdef __cplusplus
+}
+#endif
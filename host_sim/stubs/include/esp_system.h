@@ -0,0 +1,24 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Host simulation stand-in for esp_system.h
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* heap left to the application: a fixed heap less the firmware's live allocations */
+uint32_t esp_get_free_heap_size(void);
+uint32_t esp_get_minimum_free_heap_size(void);
+
+/* prints the details and aborts */
+void __attribute__((noreturn)) esp_system_abort(const char *details);
+
+#ifdef __cplusplus
+}
+#endif
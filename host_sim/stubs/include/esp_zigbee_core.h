@@ -0,0 +1,477 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Host simulation stand-in for esp_zigbee_core.h. The declarations mirror the
+ * esp-zigbee-lib 1.5 API used by the lamp controller; the implementation in
+ * host_sim/src/zb_sim.c models a coordinator and a set of simulated lights.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_zigbee_type.h"
+#include "freertos/FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* ---- Platform and network configuration ---- */
+
+typedef enum {
+    ZB_RADIO_MODE_NATIVE = 0x0,
+    ZB_RADIO_MODE_UART_RCP = 0x1,
+} esp_zb_radio_mode_t;
+
+typedef enum {
+    ZB_HOST_CONNECTION_MODE_NONE = 0x0,
+    ZB_HOST_CONNECTION_MODE_CLI_UART = 0x1,
+    ZB_HOST_CONNECTION_MODE_RCP_UART = 0x2,
+} esp_zb_host_connection_mode_t;
+
+typedef struct {
+    esp_zb_radio_mode_t radio_mode;
+} esp_zb_radio_config_t;
+
+typedef struct {
+    esp_zb_host_connection_mode_t host_connection_mode;
+} esp_zb_host_config_t;
+
+typedef struct {
+    esp_zb_radio_config_t radio_config;
+    esp_zb_host_config_t host_config;
+} esp_zb_platform_config_t;
+
+typedef struct {
+    uint8_t max_children;
+} esp_zb_zczr_cfg_t;
+
+typedef struct {
+    uint8_t ed_timeout;
+    uint32_t keep_alive;
+} esp_zb_zed_cfg_t;
+
+typedef struct esp_zb_cfg_s {
+    esp_zb_nwk_device_type_t esp_zb_role;
+    bool install_code_policy;
+    union {
+        esp_zb_zczr_cfg_t zczr_cfg;
+        esp_zb_zed_cfg_t zed_cfg;
+    } nwk_cfg;
+} esp_zb_cfg_t;
+
+/* ---- Application signals ---- */
+
+typedef enum {
+    ESP_ZB_ZDO_SIGNAL_DEFAULT_START = 0x00,
+    ESP_ZB_ZDO_SIGNAL_SKIP_STARTUP = 0x01,
+    ESP_ZB_ZDO_SIGNAL_DEVICE_ANNCE = 0x02,
+    ESP_ZB_ZDO_SIGNAL_LEAVE = 0x03,
+    ESP_ZB_ZDO_SIGNAL_ERROR = 0x04,
+    ESP_ZB_BDB_SIGNAL_DEVICE_FIRST_START = 0x05,
+    ESP_ZB_BDB_SIGNAL_DEVICE_REBOOT = 0x06,
+    ESP_ZB_BDB_SIGNAL_STEERING = 0x0a,
+    ESP_ZB_BDB_SIGNAL_FORMATION = 0x0b,
+    ESP_ZB_ZDO_SIGNAL_LEAVE_INDICATION = 0x10,
+    ESP_ZB_ZDO_SIGNAL_PRODUCTION_CONFIG_READY = 0x14,
+    ESP_ZB_NWK_SIGNAL_DEVICE_ASSOCIATED = 0x12,
+    ESP_ZB_ZDO_SIGNAL_DEVICE_AUTHORIZED = 0x2f,
+    ESP_ZB_ZDO_SIGNAL_DEVICE_UPDATE = 0x30,
+    ESP_ZB_NWK_SIGNAL_PERMIT_JOIN_STATUS = 0x36,
+} esp_zb_app_signal_type_t;
+
+typedef struct {
+    uint32_t *p_app_signal;
+    esp_err_t esp_err_status;
+} esp_zb_app_signal_t;
+
+typedef struct esp_zb_zdo_signal_device_annce_params_s {
+    uint16_t device_short_addr;
+    esp_zb_ieee_addr_t ieee_addr;
+    uint8_t capability;
+} esp_zb_zdo_signal_device_annce_params_t;
+
+typedef enum {
+    ESP_ZB_BDB_MODE_INITIALIZATION = 0,
+    ESP_ZB_BDB_MODE_TOUCHLINK_COMMISSIONING = 1,
+    ESP_ZB_BDB_MODE_NETWORK_STEERING = 2,
+    ESP_ZB_BDB_MODE_NETWORK_FORMATION = 4,
+} esp_zb_bdb_commissioning_mode_mask_t;
+
+/** Application signal handler, implemented by the application */
+void esp_zb_app_signal_handler(esp_zb_app_signal_t *signal_s);
+void *esp_zb_app_signal_get_params(uint32_t *signal_p);
+const char *esp_zb_zdo_signal_to_string(esp_zb_app_signal_type_t signal);
+
+/* ---- Data model ---- */
+
+typedef struct esp_zb_attribute_list_s esp_zb_attribute_list_t;
+typedef struct esp_zb_cluster_list_s esp_zb_cluster_list_t;
+typedef struct esp_zb_ep_list_s esp_zb_ep_list_t;
+
+typedef struct {
+    uint8_t endpoint;
+    uint16_t app_profile_id;
+    uint32_t app_device_id;
+    uint32_t app_device_version;
+} esp_zb_endpoint_config_t;
+
+esp_zb_ep_list_t *esp_zb_ep_list_create(void);
+esp_zb_cluster_list_t *esp_zb_zcl_cluster_list_create(void);
+esp_err_t esp_zb_ep_list_add_gateway_ep(esp_zb_ep_list_t *ep_list, esp_zb_cluster_list_t *cluster_list,
+                                        esp_zb_endpoint_config_t endpoint_config);
+esp_zb_cluster_list_t *esp_zb_ep_list_get_ep(const esp_zb_ep_list_t *ep_list, uint8_t ep_id);
+esp_zb_attribute_list_t *esp_zb_cluster_list_get_cluster(const esp_zb_cluster_list_t *cluster_list,
+                                                         uint16_t cluster_id, uint8_t role_mask);
+esp_zb_attribute_list_t *esp_zb_basic_cluster_create(void *basic_cfg);
+esp_zb_attribute_list_t *esp_zb_identify_cluster_create(void *identify_cfg);
+esp_err_t esp_zb_basic_cluster_add_attr(esp_zb_attribute_list_t *attr_list, uint16_t attr_id, void *value_p);
+esp_err_t esp_zb_cluster_list_add_basic_cluster(esp_zb_cluster_list_t *cluster_list,
+                                                esp_zb_attribute_list_t *attr_list, uint8_t role_mask);
+esp_err_t esp_zb_cluster_list_add_identify_cluster(esp_zb_cluster_list_t *cluster_list,
+                                                   esp_zb_attribute_list_t *attr_list, uint8_t role_mask);
+esp_err_t esp_zb_device_register(esp_zb_ep_list_t *ep_list);
+
+/* ---- Stack lifecycle ---- */
+
+typedef void (*esp_zb_callback_t)(uint8_t param);
+
+esp_err_t esp_zb_platform_config(esp_zb_platform_config_t *config);
+void esp_zb_init(esp_zb_cfg_t *nwk_cfg);
+esp_err_t esp_zb_start(bool autostart);
+void esp_zb_stack_main_loop(void);
+esp_err_t esp_zb_set_primary_network_channel_set(uint32_t channel_mask);
+bool esp_zb_lock_acquire(TickType_t block_ticks);
+void esp_zb_lock_release(void);
+void esp_zb_scheduler_alarm(esp_zb_callback_t cb, uint8_t param, uint32_t time);
+void esp_zb_scheduler_alarm_cancel(esp_zb_callback_t cb, uint8_t param);
+
+esp_err_t esp_zb_bdb_start_top_level_commissioning(uint8_t mode_mask);
+bool esp_zb_bdb_is_factory_new(void);
+esp_err_t esp_zb_bdb_open_network(uint8_t permit_duration);
+
+void esp_zb_get_long_address(esp_zb_ieee_addr_t addr);
+uint16_t esp_zb_get_short_address(void);
+uint16_t esp_zb_get_pan_id(void);
+uint8_t esp_zb_get_current_channel(void);
+esp_err_t esp_zb_ieee_address_by_short(uint16_t short_addr, uint8_t *ieee_addr);
+uint16_t esp_zb_address_short_by_ieee(esp_zb_ieee_addr_t ieee_addr);
+void esp_zb_set_node_descriptor_manufacturer_code(uint16_t manufacturer_code);
+
+typedef uint16_t esp_zb_nwk_info_iterator_t;
+
+#define ESP_ZB_NWK_INFO_ITERATOR_INIT 0
+
+typedef struct {
+    esp_zb_ieee_addr_t ieee_addr;
+    uint16_t short_addr;
+    uint8_t device_type;
+    uint8_t depth;
+    uint8_t rx_on_when_idle;
+    uint8_t relationship;
+    uint8_t lqi;
+    int8_t rssi;
+    uint8_t outgoing_cost;
+    uint8_t age;
+    uint32_t device_timeout;
+    uint32_t timeout_counter;
+} esp_zb_nwk_neighbor_info_t;
+
+/** ESP_ERR_NOT_FOUND past the last entry of the neighbor table */
+esp_err_t esp_zb_nwk_get_next_neighbor(esp_zb_nwk_info_iterator_t *iterator, esp_zb_nwk_neighbor_info_t *nbr_info);
+
+/* ---- ZDO ---- */
+
+typedef struct {
+    uint16_t dst_nwk_addr;
+    uint16_t addr_of_interest;
+    uint16_t profile_id;
+    uint8_t num_in_clusters;
+    uint8_t num_out_clusters;
+    uint16_t *cluster_list;
+} esp_zb_zdo_match_desc_req_param_t;
+
+typedef struct {
+    esp_zb_ieee_addr_t src_address;
+    uint8_t src_endp;
+    uint16_t cluster_id;
+    uint8_t dst_addr_mode;
+    esp_zb_addr_u dst_address_u;
+    uint8_t dst_endp;
+    uint16_t req_dst_addr;
+} esp_zb_zdo_bind_req_param_t;
+
+typedef void (*esp_zb_zdo_match_desc_callback_t)(esp_zb_zdp_status_t zdo_status, uint16_t addr, uint8_t endpoint,
+                                                 void *user_ctx);
+typedef void (*esp_zb_zdo_bind_callback_t)(esp_zb_zdp_status_t zdo_status, void *user_ctx);
+
+void esp_zb_zdo_find_color_dimmable_light(esp_zb_zdo_match_desc_req_param_t *cmd_req,
+                                          esp_zb_zdo_match_desc_callback_t user_cb, void *user_ctx);
+void esp_zb_zdo_device_bind_req(esp_zb_zdo_bind_req_param_t *cmd_req, esp_zb_zdo_bind_callback_t user_cb,
+                                void *user_ctx);
+
+/* ---- ZCL commands ---- */
+
+typedef struct esp_zb_zcl_basic_cmd_s {
+    esp_zb_addr_u dst_addr_u;
+    uint8_t dst_endpoint;
+    uint8_t src_endpoint;
+} esp_zb_zcl_basic_cmd_t;
+
+typedef struct esp_zb_zcl_move_to_level_cmd_s {
+    esp_zb_zcl_basic_cmd_t zcl_basic_cmd;
+    esp_zb_zcl_address_mode_t address_mode;
+    uint8_t level;
+    uint16_t transition_time;
+} esp_zb_zcl_move_to_level_cmd_t;
+
+typedef struct esp_zb_zcl_level_move_cmd_s {
+    esp_zb_zcl_basic_cmd_t zcl_basic_cmd;
+    esp_zb_zcl_address_mode_t address_mode;
+    uint8_t move_mode;              /* 0 up, 1 down */
+    uint8_t rate;                   /* units per second */
+} esp_zb_zcl_level_move_cmd_t;
+
+typedef struct esp_zb_zcl_level_step_cmd_s {
+    esp_zb_zcl_basic_cmd_t zcl_basic_cmd;
+    esp_zb_zcl_address_mode_t address_mode;
+    uint8_t step_mode;              /* 0 up, 1 down */
+    uint8_t step_size;
+    uint16_t transition_time;
+} esp_zb_zcl_level_step_cmd_t;
+
+typedef struct esp_zb_zcl_level_stop_cmd_s {
+    esp_zb_zcl_basic_cmd_t zcl_basic_cmd;
+    esp_zb_zcl_address_mode_t address_mode;
+} esp_zb_zcl_level_stop_cmd_t;
+
+typedef struct esp_zb_zcl_color_move_to_color_cmd_s {
+    esp_zb_zcl_basic_cmd_t zcl_basic_cmd;
+    esp_zb_zcl_address_mode_t address_mode;
+    uint16_t color_x;
+    uint16_t color_y;
+    uint16_t transition_time;
+} esp_zb_zcl_color_move_to_color_cmd_t;
+
+typedef struct esp_zb_color_move_to_hue_saturation_cmd_s {
+    esp_zb_zcl_basic_cmd_t zcl_basic_cmd;
+    esp_zb_zcl_address_mode_t address_mode;
+    uint8_t hue;
+    uint8_t saturation;
+    uint16_t transition_time;
+} esp_zb_color_move_to_hue_saturation_cmd_t;
+
+typedef struct esp_zb_zcl_color_enhanced_move_to_hue_cmd_s {
+    esp_zb_zcl_basic_cmd_t zcl_basic_cmd;
+    esp_zb_zcl_address_mode_t address_mode;
+    uint16_t enhanced_hue;
+    uint8_t direction;
+    uint16_t transition_time;
+} esp_zb_zcl_color_enhanced_move_to_hue_cmd_t;
+
+typedef struct esp_zb_zcl_color_move_to_color_temperature_cmd_s {
+    esp_zb_zcl_basic_cmd_t zcl_basic_cmd;
+    esp_zb_zcl_address_mode_t address_mode;
+    uint16_t color_temperature;
+    uint16_t transition_time;
+} esp_zb_zcl_color_move_to_color_temperature_cmd_t;
+
+typedef struct esp_zb_zcl_read_attr_cmd_s {
+    esp_zb_zcl_basic_cmd_t zcl_basic_cmd;
+    esp_zb_zcl_address_mode_t address_mode;
+    uint16_t clusterID;
+    uint8_t attr_number;
+    uint16_t *attr_field;
+} esp_zb_zcl_read_attr_cmd_t;
+
+typedef enum {
+    ESP_ZB_ZCL_REPORT_DIRECTION_SEND = 0x00,
+    ESP_ZB_ZCL_REPORT_DIRECTION_RECV = 0x01,
+} esp_zb_zcl_report_direction_t;
+
+typedef struct esp_zb_zcl_config_report_record_s {
+    esp_zb_zcl_report_direction_t direction;
+    uint16_t attributeID;
+    uint8_t attrType;
+    uint16_t min_interval;          /* seconds */
+    uint16_t max_interval;          /* seconds, 0xffff disables periodic reports */
+    void *reportable_change;        /* attribute typed, NULL for discrete types */
+} esp_zb_zcl_config_report_record_t;
+
+typedef struct esp_zb_zcl_config_report_cmd_s {
+    esp_zb_zcl_basic_cmd_t zcl_basic_cmd;
+    esp_zb_zcl_address_mode_t address_mode;
+    uint16_t clusterID;
+    uint8_t record_number;
+    esp_zb_zcl_config_report_record_t *record_field;
+} esp_zb_zcl_config_report_cmd_t;
+
+typedef struct esp_zb_zcl_groups_add_group_cmd_s {
+    esp_zb_zcl_basic_cmd_t zcl_basic_cmd;
+    esp_zb_zcl_address_mode_t address_mode;
+    uint16_t group_id;
+} esp_zb_zcl_groups_add_group_cmd_t;
+
+typedef struct esp_zb_zcl_scenes_extension_field_s {
+    uint16_t cluster_id;
+    uint8_t length;
+    uint8_t *extension_field_attribute_value_list;
+    struct esp_zb_zcl_scenes_extension_field_s *next;
+} esp_zb_zcl_scenes_extension_field_t;
+
+typedef struct esp_zb_zcl_scenes_add_scene_cmd_s {
+    esp_zb_zcl_basic_cmd_t zcl_basic_cmd;
+    esp_zb_zcl_address_mode_t address_mode;
+    uint16_t group_id;
+    uint8_t scene_id;
+    uint16_t transition_time;
+    esp_zb_zcl_scenes_extension_field_t *extension_field;
+} esp_zb_zcl_scenes_add_scene_cmd_t;
+
+typedef struct esp_zb_zcl_scenes_recall_scene_cmd_s {
+    esp_zb_zcl_basic_cmd_t zcl_basic_cmd;
+    esp_zb_zcl_address_mode_t address_mode;
+    uint16_t group_id;
+    uint8_t scene_id;
+} esp_zb_zcl_scenes_recall_scene_cmd_t;
+
+/* All command requests return the ZCL transaction sequence number */
+uint8_t esp_zb_zcl_level_move_to_level_cmd_req(esp_zb_zcl_move_to_level_cmd_t *cmd_req);
+uint8_t esp_zb_zcl_level_move_to_level_with_onoff_cmd_req(esp_zb_zcl_move_to_level_cmd_t *cmd_req);
+uint8_t esp_zb_zcl_level_move_cmd_req(esp_zb_zcl_level_move_cmd_t *cmd_req);
+uint8_t esp_zb_zcl_level_move_with_onoff_cmd_req(esp_zb_zcl_level_move_cmd_t *cmd_req);
+uint8_t esp_zb_zcl_level_step_cmd_req(esp_zb_zcl_level_step_cmd_t *cmd_req);
+uint8_t esp_zb_zcl_level_step_with_onoff_cmd_req(esp_zb_zcl_level_step_cmd_t *cmd_req);
+uint8_t esp_zb_zcl_level_stop_cmd_req(esp_zb_zcl_level_stop_cmd_t *cmd_req);
+uint8_t esp_zb_zcl_color_move_to_color_cmd_req(esp_zb_zcl_color_move_to_color_cmd_t *cmd_req);
+uint8_t esp_zb_zcl_color_move_to_hue_and_saturation_cmd_req(esp_zb_color_move_to_hue_saturation_cmd_t *cmd_req);
+uint8_t esp_zb_zcl_color_enhanced_move_to_hue_cmd_req(esp_zb_zcl_color_enhanced_move_to_hue_cmd_t *cmd_req);
+uint8_t esp_zb_zcl_color_move_to_color_temperature_cmd_req(esp_zb_zcl_color_move_to_color_temperature_cmd_t *cmd_req);
+uint8_t esp_zb_zcl_read_attr_cmd_req(esp_zb_zcl_read_attr_cmd_t *cmd_req);
+uint8_t esp_zb_zcl_config_report_cmd_req(esp_zb_zcl_config_report_cmd_t *cmd_req);
+uint8_t esp_zb_zcl_groups_add_group_cmd_req(esp_zb_zcl_groups_add_group_cmd_t *cmd_req);
+uint8_t esp_zb_zcl_scenes_add_scene_cmd_req(esp_zb_zcl_scenes_add_scene_cmd_t *cmd_req);
+uint8_t esp_zb_zcl_scenes_recall_scene_cmd_req(esp_zb_zcl_scenes_recall_scene_cmd_t *cmd_req);
+
+/* ---- Core action callbacks ---- */
+
+typedef enum esp_zb_core_action_callback_id_s {
+    ESP_ZB_CORE_SET_ATTR_VALUE_CB_ID = 0x0000,
+    ESP_ZB_CORE_SCENES_STORE_SCENE_CB_ID = 0x0001,
+    ESP_ZB_CORE_SCENES_RECALL_SCENE_CB_ID = 0x0002,
+    ESP_ZB_CORE_CMD_READ_ATTR_RESP_CB_ID = 0x1000,
+    ESP_ZB_CORE_CMD_WRITE_ATTR_RESP_CB_ID = 0x1001,
+    ESP_ZB_CORE_CMD_REPORT_CONFIG_RESP_CB_ID = 0x1002,
+    ESP_ZB_CORE_CMD_READ_REPORT_CFG_RESP_CB_ID = 0x1003,
+    ESP_ZB_CORE_CMD_DISC_ATTR_RESP_CB_ID = 0x1004,
+    ESP_ZB_CORE_CMD_DEFAULT_RESP_CB_ID = 0x1005,
+    ESP_ZB_CORE_CMD_OPERATE_GROUP_RESP_CB_ID = 0x1010,
+    ESP_ZB_CORE_CMD_VIEW_GROUP_RESP_CB_ID = 0x1011,
+    ESP_ZB_CORE_CMD_GET_GROUP_MEMBERSHIP_RESP_CB_ID = 0x1012,
+    ESP_ZB_CORE_CMD_OPERATE_SCENE_RESP_CB_ID = 0x1020,
+    ESP_ZB_CORE_CMD_VIEW_SCENE_RESP_CB_ID = 0x1021,
+    ESP_ZB_CORE_CMD_GET_SCENE_MEMBERSHIP_RESP_CB_ID = 0x1022,
+    ESP_ZB_CORE_REPORT_ATTR_CB_ID = 0x2000,
+} esp_zb_core_action_callback_id_t;
+
+typedef esp_err_t (*esp_zb_core_action_callback_t)(esp_zb_core_action_callback_id_t callback_id,
+                                                   const void *message);
+
+void esp_zb_core_action_handler_register(esp_zb_core_action_callback_t cb);
+
+typedef struct esp_zb_zcl_command_send_status_message_s {
+    uint8_t tsn;
+    esp_zb_zcl_addr_t dst_addr;
+    uint8_t dst_endpoint;
+    uint8_t src_endpoint;
+    esp_err_t status;           /* ESP_OK once a unicast is acknowledged */
+} esp_zb_zcl_command_send_status_message_t;
+
+typedef void (*esp_zb_zcl_command_send_status_callback_t)(esp_zb_zcl_command_send_status_message_t message);
+
+void esp_zb_zcl_command_send_status_handler_register(esp_zb_zcl_command_send_status_callback_t cb);
+
+typedef struct esp_zb_zcl_attribute_data_s {
+    esp_zb_zcl_attr_type_t type;
+    uint16_t size;
+    void *value;
+} esp_zb_zcl_attribute_data_t;
+
+typedef struct esp_zb_zcl_attribute_s {
+    uint16_t id;
+    esp_zb_zcl_attribute_data_t data;
+} esp_zb_zcl_attribute_t;
+
+typedef struct esp_zb_zcl_frame_header_s {
+    uint8_t fc;
+    uint16_t manuf_code;
+    uint8_t tsn;
+    int8_t rssi;
+} esp_zb_zcl_frame_header_t;
+
+typedef struct esp_zb_zcl_cmd_info_s {
+    esp_zb_zcl_status_t status;
+    esp_zb_zcl_frame_header_t header;
+    esp_zb_zcl_addr_t src_address;
+    uint16_t dst_address;
+    uint8_t src_endpoint;
+    uint8_t dst_endpoint;
+    uint16_t cluster;
+    uint16_t profile;
+    uint8_t command;
+} esp_zb_zcl_cmd_info_t;
+
+typedef struct esp_zb_zcl_report_attr_message_s {
+    esp_zb_zcl_status_t status;
+    esp_zb_zcl_addr_t src_address;
+    uint8_t src_endpoint;
+    uint8_t dst_endpoint;
+    uint16_t cluster;
+    esp_zb_zcl_attribute_t attribute;
+} esp_zb_zcl_report_attr_message_t;
+
+typedef struct esp_zb_zcl_read_attr_resp_variable_s {
+    esp_zb_zcl_status_t status;
+    esp_zb_zcl_attribute_t attribute;
+    struct esp_zb_zcl_read_attr_resp_variable_s *next;
+} esp_zb_zcl_read_attr_resp_variable_t;
+
+typedef struct esp_zb_zcl_cmd_read_attr_resp_message_s {
+    esp_zb_zcl_cmd_info_t info;
+    esp_zb_zcl_read_attr_resp_variable_t *variables;
+} esp_zb_zcl_cmd_read_attr_resp_message_t;
+
+typedef struct esp_zb_zcl_config_report_resp_variable_s {
+    esp_zb_zcl_status_t status;
+    uint8_t direction;
+    uint16_t attribute_id;
+    struct esp_zb_zcl_config_report_resp_variable_s *next;
+} esp_zb_zcl_config_report_resp_variable_t;
+
+typedef struct esp_zb_zcl_cmd_config_report_resp_message_s {
+    esp_zb_zcl_cmd_info_t info;
+    esp_zb_zcl_config_report_resp_variable_t *variables;
+} esp_zb_zcl_cmd_config_report_resp_message_t;
+
+typedef struct esp_zb_zcl_cmd_default_resp_message_s {
+    esp_zb_zcl_cmd_info_t info;
+    uint8_t resp_to_cmd;
+    esp_zb_zcl_status_t status_code;
+} esp_zb_zcl_cmd_default_resp_message_t;
+
+typedef struct esp_zb_zcl_groups_operate_group_resp_message_s {
+    esp_zb_zcl_cmd_info_t info;     /* info.status carries the response status */
+    uint16_t group_id;
+} esp_zb_zcl_groups_operate_group_resp_message_t;
+
+typedef struct esp_zb_zcl_scenes_operate_scene_resp_message_s {
+    esp_zb_zcl_cmd_info_t info;     /* info.status carries the response status */
+    uint16_t group_id;
+    uint8_t scene_id;
+} esp_zb_zcl_scenes_operate_scene_resp_message_t;
+
+#ifdef __cplusplus
+}
+#endif
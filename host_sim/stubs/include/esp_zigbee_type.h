@@ -0,0 +1,238 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Host simulation stand-in for the esp-zigbee-lib type definitions. Only the
+ * subset used by the lamp controller is declared; names and layouts follow
+ * esp-zigbee-lib 1.5.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef uint8_t esp_zb_ieee_addr_t[8];
+
+typedef union {
+    uint16_t addr_short;
+    esp_zb_ieee_addr_t addr_long;
+} esp_zb_addr_u;
+
+typedef enum {
+    ESP_ZB_DEVICE_TYPE_COORDINATOR = 0x0,
+    ESP_ZB_DEVICE_TYPE_ROUTER = 0x1,
+    ESP_ZB_DEVICE_TYPE_ED = 0x2,
+    ESP_ZB_DEVICE_TYPE_NONE = 0x3,
+} esp_zb_nwk_device_type_t;
+
+typedef enum {
+    ESP_ZB_APS_ADDR_MODE_DST_ADDR_ENDP_NOT_PRESENT = 0x0,
+    ESP_ZB_APS_ADDR_MODE_16_GROUP_ENDP_NOT_PRESENT = 0x1,
+    ESP_ZB_APS_ADDR_MODE_16_ENDP_PRESENT = 0x2,
+    ESP_ZB_APS_ADDR_MODE_64_ENDP_PRESENT = 0x3,
+} esp_zb_aps_address_mode_t;
+
+typedef esp_zb_aps_address_mode_t esp_zb_zcl_address_mode_t;
+
+typedef enum {
+    ESP_ZB_ZCL_ADDR_TYPE_SHORT = 0,
+    ESP_ZB_ZCL_ADDR_TYPE_IEEE_GPD = 1,
+    ESP_ZB_ZCL_ADDR_TYPE_SRC_ID_GPD = 2,
+    ESP_ZB_ZCL_ADDR_TYPE_IEEE = 3,
+} esp_zb_zcl_address_type_t;
+
+typedef struct esp_zb_zcl_addr_s {
+    esp_zb_zcl_address_type_t addr_type;
+    union {
+        uint16_t short_addr;
+        uint32_t src_id;
+        esp_zb_ieee_addr_t ieee_addr;
+    } u;
+} esp_zb_zcl_addr_t;
+
+typedef enum {
+    ESP_ZB_ZCL_CLUSTER_SERVER_ROLE = 0x01,
+    ESP_ZB_ZCL_CLUSTER_CLIENT_ROLE = 0x02,
+} esp_zb_zcl_cluster_role_t;
+
+typedef enum {
+    ESP_ZB_ZCL_CLUSTER_ID_BASIC = 0x0000U,
+    ESP_ZB_ZCL_CLUSTER_ID_POWER_CONFIG = 0x0001U,
+    ESP_ZB_ZCL_CLUSTER_ID_IDENTIFY = 0x0003U,
+    ESP_ZB_ZCL_CLUSTER_ID_GROUPS = 0x0004U,
+    ESP_ZB_ZCL_CLUSTER_ID_SCENES = 0x0005U,
+    ESP_ZB_ZCL_CLUSTER_ID_ON_OFF = 0x0006U,
+    ESP_ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL = 0x0008U,
+    ESP_ZB_ZCL_CLUSTER_ID_OTA_UPGRADE = 0x0019U,
+    ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL = 0x0300U,
+} esp_zb_zcl_cluster_id_t;
+
+typedef enum {
+    ESP_ZB_ZCL_STATUS_SUCCESS = 0x00,
+    ESP_ZB_ZCL_STATUS_FAIL = 0x01,
+    ESP_ZB_ZCL_STATUS_NOT_AUTHORIZED = 0x7E,
+    ESP_ZB_ZCL_STATUS_MALFORMED_CMD = 0x80,
+    ESP_ZB_ZCL_STATUS_UNSUP_CLUST_CMD = 0x81,
+    ESP_ZB_ZCL_STATUS_UNSUP_GEN_CMD = 0x82,
+    ESP_ZB_ZCL_STATUS_INVALID_FIELD = 0x85,
+    ESP_ZB_ZCL_STATUS_UNSUP_ATTRIB = 0x86,
+    ESP_ZB_ZCL_STATUS_INVALID_VALUE = 0x87,
+    ESP_ZB_ZCL_STATUS_READ_ONLY = 0x88,
+    ESP_ZB_ZCL_STATUS_INSUFF_SPACE = 0x89,
+    ESP_ZB_ZCL_STATUS_DUPE_EXISTS = 0x8A,
+    ESP_ZB_ZCL_STATUS_NOT_FOUND = 0x8B,
+    ESP_ZB_ZCL_STATUS_UNREPORTABLE_ATTRIB = 0x8C,
+    ESP_ZB_ZCL_STATUS_INVALID_TYPE = 0x8D,
+    ESP_ZB_ZCL_STATUS_TIMEOUT = 0x94,
+    ESP_ZB_ZCL_STATUS_UNSUP_CLUST = 0xC3,
+} esp_zb_zcl_status_t;
+
+typedef enum {
+    ESP_ZB_ZDP_STATUS_SUCCESS = 0x00,
+    ESP_ZB_ZDP_STATUS_INV_REQUESTTYPE = 0x80,
+    ESP_ZB_ZDP_STATUS_DEVICE_NOT_FOUND = 0x81,
+    ESP_ZB_ZDP_STATUS_INVALID_EP = 0x82,
+    ESP_ZB_ZDP_STATUS_NOT_ACTIVE = 0x83,
+    ESP_ZB_ZDP_STATUS_NOT_SUPPORTED = 0x84,
+    ESP_ZB_ZDP_STATUS_TIMEOUT = 0x85,
+    ESP_ZB_ZDP_STATUS_NO_MATCH = 0x86,
+    ESP_ZB_ZDP_STATUS_NO_ENTRY = 0x88,
+    ESP_ZB_ZDP_STATUS_NO_DESCRIPTOR = 0x89,
+    ESP_ZB_ZDP_STATUS_INSUFFICIENT_SPACE = 0x8a,
+    ESP_ZB_ZDP_STATUS_NOT_PERMITTED = 0x8b,
+    ESP_ZB_ZDP_STATUS_TABLE_FULL = 0x8c,
+    ESP_ZB_ZDP_STATUS_NOT_AUTHORIZED = 0x8d,
+    ESP_ZB_ZDP_STATUS_BINDING_TABLE_FULL = 0x8e,
+} esp_zb_zdp_status_t;
+
+typedef enum {
+    ESP_ZB_ZCL_ATTR_TYPE_NULL = 0x00U,
+    ESP_ZB_ZCL_ATTR_TYPE_8BIT = 0x08U,
+    ESP_ZB_ZCL_ATTR_TYPE_16BIT = 0x09U,
+    ESP_ZB_ZCL_ATTR_TYPE_24BIT = 0x0aU,
+    ESP_ZB_ZCL_ATTR_TYPE_32BIT = 0x0bU,
+    ESP_ZB_ZCL_ATTR_TYPE_40BIT = 0x0cU,
+    ESP_ZB_ZCL_ATTR_TYPE_48BIT = 0x0dU,
+    ESP_ZB_ZCL_ATTR_TYPE_56BIT = 0x0eU,
+    ESP_ZB_ZCL_ATTR_TYPE_64BIT = 0x0fU,
+    ESP_ZB_ZCL_ATTR_TYPE_BOOL = 0x10U,
+    ESP_ZB_ZCL_ATTR_TYPE_8BITMAP = 0x18U,
+    ESP_ZB_ZCL_ATTR_TYPE_16BITMAP = 0x19U,
+    ESP_ZB_ZCL_ATTR_TYPE_24BITMAP = 0x1aU,
+    ESP_ZB_ZCL_ATTR_TYPE_32BITMAP = 0x1bU,
+    ESP_ZB_ZCL_ATTR_TYPE_40BITMAP = 0x1cU,
+    ESP_ZB_ZCL_ATTR_TYPE_48BITMAP = 0x1dU,
+    ESP_ZB_ZCL_ATTR_TYPE_56BITMAP = 0x1eU,
+    ESP_ZB_ZCL_ATTR_TYPE_64BITMAP = 0x1fU,
+    ESP_ZB_ZCL_ATTR_TYPE_U8 = 0x20U,
+    ESP_ZB_ZCL_ATTR_TYPE_U16 = 0x21U,
+    ESP_ZB_ZCL_ATTR_TYPE_U24 = 0x22U,
+    ESP_ZB_ZCL_ATTR_TYPE_U32 = 0x23U,
+    ESP_ZB_ZCL_ATTR_TYPE_U40 = 0x24U,
+    ESP_ZB_ZCL_ATTR_TYPE_U48 = 0x25U,
+    ESP_ZB_ZCL_ATTR_TYPE_U56 = 0x26U,
+    ESP_ZB_ZCL_ATTR_TYPE_U64 = 0x27U,
+    ESP_ZB_ZCL_ATTR_TYPE_S8 = 0x28U,
+    ESP_ZB_ZCL_ATTR_TYPE_S16 = 0x29U,
+    ESP_ZB_ZCL_ATTR_TYPE_S24 = 0x2aU,
+    ESP_ZB_ZCL_ATTR_TYPE_S32 = 0x2bU,
+    ESP_ZB_ZCL_ATTR_TYPE_S40 = 0x2cU,
+    ESP_ZB_ZCL_ATTR_TYPE_S48 = 0x2dU,
+    ESP_ZB_ZCL_ATTR_TYPE_S56 = 0x2eU,
+    ESP_ZB_ZCL_ATTR_TYPE_S64 = 0x2fU,
+    ESP_ZB_ZCL_ATTR_TYPE_8BIT_ENUM = 0x30U,
+    ESP_ZB_ZCL_ATTR_TYPE_16BIT_ENUM = 0x31U,
+    ESP_ZB_ZCL_ATTR_TYPE_SEMI = 0x38U,
+    ESP_ZB_ZCL_ATTR_TYPE_SINGLE = 0x39U,
+    ESP_ZB_ZCL_ATTR_TYPE_DOUBLE = 0x3aU,
+    ESP_ZB_ZCL_ATTR_TYPE_OCTET_STRING = 0x41U,
+    ESP_ZB_ZCL_ATTR_TYPE_CHAR_STRING = 0x42U,
+    ESP_ZB_ZCL_ATTR_TYPE_LONG_OCTET_STRING = 0x43U,
+    ESP_ZB_ZCL_ATTR_TYPE_LONG_CHAR_STRING = 0x44U,
+    ESP_ZB_ZCL_ATTR_TYPE_ARRAY = 0x48U,
+    ESP_ZB_ZCL_ATTR_TYPE_16BIT_ARRAY = 0x49U,
+    ESP_ZB_ZCL_ATTR_TYPE_32BIT_ARRAY = 0x4aU,
+    ESP_ZB_ZCL_ATTR_TYPE_STRUCTURE = 0x4cU,
+    ESP_ZB_ZCL_ATTR_TYPE_SET = 0x50U,
+    ESP_ZB_ZCL_ATTR_TYPE_BAG = 0x51U,
+    ESP_ZB_ZCL_ATTR_TYPE_TIME_OF_DAY = 0xe0U,
+    ESP_ZB_ZCL_ATTR_TYPE_DATE = 0xe1U,
+    ESP_ZB_ZCL_ATTR_TYPE_UTC_TIME = 0xe2U,
+    ESP_ZB_ZCL_ATTR_TYPE_CLUSTER_ID = 0xe8U,
+    ESP_ZB_ZCL_ATTR_TYPE_ATTRIBUTE_ID = 0xe9U,
+    ESP_ZB_ZCL_ATTR_TYPE_BACNET_OID = 0xeaU,
+    ESP_ZB_ZCL_ATTR_TYPE_IEEE_ADDR = 0xf0U,
+    ESP_ZB_ZCL_ATTR_TYPE_128_BIT_KEY = 0xf1U,
+    ESP_ZB_ZCL_ATTR_TYPE_INVALID = 0xffU,
+} esp_zb_zcl_attr_type_t;
+
+/* Basic cluster */
+#define ESP_ZB_ZCL_ATTR_BASIC_ZCL_VERSION_ID                    0x0000U
+#define ESP_ZB_ZCL_ATTR_BASIC_MANUFACTURER_NAME_ID              0x0004U
+#define ESP_ZB_ZCL_ATTR_BASIC_MODEL_IDENTIFIER_ID               0x0005U
+
+/* On/Off cluster */
+#define ESP_ZB_ZCL_ATTR_ON_OFF_ON_OFF_ID                        0x0000U
+
+/* Level control cluster */
+#define ESP_ZB_ZCL_ATTR_LEVEL_CONTROL_CURRENT_LEVEL_ID          0x0000U
+#define ESP_ZB_ZCL_ATTR_LEVEL_CONTROL_REMAINING_TIME_ID         0x0001U
+
+/* Color control cluster */
+#define ESP_ZB_ZCL_ATTR_COLOR_CONTROL_CURRENT_HUE_ID            0x0000U
+#define ESP_ZB_ZCL_ATTR_COLOR_CONTROL_CURRENT_SATURATION_ID     0x0001U
+#define ESP_ZB_ZCL_ATTR_COLOR_CONTROL_REMAINING_TIME_ID         0x0002U
+#define ESP_ZB_ZCL_ATTR_COLOR_CONTROL_CURRENT_X_ID              0x0003U
+#define ESP_ZB_ZCL_ATTR_COLOR_CONTROL_CURRENT_Y_ID              0x0004U
+#define ESP_ZB_ZCL_ATTR_COLOR_CONTROL_COLOR_TEMPERATURE_ID      0x0007U
+#define ESP_ZB_ZCL_ATTR_COLOR_CONTROL_COLOR_MODE_ID             0x0008U
+#define ESP_ZB_ZCL_ATTR_COLOR_CONTROL_ENHANCED_CURRENT_HUE_ID   0x4000U
+#define ESP_ZB_ZCL_ATTR_COLOR_CONTROL_ENHANCED_COLOR_MODE_ID    0x4001U
+#define ESP_ZB_ZCL_ATTR_COLOR_CONTROL_COLOR_LOOP_ACTIVE_ID      0x4002U
+#define ESP_ZB_ZCL_ATTR_COLOR_CONTROL_COLOR_CAPABILITIES_ID     0x400aU
+
+/* Scenes cluster */
+#define ESP_ZB_ZCL_ATTR_SCENES_SCENE_COUNT_ID                   0x0000U
+#define ESP_ZB_ZCL_ATTR_SCENES_CURRENT_SCENE_ID                 0x0001U
+#define ESP_ZB_ZCL_ATTR_SCENES_CURRENT_GROUP_ID                 0x0002U
+#define ESP_ZB_ZCL_ATTR_SCENES_SCENE_VALID_ID                   0x0003U
+
+/* OTA upgrade cluster */
+#define ESP_ZB_ZCL_ATTR_OTA_UPGRADE_FILE_VERSION_ID             0x0002U
+
+/* ZCL command identifiers, used as resp_to_cmd in default responses */
+#define ESP_ZB_ZCL_CMD_CONFIG_REPORT                            0x06U
+#define ESP_ZB_ZCL_CMD_ON_OFF_OFF_ID                            0x00U
+#define ESP_ZB_ZCL_CMD_ON_OFF_ON_ID                             0x01U
+#define ESP_ZB_ZCL_CMD_ON_OFF_TOGGLE_ID                         0x02U
+#define ESP_ZB_ZCL_CMD_LEVEL_CONTROL_MOVE_TO_LEVEL              0x00U
+#define ESP_ZB_ZCL_CMD_LEVEL_CONTROL_MOVE                       0x01U
+#define ESP_ZB_ZCL_CMD_LEVEL_CONTROL_STEP                       0x02U
+#define ESP_ZB_ZCL_CMD_LEVEL_CONTROL_STOP                       0x03U
+#define ESP_ZB_ZCL_CMD_LEVEL_CONTROL_MOVE_TO_LEVEL_WITH_ON_OFF  0x04U
+#define ESP_ZB_ZCL_CMD_LEVEL_CONTROL_MOVE_WITH_ON_OFF           0x05U
+#define ESP_ZB_ZCL_CMD_LEVEL_CONTROL_STEP_WITH_ON_OFF           0x06U
+#define ESP_ZB_ZCL_CMD_LEVEL_CONTROL_STOP_WITH_ON_OFF           0x07U
+#define ESP_ZB_ZCL_CMD_COLOR_CONTROL_MOVE_TO_HUE_SATURATION     0x06U
+#define ESP_ZB_ZCL_CMD_COLOR_CONTROL_MOVE_TO_COLOR              0x07U
+#define ESP_ZB_ZCL_CMD_COLOR_CONTROL_MOVE_TO_COLOR_TEMPERATURE  0x0aU
+#define ESP_ZB_ZCL_CMD_COLOR_CONTROL_ENHANCED_MOVE_TO_HUE       0x40U
+#define ESP_ZB_ZCL_CMD_GROUPS_ADD_GROUP                         0x00U
+#define ESP_ZB_ZCL_CMD_GROUPS_REMOVE_GROUP                      0x03U
+#define ESP_ZB_ZCL_CMD_SCENES_ADD_SCENE                         0x00U
+#define ESP_ZB_ZCL_CMD_SCENES_REMOVE_SCENE                      0x02U
+#define ESP_ZB_ZCL_CMD_SCENES_STORE_SCENE                       0x04U
+#define ESP_ZB_ZCL_CMD_SCENES_RECALL_SCENE                      0x05U
+
+/* ZDO bind destination address modes */
+#define ESP_ZB_ZDO_BIND_DST_ADDR_MODE_16_BIT_GROUP              0x01U
+#define ESP_ZB_ZDO_BIND_DST_ADDR_MODE_64_BIT_EXTENDED           0x03U
+
+#ifdef __cplusplus
+}
+#endif
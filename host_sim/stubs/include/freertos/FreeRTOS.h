@@ -0,0 +1,50 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Host simulation stand-in for FreeRTOS.h. Tasks map to pthreads and one tick
+ * is one millisecond of wall-clock time.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_attr.h"
+#include "sdkconfig.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+/* as in the IDF port, stack depths are in bytes */
+typedef uint8_t StackType_t;
+
+/* storage of tasks and queues created with the Static calls, opaque like the real ones */
+typedef struct {
+    void *reserved[8];
+} StaticTask_t;
+
+typedef struct {
+    void *reserved[8];
+} StaticQueue_t;
+
+#define pdFALSE             ((BaseType_t)0)
+#define pdTRUE              ((BaseType_t)1)
+#define pdPASS              pdTRUE
+#define pdFAIL              pdFALSE
+#define errQUEUE_FULL       ((BaseType_t)0)
+
+#define configTICK_RATE_HZ  1000
+#define portTICK_PERIOD_MS  ((TickType_t)1000 / configTICK_RATE_HZ)
+#define portMAX_DELAY       ((TickType_t)0xffffffffUL)
+#define pdMS_TO_TICKS(ms)   ((TickType_t)(((TickType_t)(ms) * (TickType_t)configTICK_RATE_HZ) / (TickType_t)1000U))
+
+#define portYIELD_FROM_ISR(x) ((void)(x))
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,25 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Host simulation stand-in for ha/esp_zigbee_ha_standard.h
+ */
+
+#pragma once
+
+#include "esp_zigbee_core.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ESP_ZB_AF_HA_PROFILE_ID                     0x0104U
+
+#define ESP_ZB_HA_ON_OFF_SWITCH_DEVICE_ID           0x0000U
+#define ESP_ZB_HA_REMOTE_CONTROL_DEVICE_ID          0x0006U
+#define ESP_ZB_HA_COLOR_DIMMER_SWITCH_DEVICE_ID     0x0105U
+#define ESP_ZB_HA_DIMMABLE_LIGHT_DEVICE_ID          0x0101U
+#define ESP_ZB_HA_COLOR_DIMMABLE_LIGHT_DEVICE_ID    0x0102U
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,15 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Host simulation stand-in for the generated sdkconfig.h
+ */
+
+#pragma once
+
+#define CONFIG_IDF_TARGET "esp32c6"
+#define CONFIG_ZB_ENABLED 1
+#define CONFIG_ZB_ZCZR 1
+#define CONFIG_LOG_DEFAULT_LEVEL 3
+#define CONFIG_LOG_MAXIMUM_LEVEL 3
+#define CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ 1000
+#define CONFIG_HEAP_USE_HOOKS 1
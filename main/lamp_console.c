@@ -0,0 +1,411 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Lamp controller serial console
+ *
+ * This example code is in the Public Domain (or CC0 licensed, at your option.)
+ *
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_check.h"
+#include "esp_console.h"
+#include "esp_zigbee_core.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "lamp_console.h"
+#include "lamp_log.h"
+#include "lamp_mem.h"
+#include "lamp_serial.h"
+#include "lamp_trace.h"
+#include "light_fade.h"
+#include "light_latency.h"
+#include "light_link.h"
+#include "light_onboard.h"
+#include "light_registry.h"
+#include "light_schedule.h"
+#include "light_tx.h"
+#include "sdkconfig.h"
+
+/**
+ * @brief:
+ * The REPL runs in its own task; commands take the Zigbee lock while they
+ * touch state owned by the Zigbee task, so a dump never sees half an update.
+ * The dump is printed with the lock held and stalls the stack for as long as
+ * the console takes to write it, which is fine for an occasional command.
+ */
+
+static const char *TAG = "ESP_LAMP_CONSOLE";
+
+static uint32_t s_repl_stack;       /* stack depth the REPL task was created with */
+
+static int lamp_console_latency(int argc, char **argv)
+{
+    const bool reset = argc == 2 && strcmp(argv[1], "reset") == 0;
+    if (argc > 2 || (argc == 2 && !reset)) {
+        printf("usage: latency [reset]\n");
+        return 1;
+    }
+    esp_zb_lock_acquire(portMAX_DELAY);
+    if (reset) {
+        light_latency_init();
+    } else {
+        light_latency_dump();
+    }
+    esp_zb_lock_release();
+    return 0;
+}
+
+static int lamp_console_link(int argc, char **argv)
+{
+    const bool reset = argc == 2 && strcmp(argv[1], "reset") == 0;
+    if (argc > 2 || (argc == 2 && !reset)) {
+        printf("usage: link [reset]\n");
+        return 1;
+    }
+    esp_zb_lock_acquire(portMAX_DELAY);
+    if (reset) {
+        light_link_init();
+    } else {
+        light_link_dump();
+    }
+    esp_zb_lock_release();
+    return 0;
+}
+
+static int lamp_console_tx(int argc, char **argv)
+{
+    (void)argv;
+    if (argc > 1) {
+        printf("usage: tx\n");
+        return 1;
+    }
+    esp_zb_lock_acquire(portMAX_DELAY);
+    light_tx_dump();
+    esp_zb_lock_release();
+    return 0;
+}
+
+static int lamp_console_lights(int argc, char **argv)
+{
+    (void)argv;
+    if (argc > 1) {
+        printf("usage: lights\n");
+        return 1;
+    }
+    esp_zb_lock_acquire(portMAX_DELAY);
+    light_registry_dump();
+    esp_zb_lock_release();
+    return 0;
+}
+
+static int lamp_console_onboard(int argc, char **argv)
+{
+    (void)argv;
+    if (argc > 1) {
+        printf("usage: onboard\n");
+        return 1;
+    }
+    esp_zb_lock_acquire(portMAX_DELAY);
+    light_onboard_dump();
+    esp_zb_lock_release();
+    return 0;
+}
+
+static int lamp_console_mem(int argc, char **argv)
+{
+    (void)argv;
+    if (argc > 1) {
+        printf("usage: mem\n");
+        return 1;
+    }
+    /* the REPL allocates for every line it reads: its stack is reported, its heap use is not an error */
+    lamp_mem_add_task(xTaskGetCurrentTaskHandle(), s_repl_stack, false);
+    esp_zb_lock_acquire(portMAX_DELAY);
+    lamp_mem_dump();
+    esp_zb_lock_release();
+    return 0;
+}
+
+static int lamp_console_log(int argc, char **argv)
+{
+    if (argc == 1) {
+        lamp_log_stats_t stats;
+        lamp_log_get_stats(&stats);
+        printf("log: written=%lu dropped=%lu printed=%lu max_depth=%u/%u\n", (unsigned long)stats.written,
+               (unsigned long)stats.dropped, (unsigned long)stats.printed, stats.max_depth, LAMP_LOG_RING_LEN);
+    } else if (argc == 2 && strcmp(argv[1], "bench") == 0) {
+        lamp_log_bench_t bench;
+        lamp_log_bench(&bench);
+        printf("log bench, ns per call over %d calls: deferred write %lu, deferred format %lu, "
+               "in-place snprintf %lu (plus the console write)\n",
+               LAMP_LOG_BENCH_CALLS, (unsigned long)bench.write_ns, (unsigned long)bench.format_ns,
+               (unsigned long)bench.snprintf_ns);
+    } else if (argc == 2 && (strcmp(argv[1], "text") == 0 || strcmp(argv[1], "binary") == 0)) {
+        lamp_log_set_binary(strcmp(argv[1], "binary") == 0);
+    } else {
+        printf("usage: log [bench|text|binary]\n");
+        return 1;
+    }
+    return 0;
+}
+
+static void lamp_console_fade_usage(void)
+{
+    printf("usage: fade [stop | budget FRAMES_PER_S | MS LEVEL|- [xy X Y | hs HUE SAT]]\n");
+}
+
+/* Parse "fade MS LEVEL|- [xy X Y | hs HUE SAT]", which fades every light */
+static bool lamp_console_fade_parse(int argc, char **argv, light_fade_t *fade)
+{
+    if (argc != 3 && argc != 6) {
+        return false;
+    }
+    *fade = (light_fade_t){
+        .targets = LIGHT_MASK_ALL,
+        .duration_ms = strtoul(argv[1], NULL, 0),
+        .level = strcmp(argv[2], "-") != 0,
+        .level_to = (uint8_t)strtoul(argv[2], NULL, 0),
+    };
+    if (argc == 6 && strcmp(argv[3], "xy") == 0) {
+        fade->color = LIGHT_FADE_COLOR_XY;
+        fade->color_to.xy.x = (uint16_t)strtoul(argv[4], NULL, 0);
+        fade->color_to.xy.y = (uint16_t)strtoul(argv[5], NULL, 0);
+    } else if (argc == 6 && strcmp(argv[3], "hs") == 0) {
+        fade->color = LIGHT_FADE_COLOR_HUE_SAT;
+        fade->color_to.hue_sat.hue = (uint8_t)strtoul(argv[4], NULL, 0);
+        fade->color_to.hue_sat.saturation = (uint8_t)strtoul(argv[5], NULL, 0);
+    } else if (argc == 6) {
+        return false;
+    }
+    return true;
+}
+
+static int lamp_console_fade(int argc, char **argv)
+{
+    light_fade_t fade;
+    const bool stop = argc == 2 && strcmp(argv[1], "stop") == 0;
+    const bool budget = argc == 3 && strcmp(argv[1], "budget") == 0;
+    if (argc > 1 && !stop && !budget && !lamp_console_fade_parse(argc, argv, &fade)) {
+        lamp_console_fade_usage();
+        return 1;
+    }
+    esp_err_t err = ESP_OK;
+    light_fade_stats_t stats;
+    esp_zb_lock_acquire(portMAX_DELAY);
+    if (stop) {
+        light_fade_stop(LIGHT_MASK_ALL);
+    } else if (budget) {
+        light_fade_set_budget((uint16_t)strtoul(argv[2], NULL, 0));
+    } else if (argc > 1) {
+        err = light_fade_start(&fade);
+    }
+    light_fade_get_stats(&stats);
+    esp_zb_lock_release();
+    if (err != ESP_OK) {
+        printf("fade: %s\n", esp_err_to_name(err));
+        return 1;
+    }
+    printf("fade: active=%u started=%lu finished=%lu stopped=%lu setpoints=%lu frames=%lu budget=%u/s "
+           "stretch=%u.%03u\n", stats.active, (unsigned long)stats.started, (unsigned long)stats.finished,
+           (unsigned long)stats.stopped, (unsigned long)stats.setpoints, (unsigned long)stats.frames, stats.budget,
+           stats.stretch_permille / 1000, stats.stretch_permille % 1000);
+    return 0;
+}
+
+/* "HH:MM" or "HH:MM:SS" as seconds after midnight */
+static bool lamp_console_parse_time(const char *text, uint32_t *day_s)
+{
+    unsigned hours, minutes, seconds = 0;
+    char end;
+    const int fields = sscanf(text, "%u:%u:%u%c", &hours, &minutes, &seconds, &end);
+    if ((fields != 2 && fields != 3) || hours > 23 || minutes > 59 || seconds > 59) {
+        return false;
+    }
+    *day_s = hours * 3600 + minutes * 60 + seconds;
+    return true;
+}
+
+static int lamp_console_schedule(int argc, char **argv)
+{
+    uint32_t day_s = 0;
+    const bool on = argc == 2 && strcmp(argv[1], "on") == 0;
+    const bool off = argc == 2 && strcmp(argv[1], "off") == 0;
+    const bool time = argc == 3 && strcmp(argv[1], "time") == 0 && lamp_console_parse_time(argv[2], &day_s);
+    if (argc > 1 && !on && !off && !time) {
+        printf("usage: schedule [on | off | time HH:MM[:SS]]\n");
+        return 1;
+    }
+    light_schedule_stats_t stats;
+    esp_zb_lock_acquire(portMAX_DELAY);
+    if (time) {
+        light_schedule_set_time(day_s);
+    } else if (on || off) {
+        light_schedule_enable(on);
+    }
+    light_schedule_get_stats(&stats);
+    if (stats.loaded) {
+        printf("schedule: revision %lu, %s, ", (unsigned long)stats.revision, stats.enabled ? "on" : "off");
+        if (stats.clock_set) {
+            printf("time %02lu:%02lu:%02lu", (unsigned long)stats.day_s / 3600, (unsigned long)stats.day_s / 60 % 60,
+                   (unsigned long)stats.day_s % 60);
+        } else {
+            printf("waiting for 'schedule time'");
+        }
+        printf(", applied=%lu deferred=%lu\n", (unsigned long)stats.applied, (unsigned long)stats.deferred);
+    }
+    light_schedule_dump();
+    esp_zb_lock_release();
+    return 0;
+}
+
+static int lamp_console_serial(int argc, char **argv)
+{
+    (void)argv;
+    if (argc > 1) {
+        printf("usage: serial\n");
+        return 1;
+    }
+    lamp_serial_stats_t stats;
+    lamp_serial_get_stats(&stats);
+    printf("serial: bytes=%lu reads=%lu frames=%lu bad_frames=%lu skipped=%lu duplicates=%lu out_of_order=%lu "
+           "rejected=%lu records=%lu mailbox_waits=%lu write_drops=%lu telemetry=%lu\n",
+           (unsigned long)stats.bytes, (unsigned long)stats.reads, (unsigned long)stats.frames,
+           (unsigned long)stats.bad_frames, (unsigned long)stats.skipped, (unsigned long)stats.duplicates,
+           (unsigned long)stats.out_of_order, (unsigned long)stats.rejected, (unsigned long)stats.records,
+           (unsigned long)stats.mailbox_waits, (unsigned long)stats.write_drops, (unsigned long)stats.telemetry);
+    return 0;
+}
+
+static int lamp_console_trace(int argc, char **argv)
+{
+    if (argc == 1) {
+        lamp_trace_stats_t stats;
+        esp_zb_lock_acquire(portMAX_DELAY);
+        lamp_trace_get_stats(&stats);
+        esp_zb_lock_release();
+        printf("trace: %s records=%lu bytes=%lu overwritten=%lu truncated=%lu held=%lu records, %lu/%d bytes\n",
+               stats.enabled ? "on" : "off", (unsigned long)stats.records, (unsigned long)stats.bytes,
+               (unsigned long)stats.overwritten, (unsigned long)stats.truncated, (unsigned long)stats.held_records,
+               (unsigned long)stats.held_bytes, LAMP_TRACE_RING_BYTES);
+    } else if (argc == 2 && strcmp(argv[1], "dump") == 0) {
+        lamp_trace_dump();
+    } else if (argc == 2 && strcmp(argv[1], "clear") == 0) {
+        esp_zb_lock_acquire(portMAX_DELAY);
+        lamp_trace_clear();
+        esp_zb_lock_release();
+    } else if (argc == 2 && (strcmp(argv[1], "on") == 0 || strcmp(argv[1], "off") == 0)) {
+        lamp_trace_enable(strcmp(argv[1], "on") == 0);
+    } else {
+        printf("usage: trace [dump|clear|on|off]\n");
+        return 1;
+    }
+    return 0;
+}
+
+esp_err_t lamp_console_start(void)
+{
+    esp_console_repl_t *repl = NULL;
+    esp_console_repl_config_t repl_config = ESP_CONSOLE_REPL_CONFIG_DEFAULT();
+    repl_config.prompt = "lamp>";
+    s_repl_stack = repl_config.task_stack_size;
+#if CONFIG_ESP_CONSOLE_USB_SERIAL_JTAG
+    esp_console_dev_usb_serial_jtag_config_t hw_config = ESP_CONSOLE_DEV_USB_SERIAL_JTAG_CONFIG_DEFAULT();
+    ESP_RETURN_ON_ERROR(esp_console_new_repl_usb_serial_jtag(&hw_config, &repl_config, &repl), TAG,
+                        "Failed to create the console");
+#else
+    esp_console_dev_uart_config_t hw_config = ESP_CONSOLE_DEV_UART_CONFIG_DEFAULT();
+    ESP_RETURN_ON_ERROR(esp_console_new_repl_uart(&hw_config, &repl_config, &repl), TAG,
+                        "Failed to create the console");
+#endif
+    const esp_console_cmd_t latency_cmd = {
+        .command = "latency",
+        .help = "Press-to-answer latency per command type and light, 'latency reset' clears it",
+        .hint = "[reset]",
+        .func = lamp_console_latency,
+    };
+    ESP_RETURN_ON_ERROR(esp_console_cmd_register(&latency_cmd), TAG, "Failed to register latency");
+    const esp_console_cmd_t lights_cmd = {
+        .command = "lights",
+        .help = "Known lights: slot, IEEE and short address, endpoint, group and flags; slots are the numbers "
+                "schedule rooms and serial targets use",
+        .func = lamp_console_lights,
+    };
+    ESP_RETURN_ON_ERROR(esp_console_cmd_register(&lights_cmd), TAG, "Failed to register lights");
+    const esp_console_cmd_t link_cmd = {
+        .command = "link",
+        .help = "Frames, bytes and estimated airtime per light and cluster, APS acknowledgements, failures and "
+                "retries, rolling RSSI and LQI; 'link reset' clears them",
+        .hint = "[reset]",
+        .func = lamp_console_link,
+    };
+    ESP_RETURN_ON_ERROR(esp_console_cmd_register(&link_cmd), TAG, "Failed to register link");
+    const esp_console_cmd_t tx_cmd = {
+        .command = "tx",
+        .help = "Transmit scheduler: requests sent and held back per lane, waiting senders, frames in flight",
+        .func = lamp_console_tx,
+    };
+    ESP_RETURN_ON_ERROR(esp_console_cmd_register(&tx_cmd), TAG, "Failed to register tx");
+    const esp_console_cmd_t onboard_cmd = {
+        .command = "onboard",
+        .help = "Onboarding pipeline: announcements, fast path rejoins, retries and failures, time per stage, "
+                "devices still in the pipeline",
+        .func = lamp_console_onboard,
+    };
+    ESP_RETURN_ON_ERROR(esp_console_cmd_register(&onboard_cmd), TAG, "Failed to register onboard");
+    const esp_console_cmd_t mem_cmd = {
+        .command = "mem",
+        .help = "Free and lowest free heap, heap use after startup, stack high-water mark per task, "
+                "occupancy of the static pools",
+        .func = lamp_console_mem,
+    };
+    ESP_RETURN_ON_ERROR(esp_console_cmd_register(&mem_cmd), TAG, "Failed to register mem");
+    const esp_console_cmd_t log_cmd = {
+        .command = "log",
+        .help = "Deferred log counters; 'bench' times a record against formatting in place, "
+                "'binary' prints records as hex for the host decoder, 'text' formats them again",
+        .hint = "[bench|text|binary]",
+        .func = lamp_console_log,
+    };
+    ESP_RETURN_ON_ERROR(esp_console_cmd_register(&log_cmd), TAG, "Failed to register log");
+    const esp_console_cmd_t fade_cmd = {
+        .command = "fade",
+        .help = "Fade counters; 'fade MS LEVEL' fades every light over MS milliseconds, '-' keeps the level, "
+                "'xy X Y' or 'hs HUE SAT' fades the color too; 'stop' stops all fades, 'budget' sets their "
+                "frames per second",
+        .hint = "[stop | budget N | MS LEVEL|- [xy X Y | hs HUE SAT]]",
+        .func = lamp_console_fade,
+    };
+    ESP_RETURN_ON_ERROR(esp_console_cmd_register(&fade_cmd), TAG, "Failed to register fade");
+    const esp_console_cmd_t schedule_cmd = {
+        .command = "schedule",
+        .help = "Schedule rooms and their active segments; 'time' sets the time of day the schedule runs on, "
+                "'off' stops following it until 'on'",
+        .hint = "[on | off | time HH:MM[:SS]]",
+        .func = lamp_console_schedule,
+    };
+    ESP_RETURN_ON_ERROR(esp_console_cmd_register(&schedule_cmd), TAG, "Failed to register schedule");
+    const esp_console_cmd_t serial_cmd = {
+        .command = "serial",
+        .help = "Serial protocol counters: bytes and reads, frames, rejected and resent ones, records posted and "
+                "how many waited for the mailbox",
+        .hint = NULL,
+        .func = lamp_console_serial,
+    };
+    ESP_RETURN_ON_ERROR(esp_console_cmd_register(&serial_cmd), TAG, "Failed to register serial");
+    const esp_console_cmd_t trace_cmd = {
+        .command = "trace",
+        .help = "Zigbee trace counters; 'dump' prints the ring as hex lines for the host replay (lamp_replay), "
+                "'clear' empties it, 'off' and 'on' pause and resume recording",
+        .hint = "[dump|clear|on|off]",
+        .func = lamp_console_trace,
+    };
+    ESP_RETURN_ON_ERROR(esp_console_cmd_register(&trace_cmd), TAG, "Failed to register trace");
+    ESP_RETURN_ON_ERROR(esp_console_register_help_command(), TAG, "Failed to register help");
+    return esp_console_start_repl(repl);
+}
@@ -0,0 +1,59 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Lamp controller serial console
+ *
+ * This example code is in the Public Domain (or CC0 licensed, at your option.)
+ *
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#pragma once
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Commands typed on the serial console (USB serial/JTAG or UART, whichever
+ * the console is configured for):
+ *
+ *   fade            fade counters (light_fade.h)
+ *   fade MS LEVEL|- [xy X Y | hs HUE SAT]
+ *                   fade every light over MS milliseconds, "-" keeps the level, xy or hs fades the color too
+ *   fade stop       stop every fade
+ *   fade budget N   frames per second all fades share
+ *   latency         print the press-to-answer histograms per command type and light
+ *   latency reset   clear them
+ *   lights          known lights by slot, with IEEE and short address (light_registry.h)
+ *   link            frames, bytes, airtime, APS acknowledgements, retries and link quality per light (light_link.h)
+ *   link reset      clear them
+ *   log             deferred log ring counters
+ *   log bench       time a deferred record against formatting the message in place
+ *   log binary      print log records as hex lines for the host decoder, "log text" to format them again
+ *   mem             heap, stack high-water marks and static pool occupancy (lamp_mem.h)
+ *   onboard         onboarding pipeline counters, time per stage and the devices in it (light_onboard.h)
+ *   schedule        rooms of the schedule and their active segments (light_schedule.h)
+ *   schedule time HH:MM[:SS]
+ *                   set the time of day the schedule runs on
+ *   schedule off    stop following the schedule, "schedule on" to follow it again
+ *   serial          serial protocol counters (lamp_serial.h)
+ *   trace           Zigbee trace counters (lamp_trace.h)
+ *   trace dump      print the trace ring as hex lines for the host replay (lamp_replay)
+ *   trace clear     empty the ring
+ *   trace off       pause recording, "trace on" to resume it
+ *   tx              transmit scheduler: requests sent and held back per lane, waiting senders, frames in flight
+ */
+
+/**
+ * @brief Start the console REPL task and register the lamp commands
+ */
+esp_err_t lamp_console_start(void);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
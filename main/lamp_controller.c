@@ -13,8 +13,27 @@
  */
 
 #include "lamp_controller.h"
+#include "lamp_console.h"
+#include "lamp_log.h"
+#include "lamp_mem.h"
+#include "lamp_serial.h"
+#include "lamp_trace.h"
+#include "light_attr.h"
+#include "light_color.h"
+#include "light_command.h"
+#include "light_fade.h"
+#include "light_latency.h"
+#include "light_link.h"
+#include "light_onboard.h"
+#include "light_registry.h"
+#include "light_report.h"
+#include "light_scene.h"
+#include "light_schedule.h"
+#include "light_store.h"
+#include "light_tx.h"
 #include "esp_check.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "ha/esp_zigbee_ha_standard.h"
@@ -29,25 +48,49 @@
 #error Define ZB_ZCZR in idf.py menuconfig to compile light switch (Coordinator) source code.
 #endif
 
-typedef struct light_bulb_device_params_s {
-  esp_zb_ieee_addr_t ieee_addr;
-  uint8_t endpoint;
-  uint16_t short_addr;
-} light_bulb_device_params_t;
-
-static light_bulb_device_params_t *global_light = 0;
+#define DIM_GESTURES                                                           \
+  (SWITCH_GESTURE_BIT(SWITCH_GESTURE_DOUBLE_PRESS) |                           \
+   SWITCH_GESTURE_BIT(SWITCH_GESTURE_HOLD))
 
 static switch_func_pair_t button_func_pair[] = {
-    {GPIO_INPUT_IO_TOGGLE_SWITCH, SWITCH_ONOFF_TOGGLE_CONTROL}};
-
-/* R, G, B of color x,y define table */
-/*
-static uint16_t color_x_table[3] = {41942, 19660, 9830};
-static uint16_t color_y_table[3] = {21626, 38321, 3932};
-*/
+    {GPIO_INPUT_IO_TOGGLE_SWITCH, SWITCH_ONOFF_TOGGLE_CONTROL},
+    {GPIO_INPUT_IO_LEVEL_UP_SWITCH, SWITCH_LEVEL_UP_CONTROL, false,
+     DIM_GESTURES},
+    {GPIO_INPUT_IO_LEVEL_DOWN_SWITCH, SWITCH_LEVEL_DOWN_CONTROL, false,
+     DIM_GESTURES}};
 
 static const char *TAG = "ESP_LAMP_CONTROLLER";
 
+static StackType_t s_zb_task_stack[ZIGBEE_TASK_STACK];
+static StaticTask_t s_zb_task;
+
+/* whites of the presets, in mireds */
+#define LAMP_COLD_MIREDS 154 /* 6500 K */
+#define LAMP_WARM_MIREDS 312 /* 3200 K */
+
+/* A preset of a white, its color computed by the compiler */
+#define LAMP_PRESET_WHITE(mireds, lvl)                                         \
+  {.color_x = LIGHT_COLOR_MIREDS_X(mireds),                                    \
+   .color_y = LIGHT_COLOR_MIREDS_Y(mireds),                                    \
+   .level = (lvl)}
+
+/* Button presets, stored in every light as scenes: cold, dimmer each, then warm */
+static const light_scene_preset_t s_presets[] = {
+    LAMP_PRESET_WHITE(LAMP_COLD_MIREDS, 254),
+    LAMP_PRESET_WHITE(LAMP_COLD_MIREDS, 200),
+    LAMP_PRESET_WHITE(LAMP_COLD_MIREDS, 150),
+    LAMP_PRESET_WHITE(LAMP_COLD_MIREDS, 100),
+    LAMP_PRESET_WHITE(LAMP_COLD_MIREDS, 50),
+    LAMP_PRESET_WHITE(LAMP_COLD_MIREDS, 20),
+    LAMP_PRESET_WHITE(LAMP_WARM_MIREDS, 254),
+};
+
+/*
+ * Preset of the latest recall sent to each light, replayed as direct writes
+ * to lights that turn out not to hold it
+ */
+static uint8_t s_recalled[LIGHT_REGISTRY_CAPACITY];
+
 /* Production configuration app data */
 typedef struct app_production_config_s {
   uint16_t version;
@@ -55,139 +98,416 @@ typedef struct app_production_config_s {
   char manuf_name[16];
 } app_production_config_t;
 
-static void set_level(const uint8_t level) {
-  esp_zb_zcl_move_to_level_cmd_t cmd_level;
-  cmd_level.zcl_basic_cmd.src_endpoint = GATEWAY_ENDPOINT;
-  cmd_level.address_mode = ESP_ZB_APS_ADDR_MODE_DST_ADDR_ENDP_NOT_PRESENT;
-  cmd_level.level = level;
-  cmd_level.transition_time = 0xffff;
-  esp_zb_lock_acquire(portMAX_DELAY);
-  esp_zb_zcl_level_move_to_level_with_onoff_cmd_req(&cmd_level);
-  esp_zb_lock_release();
+/* Address a ZCL command to one light by network address and endpoint */
+static void light_cmd_addr(esp_zb_zcl_basic_cmd_t *zcl_basic_cmd,
+                           const light_bulb_device_params_t *light) {
+  zcl_basic_cmd->dst_addr_u.addr_short = light->short_addr;
+  zcl_basic_cmd->dst_endpoint = light->endpoint;
+  zcl_basic_cmd->src_endpoint = GATEWAY_ENDPOINT;
 }
 
-#define levels_count 6
+/* ZCL request for a mailbox command, returns its ZCL sequence number */
+static uint8_t light_cmd_request(const light_cmd_t *cmd,
+                                 const esp_zb_zcl_basic_cmd_t *zcl_basic_cmd,
+                                 esp_zb_zcl_address_mode_t address_mode) {
+  switch (cmd->type) {
+  case LIGHT_CMD_LEVEL: {
+    esp_zb_zcl_move_to_level_cmd_t req = {
+        .zcl_basic_cmd = *zcl_basic_cmd,
+        .address_mode = address_mode,
+        .level = cmd->level,
+        .transition_time = cmd->transition_time,
+    };
+    return esp_zb_zcl_level_move_to_level_with_onoff_cmd_req(&req);
+  }
+  case LIGHT_CMD_COLOR_XY: {
+    esp_zb_zcl_color_move_to_color_cmd_t req = {
+        .zcl_basic_cmd = *zcl_basic_cmd,
+        .address_mode = address_mode,
+        .color_x = cmd->xy.x,
+        .color_y = cmd->xy.y,
+        .transition_time = cmd->transition_time,
+    };
+    return esp_zb_zcl_color_move_to_color_cmd_req(&req);
+  }
+  case LIGHT_CMD_HUE_SAT: {
+    esp_zb_color_move_to_hue_saturation_cmd_t req = {
+        .zcl_basic_cmd = *zcl_basic_cmd,
+        .address_mode = address_mode,
+        .hue = cmd->hue_sat.hue,
+        .saturation = cmd->hue_sat.saturation,
+        .transition_time = cmd->transition_time,
+    };
+    return esp_zb_zcl_color_move_to_hue_and_saturation_cmd_req(&req);
+  }
+  case LIGHT_CMD_ENHANCED_HUE: {
+    esp_zb_zcl_color_enhanced_move_to_hue_cmd_t req = {
+        .zcl_basic_cmd = *zcl_basic_cmd,
+        .address_mode = address_mode,
+        .enhanced_hue = cmd->enhanced_hue.hue,
+        .direction = cmd->enhanced_hue.direction,
+        .transition_time = cmd->transition_time,
+    };
+    return esp_zb_zcl_color_enhanced_move_to_hue_cmd_req(&req);
+  }
+  case LIGHT_CMD_COLOR_TEMP: {
+    esp_zb_zcl_color_move_to_color_temperature_cmd_t req = {
+        .zcl_basic_cmd = *zcl_basic_cmd,
+        .address_mode = address_mode,
+        .color_temperature = cmd->color_temperature,
+        .transition_time = cmd->transition_time,
+    };
+    return esp_zb_zcl_color_move_to_color_temperature_cmd_req(&req);
+  }
+  case LIGHT_CMD_RECALL_SCENE: {
+    esp_zb_zcl_scenes_recall_scene_cmd_t req = {
+        .zcl_basic_cmd = *zcl_basic_cmd,
+        .address_mode = address_mode,
+        .group_id = LIGHT_SCENE_GROUP_ID,
+        .scene_id = cmd->preset + 1,
+    };
+    return esp_zb_zcl_scenes_recall_scene_cmd_req(&req);
+  }
+  case LIGHT_CMD_MOVE_LEVEL: {
+    esp_zb_zcl_level_move_cmd_t req = {
+        .zcl_basic_cmd = *zcl_basic_cmd,
+        .address_mode = address_mode,
+        .move_mode = cmd->move.mode,
+        .rate = cmd->move.rate,
+    };
+    return esp_zb_zcl_level_move_with_onoff_cmd_req(&req);
+  }
+  case LIGHT_CMD_STEP_LEVEL: {
+    esp_zb_zcl_level_step_cmd_t req = {
+        .zcl_basic_cmd = *zcl_basic_cmd,
+        .address_mode = address_mode,
+        .step_mode = cmd->step.mode,
+        .step_size = cmd->step.size,
+        .transition_time = cmd->transition_time,
+    };
+    return esp_zb_zcl_level_step_with_onoff_cmd_req(&req);
+  }
+  case LIGHT_CMD_STOP_LEVEL: {
+    esp_zb_zcl_level_stop_cmd_t req = {
+        .zcl_basic_cmd = *zcl_basic_cmd,
+        .address_mode = address_mode,
+    };
+    return esp_zb_zcl_level_stop_cmd_req(&req);
+  }
+  case LIGHT_CMD_READ_ATTRS: {
+    esp_zb_zcl_read_attr_cmd_t req = {
+        .zcl_basic_cmd = *zcl_basic_cmd,
+        .address_mode = address_mode,
+        .clusterID = cmd->read.cluster_id,
+        .attr_number = cmd->read.count,
+        .attr_field = (uint16_t *)cmd->read.ids,
+    };
+    return esp_zb_zcl_read_attr_cmd_req(&req);
+  }
+  default:
+    ESP_LOGW(TAG, "Unknown light command %d", cmd->type);
+    return 0;
+  }
+}
 
-static void cycle_level(void) {
-  static const uint8_t levels[levels_count] = {255, 200, 150, 100, 50, 20};
-  static uint8_t counter = 0;
-  set_level(levels[counter % levels_count]);
-  counter++;
+/*
+ * Issue one ZCL request for a mailbox command to an already set address,
+ * returns its ZCL sequence number
+ */
+static uint8_t light_cmd_issue(const light_cmd_t *cmd,
+                               const esp_zb_zcl_basic_cmd_t *zcl_basic_cmd,
+                               esp_zb_zcl_address_mode_t address_mode) {
+  const uint8_t tsn = light_cmd_request(cmd, zcl_basic_cmd, address_mode);
+  lamp_trace_command(cmd, zcl_basic_cmd, address_mode, tsn);
+  light_link_command(cmd, zcl_basic_cmd, address_mode, tsn);
+  return tsn;
 }
 
-static void set_color_xy(uint16_t x, uint16_t y) {
-  esp_zb_zcl_color_move_to_color_cmd_t cmd;
-  cmd.zcl_basic_cmd.src_endpoint = GATEWAY_ENDPOINT;
-  cmd.address_mode = ESP_ZB_APS_ADDR_MODE_DST_ADDR_ENDP_NOT_PRESENT;
+static light_mask_t light_cmd_send_writes(const light_cmd_t *cmds,
+                                          uint8_t count,
+                                          light_mask_t *deferred);
+
+/* Reach lights without the preset scenes with a level and a color write */
+static light_mask_t light_cmd_send_preset(const light_cmd_t *cmd,
+                                          light_mask_t targets,
+                                          light_mask_t *deferred) {
+  const light_scene_preset_t *preset = light_scene_preset(cmd->preset);
+  if (!preset) {
+    return 0;
+  }
+  const light_cmd_t writes[] = {
+      {
+          .type = LIGHT_CMD_COLOR_XY,
+          .targets = targets,
+          .origin_us = cmd->origin_us,
+          .transition_time = cmd->transition_time,
+          .xy = {.x = preset->color_x, .y = preset->color_y},
+      },
+      {
+          .type = LIGHT_CMD_LEVEL,
+          .targets = targets,
+          .origin_us = cmd->origin_us,
+          .transition_time = cmd->transition_time,
+          .level = preset->level,
+      },
+  };
+  /* both writes or neither: a light held back gets the whole recall again */
+  return light_cmd_send_writes(writes, sizeof(writes) / sizeof(writes[0]),
+                               deferred);
+}
 
-  cmd.color_x = x;
-  cmd.color_y = y;
+/*
+ * Send mailbox commands with the same targets to them, runs in the Zigbee
+ * task. Writes covering every member of a group go out as a single
+ * groupcast, the rest (non-members, lights that rejected the group, partial
+ * groups) are unicast. Reads are always unicast, each light has to answer.
+ * Scene recalls are only groupcast to lights that confirmed their scenes on
+ * this boot. A write that is not a fade setpoint takes its lights out of
+ * their fade. A group or light gets all `count` commands once the transmit
+ * lane of the first has room for them, the ones it finds none for are added
+ * to `deferred`.
+ */
+static light_mask_t light_cmd_send_writes(const light_cmd_t *cmds,
+                                          uint8_t count,
+                                          light_mask_t *deferred) {
+  const light_cmd_t *cmd = &cmds[0];
+  const light_tx_lane_t lane = light_command_tx_lane(cmd);
+  light_mask_t unicast = cmd->targets & light_registry_all();
+  if (cmd->type != LIGHT_CMD_READ_ATTRS &&
+      !(cmd->flags & LIGHT_CMD_FLAG_FADE)) {
+    light_fade_stop(unicast);
+  }
+  light_mask_t groupable = unicast;
+  light_mask_t groupcast = 0;
+  if (cmd->type == LIGHT_CMD_RECALL_SCENE) {
+    uint8_t index;
+    LIGHT_MASK_FOR_EACH(index, unicast) { s_recalled[index] = cmd->preset; }
+    const light_mask_t direct = unicast & ~light_scene_stored();
+    if (direct) {
+      groupcast |= light_cmd_send_preset(cmd, direct, deferred);
+      unicast &= ~direct;
+    }
+    groupable = unicast & light_scene_verified();
+  }
+  if (cmd->type != LIGHT_CMD_READ_ATTRS) {
+    light_mask_t candidates = groupable;
+    while (candidates) {
+      const light_bulb_device_params_t *light =
+          light_registry_get((uint8_t)__builtin_ctzll(candidates));
+      if (!(light->flags & LIGHT_FLAG_GROUP_MEMBER)) {
+        candidates &= candidates - 1;
+        continue;
+      }
+      const light_mask_t members =
+          light_registry_group_members(light->group_id);
+      candidates &= ~members;
+      if ((members & groupable) != members) {
+        continue;
+      }
+      unicast &= ~members;
+      if (!light_tx_ready_for(lane, LIGHT_TX_GROUP, count)) {
+        *deferred |= members;
+        continue;
+      }
+      esp_zb_zcl_basic_cmd_t zcl_basic_cmd = {
+          .dst_addr_u.addr_short = light->group_id,
+          .src_endpoint = GATEWAY_ENDPOINT,
+      };
+      for (uint8_t i = 0; i < count; ++i) {
+        const uint8_t tsn =
+            light_cmd_issue(&cmds[i], &zcl_basic_cmd,
+                            ESP_ZB_APS_ADDR_MODE_16_GROUP_ENDP_NOT_PRESENT);
+        light_tx_sent(lane, LIGHT_TX_GROUP, tsn);
+        light_latency_groupcast(cmds[i].type);
+      }
+      groupcast |= members;
+    }
+  }
+  uint8_t index;
+  LIGHT_MASK_FOR_EACH(index, unicast) {
+    if (!light_tx_ready_for(lane, index, count)) {
+      *deferred |= LIGHT_MASK(index);
+      continue;
+    }
+    esp_zb_zcl_basic_cmd_t zcl_basic_cmd;
+    light_cmd_addr(&zcl_basic_cmd, light_registry_get(index));
+    for (uint8_t i = 0; i < count; ++i) {
+      const uint8_t tsn = light_cmd_issue(&cmds[i], &zcl_basic_cmd,
+                                          ESP_ZB_APS_ADDR_MODE_16_ENDP_PRESENT);
+      light_tx_sent(lane, index, tsn);
+      light_latency_sent(index, cmds[i].type, tsn, cmds[i].origin_us);
+    }
+  }
+  return groupcast;
+}
+
+/* Send one mailbox command to its target lights, see light_cmd_send_writes() */
+static light_mask_t light_cmd_send(const light_cmd_t *cmd,
+                                   light_mask_t *deferred) {
+  return light_cmd_send_writes(cmd, 1, deferred);
+}
+
+/*
+ * origin_us: the input that caused a command, 0 for none (see light_cmd_t).
+ * Setters return false when the mailbox was full and the command dropped.
+ */
+static bool set_level(light_mask_t targets, const uint8_t level,
+                      int64_t origin_us) {
+  light_cmd_t cmd = {
+      .type = LIGHT_CMD_LEVEL,
+      .targets = targets,
+      .origin_us = origin_us,
+      .transition_time = LIGHT_CMD_TRANSITION_DEFAULT,
+      .level = level,
+  };
+  return light_command_post(&cmd);
+}
+
+/* Start moving the level, until stop_level() or the end of the range */
+static void move_level(light_mask_t targets, uint8_t mode, uint8_t rate,
+                       int64_t origin_us) {
+  light_cmd_t cmd = {
+      .type = LIGHT_CMD_MOVE_LEVEL,
+      .targets = targets,
+      .origin_us = origin_us,
+      .move = {.mode = mode, .rate = rate},
+  };
+  light_command_post(&cmd);
+}
+
+static void step_level(light_mask_t targets, uint8_t mode, uint8_t size,
+                       int64_t origin_us) {
+  light_cmd_t cmd = {
+      .type = LIGHT_CMD_STEP_LEVEL,
+      .targets = targets,
+      .origin_us = origin_us,
+      .transition_time = BUTTON_LEVEL_STEP_TIME,
+      .step = {.mode = mode, .size = size},
+  };
+  light_command_post(&cmd);
+}
+
+static void stop_level(light_mask_t targets, int64_t origin_us) {
+  light_cmd_t cmd = {
+      .type = LIGHT_CMD_STOP_LEVEL,
+      .targets = targets,
+      .origin_us = origin_us,
+  };
+  light_command_post(&cmd);
+}
+
+static bool set_color_xy(light_mask_t targets, uint16_t x, uint16_t y,
+                         int64_t origin_us) {
+  light_cmd_t cmd = {
+      .type = LIGHT_CMD_COLOR_XY,
+      .targets = targets,
+      .origin_us = origin_us,
+      .transition_time = LIGHT_CMD_TRANSITION_DEFAULT,
+      .xy = {.x = x, .y = y},
+  };
+  return light_command_post(&cmd);
+}
 
-  cmd.transition_time = 0xffff;
-  esp_zb_lock_acquire(portMAX_DELAY);
-  esp_zb_zcl_color_move_to_color_cmd_req(&cmd);
-  esp_zb_lock_release();
+static bool recall_preset(light_mask_t targets, uint8_t preset,
+                          int64_t origin_us) {
+  light_cmd_t cmd = {
+      .type = LIGHT_CMD_RECALL_SCENE,
+      .targets = targets,
+      .origin_us = origin_us,
+      .transition_time = LIGHT_CMD_TRANSITION_DEFAULT,
+      .preset = preset,
+  };
+  return light_command_post(&cmd);
 }
 
-static void set_cold() {
-  esp_zb_zcl_color_move_to_color_cmd_t cmd;
-  cmd.color_x = 1000;
-  cmd.color_y = 1000;
+static void read_attrs(light_mask_t targets, uint16_t cluster_id,
+                       const uint16_t *attributes, uint8_t attr_number) {
+  light_cmd_t cmd = {
+      .type = LIGHT_CMD_READ_ATTRS,
+      .targets = targets,
+      .read = {.cluster_id = cluster_id, .count = attr_number},
+  };
+  if (attr_number > LIGHT_CMD_MAX_READ_ATTRS) {
+    ESP_LOGW(TAG, "Reading only the first %d of %d attributes",
+             LIGHT_CMD_MAX_READ_ATTRS, attr_number);
+    cmd.read.count = LIGHT_CMD_MAX_READ_ATTRS;
+  }
+  memcpy(cmd.read.ids, attributes, cmd.read.count * sizeof(uint16_t));
+  light_command_post(&cmd);
+}
 
-  cmd.transition_time = 0xffff;
-  esp_zb_lock_acquire(portMAX_DELAY);
-  esp_zb_zcl_color_move_to_color_cmd_req(&cmd);
-  esp_zb_lock_release();
+static void request_capabilities(light_mask_t targets) {
+  uint16_t attributes[] = {ESP_ZB_ZCL_ATTR_COLOR_CONTROL_COLOR_CAPABILITIES_ID};
+  read_attrs(targets, ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL, attributes,
+             sizeof(attributes) / sizeof(uint16_t));
 }
 
 /*
-static void set_warm() {
-  static int counter = 1;
-
-  esp_zb_zcl_color_move_to_color_temperature_cmd_t cmd;
-
-  cmd.zcl_basic_cmd.src_endpoint = GATEWAY_ENDPOINT;
-  cmd.address_mode = ESP_ZB_APS_ADDR_MODE_DST_ADDR_ENDP_NOT_PRESENT;
-  const uint16_t temp = (counter % 32) * 2 * 1000;
-  printf("temp: %d\n", temp);
-  cmd.color_temperature = temp;
-  cmd.transition_time = 0xffff;
-  esp_zb_lock_acquire(portMAX_DELAY);
-  esp_zb_zcl_color_move_to_color_temperature_cmd_req(&cmd);
-  esp_zb_lock_release();
-
-  counter++;
-}
-*/
-
-static void set_warm() {
-  esp_zb_color_move_to_hue_saturation_cmd_t cmd;
-
-  cmd.zcl_basic_cmd.src_endpoint = GATEWAY_ENDPOINT;
-  cmd.address_mode = ESP_ZB_APS_ADDR_MODE_DST_ADDR_ENDP_NOT_PRESENT;
-  cmd.hue = 20;
-  cmd.saturation = 132;
-  cmd.transition_time = 0xffff;
-  esp_zb_lock_acquire(portMAX_DELAY);
-  esp_zb_zcl_color_move_to_hue_and_saturation_cmd_req(&cmd);
-  esp_zb_lock_release();
-}
-
-static void request_color_attrs(const light_bulb_device_params_t *light) {
-  ESP_LOGI(TAG, "Requesting color attributes");
-  esp_zb_zcl_read_attr_cmd_t read_req;
-  uint16_t attributes[] = {ESP_ZB_ZCL_ATTR_COLOR_CONTROL_COLOR_CAPABILITIES_ID,
-                           ESP_ZB_ZCL_ATTR_COLOR_CONTROL_CURRENT_HUE_ID,
-                           ESP_ZB_ZCL_ATTR_COLOR_CONTROL_CURRENT_SATURATION_ID,
-                           ESP_ZB_ZCL_ATTR_COLOR_CONTROL_CURRENT_X_ID,
-                           ESP_ZB_ZCL_ATTR_COLOR_CONTROL_CURRENT_Y_ID,
-                           ESP_ZB_ZCL_ATTR_COLOR_CONTROL_COLOR_LOOP_ACTIVE_ID};
-  read_req.address_mode = ESP_ZB_APS_ADDR_MODE_16_ENDP_PRESENT;
-  read_req.attr_number = sizeof(attributes) / sizeof(uint16_t);
-  read_req.attr_field = attributes;
-  read_req.clusterID = ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL;
-  read_req.zcl_basic_cmd.dst_endpoint = light->endpoint;
-  read_req.zcl_basic_cmd.src_endpoint = GATEWAY_ENDPOINT;
-
-  read_req.zcl_basic_cmd.dst_addr_u.addr_short = light->short_addr;
-  esp_zb_zcl_read_attr_cmd_req(&read_req);
-}
-
-static void set_hue() {
-  static uint16_t hue = 1;
-  static uint8_t dir = 1;
-  esp_zb_zcl_color_enhanced_move_to_hue_cmd_t cmd;
-
-  cmd.zcl_basic_cmd.src_endpoint = GATEWAY_ENDPOINT;
-  cmd.address_mode = ESP_ZB_APS_ADDR_MODE_DST_ADDR_ENDP_NOT_PRESENT;
-  cmd.enhanced_hue = hue;
-  cmd.direction = dir;
-  cmd.transition_time = 0xffff;
-  esp_zb_lock_acquire(portMAX_DELAY);
-  esp_zb_zcl_color_enhanced_move_to_hue_cmd_req(&cmd);
-  esp_zb_lock_release();
-  dir += 10;
-  hue += 1000;
-  printf("hue: %d\n", hue);
-  printf("dir: %d\n", dir);
-  if (global_light != 0) {
-    request_color_attrs(global_light);
-  }
-}
-
-static void zb_buttons_handler(switch_func_pair_t *button_func_pair) {
+ * Dimming button: a press steps, a double press goes to the end of the range
+ * (off when dimming down), a hold moves until released, so a dimming gesture
+ * of any length costs two frames.
+ */
+static void dim_gesture(light_mask_t targets, uint8_t mode,
+                        switch_gesture_t gesture, int64_t origin_us) {
+  switch (gesture) {
+  case SWITCH_GESTURE_PRESS:
+    step_level(targets, mode, BUTTON_LEVEL_STEP, origin_us);
+    break;
+  case SWITCH_GESTURE_DOUBLE_PRESS:
+    set_level(targets, mode == LIGHT_LEVEL_UP ? 254 : 1, origin_us);
+    break;
+  case SWITCH_GESTURE_HOLD:
+    move_level(targets, mode, BUTTON_LEVEL_MOVE_RATE, origin_us);
+    break;
+  case SWITCH_GESTURE_HOLD_RELEASE:
+    stop_level(targets, origin_us);
+    break;
+  default:
+    break;
+  }
+}
+
+static void zb_buttons_handler(switch_func_pair_t *button_func_pair,
+                               switch_gesture_t gesture) {
   static unsigned int toggle = 0;
-  if (button_func_pair->func == SWITCH_ONOFF_TOGGLE_CONTROL) {
-    if (toggle % 2 == 0) {
-    // set_warm();
-    // set_hue();
-    set_cold();
-    // cycle_level();
-    // set_level(254);
-    } else {
-      cycle_level();
-    }
+  /* latency is measured from the edge that decided the gesture */
+  const int64_t origin_us = switch_driver_decided_us();
+  switch (button_func_pair->func) {
+  case SWITCH_ONOFF_TOGGLE_CONTROL:
+    recall_preset(LIGHT_MASK_ALL, toggle % light_scene_count(), origin_us);
     ++toggle;
+    break;
+  case SWITCH_LEVEL_UP_CONTROL:
+    dim_gesture(LIGHT_MASK_ALL, LIGHT_LEVEL_UP, gesture, origin_us);
+    break;
+  case SWITCH_LEVEL_DOWN_CONTROL:
+    dim_gesture(LIGHT_MASK_ALL, LIGHT_LEVEL_DOWN, gesture, origin_us);
+    break;
+  default:
+    break;
+  }
+}
+
+/* Serial protocol records, posted from the serial task */
+static bool serial_record_handler(const lamp_proto_record_t *record,
+                                  light_mask_t targets, int64_t origin_us) {
+  uint16_t x, y;
+  switch (record->op) {
+  case LAMP_PROTO_OP_LEVEL:
+    return set_level(targets, record->level, origin_us);
+  case LAMP_PROTO_OP_RGB:
+    light_color_rgb_to_xy(record->rgb[0], record->rgb[1], record->rgb[2], &x,
+                          &y);
+    return set_color_xy(targets, x, y, origin_us);
+  case LAMP_PROTO_OP_XY:
+    return set_color_xy(targets, record->x, record->y, origin_us);
+  case LAMP_PROTO_OP_MIREDS:
+    light_color_mireds_to_xy(record->mireds, &x, &y);
+    return set_color_xy(targets, x, y, origin_us);
+  case LAMP_PROTO_OP_PRESET:
+    return recall_preset(targets, record->preset, origin_us);
+  default:
+    return true;
   }
 }
 
@@ -205,92 +525,70 @@ static void bdb_start_top_level_commissioning_cb(uint8_t mode_mask) {
                       , TAG, "Failed to start Zigbee bdb commissioning");
 }
 
-static void bind_cb(esp_zb_zdp_status_t zdo_status, void *user_ctx) {
-  if (zdo_status == ESP_ZB_ZDP_STATUS_SUCCESS) {
-    ESP_LOGI(TAG, "Bound successfully!");
-    if (user_ctx) {
-      light_bulb_device_params_t *light =
-          (light_bulb_device_params_t *)user_ctx;
-      ESP_LOGI(TAG, "The light originating from address(0x%x) on endpoint(%d)",
-               light->short_addr, light->endpoint);
-      free(light);
-    }
+/* lights whose add group waits for room in the maintenance lane */
+static light_mask_t s_group_joins;
+
+static void join_group_resume_cb(uint8_t param);
+
+/* Ask a light to join LAMP_GROUP_ID, the answer arrives as an operate group response */
+static void join_group(uint8_t index) {
+  light_bulb_device_params_t *light = light_registry_get(index);
+  if (!light ||
+      (light->flags & (LIGHT_FLAG_GROUP_MEMBER | LIGHT_FLAG_GROUP_REJECTED))) {
+    return;
   }
+  if (!light_tx_ready(LIGHT_TX_MAINTENANCE, index)) {
+    s_group_joins |= LIGHT_MASK(index);
+    light_tx_defer(LIGHT_TX_MAINTENANCE, join_group_resume_cb, 0);
+    return;
+  }
+  esp_zb_zcl_groups_add_group_cmd_t req = {
+      .address_mode = ESP_ZB_APS_ADDR_MODE_16_ENDP_PRESENT,
+      .group_id = LAMP_GROUP_ID,
+  };
+  light_cmd_addr(&req.zcl_basic_cmd, light);
+  light->group_id = LAMP_GROUP_ID;
+  const uint8_t tsn = esp_zb_zcl_groups_add_group_cmd_req(&req);
+  lamp_trace_zcl_request(ESP_ZB_ZCL_CLUSTER_ID_GROUPS,
+                         ESP_ZB_ZCL_CMD_GROUPS_ADD_GROUP, &req.zcl_basic_cmd,
+                         req.address_mode, tsn, req.group_id);
+  /* group id and an empty group name */
+  light_link_sent(ESP_ZB_ZCL_CLUSTER_ID_GROUPS, &req.zcl_basic_cmd,
+                  req.address_mode, tsn, 3);
+  light_tx_sent(LIGHT_TX_MAINTENANCE, index, tsn);
 }
 
-static void request_version(const light_bulb_device_params_t *light) {
-  ESP_LOGI(TAG, "Requesting current level");
-  esp_zb_zcl_read_attr_cmd_t read_req;
-  uint16_t attributes[] = {ESP_ZB_ZCL_ATTR_OTA_UPGRADE_FILE_VERSION_ID};
-  read_req.address_mode = ESP_ZB_APS_ADDR_MODE_16_ENDP_PRESENT;
-  read_req.attr_number = sizeof(attributes) / sizeof(uint16_t);
-  read_req.attr_field = attributes;
-  read_req.clusterID = ESP_ZB_ZCL_CLUSTER_ID_OTA_UPGRADE;
-  read_req.zcl_basic_cmd.dst_endpoint = light->endpoint;
-  read_req.zcl_basic_cmd.src_endpoint = GATEWAY_ENDPOINT;
-
-  read_req.zcl_basic_cmd.dst_addr_u.addr_short = light->short_addr;
-  esp_zb_zcl_read_attr_cmd_req(&read_req);
-}
-
-static void request_level(const light_bulb_device_params_t *light) {
-  ESP_LOGI(TAG, "Requesting current level");
-  esp_zb_zcl_read_attr_cmd_t read_req;
-  uint16_t attributes[] = {ESP_ZB_ZCL_ATTR_LEVEL_CONTROL_CURRENT_LEVEL_ID};
-  read_req.address_mode = ESP_ZB_APS_ADDR_MODE_16_ENDP_PRESENT;
-  read_req.attr_number = sizeof(attributes) / sizeof(uint16_t);
-  read_req.attr_field = attributes;
-  read_req.clusterID = ESP_ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL;
-  read_req.zcl_basic_cmd.dst_endpoint = light->endpoint;
-  read_req.zcl_basic_cmd.src_endpoint = GATEWAY_ENDPOINT;
-
-  read_req.zcl_basic_cmd.dst_addr_u.addr_short = light->short_addr;
-  esp_zb_zcl_read_attr_cmd_req(&read_req);
-}
-
-static void user_find_cb(esp_zb_zdp_status_t zdo_status, uint16_t addr,
-                         uint8_t endpoint, void *user_ctx) {
-  if (zdo_status == ESP_ZB_ZDP_STATUS_SUCCESS) {
-    ESP_LOGI(TAG, "Found dimmable light");
-    esp_zb_zdo_bind_req_param_t bind_req;
-    global_light = (light_bulb_device_params_t *)malloc(
-        sizeof(light_bulb_device_params_t));
-    global_light->endpoint = endpoint;
-    global_light->short_addr = addr;
-    esp_zb_ieee_address_by_short(global_light->short_addr,
-                                 global_light->ieee_addr);
-    esp_zb_get_long_address(bind_req.src_address);
-    bind_req.src_endp = GATEWAY_ENDPOINT;
-    bind_req.cluster_id = ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL;
-    bind_req.dst_addr_mode = ESP_ZB_ZDO_BIND_DST_ADDR_MODE_64_BIT_EXTENDED;
-    memcpy(bind_req.dst_address_u.addr_long, global_light->ieee_addr,
-           sizeof(esp_zb_ieee_addr_t));
-    bind_req.dst_endp = endpoint;
-    bind_req.req_dst_addr =
-        esp_zb_get_short_address(); /* TODO: Send bind request to self */
-    ESP_LOGI(TAG, "Try to bind color control");
-    esp_zb_zdo_device_bind_req(&bind_req, bind_cb, NULL);
-    bind_req.cluster_id = ESP_ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL;
-    ESP_LOGI(TAG, "Try to bind level control");
-    esp_zb_zdo_device_bind_req(&bind_req, bind_cb, (void *)global_light);
-
-    // request_version(global_light);
-    // request_level(global_light);
-    // request_color_attrs(global_light);
-    // set_hue();
-    // set_cold();
-    // set_color_xy(50, 60);
-    // set_warm();
-    // set_level(254);
+static void join_group_resume_cb(uint8_t param) {
+  const light_mask_t joins = s_group_joins;
+  s_group_joins = 0;
+  uint8_t index;
+  LIGHT_MASK_FOR_EACH(index, joins) { join_group(index); }
+}
+
+/* Configure stage of onboarding: everything a matched and bound light is set up with */
+static void configure_light(uint8_t index) {
+  light_bulb_device_params_t *light = light_registry_get(index);
+  if (!light) {
+    light_onboard_configured(index);
+    return;
   }
+  /* group membership also lives in the light and survives its reboots */
+  join_group(index);
+  light_scene_program(index);
+  if (light->color_capabilities == LIGHT_CAPABILITIES_UNKNOWN) {
+    request_capabilities(LIGHT_MASK(index));
+  }
+  /* ends the stage once the light reports */
+  light_report_configure(index);
 }
 
-void esp_zb_app_signal_handler(esp_zb_app_signal_t *signal_struct) {
+static void zb_app_signal_handler(esp_zb_app_signal_t *signal_struct) {
   uint32_t *p_sg_p = signal_struct->p_app_signal;
   esp_err_t err_status = signal_struct->esp_err_status;
   esp_zb_app_signal_type_t sig_type = *p_sg_p;
   esp_zb_zdo_signal_device_annce_params_t *dev_annce_params = NULL;
 
+  lamp_trace_signal(signal_struct);
   switch (sig_type) {
   case ESP_ZB_ZDO_SIGNAL_SKIP_STARTUP:
 #if CONFIG_EXAMPLE_CONNECT_WIFI
@@ -311,19 +609,33 @@ void esp_zb_app_signal_handler(esp_zb_app_signal_t *signal_struct) {
   case ESP_ZB_BDB_SIGNAL_DEVICE_FIRST_START:
   case ESP_ZB_BDB_SIGNAL_DEVICE_REBOOT:
     if (err_status == ESP_OK) {
+      light_command_start();
+      light_link_start();
       ESP_LOGI(TAG, "Deferred driver initialization %s",
                deferred_driver_init() ? "failed" : "successful");
       ESP_LOGI(TAG, "Device started up in %s factory-reset mode",
                esp_zb_bdb_is_factory_new() ? "" : "non");
 
       if (esp_zb_bdb_is_factory_new()) {
+        /* a new network invalidates every stored light */
+        if (light_registry_count()) {
+          light_registry_init();
+          light_attr_init();
+          light_latency_init();
+          light_link_init();
+          light_store_save();
+        }
         ESP_LOGI(TAG, "Start network formation");
         esp_zb_bdb_start_top_level_commissioning(
             ESP_ZB_BDB_MODE_NETWORK_FORMATION);
       } else {
         esp_zb_bdb_open_network(180);
-        ESP_LOGI(TAG, "Device rebooted");
+        ESP_LOGI(TAG, "Device rebooted, revalidating %d stored lights",
+                 light_registry_count());
+        light_onboard_revalidate();
       }
+      /* stack and drivers are up: from here on the application runs on its static pools */
+      lamp_mem_seal();
     } else {
       ESP_LOGE(TAG, "Failed to initialize Zigbee stack (status: %s)",
                esp_err_to_name(err_status));
@@ -362,11 +674,8 @@ void esp_zb_app_signal_handler(esp_zb_app_signal_t *signal_struct) {
             p_sg_p);
     ESP_LOGI(TAG, "New device commissioned or rejoined (short: 0x%04hx)",
              dev_annce_params->device_short_addr);
-    /* find color dimmable light once device joining the network */
-    esp_zb_zdo_match_desc_req_param_t cmd_req;
-    cmd_req.dst_nwk_addr = dev_annce_params->device_short_addr;
-    cmd_req.addr_of_interest = dev_annce_params->device_short_addr;
-    esp_zb_zdo_find_color_dimmable_light(&cmd_req, user_find_cb, NULL);
+    /* match, bind and configure it, or only configure a known light */
+    light_onboard_announced(dev_annce_params);
     break;
   case ESP_ZB_NWK_SIGNAL_PERMIT_JOIN_STATUS:
     if (err_status == ESP_OK) {
@@ -395,120 +704,142 @@ void esp_zb_app_signal_handler(esp_zb_app_signal_t *signal_struct) {
     }
     break;
   default:
-    ESP_LOGI(TAG, "ZDO signal: %s (0x%x), status: %s",
-             esp_zb_zdo_signal_to_string(sig_type), sig_type,
-             esp_err_to_name(err_status));
+    /* network status indications and the like arrive all the time */
+    LAMP_LOGI(ZDO_SIGNAL, sig_type, err_status);
     break;
   }
 }
 
+void esp_zb_app_signal_handler(esp_zb_app_signal_t *signal_struct) {
+  /* the stack's main loop may allocate, the application may not */
+  const uint8_t mem = lamp_mem_steady_begin();
+  zb_app_signal_handler(signal_struct);
+  lamp_mem_steady_end(mem);
+}
+
 static esp_err_t zb_attribute_reporting_handler(
     const esp_zb_zcl_report_attr_message_t *message) {
   ESP_RETURN_ON_FALSE(message, ESP_FAIL, TAG, "Empty message");
   ESP_RETURN_ON_FALSE(message->status == ESP_ZB_ZCL_STATUS_SUCCESS,
                       ESP_ERR_INVALID_ARG, TAG,
                       "Received message: error status(%d)", message->status);
-  ESP_LOGI(TAG,
-           "Received report from address(0x%x) src endpoint(%d) to dst "
-           "endpoint(%d) cluster(0x%x)",
-           message->src_address.u.short_addr, message->src_endpoint,
-           message->dst_endpoint, message->cluster);
-  ESP_LOGI(
-      TAG,
-      "Received report information: attribute(0x%x), type(0x%x), value(%d)\n",
-      message->attribute.id, message->attribute.data.type,
-      message->attribute.data.value ? *(uint8_t *)message->attribute.data.value
-                                    : 0);
-  return ESP_OK;
+  LAMP_LOGI(REPORT_RX, message->src_address.u.short_addr,
+            message->src_endpoint, message->dst_endpoint, message->cluster);
+  const uint8_t index =
+      light_registry_find_short(message->src_address.u.short_addr);
+  light_report_heard(index);
+  return light_attr_update(index, message->cluster, &message->attribute);
 }
 
 static esp_err_t zb_read_attr_resp_handler(
     const esp_zb_zcl_cmd_read_attr_resp_message_t *message) {
   ESP_RETURN_ON_FALSE(message, ESP_FAIL, TAG, "Empty message");
+  const uint8_t index =
+      light_registry_find_short(message->info.src_address.u.short_addr);
+  light_latency_answered(index, message->info.header.tsn,
+                         message->info.status);
   ESP_RETURN_ON_FALSE(
       message->info.status == ESP_ZB_ZCL_STATUS_SUCCESS, ESP_ERR_INVALID_ARG,
       TAG, "Received message: error status(%d)", message->info.status);
 
   esp_zb_zcl_read_attr_resp_variable_t *variable = message->variables;
   while (variable) {
-    ESP_LOGI(TAG,
-             "Read attribute response: status(0x%x), cluster(0x%x), "
-             "attribute(0x%x), type(0x%x), value(%d)",
-             variable->status, message->info.cluster, variable->attribute.id,
-             variable->attribute.data.type,
-             variable->attribute.data.value
-                 ? *(uint8_t *)variable->attribute.data.value
-                 : 0);
-
-    const uint16_t cluster = message->info.cluster;
-    const uint16_t attribute = variable->attribute.id;
-    const uint16_t status = variable->status;
-
-    if (status == 0) {
-      if (cluster == ESP_ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL) {
-        if (attribute == ESP_ZB_ZCL_ATTR_LEVEL_CONTROL_CURRENT_LEVEL_ID) {
-          ESP_LOGI(TAG, "Current level: %d",
-                   variable->attribute.data.value
-                       ? *(uint8_t *)variable->attribute.data.value
-                       : 0);
-        }
-      } else if (cluster == ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL) {
-        const uint16_t val = variable->attribute.data.value
-                                 ? *(uint8_t *)variable->attribute.data.value
-                                 : 0;
-
-        switch (attribute) {
-        case ESP_ZB_ZCL_ATTR_COLOR_CONTROL_COLOR_CAPABILITIES_ID:
-          ESP_LOGI(TAG, "Color capabilities: 0x%x", val);
-          break;
-        case ESP_ZB_ZCL_ATTR_COLOR_CONTROL_CURRENT_SATURATION_ID:
-          ESP_LOGI(TAG, "Current saturation: %d", val);
-          break;
-        case ESP_ZB_ZCL_ATTR_COLOR_CONTROL_CURRENT_HUE_ID:
-          ESP_LOGI(TAG, "Current hue: %d", val);
-          break;
-        case ESP_ZB_ZCL_ATTR_COLOR_CONTROL_COLOR_LOOP_ACTIVE_ID:
-          ESP_LOGI(TAG, "Color loop active: %d", val);
-          break;
-        case ESP_ZB_ZCL_ATTR_COLOR_CONTROL_CURRENT_X_ID:
-          ESP_LOGI(TAG, "Color X: %d", val);
-          break;
-        case ESP_ZB_ZCL_ATTR_COLOR_CONTROL_CURRENT_Y_ID:
-          ESP_LOGI(TAG, "Color Y: %d", val);
-          break;
-        default:
-        }
-      }
+    if (variable->status != ESP_ZB_ZCL_STATUS_SUCCESS) {
+      LAMP_LOGI(READ_ATTR_STATUS, variable->status, message->info.cluster,
+                variable->attribute.id);
+    } else {
+      light_attr_update(index, message->info.cluster, &variable->attribute);
     }
-
     variable = variable->next;
   }
 
+  /* color capabilities decide which color commands a light accepts */
+  light_bulb_device_params_t *light = light_registry_get(index);
+  uint32_t capabilities;
+  if (light &&
+      light_attr_get(index, LIGHT_ATTR_COLOR_CAPABILITIES, &capabilities) &&
+      light->color_capabilities != capabilities) {
+    ESP_LOGI(TAG, "Color capabilities: 0x%x", (unsigned)capabilities);
+    light->color_capabilities = (uint16_t)capabilities;
+    light_store_schedule_save();
+  }
+
   return ESP_OK;
 }
 
 static esp_err_t zb_configure_report_resp_handler(
     const esp_zb_zcl_cmd_config_report_resp_message_t *message) {
   ESP_RETURN_ON_FALSE(message, ESP_FAIL, TAG, "Empty message");
-  ESP_RETURN_ON_FALSE(
-      message->info.status == ESP_ZB_ZCL_STATUS_SUCCESS, ESP_ERR_INVALID_ARG,
-      TAG, "Received message: error status(%d)", message->info.status);
+  if (message->info.status != ESP_ZB_ZCL_STATUS_SUCCESS) {
+    ESP_LOGW(TAG, "Received message: error status(%d)", message->info.status);
+  }
 
   esp_zb_zcl_config_report_resp_variable_t *variable = message->variables;
   while (variable) {
-    ESP_LOGI(
-        TAG,
-        "Configure report response: status(%d), cluster(0x%x), attribute(0x%x)",
-        message->info.status, message->info.cluster, variable->attribute_id);
+    LAMP_LOGI(CONFIG_REPORT_STATUS, variable->status, message->info.cluster,
+              variable->attribute_id);
     variable = variable->next;
   }
 
+  /* failures still tell the light which attributes it will not report */
+  return light_report_resp_handler(message);
+}
+
+static esp_err_t zb_default_resp_handler(
+    const esp_zb_zcl_cmd_default_resp_message_t *message) {
+  ESP_RETURN_ON_FALSE(message, ESP_FAIL, TAG, "Empty message");
+  LAMP_LOGI(DEFAULT_RESP, message->info.cluster, message->resp_to_cmd,
+            message->status_code);
+  const uint8_t index =
+      light_registry_find_short(message->info.src_address.u.short_addr);
+  light_latency_answered(index, message->info.header.tsn,
+                         message->status_code);
+  /* release the next coalesced value for this light */
+  light_command_complete(index, message->info.cluster);
+  light_attr_confirm(index, message->info.cluster, message->status_code);
+  if (message->info.cluster == ESP_ZB_ZCL_CLUSTER_ID_SCENES &&
+      message->resp_to_cmd == ESP_ZB_ZCL_CMD_SCENES_RECALL_SCENE) {
+    light_scene_recall_done(index, message->status_code);
+    if (message->status_code != ESP_ZB_ZCL_STATUS_SUCCESS &&
+        light_registry_get(index)) {
+      /* the light no longer holds the preset, replay it as direct writes */
+      light_latency_retry(index, LIGHT_CMD_RECALL_SCENE);
+      recall_preset(LIGHT_MASK(index), s_recalled[index], 0);
+    }
+  }
+  return ESP_OK;
+}
+
+static esp_err_t zb_group_resp_handler(
+    const esp_zb_zcl_groups_operate_group_resp_message_t *message) {
+  ESP_RETURN_ON_FALSE(message, ESP_FAIL, TAG, "Empty message");
+  light_bulb_device_params_t *light = light_registry_get(
+      light_registry_find_short(message->info.src_address.u.short_addr));
+  if (!light || message->group_id != light->group_id) {
+    return ESP_OK;
+  }
+  if (message->info.status == ESP_ZB_ZCL_STATUS_SUCCESS ||
+      message->info.status == ESP_ZB_ZCL_STATUS_DUPE_EXISTS) {
+    ESP_LOGI(TAG, "Light 0x%04hx joined group 0x%04hx",
+             light->short_addr, message->group_id);
+    light->flags |= LIGHT_FLAG_GROUP_MEMBER;
+  } else {
+    ESP_LOGW(TAG,
+             "Light 0x%04hx rejected group 0x%04hx (status: 0x%x), falls "
+             "back to unicast",
+             light->short_addr, message->group_id, message->info.status);
+    light->flags |= LIGHT_FLAG_GROUP_REJECTED;
+  }
+  light_store_schedule_save();
   return ESP_OK;
 }
 
 static esp_err_t zb_action_handler(esp_zb_core_action_callback_id_t callback_id,
                                    const void *message) {
   esp_err_t ret = ESP_OK;
+  const uint8_t mem = lamp_mem_steady_begin();
+  lamp_trace_action(callback_id, message);
+  light_link_received(callback_id, message);
   switch (callback_id) {
   case ESP_ZB_CORE_REPORT_ATTR_CB_ID:
     ret = zb_attribute_reporting_handler(
@@ -518,21 +849,45 @@ static esp_err_t zb_action_handler(esp_zb_core_action_callback_id_t callback_id,
     ret = zb_read_attr_resp_handler(
         (esp_zb_zcl_cmd_read_attr_resp_message_t *)message);
     break;
+  case ESP_ZB_CORE_CMD_REPORT_CONFIG_RESP_CB_ID:
+    ret = zb_configure_report_resp_handler(
+        (esp_zb_zcl_cmd_config_report_resp_message_t *)message);
+    break;
   case ESP_ZB_CORE_CMD_DEFAULT_RESP_CB_ID:
-    ESP_LOGI(TAG, "Received default response");
+    ret = zb_default_resp_handler(
+        (esp_zb_zcl_cmd_default_resp_message_t *)message);
+    break;
+  case ESP_ZB_CORE_CMD_OPERATE_SCENE_RESP_CB_ID:
+    ret = light_scene_resp_handler(
+        (esp_zb_zcl_scenes_operate_scene_resp_message_t *)message);
+    break;
+  case ESP_ZB_CORE_CMD_OPERATE_GROUP_RESP_CB_ID:
+    ret = zb_group_resp_handler(
+        (esp_zb_zcl_groups_operate_group_resp_message_t *)message);
     break;
   default:
     ESP_LOGW(TAG, "Receive Zigbee action(0x%x) callback", callback_id);
     break;
   }
+  lamp_mem_steady_end(mem);
   return ret;
 }
 
+static void zb_send_status_handler(
+    esp_zb_zcl_command_send_status_message_t message) {
+  const uint8_t mem = lamp_mem_steady_begin();
+  lamp_trace_send_status(&message);
+  light_link_send_status(&message);
+  light_tx_send_status(&message);
+  lamp_mem_steady_end(mem);
+}
+
 static void esp_zb_task(void *pvParameters) {
   /* initialize Zigbee stack */
   esp_zb_cfg_t zb_nwk_cfg = ESP_ZB_ZC_CONFIG();
   esp_zb_init(&zb_nwk_cfg);
   esp_zb_core_action_handler_register(zb_action_handler);
+  esp_zb_zcl_command_send_status_handler_register(zb_send_status_handler);
   esp_zb_set_primary_network_channel_set(ESP_ZB_PRIMARY_CHANNEL_MASK);
   esp_zb_ep_list_t *ep_list = esp_zb_ep_list_create();
   esp_zb_cluster_list_t *cluster_list = esp_zb_zcl_cluster_list_create();
@@ -558,7 +913,11 @@ static void esp_zb_task(void *pvParameters) {
   esp_zb_ep_list_add_gateway_ep(ep_list, cluster_list, endpoint_config);
   esp_zb_device_register(ep_list);
   ESP_ERROR_CHECK(esp_zb_start(false));
+  /* esp-zigbee-lib allocates for its own frames and lists: the handlers above
+   * close this scope again for the application's code */
+  lamp_mem_allow_begin();
   esp_zb_stack_main_loop();
+  lamp_mem_allow_end();
   vTaskDelete(NULL);
 }
 
@@ -567,7 +926,37 @@ void app_main(void) {
       .radio_config = ESP_ZB_DEFAULT_RADIO_CONFIG(),
       .host_config = ESP_ZB_DEFAULT_HOST_CONFIG(),
   };
+  lamp_log_init();
+  lamp_trace_init();
   ESP_ERROR_CHECK(nvs_flash_init());
+  light_command_init(light_cmd_send);
+  light_attr_init();
+  light_latency_init();
+  light_link_init();
+  light_tx_init();
+  light_fade_init();
+  light_report_init(GATEWAY_ENDPOINT);
+  light_onboard_init(GATEWAY_ENDPOINT, configure_light);
+  light_scene_init(GATEWAY_ENDPOINT, s_presets,
+                   sizeof(s_presets) / sizeof(s_presets[0]));
+  light_registry_init();
+  if (light_store_load() != ESP_OK) {
+    ESP_LOGW(TAG, "Starting with an empty light table");
+    light_registry_init();
+  }
+  if (light_schedule_init() != ESP_OK) {
+    ESP_LOGI(TAG, "Running without a schedule");
+  }
   ESP_ERROR_CHECK(esp_zb_platform_config(&config));
-  xTaskCreate(esp_zb_task, "Zigbee_main", 4096, NULL, 5, NULL);
+  ESP_ERROR_CHECK(lamp_log_start());
+  TaskHandle_t zb_task = xTaskCreateStatic(
+      esp_zb_task, "Zigbee_main", ZIGBEE_TASK_STACK, NULL, ZIGBEE_TASK_PRIORITY,
+      s_zb_task_stack, &s_zb_task);
+  lamp_mem_add_task(zb_task, ZIGBEE_TASK_STACK, true);
+  if (lamp_console_start() != ESP_OK) {
+    ESP_LOGW(TAG, "Running without a serial console");
+  }
+  if (lamp_serial_start(serial_record_handler) != ESP_OK) {
+    ESP_LOGW(TAG, "Running without serial commands");
+  }
 }
@@ -21,6 +21,18 @@
 #define GATEWAY_ENDPOINT        1          /* esp light switch device endpoint */
 #define ESP_ZB_PRIMARY_CHANNEL_MASK     (1l << 13)  /* Zigbee primary channel mask use in the example */
 
+/* Zigbee task: the stack's main loop runs every handler and callback of the application */
+#define ZIGBEE_TASK_PRIORITY            5
+#define ZIGBEE_TASK_STACK               4096
+
+/* Light table */
+#define LAMP_GROUP_ID                   0x0001      /* ZCL group every light is added to, commands to all lights are groupcast */
+
+/* Dimming buttons */
+#define BUTTON_LEVEL_STEP               32          /* levels per short press */
+#define BUTTON_LEVEL_STEP_TIME          2           /* transition of a step, 1/10 s */
+#define BUTTON_LEVEL_MOVE_RATE          100         /* levels per second while held, bottom to top in 2.5 s */
+
 /* Basic manufacturer information */
 #define ESP_MANUFACTURER_NAME "\x09""ESPRESSIF"      /* Customized manufacturer name */
 #define ESP_MODEL_IDENTIFIER "\x07"CONFIG_IDF_TARGET /* Customized model identifier */
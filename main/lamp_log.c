@@ -0,0 +1,232 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Lamp controller deferred binary logging
+ *
+ * This example code is in the Public Domain (or CC0 licensed, at your option.)
+ *
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include "esp_cpu.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "lamp_log.h"
+#include "lamp_mem.h"
+#include "lamp_ring.h"
+
+/**
+ * @brief:
+ * ESP_LOGx formats its message and writes it to the console in the caller,
+ * so a log line in a Zigbee callback holds up the stack for the formatting
+ * and, once the UART FIFO is full, for the transmission itself. LAMP_LOGx
+ * instead stores the message id and its raw arguments in a fixed-size ring
+ * and returns; a low-priority task formats and prints the records later.
+ *
+ * The records sit in a lamp_ring, the queue behind the command mailbox too:
+ * writers claim a slot with a compare-and-swap and publish it, the log task
+ * is the only reader. A full ring drops the new record rather than waiting,
+ * and the log task prints how many were lost.
+ *
+ * In binary mode the log task prints each record as a hex line instead of
+ * formatting it, and the host decoder (host_sim, lamp_log_decode) turns a
+ * console capture back into text with the same format table.
+ */
+
+_Static_assert((LAMP_LOG_RING_LEN & (LAMP_LOG_RING_LEN - 1)) == 0, "LAMP_LOG_RING_LEN must be a power of two");
+_Static_assert(LAMP_LOG_RING_LEN <= UINT8_MAX, "depth is reported as uint8_t");
+_Static_assert(LAMP_LOG_BENCH_CALLS < LAMP_LOG_RING_LEN / 2, "a bench must fit the ring");
+
+#define RING_MASK       (LAMP_LOG_RING_LEN - 1)
+#define MESSAGE_MAX     160
+
+/* cycles of a loop of LAMP_LOG_BENCH_CALLS to nanoseconds per call */
+#define BENCH_NS(cycles) \
+    ((uint32_t)((uint64_t)(cycles) * 1000 / CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ / LAMP_LOG_BENCH_CALLS))
+
+static const char *TAG = "LAMP_LOG";
+
+static lamp_ring_t s_ring;
+static atomic_uint s_seq[LAMP_LOG_RING_LEN];
+static lamp_log_record_t s_records[LAMP_LOG_RING_LEN];
+static atomic_uint s_written;
+static atomic_uint s_dropped;
+static atomic_bool s_binary;
+static uint32_t s_printed;
+static StackType_t s_task_stack[LAMP_LOG_TASK_STACK];
+static StaticTask_t s_task;
+
+static void lamp_log_print(const lamp_log_record_t *record)
+{
+    if (record->id == LAMP_LOG_ID_BENCH) {
+        return;
+    }
+    s_printed++;
+    if (atomic_load_explicit(&s_binary, memory_order_relaxed)) {
+        char line[LAMP_LOG_HEX_MAX + 1];
+        lamp_log_encode_hex(line, record);
+        printf("%s\n", line);
+        return;
+    }
+    char message[MESSAGE_MAX];
+    if (lamp_log_format(message, sizeof(message), record) < 0) {
+        snprintf(message, sizeof(message), "undecodable record %u", record->id);
+    }
+    const char *tag = lamp_log_tag(record->id);
+    const uint8_t level = record->level <= ESP_LOG_VERBOSE ? record->level : ESP_LOG_VERBOSE;
+    esp_log_write((esp_log_level_t)level, tag ? tag : TAG, "%c (%lu) %s: %s\n", "NEWIDV"[level],
+                  (unsigned long)record->time_ms, tag ? tag : TAG, message);
+}
+
+static bool lamp_log_pop(lamp_log_record_t *record)
+{
+    unsigned pos;
+    if (!lamp_ring_take(&s_ring, &pos)) {
+        return false;
+    }
+    *record = s_records[pos & RING_MASK];
+    lamp_ring_release(&s_ring, pos);
+    return true;
+}
+
+static void lamp_log_task(void *arg)
+{
+    uint32_t reported_drops = 0;
+    for (;;) {
+        lamp_log_record_t record;
+        bool printed = false;
+        while (lamp_log_pop(&record)) {
+            lamp_log_print(&record);
+            printed = true;
+        }
+        const uint32_t dropped = atomic_load_explicit(&s_dropped, memory_order_relaxed);
+        if (dropped != reported_drops) {
+            record = (lamp_log_record_t){
+                .time_ms = esp_log_timestamp(),
+                .id = LAMP_LOG_ID_DROPPED,
+                .level = ESP_LOG_WARN,
+                .argc = LAMP_LOG_ARGC_DROPPED,
+                .args = {dropped - reported_drops},
+            };
+            lamp_log_print(&record);
+            reported_drops = dropped;
+            printed = true;
+        }
+        if (printed) {
+            fflush(stdout);
+        }
+        vTaskDelay(pdMS_TO_TICKS(LAMP_LOG_DRAIN_INTERVAL_MS));
+    }
+}
+
+static void lamp_log_usage(lamp_mem_usage_t *usage)
+{
+    usage->used = lamp_ring_depth(&s_ring);
+    usage->peak = atomic_load(&s_ring.max_depth);
+}
+
+void lamp_log_init(void)
+{
+    lamp_ring_init(&s_ring, s_seq, LAMP_LOG_RING_LEN);
+    atomic_init(&s_written, 0);
+    atomic_init(&s_dropped, 0);
+    s_printed = 0;
+    lamp_mem_add_pool("log ring", LAMP_LOG_RING_LEN, sizeof(lamp_log_record_t) + sizeof(atomic_uint), lamp_log_usage);
+}
+
+esp_err_t lamp_log_start(void)
+{
+    TaskHandle_t task = xTaskCreateStatic(lamp_log_task, "lamp_log", LAMP_LOG_TASK_STACK, NULL,
+                                          LAMP_LOG_TASK_PRIORITY, s_task_stack, &s_task);
+    if (!task) {
+        ESP_LOGE(TAG, "Log task was not created");
+        return ESP_FAIL;
+    }
+    lamp_mem_add_task(task, LAMP_LOG_TASK_STACK, true);
+    return ESP_OK;
+}
+
+void lamp_log_set_binary(bool binary)
+{
+    atomic_store(&s_binary, binary);
+}
+
+void lamp_log_write(uint8_t level, uint16_t id, uint8_t argc, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4)
+{
+#if LAMP_LOG_DEFERRED
+    unsigned pos;
+    if (!lamp_ring_claim(&s_ring, &pos)) {
+        atomic_fetch_add_explicit(&s_dropped, 1, memory_order_relaxed);
+        return;
+    }
+    s_records[pos & RING_MASK] = (lamp_log_record_t){
+        .time_ms = esp_log_timestamp(),
+        .id = id,
+        .level = level,
+        .argc = argc,
+        .args = {a1, a2, a3, a4},
+    };
+    lamp_ring_publish(&s_ring, pos);
+    atomic_fetch_add_explicit(&s_written, 1, memory_order_relaxed);
+#else
+    const lamp_log_record_t record = {
+        .time_ms = esp_log_timestamp(),
+        .id = id,
+        .level = level,
+        .argc = argc,
+        .args = {a1, a2, a3, a4},
+    };
+    atomic_fetch_add_explicit(&s_written, 1, memory_order_relaxed);
+    lamp_log_print(&record);
+#endif
+}
+
+void lamp_log_get_stats(lamp_log_stats_t *stats)
+{
+    stats->written = atomic_load(&s_written);
+    stats->dropped = atomic_load(&s_dropped);
+    stats->printed = s_printed;
+    stats->max_depth = (uint8_t)atomic_load(&s_ring.max_depth);
+}
+
+void lamp_log_bench(lamp_log_bench_t *bench)
+{
+    const lamp_log_record_t record = {
+        .time_ms = esp_log_timestamp(),
+        .id = LAMP_LOG_ID_REPORT_RX,
+        .level = ESP_LOG_INFO,
+        .argc = LAMP_LOG_ARGC_REPORT_RX,
+        .args = {0x1234, 1, 1, 0x0008},
+    };
+    char message[MESSAGE_MAX];
+    volatile int sink = 0;
+
+    uint32_t start = esp_cpu_get_cycle_count();
+    for (unsigned i = 0; i < LAMP_LOG_BENCH_CALLS; ++i) {
+        LAMP_LOGI(BENCH, 0x1234, 1, 1, i);
+    }
+    bench->write_ns = BENCH_NS(esp_cpu_get_cycle_count() - start);
+
+    start = esp_cpu_get_cycle_count();
+    for (unsigned i = 0; i < LAMP_LOG_BENCH_CALLS; ++i) {
+        sink += lamp_log_format(message, sizeof(message), &record);
+    }
+    bench->format_ns = BENCH_NS(esp_cpu_get_cycle_count() - start);
+
+    /* the REPORT_RX message the way ESP_LOGI builds it, minus the console write */
+    start = esp_cpu_get_cycle_count();
+    for (unsigned i = 0; i < LAMP_LOG_BENCH_CALLS; ++i) {
+        sink += snprintf(message, sizeof(message),
+                         "I (%lu) %s: Received report from address(0x%x) src endpoint(%d) to dst endpoint(%d) "
+                         "cluster(0x%x)\n",
+                         (unsigned long)esp_log_timestamp(), "ESP_LAMP_CONTROLLER", 0x1234, 1, 1, 0x0008);
+    }
+    bench->snprintf_ns = BENCH_NS(esp_cpu_get_cycle_count() - start);
+    (void)sink;
+}
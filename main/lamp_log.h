@@ -0,0 +1,114 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Lamp controller deferred binary logging
+ *
+ * This example code is in the Public Domain (or CC0 licensed, at your option.)
+ *
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "lamp_log_format.h"
+#include "sdkconfig.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* 1: LAMP_LOGx only store a record and the log task prints it; 0: print in place like ESP_LOGx */
+#ifndef LAMP_LOG_DEFERRED
+#define LAMP_LOG_DEFERRED           1
+#endif
+
+/* records the ring holds; a full ring drops new records and counts them */
+#define LAMP_LOG_RING_LEN           128
+
+/* the log task empties the ring this often, below the Zigbee task's priority */
+#define LAMP_LOG_DRAIN_INTERVAL_MS  20
+#define LAMP_LOG_TASK_PRIORITY      1
+#define LAMP_LOG_TASK_STACK         3072
+
+/* calls timed by lamp_log_bench(), below half the ring so a bench does not drop */
+#define LAMP_LOG_BENCH_CALLS        48
+
+/* levels above this compile to nothing */
+#ifndef LAMP_LOG_MAXIMUM_LEVEL
+#define LAMP_LOG_MAXIMUM_LEVEL      CONFIG_LOG_MAXIMUM_LEVEL
+#endif
+
+#define LAMP_LOG_NARGS_(a1, a2, a3, a4, a5, n, ...) n
+#define LAMP_LOG_NARGS(...) LAMP_LOG_NARGS_(__VA_ARGS__, 5, 4, 3, 2, 1, 0)
+#define LAMP_LOG_ARGS_(a1, a2, a3, a4, ...) (uint32_t)(a1), (uint32_t)(a2), (uint32_t)(a3), (uint32_t)(a4)
+
+/*
+ * LAMP_LOGx(id, args...) logs message id of LAMP_LOG_FORMATS with one to
+ * LAMP_LOG_MAX_ARGS integer arguments (floats through lamp_log_float()). The
+ * argument count is checked against the table at compile time.
+ */
+#define LAMP_LOG_LEVEL(level, id, ...) do {                                                         \
+        _Static_assert(LAMP_LOG_NARGS(__VA_ARGS__) == LAMP_LOG_ARGC_##id, #id ": wrong argument count"); \
+        if ((level) <= LAMP_LOG_MAXIMUM_LEVEL) {                                                     \
+            lamp_log_write((level), LAMP_LOG_ID_##id, LAMP_LOG_ARGC_##id,                            \
+                           LAMP_LOG_ARGS_(__VA_ARGS__, 0, 0, 0, 0));                                 \
+        }                                                                                            \
+    } while (0)
+
+#define LAMP_LOGE(id, ...) LAMP_LOG_LEVEL(ESP_LOG_ERROR, id, __VA_ARGS__)
+#define LAMP_LOGW(id, ...) LAMP_LOG_LEVEL(ESP_LOG_WARN, id, __VA_ARGS__)
+#define LAMP_LOGI(id, ...) LAMP_LOG_LEVEL(ESP_LOG_INFO, id, __VA_ARGS__)
+#define LAMP_LOGD(id, ...) LAMP_LOG_LEVEL(ESP_LOG_DEBUG, id, __VA_ARGS__)
+
+typedef struct {
+    uint32_t written;
+    uint32_t dropped;           /* ring full */
+    uint32_t printed;           /* records the log task printed */
+    uint8_t max_depth;
+} lamp_log_stats_t;
+
+typedef struct {
+    uint32_t write_ns;          /* LAMP_LOGx into the ring, what the caller pays */
+    uint32_t format_ns;         /* formatting the same record, what the log task pays before the UART */
+    uint32_t snprintf_ns;       /* snprintf of the same message with a timestamp and tag, ESP_LOGx without the UART */
+} lamp_log_bench_t;
+
+/**
+ * @brief Clear the ring, call before anything logs
+ */
+void lamp_log_init(void);
+
+/**
+ * @brief Start the log task that prints the ring
+ */
+esp_err_t lamp_log_start(void);
+
+/**
+ * @brief Print records as hex lines for the host decoder instead of text
+ */
+void lamp_log_set_binary(bool binary);
+
+/**
+ * @brief Store a record, use the LAMP_LOGx macros; safe from any task, not from an ISR
+ */
+void lamp_log_write(uint8_t level, uint16_t id, uint8_t argc, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4);
+
+/**
+ * @brief Get a snapshot of the ring counters
+ */
+void lamp_log_get_stats(lamp_log_stats_t *stats);
+
+/**
+ * @brief Time LAMP_LOG_BENCH_CALLS records against formatting them in place
+ */
+void lamp_log_bench(lamp_log_bench_t *bench);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,219 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Lamp controller binary log records and their formats
+ *
+ * This example code is in the Public Domain (or CC0 licensed, at your option.)
+ *
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "lamp_log_format.h"
+
+/**
+ * @brief:
+ * Plain C without ESP-IDF dependencies: the firmware formats records with it
+ * in its log task, and the host decoder links the same file, so both always
+ * agree on the message table and the record layout.
+ *
+ * A record is formatted one conversion at a time, each handed to snprintf
+ * with the C type its conversion character asks for, which keeps passing
+ * 32-bit arguments well defined whatever the format says.
+ */
+
+#define RECORD_HEADER_BYTES     8
+
+#define LAMP_LOG_ARGC_CHECK(id, tag, argc, format) \
+    _Static_assert(argc <= LAMP_LOG_MAX_ARGS, #id " has more than LAMP_LOG_MAX_ARGS arguments");
+LAMP_LOG_FORMATS(LAMP_LOG_ARGC_CHECK)
+#undef LAMP_LOG_ARGC_CHECK
+
+typedef struct {
+    const char *tag;
+    const char *format;
+    uint8_t argc;
+} lamp_log_format_t;
+
+static const lamp_log_format_t s_formats[LAMP_LOG_ID_COUNT] = {
+#define LAMP_LOG_FORMAT_ENTRY(id, tag, argc, format) [LAMP_LOG_ID_##id] = {tag, format, argc},
+    LAMP_LOG_FORMATS(LAMP_LOG_FORMAT_ENTRY)
+#undef LAMP_LOG_FORMAT_ENTRY
+};
+
+const char *lamp_log_tag(uint16_t id)
+{
+    return id < LAMP_LOG_ID_COUNT ? s_formats[id].tag : NULL;
+}
+
+static float bits_to_float(uint32_t value)
+{
+    union {
+        uint32_t u;
+        float f;
+    } bits = {.u = value};
+    return bits.f;
+}
+
+int lamp_log_format(char *buf, size_t len, const lamp_log_record_t *record)
+{
+    if (record->id >= LAMP_LOG_ID_COUNT || record->argc < s_formats[record->id].argc) {
+        return -1;
+    }
+    const char *p = s_formats[record->id].format;
+    size_t pos = 0;
+    unsigned arg = 0;
+    while (*p) {
+        if (*p != '%' || p[1] == '%') {
+            if (pos + 1 < len) {
+                buf[pos] = *p;
+            }
+            pos++;
+            p += *p == '%' ? 2 : 1;
+            continue;
+        }
+        /* copy flags, width and precision, drop length modifiers */
+        char spec[16];
+        size_t n = 0;
+        spec[n++] = *p++;
+        while (*p && strchr("-+ #0123456789.", *p) && n < sizeof(spec) - 2) {
+            spec[n++] = *p++;
+        }
+        while (*p && strchr("hlLqjzt", *p)) {
+            p++;
+        }
+        const char conversion = *p;
+        if (!conversion || arg >= record->argc) {
+            return -1;
+        }
+        spec[n++] = *p++;
+        spec[n] = '\0';
+        char *out = pos < len ? buf + pos : NULL;
+        const size_t room = pos < len ? len - pos : 0;
+        const uint32_t value = record->args[arg++];
+        int wrote;
+        switch (conversion) {
+        case 'd':
+        case 'i':
+            wrote = snprintf(out, room, spec, (int)(int32_t)value);
+            break;
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'o':
+            wrote = snprintf(out, room, spec, (unsigned)value);
+            break;
+        case 'c':
+            wrote = snprintf(out, room, spec, (int)value);
+            break;
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+            wrote = snprintf(out, room, spec, (double)bits_to_float(value));
+            break;
+        default:
+            return -1;
+        }
+        if (wrote < 0) {
+            return -1;
+        }
+        pos += (size_t)wrote;
+    }
+    if (len) {
+        buf[pos < len ? pos : len - 1] = '\0';
+    }
+    return (int)pos;
+}
+
+static size_t put_le(uint8_t *out, uint32_t value, size_t bytes)
+{
+    for (size_t i = 0; i < bytes; ++i) {
+        out[i] = (uint8_t)(value >> (8 * i));
+    }
+    return bytes;
+}
+
+static uint32_t get_le(const uint8_t *in, size_t bytes)
+{
+    uint32_t value = 0;
+    for (size_t i = 0; i < bytes; ++i) {
+        value |= (uint32_t)in[i] << (8 * i);
+    }
+    return value;
+}
+
+void lamp_log_encode_hex(char *buf, const lamp_log_record_t *record)
+{
+    static const char digits[] = "0123456789abcdef";
+    uint8_t bytes[RECORD_HEADER_BYTES + 4 * LAMP_LOG_MAX_ARGS];
+    const uint8_t argc = record->argc <= LAMP_LOG_MAX_ARGS ? record->argc : LAMP_LOG_MAX_ARGS;
+    size_t n = put_le(bytes, record->time_ms, 4);
+    n += put_le(bytes + n, record->id, 2);
+    bytes[n++] = record->level;
+    bytes[n++] = argc;
+    for (uint8_t i = 0; i < argc; ++i) {
+        n += put_le(bytes + n, record->args[i], 4);
+    }
+    memcpy(buf, LAMP_LOG_HEX_PREFIX, sizeof(LAMP_LOG_HEX_PREFIX) - 1);
+    char *out = buf + sizeof(LAMP_LOG_HEX_PREFIX) - 1;
+    for (size_t i = 0; i < n; ++i) {
+        *out++ = digits[bytes[i] >> 4];
+        *out++ = digits[bytes[i] & 0xf];
+    }
+    *out = '\0';
+}
+
+static int hex_digit(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+bool lamp_log_decode_hex(const char *line, lamp_log_record_t *record)
+{
+    const char *p = strstr(line, LAMP_LOG_HEX_PREFIX);
+    if (!p) {
+        return false;
+    }
+    p += sizeof(LAMP_LOG_HEX_PREFIX) - 1;
+    uint8_t bytes[RECORD_HEADER_BYTES + 4 * LAMP_LOG_MAX_ARGS];
+    size_t n = 0;
+    for (;;) {
+        const int high = hex_digit(p[0]);
+        const int low = high < 0 ? -1 : hex_digit(p[1]);
+        if (high < 0 || low < 0) {
+            break;
+        }
+        if (n == sizeof(bytes)) {
+            return false;
+        }
+        bytes[n++] = (uint8_t)(high << 4 | low);
+        p += 2;
+    }
+    if (n < RECORD_HEADER_BYTES || bytes[7] > LAMP_LOG_MAX_ARGS || n != RECORD_HEADER_BYTES + 4u * bytes[7]) {
+        return false;
+    }
+    memset(record, 0, sizeof(*record));
+    record->time_ms = get_le(bytes, 4);
+    record->id = (uint16_t)get_le(bytes + 4, 2);
+    record->level = bytes[6];
+    record->argc = bytes[7];
+    for (uint8_t i = 0; i < record->argc; ++i) {
+        record->args[i] = get_le(bytes + RECORD_HEADER_BYTES + 4 * i, 4);
+    }
+    return true;
+}
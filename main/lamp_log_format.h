@@ -0,0 +1,119 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Lamp controller binary log records and their formats
+ *
+ * This example code is in the Public Domain (or CC0 licensed, at your option.)
+ *
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Every deferred log message: X(id, tag, argument count, format). Arguments
+ * are 32-bit; the format may use d, i, u, x, X, c and, for arguments passed
+ * through lamp_log_float(), f, e and g, with any flags, width and precision.
+ * Length modifiers are ignored. Ids are part of the binary log format: append
+ * new messages, and keep the arguments of an existing one when changing it,
+ * or captures taken with older firmware decode wrongly.
+ */
+#define LAMP_LOG_FORMATS(X) \
+    X(DROPPED, "LAMP_LOG", 1, "%u records dropped, log ring full") \
+    X(BENCH, "LAMP_LOG", 4, "bench %u %u %u %u") \
+    X(ZDO_SIGNAL, "ESP_LAMP_CONTROLLER", 2, "ZDO signal: 0x%x, status: %d") \
+    X(REPORT_RX, "ESP_LAMP_CONTROLLER", 4, \
+      "Received report from address(0x%x) src endpoint(%d) to dst endpoint(%d) cluster(0x%x)") \
+    X(READ_ATTR_STATUS, "ESP_LAMP_CONTROLLER", 3, \
+      "Read attribute response: status(0x%x), cluster(0x%x), attribute(0x%x)") \
+    X(CONFIG_REPORT_STATUS, "ESP_LAMP_CONTROLLER", 3, \
+      "Configure report response: status(%d), cluster(0x%x), attribute(0x%x)") \
+    X(DEFAULT_RESP, "ESP_LAMP_CONTROLLER", 3, \
+      "Received default response: cluster(0x%x), command(0x%x), status(0x%x)") \
+    X(SET_HUE, "ESP_LAMP_CONTROLLER", 2, "hue: %d, dir: %d") \
+    X(ATTR_UNSIGNED, "LIGHT_ATTR", 4, "Light %d cluster 0x%04x attribute 0x%04x = %u") \
+    X(ATTR_SIGNED, "LIGHT_ATTR", 4, "Light %d cluster 0x%04x attribute 0x%04x = %d") \
+    X(ATTR_FLOAT, "LIGHT_ATTR", 4, "Light %d cluster 0x%04x attribute 0x%04x = %f")
+
+#define LAMP_LOG_MAX_ARGS       4
+
+/* prefix of a record written as a hex line for the host decoder */
+#define LAMP_LOG_HEX_PREFIX     "#L:"
+
+/* longest hex line without the newline: prefix, 8 byte header and the arguments, 2 digits per byte */
+#define LAMP_LOG_HEX_MAX        (sizeof(LAMP_LOG_HEX_PREFIX) - 1 + 2 * (8 + 4 * LAMP_LOG_MAX_ARGS))
+
+typedef enum {
+#define LAMP_LOG_ID_ENTRY(id, tag, argc, format) LAMP_LOG_ID_##id,
+    LAMP_LOG_FORMATS(LAMP_LOG_ID_ENTRY)
+#undef LAMP_LOG_ID_ENTRY
+    LAMP_LOG_ID_COUNT,
+} lamp_log_id_t;
+
+/* LAMP_LOG_ARGC_<id>: argument count of a message, checked at every call site */
+enum {
+#define LAMP_LOG_ARGC_ENTRY(id, tag, argc, format) LAMP_LOG_ARGC_##id = argc,
+    LAMP_LOG_FORMATS(LAMP_LOG_ARGC_ENTRY)
+#undef LAMP_LOG_ARGC_ENTRY
+};
+
+typedef struct {
+    uint32_t time_ms;           /* esp_log_timestamp() when the record was written */
+    uint16_t id;                /* lamp_log_id_t */
+    uint8_t level;              /* esp_log_level_t */
+    uint8_t argc;
+    uint32_t args[LAMP_LOG_MAX_ARGS];
+} lamp_log_record_t;
+
+/**
+ * @brief Float argument as the 32-bit value a record carries
+ */
+static inline uint32_t lamp_log_float(float value)
+{
+    union {
+        float f;
+        uint32_t u;
+    } bits = {.f = value};
+    return bits.u;
+}
+
+/**
+ * @brief Tag of a message, NULL for an unknown id
+ */
+const char *lamp_log_tag(uint16_t id);
+
+/**
+ * @brief Format the message of a record, like snprintf
+ *
+ * @return length of the message, negative for an unknown id or a record
+ *         with fewer arguments than its format.
+ */
+int lamp_log_format(char *buf, size_t len, const lamp_log_record_t *record);
+
+/**
+ * @brief Write a record as a LAMP_LOG_HEX_PREFIX line, without the newline
+ *
+ * @param buf       at least LAMP_LOG_HEX_MAX + 1 bytes.
+ */
+void lamp_log_encode_hex(char *buf, const lamp_log_record_t *record);
+
+/**
+ * @brief Read a record back from a hex line, which may have text before the prefix
+ *
+ * @return false if the line holds no valid record.
+ */
+bool lamp_log_decode_hex(const char *line, lamp_log_record_t *record);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
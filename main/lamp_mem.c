@@ -0,0 +1,262 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Lamp controller memory budget
+ *
+ * This example code is in the Public Domain (or CC0 licensed, at your option.)
+ *
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include "esp_attr.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "lamp_mem.h"
+
+/**
+ * @brief:
+ * The IDF calls the heap hooks on every allocation and free, from whatever
+ * task made it. Before the seal they return at once. After it they count
+ * the call and look the current task up in the small task table; only a
+ * steady task outside an allow scope is an error. The hooks run inside the
+ * allocator, so they take no lock, allocate nothing and log nothing: the
+ * strict build aborts on the spot and leaves the caller to the backtrace.
+ *
+ * The Zigbee task is steady but runs esp-zigbee-lib, which allocates for
+ * frames and attribute lists of its own. Its main loop is an allow scope,
+ * which the signal, action and send status handlers and the mailbox drain
+ * suspend while they run, so the application's heap use there is still an
+ * error. The application's other alarms and ZDO callbacks stay inside the
+ * scope: their heap use shows up only as allowed.
+ *
+ * The task and pool tables are filled at startup, before the seal. A task
+ * entry is complete before the count that publishes it goes up, so a hook
+ * never sees half an entry.
+ */
+
+typedef struct {
+    TaskHandle_t task;
+    uint32_t stack_size;
+    bool steady;
+    uint8_t allow;              /* lamp_mem_allow_begin() depth, only touched by the task itself */
+} lamp_mem_task_t;
+
+typedef struct {
+    const char *name;
+    uint32_t capacity;
+    size_t item_size;
+    lamp_mem_pool_usage_t usage;
+} lamp_mem_pool_t;
+
+static const char *TAG = "LAMP_MEM";
+
+static lamp_mem_task_t s_tasks[LAMP_MEM_TASKS];
+static atomic_uint s_task_count;
+static lamp_mem_pool_t s_pools[LAMP_MEM_POOLS];
+static uint8_t s_pool_count;
+
+static atomic_bool s_sealed;
+static atomic_uint s_allocs;
+static atomic_uint s_frees;
+static atomic_uint s_steady;
+static atomic_uint s_allowed;
+
+static IRAM_ATTR lamp_mem_task_t *lamp_mem_find(TaskHandle_t task)
+{
+    const unsigned count = atomic_load_explicit(&s_task_count, memory_order_acquire);
+    for (unsigned i = 0; i < count; ++i) {
+        if (s_tasks[i].task == task) {
+            return &s_tasks[i];
+        }
+    }
+    return NULL;
+}
+
+void lamp_mem_add_task(TaskHandle_t task, uint32_t stack_size, bool steady)
+{
+    if (!task) {
+        return;
+    }
+    lamp_mem_task_t *entry = lamp_mem_find(task);
+    if (entry) {
+        entry->stack_size = stack_size;
+        entry->steady = steady;
+        return;
+    }
+    const unsigned count = atomic_load_explicit(&s_task_count, memory_order_relaxed);
+    if (count == LAMP_MEM_TASKS) {
+        ESP_LOGW(TAG, "More than %d tasks, %s is not reported", LAMP_MEM_TASKS, pcTaskGetName(task));
+        return;
+    }
+    s_tasks[count] = (lamp_mem_task_t) {
+        .task = task,
+        .stack_size = stack_size,
+        .steady = steady,
+    };
+    atomic_store_explicit(&s_task_count, count + 1, memory_order_release);
+}
+
+void lamp_mem_add_pool(const char *name, uint32_t capacity, size_t item_size, lamp_mem_pool_usage_t usage)
+{
+    lamp_mem_pool_t *pool = NULL;
+    for (unsigned i = 0; i < s_pool_count && !pool; ++i) {
+        if (s_pools[i].usage == usage) {
+            pool = &s_pools[i];
+        }
+    }
+    if (!pool) {
+        if (s_pool_count == LAMP_MEM_POOLS) {
+            ESP_LOGW(TAG, "More than %d pools, %s is not reported", LAMP_MEM_POOLS, name);
+            return;
+        }
+        pool = &s_pools[s_pool_count++];
+    }
+    *pool = (lamp_mem_pool_t) {
+        .name = name,
+        .capacity = capacity,
+        .item_size = item_size,
+        .usage = usage,
+    };
+}
+
+void lamp_mem_seal(void)
+{
+    if (atomic_load(&s_sealed)) {
+        return;
+    }
+    /* log first, whatever the log path allocates is still startup */
+    ESP_LOGI(TAG, "Startup over with %lu bytes of heap free, %lu at the lowest",
+             (unsigned long)esp_get_free_heap_size(), (unsigned long)esp_get_minimum_free_heap_size());
+    atomic_store(&s_sealed, true);
+}
+
+void lamp_mem_allow_begin(void)
+{
+    lamp_mem_task_t *entry = lamp_mem_find(xTaskGetCurrentTaskHandle());
+    if (entry) {
+        entry->allow++;
+    }
+}
+
+void lamp_mem_allow_end(void)
+{
+    lamp_mem_task_t *entry = lamp_mem_find(xTaskGetCurrentTaskHandle());
+    if (entry && entry->allow) {
+        entry->allow--;
+    }
+}
+
+uint8_t lamp_mem_steady_begin(void)
+{
+    lamp_mem_task_t *entry = lamp_mem_find(xTaskGetCurrentTaskHandle());
+    if (!entry) {
+        return 0;
+    }
+    const uint8_t depth = entry->allow;
+    entry->allow = 0;
+    return depth;
+}
+
+void lamp_mem_steady_end(uint8_t depth)
+{
+    lamp_mem_task_t *entry = lamp_mem_find(xTaskGetCurrentTaskHandle());
+    if (entry) {
+        entry->allow = depth;
+    }
+}
+
+#if CONFIG_HEAP_USE_HOOKS
+static IRAM_ATTR void lamp_mem_touched(atomic_uint *counter)
+{
+    if (!atomic_load_explicit(&s_sealed, memory_order_relaxed)) {
+        return;
+    }
+    atomic_fetch_add_explicit(counter, 1, memory_order_relaxed);
+    const lamp_mem_task_t *entry = lamp_mem_find(xTaskGetCurrentTaskHandle());
+    if (!entry || !entry->steady) {
+        return;
+    }
+    if (entry->allow) {
+        atomic_fetch_add_explicit(&s_allowed, 1, memory_order_relaxed);
+        return;
+    }
+    atomic_fetch_add_explicit(&s_steady, 1, memory_order_relaxed);
+#if LAMP_MEM_STRICT
+    esp_system_abort("heap used on a steady task after startup (LAMP_MEM_STRICT)");
+#endif
+}
+
+IRAM_ATTR void esp_heap_trace_alloc_hook(void *ptr, size_t size, uint32_t caps)
+{
+    (void)ptr;
+    (void)size;
+    (void)caps;
+    lamp_mem_touched(&s_allocs);
+}
+
+IRAM_ATTR void esp_heap_trace_free_hook(void *ptr)
+{
+    (void)ptr;
+    lamp_mem_touched(&s_frees);
+}
+#endif
+
+void lamp_mem_get_stats(lamp_mem_stats_t *stats)
+{
+    stats->sealed = atomic_load(&s_sealed);
+    stats->allocs = atomic_load(&s_allocs);
+    stats->frees = atomic_load(&s_frees);
+    stats->steady = atomic_load(&s_steady);
+    stats->allowed = atomic_load(&s_allowed);
+    stats->free_bytes = esp_get_free_heap_size();
+    stats->min_free_bytes = esp_get_minimum_free_heap_size();
+    stats->largest_block = heap_caps_get_largest_free_block(MALLOC_CAP_DEFAULT);
+}
+
+void lamp_mem_dump(void)
+{
+    lamp_mem_stats_t stats;
+    lamp_mem_get_stats(&stats);
+    printf("heap: %lu bytes free, %lu at the lowest, largest block %lu\n", (unsigned long)stats.free_bytes,
+           (unsigned long)stats.min_free_bytes, (unsigned long)stats.largest_block);
+#if CONFIG_HEAP_USE_HOOKS
+    if (!stats.sealed) {
+        printf("after startup: not counted, startup is not over\n");
+    } else {
+        printf("after startup: %lu allocations, %lu frees; on steady tasks %lu, %lu allowed%s\n",
+               (unsigned long)stats.allocs, (unsigned long)stats.frees, (unsigned long)stats.steady,
+               (unsigned long)stats.allowed, LAMP_MEM_STRICT ? " (strict)" : "");
+    }
+#else
+    printf("after startup: not counted, CONFIG_HEAP_USE_HOOKS is off\n");
+#endif
+
+    printf("%-16s %6s %8s %5s\n", "task", "stack", "unused", "used");
+    const unsigned task_count = atomic_load(&s_task_count);
+    for (unsigned i = 0; i < task_count; ++i) {
+        const lamp_mem_task_t *entry = &s_tasks[i];
+        const uint32_t unused = uxTaskGetStackHighWaterMark(entry->task);
+        const uint32_t used = unused < entry->stack_size ? entry->stack_size - unused : 0;
+        const uint32_t percent = entry->stack_size ? used * 100 / entry->stack_size : 0;
+        printf("%-16s %6lu %8lu %4lu%%%s\n", pcTaskGetName(entry->task), (unsigned long)entry->stack_size,
+               (unsigned long)unused, (unsigned long)percent, entry->steady ? "" : "  not steady");
+    }
+
+    printf("%-16s %6s %8s %5s %5s\n", "pool", "items", "bytes", "used", "peak");
+    size_t total = 0;
+    for (unsigned i = 0; i < s_pool_count; ++i) {
+        const lamp_mem_pool_t *pool = &s_pools[i];
+        lamp_mem_usage_t usage = { 0 };
+        pool->usage(&usage);
+        const size_t bytes = (size_t)pool->capacity * pool->item_size;
+        total += bytes;
+        printf("%-16s %6lu %8lu %5lu %5lu\n", pool->name, (unsigned long)pool->capacity, (unsigned long)bytes,
+               (unsigned long)usage.used, (unsigned long)usage.peak);
+    }
+    printf("%-16s %6s %8lu\n", "total", "", (unsigned long)total);
+}
@@ -0,0 +1,139 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Lamp controller memory budget
+ *
+ * This example code is in the Public Domain (or CC0 licensed, at your option.)
+ *
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* 1: heap use on a steady task after lamp_mem_seal() aborts, the backtrace shows the caller */
+#ifndef LAMP_MEM_STRICT
+#define LAMP_MEM_STRICT             0
+#endif
+
+#if LAMP_MEM_STRICT && !CONFIG_HEAP_USE_HOOKS
+#error "LAMP_MEM_STRICT needs CONFIG_HEAP_USE_HOOKS to see the heap"
+#endif
+
+/* tasks whose stack high-water mark is reported */
+#define LAMP_MEM_TASKS              8
+
+/* fixed-size pools whose occupancy is reported */
+#define LAMP_MEM_POOLS              8
+
+typedef struct {
+    uint32_t used;              /* items taken right now */
+    uint32_t peak;              /* most items taken at once */
+} lamp_mem_usage_t;
+
+/**
+ * @brief Occupancy of a pool, called by lamp_mem_dump() with the Zigbee lock held
+ */
+typedef void (*lamp_mem_pool_usage_t)(lamp_mem_usage_t *usage);
+
+typedef struct {
+    bool sealed;                /* lamp_mem_seal() was called */
+    uint32_t allocs;            /* heap allocations after the seal, on every task */
+    uint32_t frees;
+    uint32_t steady;            /* allocations and frees of those on steady tasks, outside lamp_mem_allow_begin() */
+    uint32_t allowed;           /* allocations and frees on steady tasks inside lamp_mem_allow_begin(), the stack's among them */
+    uint32_t free_bytes;
+    uint32_t min_free_bytes;    /* lowest free heap since boot */
+    uint32_t largest_block;
+} lamp_mem_stats_t;
+
+/*
+ * Application state lives in static pools sized at compile time and the
+ * application tasks run on static stacks, so once startup is over the
+ * firmware needs no heap. lamp_mem_seal() marks that point: from then on the
+ * heap hooks (CONFIG_HEAP_USE_HOOKS) count every allocation and free, and
+ * with LAMP_MEM_STRICT one on a steady task aborts.
+ *
+ * Tasks and pools are added once at startup; the counters are safe from any
+ * task.
+ */
+
+/**
+ * @brief Report a task's stack high-water mark
+ *
+ * @param task          handle of the task, adding it again only updates it.
+ * @param stack_size    stack depth it was created with, in bytes.
+ * @param steady        the task is the application's own: heap use on it after lamp_mem_seal() is an error.
+ */
+void lamp_mem_add_task(TaskHandle_t task, uint32_t stack_size, bool steady);
+
+/**
+ * @brief Report a pool's occupancy
+ *
+ * @param name          printed name, kept by reference.
+ * @param capacity      items the pool holds.
+ * @param item_size     bytes per item.
+ * @param usage         occupancy of the pool; adding it again only updates the rest.
+ */
+void lamp_mem_add_pool(const char *name, uint32_t capacity, size_t item_size, lamp_mem_pool_usage_t usage);
+
+/**
+ * @brief End of startup: count heap use from now on
+ */
+void lamp_mem_seal(void);
+
+/**
+ * @brief Let the calling task use the heap until lamp_mem_allow_end()
+ *
+ * For IDF calls a steady task cannot avoid and that allocate internally,
+ * such as an NVS write. Their heap use is counted apart and is not fatal.
+ * Scopes nest; tasks not added with lamp_mem_add_task() need none.
+ */
+void lamp_mem_allow_begin(void);
+
+/**
+ * @brief Close the scope of lamp_mem_allow_begin()
+ */
+void lamp_mem_allow_end(void);
+
+/**
+ * @brief Suspend the calling task's allow scopes until lamp_mem_steady_end()
+ *
+ * The Zigbee task runs the stack's main loop in an allow scope, since
+ * esp-zigbee-lib allocates on it for its own work; the handlers the stack
+ * calls into use this to make the application's heap use an error again.
+ *
+ * @return the depth to give back to lamp_mem_steady_end().
+ */
+uint8_t lamp_mem_steady_begin(void);
+
+/**
+ * @brief Reopen the allow scopes lamp_mem_steady_begin() suspended
+ */
+void lamp_mem_steady_end(uint8_t depth);
+
+/**
+ * @brief Snapshot of the counters and the heap
+ */
+void lamp_mem_get_stats(lamp_mem_stats_t *stats);
+
+/**
+ * @brief Print the heap, the stack high-water mark of every task and the occupancy of every pool
+ */
+void lamp_mem_dump(void);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,89 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Lamp controller bounded multi-producer ring
+ *
+ * This example code is in the Public Domain (or CC0 licensed, at your option.)
+ *
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#include "lamp_ring.h"
+
+/**
+ * @brief:
+ * Dmitry Vyukov's bounded MPMC queue, used with a single consumer. Each slot
+ * carries a sequence number: equal to the position when the slot is free
+ * for it, one more once an item is published there, and a full lap more
+ * once the consumer is done with it. A producer compares its slot's number
+ * with the tail it read: equal, it claims the position with one
+ * compare-and-swap; behind, the ring is full; ahead, another producer won
+ * and it reads the tail again. The release and acquire on the sequence
+ * number order the item's copy, so positions and counters stay relaxed.
+ */
+
+void lamp_ring_init(lamp_ring_t *ring, atomic_uint *seq, unsigned len)
+{
+    ring->seq = seq;
+    ring->mask = len - 1;
+    for (unsigned i = 0; i < len; ++i) {
+        atomic_init(&seq[i], i);
+    }
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->max_depth, 0);
+}
+
+bool lamp_ring_claim(lamp_ring_t *ring, unsigned *pos)
+{
+    unsigned tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    for (;;) {
+        const int diff = (int)(atomic_load_explicit(&ring->seq[tail & ring->mask], memory_order_acquire) - tail);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&ring->tail, &tail, tail + 1, memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                *pos = tail;
+                return true;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        }
+    }
+}
+
+void lamp_ring_publish(lamp_ring_t *ring, unsigned pos)
+{
+    atomic_store_explicit(&ring->seq[pos & ring->mask], pos + 1, memory_order_release);
+
+    const unsigned depth = pos + 1 - atomic_load_explicit(&ring->head, memory_order_relaxed);
+    unsigned max_depth = atomic_load_explicit(&ring->max_depth, memory_order_relaxed);
+    while (depth > max_depth &&
+           !atomic_compare_exchange_weak_explicit(&ring->max_depth, &max_depth, depth, memory_order_relaxed,
+                                                  memory_order_relaxed)) {
+    }
+}
+
+bool lamp_ring_take(lamp_ring_t *ring, unsigned *pos)
+{
+    const unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    if (atomic_load_explicit(&ring->seq[head & ring->mask], memory_order_acquire) != head + 1) {
+        return false;
+    }
+    *pos = head;
+    return true;
+}
+
+void lamp_ring_release(lamp_ring_t *ring, unsigned pos)
+{
+    atomic_store_explicit(&ring->seq[pos & ring->mask], pos + ring->mask + 1, memory_order_release);
+    atomic_store_explicit(&ring->head, pos + 1, memory_order_relaxed);
+}
+
+unsigned lamp_ring_depth(const lamp_ring_t *ring)
+{
+    return atomic_load(&ring->tail) - atomic_load(&ring->head);
+}
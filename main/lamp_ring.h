@@ -0,0 +1,79 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Lamp controller bounded multi-producer ring
+ *
+ * This example code is in the Public Domain (or CC0 licensed, at your option.)
+ *
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Positions and sequence numbers of a bounded lock-free queue with any
+ * number of producers and a single consumer. The ring does not hold the
+ * items: the caller keeps an array of the same length and moves an item in
+ * or out of slot `pos & mask` between the calls below.
+ *
+ * A producer claims a position, fills the slot and publishes it. The
+ * consumer takes the oldest published position, copies the slot out and
+ * releases it. Nothing blocks; a full ring fails the claim.
+ */
+typedef struct {
+    atomic_uint *seq;           /* per slot: == position when free, position + 1 when published */
+    unsigned mask;              /* length - 1 */
+    atomic_uint tail;           /* next position producers claim */
+    atomic_uint head;           /* next position the consumer takes */
+    atomic_uint max_depth;      /* most items published and not released at once */
+} lamp_ring_t;
+
+/**
+ * @brief Empty the ring
+ *
+ * @param seq   one sequence number per slot, owned by the caller.
+ * @param len   slots, a power of two.
+ */
+void lamp_ring_init(lamp_ring_t *ring, atomic_uint *seq, unsigned len);
+
+/**
+ * @brief Claim the next free slot, safe from any task concurrently
+ *
+ * @return false if the ring is full.
+ */
+bool lamp_ring_claim(lamp_ring_t *ring, unsigned *pos);
+
+/**
+ * @brief Hand a claimed and filled slot to the consumer
+ */
+void lamp_ring_publish(lamp_ring_t *ring, unsigned pos);
+
+/**
+ * @brief Oldest published slot, for the consumer only
+ *
+ * @return false if nothing is published.
+ */
+bool lamp_ring_take(lamp_ring_t *ring, unsigned *pos);
+
+/**
+ * @brief Give a taken slot back to the producers once it is copied out
+ */
+void lamp_ring_release(lamp_ring_t *ring, unsigned pos);
+
+/**
+ * @brief Items claimed and not released yet
+ */
+unsigned lamp_ring_depth(const lamp_ring_t *ring);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
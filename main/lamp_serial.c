@@ -0,0 +1,331 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Lamp controller serial command interface
+ *
+ * This example code is in the Public Domain (or CC0 licensed, at your option.)
+ *
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#include <string.h>
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_zigbee_core.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "lamp_mem.h"
+#include "lamp_serial.h"
+#include "light_command.h"
+#include "light_scene.h"
+#include "sdkconfig.h"
+
+#if CONFIG_ESP_CONSOLE_USB_SERIAL_JTAG
+#include "driver/uart.h"
+#define LAMP_SERIAL_ON_UART 1
+#else
+#include "driver/usb_serial_jtag.h"
+#define LAMP_SERIAL_ON_UART 0
+#endif
+
+/**
+ * @brief:
+ * The serial driver fills its ring buffer from the receive interrupt; the
+ * serial task takes up to LAMP_SERIAL_READ_CHUNK bytes at a time and the
+ * protocol decoder finds the frames in that chunk where they are, so a frame
+ * is never copied again unless a read ends in the middle of it. A burst of
+ * frames arriving together is decoded from a single read.
+ *
+ * Records go to the Zigbee task only through the lock-free mailbox, which
+ * coalesces what a light has not been sent yet, so the serial task never
+ * takes the Zigbee lock on the command path: it validates targets against a
+ * snapshot of the known lights, refreshed under the lock only when a record
+ * names a light missing from it, and for telemetry. When the mailbox is full
+ * the task waits a tick and posts again, which holds back the frame's ACK and
+ * so the host's window: the serial port slows down, the Zigbee task does not.
+ */
+
+_Static_assert(LAMP_SERIAL_RX_BUFFER > 128, "the driver needs more than the hardware FIFO");
+_Static_assert(LAMP_SERIAL_READ_CHUNK >= LAMP_PROTO_MAX_FRAME, "a read holds a whole frame");
+
+static const char *TAG = "ESP_LAMP_SERIAL";
+
+static lamp_serial_record_handler_t s_handler;
+static lamp_proto_decoder_t s_decoder;
+static lamp_proto_sequencer_t s_sequencer;
+static lamp_serial_stats_t s_stats;
+static light_mask_t s_known;            /* lights known at the last refresh */
+static uint32_t s_mailbox_sent;         /* mailbox counters at the last refresh */
+static uint32_t s_mailbox_coalesced;
+static uint32_t s_mailbox_latency_last_us;
+static uint32_t s_mailbox_latency_max_us;
+static uint8_t s_tx_seq;                /* sequence number of the next TELEMETRY */
+static uint16_t s_telemetry_period_ms;
+static int64_t s_telemetry_due_us;
+static int64_t s_origin_us;             /* when the chunk being decoded was read */
+static StackType_t s_task_stack[LAMP_SERIAL_TASK_STACK];
+static StaticTask_t s_task;
+
+static int lamp_serial_read(uint8_t *buf, size_t size, TickType_t ticks)
+{
+#if LAMP_SERIAL_ON_UART
+    /* uart_read_bytes() waits for all it is asked for: wait for one byte, then take what the ring buffer holds */
+    int len = uart_read_bytes(LAMP_SERIAL_UART_PORT, buf, 1, ticks);
+    size_t buffered = 0;
+    if (len == 1 && uart_get_buffered_data_len(LAMP_SERIAL_UART_PORT, &buffered) == ESP_OK && buffered) {
+        const int more = uart_read_bytes(LAMP_SERIAL_UART_PORT, buf + 1, buffered < size - 1 ? buffered : size - 1, 0);
+        len += more > 0 ? more : 0;
+    }
+    return len;
+#else
+    return usb_serial_jtag_read_bytes(buf, size, ticks);
+#endif
+}
+
+static void lamp_serial_write(const uint8_t *data, size_t len)
+{
+#if LAMP_SERIAL_ON_UART
+    const int written = uart_write_bytes(LAMP_SERIAL_UART_PORT, data, len);
+#else
+    const int written = usb_serial_jtag_write_bytes(data, len, pdMS_TO_TICKS(LAMP_SERIAL_WRITE_TIMEOUT_MS));
+#endif
+    if (written != (int)len) {
+        s_stats.write_drops++;
+    }
+}
+
+static void lamp_serial_send(uint8_t type, uint8_t seq, const uint8_t *payload, size_t length)
+{
+    uint8_t frame[LAMP_PROTO_MAX_FRAME];
+    const size_t len = lamp_proto_encode(frame, sizeof(frame), type, seq, payload, length);
+    if (len) {
+        lamp_serial_write(frame, len);
+    }
+}
+
+static void lamp_serial_ack(uint8_t seq, uint8_t status, const uint8_t *data, size_t length)
+{
+    uint8_t payload[1 + LAMP_PROTO_HELLO_ACK_SIZE] = {status};
+    memcpy(payload + 1, data, length);
+    lamp_serial_send(LAMP_PROTO_ACK, seq, payload, 1 + length);
+}
+
+/* Snapshot state owned by the Zigbee task; wait for its lock or give up if it is busy */
+static bool lamp_serial_refresh(TickType_t ticks)
+{
+    if (!esp_zb_lock_acquire(ticks)) {
+        return false;
+    }
+    light_command_stats_t mailbox;
+    s_known = light_registry_all();
+    light_command_get_stats(&mailbox);
+    esp_zb_lock_release();
+    s_mailbox_sent = mailbox.sent;
+    s_mailbox_coalesced = mailbox.coalesced;
+    s_mailbox_latency_last_us = mailbox.latency_last_us;
+    s_mailbox_latency_max_us = mailbox.latency_max_us;
+    return true;
+}
+
+/* Lights a record addresses, 0 if it names one that does not exist */
+static light_mask_t lamp_serial_targets(const lamp_proto_record_t *record, bool *refreshed)
+{
+    if (record->op == LAMP_PROTO_OP_PRESET && !light_scene_preset(record->preset)) {
+        return 0;
+    }
+    if (record->target == LAMP_PROTO_TARGET_ALL) {
+        return LIGHT_MASK_ALL;
+    }
+    if (record->target >= LIGHT_REGISTRY_CAPACITY) {
+        return 0;
+    }
+    const light_mask_t mask = LIGHT_MASK(record->target);
+    if (!(s_known & mask) && !*refreshed) {
+        /* joined since the last snapshot, or really unknown */
+        *refreshed = lamp_serial_refresh(portMAX_DELAY);
+    }
+    return s_known & mask;
+}
+
+/* Validate every record first, so a frame is applied all or none */
+static uint8_t lamp_serial_commands(const lamp_proto_frame_t *frame)
+{
+    lamp_proto_record_t record;
+    bool refreshed = false;
+    size_t offset = 0;
+    if (!frame->length) {
+        return LAMP_PROTO_ERR_MALFORMED;
+    }
+    while (offset < frame->length) {
+        const size_t size = lamp_proto_get_record(frame->payload + offset, frame->length - offset, &record);
+        if (!size) {
+            return LAMP_PROTO_ERR_MALFORMED;
+        }
+        if (!lamp_serial_targets(&record, &refreshed)) {
+            return LAMP_PROTO_ERR_TARGET;
+        }
+        offset += size;
+    }
+    for (offset = 0; offset < frame->length;) {
+        offset += lamp_proto_get_record(frame->payload + offset, frame->length - offset, &record);
+        const light_mask_t targets = lamp_serial_targets(&record, &refreshed);
+        if (!s_handler(&record, targets, s_origin_us)) {
+            s_stats.mailbox_waits++;
+            do {
+                vTaskDelay(1);
+            } while (!s_handler(&record, targets, s_origin_us));
+        }
+        s_stats.records++;
+    }
+    return LAMP_PROTO_OK;
+}
+
+static void lamp_serial_frame(const lamp_proto_frame_t *frame, void *ctx)
+{
+    (void)ctx;
+    uint8_t status = LAMP_PROTO_OK;
+    switch (lamp_proto_sequence_check(&s_sequencer, frame, &status)) {
+    case LAMP_PROTO_FRAME_DUPLICATE:
+        lamp_serial_ack(frame->seq, status, NULL, 0);
+        return;
+    case LAMP_PROTO_FRAME_OUT_OF_ORDER:
+        lamp_serial_ack(frame->seq, LAMP_PROTO_ERR_SEQUENCE, &s_sequencer.expected, 1);
+        return;
+    case LAMP_PROTO_FRAME_NEW:
+        break;
+    }
+    switch (frame->type) {
+    case LAMP_PROTO_HELLO: {
+        const uint8_t hello[LAMP_PROTO_HELLO_ACK_SIZE] = {
+            LAMP_PROTO_VERSION, LAMP_PROTO_MAX_PAYLOAD, LAMP_PROTO_WINDOW,
+        };
+        lamp_proto_sequence_commit(&s_sequencer, frame->seq, LAMP_PROTO_OK);
+        lamp_serial_ack(frame->seq, LAMP_PROTO_OK, hello, sizeof(hello));
+        return;
+    }
+    case LAMP_PROTO_COMMANDS:
+        status = lamp_serial_commands(frame);
+        break;
+    case LAMP_PROTO_TELEMETRY_PERIOD:
+        if (frame->length != 2) {
+            status = LAMP_PROTO_ERR_MALFORMED;
+            break;
+        }
+        s_telemetry_period_ms = (uint16_t)(frame->payload[0] | frame->payload[1] << 8);
+        s_telemetry_due_us = esp_timer_get_time();
+        break;
+    default:
+        status = LAMP_PROTO_ERR_TYPE;
+        break;
+    }
+    if (status != LAMP_PROTO_OK) {
+        s_stats.rejected++;
+    }
+    lamp_proto_sequence_commit(&s_sequencer, frame->seq, status);
+    lamp_serial_ack(frame->seq, status, NULL, 0);
+}
+
+static void lamp_serial_telemetry(void)
+{
+    lamp_serial_refresh(portMAX_DELAY);
+    const lamp_proto_telemetry_t telemetry = {
+        .uptime_ms = (uint32_t)(esp_timer_get_time() / 1000),
+        .frames = s_decoder.frames,
+        .bad_frames = s_decoder.bad_frames,
+        .skipped = s_decoder.skipped,
+        .records = s_stats.records,
+        .sent = s_mailbox_sent,
+        .coalesced = s_mailbox_coalesced,
+        .duplicates = s_sequencer.duplicates,
+        .out_of_order = s_sequencer.out_of_order,
+        .lights = (uint8_t)(s_known ? 64 - __builtin_clzll(s_known) : 0),
+        /* records are posted as they are read, so enqueue to send is input to send */
+        .latency_last_us = s_mailbox_latency_last_us,
+        .latency_max_us = s_mailbox_latency_max_us,
+    };
+    uint8_t payload[LAMP_PROTO_TELEMETRY_SIZE];
+    lamp_proto_put_telemetry(payload, &telemetry);
+    lamp_serial_send(LAMP_PROTO_TELEMETRY, s_tx_seq++, payload, sizeof(payload));
+    s_stats.telemetry++;
+}
+
+/* Ticks to wait for data before the next telemetry frame is due */
+static TickType_t lamp_serial_wait(void)
+{
+    if (!s_telemetry_period_ms) {
+        return portMAX_DELAY;
+    }
+    const int64_t now_us = esp_timer_get_time();
+    if (now_us >= s_telemetry_due_us) {
+        lamp_serial_telemetry();
+        s_telemetry_due_us = (now_us - s_telemetry_due_us > s_telemetry_period_ms * 1000LL)
+                                 ? now_us + s_telemetry_period_ms * 1000LL
+                                 : s_telemetry_due_us + s_telemetry_period_ms * 1000LL;
+    }
+    return pdMS_TO_TICKS((s_telemetry_due_us - now_us) / 1000) + 1;
+}
+
+static void lamp_serial_task(void *arg)
+{
+    (void)arg;
+    uint8_t chunk[LAMP_SERIAL_READ_CHUNK];
+    for (;;) {
+        const int len = lamp_serial_read(chunk, sizeof(chunk), lamp_serial_wait());
+        if (len <= 0) {
+            continue;
+        }
+        s_origin_us = esp_timer_get_time();
+        s_stats.bytes += len;
+        s_stats.reads++;
+        lamp_proto_decoder_feed(&s_decoder, chunk, len, lamp_serial_frame, NULL);
+    }
+}
+
+esp_err_t lamp_serial_start(lamp_serial_record_handler_t handler)
+{
+    s_handler = handler;
+    lamp_proto_decoder_init(&s_decoder);
+    lamp_proto_sequencer_init(&s_sequencer);
+#if LAMP_SERIAL_ON_UART
+    const uart_config_t uart_config = {
+        .baud_rate = LAMP_SERIAL_UART_BAUD,
+        .data_bits = UART_DATA_8_BITS,
+        .parity = UART_PARITY_DISABLE,
+        .stop_bits = UART_STOP_BITS_1,
+        .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
+        .source_clk = UART_SCLK_DEFAULT,
+    };
+    ESP_RETURN_ON_ERROR(uart_driver_install(LAMP_SERIAL_UART_PORT, LAMP_SERIAL_RX_BUFFER, LAMP_SERIAL_TX_BUFFER, 0,
+                                            NULL, 0), TAG, "Failed to install the UART driver");
+    ESP_RETURN_ON_ERROR(uart_param_config(LAMP_SERIAL_UART_PORT, &uart_config), TAG, "Failed to configure the UART");
+    ESP_RETURN_ON_ERROR(uart_set_pin(LAMP_SERIAL_UART_PORT, LAMP_SERIAL_UART_TX_PIN, LAMP_SERIAL_UART_RX_PIN,
+                                     UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE), TAG, "Failed to set the UART pins");
+#else
+    usb_serial_jtag_driver_config_t usb_config = {
+        .rx_buffer_size = LAMP_SERIAL_RX_BUFFER,
+        .tx_buffer_size = LAMP_SERIAL_TX_BUFFER,
+    };
+    ESP_RETURN_ON_ERROR(usb_serial_jtag_driver_install(&usb_config), TAG, "Failed to install the USB serial driver");
+#endif
+    TaskHandle_t task = xTaskCreateStatic(lamp_serial_task, "lamp_serial", LAMP_SERIAL_TASK_STACK, NULL,
+                                          LAMP_SERIAL_TASK_PRIORITY, s_task_stack, &s_task);
+    if (!task) {
+        ESP_LOGE(TAG, "Serial task was not created");
+        return ESP_FAIL;
+    }
+    lamp_mem_add_task(task, LAMP_SERIAL_TASK_STACK, true);
+    return ESP_OK;
+}
+
+void lamp_serial_get_stats(lamp_serial_stats_t *stats)
+{
+    *stats = s_stats;
+    stats->frames = s_decoder.frames;
+    stats->bad_frames = s_decoder.bad_frames;
+    stats->skipped = s_decoder.skipped;
+    stats->duplicates = s_sequencer.duplicates;
+    stats->out_of_order = s_sequencer.out_of_order;
+}
@@ -0,0 +1,89 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Lamp controller serial command interface
+ *
+ * This example code is in the Public Domain (or CC0 licensed, at your option.)
+ *
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "lamp_protocol.h"
+#include "light_registry.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Serial protocol v2 (components/lamp_protocol) on the serial port the
+ * console does not use: USB serial/JTAG when the console is on a UART, which
+ * is the default, otherwise LAMP_SERIAL_UART_PORT on the pins below.
+ */
+#define LAMP_SERIAL_UART_PORT       1
+#define LAMP_SERIAL_UART_TX_PIN     5
+#define LAMP_SERIAL_UART_RX_PIN     4
+#define LAMP_SERIAL_UART_BAUD       460800
+
+/* driver receive ring buffer: two full windows, so the host never waits for room while a window is applied */
+#define LAMP_SERIAL_RX_BUFFER       (2 * LAMP_PROTO_WINDOW * LAMP_PROTO_MAX_FRAME)
+#define LAMP_SERIAL_TX_BUFFER       1024
+
+/* bytes taken from the ring buffer per read, and decoded in place */
+#define LAMP_SERIAL_READ_CHUNK      256
+
+/* an ACK that does not fit the transmit buffer after this long is dropped, the host sends its frame again */
+#define LAMP_SERIAL_WRITE_TIMEOUT_MS    20
+
+/* below the Zigbee task, which must never wait for the serial port */
+#define LAMP_SERIAL_TASK_PRIORITY   4
+#define LAMP_SERIAL_TASK_STACK      3072
+
+typedef struct {
+    uint32_t bytes;             /* bytes received */
+    uint32_t reads;             /* reads returning data, bytes / reads is the mean batch */
+    uint32_t frames;            /* good frames received */
+    uint32_t bad_frames;        /* candidate frames rejected for their length or CRC */
+    uint32_t skipped;           /* bytes skipped while hunting for a sync byte */
+    uint32_t duplicates;        /* frames received again after their ACK was lost */
+    uint32_t out_of_order;      /* frames dropped because an earlier one was lost */
+    uint32_t rejected;          /* new frames acknowledged with an error status */
+    uint32_t records;           /* command records posted */
+    uint32_t mailbox_waits;     /* records that waited for room in the mailbox, delaying their ACK */
+    uint32_t write_drops;       /* frames not sent because the transmit buffer stayed full */
+    uint32_t telemetry;         /* telemetry frames sent */
+} lamp_serial_stats_t;
+
+/**
+ * @brief Posts one validated command record, runs in the serial task
+ *
+ * @param record    record with a known op, and a known preset for LAMP_PROTO_OP_PRESET.
+ * @param targets   lights the record addresses.
+ * @param origin_us when the read completing its frame returned.
+ * @return false if the mailbox was full; the record is posted again a tick later.
+ */
+typedef bool (*lamp_serial_record_handler_t)(const lamp_proto_record_t *record, light_mask_t targets,
+                                             int64_t origin_us);
+
+/**
+ * @brief Install the serial driver and start the protocol task
+ *
+ * @param handler   called for every record of every COMMANDS frame, in order.
+ */
+esp_err_t lamp_serial_start(lamp_serial_record_handler_t handler);
+
+/**
+ * @brief Snapshot of the serial counters
+ */
+void lamp_serial_get_stats(lamp_serial_stats_t *stats);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,464 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Lamp controller Zigbee trace capture
+ *
+ * This example code is in the Public Domain (or CC0 licensed, at your option.)
+ *
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "lamp_trace.h"
+
+/**
+ * @brief:
+ * Everything that reaches the application from the Zigbee stack (signals,
+ * ZCL action callbacks, ZDO responses), every command another task posts to
+ * the mailbox, the alarms that drain the mailbox or free a place in the
+ * transmit scheduler, and every request the application issues is written to
+ * a RAM ring as a compact record (lamp_trace_format.h) with its time. The
+ * ring keeps the newest LAMP_TRACE_RING_BYTES: a new record pushes out as
+ * many of the oldest ones as it needs room for.
+ *
+ * All writers run in the Zigbee task, or elsewhere with the Zigbee lock held,
+ * so the ring needs no synchronisation of its own. Mailbox posts from other
+ * tasks are recorded when the Zigbee task takes them, not when they are made.
+ * The console copies the ring out a chunk at a time under the lock and prints
+ * the chunk without it, so a dump holds up the stack only for the copies.
+ *
+ * The host replay (host_sim, lamp_replay) reads a dump back, feeds the inputs
+ * through the same handlers and compares the requests they issue with the
+ * recorded ones.
+ */
+
+_Static_assert((LAMP_TRACE_RING_BYTES & (LAMP_TRACE_RING_BYTES - 1)) == 0,
+               "LAMP_TRACE_RING_BYTES must be a power of two");
+_Static_assert(LAMP_TRACE_RING_BYTES >= 2 * LAMP_TRACE_RECORD_MAX, "the ring must hold the largest record");
+_Static_assert(LAMP_TRACE_DUMP_CHUNK >= LAMP_TRACE_RECORD_MAX, "a dump chunk must hold the largest record");
+
+#define RING_MASK       (LAMP_TRACE_RING_BYTES - 1)
+
+static uint8_t s_ring[LAMP_TRACE_RING_BYTES];
+static uint32_t s_head;         /* position after the newest record */
+static uint32_t s_tail;         /* position of the oldest record */
+static atomic_bool s_enabled;
+static lamp_trace_stats_t s_stats;
+
+static void ring_write(const uint8_t *record, uint8_t len)
+{
+    while (s_head + len - s_tail > LAMP_TRACE_RING_BYTES) {
+        s_tail += s_ring[s_tail & RING_MASK];
+        s_stats.held_records--;
+        s_stats.overwritten++;
+    }
+    const uint32_t at = s_head & RING_MASK;
+    const uint32_t first = len <= LAMP_TRACE_RING_BYTES - at ? len : LAMP_TRACE_RING_BYTES - at;
+    memcpy(s_ring + at, record, first);
+    memcpy(s_ring, record + first, len - first);
+    s_head += len;
+    s_stats.records++;
+    s_stats.bytes += len;
+    s_stats.held_records++;
+}
+
+static bool record_begin(lamp_trace_cursor_t *c, uint8_t *buf, uint8_t kind)
+{
+    if (!atomic_load_explicit(&s_enabled, memory_order_relaxed)) {
+        return false;
+    }
+    *c = (lamp_trace_cursor_t){.data = buf, .size = LAMP_TRACE_RECORD_MAX};
+    lamp_trace_put_u8(c, 0); /* length, set by record_end() */
+    lamp_trace_put_u8(c, kind);
+    lamp_trace_put_u32(c, (uint32_t)esp_timer_get_time());
+    return true;
+}
+
+static void record_end(lamp_trace_cursor_t *c)
+{
+    if (c->overflow) {
+        /* only variable lists can overflow, and they stop at what fits */
+        s_stats.truncated++;
+        return;
+    }
+    c->data[0] = (uint8_t)c->pos;
+    ring_write(c->data, (uint8_t)c->pos);
+}
+
+/* Start an optional part of a record; returns where it began for put_end() */
+static size_t put_begin(const lamp_trace_cursor_t *c)
+{
+    return c->pos;
+}
+
+/* Drop a part that did not fit, false if so */
+static bool put_end(lamp_trace_cursor_t *c, size_t begin, bool *truncated)
+{
+    if (!c->overflow) {
+        return true;
+    }
+    c->pos = begin;
+    c->overflow = false;
+    *truncated = true;
+    return false;
+}
+
+static void put_attribute(lamp_trace_cursor_t *c, const esp_zb_zcl_attribute_t *attribute)
+{
+    const uint8_t size = !attribute->data.value ? 0 :
+                         attribute->data.size < LAMP_TRACE_VALUE_MAX ? (uint8_t)attribute->data.size :
+                         LAMP_TRACE_VALUE_MAX;
+    lamp_trace_put_u16(c, attribute->id);
+    lamp_trace_put_u8(c, (uint8_t)attribute->data.type);
+    lamp_trace_put_u8(c, size);
+    lamp_trace_put(c, attribute->data.value, size);
+}
+
+static void put_source(lamp_trace_cursor_t *c, const esp_zb_zcl_addr_t *address, uint8_t src_endpoint,
+                       uint8_t dst_endpoint)
+{
+    lamp_trace_put_u8(c, (uint8_t)address->addr_type);
+    lamp_trace_put_u16(c, address->u.short_addr);
+    lamp_trace_put_u8(c, src_endpoint);
+    lamp_trace_put_u8(c, dst_endpoint);
+}
+
+static void put_info(lamp_trace_cursor_t *c, const esp_zb_zcl_cmd_info_t *info)
+{
+    lamp_trace_put_u8(c, (uint8_t)info->status);
+    put_source(c, &info->src_address, info->src_endpoint, info->dst_endpoint);
+    lamp_trace_put_u16(c, info->cluster);
+    lamp_trace_put_u16(c, info->profile);
+    lamp_trace_put_u8(c, info->command);
+    lamp_trace_put_u8(c, info->header.tsn);
+    lamp_trace_put_u8(c, (uint8_t)info->header.rssi);
+}
+
+void lamp_trace_init(void)
+{
+    s_head = 0;
+    s_tail = 0;
+    memset(&s_stats, 0, sizeof(s_stats));
+    atomic_store(&s_enabled, true);
+    uint8_t buf[LAMP_TRACE_RECORD_MAX];
+    lamp_trace_cursor_t c;
+    record_begin(&c, buf, LAMP_TRACE_BOOT);
+    lamp_trace_put_u8(&c, LAMP_TRACE_VERSION);
+    record_end(&c);
+}
+
+void lamp_trace_enable(bool enable)
+{
+    atomic_store(&s_enabled, enable);
+}
+
+void lamp_trace_signal(const esp_zb_app_signal_t *signal)
+{
+    uint8_t buf[LAMP_TRACE_RECORD_MAX];
+    lamp_trace_cursor_t c;
+    if (!record_begin(&c, buf, LAMP_TRACE_SIGNAL)) {
+        return;
+    }
+    const esp_zb_app_signal_type_t type = *signal->p_app_signal;
+    const void *params = esp_zb_app_signal_get_params(signal->p_app_signal);
+    lamp_trace_put_u16(&c, (uint16_t)type);
+    lamp_trace_put_u32(&c, (uint32_t)signal->esp_err_status);
+    switch (type) {
+    case ESP_ZB_ZDO_SIGNAL_DEVICE_ANNCE: {
+        const esp_zb_zdo_signal_device_annce_params_t *annce = params;
+        lamp_trace_put_u16(&c, annce->device_short_addr);
+        lamp_trace_put(&c, annce->ieee_addr, sizeof(esp_zb_ieee_addr_t));
+        lamp_trace_put_u8(&c, annce->capability);
+        break;
+    }
+    case ESP_ZB_NWK_SIGNAL_PERMIT_JOIN_STATUS:
+        if (signal->esp_err_status == ESP_OK) {
+            lamp_trace_put_u8(&c, *(const uint8_t *)params);
+        }
+        break;
+    case ESP_ZB_BDB_SIGNAL_DEVICE_FIRST_START:
+    case ESP_ZB_BDB_SIGNAL_DEVICE_REBOOT:
+        lamp_trace_put_u8(&c, esp_zb_bdb_is_factory_new());
+        break;
+    default:
+        break;
+    }
+    record_end(&c);
+}
+
+void lamp_trace_action(esp_zb_core_action_callback_id_t callback_id, const void *message)
+{
+    uint8_t buf[LAMP_TRACE_RECORD_MAX];
+    lamp_trace_cursor_t c;
+    if (!message || !record_begin(&c, buf, LAMP_TRACE_ACTION)) {
+        return;
+    }
+    bool truncated = false;
+    lamp_trace_put_u16(&c, (uint16_t)callback_id);
+    switch (callback_id) {
+    case ESP_ZB_CORE_REPORT_ATTR_CB_ID: {
+        const esp_zb_zcl_report_attr_message_t *report = message;
+        lamp_trace_put_u8(&c, (uint8_t)report->status);
+        put_source(&c, &report->src_address, report->src_endpoint, report->dst_endpoint);
+        lamp_trace_put_u16(&c, report->cluster);
+        put_attribute(&c, &report->attribute);
+        break;
+    }
+    case ESP_ZB_CORE_CMD_READ_ATTR_RESP_CB_ID: {
+        const esp_zb_zcl_cmd_read_attr_resp_message_t *resp = message;
+        put_info(&c, &resp->info);
+        const size_t count_at = c.pos;
+        uint8_t count = 0;
+        lamp_trace_put_u8(&c, 0);
+        for (const esp_zb_zcl_read_attr_resp_variable_t *v = resp->variables; v && count < UINT8_MAX; v = v->next) {
+            const size_t begin = put_begin(&c);
+            lamp_trace_put_u8(&c, (uint8_t)v->status);
+            put_attribute(&c, &v->attribute);
+            if (!put_end(&c, begin, &truncated)) {
+                break;
+            }
+            count++;
+        }
+        buf[count_at] = count;
+        break;
+    }
+    case ESP_ZB_CORE_CMD_REPORT_CONFIG_RESP_CB_ID: {
+        const esp_zb_zcl_cmd_config_report_resp_message_t *resp = message;
+        put_info(&c, &resp->info);
+        const size_t count_at = c.pos;
+        uint8_t count = 0;
+        lamp_trace_put_u8(&c, 0);
+        for (const esp_zb_zcl_config_report_resp_variable_t *v = resp->variables; v && count < UINT8_MAX;
+                v = v->next) {
+            const size_t begin = put_begin(&c);
+            lamp_trace_put_u8(&c, (uint8_t)v->status);
+            lamp_trace_put_u8(&c, v->direction);
+            lamp_trace_put_u16(&c, v->attribute_id);
+            if (!put_end(&c, begin, &truncated)) {
+                break;
+            }
+            count++;
+        }
+        buf[count_at] = count;
+        break;
+    }
+    case ESP_ZB_CORE_CMD_DEFAULT_RESP_CB_ID: {
+        const esp_zb_zcl_cmd_default_resp_message_t *resp = message;
+        put_info(&c, &resp->info);
+        lamp_trace_put_u8(&c, resp->resp_to_cmd);
+        lamp_trace_put_u8(&c, (uint8_t)resp->status_code);
+        break;
+    }
+    case ESP_ZB_CORE_CMD_OPERATE_GROUP_RESP_CB_ID: {
+        const esp_zb_zcl_groups_operate_group_resp_message_t *resp = message;
+        put_info(&c, &resp->info);
+        lamp_trace_put_u16(&c, resp->group_id);
+        break;
+    }
+    case ESP_ZB_CORE_CMD_OPERATE_SCENE_RESP_CB_ID: {
+        const esp_zb_zcl_scenes_operate_scene_resp_message_t *resp = message;
+        put_info(&c, &resp->info);
+        lamp_trace_put_u16(&c, resp->group_id);
+        lamp_trace_put_u8(&c, resp->scene_id);
+        break;
+    }
+    default:
+        /* handled by nobody, the id is enough */
+        break;
+    }
+    if (truncated) {
+        s_stats.truncated++;
+    }
+    record_end(&c);
+}
+
+void lamp_trace_match_desc(esp_zb_zdp_status_t status, uint16_t addr, uint8_t endpoint)
+{
+    uint8_t buf[LAMP_TRACE_RECORD_MAX];
+    lamp_trace_cursor_t c;
+    if (!record_begin(&c, buf, LAMP_TRACE_MATCH_DESC)) {
+        return;
+    }
+    /* the replay has no address table, it learns the light's from here */
+    esp_zb_ieee_addr_t ieee_addr = {0};
+    if (status == ESP_ZB_ZDP_STATUS_SUCCESS) {
+        esp_zb_ieee_address_by_short(addr, ieee_addr);
+    }
+    lamp_trace_put_u8(&c, (uint8_t)status);
+    lamp_trace_put_u16(&c, addr);
+    lamp_trace_put_u8(&c, endpoint);
+    lamp_trace_put(&c, ieee_addr, sizeof(ieee_addr));
+    record_end(&c);
+}
+
+void lamp_trace_bind(esp_zb_zdp_status_t status, void *user_ctx)
+{
+    uint8_t buf[LAMP_TRACE_RECORD_MAX];
+    lamp_trace_cursor_t c;
+    if (!record_begin(&c, buf, LAMP_TRACE_BIND)) {
+        return;
+    }
+    lamp_trace_put_u8(&c, (uint8_t)status);
+    lamp_trace_put_u32(&c, (uint32_t)(uintptr_t)user_ctx);
+    record_end(&c);
+}
+
+void lamp_trace_send_status(const esp_zb_zcl_command_send_status_message_t *message)
+{
+    uint8_t buf[LAMP_TRACE_RECORD_MAX];
+    lamp_trace_cursor_t c;
+    if (!record_begin(&c, buf, LAMP_TRACE_SEND_STATUS)) {
+        return;
+    }
+    lamp_trace_put_u32(&c, (uint32_t)message->status);
+    lamp_trace_put_u8(&c, message->dst_addr.addr_type);
+    lamp_trace_put_u16(&c, message->dst_addr.u.short_addr);
+    lamp_trace_put_u8(&c, message->dst_endpoint);
+    lamp_trace_put_u8(&c, message->tsn);
+    record_end(&c);
+}
+
+void lamp_trace_drain(void)
+{
+    uint8_t buf[LAMP_TRACE_RECORD_MAX];
+    lamp_trace_cursor_t c;
+    if (!record_begin(&c, buf, LAMP_TRACE_DRAIN)) {
+        return;
+    }
+    record_end(&c);
+}
+
+void lamp_trace_tx_expire(uint8_t param)
+{
+    uint8_t buf[LAMP_TRACE_RECORD_MAX];
+    lamp_trace_cursor_t c;
+    if (!record_begin(&c, buf, LAMP_TRACE_TX_EXPIRE)) {
+        return;
+    }
+    lamp_trace_put_u8(&c, param);
+    record_end(&c);
+}
+
+void lamp_trace_post(const light_cmd_t *cmd)
+{
+    uint8_t buf[LAMP_TRACE_RECORD_MAX];
+    lamp_trace_cursor_t c;
+    if (!record_begin(&c, buf, LAMP_TRACE_POST)) {
+        return;
+    }
+    const int64_t age = esp_timer_get_time() - cmd->origin_us;
+    lamp_trace_put_u32(&c, age > 0 && age < UINT32_MAX ? (uint32_t)age : 0);
+    lamp_trace_put_u64(&c, cmd->targets);
+    lamp_trace_put_cmd(&c, cmd);
+    record_end(&c);
+}
+
+void lamp_trace_command(const light_cmd_t *cmd, const esp_zb_zcl_basic_cmd_t *basic,
+                        esp_zb_zcl_address_mode_t address_mode, uint8_t tsn)
+{
+    uint8_t buf[LAMP_TRACE_RECORD_MAX];
+    lamp_trace_cursor_t c;
+    if (!record_begin(&c, buf, LAMP_TRACE_COMMAND)) {
+        return;
+    }
+    lamp_trace_put_u8(&c, (uint8_t)address_mode);
+    lamp_trace_put_u16(&c, basic->dst_addr_u.addr_short);
+    lamp_trace_put_u8(&c, basic->dst_endpoint);
+    lamp_trace_put_u8(&c, tsn);
+    lamp_trace_put_cmd(&c, cmd);
+    record_end(&c);
+}
+
+void lamp_trace_zcl_request(uint16_t cluster, uint8_t command, const esp_zb_zcl_basic_cmd_t *basic,
+                            esp_zb_zcl_address_mode_t address_mode, uint8_t tsn, uint16_t arg)
+{
+    uint8_t buf[LAMP_TRACE_RECORD_MAX];
+    lamp_trace_cursor_t c;
+    if (!record_begin(&c, buf, LAMP_TRACE_ZCL_REQUEST)) {
+        return;
+    }
+    lamp_trace_put_u16(&c, cluster);
+    lamp_trace_put_u8(&c, command);
+    lamp_trace_put_u8(&c, (uint8_t)address_mode);
+    lamp_trace_put_u16(&c, basic->dst_addr_u.addr_short);
+    lamp_trace_put_u8(&c, basic->dst_endpoint);
+    lamp_trace_put_u8(&c, tsn);
+    lamp_trace_put_u16(&c, arg);
+    record_end(&c);
+}
+
+void lamp_trace_zdo_request(uint16_t request, uint16_t dst, uint16_t arg)
+{
+    uint8_t buf[LAMP_TRACE_RECORD_MAX];
+    lamp_trace_cursor_t c;
+    if (!record_begin(&c, buf, LAMP_TRACE_ZDO_REQUEST)) {
+        return;
+    }
+    lamp_trace_put_u16(&c, request);
+    lamp_trace_put_u16(&c, dst);
+    lamp_trace_put_u16(&c, arg);
+    record_end(&c);
+}
+
+size_t lamp_trace_read(uint32_t *pos, uint8_t *buf, size_t size)
+{
+    if ((int32_t)(*pos - s_tail) < 0) {
+        *pos = s_tail;
+    }
+    size_t copied = 0;
+    while (*pos != s_head) {
+        const uint8_t len = s_ring[*pos & RING_MASK];
+        if (len > size - copied) {
+            break;
+        }
+        for (uint8_t i = 0; i < len; ++i) {
+            buf[copied++] = s_ring[(*pos + i) & RING_MASK];
+        }
+        *pos += len;
+    }
+    return copied;
+}
+
+void lamp_trace_dump(void)
+{
+    uint8_t chunk[LAMP_TRACE_DUMP_CHUNK];
+    char line[LAMP_TRACE_HEX_MAX + 1];
+    uint32_t pos = 0;
+    esp_zb_lock_acquire(portMAX_DELAY);
+    const uint32_t end = s_head;
+    esp_zb_lock_release();
+    /* records written during the dump are left for the next one */
+    while ((int32_t)(end - pos) > 0) {
+        esp_zb_lock_acquire(portMAX_DELAY);
+        const size_t len = lamp_trace_read(&pos, chunk, sizeof(chunk));
+        esp_zb_lock_release();
+        if (!len) {
+            break;
+        }
+        for (size_t at = 0; at < len; at += chunk[at]) {
+            lamp_trace_encode_hex(line, chunk + at);
+            printf("%s\n", line);
+        }
+    }
+}
+
+void lamp_trace_clear(void)
+{
+    const bool enabled = atomic_load(&s_enabled);
+    s_tail = s_head;
+    memset(&s_stats, 0, sizeof(s_stats));
+    atomic_store(&s_enabled, enabled);
+}
+
+void lamp_trace_get_stats(lamp_trace_stats_t *stats)
+{
+    *stats = s_stats;
+    stats->held_bytes = s_head - s_tail;
+    stats->enabled = atomic_load(&s_enabled);
+}
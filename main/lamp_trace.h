@@ -0,0 +1,126 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Lamp controller Zigbee trace capture
+ *
+ * This example code is in the Public Domain (or CC0 licensed, at your option.)
+ *
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_zigbee_core.h"
+#include "lamp_trace_format.h"
+#include "light_command.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* bytes of the trace ring, a power of two; the oldest records make room for new ones */
+#define LAMP_TRACE_RING_BYTES       16384
+
+/* bytes the console copies out of the ring per hold of the Zigbee lock */
+#define LAMP_TRACE_DUMP_CHUNK       512
+
+typedef struct {
+    uint32_t records;           /* written since the last clear */
+    uint32_t bytes;
+    uint32_t overwritten;       /* oldest records dropped to make room */
+    uint32_t truncated;         /* records that left variables out to fit LAMP_TRACE_RECORD_MAX */
+    uint32_t held_records;      /* in the ring right now */
+    uint32_t held_bytes;
+    bool enabled;
+} lamp_trace_stats_t;
+
+/**
+ * @brief Empty the ring and write the BOOT record, call before the Zigbee task starts
+ */
+void lamp_trace_init(void);
+
+/**
+ * @brief Start or stop recording; recording is on after lamp_trace_init()
+ */
+void lamp_trace_enable(bool enable);
+
+/*
+ * Recording, only from the Zigbee task (or with the Zigbee lock held): the
+ * handler of every input calls its lamp_trace_x() first, and every request
+ * the application issues is recorded right after it.
+ */
+void lamp_trace_signal(const esp_zb_app_signal_t *signal);
+void lamp_trace_action(esp_zb_core_action_callback_id_t callback_id, const void *message);
+void lamp_trace_match_desc(esp_zb_zdp_status_t status, uint16_t addr, uint8_t endpoint);
+void lamp_trace_bind(esp_zb_zdp_status_t status, void *user_ctx);
+void lamp_trace_send_status(const esp_zb_zcl_command_send_status_message_t *message);
+
+/**
+ * @brief Record a transmit scheduler expiry that frees a place, with its alarm parameter
+ */
+void lamp_trace_tx_expire(uint8_t param);
+
+/**
+ * @brief Record a mailbox drain the Zigbee task was woken for, before it takes the commands
+ */
+void lamp_trace_drain(void);
+
+/**
+ * @brief Record a mailbox command posted by another task, as the Zigbee task takes it
+ */
+void lamp_trace_post(const light_cmd_t *cmd);
+
+/**
+ * @brief Record the ZCL request issued for a mailbox command
+ */
+void lamp_trace_command(const light_cmd_t *cmd, const esp_zb_zcl_basic_cmd_t *basic,
+                        esp_zb_zcl_address_mode_t address_mode, uint8_t tsn);
+
+/**
+ * @brief Record any other ZCL request
+ *
+ * @param arg   the request's main argument: group id, scene id or the number of records.
+ */
+void lamp_trace_zcl_request(uint16_t cluster, uint8_t command, const esp_zb_zcl_basic_cmd_t *basic,
+                            esp_zb_zcl_address_mode_t address_mode, uint8_t tsn, uint16_t arg);
+
+/**
+ * @brief Record a ZDO request, LAMP_TRACE_ZDO_MATCH_DESC or LAMP_TRACE_ZDO_BIND
+ *
+ * @param arg   address of interest of a match descriptor request, cluster of a bind request.
+ */
+void lamp_trace_zdo_request(uint16_t request, uint16_t dst, uint16_t arg);
+
+/**
+ * @brief Copy whole records out of the ring, oldest first; call with the Zigbee lock held
+ *
+ * @param pos   ring position to read from, 0 for the oldest record; advanced
+ *              past the records copied. A position the ring has overwritten
+ *              since moves to the oldest record still held.
+ * @return bytes copied, 0 once `pos` reached the newest record.
+ */
+size_t lamp_trace_read(uint32_t *pos, uint8_t *buf, size_t size);
+
+/**
+ * @brief Print the ring as LAMP_TRACE_HEX_PREFIX lines; takes the Zigbee lock once per chunk
+ */
+void lamp_trace_dump(void);
+
+/**
+ * @brief Empty the ring and reset the counters, with the Zigbee lock held
+ */
+void lamp_trace_clear(void);
+
+/**
+ * @brief Snapshot of the counters, with the Zigbee lock held
+ */
+void lamp_trace_get_stats(lamp_trace_stats_t *stats);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,196 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Lamp controller Zigbee trace records
+ *
+ * This example code is in the Public Domain (or CC0 licensed, at your option.)
+ *
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#include <string.h>
+#include "lamp_trace_format.h"
+
+/**
+ * @brief:
+ * The parts of the trace format both ends need: the firmware writes mailbox
+ * commands and hex lines with it, the host replay (host_sim, lamp_replay)
+ * reads them back with the same code. Fields go through the cursor one by
+ * one, never as struct copies, so a capture reads the same on any host.
+ */
+
+const char *lamp_trace_kind_name(uint8_t kind)
+{
+    static const char *const names[LAMP_TRACE_KIND_COUNT] = {
+        [LAMP_TRACE_BOOT] = "boot",
+        [LAMP_TRACE_SIGNAL] = "signal",
+        [LAMP_TRACE_ACTION] = "action",
+        [LAMP_TRACE_MATCH_DESC] = "match_desc",
+        [LAMP_TRACE_BIND] = "bind",
+        [LAMP_TRACE_POST] = "post",
+        [LAMP_TRACE_COMMAND] = "command",
+        [LAMP_TRACE_ZCL_REQUEST] = "zcl_request",
+        [LAMP_TRACE_ZDO_REQUEST] = "zdo_request",
+        [LAMP_TRACE_SEND_STATUS] = "send_status",
+        [LAMP_TRACE_TX_EXPIRE] = "tx_expire",
+        [LAMP_TRACE_DRAIN] = "drain",
+    };
+    return kind < LAMP_TRACE_KIND_COUNT && names[kind] ? names[kind] : "?";
+}
+
+bool lamp_trace_put_cmd(lamp_trace_cursor_t *c, const light_cmd_t *cmd)
+{
+    lamp_trace_put_u8(c, cmd->type);
+    lamp_trace_put_u8(c, cmd->flags);
+    lamp_trace_put_u16(c, cmd->transition_time);
+    switch (cmd->type) {
+    case LIGHT_CMD_LEVEL:
+        lamp_trace_put_u8(c, cmd->level);
+        break;
+    case LIGHT_CMD_COLOR_XY:
+        lamp_trace_put_u16(c, cmd->xy.x);
+        lamp_trace_put_u16(c, cmd->xy.y);
+        break;
+    case LIGHT_CMD_HUE_SAT:
+        lamp_trace_put_u8(c, cmd->hue_sat.hue);
+        lamp_trace_put_u8(c, cmd->hue_sat.saturation);
+        break;
+    case LIGHT_CMD_ENHANCED_HUE:
+        lamp_trace_put_u16(c, cmd->enhanced_hue.hue);
+        lamp_trace_put_u8(c, cmd->enhanced_hue.direction);
+        break;
+    case LIGHT_CMD_COLOR_TEMP:
+        lamp_trace_put_u16(c, cmd->color_temperature);
+        break;
+    case LIGHT_CMD_RECALL_SCENE:
+        lamp_trace_put_u8(c, cmd->preset);
+        break;
+    case LIGHT_CMD_MOVE_LEVEL:
+        lamp_trace_put_u8(c, cmd->move.mode);
+        lamp_trace_put_u8(c, cmd->move.rate);
+        break;
+    case LIGHT_CMD_STEP_LEVEL:
+        lamp_trace_put_u8(c, cmd->step.mode);
+        lamp_trace_put_u8(c, cmd->step.size);
+        break;
+    case LIGHT_CMD_READ_ATTRS: {
+        const uint8_t count = cmd->read.count <= LIGHT_CMD_MAX_READ_ATTRS ? cmd->read.count : LIGHT_CMD_MAX_READ_ATTRS;
+        lamp_trace_put_u16(c, cmd->read.cluster_id);
+        lamp_trace_put_u8(c, count);
+        for (uint8_t i = 0; i < count; ++i) {
+            lamp_trace_put_u16(c, cmd->read.ids[i]);
+        }
+        break;
+    }
+    default:
+        break;
+    }
+    return !c->overflow;
+}
+
+bool lamp_trace_get_cmd(lamp_trace_cursor_t *c, light_cmd_t *cmd)
+{
+    memset(cmd, 0, sizeof(*cmd));
+    cmd->type = lamp_trace_get_u8(c);
+    cmd->flags = lamp_trace_get_u8(c);
+    cmd->transition_time = lamp_trace_get_u16(c);
+    switch (cmd->type) {
+    case LIGHT_CMD_LEVEL:
+        cmd->level = lamp_trace_get_u8(c);
+        break;
+    case LIGHT_CMD_COLOR_XY:
+        cmd->xy.x = lamp_trace_get_u16(c);
+        cmd->xy.y = lamp_trace_get_u16(c);
+        break;
+    case LIGHT_CMD_HUE_SAT:
+        cmd->hue_sat.hue = lamp_trace_get_u8(c);
+        cmd->hue_sat.saturation = lamp_trace_get_u8(c);
+        break;
+    case LIGHT_CMD_ENHANCED_HUE:
+        cmd->enhanced_hue.hue = lamp_trace_get_u16(c);
+        cmd->enhanced_hue.direction = lamp_trace_get_u8(c);
+        break;
+    case LIGHT_CMD_COLOR_TEMP:
+        cmd->color_temperature = lamp_trace_get_u16(c);
+        break;
+    case LIGHT_CMD_RECALL_SCENE:
+        cmd->preset = lamp_trace_get_u8(c);
+        break;
+    case LIGHT_CMD_MOVE_LEVEL:
+        cmd->move.mode = lamp_trace_get_u8(c);
+        cmd->move.rate = lamp_trace_get_u8(c);
+        break;
+    case LIGHT_CMD_STEP_LEVEL:
+        cmd->step.mode = lamp_trace_get_u8(c);
+        cmd->step.size = lamp_trace_get_u8(c);
+        break;
+    case LIGHT_CMD_READ_ATTRS:
+        cmd->read.cluster_id = lamp_trace_get_u16(c);
+        cmd->read.count = lamp_trace_get_u8(c);
+        if (cmd->read.count > LIGHT_CMD_MAX_READ_ATTRS) {
+            c->overflow = true;
+            break;
+        }
+        for (uint8_t i = 0; i < cmd->read.count; ++i) {
+            cmd->read.ids[i] = lamp_trace_get_u16(c);
+        }
+        break;
+    default:
+        break;
+    }
+    return !c->overflow;
+}
+
+void lamp_trace_encode_hex(char *buf, const uint8_t *record)
+{
+    static const char digits[] = "0123456789abcdef";
+    memcpy(buf, LAMP_TRACE_HEX_PREFIX, sizeof(LAMP_TRACE_HEX_PREFIX) - 1);
+    char *out = buf + sizeof(LAMP_TRACE_HEX_PREFIX) - 1;
+    for (size_t i = 0; i < record[0]; ++i) {
+        *out++ = digits[record[i] >> 4];
+        *out++ = digits[record[i] & 0xf];
+    }
+    *out = '\0';
+}
+
+static int hex_digit(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+size_t lamp_trace_decode_hex(const char *line, uint8_t *record)
+{
+    const char *p = strstr(line, LAMP_TRACE_HEX_PREFIX);
+    if (!p) {
+        return 0;
+    }
+    p += sizeof(LAMP_TRACE_HEX_PREFIX) - 1;
+    size_t n = 0;
+    for (;;) {
+        const int high = hex_digit(p[0]);
+        const int low = high < 0 ? -1 : hex_digit(p[1]);
+        if (high < 0 || low < 0) {
+            break;
+        }
+        if (n == LAMP_TRACE_RECORD_MAX) {
+            return 0;
+        }
+        record[n++] = (uint8_t)(high << 4 | low);
+        p += 2;
+    }
+    if (n < LAMP_TRACE_HEADER_SIZE || n != record[0]) {
+        return 0;
+    }
+    return n;
+}
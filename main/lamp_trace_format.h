@@ -0,0 +1,213 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Lamp controller Zigbee trace records
+ *
+ * This example code is in the Public Domain (or CC0 licensed, at your option.)
+ *
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "light_command.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A record is a 6 byte header, then the fields of its kind. All fields are
+ * little-endian and packed, whatever the target's layout:
+ *
+ *   header         u8 length (header included), u8 kind, u32 esp_timer_get_time() (wraps after 71 minutes)
+ *
+ *   BOOT           u8 LAMP_TRACE_VERSION
+ *   SIGNAL         u16 signal type, i32 status, parameters by type:
+ *                    DEVICE_ANNCE: u16 short address, ieee[8], u8 capability
+ *                    PERMIT_JOIN_STATUS: u8 duration
+ *                    DEVICE_FIRST_START, DEVICE_REBOOT: u8 esp_zb_bdb_is_factory_new()
+ *   ACTION         u16 callback id, message by id (below)
+ *   MATCH_DESC     u8 status, u16 address, u8 endpoint, ieee[8] of the address (zero when unknown)
+ *   BIND           u8 status, u32 user context
+ *   POST           u32 age of the command's origin, u64 targets, command
+ *   COMMAND        u8 address mode, u16 destination, u8 endpoint, u8 tsn, command
+ *   ZCL_REQUEST    u16 cluster, u8 command, u8 address mode, u16 destination, u8 endpoint, u8 tsn, u16 argument
+ *   ZDO_REQUEST    u16 ZDO cluster (request), u16 destination, u16 argument
+ *   SEND_STATUS    i32 status, u8 address type, u16 short address, u8 endpoint, u8 tsn
+ *   TX_EXPIRE      u8 alarm parameter of light_tx_expire_cb() (slot, generation)
+ *   DRAIN          nothing, the POST records of the commands it took follow
+ *
+ *   command        u8 type, u8 flags, u16 transition time, then by type: level u8; xy u16 u16; hue and
+ *                  saturation u8 u8; enhanced hue u16 u8; color temperature u16; preset u8; move and step
+ *                  u8 mode u8 rate or size; read u16 cluster, u8 count, u16 ids[count]; stop nothing
+ *
+ * ACTION messages:
+ *
+ *   REPORT_ATTR            u8 status, source, u16 cluster, attribute
+ *   other ZCL messages     info, then by id:
+ *     READ_ATTR_RESP       u8 count, per variable u8 status, attribute
+ *     REPORT_CONFIG_RESP   u8 count, per variable u8 status, u8 direction, u16 attribute id
+ *     DEFAULT_RESP         u8 command answered, u8 status
+ *     OPERATE_GROUP_RESP   u16 group
+ *     OPERATE_SCENE_RESP   u16 group, u8 scene
+ *
+ *   source         u8 address type, u16 short address, u8 source endpoint, u8 destination endpoint
+ *   info           u8 status, source, u16 cluster, u16 profile, u8 command, u8 tsn, i8 rssi
+ *   attribute      u16 id, u8 type, u8 value size, value (its first LAMP_TRACE_VALUE_MAX bytes)
+ *
+ * Variables that do not fit LAMP_TRACE_RECORD_MAX are left out, the count
+ * says how many follow. Kinds and layouts are part of the capture format:
+ * append, and bump LAMP_TRACE_VERSION when a layout changes.
+ */
+#define LAMP_TRACE_VERSION          2
+
+#define LAMP_TRACE_HEADER_SIZE      6
+#define LAMP_TRACE_RECORD_MAX       255
+#define LAMP_TRACE_VALUE_MAX        16
+
+/* prefix of a record written as a hex line for the host replay */
+#define LAMP_TRACE_HEX_PREFIX       "#T:"
+
+/* longest hex line without the newline */
+#define LAMP_TRACE_HEX_MAX          (sizeof(LAMP_TRACE_HEX_PREFIX) - 1 + 2 * LAMP_TRACE_RECORD_MAX)
+
+/* ZDO request clusters of ZDO_REQUEST records */
+#define LAMP_TRACE_ZDO_MATCH_DESC   0x0006
+#define LAMP_TRACE_ZDO_BIND         0x0021
+
+typedef enum {
+    LAMP_TRACE_BOOT = 1,
+    LAMP_TRACE_SIGNAL,
+    LAMP_TRACE_ACTION,
+    LAMP_TRACE_MATCH_DESC,
+    LAMP_TRACE_BIND,
+    LAMP_TRACE_POST,            /* mailbox command posted by another task, as the Zigbee task took it */
+    LAMP_TRACE_COMMAND,         /* ZCL request for a mailbox command */
+    LAMP_TRACE_ZCL_REQUEST,     /* any other ZCL request */
+    LAMP_TRACE_ZDO_REQUEST,
+    LAMP_TRACE_SEND_STATUS,     /* ZCL send status of a request */
+    LAMP_TRACE_TX_EXPIRE,       /* transmit scheduler alarm that freed the place of a frame in flight */
+    LAMP_TRACE_DRAIN,           /* mailbox drain alarm */
+    LAMP_TRACE_KIND_COUNT,
+} lamp_trace_kind_t;
+
+/* Cursor over a record being built or read; puts and gets past the end fail and set `overflow` */
+typedef struct {
+    uint8_t *data;
+    size_t size;
+    size_t pos;
+    bool overflow;
+} lamp_trace_cursor_t;
+
+static inline bool lamp_trace_put(lamp_trace_cursor_t *c, const void *data, size_t len)
+{
+    if (c->overflow || len > c->size - c->pos) {
+        c->overflow = true;
+        return false;
+    }
+    for (size_t i = 0; i < len; ++i) {
+        c->data[c->pos++] = ((const uint8_t *)data)[i];
+    }
+    return true;
+}
+
+static inline bool lamp_trace_put_u8(lamp_trace_cursor_t *c, uint8_t value)
+{
+    return lamp_trace_put(c, &value, 1);
+}
+
+static inline bool lamp_trace_put_u16(lamp_trace_cursor_t *c, uint16_t value)
+{
+    const uint8_t bytes[2] = {(uint8_t)value, (uint8_t)(value >> 8)};
+    return lamp_trace_put(c, bytes, sizeof(bytes));
+}
+
+static inline bool lamp_trace_put_u32(lamp_trace_cursor_t *c, uint32_t value)
+{
+    const uint8_t bytes[4] = {(uint8_t)value, (uint8_t)(value >> 8), (uint8_t)(value >> 16), (uint8_t)(value >> 24)};
+    return lamp_trace_put(c, bytes, sizeof(bytes));
+}
+
+static inline bool lamp_trace_put_u64(lamp_trace_cursor_t *c, uint64_t value)
+{
+    return lamp_trace_put_u32(c, (uint32_t)value) && lamp_trace_put_u32(c, (uint32_t)(value >> 32));
+}
+
+static inline bool lamp_trace_get(lamp_trace_cursor_t *c, void *data, size_t len)
+{
+    if (c->overflow || len > c->size - c->pos) {
+        c->overflow = true;
+        return false;
+    }
+    for (size_t i = 0; i < len; ++i) {
+        ((uint8_t *)data)[i] = c->data[c->pos++];
+    }
+    return true;
+}
+
+static inline uint8_t lamp_trace_get_u8(lamp_trace_cursor_t *c)
+{
+    uint8_t value = 0;
+    lamp_trace_get(c, &value, 1);
+    return value;
+}
+
+static inline uint16_t lamp_trace_get_u16(lamp_trace_cursor_t *c)
+{
+    uint8_t bytes[2] = {0};
+    lamp_trace_get(c, bytes, sizeof(bytes));
+    return (uint16_t)(bytes[0] | bytes[1] << 8);
+}
+
+static inline uint32_t lamp_trace_get_u32(lamp_trace_cursor_t *c)
+{
+    uint8_t bytes[4] = {0};
+    lamp_trace_get(c, bytes, sizeof(bytes));
+    return (uint32_t)bytes[0] | (uint32_t)bytes[1] << 8 | (uint32_t)bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+}
+
+static inline uint64_t lamp_trace_get_u64(lamp_trace_cursor_t *c)
+{
+    const uint32_t low = lamp_trace_get_u32(c);
+    return (uint64_t)lamp_trace_get_u32(c) << 32 | low;
+}
+
+/**
+ * @brief Name of a record kind, "?" for an unknown one
+ */
+const char *lamp_trace_kind_name(uint8_t kind);
+
+/**
+ * @brief Write the type, flags, transition time and value of a mailbox command
+ */
+bool lamp_trace_put_cmd(lamp_trace_cursor_t *c, const light_cmd_t *cmd);
+
+/**
+ * @brief Read a command written by lamp_trace_put_cmd(), targets and times are left zero
+ */
+bool lamp_trace_get_cmd(lamp_trace_cursor_t *c, light_cmd_t *cmd);
+
+/**
+ * @brief Write a record as a LAMP_TRACE_HEX_PREFIX line, without the newline
+ *
+ * @param buf       at least LAMP_TRACE_HEX_MAX + 1 bytes.
+ */
+void lamp_trace_encode_hex(char *buf, const uint8_t *record);
+
+/**
+ * @brief Read a record back from a hex line, which may have text before the prefix
+ *
+ * @param record    LAMP_TRACE_RECORD_MAX bytes.
+ * @return length of the record, 0 if the line holds no valid record.
+ */
+size_t lamp_trace_decode_hex(const char *line, uint8_t *record);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
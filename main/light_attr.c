@@ -0,0 +1,344 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Lamp controller light attribute cache
+ *
+ * This example code is in the Public Domain (or CC0 licensed, at your option.)
+ *
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#include <string.h>
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "lamp_log.h"
+#include "light_attr.h"
+#include "light_scene.h"
+#include "zcl_utility.h"
+
+/**
+ * @brief:
+ * Every cached attribute fits in 32 bits, so a light costs a value and a
+ * timestamp per attribute plus the values its unconfirmed writes will set.
+ * Writes are only committed once the light acknowledges them with a
+ * successful default response; until then the old value stays cached, and
+ * a light with a write in flight never has a write skipped.
+ */
+
+_Static_assert(LIGHT_ATTR_COUNT <= 16, "valid and pending masks are 16 bits");
+
+typedef struct {
+    uint16_t cluster_id;
+    uint16_t attr_id;
+    uint16_t written_by;        /* cluster whose default response confirms a write, 0 if never written */
+} light_attr_desc_t;
+
+static const light_attr_desc_t s_desc[LIGHT_ATTR_COUNT] = {
+    [LIGHT_ATTR_ON_OFF] = {ESP_ZB_ZCL_CLUSTER_ID_ON_OFF, ESP_ZB_ZCL_ATTR_ON_OFF_ON_OFF_ID,
+                           ESP_ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL},
+    [LIGHT_ATTR_LEVEL] = {ESP_ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL, ESP_ZB_ZCL_ATTR_LEVEL_CONTROL_CURRENT_LEVEL_ID,
+                          ESP_ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL},
+    [LIGHT_ATTR_HUE] = {ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL, ESP_ZB_ZCL_ATTR_COLOR_CONTROL_CURRENT_HUE_ID,
+                        ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL},
+    [LIGHT_ATTR_SATURATION] = {ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL, ESP_ZB_ZCL_ATTR_COLOR_CONTROL_CURRENT_SATURATION_ID,
+                               ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL},
+    [LIGHT_ATTR_X] = {ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL, ESP_ZB_ZCL_ATTR_COLOR_CONTROL_CURRENT_X_ID,
+                      ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL},
+    [LIGHT_ATTR_Y] = {ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL, ESP_ZB_ZCL_ATTR_COLOR_CONTROL_CURRENT_Y_ID,
+                      ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL},
+    [LIGHT_ATTR_ENHANCED_HUE] = {ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL,
+                                 ESP_ZB_ZCL_ATTR_COLOR_CONTROL_ENHANCED_CURRENT_HUE_ID,
+                                 ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL},
+    [LIGHT_ATTR_COLOR_TEMPERATURE] = {ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL,
+                                      ESP_ZB_ZCL_ATTR_COLOR_CONTROL_COLOR_TEMPERATURE_ID,
+                                      ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL},
+    [LIGHT_ATTR_COLOR_MODE] = {ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL, ESP_ZB_ZCL_ATTR_COLOR_CONTROL_COLOR_MODE_ID,
+                               ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL},
+    [LIGHT_ATTR_COLOR_LOOP_ACTIVE] = {ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL,
+                                      ESP_ZB_ZCL_ATTR_COLOR_CONTROL_COLOR_LOOP_ACTIVE_ID, 0},
+    [LIGHT_ATTR_COLOR_CAPABILITIES] = {ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL,
+                                       ESP_ZB_ZCL_ATTR_COLOR_CONTROL_COLOR_CAPABILITIES_ID, 0},
+    [LIGHT_ATTR_OTA_FILE_VERSION] = {ESP_ZB_ZCL_CLUSTER_ID_OTA_UPGRADE, ESP_ZB_ZCL_ATTR_OTA_UPGRADE_FILE_VERSION_ID, 0},
+};
+
+typedef struct {
+    uint32_t value[LIGHT_ATTR_COUNT];
+    uint32_t updated_ms[LIGHT_ATTR_COUNT];
+    uint32_t expected[LIGHT_ATTR_COUNT];    /* set by the unconfirmed write */
+    uint16_t valid;
+    uint16_t pending;                       /* attributes in expected[] */
+} light_attr_entry_t;
+
+/* values a write leaves the light with */
+typedef struct {
+    uint16_t attrs;
+    uint16_t unknown;                       /* changed to values only the light knows */
+    uint32_t value[LIGHT_ATTR_COUNT];
+} light_attr_outcome_t;
+
+static const char *TAG = "LIGHT_ATTR";
+
+static light_attr_entry_t s_cache[LIGHT_REGISTRY_CAPACITY];
+
+static uint32_t light_attr_now_ms(void)
+{
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+static void light_attr_store(light_attr_entry_t *entry, light_attr_t attr, uint32_t value, uint32_t now_ms)
+{
+    entry->value[attr] = value;
+    entry->updated_ms[attr] = now_ms;
+    entry->valid |= 1U << attr;
+}
+
+static void outcome_set(light_attr_outcome_t *outcome, light_attr_t attr, uint32_t value)
+{
+    outcome->attrs |= 1U << attr;
+    outcome->value[attr] = value;
+}
+
+static bool light_attr_outcome(const light_cmd_t *cmd, light_attr_outcome_t *outcome)
+{
+    outcome->attrs = 0;
+    outcome->unknown = 0;
+    switch (cmd->type) {
+    case LIGHT_CMD_LEVEL:
+        /* move to level with on/off turns the light off at the minimum level */
+        outcome_set(outcome, LIGHT_ATTR_LEVEL, cmd->level);
+        outcome_set(outcome, LIGHT_ATTR_ON_OFF, cmd->level > 1);
+        return true;
+    case LIGHT_CMD_COLOR_XY:
+        outcome_set(outcome, LIGHT_ATTR_X, cmd->xy.x);
+        outcome_set(outcome, LIGHT_ATTR_Y, cmd->xy.y);
+        outcome_set(outcome, LIGHT_ATTR_COLOR_MODE, 1);
+        return true;
+    case LIGHT_CMD_HUE_SAT:
+        outcome_set(outcome, LIGHT_ATTR_HUE, cmd->hue_sat.hue);
+        outcome_set(outcome, LIGHT_ATTR_SATURATION, cmd->hue_sat.saturation);
+        outcome_set(outcome, LIGHT_ATTR_COLOR_MODE, 0);
+        return true;
+    case LIGHT_CMD_ENHANCED_HUE:
+        outcome_set(outcome, LIGHT_ATTR_ENHANCED_HUE, cmd->enhanced_hue.hue);
+        outcome_set(outcome, LIGHT_ATTR_HUE, cmd->enhanced_hue.hue >> 8);
+        outcome_set(outcome, LIGHT_ATTR_COLOR_MODE, 0);
+        return true;
+    case LIGHT_CMD_COLOR_TEMP:
+        outcome_set(outcome, LIGHT_ATTR_COLOR_TEMPERATURE, cmd->color_temperature);
+        outcome_set(outcome, LIGHT_ATTR_COLOR_MODE, 2);
+        return true;
+    case LIGHT_CMD_RECALL_SCENE: {
+        const light_scene_preset_t *preset = light_scene_preset(cmd->preset);
+        if (!preset) {
+            return false;
+        }
+        outcome_set(outcome, LIGHT_ATTR_LEVEL, preset->level);
+        outcome_set(outcome, LIGHT_ATTR_ON_OFF, preset->level > 1);
+        outcome_set(outcome, LIGHT_ATTR_X, preset->color_x);
+        outcome_set(outcome, LIGHT_ATTR_Y, preset->color_y);
+        outcome_set(outcome, LIGHT_ATTR_COLOR_MODE, 1);
+        return true;
+    }
+    case LIGHT_CMD_MOVE_LEVEL:
+    case LIGHT_CMD_STEP_LEVEL:
+        /* relative to a level that may be stale, and may cross the minimum */
+        outcome->unknown = 1U << LIGHT_ATTR_LEVEL | 1U << LIGHT_ATTR_ON_OFF;
+        return true;
+    case LIGHT_CMD_STOP_LEVEL:
+        outcome->unknown = 1U << LIGHT_ATTR_LEVEL;
+        return true;
+    default:
+        return false;
+    }
+}
+
+void light_attr_init(void)
+{
+    memset(s_cache, 0, sizeof(s_cache));
+}
+
+void light_attr_forget(uint8_t index)
+{
+    if (index < LIGHT_REGISTRY_CAPACITY) {
+        memset(&s_cache[index], 0, sizeof(s_cache[index]));
+    }
+}
+
+light_attr_t light_attr_lookup(uint16_t cluster_id, uint16_t attr_id)
+{
+    for (int attr = 0; attr < LIGHT_ATTR_COUNT; ++attr) {
+        if (s_desc[attr].cluster_id == cluster_id && s_desc[attr].attr_id == attr_id) {
+            return (light_attr_t)attr;
+        }
+    }
+    return LIGHT_ATTR_COUNT;
+}
+
+esp_err_t light_attr_update(uint8_t index, uint16_t cluster_id, const esp_zb_zcl_attribute_t *attribute)
+{
+    zcl_value_t value;
+    ESP_RETURN_ON_ERROR(esp_zcl_utility_decode_value(&attribute->data, &value), TAG,
+                        "Failed to decode attribute 0x%04x of cluster 0x%04x", attribute->id, cluster_id);
+    switch (value.kind) {
+    /* every report lands here: log through the ring, values wider than a record argument in place */
+    case ZCL_VALUE_UNSIGNED:
+        if (value.u <= UINT32_MAX) {
+            LAMP_LOGI(ATTR_UNSIGNED, index, cluster_id, attribute->id, value.u);
+        } else {
+            ESP_LOGI(TAG, "Light %d cluster 0x%04x attribute 0x%04x = %llu", index, cluster_id, attribute->id,
+                     (unsigned long long)value.u);
+        }
+        break;
+    case ZCL_VALUE_SIGNED:
+        if (value.s >= INT32_MIN && value.s <= INT32_MAX) {
+            LAMP_LOGI(ATTR_SIGNED, index, cluster_id, attribute->id, (int32_t)value.s);
+        } else {
+            ESP_LOGI(TAG, "Light %d cluster 0x%04x attribute 0x%04x = %lld", index, cluster_id, attribute->id,
+                     (long long)value.s);
+        }
+        break;
+    case ZCL_VALUE_FLOAT:
+        LAMP_LOGI(ATTR_FLOAT, index, cluster_id, attribute->id, lamp_log_float((float)value.f));
+        break;
+    case ZCL_VALUE_STRING:
+        ESP_LOGI(TAG, "Light %d cluster 0x%04x attribute 0x%04x = \"%.*s\"", index, cluster_id, attribute->id,
+                 value.bytes.length, (const char *)value.bytes.data);
+        break;
+    default:
+        ESP_LOGI(TAG, "Light %d cluster 0x%04x attribute 0x%04x, type 0x%x, %d bytes", index, cluster_id,
+                 attribute->id, attribute->data.type, value.bytes.length);
+        break;
+    }
+
+    const light_attr_t attr = light_attr_lookup(cluster_id, attribute->id);
+    if (attr == LIGHT_ATTR_COUNT || index >= LIGHT_REGISTRY_CAPACITY) {
+        return ESP_OK;
+    }
+    light_attr_entry_t *entry = &s_cache[index];
+    if (value.kind == ZCL_VALUE_UNSIGNED) {
+        light_attr_store(entry, attr, (uint32_t)value.u, light_attr_now_ms());
+    } else if (value.kind == ZCL_VALUE_SIGNED) {
+        light_attr_store(entry, attr, (uint32_t)value.s, light_attr_now_ms());
+    } else {
+        entry->valid &= ~(1U << attr);
+    }
+    return ESP_OK;
+}
+
+uint32_t light_attr_age_ms(uint8_t index, light_attr_t attr)
+{
+    if (index >= LIGHT_REGISTRY_CAPACITY || attr >= LIGHT_ATTR_COUNT || !(s_cache[index].valid & 1U << attr)) {
+        return UINT32_MAX;
+    }
+    return light_attr_now_ms() - s_cache[index].updated_ms[attr];
+}
+
+/* a light reporting an attribute would have told us about a change, so its value does not age */
+static bool light_attr_stale(uint8_t index, light_attr_t attr)
+{
+    const uint32_t age_ms = light_attr_age_ms(index, attr);
+    if (age_ms == UINT32_MAX) {
+        return true;
+    }
+    const light_bulb_device_params_t *light = light_registry_get(index);
+    return age_ms >= LIGHT_ATTR_MAX_AGE_MS && !(light && (light->reported_attrs & 1U << attr));
+}
+
+bool light_attr_get(uint8_t index, light_attr_t attr, uint32_t *value)
+{
+    if (light_attr_stale(index, attr)) {
+        return false;
+    }
+    *value = s_cache[index].value[attr];
+    return true;
+}
+
+light_mask_t light_attr_fresh(light_mask_t lights, uint16_t cluster_id, const uint16_t *attr_ids, uint8_t count)
+{
+    light_mask_t fresh = lights;
+    for (uint8_t i = 0; i < count && fresh; ++i) {
+        const light_attr_t attr = light_attr_lookup(cluster_id, attr_ids[i]);
+        if (attr == LIGHT_ATTR_COUNT) {
+            return 0;
+        }
+        uint8_t index;
+        LIGHT_MASK_FOR_EACH(index, fresh) {
+            if (light_attr_stale(index, attr)) {
+                fresh &= ~LIGHT_MASK(index);
+            }
+        }
+    }
+    return fresh;
+}
+
+bool light_attr_matches(uint8_t index, const light_cmd_t *cmd)
+{
+    light_attr_outcome_t outcome;
+    if (index >= LIGHT_REGISTRY_CAPACITY || !light_attr_outcome(cmd, &outcome) || outcome.unknown ||
+        s_cache[index].pending) {
+        return false;
+    }
+    for (int attr = 0; attr < LIGHT_ATTR_COUNT; ++attr) {
+        uint32_t value;
+        if ((outcome.attrs & 1U << attr) &&
+            (!light_attr_get(index, (light_attr_t)attr, &value) || value != outcome.value[attr])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void light_attr_sent(const light_cmd_t *cmd, light_mask_t groupcast)
+{
+    light_attr_outcome_t outcome;
+    if (!light_attr_outcome(cmd, &outcome)) {
+        return;
+    }
+    uint8_t index;
+    LIGHT_MASK_FOR_EACH(index, cmd->targets) {
+        light_attr_entry_t *entry = &s_cache[index];
+        entry->valid &= ~outcome.unknown;
+        entry->pending &= ~outcome.unknown;
+        if (groupcast & LIGHT_MASK(index)) {
+            entry->valid &= ~outcome.attrs;
+            entry->pending &= ~outcome.attrs;
+            continue;
+        }
+        for (int attr = 0; attr < LIGHT_ATTR_COUNT; ++attr) {
+            if (outcome.attrs & 1U << attr) {
+                entry->expected[attr] = outcome.value[attr];
+            }
+        }
+        entry->pending |= outcome.attrs;
+    }
+}
+
+void light_attr_confirm(uint8_t index, uint16_t cluster_id, esp_zb_zcl_status_t status)
+{
+    if (index >= LIGHT_REGISTRY_CAPACITY) {
+        return;
+    }
+    light_attr_entry_t *entry = &s_cache[index];
+    uint16_t confirmed = 0;
+    for (int attr = 0; attr < LIGHT_ATTR_COUNT; ++attr) {
+        /* a scene recall sets attributes of several clusters at once */
+        if ((entry->pending & 1U << attr) &&
+            (s_desc[attr].written_by == cluster_id || cluster_id == ESP_ZB_ZCL_CLUSTER_ID_SCENES)) {
+            confirmed |= 1U << attr;
+        }
+    }
+    entry->pending &= ~confirmed;
+    if (status != ESP_ZB_ZCL_STATUS_SUCCESS) {
+        entry->valid &= ~confirmed;
+        return;
+    }
+    const uint32_t now_ms = light_attr_now_ms();
+    for (int attr = 0; attr < LIGHT_ATTR_COUNT; ++attr) {
+        if (confirmed & 1U << attr) {
+            light_attr_store(entry, (light_attr_t)attr, entry->expected[attr], now_ms);
+        }
+    }
+}
@@ -0,0 +1,129 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Lamp controller light attribute cache
+ *
+ * This example code is in the Public Domain (or CC0 licensed, at your option.)
+ *
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_zigbee_core.h"
+#include "light_command.h"
+#include "light_registry.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * cached values older than this are stale: not used to answer reads or to skip
+ * writes, unless the light reports the attribute (light_report.h)
+ */
+#define LIGHT_ATTR_MAX_AGE_MS       60000
+
+/* attributes kept per light */
+typedef enum {
+    LIGHT_ATTR_ON_OFF,
+    LIGHT_ATTR_LEVEL,
+    LIGHT_ATTR_HUE,
+    LIGHT_ATTR_SATURATION,
+    LIGHT_ATTR_X,
+    LIGHT_ATTR_Y,
+    LIGHT_ATTR_ENHANCED_HUE,
+    LIGHT_ATTR_COLOR_TEMPERATURE,
+    LIGHT_ATTR_COLOR_MODE,
+    LIGHT_ATTR_COLOR_LOOP_ACTIVE,
+    LIGHT_ATTR_COLOR_CAPABILITIES,
+    LIGHT_ATTR_OTA_FILE_VERSION,
+    LIGHT_ATTR_COUNT,
+} light_attr_t;
+
+/*
+ * The cache holds only what lights told us: read responses, reports and
+ * default responses to unicast writes. Call from the Zigbee task.
+ */
+
+/**
+ * @brief Forget every cached value
+ */
+void light_attr_init(void);
+
+/**
+ * @brief Forget the cached values of one light, for a slot taken by a new light
+ */
+void light_attr_forget(uint8_t index);
+
+/**
+ * @brief Cache slot of a ZCL attribute
+ *
+ * @return the attribute, LIGHT_ATTR_COUNT if it is not cached.
+ */
+light_attr_t light_attr_lookup(uint16_t cluster_id, uint16_t attr_id);
+
+/**
+ * @brief Store an attribute value received from a light
+ *
+ * @param index         slot index of the light.
+ * @param cluster_id    cluster of the attribute.
+ * @param attribute     attribute as received, decoded according to its data type.
+ * @return ESP_OK if stored or not cached, decoding error otherwise.
+ */
+esp_err_t light_attr_update(uint8_t index, uint16_t cluster_id, const esp_zb_zcl_attribute_t *attribute);
+
+/**
+ * @brief Fresh cached value of an attribute
+ *
+ * @return true and the value if known and either reported by the light or
+ *         younger than LIGHT_ATTR_MAX_AGE_MS.
+ */
+bool light_attr_get(uint8_t index, light_attr_t attr, uint32_t *value);
+
+/**
+ * @brief Age of a cached value
+ *
+ * @return milliseconds since the value was received, UINT32_MAX if unknown.
+ */
+uint32_t light_attr_age_ms(uint8_t index, light_attr_t attr);
+
+/**
+ * @brief Lights whose fresh cache holds every one of a set of attributes
+ *
+ * @return subset of lights for which a read of these attributes needs no frame.
+ */
+light_mask_t light_attr_fresh(light_mask_t lights, uint16_t cluster_id, const uint16_t *attr_ids, uint8_t count);
+
+/**
+ * @brief Whether a light is known to already be in the state a write would set
+ */
+bool light_attr_matches(uint8_t index, const light_cmd_t *cmd);
+
+/**
+ * @brief Record a write handed to the stack
+ *
+ * Unicast targets confirm the new values with their default response,
+ * groupcast targets never answer, so their values become unknown.
+ *
+ * @param cmd           the write, targets are the lights it was sent to.
+ * @param groupcast     targets reached by groupcast.
+ */
+void light_attr_sent(const light_cmd_t *cmd, light_mask_t groupcast);
+
+/**
+ * @brief Apply a default response to the values written by the last write
+ *
+ * @param index         slot index of the light.
+ * @param cluster_id    cluster of the answered command.
+ * @param status        ZCL status of the default response.
+ */
+void light_attr_confirm(uint8_t index, uint16_t cluster_id, esp_zb_zcl_status_t status);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
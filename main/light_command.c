@@ -0,0 +1,565 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Lamp controller light command mailbox
+ *
+ * This example code is in the Public Domain (or CC0 licensed, at your option.)
+ *
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#include <stdatomic.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_zigbee_core.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "lamp_mem.h"
+#include "lamp_ring.h"
+#include "lamp_trace.h"
+#include "light_attr.h"
+#include "light_command.h"
+#include "light_scene.h"
+
+/**
+ * @brief:
+ * Producers (button task, serial, timers) claim a slot of a lamp_ring with a
+ * single compare-and-swap and publish it, so a post never waits for the
+ * Zigbee stack. The Zigbee task is the only consumer: posts wake it through
+ * the stack scheduler when its lock is free right away. A post that finds the
+ * stack busy arms a one-shot backstop timer instead, which retries the wake
+ * until it gets through and stops once the mailbox is empty. Commands are
+ * only taken in these wake-ups, and each is recorded in the trace, so a
+ * replay drains the mailbox where the Zigbee task did.
+ *
+ * Writes are then coalesced: each light keeps only its newest pending level
+ * and its newest pending color (of any color command type), and a light gets
+ * at most one write per cluster on the air at a time. While a write is in
+ * flight, newer values overwrite the pending one, so a burst of inputs costs
+ * at most one frame per light and cluster beyond the first. A scene recall
+ * travels in the color lane and replaces any pending level as well. A level
+ * posted after a recall waits until the recall is out, and a color posted
+ * after one takes its place but leaves the preset's level pending, so the
+ * light ends up where the inputs left it in the order they came. Relative level
+ * commands (move, step, stop) share the level lane, so a stop that catches up with
+ * a move still pending cancels it and nothing is sent. Lights with the
+ * same pending value are sent together as one command. Lights reached by a
+ * groupcast never answer it, so they are held for a short fixed time instead.
+ *
+ * Writes the attribute cache shows a light already holds are dropped, and
+ * reads it can answer never reach the network.
+ *
+ * The transmit scheduler decides when a value goes out: interactive values
+ * are offered before fade setpoints, and lights it holds back keep their
+ * value pending, so it keeps coalescing until the scheduler runs the flush
+ * again. Reads wait in a short backlog behind the writes pending for their
+ * lights, a read already waiting takes the targets of the same read posted
+ * again. The mailbox is always drained, so reads never hold up writes: once
+ * the backlog is full, a new read joins a waiting read of the same cluster if
+ * their attributes fit in one request, or is dropped and counted. Attribute
+ * reports and the next read refresh what it would have asked for.
+ */
+
+_Static_assert((LIGHT_COMMAND_QUEUE_LEN & (LIGHT_COMMAND_QUEUE_LEN - 1)) == 0,
+               "LIGHT_COMMAND_QUEUE_LEN must be a power of two");
+_Static_assert(LIGHT_COMMAND_QUEUE_LEN <= UINT8_MAX, "depth is reported as uint8_t");
+
+#define QUEUE_MASK      (LIGHT_COMMAND_QUEUE_LEN - 1)
+
+typedef struct {
+    bool external;              /* posted by another task than the Zigbee task, for the trace */
+    light_cmd_t cmd;
+} light_command_cell_t;
+
+static const char *TAG = "LIGHT_COMMAND";
+
+static lamp_ring_t s_ring;
+static atomic_uint s_seq[LIGHT_COMMAND_QUEUE_LEN];
+static light_command_cell_t s_cells[LIGHT_COMMAND_QUEUE_LEN];
+static atomic_bool s_drain_scheduled;
+static light_command_handler_t s_handler;
+static TaskHandle_t s_consumer;
+static esp_timer_handle_t s_backstop;
+
+static atomic_uint s_enqueued;
+static atomic_uint s_dropped;
+static light_command_stats_t s_stats;   /* consumer side counters */
+
+/* consumer side coalescing state, one entry per light slot */
+typedef enum {
+    LANE_LEVEL,
+    LANE_COLOR,
+    LANE_COUNT,
+} light_command_lane_t;
+
+typedef struct {
+    light_cmd_t cmd[LIGHT_REGISTRY_CAPACITY];           /* newest value per light */
+    int64_t busy_until_us[LIGHT_REGISTRY_CAPACITY];     /* in-flight write expires */
+    light_mask_t pending;
+    light_mask_t busy;
+} light_command_lane_state_t;
+
+static light_command_lane_state_t s_lanes[LANE_COUNT];
+static light_cmd_t s_reads[LIGHT_COMMAND_READ_BACKLOG];
+static uint8_t s_read_count;
+static bool s_first_logged;     /* boot to first write for a light, from any input */
+
+static bool light_command_take(light_cmd_t *cmd)
+{
+    unsigned pos;
+    if (!lamp_ring_take(&s_ring, &pos)) {
+        return false;
+    }
+    const light_command_cell_t *cell = &s_cells[pos & QUEUE_MASK];
+    *cmd = cell->cmd;
+    if (cell->external) {
+        lamp_trace_post(cmd);
+    }
+    lamp_ring_release(&s_ring, pos);
+    return true;
+}
+
+static light_mask_t light_command_send(const light_cmd_t *cmd, light_mask_t *deferred)
+{
+    *deferred = 0;
+    const light_mask_t groupcast = s_handler(cmd, deferred);
+    *deferred &= cmd->targets;
+    s_stats.deferred += __builtin_popcountll(*deferred);
+    if (*deferred == cmd->targets) {
+        return groupcast;
+    }
+    const uint32_t latency = (uint32_t)(esp_timer_get_time() - cmd->enqueue_us);
+    s_stats.sent++;
+    s_stats.latency_last_us = latency;
+    s_stats.latency_total_us += latency;
+    if (latency > s_stats.latency_max_us) {
+        s_stats.latency_max_us = latency;
+    }
+    return groupcast;
+}
+
+static light_command_lane_t light_cmd_lane(uint8_t type)
+{
+    switch (type) {
+    case LIGHT_CMD_LEVEL:
+    case LIGHT_CMD_MOVE_LEVEL:
+    case LIGHT_CMD_STEP_LEVEL:
+    case LIGHT_CMD_STOP_LEVEL:
+        return LANE_LEVEL;
+    default:
+        return LANE_COLOR;
+    }
+}
+
+static bool light_cmd_same_value(const light_cmd_t *a, const light_cmd_t *b)
+{
+    if (a->type != b->type || a->flags != b->flags || a->transition_time != b->transition_time) {
+        return false;
+    }
+    switch (a->type) {
+    case LIGHT_CMD_LEVEL:
+        return a->level == b->level;
+    case LIGHT_CMD_COLOR_XY:
+        return a->xy.x == b->xy.x && a->xy.y == b->xy.y;
+    case LIGHT_CMD_HUE_SAT:
+        return a->hue_sat.hue == b->hue_sat.hue && a->hue_sat.saturation == b->hue_sat.saturation;
+    case LIGHT_CMD_ENHANCED_HUE:
+        return a->enhanced_hue.hue == b->enhanced_hue.hue && a->enhanced_hue.direction == b->enhanced_hue.direction;
+    case LIGHT_CMD_COLOR_TEMP:
+        return a->color_temperature == b->color_temperature;
+    case LIGHT_CMD_RECALL_SCENE:
+        return a->preset == b->preset;
+    case LIGHT_CMD_MOVE_LEVEL:
+        return a->move.mode == b->move.mode && a->move.rate == b->move.rate;
+    case LIGHT_CMD_STEP_LEVEL:
+        return a->step.mode == b->step.mode && a->step.size == b->step.size;
+    case LIGHT_CMD_STOP_LEVEL:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool light_cmd_same_read(const light_cmd_t *a, const light_cmd_t *b)
+{
+    return a->read.cluster_id == b->read.cluster_id && a->read.count == b->read.count &&
+           memcmp(a->read.ids, b->read.ids, a->read.count * sizeof(a->read.ids[0])) == 0;
+}
+
+/* Add the attributes and targets of `read` to `into` if both ask the same cluster and fit one request */
+static bool light_cmd_join_read(light_cmd_t *into, const light_cmd_t *read)
+{
+    if (into->read.cluster_id != read->read.cluster_id) {
+        return false;
+    }
+    uint16_t ids[LIGHT_CMD_MAX_READ_ATTRS];
+    uint8_t count = into->read.count;
+    memcpy(ids, into->read.ids, count * sizeof(ids[0]));
+    for (uint8_t i = 0; i < read->read.count; ++i) {
+        bool known = false;
+        for (uint8_t j = 0; j < count && !known; ++j) {
+            known = ids[j] == read->read.ids[i];
+        }
+        if (known) {
+            continue;
+        }
+        if (count == LIGHT_CMD_MAX_READ_ATTRS) {
+            return false;
+        }
+        ids[count++] = read->read.ids[i];
+    }
+    memcpy(into->read.ids, ids, count * sizeof(ids[0]));
+    into->read.count = count;
+    into->targets |= read->targets;
+    return true;
+}
+
+light_tx_lane_t light_command_tx_lane(const light_cmd_t *cmd)
+{
+    return cmd->type == LIGHT_CMD_READ_ATTRS || (cmd->flags & LIGHT_CMD_FLAG_FADE) ? LIGHT_TX_BULK
+                                                                                    : LIGHT_TX_INTERACTIVE;
+}
+
+static void light_command_pump_cb(uint8_t param);
+
+/* Lights with a scene recall pending or in flight in the color lane */
+static light_mask_t light_command_recalling(void)
+{
+    const light_command_lane_state_t *color = &s_lanes[LANE_COLOR];
+    light_mask_t recalling = 0;
+    uint8_t index;
+    LIGHT_MASK_FOR_EACH(index, color->pending | color->busy) {
+        if (color->cmd[index].type == LIGHT_CMD_RECALL_SCENE) {
+            recalling |= LIGHT_MASK(index);
+        }
+    }
+    return recalling;
+}
+
+/*
+ * A color write replacing a pending recall leaves the recall's level in the
+ * level lane, unless a level posted after the recall is already waiting there.
+ */
+static void light_command_split_recall(light_mask_t targets)
+{
+    light_command_lane_state_t *color = &s_lanes[LANE_COLOR];
+    light_command_lane_state_t *level = &s_lanes[LANE_LEVEL];
+    uint8_t index;
+    LIGHT_MASK_FOR_EACH(index, targets & color->pending & ~level->pending) {
+        const light_cmd_t *recall = &color->cmd[index];
+        const light_scene_preset_t *preset =
+            recall->type == LIGHT_CMD_RECALL_SCENE ? light_scene_preset(recall->preset) : NULL;
+        if (!preset) {
+            continue;
+        }
+        level->cmd[index] = (light_cmd_t) {
+            .type = LIGHT_CMD_LEVEL,
+            .transition_time = recall->transition_time,
+            .origin_us = recall->origin_us,
+            .enqueue_us = recall->enqueue_us,
+            .level = preset->level,
+        };
+        level->pending |= LIGHT_MASK(index);
+    }
+}
+
+/* Send the pending values of one transmit lane whose light has no write in flight on that mailbox lane */
+static void light_command_flush_lane(light_command_lane_state_t *state, int tx_lane, int64_t now)
+{
+    light_mask_t ready = state->pending & ~state->busy & light_registry_all();
+    if (state == &s_lanes[LANE_LEVEL]) {
+        /* a pending level was posted after the recall (the recall cleared the lane), it goes second */
+        ready &= ~light_command_recalling();
+    }
+    uint8_t index;
+    LIGHT_MASK_FOR_EACH(index, ready) {
+        if (light_command_tx_lane(&state->cmd[index]) != tx_lane) {
+            ready &= ~LIGHT_MASK(index);
+        } else if (light_attr_matches(index, &state->cmd[index])) {
+            ready &= ~LIGHT_MASK(index);
+            state->pending &= ~LIGHT_MASK(index);
+            s_stats.filtered++;
+        }
+    }
+    while (ready) {
+        const uint8_t first = (uint8_t)__builtin_ctzll(ready);
+        light_cmd_t cmd = state->cmd[first];
+        cmd.targets = 0;
+        LIGHT_MASK_FOR_EACH(index, ready) {
+            if (light_cmd_same_value(&state->cmd[index], &cmd)) {
+                cmd.targets |= LIGHT_MASK(index);
+                state->busy_until_us[index] = now + LIGHT_COMMAND_INFLIGHT_TIMEOUT_MS * 1000;
+            }
+        }
+        ready &= ~cmd.targets;
+        state->pending &= ~cmd.targets;
+        state->busy |= cmd.targets;
+        light_mask_t deferred;
+        const light_mask_t groupcast = light_command_send(&cmd, &deferred);
+        if (deferred) {
+            state->pending |= deferred;
+            state->busy &= ~deferred;
+            cmd.targets &= ~deferred;
+            light_tx_defer(tx_lane, light_command_pump_cb, 0);
+        }
+        light_attr_sent(&cmd, groupcast);
+        LIGHT_MASK_FOR_EACH(index, groupcast) {
+            state->busy_until_us[index] = now + LIGHT_COMMAND_GROUPCAST_HOLD_MS * 1000;
+        }
+    }
+}
+
+/* Send the backlog's reads, each light's once no write is pending for it, oldest first */
+static void light_command_flush_reads(void)
+{
+    const light_mask_t writing = (s_lanes[LANE_LEVEL].pending & ~s_lanes[LANE_LEVEL].busy) |
+                                 (s_lanes[LANE_COLOR].pending & ~s_lanes[LANE_COLOR].busy);
+    uint8_t kept = 0;
+    for (uint8_t i = 0; i < s_read_count; ++i) {
+        light_cmd_t *read = &s_reads[i];
+        read->targets &= light_registry_all();
+        light_cmd_t cmd = *read;
+        cmd.targets &= ~writing;
+        if (cmd.targets) {
+            light_mask_t deferred;
+            light_command_send(&cmd, &deferred);
+            read->targets &= ~cmd.targets | deferred;
+            if (deferred) {
+                light_tx_defer(LIGHT_TX_BULK, light_command_pump_cb, 0);
+            }
+        }
+        if (read->targets) {
+            s_reads[kept++] = *read;
+        }
+    }
+    s_read_count = kept;
+}
+
+/* Send every pending value the transmit scheduler has room for, interactive ones first, then the reads */
+static void light_command_flush(void)
+{
+    const int64_t now = esp_timer_get_time();
+    for (int lane = 0; lane < LANE_COUNT; ++lane) {
+        light_command_lane_state_t *state = &s_lanes[lane];
+        uint8_t index;
+        LIGHT_MASK_FOR_EACH(index, state->busy) {
+            if (now >= state->busy_until_us[index]) {
+                state->busy &= ~LIGHT_MASK(index);
+            }
+        }
+    }
+    for (int tx_lane = LIGHT_TX_INTERACTIVE; tx_lane <= LIGHT_TX_BULK; ++tx_lane) {
+        for (int lane = 0; lane < LANE_COUNT; ++lane) {
+            light_command_flush_lane(&s_lanes[lane], tx_lane, now);
+        }
+    }
+    light_command_flush_reads();
+}
+
+static void light_command_fold(const light_cmd_t *cmd)
+{
+    if (cmd->type == LIGHT_CMD_READ_ATTRS) {
+        /* reads are not coalesced, and wait for the writes pending for their lights (light_command_flush_reads) */
+        light_cmd_t read = *cmd;
+        const light_mask_t cached =
+            light_attr_fresh(read.targets & light_registry_all(), read.read.cluster_id, read.read.ids, read.read.count);
+        s_stats.cached_reads += __builtin_popcountll(cached);
+        read.targets &= light_registry_all() & ~cached;
+        if (!read.targets) {
+            return;
+        }
+        /* the same read waiting in the backlog answers for the new targets too */
+        for (uint8_t i = 0; i < s_read_count; ++i) {
+            if (light_cmd_same_read(&s_reads[i], &read)) {
+                s_stats.coalesced += __builtin_popcountll(s_reads[i].targets & read.targets);
+                s_reads[i].targets |= read.targets;
+                return;
+            }
+        }
+        if (s_read_count < LIGHT_COMMAND_READ_BACKLOG) {
+            s_reads[s_read_count++] = read;
+            return;
+        }
+        /* backlog full: the lights get the extra attributes of a waiting read, or nothing */
+        for (uint8_t i = 0; i < s_read_count; ++i) {
+            if (light_cmd_join_read(&s_reads[i], &read)) {
+                return;
+            }
+        }
+        s_stats.dropped_reads += __builtin_popcountll(read.targets);
+        return;
+    }
+    light_command_lane_state_t *state = &s_lanes[light_cmd_lane(cmd->type)];
+    light_mask_t targets = cmd->targets & light_registry_all();
+    uint8_t index;
+    if (cmd->flags & LIGHT_CMD_FLAG_FADE) {
+        /* a fade setpoint never replaces a command from elsewhere: once sent, that one stops the fade */
+        LIGHT_MASK_FOR_EACH(index, targets & (state->pending | s_lanes[LANE_COLOR].pending)) {
+            const bool foreign = (state->pending & LIGHT_MASK(index)) && !(state->cmd[index].flags & LIGHT_CMD_FLAG_FADE);
+            const bool recall = (s_lanes[LANE_COLOR].pending & LIGHT_MASK(index)) &&
+                                s_lanes[LANE_COLOR].cmd[index].type == LIGHT_CMD_RECALL_SCENE;
+            if (foreign || recall) {
+                targets &= ~LIGHT_MASK(index);
+            }
+        }
+    }
+    if (state == &s_lanes[LANE_COLOR] && cmd->type != LIGHT_CMD_RECALL_SCENE) {
+        light_command_split_recall(targets);
+    }
+    LIGHT_MASK_FOR_EACH(index, targets) {
+        state->cmd[index] = *cmd;
+    }
+    s_stats.coalesced += __builtin_popcountll(state->pending & targets);
+    state->pending |= targets;
+    if (cmd->type == LIGHT_CMD_RECALL_SCENE) {
+        s_stats.coalesced += __builtin_popcountll(s_lanes[LANE_LEVEL].pending & targets);
+        s_lanes[LANE_LEVEL].pending &= ~targets;
+    }
+}
+
+static void light_command_drain(void)
+{
+    light_cmd_t cmd;
+    while (light_command_take(&cmd)) {
+        if (!s_first_logged && cmd.type != LIGHT_CMD_READ_ATTRS && (cmd.targets & light_registry_all())) {
+            s_first_logged = true;
+            ESP_LOGI(TAG, "First light command %lld ms after boot", (long long)(esp_timer_get_time() / 1000));
+        }
+        light_command_fold(&cmd);
+    }
+    light_command_flush();
+}
+
+/* Senders the transmit scheduler held back; what was posted since waits for its own drain */
+static void light_command_pump_cb(uint8_t param)
+{
+    (void)param;
+    const uint8_t mem = lamp_mem_steady_begin();
+    light_command_flush();
+    lamp_mem_steady_end(mem);
+}
+
+void light_command_drain_cb(uint8_t param)
+{
+    (void)param;
+    /* clear first: a post racing with this drain schedules the next one */
+    atomic_store(&s_drain_scheduled, false);
+    lamp_trace_drain();
+    /* runs from the stack's main loop, whose heap use is allowed; this one's is not */
+    const uint8_t mem = lamp_mem_steady_begin();
+    light_command_drain();
+    lamp_mem_steady_end(mem);
+}
+
+/* wake the Zigbee task only if that does not mean waiting for it, else leave it to the backstop */
+static void light_command_wake(void)
+{
+    if (atomic_exchange(&s_drain_scheduled, true)) {
+        return;
+    }
+    if (esp_zb_lock_acquire(0)) {
+        esp_zb_scheduler_alarm(light_command_drain_cb, 0, 0);
+        esp_zb_lock_release();
+        return;
+    }
+    atomic_store(&s_drain_scheduled, false);
+    /* already armed is fine, one pending retry covers every post */
+    esp_timer_start_once(s_backstop, LIGHT_COMMAND_POLL_MS * 1000);
+}
+
+static void light_command_backstop_cb(void *arg)
+{
+    (void)arg;
+    if (lamp_ring_depth(&s_ring)) {
+        light_command_wake();
+    }
+}
+
+static void light_command_usage(lamp_mem_usage_t *usage)
+{
+    usage->used = lamp_ring_depth(&s_ring);
+    usage->peak = atomic_load(&s_ring.max_depth);
+}
+
+void light_command_init(light_command_handler_t handler)
+{
+    lamp_ring_init(&s_ring, s_seq, LIGHT_COMMAND_QUEUE_LEN);
+    atomic_init(&s_drain_scheduled, false);
+    atomic_init(&s_enqueued, 0);
+    atomic_init(&s_dropped, 0);
+    memset(&s_stats, 0, sizeof(s_stats));
+    memset(s_lanes, 0, sizeof(s_lanes));
+    s_read_count = 0;
+    s_first_logged = false;
+    s_handler = handler;
+    if (!s_backstop) {
+        const esp_timer_create_args_t backstop_args = {
+            .callback = light_command_backstop_cb,
+            .dispatch_method = ESP_TIMER_TASK,
+            .name = "mailbox_backstop",
+        };
+        if (esp_timer_create(&backstop_args, &s_backstop) != ESP_OK) {
+            ESP_LOGE(TAG, "Mailbox backstop timer was not created");
+        }
+    }
+    lamp_mem_add_pool("mailbox", LIGHT_COMMAND_QUEUE_LEN, sizeof(light_command_cell_t) + sizeof(atomic_uint),
+                      light_command_usage);
+}
+
+void light_command_start(void)
+{
+    s_consumer = xTaskGetCurrentTaskHandle();
+    /* pick up what was posted before the stack ran */
+    if (lamp_ring_depth(&s_ring) && !atomic_exchange(&s_drain_scheduled, true)) {
+        esp_zb_scheduler_alarm(light_command_drain_cb, 0, 0);
+    }
+}
+
+bool light_command_post(light_cmd_t *cmd)
+{
+    cmd->enqueue_us = esp_timer_get_time();
+    if (!cmd->origin_us) {
+        cmd->origin_us = cmd->enqueue_us;
+    }
+    unsigned pos;
+    if (!lamp_ring_claim(&s_ring, &pos)) {
+        atomic_fetch_add_explicit(&s_dropped, 1, memory_order_relaxed);
+        ESP_LOGW(TAG, "Mailbox full, dropping command %d", cmd->type);
+        return false;
+    }
+    light_command_cell_t *cell = &s_cells[pos & QUEUE_MASK];
+    cell->cmd = *cmd;
+    cell->external = xTaskGetCurrentTaskHandle() != s_consumer;
+    lamp_ring_publish(&s_ring, pos);
+    atomic_fetch_add_explicit(&s_enqueued, 1, memory_order_relaxed);
+
+    light_command_wake();
+    return true;
+}
+
+void light_command_complete(uint8_t index, uint16_t cluster_id)
+{
+    if (index >= LIGHT_REGISTRY_CAPACITY) {
+        return;
+    }
+    if (cluster_id == ESP_ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL) {
+        s_lanes[LANE_LEVEL].busy &= ~LIGHT_MASK(index);
+    } else if (cluster_id == ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL || cluster_id == ESP_ZB_ZCL_CLUSTER_ID_SCENES) {
+        s_lanes[LANE_COLOR].busy &= ~LIGHT_MASK(index);
+    } else {
+        return;
+    }
+    light_command_flush();
+}
+
+void light_command_get_stats(light_command_stats_t *stats)
+{
+    *stats = s_stats;
+    stats->enqueued = atomic_load(&s_enqueued);
+    stats->dropped = atomic_load(&s_dropped);
+    stats->max_depth = (uint8_t)atomic_load(&s_ring.max_depth);
+    stats->depth = (uint8_t)lamp_ring_depth(&s_ring);
+}
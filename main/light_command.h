@@ -0,0 +1,187 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Lamp controller light command mailbox
+ *
+ * This example code is in the Public Domain (or CC0 licensed, at your option.)
+ *
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "light_registry.h"
+#include "light_tx.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* mailbox slots, must be a power of two */
+#define LIGHT_COMMAND_QUEUE_LEN     32
+
+/* retry period of the backstop that wakes the Zigbee task for posts that found it busy */
+#define LIGHT_COMMAND_POLL_MS       10
+
+/* a light gets its next write for a cluster once the previous one is answered, or after this long */
+#define LIGHT_COMMAND_INFLIGHT_TIMEOUT_MS   300
+
+/* groupcasts get no default response, lights reached by one take their next write after this long */
+#define LIGHT_COMMAND_GROUPCAST_HOLD_MS     100
+
+/* reads waiting for the transmit scheduler; once they are all taken, a new read joins one of its cluster or is dropped */
+#define LIGHT_COMMAND_READ_BACKLOG  8
+
+/* most attributes a single LIGHT_CMD_READ_ATTRS command can ask for */
+#define LIGHT_CMD_MAX_READ_ATTRS    6
+
+/* ZCL transition time asking the light for its own default transition (on/off transition time) */
+#define LIGHT_CMD_TRANSITION_DEFAULT    0xffff
+
+/* light_cmd_t.flags bits */
+#define LIGHT_CMD_FLAG_FADE         (1U << 0)   /* setpoint of a light_fade fade, never replaces other pending writes */
+
+typedef enum {
+    LIGHT_CMD_LEVEL,            /* move to level with on/off */
+    LIGHT_CMD_COLOR_XY,         /* move to color */
+    LIGHT_CMD_HUE_SAT,          /* move to hue and saturation */
+    LIGHT_CMD_ENHANCED_HUE,     /* enhanced move to hue */
+    LIGHT_CMD_COLOR_TEMP,       /* move to color temperature */
+    LIGHT_CMD_READ_ATTRS,       /* read attributes of one cluster */
+    LIGHT_CMD_RECALL_SCENE,     /* recall a preset scene, sets color and level together */
+    LIGHT_CMD_MOVE_LEVEL,       /* move with on/off, until stopped or the end of the range */
+    LIGHT_CMD_STEP_LEVEL,       /* step with on/off */
+    LIGHT_CMD_STOP_LEVEL,       /* stop a move */
+    LIGHT_CMD_TYPE_COUNT,
+} light_cmd_type_t;
+
+/* ZCL move and step mode of the level control cluster */
+typedef enum {
+    LIGHT_LEVEL_UP = 0x00,
+    LIGHT_LEVEL_DOWN = 0x01,
+} light_level_mode_t;
+
+typedef struct {
+    uint8_t type;               /* light_cmd_type_t */
+    uint8_t flags;              /* LIGHT_CMD_FLAG_* bits */
+    uint16_t transition_time;   /* ZCL transition time, 1/10 s */
+    light_mask_t targets;       /* lights to send the command to */
+    int64_t origin_us;          /* input that caused the command, 0 for the time it is posted */
+    int64_t enqueue_us;         /* set by light_command_post() */
+    union {
+        uint8_t level;
+        struct {
+            uint16_t x;
+            uint16_t y;
+        } xy;
+        struct {
+            uint8_t hue;
+            uint8_t saturation;
+        } hue_sat;
+        struct {
+            uint16_t hue;
+            uint8_t direction;
+        } enhanced_hue;
+        uint16_t color_temperature;
+        uint8_t preset;         /* light_scene preset index */
+        struct {
+            uint8_t mode;       /* light_level_mode_t */
+            uint8_t rate;       /* levels per second */
+        } move;
+        struct {
+            uint8_t mode;       /* light_level_mode_t */
+            uint8_t size;       /* levels */
+        } step;
+        struct {
+            uint16_t cluster_id;
+            uint8_t count;
+            uint16_t ids[LIGHT_CMD_MAX_READ_ATTRS];
+        } read;
+    };
+} light_cmd_t;
+
+typedef struct {
+    uint32_t enqueued;          /* commands accepted by light_command_post() */
+    uint32_t dropped;           /* commands rejected because the mailbox was full */
+    uint32_t sent;              /* commands the send handler issued requests for */
+    uint32_t coalesced;         /* per light writes replaced by a newer one, or reads joined to the same read, before they were sent */
+    uint32_t filtered;          /* per light writes skipped because the light already held the value */
+    uint32_t cached_reads;      /* per light reads answered from the attribute cache */
+    uint32_t dropped_reads;     /* per light reads that found the backlog full, left to the cache and reporting */
+    uint32_t deferred;          /* per light requests the transmit scheduler held back, at every attempt */
+    uint8_t depth;              /* commands waiting right now */
+    uint8_t max_depth;          /* highest depth seen */
+    uint32_t latency_last_us;   /* enqueue-to-send latency of the latest command */
+    uint32_t latency_max_us;
+    uint64_t latency_total_us;  /* divide by sent for the mean */
+} light_command_stats_t;
+
+/**
+ * @brief Sends one command, runs in the Zigbee task with the stack available
+ *
+ * Asks the transmit scheduler before every request, in the lane
+ * light_command_tx_lane() gives the command.
+ *
+ * @param deferred  set to the targets the scheduler held back; they stay
+ *                  pending and are handed over again once it has room.
+ * @return targets reached by groupcast, which will not send a default response.
+ */
+typedef light_mask_t (*light_command_handler_t)(const light_cmd_t *cmd, light_mask_t *deferred);
+
+/**
+ * @brief Set the send handler and empty the mailbox
+ *
+ * @param handler   called in the Zigbee task for every command taken from the mailbox.
+ */
+void light_command_init(light_command_handler_t handler);
+
+/**
+ * @brief Start draining the mailbox, call from the Zigbee task once the stack runs
+ */
+void light_command_start(void);
+
+/**
+ * @brief Drain alarm of the Zigbee task: take every command posted, then send what the transmit scheduler lets out
+ *
+ * Scheduled by posts, recorded in the trace; the host replay runs it from
+ * there instead of from the stack scheduler.
+ */
+void light_command_drain_cb(uint8_t param);
+
+/**
+ * @brief Queue a command for the Zigbee task without blocking
+ *
+ * Safe to call from any task, concurrently. Not for use from an ISR.
+ *
+ * @param cmd   command to copy into the mailbox, enqueue_us and a missing origin_us are filled in.
+ * @return true if queued, false if the mailbox was full and the command was dropped.
+ */
+bool light_command_post(light_cmd_t *cmd);
+
+/**
+ * @brief Report that a light answered a write, releasing its next pending value
+ *
+ * Call from the Zigbee task when the default response arrives.
+ *
+ * @param index         slot index of the light.
+ * @param cluster_id    cluster of the answered command.
+ */
+void light_command_complete(uint8_t index, uint16_t cluster_id);
+
+/**
+ * @brief Transmit scheduler lane of a command: fade setpoints and reads are bulk traffic, the rest interactive
+ */
+light_tx_lane_t light_command_tx_lane(const light_cmd_t *cmd);
+
+/**
+ * @brief Snapshot of the mailbox counters
+ */
+void light_command_get_stats(light_command_stats_t *stats);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
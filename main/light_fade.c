@@ -0,0 +1,410 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Lamp controller fade engine
+ *
+ * This example code is in the Public Domain (or CC0 licensed, at your option.)
+ *
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_zigbee_core.h"
+#include "lamp_mem.h"
+#include "light_attr.h"
+#include "light_command.h"
+#include "light_fade.h"
+
+/**
+ * @brief:
+ * A bulb's own transition is linear in whatever space the bulb picks, is lost
+ * with a single frame and cannot be shared by lights that start out apart.
+ * Here the coordinator owns the curve instead and streams setpoints on it:
+ * each setpoint is the value the curve reaches at the next setpoint, sent
+ * with a transition time lasting until then, so lights glide from one to the
+ * next and a lost frame only costs precision until the next one.
+ *
+ * The interval between setpoints is the time the curve needs for one
+ * perceptible step (LIGHT_FADE_*_STEP), within the interval bounds: a
+ * 30-minute sunrise over the whole level range sends one setpoint every 7 s,
+ * a 5 s dimming ten. The fades' estimated frame rates are added up, and when
+ * they exceed the airtime budget every interval is stretched by the same
+ * factor, so adding a fade slows the others down rather than flooding the
+ * mesh. Setpoints go through the mailbox, which groupcasts them where it can
+ * and keeps at most one per light and lane on the air.
+ */
+
+#define TRANSITION_MAX_DS   0xfffe
+
+typedef struct {
+    light_mask_t targets;       /* 0 for a free slot */
+    int64_t start_us;
+    int64_t next_us;            /* next setpoint due */
+    uint32_t duration_ms;
+    uint32_t interval_ms;       /* between setpoints, before the budget stretches it */
+    uint16_t frames;            /* estimated frames per setpoint */
+    bool level;
+    uint8_t color;              /* light_fade_color_t */
+    uint8_t level_from;
+    uint8_t level_to;
+    uint16_t from[2];           /* x, y or hue, saturation */
+    uint16_t to[2];
+} light_fade_slot_t;
+
+static const char *TAG = "LIGHT_FADE";
+
+static light_fade_slot_t s_fades[LIGHT_FADE_MAX];
+static light_fade_stats_t s_stats;
+static bool s_ticking;
+
+static uint16_t ds_from_ms(uint32_t ms)
+{
+    const uint32_t ds = (ms + 50) / 100;
+    return ds > TRANSITION_MAX_DS ? TRANSITION_MAX_DS : (uint16_t)ds;
+}
+
+/* Frames one command to these lights costs, counting groupcasts the way the mailbox sends them */
+static uint16_t light_fade_frames(light_mask_t targets)
+{
+    uint16_t frames = 0;
+    targets &= light_registry_all();
+    while (targets) {
+        const light_bulb_device_params_t *light = light_registry_get((uint8_t)__builtin_ctzll(targets));
+        if (light->flags & LIGHT_FLAG_GROUP_MEMBER) {
+            const light_mask_t members = light_registry_group_members(light->group_id);
+            if ((members & targets) == members) {
+                frames += LIGHT_FADE_GROUPCAST_COST;
+                targets &= ~members;
+                continue;
+            }
+        }
+        frames++;
+        targets &= targets - 1;
+    }
+    return frames;
+}
+
+/* Signed hue difference the shorter way round, hue runs 0..254 over the full circle */
+static int hue_delta(uint16_t from, uint16_t to)
+{
+    int delta = (int)to - (int)from;
+    if (delta > 127) {
+        delta -= 254;
+    } else if (delta < -127) {
+        delta += 254;
+    }
+    return delta;
+}
+
+static uint16_t hue_at(uint16_t from, int delta, uint32_t at_ms, uint32_t duration_ms)
+{
+    int hue = (int)from + (int)((int64_t)delta * at_ms / duration_ms);
+    if (hue < 0) {
+        hue += 254;
+    } else if (hue >= 254) {
+        hue -= 254;
+    }
+    return (uint16_t)hue;
+}
+
+static uint16_t lerp(uint16_t from, uint16_t to, uint32_t at_ms, uint32_t duration_ms)
+{
+    return (uint16_t)((int)from + (int)(((int64_t)to - from) * at_ms / duration_ms));
+}
+
+static uint32_t abs_diff(uint32_t a, uint32_t b)
+{
+    return a > b ? a - b : b - a;
+}
+
+/* Interval of one perceptible step of the biggest change, within the bounds */
+static uint32_t light_fade_interval(const light_fade_slot_t *fade)
+{
+    uint32_t steps = 1;
+    if (fade->level) {
+        const uint32_t level_steps = abs_diff(fade->level_from, fade->level_to) / LIGHT_FADE_LEVEL_STEP;
+        steps = level_steps > steps ? level_steps : steps;
+    }
+    for (int c = 0; c < 2 && fade->color != LIGHT_FADE_COLOR_NONE; ++c) {
+        uint32_t color_steps;
+        if (fade->color == LIGHT_FADE_COLOR_XY) {
+            color_steps = abs_diff(fade->from[c], fade->to[c]) / LIGHT_FADE_XY_STEP;
+        } else if (c == 0) {
+            const int delta = hue_delta(fade->from[0], fade->to[0]);
+            color_steps = (uint32_t)(delta < 0 ? -delta : delta) / LIGHT_FADE_HUE_SAT_STEP;
+        } else {
+            color_steps = abs_diff(fade->from[1], fade->to[1]) / LIGHT_FADE_HUE_SAT_STEP;
+        }
+        steps = color_steps > steps ? color_steps : steps;
+    }
+    uint32_t interval_ms = fade->duration_ms / steps;
+    if (interval_ms < LIGHT_FADE_MIN_INTERVAL_MS) {
+        interval_ms = LIGHT_FADE_MIN_INTERVAL_MS;
+    } else if (interval_ms > LIGHT_FADE_MAX_INTERVAL_MS) {
+        interval_ms = LIGHT_FADE_MAX_INTERVAL_MS;
+    }
+    return interval_ms;
+}
+
+static void light_fade_post(light_cmd_t *cmd, light_fade_slot_t *fade)
+{
+    cmd->targets = fade->targets;
+    cmd->flags = LIGHT_CMD_FLAG_FADE;
+    if (light_command_post(cmd)) {
+        s_stats.setpoints++;
+    }
+}
+
+/* Post the setpoint the curve reaches interval_ms from now, returns true for the last one */
+static bool light_fade_emit(light_fade_slot_t *fade, int64_t now_us, uint32_t interval_ms)
+{
+    const uint32_t elapsed_ms = (uint32_t)((now_us - fade->start_us) / 1000);
+    uint32_t at_ms = elapsed_ms + interval_ms;
+    /* end on a full interval rather than with a short leftover one */
+    const bool last = at_ms + interval_ms / 2 >= fade->duration_ms;
+    if (last) {
+        at_ms = fade->duration_ms;
+        interval_ms = elapsed_ms < fade->duration_ms ? fade->duration_ms - elapsed_ms : 0;
+    }
+    const uint16_t transition = ds_from_ms(interval_ms);
+    if (fade->level) {
+        light_cmd_t cmd = {
+            .type = LIGHT_CMD_LEVEL,
+            .transition_time = transition,
+            .level = (uint8_t)lerp(fade->level_from, fade->level_to, at_ms, fade->duration_ms),
+        };
+        light_fade_post(&cmd, fade);
+    }
+    if (fade->color == LIGHT_FADE_COLOR_XY) {
+        light_cmd_t cmd = {
+            .type = LIGHT_CMD_COLOR_XY,
+            .transition_time = transition,
+            .xy = {
+                .x = lerp(fade->from[0], fade->to[0], at_ms, fade->duration_ms),
+                .y = lerp(fade->from[1], fade->to[1], at_ms, fade->duration_ms),
+            },
+        };
+        light_fade_post(&cmd, fade);
+    } else if (fade->color == LIGHT_FADE_COLOR_HUE_SAT) {
+        light_cmd_t cmd = {
+            .type = LIGHT_CMD_HUE_SAT,
+            .transition_time = transition,
+            .hue_sat = {
+                .hue = (uint8_t)hue_at(fade->from[0], hue_delta(fade->from[0], fade->to[0]), at_ms,
+                                       fade->duration_ms),
+                .saturation = (uint8_t)lerp(fade->from[1], fade->to[1], at_ms, fade->duration_ms),
+            },
+        };
+        light_fade_post(&cmd, fade);
+    }
+    s_stats.frames += fade->frames;
+    fade->next_us = now_us + (int64_t)interval_ms * 1000;
+    return last;
+}
+
+static void light_fade_tick_cb(uint8_t param);
+
+static void light_fade_schedule(void)
+{
+    if (!s_ticking && s_stats.active) {
+        s_ticking = true;
+        esp_zb_scheduler_alarm(light_fade_tick_cb, 0, LIGHT_FADE_TICK_MS);
+    }
+}
+
+static void light_fade_run(void)
+{
+    const int64_t now_us = esp_timer_get_time();
+    /* frames per second all fades ask for, in thousandths */
+    uint64_t demand = 0;
+    for (int i = 0; i < LIGHT_FADE_MAX; ++i) {
+        light_fade_slot_t *fade = &s_fades[i];
+        fade->targets &= light_registry_all();
+        if (!fade->targets) {
+            continue;
+        }
+        const uint16_t lanes = (fade->level ? 1 : 0) + (fade->color != LIGHT_FADE_COLOR_NONE ? 1 : 0);
+        fade->frames = lanes * light_fade_frames(fade->targets);
+        demand += (uint64_t)fade->frames * 1000 * 1000 / fade->interval_ms;
+    }
+    uint64_t stretch = s_stats.budget ? demand / s_stats.budget : 1000;
+    stretch = stretch < 1000 ? 1000 : stretch > UINT16_MAX ? UINT16_MAX : stretch;
+    s_stats.stretch_permille = (uint16_t)stretch;
+
+    uint8_t active = 0;
+    for (int i = 0; i < LIGHT_FADE_MAX; ++i) {
+        light_fade_slot_t *fade = &s_fades[i];
+        if (!fade->targets) {
+            continue;
+        }
+        if (fade->next_us <= now_us &&
+            light_fade_emit(fade, now_us, (uint32_t)((uint64_t)fade->interval_ms * stretch / 1000))) {
+            fade->targets = 0;
+            s_stats.finished++;
+            continue;
+        }
+        active++;
+    }
+    s_stats.active = active;
+    if (active > s_stats.max_active) {
+        s_stats.max_active = active;
+    }
+    light_fade_schedule();
+}
+
+static void light_fade_tick_cb(uint8_t param)
+{
+    (void)param;
+    s_ticking = false;
+    light_fade_run();
+}
+
+static void light_fade_usage(lamp_mem_usage_t *usage)
+{
+    usage->used = s_stats.active;
+    usage->peak = s_stats.max_active;
+}
+
+void light_fade_init(void)
+{
+    memset(s_fades, 0, sizeof(s_fades));
+    memset(&s_stats, 0, sizeof(s_stats));
+    s_stats.budget = LIGHT_FADE_BUDGET_FRAMES_PER_S;
+    s_stats.stretch_permille = 1000;
+    lamp_mem_add_pool("fades", LIGHT_FADE_MAX, sizeof(light_fade_slot_t), light_fade_usage);
+}
+
+/* Mean of a cached attribute over the lights, false if no light has it cached */
+static bool light_fade_mean(light_mask_t targets, light_attr_t attr, uint16_t *mean)
+{
+    uint32_t sum = 0;
+    uint32_t count = 0;
+    uint8_t index;
+    LIGHT_MASK_FOR_EACH(index, targets) {
+        uint32_t value;
+        if (light_attr_get(index, attr, &value)) {
+            sum += value;
+            count++;
+        }
+    }
+    if (!count) {
+        return false;
+    }
+    *mean = (uint16_t)((sum + count / 2) / count);
+    return true;
+}
+
+esp_err_t light_fade_start(const light_fade_t *request)
+{
+    const light_mask_t targets = request->targets & light_registry_all();
+    if (!targets || (!request->level && request->color == LIGHT_FADE_COLOR_NONE) ||
+        request->color > LIGHT_FADE_COLOR_HUE_SAT) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    light_fade_stop(targets);
+    light_fade_slot_t *fade = NULL;
+    for (int i = 0; i < LIGHT_FADE_MAX && !fade; ++i) {
+        if (!s_fades[i].targets) {
+            fade = &s_fades[i];
+        }
+    }
+    if (!fade) {
+        ESP_LOGW(TAG, "%d fades are running already", LIGHT_FADE_MAX);
+        return ESP_ERR_NO_MEM;
+    }
+    *fade = (light_fade_slot_t){
+        .targets = targets,
+        .start_us = esp_timer_get_time(),
+        .duration_ms = request->duration_ms ? request->duration_ms : 1,
+        .level = request->level,
+        .color = request->color,
+        .level_to = request->level_to,
+    };
+    fade->next_us = fade->start_us;
+    const uint16_t transition = ds_from_ms(fade->duration_ms);
+
+    uint16_t level_from = 0;
+    if (fade->level && !light_fade_mean(targets, LIGHT_ATTR_LEVEL, &level_from)) {
+        /* nothing to start the curve from: leave the whole way to the lights */
+        light_cmd_t cmd = {.type = LIGHT_CMD_LEVEL, .transition_time = transition, .level = request->level_to};
+        light_fade_post(&cmd, fade);
+        fade->level = false;
+    }
+    fade->level_from = (uint8_t)level_from;
+    if (fade->color == LIGHT_FADE_COLOR_XY) {
+        fade->to[0] = request->color_to.xy.x;
+        fade->to[1] = request->color_to.xy.y;
+        if (!light_fade_mean(targets, LIGHT_ATTR_X, &fade->from[0]) ||
+            !light_fade_mean(targets, LIGHT_ATTR_Y, &fade->from[1])) {
+            light_cmd_t cmd = {
+                .type = LIGHT_CMD_COLOR_XY,
+                .transition_time = transition,
+                .xy = {.x = fade->to[0], .y = fade->to[1]},
+            };
+            light_fade_post(&cmd, fade);
+            fade->color = LIGHT_FADE_COLOR_NONE;
+        }
+    } else if (fade->color == LIGHT_FADE_COLOR_HUE_SAT) {
+        fade->to[0] = request->color_to.hue_sat.hue;
+        fade->to[1] = request->color_to.hue_sat.saturation;
+        /* the mean of angles is meaningless, so the hue starts at the first light that has one */
+        uint8_t index;
+        uint32_t hue = UINT32_MAX;
+        LIGHT_MASK_FOR_EACH(index, targets) {
+            if (light_attr_get(index, LIGHT_ATTR_HUE, &hue)) {
+                break;
+            }
+        }
+        if (hue == UINT32_MAX || !light_fade_mean(targets, LIGHT_ATTR_SATURATION, &fade->from[1])) {
+            light_cmd_t cmd = {
+                .type = LIGHT_CMD_HUE_SAT,
+                .transition_time = transition,
+                .hue_sat = {.hue = request->color_to.hue_sat.hue, .saturation = request->color_to.hue_sat.saturation},
+            };
+            light_fade_post(&cmd, fade);
+            fade->color = LIGHT_FADE_COLOR_NONE;
+        } else {
+            fade->from[0] = (uint16_t)hue;
+        }
+    }
+    s_stats.started++;
+    if (!fade->level && fade->color == LIGHT_FADE_COLOR_NONE) {
+        /* handed to the lights whole */
+        fade->targets = 0;
+        s_stats.finished++;
+        return ESP_OK;
+    }
+    fade->interval_ms = light_fade_interval(fade);
+    ESP_LOGI(TAG, "Fading %d lights over %lu ms, a setpoint every %lu ms", __builtin_popcountll(targets),
+             (unsigned long)fade->duration_ms, (unsigned long)fade->interval_ms);
+    light_fade_run();
+    return ESP_OK;
+}
+
+void light_fade_stop(light_mask_t targets)
+{
+    for (int i = 0; i < LIGHT_FADE_MAX; ++i) {
+        light_fade_slot_t *fade = &s_fades[i];
+        if (fade->targets & targets) {
+            fade->targets &= ~targets;
+            if (!fade->targets) {
+                s_stats.stopped++;
+                s_stats.active -= s_stats.active ? 1 : 0;
+            }
+        }
+    }
+}
+
+void light_fade_set_budget(uint16_t frames_per_s)
+{
+    s_stats.budget = frames_per_s;
+}
+
+void light_fade_get_stats(light_fade_stats_t *stats)
+{
+    *stats = s_stats;
+}
@@ -0,0 +1,130 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Lamp controller fade engine
+ *
+ * This example code is in the Public Domain (or CC0 licensed, at your option.)
+ *
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "light_registry.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* fades running at once; a new fade takes its lights away from older ones */
+#define LIGHT_FADE_MAX              4
+
+/* how often due setpoints are looked for while a fade runs */
+#define LIGHT_FADE_TICK_MS          100
+
+/*
+ * Bounds of the time between two setpoints of a fade. Each setpoint asks the
+ * light for a transition lasting until the next one, so the light moves
+ * continuously; a longer interval saves airtime, a shorter one keeps lights
+ * that missed a setpoint or started elsewhere closer to the curve.
+ */
+#define LIGHT_FADE_MIN_INTERVAL_MS  500
+#define LIGHT_FADE_MAX_INTERVAL_MS  10000
+
+/* smallest change worth a setpoint, per channel */
+#define LIGHT_FADE_LEVEL_STEP       1           /* current level, 1..254 */
+#define LIGHT_FADE_XY_STEP          64          /* CIE x and y, 0..65279 */
+#define LIGHT_FADE_HUE_SAT_STEP     1           /* hue and saturation, 0..254 */
+
+/*
+ * Airtime budget shared by all fades, in frames per second. A unicast costs
+ * one frame; a groupcast is a network broadcast every router repeats, so it
+ * counts as LIGHT_FADE_GROUPCAST_COST frames. When the fades together would
+ * exceed the budget, all their intervals stretch by the same factor.
+ */
+#define LIGHT_FADE_BUDGET_FRAMES_PER_S  10
+#define LIGHT_FADE_GROUPCAST_COST       4
+
+typedef enum {
+    LIGHT_FADE_COLOR_NONE,      /* leave the color alone */
+    LIGHT_FADE_COLOR_XY,        /* interpolate in CIE xy */
+    LIGHT_FADE_COLOR_HUE_SAT,   /* interpolate hue along the shorter way round, and saturation */
+} light_fade_color_t;
+
+typedef struct {
+    light_mask_t targets;
+    uint32_t duration_ms;
+    bool level;                 /* fade the level to level_to */
+    uint8_t level_to;           /* 1..254, with on/off: reaching the minimum turns the light off */
+    uint8_t color;              /* light_fade_color_t */
+    union {
+        struct {
+            uint16_t x;
+            uint16_t y;
+        } xy;
+        struct {
+            uint8_t hue;
+            uint8_t saturation;
+        } hue_sat;
+    } color_to;
+} light_fade_t;
+
+typedef struct {
+    uint32_t started;
+    uint32_t finished;
+    uint32_t stopped;           /* taken over by other commands or light_fade_stop() */
+    uint32_t setpoints;         /* commands posted to the mailbox */
+    uint32_t frames;            /* estimated frames those commands cost */
+    uint8_t active;
+    uint8_t max_active;
+    uint16_t budget;            /* frames per second */
+    uint16_t stretch_permille;  /* how far the budget stretched the intervals last time, 1000 for not at all */
+} light_fade_stats_t;
+
+/*
+ * A fade follows one curve for all its lights, starting from the mean of the
+ * cached values of its lights; lights that were elsewhere join the curve over
+ * the first setpoint's transition. When none of its lights has a cached
+ * value for a channel, that channel is sent its end value once, with the
+ * whole duration as the transition. Any write to a light that does not come
+ * from its fade (a button, a scene recall) stops the fade on that light.
+ *
+ * Like the registry, the fade state is not locked: call from the Zigbee task.
+ */
+
+/**
+ * @brief Forget every fade and set the default budget
+ */
+void light_fade_init(void);
+
+/**
+ * @brief Start a fade, replacing any fade its lights are part of
+ *
+ * @return ESP_OK, ESP_ERR_INVALID_ARG for a fade without lights or without
+ *         anything to fade, ESP_ERR_NO_MEM with LIGHT_FADE_MAX fades running.
+ */
+esp_err_t light_fade_start(const light_fade_t *fade);
+
+/**
+ * @brief Stop fading lights where they are, e.g. because something else commands them now
+ */
+void light_fade_stop(light_mask_t targets);
+
+/**
+ * @brief Set the airtime budget of all fades, in frames per second
+ */
+void light_fade_set_budget(uint16_t frames_per_s);
+
+/**
+ * @brief Get a snapshot of the fade counters
+ */
+void light_fade_get_stats(light_fade_stats_t *stats);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,278 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Lamp controller command latency histograms
+ *
+ * This example code is in the Public Domain (or CC0 licensed, at your option.)
+ *
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "esp_timer.h"
+#include "light_latency.h"
+
+/**
+ * @brief:
+ * Each light has a few pending slots holding the sequence number and origin
+ * of its unanswered commands. An answer is matched by light and sequence
+ * number and lands in two log2 histograms, the light's and its command
+ * type's, so memory stays fixed however long the controller runs. Timeouts
+ * are found lazily, whenever a light's slots are looked at and on a dump; a
+ * timed out slot is kept until reused, so a late answer is still recognized.
+ *
+ * Times are kept as the low 32 bits of esp_timer_get_time(): differences stay
+ * exact for over an hour, far beyond any timeout.
+ */
+
+_Static_assert(LIGHT_LATENCY_BUCKETS >= 2 && LIGHT_LATENCY_BUCKETS <= 32, "bucket n is below 2^n ms");
+
+typedef enum {
+    PENDING_FREE,
+    PENDING_WAITING,
+    PENDING_EXPIRED,            /* timeout counted, an answer is late */
+} light_latency_pending_state_t;
+
+typedef struct {
+    uint32_t origin_us;
+    uint32_t sent_us;
+    uint8_t tsn;
+    uint8_t type;
+    uint8_t state;              /* light_latency_pending_state_t */
+} light_latency_pending_t;
+
+static const char *const s_type_names[LIGHT_CMD_TYPE_COUNT] = {
+    [LIGHT_CMD_LEVEL] = "level",
+    [LIGHT_CMD_COLOR_XY] = "color_xy",
+    [LIGHT_CMD_HUE_SAT] = "hue_sat",
+    [LIGHT_CMD_ENHANCED_HUE] = "enhanced_hue",
+    [LIGHT_CMD_COLOR_TEMP] = "color_temp",
+    [LIGHT_CMD_READ_ATTRS] = "read_attrs",
+    [LIGHT_CMD_RECALL_SCENE] = "recall_scene",
+    [LIGHT_CMD_MOVE_LEVEL] = "move_level",
+    [LIGHT_CMD_STEP_LEVEL] = "step_level",
+    [LIGHT_CMD_STOP_LEVEL] = "stop_level",
+};
+
+static light_latency_pending_t s_pending[LIGHT_REGISTRY_CAPACITY][LIGHT_LATENCY_PENDING];
+static light_latency_hist_t s_lights[LIGHT_REGISTRY_CAPACITY];
+static light_latency_hist_t s_types[LIGHT_CMD_TYPE_COUNT];
+
+static uint32_t light_latency_now_us(void)
+{
+    return (uint32_t)esp_timer_get_time();
+}
+
+static void hist_add(light_latency_hist_t *hist, uint32_t latency_us)
+{
+    const uint32_t ms = latency_us / 1000;
+    unsigned bucket = ms ? 32 - __builtin_clz(ms) : 0;
+    if (bucket >= LIGHT_LATENCY_BUCKETS) {
+        bucket = LIGHT_LATENCY_BUCKETS - 1;
+    }
+    hist->bucket[bucket]++;
+    hist->answered++;
+    hist->total_us += latency_us;
+    if (latency_us > hist->max_us) {
+        hist->max_us = latency_us;
+    }
+}
+
+/* Bucket holding the given percentile of the answers, -1 if there are none */
+static int hist_percentile(const light_latency_hist_t *hist, unsigned percent)
+{
+    const uint64_t rank = ((uint64_t)hist->answered * percent + 99) / 100;
+    uint64_t seen = 0;
+    for (int b = 0; b < LIGHT_LATENCY_BUCKETS && hist->answered; ++b) {
+        seen += hist->bucket[b];
+        if (seen >= rank) {
+            return b;
+        }
+    }
+    return -1;
+}
+
+/* "<N" ms for the upper bound of a bucket, ">=N" for the open ended last one */
+static void bucket_format(char *buf, size_t len, int bucket)
+{
+    if (bucket < 0) {
+        snprintf(buf, len, "-");
+    } else if (bucket + 1 < LIGHT_LATENCY_BUCKETS) {
+        snprintf(buf, len, "<%u", 1U << bucket);
+    } else {
+        snprintf(buf, len, ">=%u", 1U << (bucket - 1));
+    }
+}
+
+static void light_latency_expire(uint8_t index, uint32_t now_us)
+{
+    for (int i = 0; i < LIGHT_LATENCY_PENDING; ++i) {
+        light_latency_pending_t *pending = &s_pending[index][i];
+        if (pending->state == PENDING_WAITING && now_us - pending->sent_us >= LIGHT_LATENCY_TIMEOUT_MS * 1000) {
+            pending->state = PENDING_EXPIRED;
+            s_lights[index].timeouts++;
+            s_types[pending->type].timeouts++;
+        }
+    }
+}
+
+void light_latency_init(void)
+{
+    memset(s_pending, 0, sizeof(s_pending));
+    memset(s_lights, 0, sizeof(s_lights));
+    memset(s_types, 0, sizeof(s_types));
+}
+
+void light_latency_forget(uint8_t index)
+{
+    if (index >= LIGHT_REGISTRY_CAPACITY) {
+        return;
+    }
+    memset(s_pending[index], 0, sizeof(s_pending[index]));
+    memset(&s_lights[index], 0, sizeof(s_lights[index]));
+}
+
+void light_latency_sent(uint8_t index, uint8_t type, uint8_t tsn, int64_t origin_us)
+{
+    if (index >= LIGHT_REGISTRY_CAPACITY || type >= LIGHT_CMD_TYPE_COUNT) {
+        return;
+    }
+    const uint32_t now_us = light_latency_now_us();
+    light_latency_expire(index, now_us);
+    light_latency_pending_t *slot = NULL;
+    for (int i = 0; i < LIGHT_LATENCY_PENDING; ++i) {
+        light_latency_pending_t *pending = &s_pending[index][i];
+        if (pending->state == PENDING_FREE) {
+            slot = pending;
+            break;
+        }
+        /* otherwise give up the oldest expired one */
+        if (pending->state == PENDING_EXPIRED && (!slot || pending->sent_us - slot->sent_us > UINT32_MAX / 2)) {
+            slot = pending;
+        }
+    }
+    if (!slot) {
+        s_lights[index].untracked++;
+        s_types[type].untracked++;
+        return;
+    }
+    *slot = (light_latency_pending_t){
+        .origin_us = (uint32_t)origin_us,
+        .sent_us = now_us,
+        .tsn = tsn,
+        .type = type,
+        .state = PENDING_WAITING,
+    };
+}
+
+void light_latency_groupcast(uint8_t type)
+{
+    if (type < LIGHT_CMD_TYPE_COUNT) {
+        s_types[type].groupcasts++;
+    }
+}
+
+void light_latency_answered(uint8_t index, uint8_t tsn, esp_zb_zcl_status_t status)
+{
+    if (index >= LIGHT_REGISTRY_CAPACITY) {
+        return;
+    }
+    const uint32_t now_us = light_latency_now_us();
+    light_latency_expire(index, now_us);
+    for (int i = 0; i < LIGHT_LATENCY_PENDING; ++i) {
+        light_latency_pending_t *pending = &s_pending[index][i];
+        if (pending->state == PENDING_FREE || pending->tsn != tsn) {
+            continue;
+        }
+        if (pending->state == PENDING_EXPIRED) {
+            s_lights[index].late++;
+            s_types[pending->type].late++;
+        } else {
+            const uint32_t latency_us = now_us - pending->origin_us;
+            hist_add(&s_lights[index], latency_us);
+            hist_add(&s_types[pending->type], latency_us);
+            if (status != ESP_ZB_ZCL_STATUS_SUCCESS) {
+                s_lights[index].failed++;
+                s_types[pending->type].failed++;
+            }
+        }
+        pending->state = PENDING_FREE;
+        return;
+    }
+}
+
+void light_latency_retry(uint8_t index, uint8_t type)
+{
+    if (index < LIGHT_REGISTRY_CAPACITY && type < LIGHT_CMD_TYPE_COUNT) {
+        s_lights[index].retries++;
+        s_types[type].retries++;
+    }
+}
+
+const light_latency_hist_t *light_latency_light(uint8_t index)
+{
+    return index < LIGHT_REGISTRY_CAPACITY ? &s_lights[index] : NULL;
+}
+
+const light_latency_hist_t *light_latency_type(uint8_t type)
+{
+    return type < LIGHT_CMD_TYPE_COUNT ? &s_types[type] : NULL;
+}
+
+static void hist_print(const char *name, const light_latency_hist_t *hist)
+{
+    char p50[16];
+    char p95[16];
+    bucket_format(p50, sizeof(p50), hist_percentile(hist, 50));
+    bucket_format(p95, sizeof(p95), hist_percentile(hist, 95));
+    printf("%-14s %6lu %8.2f %8.2f %6s %6s %5lu %5lu %5lu %5lu %5lu |", name, (unsigned long)hist->answered,
+           hist->answered ? (double)hist->total_us / hist->answered / 1000.0 : 0.0, hist->max_us / 1000.0, p50, p95,
+           (unsigned long)hist->failed, (unsigned long)hist->timeouts, (unsigned long)hist->late,
+           (unsigned long)hist->retries, (unsigned long)hist->untracked);
+    for (int b = 0; b < LIGHT_LATENCY_BUCKETS; ++b) {
+        printf(" %lu", (unsigned long)hist->bucket[b]);
+    }
+    printf("\n");
+}
+
+static void header_print(const char *what)
+{
+    printf("%-14s %6s %8s %8s %6s %6s %5s %5s %5s %5s %5s | answers below 1, 2, 4 .. %u ms, then slower\n", what,
+           "n", "mean_ms", "max_ms", "p50_ms", "p95_ms", "fail", "tmo", "late", "retry", "untrk",
+           1U << (LIGHT_LATENCY_BUCKETS - 2));
+}
+
+void light_latency_dump(void)
+{
+    const uint32_t now_us = light_latency_now_us();
+    uint8_t index;
+    LIGHT_MASK_FOR_EACH(index, light_registry_all()) {
+        light_latency_expire(index, now_us);
+    }
+    header_print("command");
+    for (int type = 0; type < LIGHT_CMD_TYPE_COUNT; ++type) {
+        const light_latency_hist_t *hist = &s_types[type];
+        if (hist->answered || hist->timeouts || hist->untracked) {
+            hist_print(s_type_names[type], hist);
+        }
+    }
+    for (int type = 0; type < LIGHT_CMD_TYPE_COUNT; ++type) {
+        if (s_types[type].groupcasts) {
+            printf("%-14s %6lu groupcasts, not answered\n", s_type_names[type],
+                   (unsigned long)s_types[type].groupcasts);
+        }
+    }
+    header_print("light");
+    LIGHT_MASK_FOR_EACH(index, light_registry_all()) {
+        const light_latency_hist_t *hist = &s_lights[index];
+        if (!hist->answered && !hist->timeouts && !hist->untracked) {
+            continue;
+        }
+        char name[16];
+        snprintf(name, sizeof(name), "%2u 0x%04hx", index, light_registry_get(index)->short_addr);
+        hist_print(name, hist);
+    }
+}
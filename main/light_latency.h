@@ -0,0 +1,111 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Lamp controller command latency histograms
+ *
+ * This example code is in the Public Domain (or CC0 licensed, at your option.)
+ *
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include "esp_zigbee_core.h"
+#include "light_command.h"
+#include "light_registry.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* bucket 0 holds answers under 1 ms, bucket n those under 2^n ms, the last one everything slower */
+#define LIGHT_LATENCY_BUCKETS       12
+
+/* unanswered commands tracked per light; a light has at most one write per lane and a few reads in flight */
+#define LIGHT_LATENCY_PENDING       4
+
+/* a command without an answer for this long counts as timed out, a later answer as late */
+#define LIGHT_LATENCY_TIMEOUT_MS    2000
+
+typedef struct {
+    uint32_t bucket[LIGHT_LATENCY_BUCKETS];
+    uint32_t answered;          /* sum of the buckets */
+    uint32_t max_us;
+    uint64_t total_us;          /* divide by answered for the mean */
+    uint32_t failed;            /* answered with a ZCL error status, included in the buckets */
+    uint32_t timeouts;
+    uint32_t late;              /* answers that came after their timeout was counted */
+    uint32_t retries;           /* commands sent again after a failed answer */
+    uint32_t untracked;         /* unicasts sent while every pending slot of the light was taken */
+    uint32_t groupcasts;        /* per command type only: groupcasts, which are never answered */
+} light_latency_hist_t;
+
+/*
+ * Latency runs from the input that caused a command (light_cmd_t.origin_us,
+ * the button edge for a press) until the light's default response, or read
+ * attributes response for a read, matched by ZCL sequence number. Only
+ * unicasts are measured: lights do not answer groupcasts.
+ *
+ * Like the registry, the histograms are not locked: call from the Zigbee task.
+ */
+
+/**
+ * @brief Clear every histogram and forget pending commands
+ */
+void light_latency_init(void);
+
+/**
+ * @brief Clear the histograms and pending commands of one light, for a slot taken by a new light
+ */
+void light_latency_forget(uint8_t index);
+
+/**
+ * @brief Start timing a unicast command handed to the stack
+ *
+ * @param index     slot index of the light.
+ * @param type      light_cmd_type_t of the command.
+ * @param tsn       ZCL sequence number returned by the request.
+ * @param origin_us input that caused the command, esp_timer_get_time() time base.
+ */
+void light_latency_sent(uint8_t index, uint8_t type, uint8_t tsn, int64_t origin_us);
+
+/**
+ * @brief Count a groupcast of a command type
+ */
+void light_latency_groupcast(uint8_t type);
+
+/**
+ * @brief Stop timing the command a response answers
+ *
+ * @param index     slot index of the light.
+ * @param tsn       ZCL sequence number of the response.
+ * @param status    ZCL status of the response.
+ */
+void light_latency_answered(uint8_t index, uint8_t tsn, esp_zb_zcl_status_t status);
+
+/**
+ * @brief Count a command sent again to a light after a failed answer
+ */
+void light_latency_retry(uint8_t index, uint8_t type);
+
+/**
+ * @brief Histogram of one light, NULL for an invalid index
+ */
+const light_latency_hist_t *light_latency_light(uint8_t index);
+
+/**
+ * @brief Histogram of one command type over all lights, NULL for an invalid type
+ */
+const light_latency_hist_t *light_latency_type(uint8_t type);
+
+/**
+ * @brief Print the histograms of every command type and every light that was sent a command
+ */
+void light_latency_dump(void);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,421 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Lamp controller per-light link quality and airtime counters
+ *
+ * This example code is in the Public Domain (or CC0 licensed, at your option.)
+ *
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "esp_timer.h"
+#include "light_link.h"
+
+/**
+ * @brief:
+ * Counters sit in one row per registry slot, one for group addressed
+ * requests and one per cluster family; only unicasts awaiting their send
+ * status are tracked one by one. Sizes are those of the ZCL frames as the specification lays them out, not
+ * what the stack finally puts on air; airtime adds the fixed per-frame
+ * overhead and MAC acknowledgements on top, which is what makes a frame of a
+ * few bytes cost about 2 ms.
+ *
+ * esp-zigbee-lib reports neither APS resends nor the LQI of a received frame.
+ * A unicast keeps a pending slot until its send status, and the delay of that
+ * status tells how many ack waits the stack went through. The RSSI comes from
+ * the ZCL header of every response (reports carry none), the LQI from the
+ * stack's neighbor table, which only holds lights one hop away; a light with
+ * a rolling RSSI but no LQI sits behind a router.
+ */
+
+_Static_assert(LIGHT_LINK_AVG_SHIFT >= 1 && LIGHT_LINK_AVG_SHIFT <= 8, "averages are kept in 1/16 units");
+
+typedef struct {
+    uint32_t sent_us;
+    uint16_t bytes;             /* ZCL frame */
+    uint8_t tsn;
+    uint8_t cluster;            /* light_link_cluster_t */
+    bool waiting;
+} light_link_pending_t;
+
+static const char *const s_cluster_names[LIGHT_LINK_CLUSTER_COUNT] = {
+    [LIGHT_LINK_CLUSTER_ON_OFF] = "on_off",
+    [LIGHT_LINK_CLUSTER_LEVEL] = "level",
+    [LIGHT_LINK_CLUSTER_COLOR] = "color",
+    [LIGHT_LINK_CLUSTER_SCENES] = "scenes",
+    [LIGHT_LINK_CLUSTER_GROUPS] = "groups",
+    [LIGHT_LINK_CLUSTER_OTHER] = "other",
+};
+
+static light_link_t s_links[LIGHT_REGISTRY_CAPACITY];
+static light_link_t s_group;
+static light_link_cluster_stats_t s_clusters[LIGHT_LINK_CLUSTER_COUNT];
+static light_link_pending_t s_pending[LIGHT_REGISTRY_CAPACITY][LIGHT_LINK_PENDING];
+static bool s_started;
+
+static light_link_cluster_t light_link_cluster_of(uint16_t cluster_id)
+{
+    switch (cluster_id) {
+    case ESP_ZB_ZCL_CLUSTER_ID_ON_OFF:
+        return LIGHT_LINK_CLUSTER_ON_OFF;
+    case ESP_ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL:
+        return LIGHT_LINK_CLUSTER_LEVEL;
+    case ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL:
+        return LIGHT_LINK_CLUSTER_COLOR;
+    case ESP_ZB_ZCL_CLUSTER_ID_SCENES:
+        return LIGHT_LINK_CLUSTER_SCENES;
+    case ESP_ZB_ZCL_CLUSTER_ID_GROUPS:
+        return LIGHT_LINK_CLUSTER_GROUPS;
+    default:
+        return LIGHT_LINK_CLUSTER_OTHER;
+    }
+}
+
+/* Airtime of one transmission of a ZCL frame of `bytes`, with its MAC acknowledgement if it is a unicast */
+static uint32_t light_link_frame_us(uint16_t bytes, bool acked)
+{
+    return (LIGHT_LINK_FRAME_OVERHEAD + bytes) * LIGHT_LINK_US_PER_BYTE + (acked ? LIGHT_LINK_MAC_ACK_US : 0);
+}
+
+/* Move a rolling average in 1/16 units towards a sample */
+static int32_t light_link_avg(int32_t avg, int32_t sample, uint32_t samples)
+{
+    if (!samples) {
+        return sample * 16;
+    }
+    return avg + (sample * 16 - avg) / (1 << LIGHT_LINK_AVG_SHIFT);
+}
+
+static void light_link_rssi(light_link_t *link, int8_t rssi)
+{
+    link->rssi_avg = (int16_t)light_link_avg(link->rssi_avg, rssi, link->rssi_samples);
+    if (!link->rssi_samples || rssi < link->rssi_min) {
+        link->rssi_min = rssi;
+    }
+    link->rssi_last = rssi;
+    link->rssi_samples++;
+}
+
+static void light_link_neighbors(void)
+{
+    for (int i = 0; i < LIGHT_REGISTRY_CAPACITY; ++i) {
+        s_links[i].neighbor = false;
+    }
+    esp_zb_nwk_info_iterator_t iterator = ESP_ZB_NWK_INFO_ITERATOR_INIT;
+    esp_zb_nwk_neighbor_info_t neighbor;
+    while (esp_zb_nwk_get_next_neighbor(&iterator, &neighbor) == ESP_OK) {
+        const uint8_t index = light_registry_find_ieee(neighbor.ieee_addr);
+        if (index >= LIGHT_REGISTRY_CAPACITY) {
+            continue;
+        }
+        light_link_t *link = &s_links[index];
+        link->lqi_avg = (uint16_t)light_link_avg(link->lqi_avg, neighbor.lqi, link->lqi_samples);
+        link->lqi_last = neighbor.lqi;
+        link->lqi_samples++;
+        link->neighbor = true;
+    }
+}
+
+static void light_link_neighbors_cb(uint8_t param)
+{
+    light_link_neighbors();
+    esp_zb_scheduler_alarm(light_link_neighbors_cb, 0, LIGHT_LINK_NEIGHBOR_INTERVAL_MS);
+}
+
+void light_link_init(void)
+{
+    memset(s_links, 0, sizeof(s_links));
+    memset(&s_group, 0, sizeof(s_group));
+    memset(s_clusters, 0, sizeof(s_clusters));
+    memset(s_pending, 0, sizeof(s_pending));
+}
+
+void light_link_start(void)
+{
+    if (!s_started) {
+        s_started = true;
+        light_link_neighbors_cb(0);
+    }
+}
+
+void light_link_forget(uint8_t index)
+{
+    if (index >= LIGHT_REGISTRY_CAPACITY) {
+        return;
+    }
+    memset(&s_links[index], 0, sizeof(s_links[index]));
+    memset(s_pending[index], 0, sizeof(s_pending[index]));
+}
+
+void light_link_sent(uint16_t cluster, const esp_zb_zcl_basic_cmd_t *basic, esp_zb_zcl_address_mode_t address_mode,
+                     uint8_t tsn, uint16_t payload)
+{
+    const uint16_t bytes = LIGHT_LINK_ZCL_HEADER + payload;
+    const light_link_cluster_t family = light_link_cluster_of(cluster);
+    const uint8_t index = address_mode == ESP_ZB_APS_ADDR_MODE_16_ENDP_PRESENT ?
+                          light_registry_find_short(basic->dst_addr_u.addr_short) : LIGHT_REGISTRY_INVALID;
+    const bool unicast = index < LIGHT_REGISTRY_CAPACITY;
+    const uint32_t airtime_us = light_link_frame_us(bytes, unicast);
+    light_link_t *link = unicast ? &s_links[index] : &s_group;
+    link->tx_frames++;
+    link->tx_bytes += bytes;
+    link->tx_airtime_us += airtime_us;
+    s_clusters[family].tx_frames++;
+    s_clusters[family].tx_airtime_us += airtime_us;
+    if (!unicast) {
+        return;
+    }
+    /* a free slot, else the oldest one, whose send status is then never counted */
+    light_link_pending_t *slot = &s_pending[index][0];
+    for (int i = 0; i < LIGHT_LINK_PENDING; ++i) {
+        light_link_pending_t *pending = &s_pending[index][i];
+        if (!pending->waiting) {
+            slot = pending;
+            break;
+        }
+        if (pending->sent_us - slot->sent_us > UINT32_MAX / 2) {
+            slot = pending;
+        }
+    }
+    if (slot->waiting) {
+        link->untracked++;
+    }
+    *slot = (light_link_pending_t){
+        .sent_us = (uint32_t)esp_timer_get_time(),
+        .bytes = bytes,
+        .tsn = tsn,
+        .cluster = family,
+        .waiting = true,
+    };
+}
+
+void light_link_command(const light_cmd_t *cmd, const esp_zb_zcl_basic_cmd_t *basic,
+                        esp_zb_zcl_address_mode_t address_mode, uint8_t tsn)
+{
+    uint16_t cluster = ESP_ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL;
+    uint16_t payload = 0;
+    switch (cmd->type) {
+    case LIGHT_CMD_LEVEL:
+        payload = 3;
+        break;
+    case LIGHT_CMD_MOVE_LEVEL:
+        payload = 2;
+        break;
+    case LIGHT_CMD_STEP_LEVEL:
+        payload = 4;
+        break;
+    case LIGHT_CMD_STOP_LEVEL:
+        break;
+    case LIGHT_CMD_COLOR_XY:
+        cluster = ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL;
+        payload = 6;
+        break;
+    case LIGHT_CMD_HUE_SAT:
+    case LIGHT_CMD_COLOR_TEMP:
+        cluster = ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL;
+        payload = 4;
+        break;
+    case LIGHT_CMD_ENHANCED_HUE:
+        cluster = ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL;
+        payload = 5;
+        break;
+    case LIGHT_CMD_RECALL_SCENE:
+        cluster = ESP_ZB_ZCL_CLUSTER_ID_SCENES;
+        payload = 3;
+        break;
+    case LIGHT_CMD_READ_ATTRS:
+        cluster = cmd->read.cluster_id;
+        payload = 2 * cmd->read.count;
+        break;
+    default:
+        return;
+    }
+    light_link_sent(cluster, basic, address_mode, tsn, payload);
+}
+
+static void light_link_count_rx(uint16_t short_addr, uint16_t cluster, uint16_t payload, const int8_t *rssi)
+{
+    const uint8_t index = light_registry_find_short(short_addr);
+    if (index >= LIGHT_REGISTRY_CAPACITY) {
+        return;
+    }
+    const uint16_t bytes = LIGHT_LINK_ZCL_HEADER + payload;
+    const uint32_t airtime_us = light_link_frame_us(bytes, true);
+    light_link_t *link = &s_links[index];
+    link->rx_frames++;
+    link->rx_bytes += bytes;
+    link->rx_airtime_us += airtime_us;
+    const light_link_cluster_t family = light_link_cluster_of(cluster);
+    s_clusters[family].rx_frames++;
+    s_clusters[family].rx_airtime_us += airtime_us;
+    if (rssi) {
+        light_link_rssi(link, *rssi);
+    }
+}
+
+void light_link_received(esp_zb_core_action_callback_id_t callback_id, const void *message)
+{
+    if (!message) {
+        return;
+    }
+    uint16_t payload = 0;
+    switch (callback_id) {
+    case ESP_ZB_CORE_REPORT_ATTR_CB_ID: {
+        /* one callback per attribute, so a report of several counts a frame for each */
+        const esp_zb_zcl_report_attr_message_t *report = message;
+        light_link_count_rx(report->src_address.u.short_addr, report->cluster, 3 + report->attribute.data.size,
+                            NULL);
+        return;
+    }
+    case ESP_ZB_CORE_CMD_READ_ATTR_RESP_CB_ID: {
+        const esp_zb_zcl_cmd_read_attr_resp_message_t *resp = message;
+        for (const esp_zb_zcl_read_attr_resp_variable_t *variable = resp->variables; variable;
+             variable = variable->next) {
+            payload += 3;
+            if (variable->status == ESP_ZB_ZCL_STATUS_SUCCESS) {
+                payload += 1 + variable->attribute.data.size;
+            }
+        }
+        break;
+    }
+    case ESP_ZB_CORE_CMD_REPORT_CONFIG_RESP_CB_ID: {
+        const esp_zb_zcl_cmd_config_report_resp_message_t *resp = message;
+        for (const esp_zb_zcl_config_report_resp_variable_t *variable = resp->variables; variable;
+             variable = variable->next) {
+            payload += 4;
+        }
+        break;
+    }
+    case ESP_ZB_CORE_CMD_DEFAULT_RESP_CB_ID:
+        payload = 2;
+        break;
+    case ESP_ZB_CORE_CMD_OPERATE_GROUP_RESP_CB_ID:
+        payload = 3;
+        break;
+    case ESP_ZB_CORE_CMD_OPERATE_SCENE_RESP_CB_ID:
+        payload = 4;
+        break;
+    default:
+        return;
+    }
+    /* every response starts with the common command info */
+    const esp_zb_zcl_cmd_info_t *info = message;
+    light_link_count_rx(info->src_address.u.short_addr, info->cluster, payload, &info->header.rssi);
+}
+
+void light_link_send_status(const esp_zb_zcl_command_send_status_message_t *message)
+{
+    if (message->dst_addr.addr_type != ESP_ZB_ZCL_ADDR_TYPE_SHORT) {
+        return;
+    }
+    const uint8_t index = light_registry_find_short(message->dst_addr.u.short_addr);
+    if (index >= LIGHT_REGISTRY_CAPACITY) {
+        return;
+    }
+    light_link_pending_t *pending = NULL;
+    for (int i = 0; i < LIGHT_LINK_PENDING; ++i) {
+        if (s_pending[index][i].waiting && s_pending[index][i].tsn == message->tsn) {
+            pending = &s_pending[index][i];
+            break;
+        }
+    }
+    if (!pending) {
+        return;
+    }
+    light_link_t *link = &s_links[index];
+    light_link_cluster_stats_t *cluster = &s_clusters[pending->cluster];
+    uint32_t retries = LIGHT_LINK_APS_MAX_RETRIES;
+    if (message->status == ESP_OK) {
+        const uint32_t waited_us = (uint32_t)esp_timer_get_time() - pending->sent_us;
+        retries = waited_us / (LIGHT_LINK_APS_ACK_WAIT_MS * 1000);
+        if (retries > LIGHT_LINK_APS_MAX_RETRIES) {
+            retries = LIGHT_LINK_APS_MAX_RETRIES;
+        }
+        /* the light's APS acknowledgement carries no ZCL frame */
+        const uint32_t ack_us = light_link_frame_us(0, true);
+        link->delivered++;
+        link->rx_frames++;
+        link->rx_airtime_us += ack_us;
+        cluster->rx_frames++;
+        cluster->rx_airtime_us += ack_us;
+    } else {
+        link->failed++;
+    }
+    const uint32_t resend_us = retries * light_link_frame_us(pending->bytes, true);
+    link->retries += retries;
+    link->tx_airtime_us += resend_us;
+    cluster->tx_airtime_us += resend_us;
+    pending->waiting = false;
+}
+
+const light_link_t *light_link_get(uint8_t index)
+{
+    return index < LIGHT_REGISTRY_CAPACITY ? &s_links[index] : NULL;
+}
+
+const light_link_t *light_link_group(void)
+{
+    return &s_group;
+}
+
+const light_link_cluster_stats_t *light_link_cluster(light_link_cluster_t cluster)
+{
+    return (unsigned)cluster < LIGHT_LINK_CLUSTER_COUNT ? &s_clusters[cluster] : NULL;
+}
+
+static void light_link_print(const char *name, const light_link_t *link)
+{
+    printf("%-14s %6lu %7lu %6lu %7lu %8.1f %8.1f %6lu %5lu %5lu %5lu", name, (unsigned long)link->tx_frames,
+           (unsigned long)link->tx_bytes, (unsigned long)link->rx_frames, (unsigned long)link->rx_bytes,
+           link->tx_airtime_us / 1000.0, link->rx_airtime_us / 1000.0, (unsigned long)link->delivered,
+           (unsigned long)link->failed, (unsigned long)link->retries, (unsigned long)link->untracked);
+    if (link->rssi_samples) {
+        printf(" %6.1f %4d", link->rssi_avg / 16.0, link->rssi_min);
+    } else {
+        printf(" %6s %4s", "-", "-");
+    }
+    if (link->neighbor) {
+        printf(" %5.1f %3u\n", link->lqi_avg / 16.0, link->lqi_last);
+    } else {
+        printf(" %5s %3s\n", "-", "-");
+    }
+}
+
+void light_link_dump(void)
+{
+    light_link_neighbors();
+    printf("%-14s %6s %7s %6s %7s %8s %8s %6s %5s %5s %5s %6s %4s %5s %3s\n", "light", "tx", "tx_B", "rx", "rx_B",
+           "tx_ms", "rx_ms", "acked", "fail", "retry", "untrk", "rssi", "min", "lqi", "now");
+    uint8_t index;
+    LIGHT_MASK_FOR_EACH(index, light_registry_all()) {
+        const light_link_t *link = &s_links[index];
+        if (!link->tx_frames && !link->rx_frames && !link->neighbor) {
+            continue;
+        }
+        char name[16];
+        snprintf(name, sizeof(name), "%2u 0x%04hx", index, light_registry_get(index)->short_addr);
+        light_link_print(name, link);
+    }
+    if (s_group.tx_frames) {
+        light_link_print("group", &s_group);
+    }
+    uint32_t total_us = 0;
+    for (int family = 0; family < LIGHT_LINK_CLUSTER_COUNT; ++family) {
+        total_us += s_clusters[family].tx_airtime_us + s_clusters[family].rx_airtime_us;
+    }
+    printf("%-14s %6s %8s %6s %8s %5s\n", "cluster", "tx", "tx_ms", "rx", "rx_ms", "share");
+    for (int family = 0; family < LIGHT_LINK_CLUSTER_COUNT; ++family) {
+        const light_link_cluster_stats_t *cluster = &s_clusters[family];
+        if (!cluster->tx_frames && !cluster->rx_frames) {
+            continue;
+        }
+        const uint32_t cluster_us = cluster->tx_airtime_us + cluster->rx_airtime_us;
+        printf("%-14s %6lu %8.1f %6lu %8.1f %4.0f%%\n", s_cluster_names[family], (unsigned long)cluster->tx_frames,
+               cluster->tx_airtime_us / 1000.0, (unsigned long)cluster->rx_frames, cluster->rx_airtime_us / 1000.0,
+               total_us ? 100.0 * cluster_us / total_us : 0.0);
+    }
+}
@@ -0,0 +1,166 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Lamp controller per-light link quality and airtime counters
+ *
+ * This example code is in the Public Domain (or CC0 licensed, at your option.)
+ *
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_zigbee_core.h"
+#include "light_command.h"
+#include "light_registry.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* unicasts per light waiting for the stack's send status, oldest given up first */
+#define LIGHT_LINK_PENDING              4
+
+/*
+ * The stack sends an unacknowledged unicast again after this long and gives
+ * up after LIGHT_LINK_APS_MAX_RETRIES resends. It does not report resends, so
+ * a send status that comes N waits after the request counts N retries.
+ */
+#define LIGHT_LINK_APS_ACK_WAIT_MS      150
+#define LIGHT_LINK_APS_MAX_RETRIES      3
+
+/* how often the neighbor table is read for LQI and RSSI */
+#define LIGHT_LINK_NEIGHBOR_INTERVAL_MS 10000
+
+/* rolling LQI and RSSI: every sample moves the average by 1/2^N of the difference */
+#define LIGHT_LINK_AVG_SHIFT            3
+
+/*
+ * Airtime on 2.4 GHz 802.15.4: 250 kbit/s, 32 us per byte. Every frame
+ * carries about 51 bytes besides its ZCL payload (PHY, MAC, secured NWK and
+ * APS headers) and is acknowledged on the MAC layer after a turnaround.
+ */
+#define LIGHT_LINK_US_PER_BYTE          32
+#define LIGHT_LINK_FRAME_OVERHEAD       51
+#define LIGHT_LINK_MAC_ACK_US           (192 + 11 * LIGHT_LINK_US_PER_BYTE)
+
+/* ZCL frame control, sequence number and command id */
+#define LIGHT_LINK_ZCL_HEADER           3
+
+typedef enum {
+    LIGHT_LINK_CLUSTER_ON_OFF,
+    LIGHT_LINK_CLUSTER_LEVEL,
+    LIGHT_LINK_CLUSTER_COLOR,
+    LIGHT_LINK_CLUSTER_SCENES,
+    LIGHT_LINK_CLUSTER_GROUPS,
+    LIGHT_LINK_CLUSTER_OTHER,
+    LIGHT_LINK_CLUSTER_COUNT,
+} light_link_cluster_t;
+
+typedef struct {
+    uint32_t tx_frames;         /* ZCL requests handed to the stack */
+    uint32_t tx_bytes;          /* their ZCL frames, headers included */
+    uint32_t tx_airtime_us;     /* estimated, every attempt with its MAC acknowledgement */
+    uint32_t rx_frames;         /* ZCL responses and reports, APS acknowledgements */
+    uint32_t rx_bytes;
+    uint32_t rx_airtime_us;
+    uint32_t delivered;         /* unicasts acknowledged by the light */
+    uint32_t failed;            /* unicasts the stack gave up on */
+    uint32_t retries;           /* APS resends, estimated from the send status delay */
+    uint32_t untracked;         /* send status never seen, the pending slot was reused */
+    int16_t rssi_avg;           /* rolling, in 1/16 dBm, over the responses' RSSI */
+    int8_t rssi_min;
+    int8_t rssi_last;
+    uint32_t rssi_samples;
+    uint16_t lqi_avg;           /* rolling, in 1/16, from the neighbor table */
+    uint8_t lqi_last;
+    bool neighbor;              /* in the neighbor table at its last reading, one hop away */
+    uint32_t lqi_samples;
+} light_link_t;
+
+typedef struct {
+    uint32_t tx_frames;
+    uint32_t tx_airtime_us;
+    uint32_t rx_frames;
+    uint32_t rx_airtime_us;
+} light_link_cluster_stats_t;
+
+/*
+ * Every ZCL request the application issues and every ZCL message a light
+ * sends is counted against the light, or against the group row for group
+ * addressed requests, and against its cluster. Airtime is the coordinator's
+ * share: frames relayed by routers on longer routes are not seen.
+ *
+ * Like the registry, the counters are not locked: call from the Zigbee task.
+ */
+
+/**
+ * @brief Clear every counter and forget pending unicasts
+ */
+void light_link_init(void);
+
+/**
+ * @brief Read the neighbor table now and every LIGHT_LINK_NEIGHBOR_INTERVAL_MS, once the stack runs
+ */
+void light_link_start(void);
+
+/**
+ * @brief Clear the counters of one light, for a slot taken by a new light
+ */
+void light_link_forget(uint8_t index);
+
+/**
+ * @brief Count a ZCL request handed to the stack
+ *
+ * @param cluster       cluster of the request.
+ * @param basic         its destination.
+ * @param address_mode  its address mode.
+ * @param tsn           ZCL sequence number returned by the request.
+ * @param payload       bytes after the ZCL header.
+ */
+void light_link_sent(uint16_t cluster, const esp_zb_zcl_basic_cmd_t *basic, esp_zb_zcl_address_mode_t address_mode,
+                     uint8_t tsn, uint16_t payload);
+
+/**
+ * @brief Count the ZCL request issued for a mailbox command
+ */
+void light_link_command(const light_cmd_t *cmd, const esp_zb_zcl_basic_cmd_t *basic,
+                        esp_zb_zcl_address_mode_t address_mode, uint8_t tsn);
+
+/**
+ * @brief Count a ZCL message received from a light, from the core action handler
+ */
+void light_link_received(esp_zb_core_action_callback_id_t callback_id, const void *message);
+
+/**
+ * @brief Count the outcome of a unicast, from the ZCL send status handler
+ */
+void light_link_send_status(const esp_zb_zcl_command_send_status_message_t *message);
+
+/**
+ * @brief Counters of one light, NULL for an invalid index
+ */
+const light_link_t *light_link_get(uint8_t index);
+
+/**
+ * @brief Counters of group addressed requests
+ */
+const light_link_t *light_link_group(void);
+
+/**
+ * @brief Counters of one cluster over all lights, NULL for an invalid cluster
+ */
+const light_link_cluster_stats_t *light_link_cluster(light_link_cluster_t cluster);
+
+/**
+ * @brief Read the neighbor table, then print the counters of every light that was heard from or sent to
+ */
+void light_link_dump(void);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
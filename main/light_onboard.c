@@ -0,0 +1,547 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Lamp controller onboarding pipeline
+ *
+ * This example code is in the Public Domain (or CC0 licensed, at your option.)
+ *
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "lamp_mem.h"
+#include "lamp_trace.h"
+#include "light_attr.h"
+#include "light_latency.h"
+#include "light_link.h"
+#include "light_onboard.h"
+#include "light_store.h"
+#include "light_tx.h"
+
+/**
+ * @brief:
+ * Devices wait in a fixed table of entries and take a place in the window
+ * when they leave the queue, keeping it until the light is configured. A
+ * failed stage gives the place back and queues again after its back-off, so a
+ * silent device never holds up the lights behind it. A light has one ZDO
+ * request out at a time, binds go one cluster after the other, and the
+ * answer's context names the entry and the attempt: an answer to an attempt
+ * that was already given up on is ignored.
+ */
+
+#define STAGE_FREE      0xff    /* entry unused */
+#define STAGE_RETRY     0xfe    /* waiting out the back-off, without a place */
+
+/* ZDO callback context: entry, attempt and the LIGHT_BOUND_* bit of a bind */
+#define CTX(entry, generation, bound)   ((void *)(uintptr_t)((entry) | (generation) << 8 | (uint32_t)(bound) << 16))
+#define CTX_ENTRY(ctx)                  ((uint8_t)(uintptr_t)(ctx))
+#define CTX_GENERATION(ctx)             ((uint8_t)((uintptr_t)(ctx) >> 8))
+#define CTX_BOUND(ctx)                  ((uint8_t)((uintptr_t)(ctx) >> 16))
+
+_Static_assert(LIGHT_ONBOARD_CAPACITY <= 0xfe, "entries are alarm parameters");
+
+typedef struct {
+    esp_zb_ieee_addr_t ieee_addr;
+    uint16_t short_addr;
+    uint8_t stage;              /* light_onboard_stage_t, STAGE_RETRY or STAGE_FREE */
+    uint8_t next;               /* stage to run once a queued entry gets its place */
+    uint8_t index;              /* registry slot once matched, LIGHT_REGISTRY_INVALID before */
+    uint8_t capability;         /* MAC capability flags of the announcement, 0 for a restored light */
+    uint8_t retries;            /* of the current stage */
+    uint8_t generation;         /* attempt of the request out */
+    bool started;               /* left the queue once */
+    uint16_t order;             /* queue position, lower leaves first */
+    uint32_t since_ms;          /* announced or restored */
+    uint32_t stage_ms;          /* current stage started */
+} light_onboard_entry_t;
+
+static const char *TAG = "LIGHT_ONBOARD";
+
+static const char *const s_stage_names[LIGHT_ONBOARD_STAGE_COUNT] = {
+    [LIGHT_ONBOARD_QUEUE] = "queue",
+    [LIGHT_ONBOARD_MATCH] = "match",
+    [LIGHT_ONBOARD_BIND] = "bind",
+    [LIGHT_ONBOARD_CONFIGURE] = "configure",
+};
+
+static uint8_t s_src_endpoint;
+static light_onboard_configure_t s_configure;
+static light_onboard_entry_t s_entries[LIGHT_ONBOARD_CAPACITY];
+static uint16_t s_order;
+static bool s_pumping;
+static light_onboard_stats_t s_stats;
+
+static uint32_t light_onboard_now_ms(void)
+{
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+static void light_onboard_time(light_onboard_timing_t *timing, uint32_t since_ms)
+{
+    const uint32_t ms = light_onboard_now_ms() - since_ms;
+    timing->count++;
+    timing->total_ms += ms;
+    if (ms > timing->max_ms) {
+        timing->max_ms = ms;
+    }
+}
+
+static void light_onboard_usage(lamp_mem_usage_t *usage)
+{
+    usage->used = s_stats.pending;
+    usage->peak = s_stats.max_pending;
+}
+
+void light_onboard_init(uint8_t src_endpoint, light_onboard_configure_t configure)
+{
+    s_src_endpoint = src_endpoint;
+    s_configure = configure;
+    for (unsigned i = 0; i < LIGHT_ONBOARD_CAPACITY; ++i) {
+        s_entries[i].stage = STAGE_FREE;
+    }
+    s_order = 0;
+    s_pumping = false;
+    memset(&s_stats, 0, sizeof(s_stats));
+    lamp_mem_add_pool("onboarding", LIGHT_ONBOARD_CAPACITY, sizeof(light_onboard_entry_t), light_onboard_usage);
+}
+
+static uint8_t light_onboard_find(const esp_zb_ieee_addr_t ieee_addr)
+{
+    for (uint8_t i = 0; i < LIGHT_ONBOARD_CAPACITY; ++i) {
+        if (s_entries[i].stage != STAGE_FREE &&
+            memcmp(s_entries[i].ieee_addr, ieee_addr, sizeof(esp_zb_ieee_addr_t)) == 0) {
+            return i;
+        }
+    }
+    return LIGHT_REGISTRY_INVALID;
+}
+
+static light_onboard_entry_t *light_onboard_add(const esp_zb_ieee_addr_t ieee_addr, uint16_t short_addr)
+{
+    for (uint8_t i = 0; i < LIGHT_ONBOARD_CAPACITY; ++i) {
+        light_onboard_entry_t *entry = &s_entries[i];
+        if (entry->stage != STAGE_FREE) {
+            continue;
+        }
+        *entry = (light_onboard_entry_t){
+            .short_addr = short_addr,
+            .stage = LIGHT_ONBOARD_QUEUE,
+            .next = LIGHT_ONBOARD_MATCH,
+            .index = LIGHT_REGISTRY_INVALID,
+            .order = s_order++,
+            .since_ms = light_onboard_now_ms(),
+        };
+        entry->stage_ms = entry->since_ms;
+        memcpy(entry->ieee_addr, ieee_addr, sizeof(esp_zb_ieee_addr_t));
+        if (++s_stats.pending > s_stats.max_pending) {
+            s_stats.max_pending = s_stats.pending;
+        }
+        return entry;
+    }
+    return NULL;
+}
+
+static bool light_onboard_placed(const light_onboard_entry_t *entry)
+{
+    return entry->stage == LIGHT_ONBOARD_MATCH || entry->stage == LIGHT_ONBOARD_BIND ||
+           entry->stage == LIGHT_ONBOARD_CONFIGURE;
+}
+
+static void light_onboard_pump(void);
+static void light_onboard_timeout_cb(uint8_t param);
+static void light_onboard_retry_cb(uint8_t param);
+
+/* Leave the pipeline, giving the place back */
+static void light_onboard_finish(light_onboard_entry_t *entry)
+{
+    const uint8_t slot = (uint8_t)(entry - s_entries);
+    esp_zb_scheduler_alarm_cancel(light_onboard_timeout_cb, slot);
+    esp_zb_scheduler_alarm_cancel(light_onboard_retry_cb, slot);
+    if (light_onboard_placed(entry)) {
+        s_stats.active--;
+    }
+    entry->stage = STAGE_FREE;
+    s_stats.pending--;
+    light_onboard_pump();
+}
+
+static void light_onboard_retry_cb(uint8_t param)
+{
+    light_onboard_entry_t *entry = &s_entries[param];
+    if (entry->stage != STAGE_RETRY) {
+        return;
+    }
+    entry->stage = LIGHT_ONBOARD_QUEUE;
+    light_onboard_pump();
+}
+
+/* A stage failed: queue it again after the back-off, or give up */
+static void light_onboard_fail(light_onboard_entry_t *entry, esp_zb_zdp_status_t zdo_status)
+{
+    const uint8_t slot = (uint8_t)(entry - s_entries);
+    if (entry->retries >= LIGHT_ONBOARD_RETRIES) {
+        ESP_LOGW(TAG, "Giving up on device 0x%04hx in stage %s (status: 0x%x)", entry->short_addr,
+                 s_stage_names[entry->stage], zdo_status);
+        s_stats.failed++;
+        light_onboard_finish(entry);
+        return;
+    }
+    esp_zb_scheduler_alarm_cancel(light_onboard_timeout_cb, slot);
+    s_stats.retries++;
+    s_stats.active--;
+    entry->next = entry->stage;
+    entry->stage = STAGE_RETRY;
+    esp_zb_scheduler_alarm(light_onboard_retry_cb, slot, (uint32_t)LIGHT_ONBOARD_RETRY_MS << entry->retries);
+    entry->retries++;
+    light_onboard_pump();
+}
+
+static void light_onboard_match_cb(esp_zb_zdp_status_t zdo_status, uint16_t addr, uint8_t endpoint, void *user_ctx);
+static void light_onboard_bind_cb(esp_zb_zdp_status_t zdo_status, void *user_ctx);
+
+static void light_onboard_send_match(light_onboard_entry_t *entry)
+{
+    const uint8_t slot = (uint8_t)(entry - s_entries);
+    esp_zb_zdo_match_desc_req_param_t cmd_req = {
+        .dst_nwk_addr = entry->short_addr,
+        .addr_of_interest = entry->short_addr,
+    };
+    esp_zb_zdo_find_color_dimmable_light(&cmd_req, light_onboard_match_cb, CTX(slot, entry->generation, 0));
+    lamp_trace_zdo_request(LAMP_TRACE_ZDO_MATCH_DESC, cmd_req.dst_nwk_addr, cmd_req.addr_of_interest);
+    light_tx_sent_zdo(LIGHT_TX_MAINTENANCE);
+}
+
+/* Bind the first cluster the light misses on the coordinator, false when none is left or the light is gone */
+static bool light_onboard_send_bind(light_onboard_entry_t *entry)
+{
+    const uint8_t slot = (uint8_t)(entry - s_entries);
+    const light_bulb_device_params_t *light = light_registry_get(entry->index);
+    const uint8_t missing = light ? LIGHT_BOUND_ALL & ~light->bound_clusters : 0;
+    if (!missing) {
+        return false;
+    }
+    const uint8_t bound = missing & -missing;
+    esp_zb_zdo_bind_req_param_t bind_req = {
+        .src_endp = s_src_endpoint,
+        .cluster_id = bound == LIGHT_BOUND_COLOR ? ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL
+                                                 : ESP_ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL,
+        .dst_addr_mode = ESP_ZB_ZDO_BIND_DST_ADDR_MODE_64_BIT_EXTENDED,
+        .dst_endp = light->endpoint,
+        .req_dst_addr = esp_zb_get_short_address(),
+    };
+    esp_zb_get_long_address(bind_req.src_address);
+    memcpy(bind_req.dst_address_u.addr_long, light->ieee_addr, sizeof(esp_zb_ieee_addr_t));
+    esp_zb_zdo_device_bind_req(&bind_req, light_onboard_bind_cb, CTX(slot, entry->generation, bound));
+    lamp_trace_zdo_request(LAMP_TRACE_ZDO_BIND, bind_req.req_dst_addr, bind_req.cluster_id);
+    light_tx_sent_zdo(LIGHT_TX_MAINTENANCE);
+    return true;
+}
+
+/* Run a stage of a light that holds a place */
+static void light_onboard_run(light_onboard_entry_t *entry, light_onboard_stage_t stage)
+{
+    const uint8_t slot = (uint8_t)(entry - s_entries);
+    if (entry->stage != stage) {
+        entry->stage = stage;
+        entry->stage_ms = light_onboard_now_ms();
+    }
+    entry->generation++;
+    esp_zb_scheduler_alarm_cancel(light_onboard_timeout_cb, slot);
+    switch (stage) {
+    case LIGHT_ONBOARD_MATCH:
+        light_onboard_send_match(entry);
+        break;
+    case LIGHT_ONBOARD_BIND:
+        if (!light_onboard_send_bind(entry)) {
+            light_onboard_time(&s_stats.stages[LIGHT_ONBOARD_BIND], entry->stage_ms);
+            entry->retries = 0;
+            light_onboard_run(entry, LIGHT_ONBOARD_CONFIGURE);
+            return;
+        }
+        break;
+    case LIGHT_ONBOARD_CONFIGURE:
+        esp_zb_scheduler_alarm(light_onboard_timeout_cb, slot, LIGHT_ONBOARD_CONFIGURE_TIMEOUT_MS);
+        /* may end the stage right away */
+        s_configure(entry->index);
+        return;
+    default:
+        return;
+    }
+    esp_zb_scheduler_alarm(light_onboard_timeout_cb, slot, LIGHT_ONBOARD_ZDO_TIMEOUT_MS);
+}
+
+static void light_onboard_resume_cb(uint8_t param)
+{
+    (void)param;
+    light_onboard_pump();
+}
+
+/* Give free places to queued entries, fast path rejoins first, then in queue order */
+static void light_onboard_pump(void)
+{
+    if (s_pumping) {
+        return;
+    }
+    s_pumping = true;
+    while (s_stats.active < LIGHT_ONBOARD_WINDOW) {
+        light_onboard_entry_t *next = NULL;
+        for (unsigned i = 0; i < LIGHT_ONBOARD_CAPACITY; ++i) {
+            light_onboard_entry_t *entry = &s_entries[i];
+            if (entry->stage != LIGHT_ONBOARD_QUEUE) {
+                continue;
+            }
+            const bool fast = entry->next == LIGHT_ONBOARD_CONFIGURE;
+            const bool next_fast = next && next->next == LIGHT_ONBOARD_CONFIGURE;
+            if (!next || fast > next_fast || (fast == next_fast && (int16_t)(entry->order - next->order) < 0)) {
+                next = entry;
+            }
+        }
+        if (!next) {
+            break;
+        }
+        /* a known light's ZDO requests share the radio with its writes: let the lanes above go first */
+        if (next->index != LIGHT_REGISTRY_INVALID && next->next != LIGHT_ONBOARD_CONFIGURE &&
+            !light_tx_ready(LIGHT_TX_MAINTENANCE, next->index)) {
+            light_tx_defer(LIGHT_TX_MAINTENANCE, light_onboard_resume_cb, 0);
+            break;
+        }
+        if (!next->started) {
+            next->started = true;
+            light_onboard_time(&s_stats.stages[LIGHT_ONBOARD_QUEUE], next->since_ms);
+        }
+        if (++s_stats.active > s_stats.max_active) {
+            s_stats.max_active = s_stats.active;
+        }
+        light_onboard_run(next, next->next);
+    }
+    s_pumping = false;
+}
+
+static light_onboard_entry_t *light_onboard_answered(void *user_ctx, light_onboard_stage_t stage)
+{
+    const uint8_t slot = CTX_ENTRY(user_ctx);
+    if (slot >= LIGHT_ONBOARD_CAPACITY) {
+        return NULL;
+    }
+    light_onboard_entry_t *entry = &s_entries[slot];
+    if (entry->stage != stage || entry->generation != CTX_GENERATION(user_ctx)) {
+        return NULL;
+    }
+    esp_zb_scheduler_alarm_cancel(light_onboard_timeout_cb, slot);
+    return entry;
+}
+
+static void light_onboard_match_cb(esp_zb_zdp_status_t zdo_status, uint16_t addr, uint8_t endpoint, void *user_ctx)
+{
+    lamp_trace_match_desc(zdo_status, addr, endpoint);
+    light_onboard_entry_t *entry = light_onboard_answered(user_ctx, LIGHT_ONBOARD_MATCH);
+    if (!entry) {
+        return;
+    }
+    if (zdo_status == ESP_ZB_ZDP_STATUS_NO_MATCH || zdo_status == ESP_ZB_ZDP_STATUS_DEVICE_NOT_FOUND) {
+        ESP_LOGI(TAG, "Device 0x%04hx has no color dimmable light (status: 0x%x)", addr, zdo_status);
+        s_stats.not_lights++;
+        light_onboard_finish(entry);
+        return;
+    }
+    if (zdo_status != ESP_ZB_ZDP_STATUS_SUCCESS) {
+        ESP_LOGW(TAG, "Failed to find dimmable light 0x%04hx (status: 0x%x)", addr, zdo_status);
+        light_onboard_fail(entry, zdo_status);
+        return;
+    }
+    const uint8_t known = light_registry_find_ieee(entry->ieee_addr);
+    const uint8_t previous_endpoint = known == LIGHT_REGISTRY_INVALID ? 0 : light_registry_get(known)->endpoint;
+    const uint8_t index = light_registry_add(entry->ieee_addr, addr, endpoint);
+    if (index == LIGHT_REGISTRY_INVALID) {
+        ESP_LOGW(TAG, "Light table full (%d), ignoring light 0x%04hx", LIGHT_REGISTRY_CAPACITY, addr);
+        s_stats.failed++;
+        light_onboard_finish(entry);
+        return;
+    }
+    light_bulb_device_params_t *light = light_registry_get(index);
+    ESP_LOGI(TAG, "Found dimmable light %d (0x%04hx)", index, addr);
+    light->flags &= ~LIGHT_FLAG_STALE;
+    if (known == LIGHT_REGISTRY_INVALID) {
+        light_attr_forget(index);
+        light_latency_forget(index);
+        light_link_forget(index);
+        light_store_schedule_save();
+    } else if (previous_endpoint != endpoint) {
+        /* bindings and reporting name the old endpoint */
+        ESP_LOGW(TAG, "Light %d moved to endpoint %d, binding it again", index, endpoint);
+        light->bound_clusters = 0;
+        light->reported_attrs = 0;
+        light_store_schedule_save();
+    }
+    if (known != LIGHT_REGISTRY_INVALID && !entry->capability) {
+        s_stats.revalidated++;
+    }
+    light_onboard_time(&s_stats.stages[LIGHT_ONBOARD_MATCH], entry->stage_ms);
+    entry->index = index;
+    entry->retries = 0;
+    /* bindings live in the stack's own storage and survive reboots */
+    light_onboard_run(entry, LIGHT_ONBOARD_BIND);
+}
+
+static void light_onboard_bind_cb(esp_zb_zdp_status_t zdo_status, void *user_ctx)
+{
+    lamp_trace_bind(zdo_status, user_ctx);
+    light_onboard_entry_t *entry = light_onboard_answered(user_ctx, LIGHT_ONBOARD_BIND);
+    if (!entry) {
+        return;
+    }
+    light_bulb_device_params_t *light = light_registry_get(entry->index);
+    if (!light) {
+        light_onboard_finish(entry);
+        return;
+    }
+    if (zdo_status != ESP_ZB_ZDP_STATUS_SUCCESS) {
+        ESP_LOGW(TAG, "Failed to bind light %d (status: 0x%x)", entry->index, zdo_status);
+        light_onboard_fail(entry, zdo_status);
+        return;
+    }
+    light->bound_clusters |= CTX_BOUND(user_ctx);
+    light_store_schedule_save();
+    entry->retries = 0;
+    light_onboard_run(entry, LIGHT_ONBOARD_BIND);
+}
+
+static void light_onboard_timeout_cb(uint8_t param)
+{
+    light_onboard_entry_t *entry = &s_entries[param];
+    switch (entry->stage) {
+    case LIGHT_ONBOARD_MATCH:
+    case LIGHT_ONBOARD_BIND:
+        ESP_LOGW(TAG, "No answer from the stack for device 0x%04hx in stage %s", entry->short_addr,
+                 s_stage_names[entry->stage]);
+        light_onboard_fail(entry, ESP_ZB_ZDP_STATUS_TIMEOUT);
+        break;
+    case LIGHT_ONBOARD_CONFIGURE:
+        ESP_LOGW(TAG, "Light %d still configuring after %d ms, letting it finish outside the window", entry->index,
+                 LIGHT_ONBOARD_CONFIGURE_TIMEOUT_MS);
+        light_onboard_configured(entry->index);
+        break;
+    default:
+        break;
+    }
+}
+
+void light_onboard_configured(uint8_t index)
+{
+    for (unsigned i = 0; i < LIGHT_ONBOARD_CAPACITY; ++i) {
+        light_onboard_entry_t *entry = &s_entries[i];
+        if (entry->stage != LIGHT_ONBOARD_CONFIGURE || entry->index != index) {
+            continue;
+        }
+        light_bulb_device_params_t *light = light_registry_get(index);
+        if (light && entry->capability && light->mac_capability != entry->capability) {
+            light->mac_capability = entry->capability;
+            light_store_schedule_save();
+        }
+        light_onboard_time(&s_stats.stages[LIGHT_ONBOARD_CONFIGURE], entry->stage_ms);
+        light_onboard_time(&s_stats.onboarded, entry->since_ms);
+        ESP_LOGI(TAG, "Light %d onboarded in %" PRIu32 " ms", index, light_onboard_now_ms() - entry->since_ms);
+        light_onboard_finish(entry);
+        return;
+    }
+}
+
+void light_onboard_announced(const esp_zb_zdo_signal_device_annce_params_t *annce)
+{
+    s_stats.announced++;
+    const uint8_t known = light_registry_find_ieee(annce->ieee_addr);
+    light_bulb_device_params_t *light = light_registry_get(known);
+    /* keep addressing a known light that rejoined with a new short address */
+    if (light && light->short_addr != annce->device_short_addr) {
+        light_registry_add(annce->ieee_addr, annce->device_short_addr, light->endpoint);
+        light_store_schedule_save();
+    }
+    const uint8_t slot = light_onboard_find(annce->ieee_addr);
+    light_onboard_entry_t *entry = slot == LIGHT_REGISTRY_INVALID ? NULL : &s_entries[slot];
+    if (entry) {
+        /* an entry past the queue carries on with the new address, one backing off tries again now */
+        entry->short_addr = annce->device_short_addr;
+        entry->capability = annce->capability;
+        if (entry->stage == STAGE_RETRY) {
+            esp_zb_scheduler_alarm_cancel(light_onboard_retry_cb, slot);
+            entry->stage = LIGHT_ONBOARD_QUEUE;
+        }
+    } else {
+        entry = light_onboard_add(annce->ieee_addr, annce->device_short_addr);
+        if (!entry) {
+            ESP_LOGW(TAG, "Onboarding full (%d), ignoring device 0x%04hx", LIGHT_ONBOARD_CAPACITY,
+                     annce->device_short_addr);
+            s_stats.dropped++;
+            return;
+        }
+        entry->capability = annce->capability;
+    }
+    /* the same light, still bound and with the same descriptor: nothing to rediscover */
+    if (light && entry->stage == LIGHT_ONBOARD_QUEUE && entry->next == LIGHT_ONBOARD_MATCH &&
+        light->bound_clusters == LIGHT_BOUND_ALL && light->mac_capability == annce->capability) {
+        ESP_LOGI(TAG, "Light %d rejoined unchanged, skipping match and bind", known);
+        s_stats.fast++;
+        light->flags &= ~LIGHT_FLAG_STALE;
+        entry->index = known;
+        entry->next = LIGHT_ONBOARD_CONFIGURE;
+    }
+    light_onboard_pump();
+}
+
+void light_onboard_revalidate(void)
+{
+    uint8_t index;
+    LIGHT_MASK_FOR_EACH(index, light_registry_all()) {
+        const light_bulb_device_params_t *light = light_registry_get(index);
+        if (!(light->flags & LIGHT_FLAG_STALE) || light_onboard_find(light->ieee_addr) != LIGHT_REGISTRY_INVALID) {
+            continue;
+        }
+        light_onboard_entry_t *entry = light_onboard_add(light->ieee_addr, light->short_addr);
+        if (!entry) {
+            s_stats.dropped++;
+            continue;
+        }
+        entry->index = index;
+    }
+    light_onboard_pump();
+}
+
+void light_onboard_get_stats(light_onboard_stats_t *stats)
+{
+    *stats = s_stats;
+}
+
+void light_onboard_dump(void)
+{
+    printf("announced %lu, fast path %lu, revalidated %lu, retries %lu, failed %lu, not lights %lu, dropped %lu\n",
+           (unsigned long)s_stats.announced, (unsigned long)s_stats.fast, (unsigned long)s_stats.revalidated,
+           (unsigned long)s_stats.retries, (unsigned long)s_stats.failed, (unsigned long)s_stats.not_lights,
+           (unsigned long)s_stats.dropped);
+    printf("window %u/%u (max %u), in pipeline %u (max %u)\n", s_stats.active, LIGHT_ONBOARD_WINDOW,
+           s_stats.max_active, s_stats.pending, s_stats.max_pending);
+    printf("%-10s %6s %8s %8s\n", "stage", "count", "mean ms", "max ms");
+    for (int stage = 0; stage <= LIGHT_ONBOARD_STAGE_COUNT; ++stage) {
+        const light_onboard_timing_t *timing =
+            stage < LIGHT_ONBOARD_STAGE_COUNT ? &s_stats.stages[stage] : &s_stats.onboarded;
+        printf("%-10s %6lu %8lu %8lu\n", stage < LIGHT_ONBOARD_STAGE_COUNT ? s_stage_names[stage] : "total",
+               (unsigned long)timing->count, timing->count ? (unsigned long)(timing->total_ms / timing->count) : 0UL,
+               (unsigned long)timing->max_ms);
+    }
+    const uint32_t now_ms = light_onboard_now_ms();
+    for (unsigned i = 0; i < LIGHT_ONBOARD_CAPACITY; ++i) {
+        const light_onboard_entry_t *entry = &s_entries[i];
+        if (entry->stage == STAGE_FREE) {
+            continue;
+        }
+        printf("  0x%04hx %-9s %s retries %u, %lu ms in stage\n", entry->short_addr,
+               entry->stage == STAGE_RETRY ? "retry" : s_stage_names[entry->stage],
+               entry->stage == LIGHT_ONBOARD_QUEUE ? s_stage_names[entry->next] : "", entry->retries,
+               (unsigned long)(now_ms - entry->stage_ms));
+    }
+}
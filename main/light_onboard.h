@@ -0,0 +1,130 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Lamp controller onboarding pipeline
+ *
+ * This example code is in the Public Domain (or CC0 licensed, at your option.)
+ *
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include "esp_zigbee_core.h"
+#include "light_registry.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* devices announced or restored and not onboarded yet, waiting ones included */
+#define LIGHT_ONBOARD_CAPACITY          LIGHT_REGISTRY_CAPACITY
+
+/*
+ * Lights matched, bound or configured at once. Each has at most one ZDO
+ * request out, so this also bounds the stack's ZDO transactions.
+ */
+#define LIGHT_ONBOARD_WINDOW            6
+
+/* a failed or unanswered stage is queued again after LIGHT_ONBOARD_RETRY_MS, doubled each time, up to RETRIES times */
+#define LIGHT_ONBOARD_RETRIES           3
+#define LIGHT_ONBOARD_RETRY_MS          250
+
+/* a ZDO request the stack never answered, beyond its own ZDO timeout */
+#define LIGHT_ONBOARD_ZDO_TIMEOUT_MS    6000
+
+/* the configure stage gives the light its place back after this long, whatever is still going on */
+#define LIGHT_ONBOARD_CONFIGURE_TIMEOUT_MS 20000
+
+_Static_assert(LIGHT_ONBOARD_WINDOW >= 1 && LIGHT_ONBOARD_WINDOW <= LIGHT_ONBOARD_CAPACITY,
+               "the window is a subset of the pipeline");
+
+/* stages in pipeline order */
+typedef enum {
+    LIGHT_ONBOARD_QUEUE,            /* announced or restored, waiting for a place in the window */
+    LIGHT_ONBOARD_MATCH,            /* match descriptor request for a color dimmable light */
+    LIGHT_ONBOARD_BIND,             /* color and level control bound to the coordinator endpoint */
+    LIGHT_ONBOARD_CONFIGURE,        /* group, scenes, capabilities and attribute reporting */
+    LIGHT_ONBOARD_STAGE_COUNT,
+} light_onboard_stage_t;
+
+typedef struct {
+    uint32_t count;
+    uint32_t total_ms;
+    uint32_t max_ms;
+} light_onboard_timing_t;
+
+typedef struct {
+    light_onboard_timing_t stages[LIGHT_ONBOARD_STAGE_COUNT];  /* time spent in each stage, the attempt that passed */
+    light_onboard_timing_t onboarded;   /* announce or restore to configured, retries included */
+    uint32_t announced;         /* device announcements */
+    uint32_t fast;              /* known lights that rejoined unchanged and skipped match and bind */
+    uint32_t revalidated;       /* restored lights matched again without an announcement */
+    uint32_t retries;
+    uint32_t failed;            /* given up after LIGHT_ONBOARD_RETRIES */
+    uint32_t not_lights;        /* devices without a color dimmable light endpoint */
+    uint32_t dropped;           /* announcements that found the pipeline full */
+    uint8_t active;             /* places taken in the window right now */
+    uint8_t max_active;
+    uint8_t pending;            /* devices in the pipeline right now */
+    uint8_t max_pending;
+} light_onboard_stats_t;
+
+/**
+ * @brief Set up a light the pipeline matched and bound
+ *
+ * Starts the configure stage: the callee sends what the light needs and the
+ * stage ends with light_onboard_configured().
+ */
+typedef void (*light_onboard_configure_t)(uint8_t index);
+
+/*
+ * Every announced device walks through match, bind and configure in its own
+ * entry, LIGHT_ONBOARD_WINDOW of them past the queue at a time. A known light
+ * that rejoins bound and with the MAC capabilities it had before skips match
+ * and bind, so a room whose power came back is only configured again.
+ *
+ * Like the registry, the pipeline is not locked: call from the Zigbee task.
+ */
+
+/**
+ * @brief Forget every device in the pipeline and the counters
+ *
+ * @param src_endpoint  coordinator endpoint lights are bound to.
+ * @param configure     configure stage of a matched and bound light.
+ */
+void light_onboard_init(uint8_t src_endpoint, light_onboard_configure_t configure);
+
+/**
+ * @brief Onboard a device that announced itself, from the device announcement signal
+ */
+void light_onboard_announced(const esp_zb_zdo_signal_device_annce_params_t *annce);
+
+/**
+ * @brief Match every light restored from NVS that is still LIGHT_FLAG_STALE again
+ */
+void light_onboard_revalidate(void);
+
+/**
+ * @brief End the configure stage of a light, whether or not it accepted everything
+ *
+ * Lights not in the configure stage are ignored.
+ */
+void light_onboard_configured(uint8_t index);
+
+/**
+ * @brief Snapshot of the counters
+ */
+void light_onboard_get_stats(light_onboard_stats_t *stats);
+
+/**
+ * @brief Print the counters, the stage timing and the devices in the pipeline
+ */
+void light_onboard_dump(void);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,228 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Lamp controller light registry
+ *
+ * This example code is in the Public Domain (or CC0 licensed, at your option.)
+ *
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "lamp_mem.h"
+#include "light_registry.h"
+
+/**
+ * @brief:
+ * Light records live in a fixed array of LIGHT_REGISTRY_CAPACITY slots. Two
+ * open addressing hash indexes (linear probing, twice the capacity so the load
+ * factor stays at or below 1/2) map the short address and the IEEE address to
+ * a slot, giving O(1) lookups from either side without any heap use.
+ */
+
+_Static_assert(LIGHT_REGISTRY_CAPACITY <= 64, "light_mask_t holds at most 64 lights");
+
+#define INDEX_BITS      7
+#define INDEX_SIZE      (1U << INDEX_BITS)
+#define INDEX_EMPTY     0   /* index entries hold slot + 1 so zeroed tables are empty */
+#define SLOTS_MASK      (~(light_mask_t)0 >> (64 - LIGHT_REGISTRY_CAPACITY))
+
+_Static_assert(INDEX_SIZE >= 2 * LIGHT_REGISTRY_CAPACITY, "index must keep the load factor at or below 1/2");
+
+static light_bulb_device_params_t s_lights[LIGHT_REGISTRY_CAPACITY];
+static light_mask_t s_used;
+static uint8_t s_by_short[INDEX_SIZE];
+static uint8_t s_by_ieee[INDEX_SIZE];
+static uint8_t s_peak;          /* most lights held at once since boot */
+
+static void light_registry_usage(lamp_mem_usage_t *usage)
+{
+    usage->used = light_registry_count();
+    usage->peak = s_peak;
+}
+
+static uint32_t hash_short(uint16_t short_addr)
+{
+    return ((uint32_t)short_addr * 40503U) >> (16 - INDEX_BITS) & (INDEX_SIZE - 1);
+}
+
+static uint32_t hash_ieee(const esp_zb_ieee_addr_t ieee_addr)
+{
+    uint64_t x;
+    memcpy(&x, ieee_addr, sizeof(x));
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return (uint32_t)x & (INDEX_SIZE - 1);
+}
+
+static uint32_t hash_entry(const uint8_t *table, uint8_t entry)
+{
+    const light_bulb_device_params_t *light = &s_lights[entry - 1];
+    return table == s_by_short ? hash_short(light->short_addr) : hash_ieee(light->ieee_addr);
+}
+
+static void index_insert(uint8_t *table, uint32_t pos, uint8_t slot)
+{
+    while (table[pos] != INDEX_EMPTY) {
+        pos = (pos + 1) & (INDEX_SIZE - 1);
+    }
+    table[pos] = slot + 1;
+}
+
+/* Position of a slot's own entry, which may differ from a key match on address collisions */
+static uint32_t index_locate(const uint8_t *table, uint32_t pos, uint8_t slot)
+{
+    while (table[pos] != slot + 1) {
+        pos = (pos + 1) & (INDEX_SIZE - 1);
+    }
+    return pos;
+}
+
+/* Backward shift deletion keeps probe sequences intact without tombstones */
+static void index_erase(uint8_t *table, uint32_t pos)
+{
+    uint32_t hole = pos;
+    table[hole] = INDEX_EMPTY;
+    for (;;) {
+        pos = (pos + 1) & (INDEX_SIZE - 1);
+        if (table[pos] == INDEX_EMPTY) {
+            return;
+        }
+        uint32_t home = hash_entry(table, table[pos]);
+        /* move the entry into the hole unless its home lies cyclically in (hole, pos] */
+        if (((pos - home) & (INDEX_SIZE - 1)) >= ((pos - hole) & (INDEX_SIZE - 1))) {
+            table[hole] = table[pos];
+            table[pos] = INDEX_EMPTY;
+            hole = pos;
+        }
+    }
+}
+
+static uint32_t index_find_short(uint16_t short_addr)
+{
+    uint32_t pos = hash_short(short_addr);
+    while (s_by_short[pos] != INDEX_EMPTY && s_lights[s_by_short[pos] - 1].short_addr != short_addr) {
+        pos = (pos + 1) & (INDEX_SIZE - 1);
+    }
+    return pos;
+}
+
+static uint32_t index_find_ieee(const esp_zb_ieee_addr_t ieee_addr)
+{
+    uint32_t pos = hash_ieee(ieee_addr);
+    while (s_by_ieee[pos] != INDEX_EMPTY &&
+           memcmp(s_lights[s_by_ieee[pos] - 1].ieee_addr, ieee_addr, sizeof(esp_zb_ieee_addr_t)) != 0) {
+        pos = (pos + 1) & (INDEX_SIZE - 1);
+    }
+    return pos;
+}
+
+void light_registry_init(void)
+{
+    memset(s_lights, 0, sizeof(s_lights));
+    memset(s_by_short, INDEX_EMPTY, sizeof(s_by_short));
+    memset(s_by_ieee, INDEX_EMPTY, sizeof(s_by_ieee));
+    s_used = 0;
+    lamp_mem_add_pool("lights", LIGHT_REGISTRY_CAPACITY, sizeof(light_bulb_device_params_t), light_registry_usage);
+}
+
+uint8_t light_registry_add(const esp_zb_ieee_addr_t ieee_addr, uint16_t short_addr, uint8_t endpoint)
+{
+    uint8_t slot = light_registry_find_ieee(ieee_addr);
+    if (slot == LIGHT_REGISTRY_INVALID) {
+        light_mask_t free_slots = ~s_used & SLOTS_MASK;
+        if (!free_slots) {
+            return LIGHT_REGISTRY_INVALID;
+        }
+        slot = (uint8_t)__builtin_ctzll(free_slots);
+        memcpy(s_lights[slot].ieee_addr, ieee_addr, sizeof(esp_zb_ieee_addr_t));
+        s_lights[slot].short_addr = short_addr;
+        s_lights[slot].color_capabilities = LIGHT_CAPABILITIES_UNKNOWN;
+        s_used |= LIGHT_MASK(slot);
+        index_insert(s_by_ieee, hash_ieee(ieee_addr), slot);
+        index_insert(s_by_short, hash_short(short_addr), slot);
+        if (light_registry_count() > s_peak) {
+            s_peak = light_registry_count();
+        }
+    } else if (s_lights[slot].short_addr != short_addr) {
+        /* rejoined with a new network address */
+        index_erase(s_by_short, index_locate(s_by_short, hash_short(s_lights[slot].short_addr), slot));
+        s_lights[slot].short_addr = short_addr;
+        index_insert(s_by_short, hash_short(short_addr), slot);
+    }
+    s_lights[slot].endpoint = endpoint;
+    return slot;
+}
+
+void light_registry_remove(uint8_t index)
+{
+    if (!light_registry_get(index)) {
+        return;
+    }
+    index_erase(s_by_short, index_locate(s_by_short, hash_short(s_lights[index].short_addr), index));
+    index_erase(s_by_ieee, index_locate(s_by_ieee, hash_ieee(s_lights[index].ieee_addr), index));
+    memset(&s_lights[index], 0, sizeof(s_lights[index]));
+    s_used &= ~LIGHT_MASK(index);
+}
+
+uint8_t light_registry_find_short(uint16_t short_addr)
+{
+    uint8_t entry = s_by_short[index_find_short(short_addr)];
+    return entry == INDEX_EMPTY ? LIGHT_REGISTRY_INVALID : entry - 1;
+}
+
+uint8_t light_registry_find_ieee(const esp_zb_ieee_addr_t ieee_addr)
+{
+    uint8_t entry = s_by_ieee[index_find_ieee(ieee_addr)];
+    return entry == INDEX_EMPTY ? LIGHT_REGISTRY_INVALID : entry - 1;
+}
+
+light_bulb_device_params_t *light_registry_get(uint8_t index)
+{
+    if (index >= LIGHT_REGISTRY_CAPACITY || !(s_used & LIGHT_MASK(index))) {
+        return NULL;
+    }
+    return &s_lights[index];
+}
+
+light_mask_t light_registry_group_members(uint16_t group_id)
+{
+    light_mask_t members = 0;
+    uint8_t index;
+    LIGHT_MASK_FOR_EACH(index, s_used) {
+        if ((s_lights[index].flags & LIGHT_FLAG_GROUP_MEMBER) && s_lights[index].group_id == group_id) {
+            members |= LIGHT_MASK(index);
+        }
+    }
+    return members;
+}
+
+light_mask_t light_registry_all(void)
+{
+    return s_used;
+}
+
+uint8_t light_registry_count(void)
+{
+    return (uint8_t)__builtin_popcountll(s_used);
+}
+
+void light_registry_dump(void)
+{
+    printf("%-4s %-23s %-6s %-2s %-6s %s\n", "slot", "ieee", "short", "ep", "group", "flags");
+    uint8_t index;
+    LIGHT_MASK_FOR_EACH(index, s_used) {
+        const light_bulb_device_params_t *light = &s_lights[index];
+        const uint8_t *ieee = light->ieee_addr;
+        printf("%4u %02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x 0x%04hx %2u 0x%04hx%s%s%s%s\n", index, ieee[7], ieee[6],
+               ieee[5], ieee[4], ieee[3], ieee[2], ieee[1], ieee[0], light->short_addr, light->endpoint,
+               light->group_id, (light->flags & LIGHT_FLAG_STALE) ? " stale" : "",
+               (light->flags & LIGHT_FLAG_GROUP_MEMBER) ? " member" : "",
+               (light->flags & LIGHT_FLAG_GROUP_REJECTED) ? " rejected" : "",
+               (light->flags & LIGHT_FLAG_SCENES_VERIFIED) ? " scenes" : "");
+    }
+}
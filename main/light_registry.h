@@ -0,0 +1,148 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Lamp controller light registry
+ *
+ * This example code is in the Public Domain (or CC0 licensed, at your option.)
+ *
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_zigbee_core.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* maximum number of lights the coordinator keeps track of, at most 64 (one bit each in light_mask_t) */
+#define LIGHT_REGISTRY_CAPACITY     64
+
+/* sentinel returned by the index lookups when a light is unknown */
+#define LIGHT_REGISTRY_INVALID      0xff
+
+/* set of lights, bit n selects the light stored in slot n */
+typedef uint64_t light_mask_t;
+
+#define LIGHT_MASK(index)           ((light_mask_t)1 << (index))
+#define LIGHT_MASK_ALL              (~(light_mask_t)0)
+
+/**
+ * @brief Iterate over the slot indices selected by a mask, lowest first
+ *
+ * @param index     uint8_t variable receiving each slot index.
+ * @param mask      light_mask_t to iterate, evaluated once.
+ */
+#define LIGHT_MASK_FOR_EACH(index, mask)                                        \
+    for (light_mask_t _lm_rest = (mask);                                        \
+         _lm_rest && (((index) = (uint8_t)__builtin_ctzll(_lm_rest)), true);    \
+         _lm_rest &= _lm_rest - 1)
+
+/* light_bulb_device_params_t.bound_clusters bits */
+#define LIGHT_BOUND_COLOR           (1U << 0)
+#define LIGHT_BOUND_LEVEL           (1U << 1)
+#define LIGHT_BOUND_ALL             (LIGHT_BOUND_COLOR | LIGHT_BOUND_LEVEL)
+
+/* light_bulb_device_params_t.flags bits */
+#define LIGHT_FLAG_STALE            (1U << 0)   /* restored from NVS, not yet seen on this boot */
+#define LIGHT_FLAG_GROUP_MEMBER     (1U << 1)   /* light confirmed membership of group_id */
+#define LIGHT_FLAG_GROUP_REJECTED   (1U << 2)   /* light refused group_id, always addressed by unicast */
+#define LIGHT_FLAG_SCENES_VERIFIED  (1U << 3)   /* light proved on this boot that it holds scene_revision */
+
+/* color capabilities not read from the light yet */
+#define LIGHT_CAPABILITIES_UNKNOWN  0xffff
+
+typedef struct light_bulb_device_params_s {
+    esp_zb_ieee_addr_t ieee_addr;
+    uint8_t endpoint;
+    uint16_t short_addr;
+    uint8_t bound_clusters;         /* LIGHT_BOUND_* bits */
+    uint8_t flags;                  /* LIGHT_FLAG_* bits */
+    uint16_t color_capabilities;    /* ZCL color capabilities bitmap, LIGHT_CAPABILITIES_UNKNOWN if not read */
+    uint16_t group_id;              /* ZCL group the light was asked to join, 0 if none */
+    uint8_t scene_revision;         /* revision of the preset scenes stored in the light, 0 if none */
+    uint16_t reported_attrs;        /* light_attr_t bits the light reports on change, 0 if reporting is not set up */
+    uint8_t mac_capability;         /* MAC capability flags of its last device announcement, 0 if none was seen */
+} light_bulb_device_params_t;
+
+/*
+ * The registry is a fixed, statically allocated table. It is not locked
+ * internally: call it from the Zigbee task, or with esp_zb_lock_acquire() held.
+ */
+
+/**
+ * @brief Forget every light
+ */
+void light_registry_init(void);
+
+/**
+ * @brief Add a light, or update the short address and endpoint of a known one
+ *
+ * @param ieee_addr     IEEE address identifying the light.
+ * @param short_addr    current network address of the light.
+ * @param endpoint      endpoint hosting the light clusters.
+ * @return slot index of the light, LIGHT_REGISTRY_INVALID if the table is full.
+ */
+uint8_t light_registry_add(const esp_zb_ieee_addr_t ieee_addr, uint16_t short_addr, uint8_t endpoint);
+
+/**
+ * @brief Remove a light
+ *
+ * @param index     slot index of the light.
+ */
+void light_registry_remove(uint8_t index);
+
+/**
+ * @brief Find a light by network address in O(1)
+ *
+ * @return slot index, LIGHT_REGISTRY_INVALID if unknown.
+ */
+uint8_t light_registry_find_short(uint16_t short_addr);
+
+/**
+ * @brief Find a light by IEEE address in O(1)
+ *
+ * @return slot index, LIGHT_REGISTRY_INVALID if unknown.
+ */
+uint8_t light_registry_find_ieee(const esp_zb_ieee_addr_t ieee_addr);
+
+/**
+ * @brief Light record stored in a slot
+ *
+ * @return pointer to the record, NULL if the slot is empty.
+ */
+light_bulb_device_params_t *light_registry_get(uint8_t index);
+
+/**
+ * @brief Lights that confirmed membership of a group
+ *
+ * @param group_id  ZCL group identifier.
+ * @return mask of member lights, scanning at most LIGHT_REGISTRY_CAPACITY slots.
+ */
+light_mask_t light_registry_group_members(uint16_t group_id);
+
+/**
+ * @brief Mask of all occupied slots
+ */
+light_mask_t light_registry_all(void);
+
+/**
+ * @brief Number of known lights
+ */
+uint8_t light_registry_count(void);
+
+/**
+ * @brief Print every known light: slot, IEEE and short address, endpoint, group and flags
+ *
+ * Slots are the bits of a light_mask_t, the numbers schedule rooms and serial targets use.
+ */
+void light_registry_dump(void);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
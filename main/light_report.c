@@ -0,0 +1,369 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Lamp controller attribute reporting
+ *
+ * This example code is in the Public Domain (or CC0 licensed, at your option.)
+ *
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#include <inttypes.h>
+#include <string.h>
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "lamp_trace.h"
+#include "light_attr.h"
+#include "light_command.h"
+#include "light_link.h"
+#include "light_onboard.h"
+#include "light_report.h"
+#include "light_store.h"
+#include "light_tx.h"
+
+/**
+ * @brief:
+ * Each light walks through the reported clusters one step at a time: bind the
+ * cluster on the light, then configure its attributes, each step answered
+ * before the next is sent. Once configured, a cluster's attributes are read
+ * once to seed the attribute cache; from then on the light pushes changes and
+ * the cache keeps reported values without aging them.
+ */
+
+#define STEP_IDLE       0xff
+#define STEP_BIND       0
+#define STEP_CONFIGURE  1
+
+/* step of a cluster, STEP_BIND or STEP_CONFIGURE */
+#define STEP(cluster, phase)    ((uint8_t)((cluster) << 1 | (phase)))
+#define STEP_CLUSTER(step)      ((step) >> 1)
+#define STEP_PHASE(step)        ((step) & 1)
+
+/* bind callback context: slot index and step the bind belongs to */
+#define BIND_CTX(index, step)   ((void *)(uintptr_t)((index) << 8 | (step)))
+#define BIND_CTX_INDEX(ctx)     ((uint8_t)((uintptr_t)(ctx) >> 8))
+#define BIND_CTX_STEP(ctx)      ((uint8_t)(uintptr_t)(ctx))
+
+_Static_assert(LIGHT_REPORT_SILENCE_MS > 2000U * LIGHT_REPORT_ON_OFF_MAX_S &&
+               LIGHT_REPORT_SILENCE_MS > 2000U * LIGHT_REPORT_LEVEL_MAX_S &&
+               LIGHT_REPORT_SILENCE_MS > 2000U * LIGHT_REPORT_COLOR_MAX_S,
+               "a light must be allowed to miss one periodic report");
+
+typedef struct {
+    uint16_t attr_id;
+    uint8_t type;
+    const void *change;         /* in the attribute type, NULL for discrete types */
+} light_report_attr_t;
+
+typedef struct {
+    uint16_t cluster_id;
+    uint16_t min_interval;
+    uint16_t max_interval;
+    uint8_t count;
+    const light_report_attr_t *attrs;
+} light_report_cluster_t;
+
+static const uint8_t s_level_change = LIGHT_REPORT_LEVEL_CHANGE;
+static const uint16_t s_xy_change = LIGHT_REPORT_XY_CHANGE;
+static const uint8_t s_hue_sat_change = LIGHT_REPORT_HUE_SAT_CHANGE;
+static const uint16_t s_color_temperature_change = LIGHT_REPORT_COLOR_TEMPERATURE_CHANGE;
+
+static const light_report_attr_t s_on_off_attrs[] = {
+    {ESP_ZB_ZCL_ATTR_ON_OFF_ON_OFF_ID, ESP_ZB_ZCL_ATTR_TYPE_BOOL, NULL},
+};
+
+static const light_report_attr_t s_level_attrs[] = {
+    {ESP_ZB_ZCL_ATTR_LEVEL_CONTROL_CURRENT_LEVEL_ID, ESP_ZB_ZCL_ATTR_TYPE_U8, &s_level_change},
+};
+
+/* lights without hue or color temperature support reject those records, the others still report */
+static const light_report_attr_t s_color_attrs[] = {
+    {ESP_ZB_ZCL_ATTR_COLOR_CONTROL_CURRENT_X_ID, ESP_ZB_ZCL_ATTR_TYPE_U16, &s_xy_change},
+    {ESP_ZB_ZCL_ATTR_COLOR_CONTROL_CURRENT_Y_ID, ESP_ZB_ZCL_ATTR_TYPE_U16, &s_xy_change},
+    {ESP_ZB_ZCL_ATTR_COLOR_CONTROL_COLOR_MODE_ID, ESP_ZB_ZCL_ATTR_TYPE_8BIT_ENUM, NULL},
+    {ESP_ZB_ZCL_ATTR_COLOR_CONTROL_CURRENT_HUE_ID, ESP_ZB_ZCL_ATTR_TYPE_U8, &s_hue_sat_change},
+    {ESP_ZB_ZCL_ATTR_COLOR_CONTROL_CURRENT_SATURATION_ID, ESP_ZB_ZCL_ATTR_TYPE_U8, &s_hue_sat_change},
+    {ESP_ZB_ZCL_ATTR_COLOR_CONTROL_COLOR_TEMPERATURE_ID, ESP_ZB_ZCL_ATTR_TYPE_U16, &s_color_temperature_change},
+};
+
+#define ATTRS(list)     sizeof(list) / sizeof(list[0]), list
+
+static const light_report_cluster_t s_clusters[] = {
+    {ESP_ZB_ZCL_CLUSTER_ID_ON_OFF, LIGHT_REPORT_ON_OFF_MIN_S, LIGHT_REPORT_ON_OFF_MAX_S, ATTRS(s_on_off_attrs)},
+    {ESP_ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL, LIGHT_REPORT_LEVEL_MIN_S, LIGHT_REPORT_LEVEL_MAX_S, ATTRS(s_level_attrs)},
+    {ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL, LIGHT_REPORT_COLOR_MIN_S, LIGHT_REPORT_COLOR_MAX_S, ATTRS(s_color_attrs)},
+};
+
+#define CLUSTER_COUNT   (sizeof(s_clusters) / sizeof(s_clusters[0]))
+
+_Static_assert(sizeof(s_color_attrs) / sizeof(s_color_attrs[0]) <= LIGHT_CMD_MAX_READ_ATTRS,
+               "the seeding read asks for every attribute of a cluster at once");
+
+static const char *TAG = "LIGHT_REPORT";
+
+static uint8_t s_src_endpoint;
+static bool s_watching;
+
+/* per light configuration progress */
+static uint8_t s_step[LIGHT_REGISTRY_CAPACITY];         /* STEP() in progress, STEP_IDLE if none */
+static uint8_t s_retries[LIGHT_REGISTRY_CAPACITY];
+static uint16_t s_accepted[LIGHT_REGISTRY_CAPACITY];    /* light_attr_t bits configured so far */
+static uint32_t s_heard_ms[LIGHT_REGISTRY_CAPACITY];    /* last report, or when watching started */
+static light_mask_t s_held;                             /* lights whose step waits for the transmit scheduler */
+
+static uint32_t light_report_now_ms(void)
+{
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+static uint16_t light_report_attr_bit(uint16_t cluster_id, uint16_t attr_id)
+{
+    const light_attr_t attr = light_attr_lookup(cluster_id, attr_id);
+    return attr == LIGHT_ATTR_COUNT ? 0 : (uint16_t)(1U << attr);
+}
+
+void light_report_init(uint8_t src_endpoint)
+{
+    s_src_endpoint = src_endpoint;
+    s_watching = false;
+    s_held = 0;
+    memset(s_step, STEP_IDLE, sizeof(s_step));
+}
+
+static void light_report_step(uint8_t index);
+
+static void light_report_timeout_cb(uint8_t index)
+{
+    if (s_step[index] == STEP_IDLE || !light_registry_get(index)) {
+        s_step[index] = STEP_IDLE;
+        return;
+    }
+    if (++s_retries[index] > LIGHT_REPORT_RETRIES) {
+        ESP_LOGW(TAG, "Light %d did not answer %s of cluster 0x%04x, giving up", index,
+                 STEP_PHASE(s_step[index]) == STEP_BIND ? "bind" : "configure reporting",
+                 s_clusters[STEP_CLUSTER(s_step[index])].cluster_id);
+        s_step[index] = STEP_IDLE;
+        light_onboard_configured(index);
+        return;
+    }
+    light_report_step(index);
+}
+
+static void light_report_bind_cb(esp_zb_zdp_status_t zdo_status, void *user_ctx)
+{
+    lamp_trace_bind(zdo_status, user_ctx);
+    const uint8_t index = BIND_CTX_INDEX(user_ctx);
+    if (!light_registry_get(index) || s_step[index] != BIND_CTX_STEP(user_ctx)) {
+        return;
+    }
+    if (zdo_status != ESP_ZB_ZDP_STATUS_SUCCESS) {
+        ESP_LOGW(TAG, "Failed to bind cluster 0x%04x on light %d (status: 0x%x)",
+                 s_clusters[STEP_CLUSTER(s_step[index])].cluster_id, index, zdo_status);
+        esp_zb_scheduler_alarm(light_report_timeout_cb, index, LIGHT_REPORT_RESP_TIMEOUT_MS);
+        return;
+    }
+    s_retries[index] = 0;
+    s_step[index] = STEP(STEP_CLUSTER(s_step[index]), STEP_CONFIGURE);
+    light_report_step(index);
+}
+
+static void light_report_bind(uint8_t index, const light_report_cluster_t *cluster)
+{
+    const light_bulb_device_params_t *light = light_registry_get(index);
+    esp_zb_zdo_bind_req_param_t bind_req = {
+        .src_endp = light->endpoint,
+        .cluster_id = cluster->cluster_id,
+        .dst_addr_mode = ESP_ZB_ZDO_BIND_DST_ADDR_MODE_64_BIT_EXTENDED,
+        .dst_endp = s_src_endpoint,
+        .req_dst_addr = light->short_addr,
+    };
+    memcpy(bind_req.src_address, light->ieee_addr, sizeof(esp_zb_ieee_addr_t));
+    esp_zb_get_long_address(bind_req.dst_address_u.addr_long);
+    esp_zb_zdo_device_bind_req(&bind_req, light_report_bind_cb, BIND_CTX(index, s_step[index]));
+    lamp_trace_zdo_request(LAMP_TRACE_ZDO_BIND, bind_req.req_dst_addr, bind_req.cluster_id);
+    light_tx_sent_zdo(LIGHT_TX_MAINTENANCE);
+}
+
+static void light_report_send_config(uint8_t index, const light_report_cluster_t *cluster)
+{
+    const light_bulb_device_params_t *light = light_registry_get(index);
+    esp_zb_zcl_config_report_record_t records[sizeof(s_color_attrs) / sizeof(s_color_attrs[0])];
+    uint16_t payload = 0;
+    for (uint8_t i = 0; i < cluster->count; ++i) {
+        /* direction, attribute id, type, both intervals, then the change in the attribute's own type */
+        payload += 8 + (cluster->attrs[i].change ? (cluster->attrs[i].type == ESP_ZB_ZCL_ATTR_TYPE_U16 ? 2 : 1) : 0);
+        records[i] = (esp_zb_zcl_config_report_record_t){
+            .direction = ESP_ZB_ZCL_REPORT_DIRECTION_SEND,
+            .attributeID = cluster->attrs[i].attr_id,
+            .attrType = cluster->attrs[i].type,
+            .min_interval = cluster->min_interval,
+            .max_interval = cluster->max_interval,
+            .reportable_change = (void *)cluster->attrs[i].change,
+        };
+    }
+    esp_zb_zcl_config_report_cmd_t req = {
+        .zcl_basic_cmd = {
+            .dst_addr_u.addr_short = light->short_addr,
+            .dst_endpoint = light->endpoint,
+            .src_endpoint = s_src_endpoint,
+        },
+        .address_mode = ESP_ZB_APS_ADDR_MODE_16_ENDP_PRESENT,
+        .clusterID = cluster->cluster_id,
+        .record_number = cluster->count,
+        .record_field = records,
+    };
+    const uint8_t tsn = esp_zb_zcl_config_report_cmd_req(&req);
+    lamp_trace_zcl_request(cluster->cluster_id, ESP_ZB_ZCL_CMD_CONFIG_REPORT, &req.zcl_basic_cmd, req.address_mode,
+                           tsn, req.record_number);
+    light_link_sent(cluster->cluster_id, &req.zcl_basic_cmd, req.address_mode, tsn, payload);
+    light_tx_sent(LIGHT_TX_MAINTENANCE, index, tsn);
+    esp_zb_scheduler_alarm(light_report_timeout_cb, index, LIGHT_REPORT_RESP_TIMEOUT_MS);
+}
+
+static void light_report_resume_cb(uint8_t param)
+{
+    (void)param;
+    const light_mask_t held = s_held;
+    s_held = 0;
+    uint8_t index;
+    LIGHT_MASK_FOR_EACH(index, held) {
+        light_report_step(index);
+    }
+}
+
+/* Send the request of the light's current step once the maintenance lane has room */
+static void light_report_step(uint8_t index)
+{
+    /* a step the scheduler held back may find the light gone or given up on */
+    if (s_step[index] == STEP_IDLE || !light_registry_get(index)) {
+        return;
+    }
+    if (!light_tx_ready(LIGHT_TX_MAINTENANCE, index)) {
+        s_held |= LIGHT_MASK(index);
+        light_tx_defer(LIGHT_TX_MAINTENANCE, light_report_resume_cb, 0);
+        return;
+    }
+    const light_report_cluster_t *cluster = &s_clusters[STEP_CLUSTER(s_step[index])];
+    if (STEP_PHASE(s_step[index]) == STEP_BIND) {
+        light_report_bind(index, cluster);
+    } else {
+        light_report_send_config(index, cluster);
+    }
+}
+
+static void light_report_watch_cb(uint8_t param)
+{
+    (void)param;
+    const uint32_t now_ms = light_report_now_ms();
+    uint8_t index;
+    LIGHT_MASK_FOR_EACH(index, light_registry_all()) {
+        light_bulb_device_params_t *light = light_registry_get(index);
+        if (!light->reported_attrs || (light->flags & LIGHT_FLAG_STALE) || s_step[index] != STEP_IDLE ||
+            now_ms - s_heard_ms[index] < LIGHT_REPORT_SILENCE_MS) {
+            continue;
+        }
+        ESP_LOGW(TAG, "Light %d sent no report for %" PRIu32 " s, configuring reporting again", index,
+                 (now_ms - s_heard_ms[index]) / 1000);
+        light->reported_attrs = 0;
+        light_store_schedule_save();
+        light_report_configure(index);
+    }
+    esp_zb_scheduler_alarm(light_report_watch_cb, 0, LIGHT_REPORT_CHECK_INTERVAL_MS);
+}
+
+void light_report_configure(uint8_t index)
+{
+    light_bulb_device_params_t *light = light_registry_get(index);
+    if (!light || s_step[index] != STEP_IDLE) {
+        return;
+    }
+    if (!s_watching) {
+        s_watching = true;
+        esp_zb_scheduler_alarm(light_report_watch_cb, 0, LIGHT_REPORT_CHECK_INTERVAL_MS);
+    }
+    if (light->reported_attrs) {
+        s_heard_ms[index] = light_report_now_ms();
+        light_onboard_configured(index);
+        return;
+    }
+    ESP_LOGI(TAG, "Configuring attribute reporting on light %d", index);
+    s_step[index] = STEP(0, STEP_BIND);
+    s_retries[index] = 0;
+    s_accepted[index] = 0;
+    light_report_step(index);
+}
+
+void light_report_heard(uint8_t index)
+{
+    if (index < LIGHT_REGISTRY_CAPACITY) {
+        s_heard_ms[index] = light_report_now_ms();
+    }
+}
+
+/* read the newly reported attributes once, the cache drops those it already knows */
+static void light_report_seed(uint8_t index, const light_report_cluster_t *cluster, uint16_t accepted)
+{
+    light_cmd_t cmd = {
+        .type = LIGHT_CMD_READ_ATTRS,
+        .targets = LIGHT_MASK(index),
+        .read = {.cluster_id = cluster->cluster_id},
+    };
+    for (uint8_t i = 0; i < cluster->count; ++i) {
+        if (accepted & light_report_attr_bit(cluster->cluster_id, cluster->attrs[i].attr_id)) {
+            cmd.read.ids[cmd.read.count++] = cluster->attrs[i].attr_id;
+        }
+    }
+    if (cmd.read.count) {
+        light_command_post(&cmd);
+    }
+}
+
+esp_err_t light_report_resp_handler(const esp_zb_zcl_cmd_config_report_resp_message_t *message)
+{
+    ESP_RETURN_ON_FALSE(message, ESP_FAIL, TAG, "Empty message");
+    const uint8_t index = light_registry_find_short(message->info.src_address.u.short_addr);
+    light_bulb_device_params_t *light = light_registry_get(index);
+    if (!light || s_step[index] == STEP_IDLE || STEP_PHASE(s_step[index]) != STEP_CONFIGURE ||
+        message->info.cluster != s_clusters[STEP_CLUSTER(s_step[index])].cluster_id) {
+        return ESP_OK;
+    }
+    esp_zb_scheduler_alarm_cancel(light_report_timeout_cb, index);
+    const light_report_cluster_t *cluster = &s_clusters[STEP_CLUSTER(s_step[index])];
+
+    /* a response lists only the records that failed, or a single success */
+    uint16_t accepted = 0;
+    if (message->info.status == ESP_ZB_ZCL_STATUS_SUCCESS) {
+        for (uint8_t i = 0; i < cluster->count; ++i) {
+            accepted |= light_report_attr_bit(cluster->cluster_id, cluster->attrs[i].attr_id);
+        }
+        for (const esp_zb_zcl_config_report_resp_variable_t *variable = message->variables; variable;
+             variable = variable->next) {
+            if (variable->status != ESP_ZB_ZCL_STATUS_SUCCESS) {
+                accepted &= ~light_report_attr_bit(cluster->cluster_id, variable->attribute_id);
+            }
+        }
+    }
+    if (!accepted) {
+        ESP_LOGW(TAG, "Light %d reports nothing of cluster 0x%04x (status: 0x%x), its state is read instead", index,
+                 cluster->cluster_id, message->info.status);
+    }
+    s_accepted[index] |= accepted;
+    light_report_seed(index, cluster, accepted);
+
+    s_retries[index] = 0;
+    if (STEP_CLUSTER(s_step[index]) + 1U < CLUSTER_COUNT) {
+        s_step[index] = STEP(STEP_CLUSTER(s_step[index]) + 1, STEP_BIND);
+        light_report_step(index);
+        return ESP_OK;
+    }
+    ESP_LOGI(TAG, "Light %d reports attributes 0x%04x", index, s_accepted[index]);
+    s_step[index] = STEP_IDLE;
+    s_heard_ms[index] = light_report_now_ms();
+    light->reported_attrs = s_accepted[index];
+    light_store_schedule_save();
+    light_onboard_configured(index);
+    return ESP_OK;
+}
@@ -0,0 +1,90 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Lamp controller attribute reporting
+ *
+ * This example code is in the Public Domain (or CC0 licensed, at your option.)
+ *
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include "esp_zigbee_core.h"
+#include "light_registry.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Reporting intervals in seconds. A light reports a change no sooner than the
+ * min interval after its previous report, and reports anyway once the max
+ * interval has passed without one.
+ */
+#define LIGHT_REPORT_ON_OFF_MIN_S           0
+#define LIGHT_REPORT_ON_OFF_MAX_S           300
+#define LIGHT_REPORT_LEVEL_MIN_S            1
+#define LIGHT_REPORT_LEVEL_MAX_S            300
+#define LIGHT_REPORT_COLOR_MIN_S            1
+#define LIGHT_REPORT_COLOR_MAX_S            300
+
+/* reportable changes, in attribute units; smaller changes wait for the max interval */
+#define LIGHT_REPORT_LEVEL_CHANGE           1           /* current level, 1..254 */
+#define LIGHT_REPORT_XY_CHANGE              16          /* CIE x and y, 0..65279 */
+#define LIGHT_REPORT_HUE_SAT_CHANGE         1           /* current hue and saturation, 0..254 */
+#define LIGHT_REPORT_COLOR_TEMPERATURE_CHANGE 1         /* mireds */
+
+/* a bind or configure request without an answer is repeated after this long, at most LIGHT_REPORT_RETRIES times */
+#define LIGHT_REPORT_RESP_TIMEOUT_MS        1000
+#define LIGHT_REPORT_RETRIES                3
+
+/*
+ * A light that sent no report for this long lost its reporting configuration
+ * (factory reset, replaced) and is configured again. Keep it above twice the
+ * shortest max interval so a single lost periodic report is tolerated.
+ */
+#define LIGHT_REPORT_SILENCE_MS             660000
+#define LIGHT_REPORT_CHECK_INTERVAL_MS      60000
+
+/*
+ * Reports go to the bindings of the light, so every reported cluster is first
+ * bound on the light to the coordinator endpoint, then configured. What a light
+ * accepted is kept in its reported_attrs and persisted with the light table,
+ * since the configuration lives in the light and survives our reboots.
+ *
+ * Like the registry, the reporting state is not locked: call from the Zigbee task.
+ */
+
+/**
+ * @brief Set the coordinator endpoint reports are bound to
+ */
+void light_report_init(uint8_t src_endpoint);
+
+/**
+ * @brief Set up reporting on a bound light unless it is already reporting
+ *
+ * For a light that already reports, this starts watching that reports arrive.
+ * The light's onboarding stage ends (light_onboard_configured()) once it
+ * reports, or once it was given up on.
+ *
+ * @param index     slot index of the light.
+ */
+void light_report_configure(uint8_t index);
+
+/**
+ * @brief Note that a light sent a report, call from the Zigbee action handler
+ */
+void light_report_heard(uint8_t index);
+
+/**
+ * @brief Handle a configure reporting response, call from the Zigbee action handler
+ */
+esp_err_t light_report_resp_handler(const esp_zb_zcl_cmd_config_report_resp_message_t *message);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,247 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Lamp controller preset scenes
+ *
+ * This example code is in the Public Domain (or CC0 licensed, at your option.)
+ *
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#include <string.h>
+#include "esp_check.h"
+#include "esp_log.h"
+#include "lamp_trace.h"
+#include "light_link.h"
+#include "light_scene.h"
+#include "light_store.h"
+#include "light_tx.h"
+
+/**
+ * @brief:
+ * Every preset is stored in each light's Scenes cluster as on/off, level and
+ * color XY, so switching presets is a single recall scene frame and the light
+ * changes color and level in one step. Which revision of the table a light
+ * holds is kept in the light table and persisted, so lights are programmed
+ * once, not on every boot.
+ */
+
+#define PROGRAM_IDLE    0xff
+
+static const char *TAG = "LIGHT_SCENE";
+
+static const light_scene_preset_t *s_presets;
+static uint8_t s_count;
+static uint8_t s_revision;
+static uint8_t s_src_endpoint;
+
+/* per light programming progress */
+static uint8_t s_next[LIGHT_REGISTRY_CAPACITY];     /* preset being added, PROGRAM_IDLE if none */
+static uint8_t s_retries[LIGHT_REGISTRY_CAPACITY];
+static light_mask_t s_held;                         /* lights whose add waits for the transmit scheduler */
+
+void light_scene_init(uint8_t src_endpoint, const light_scene_preset_t *presets, uint8_t count)
+{
+    s_presets = presets;
+    s_count = count < LIGHT_SCENE_MAX_PRESETS ? count : LIGHT_SCENE_MAX_PRESETS;
+    s_src_endpoint = src_endpoint;
+    s_held = 0;
+    memset(s_next, PROGRAM_IDLE, sizeof(s_next));
+
+    /* FNV-1a over the table folded to 8 bits, 0 is reserved for "none" */
+    uint32_t hash = 2166136261U;
+    const uint8_t *bytes = (const uint8_t *)presets;
+    for (size_t i = 0; i < s_count * sizeof(light_scene_preset_t); ++i) {
+        hash = (hash ^ bytes[i]) * 16777619U;
+    }
+    s_revision = (uint8_t)(hash ^ hash >> 8 ^ hash >> 16 ^ hash >> 24);
+    if (s_revision == 0) {
+        s_revision = 1;
+    }
+}
+
+uint8_t light_scene_count(void)
+{
+    return s_count;
+}
+
+const light_scene_preset_t *light_scene_preset(uint8_t preset)
+{
+    return preset < s_count ? &s_presets[preset] : NULL;
+}
+
+uint8_t light_scene_revision(void)
+{
+    return s_revision;
+}
+
+light_mask_t light_scene_stored(void)
+{
+    light_mask_t stored = 0;
+    uint8_t index;
+    LIGHT_MASK_FOR_EACH(index, light_registry_all()) {
+        if (light_registry_get(index)->scene_revision == s_revision) {
+            stored |= LIGHT_MASK(index);
+        }
+    }
+    return stored;
+}
+
+light_mask_t light_scene_verified(void)
+{
+    light_mask_t verified = 0;
+    uint8_t index;
+    LIGHT_MASK_FOR_EACH(index, light_scene_stored()) {
+        if (light_registry_get(index)->flags & LIGHT_FLAG_SCENES_VERIFIED) {
+            verified |= LIGHT_MASK(index);
+        }
+    }
+    return verified;
+}
+
+static void light_scene_timeout_cb(uint8_t index);
+
+static void light_scene_add(uint8_t index);
+
+static void light_scene_resume_cb(uint8_t param)
+{
+    (void)param;
+    const light_mask_t held = s_held;
+    s_held = 0;
+    uint8_t index;
+    LIGHT_MASK_FOR_EACH(index, held) {
+        light_scene_add(index);
+    }
+}
+
+/* Add the preset being programmed once the maintenance lane has room */
+static void light_scene_add(uint8_t index)
+{
+    const light_bulb_device_params_t *light = light_registry_get(index);
+    /* an add the scheduler held back may find the light gone or given up on */
+    if (!light || s_next[index] == PROGRAM_IDLE) {
+        return;
+    }
+    if (!light_tx_ready(LIGHT_TX_MAINTENANCE, index)) {
+        s_held |= LIGHT_MASK(index);
+        light_tx_defer(LIGHT_TX_MAINTENANCE, light_scene_resume_cb, 0);
+        return;
+    }
+    const light_scene_preset_t *preset = &s_presets[s_next[index]];
+    uint8_t on_off[] = {preset->level > 1};
+    uint8_t level[] = {preset->level};
+    uint8_t color[] = {preset->color_x & 0xff, preset->color_x >> 8, preset->color_y & 0xff, preset->color_y >> 8};
+    esp_zb_zcl_scenes_extension_field_t color_field = {
+        .cluster_id = ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL,
+        .length = sizeof(color),
+        .extension_field_attribute_value_list = color,
+    };
+    esp_zb_zcl_scenes_extension_field_t level_field = {
+        .cluster_id = ESP_ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL,
+        .length = sizeof(level),
+        .extension_field_attribute_value_list = level,
+        .next = &color_field,
+    };
+    esp_zb_zcl_scenes_extension_field_t on_off_field = {
+        .cluster_id = ESP_ZB_ZCL_CLUSTER_ID_ON_OFF,
+        .length = sizeof(on_off),
+        .extension_field_attribute_value_list = on_off,
+        .next = &level_field,
+    };
+    esp_zb_zcl_scenes_add_scene_cmd_t req = {
+        .zcl_basic_cmd = {
+            .dst_addr_u.addr_short = light->short_addr,
+            .dst_endpoint = light->endpoint,
+            .src_endpoint = s_src_endpoint,
+        },
+        .address_mode = ESP_ZB_APS_ADDR_MODE_16_ENDP_PRESENT,
+        .group_id = LIGHT_SCENE_GROUP_ID,
+        .scene_id = s_next[index] + 1,
+        .extension_field = &on_off_field,
+    };
+    const uint8_t tsn = esp_zb_zcl_scenes_add_scene_cmd_req(&req);
+    lamp_trace_zcl_request(ESP_ZB_ZCL_CLUSTER_ID_SCENES, ESP_ZB_ZCL_CMD_SCENES_ADD_SCENE, &req.zcl_basic_cmd,
+                           req.address_mode, tsn, req.scene_id);
+    /* group id, scene id, transition time and an empty name, then each field's cluster, length and values */
+    uint16_t payload = 6;
+    for (const esp_zb_zcl_scenes_extension_field_t *field = req.extension_field; field; field = field->next) {
+        payload += 3 + field->length;
+    }
+    light_link_sent(ESP_ZB_ZCL_CLUSTER_ID_SCENES, &req.zcl_basic_cmd, req.address_mode, tsn, payload);
+    light_tx_sent(LIGHT_TX_MAINTENANCE, index, tsn);
+    esp_zb_scheduler_alarm(light_scene_timeout_cb, index, LIGHT_SCENE_RESP_TIMEOUT_MS);
+}
+
+static void light_scene_timeout_cb(uint8_t index)
+{
+    if (s_next[index] == PROGRAM_IDLE || !light_registry_get(index)) {
+        s_next[index] = PROGRAM_IDLE;
+        return;
+    }
+    if (++s_retries[index] > LIGHT_SCENE_RETRIES) {
+        ESP_LOGW(TAG, "Light %d did not answer add scene %d, giving up", index, s_next[index] + 1);
+        s_next[index] = PROGRAM_IDLE;
+        return;
+    }
+    light_scene_add(index);
+}
+
+void light_scene_program(uint8_t index)
+{
+    light_bulb_device_params_t *light = light_registry_get(index);
+    if (!light || !s_count || light->scene_revision == s_revision || s_next[index] != PROGRAM_IDLE) {
+        return;
+    }
+    ESP_LOGI(TAG, "Storing %d preset scenes (revision 0x%02x) in light %d", s_count, s_revision, index);
+    s_next[index] = 0;
+    s_retries[index] = 0;
+    light_scene_add(index);
+}
+
+void light_scene_recall_done(uint8_t index, esp_zb_zcl_status_t status)
+{
+    light_bulb_device_params_t *light = light_registry_get(index);
+    if (!light) {
+        return;
+    }
+    if (status == ESP_ZB_ZCL_STATUS_SUCCESS) {
+        light->flags |= LIGHT_FLAG_SCENES_VERIFIED;
+        return;
+    }
+    ESP_LOGW(TAG, "Light %d failed to recall a preset (status: 0x%x), reprogramming", index, status);
+    light->flags &= ~LIGHT_FLAG_SCENES_VERIFIED;
+    light->scene_revision = 0;
+    light_store_schedule_save();
+    light_scene_program(index);
+}
+
+esp_err_t light_scene_resp_handler(const esp_zb_zcl_scenes_operate_scene_resp_message_t *message)
+{
+    ESP_RETURN_ON_FALSE(message, ESP_FAIL, TAG, "Empty message");
+    const uint8_t index = light_registry_find_short(message->info.src_address.u.short_addr);
+    light_bulb_device_params_t *light = light_registry_get(index);
+    if (!light || s_next[index] == PROGRAM_IDLE || message->group_id != LIGHT_SCENE_GROUP_ID ||
+        message->scene_id != s_next[index] + 1) {
+        return ESP_OK;
+    }
+    esp_zb_scheduler_alarm_cancel(light_scene_timeout_cb, index);
+    if (message->info.status != ESP_ZB_ZCL_STATUS_SUCCESS) {
+        ESP_LOGW(TAG, "Light %d rejected scene %d (status: 0x%x), presets fall back to direct commands", index,
+                 message->scene_id, message->info.status);
+        s_next[index] = PROGRAM_IDLE;
+        return ESP_OK;
+    }
+    s_retries[index] = 0;
+    if (++s_next[index] < s_count) {
+        light_scene_add(index);
+        return ESP_OK;
+    }
+    ESP_LOGI(TAG, "Light %d holds preset scenes revision 0x%02x", index, s_revision);
+    s_next[index] = PROGRAM_IDLE;
+    light->scene_revision = s_revision;
+    light->flags |= LIGHT_FLAG_SCENES_VERIFIED;
+    light_store_schedule_save();
+    return ESP_OK;
+}
@@ -0,0 +1,109 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Lamp controller preset scenes
+ *
+ * This example code is in the Public Domain (or CC0 licensed, at your option.)
+ *
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include "esp_zigbee_core.h"
+#include "light_registry.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* most presets a table can hold, scene ids run from 1 to this */
+#define LIGHT_SCENE_MAX_PRESETS     16
+
+/* presets are stored in the global scene table, so any addressing mode can recall them */
+#define LIGHT_SCENE_GROUP_ID        0x0000
+
+/* an add scene without an answer is repeated after this long, at most LIGHT_SCENE_RETRIES times */
+#define LIGHT_SCENE_RESP_TIMEOUT_MS 1000
+#define LIGHT_SCENE_RETRIES         3
+
+typedef struct {
+    uint16_t color_x;           /* CIE x, 0..65279 */
+    uint16_t color_y;           /* CIE y, 0..65279 */
+    uint8_t level;              /* current level, 1..254 */
+} light_scene_preset_t;
+
+/*
+ * Like the registry, the scene state is not locked: call from the Zigbee task.
+ */
+
+/**
+ * @brief Set the preset table programmed into every light
+ *
+ * The revision is derived from the table contents, so editing a preset makes
+ * every light holding an older copy get reprogrammed on discovery.
+ *
+ * @param src_endpoint  coordinator endpoint the add scene commands come from.
+ * @param presets       preset table, must stay valid, preset n is scene n + 1.
+ * @param count         number of presets, at most LIGHT_SCENE_MAX_PRESETS.
+ */
+void light_scene_init(uint8_t src_endpoint, const light_scene_preset_t *presets, uint8_t count);
+
+/**
+ * @brief Number of presets in the table
+ */
+uint8_t light_scene_count(void);
+
+/**
+ * @brief Preset stored as scene preset + 1
+ *
+ * @return pointer into the table, NULL if out of range.
+ */
+const light_scene_preset_t *light_scene_preset(uint8_t preset);
+
+/**
+ * @brief Revision of the current preset table, never 0
+ */
+uint8_t light_scene_revision(void);
+
+/**
+ * @brief Lights that hold the current revision according to the light table
+ */
+light_mask_t light_scene_stored(void);
+
+/**
+ * @brief Lights that hold the current revision and confirmed it on this boot
+ */
+light_mask_t light_scene_verified(void);
+
+/**
+ * @brief Store every preset in a light unless it already holds this revision
+ *
+ * Presets are added one at a time, each after the previous one is answered.
+ *
+ * @param index     slot index of the light.
+ */
+void light_scene_program(uint8_t index);
+
+/**
+ * @brief Report the answer to a recall from one light
+ *
+ * A failed recall means the light lost its scenes: it is reprogrammed and
+ * recalls fall back to direct commands until that finishes.
+ *
+ * @param index     slot index of the light.
+ * @param status    ZCL status of the default response.
+ */
+void light_scene_recall_done(uint8_t index, esp_zb_zcl_status_t status);
+
+/**
+ * @brief Handle an add scene response, call from the Zigbee action handler
+ */
+esp_err_t light_scene_resp_handler(const esp_zb_zcl_scenes_operate_scene_resp_message_t *message);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
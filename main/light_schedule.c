@@ -0,0 +1,204 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Lamp controller circadian schedule
+ *
+ * This example code is in the Public Domain (or CC0 licensed, at your option.)
+ *
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_timer.h"
+#include "esp_zigbee_core.h"
+#include "light_fade.h"
+#include "light_schedule.h"
+
+/**
+ * @brief:
+ * The image stays mapped for as long as the controller runs and is never
+ * copied: a lookup reads a room entry and a handful of segments through the
+ * flash cache. Per room only the index of the segment applied last is kept
+ * in RAM; a check compares it with the active one and starts a fade on a
+ * change. A fade that finds every fade slot taken is retried on the next
+ * check, so rooms whose segments start together catch up one after another.
+ */
+
+#define SEGMENT_NONE    UINT16_MAX
+
+static const char *TAG = "LIGHT_SCHEDULE";
+
+static light_schedule_image_t s_image;
+static bool s_loaded;
+static bool s_clock_set;
+static bool s_enabled = true;
+static bool s_ticking;
+static int64_t s_clock_offset_us;           /* add to esp_timer_get_time() for the time since some midnight */
+static uint16_t s_applied[LIGHT_SCHEDULE_MAX_ROOMS];
+static uint32_t s_applied_count;
+static uint32_t s_deferred_count;
+
+static uint32_t light_schedule_day_s(void)
+{
+    const int64_t day_us = (int64_t)LIGHT_SCHEDULE_DAY_S * 1000000;
+    int64_t now_us = (esp_timer_get_time() + s_clock_offset_us) % day_us;
+    return (uint32_t)((now_us < 0 ? now_us + day_us : now_us) / 1000000);
+}
+
+static void light_schedule_reset_rooms(void)
+{
+    for (int r = 0; r < LIGHT_SCHEDULE_MAX_ROOMS; ++r) {
+        s_applied[r] = SEGMENT_NONE;
+    }
+}
+
+static void light_schedule_apply(uint8_t room, uint16_t index)
+{
+    const light_schedule_segment_t *segment = &s_image.segments[index];
+    uint32_t duration_ms = segment->fade_s * 1000U;
+    if (s_applied[room] == SEGMENT_NONE && duration_ms > LIGHT_SCHEDULE_CATCH_UP_MS) {
+        duration_ms = LIGHT_SCHEDULE_CATCH_UP_MS;
+    }
+    const light_fade_t fade = {
+        .targets = s_image.rooms[room].lights,
+        .duration_ms = duration_ms,
+        .level = segment->level != 0,
+        .level_to = segment->level,
+        .color = (segment->flags & LIGHT_SCHEDULE_SEGMENT_COLOR) ? LIGHT_FADE_COLOR_XY : LIGHT_FADE_COLOR_NONE,
+        .color_to.xy = {.x = segment->color_x, .y = segment->color_y},
+    };
+    const esp_err_t err = light_fade_start(&fade);
+    if (err == ESP_ERR_NO_MEM) {
+        s_deferred_count++;
+        return;
+    }
+    /* a room without any joined light, or a segment changing nothing, is done as well */
+    s_applied[room] = index;
+    s_applied_count++;
+    ESP_LOGI(TAG, "Room %d: segment %d from %02lu:%02lu", room, index, (unsigned long)segment->start_s / 3600,
+             (unsigned long)segment->start_s / 60 % 60);
+}
+
+static void light_schedule_check(void)
+{
+    if (!s_loaded || !s_clock_set || !s_enabled) {
+        return;
+    }
+    const uint32_t day_s = light_schedule_day_s();
+    for (uint8_t room = 0; room < s_image.header->room_count; ++room) {
+        const uint16_t active = light_schedule_image_active(&s_image, room, day_s);
+        if (active != s_applied[room]) {
+            light_schedule_apply(room, active);
+        }
+    }
+}
+
+static void light_schedule_tick_cb(uint8_t param)
+{
+    (void)param;
+    light_schedule_check();
+    if (s_loaded && s_clock_set && s_enabled) {
+        esp_zb_scheduler_alarm(light_schedule_tick_cb, 0, LIGHT_SCHEDULE_CHECK_MS);
+    } else {
+        s_ticking = false;
+    }
+}
+
+static void light_schedule_run(void)
+{
+    light_schedule_check();
+    if (!s_ticking && s_loaded && s_clock_set && s_enabled) {
+        s_ticking = true;
+        esp_zb_scheduler_alarm(light_schedule_tick_cb, 0, LIGHT_SCHEDULE_CHECK_MS);
+    }
+}
+
+esp_err_t light_schedule_init(void)
+{
+    light_schedule_reset_rooms();
+    const esp_partition_t *partition = esp_partition_find_first(
+        ESP_PARTITION_TYPE_DATA, (esp_partition_subtype_t)LIGHT_SCHEDULE_PARTITION_SUBTYPE,
+        LIGHT_SCHEDULE_PARTITION_LABEL);
+    if (!partition) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    const void *data;
+    esp_partition_mmap_handle_t handle;
+    esp_err_t err = esp_partition_mmap(partition, 0, partition->size, ESP_PARTITION_MMAP_DATA, &data, &handle);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to map the schedule partition: %s", esp_err_to_name(err));
+        return err;
+    }
+    const char *error;
+    if (!light_schedule_image_open(&s_image, data, partition->size, &error)) {
+        ESP_LOGW(TAG, "No schedule: %s", error);
+        esp_partition_munmap(handle);
+        return ESP_ERR_INVALID_STATE;
+    }
+    /* the mapping is kept: the image is read in place from now on */
+    s_loaded = true;
+    ESP_LOGI(TAG, "Schedule revision %lu: %d rooms, %d segments", (unsigned long)s_image.header->revision,
+             s_image.header->room_count, s_image.header->segment_count);
+    return ESP_OK;
+}
+
+void light_schedule_set_time(uint32_t day_s)
+{
+    s_clock_offset_us = (int64_t)(day_s % LIGHT_SCHEDULE_DAY_S) * 1000000 - esp_timer_get_time();
+    s_clock_set = true;
+    /* segments are looked up again at the new time, each room catches up */
+    light_schedule_reset_rooms();
+    light_schedule_run();
+}
+
+void light_schedule_enable(bool enable)
+{
+    s_enabled = enable;
+    if (enable) {
+        light_schedule_reset_rooms();
+        light_schedule_run();
+    }
+}
+
+void light_schedule_get_stats(light_schedule_stats_t *stats)
+{
+    *stats = (light_schedule_stats_t){
+        .loaded = s_loaded,
+        .clock_set = s_clock_set,
+        .enabled = s_enabled,
+        .revision = s_loaded ? s_image.header->revision : 0,
+        .day_s = s_clock_set ? light_schedule_day_s() : 0,
+        .applied = s_applied_count,
+        .deferred = s_deferred_count,
+    };
+}
+
+void light_schedule_dump(void)
+{
+    if (!s_loaded) {
+        printf("no schedule image\n");
+        return;
+    }
+    const uint32_t day_s = light_schedule_day_s();
+    for (uint8_t room = 0; room < s_image.header->room_count; ++room) {
+        const light_schedule_room_t *r = &s_image.rooms[room];
+        printf("room %u: lights 0x%016llx, %u segments", room, (unsigned long long)r->lights, r->count);
+        if (s_clock_set) {
+            const uint16_t active = light_schedule_image_active(&s_image, room, day_s);
+            const light_schedule_segment_t *segment = &s_image.segments[active];
+            printf(", active %u from %02lu:%02lu level %u", active - r->first,
+                   (unsigned long)segment->start_s / 3600, (unsigned long)segment->start_s / 60 % 60,
+                   segment->level);
+            if (segment->flags & LIGHT_SCHEDULE_SEGMENT_COLOR) {
+                printf(" xy %u %u", segment->color_x, segment->color_y);
+            }
+            printf("%s", s_applied[room] == active ? "" : " (not applied)");
+        }
+        printf("\n");
+    }
+}
@@ -0,0 +1,86 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Lamp controller circadian schedule
+ *
+ * This example code is in the Public Domain (or CC0 licensed, at your option.)
+ *
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "light_schedule_image.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* data partition holding the schedule image, see partitions.csv */
+#define LIGHT_SCHEDULE_PARTITION_LABEL      "schedule"
+#define LIGHT_SCHEDULE_PARTITION_SUBTYPE    0x40
+
+/* how often the active segment of every room is looked up once the clock is set */
+#define LIGHT_SCHEDULE_CHECK_MS     10000
+
+/* a room first driven in the middle of a segment gets there at most this fast */
+#define LIGHT_SCHEDULE_CATCH_UP_MS  2000
+
+typedef struct {
+    bool loaded;                /* a valid image is mapped */
+    bool clock_set;
+    bool enabled;
+    uint32_t revision;          /* of the mapped image */
+    uint32_t day_s;             /* time of day now, if the clock is set */
+    uint32_t applied;           /* segments handed to the fade engine */
+    uint32_t deferred;          /* segments that waited for a free fade */
+} light_schedule_stats_t;
+
+/*
+ * The schedule fades each room to the values of its active segment whenever
+ * that segment changes, so a button press holds until the next segment
+ * starts. There is no time source on the device: the schedule waits until
+ * light_schedule_set_time() is called, then runs on esp_timer.
+ *
+ * Like the registry, the schedule state is not locked: call from the Zigbee
+ * task, except light_schedule_init().
+ */
+
+/**
+ * @brief Map the schedule partition and check its image, call once before the Zigbee task starts
+ *
+ * @return ESP_OK, ESP_ERR_NOT_FOUND without a schedule partition,
+ *         ESP_ERR_INVALID_STATE if it holds no valid image.
+ */
+esp_err_t light_schedule_init(void);
+
+/**
+ * @brief Set the time of day and start following the schedule
+ *
+ * @param day_s     seconds after midnight, below LIGHT_SCHEDULE_DAY_S.
+ */
+void light_schedule_set_time(uint32_t day_s);
+
+/**
+ * @brief Follow the schedule or stop doing so; enabling drives every room to its active segment
+ */
+void light_schedule_enable(bool enable);
+
+/**
+ * @brief Get a snapshot of the schedule state
+ */
+void light_schedule_get_stats(light_schedule_stats_t *stats);
+
+/**
+ * @brief Print the rooms with their active segments
+ */
+void light_schedule_dump(void);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,108 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Lamp controller schedule image format and evaluator
+ *
+ * This example code is in the Public Domain (or CC0 licensed, at your option.)
+ *
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#include "light_schedule_image.h"
+
+/**
+ * @brief:
+ * Plain C without ESP-IDF headers, so the host image tool builds, checks and
+ * evaluates images with the same code as the firmware. Everything the
+ * evaluator relies on (sorted segments, indices in range) is checked once
+ * when the image is opened, so a lookup is a bare binary search.
+ */
+
+uint32_t light_schedule_crc32(const void *data, size_t len)
+{
+    const uint8_t *bytes = data;
+    uint32_t crc = 0xffffffffU;
+    while (len--) {
+        crc ^= *bytes++;
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ (0xedb88320U & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+static bool image_reject(const char **error, const char *why)
+{
+    if (error) {
+        *error = why;
+    }
+    return false;
+}
+
+bool light_schedule_image_open(light_schedule_image_t *image, const void *data, size_t size, const char **error)
+{
+    const light_schedule_header_t *header = data;
+    if (((uintptr_t)data & 3) || size < sizeof(*header)) {
+        return image_reject(error, "too short or unaligned");
+    }
+    if (header->magic != LIGHT_SCHEDULE_MAGIC) {
+        return image_reject(error, "no schedule image");
+    }
+    if (header->version != LIGHT_SCHEDULE_VERSION) {
+        return image_reject(error, "unsupported version");
+    }
+    if (!header->room_count || header->room_count > LIGHT_SCHEDULE_MAX_ROOMS) {
+        return image_reject(error, "bad room count");
+    }
+    const size_t length = sizeof(*header) + header->room_count * sizeof(light_schedule_room_t) +
+                          header->segment_count * sizeof(light_schedule_segment_t);
+    if (header->length != length || length > size) {
+        return image_reject(error, "bad length");
+    }
+    if (light_schedule_crc32(header + 1, length - sizeof(*header)) != header->crc32) {
+        return image_reject(error, "bad CRC");
+    }
+    const light_schedule_room_t *rooms = (const light_schedule_room_t *)(header + 1);
+    const light_schedule_segment_t *segments = (const light_schedule_segment_t *)(rooms + header->room_count);
+    for (int r = 0; r < header->room_count; ++r) {
+        const light_schedule_room_t *room = &rooms[r];
+        if (!room->count || (uint32_t)room->first + room->count > header->segment_count) {
+            return image_reject(error, "room segments out of range");
+        }
+        for (int s = room->first; s < room->first + room->count; ++s) {
+            if (segments[s].start_s >= LIGHT_SCHEDULE_DAY_S || segments[s].level > 254) {
+                return image_reject(error, "segment out of range");
+            }
+            if (s > room->first && segments[s].start_s <= segments[s - 1].start_s) {
+                return image_reject(error, "segments not sorted by start time");
+            }
+        }
+    }
+    *image = (light_schedule_image_t){
+        .header = header,
+        .rooms = rooms,
+        .segments = segments,
+    };
+    return true;
+}
+
+uint16_t light_schedule_image_active(const light_schedule_image_t *image, uint8_t room, uint32_t day_s)
+{
+    const light_schedule_room_t *r = &image->rooms[room];
+    const light_schedule_segment_t *segments = &image->segments[r->first];
+    /* first segment starting after day_s, the one before it is active */
+    uint16_t low = 0;
+    uint16_t high = r->count;
+    while (low < high) {
+        const uint16_t mid = low + (high - low) / 2;
+        if (segments[mid].start_s <= day_s) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    /* before the first start of the day the last segment of yesterday still runs */
+    return r->first + (low ? low - 1 : r->count - 1);
+}
@@ -0,0 +1,114 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Lamp controller schedule image format and evaluator
+ *
+ * This example code is in the Public Domain (or CC0 licensed, at your option.)
+ *
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A schedule image is read where it lies, in a memory mapped flash partition
+ * on the device or a mapped file on the host, so its structs are its layout:
+ * little endian, naturally aligned, no padding. It is
+ *
+ *   light_schedule_header_t
+ *   light_schedule_room_t       rooms[room_count]
+ *   light_schedule_segment_t    segments[segment_count]
+ *
+ * where each room owns a run of segments sorted by strictly increasing start
+ * time. A segment lasts from its start until the next one of its room, the
+ * last one wraps past midnight into the first. Bump the version on any
+ * layout change: the firmware rejects images of other versions.
+ */
+#define LIGHT_SCHEDULE_MAGIC        0x4843534cU /* "LSCH" */
+#define LIGHT_SCHEDULE_VERSION      1
+
+#define LIGHT_SCHEDULE_DAY_S        86400
+#define LIGHT_SCHEDULE_MAX_ROOMS    8
+
+/* segment sets its color to color_x, color_y; without it only the level changes */
+#define LIGHT_SCHEDULE_SEGMENT_COLOR    (1U << 0)
+
+typedef struct {
+    uint32_t magic;             /* LIGHT_SCHEDULE_MAGIC */
+    uint16_t version;           /* LIGHT_SCHEDULE_VERSION */
+    uint8_t room_count;         /* 1..LIGHT_SCHEDULE_MAX_ROOMS */
+    uint8_t reserved;           /* 0 */
+    uint16_t segment_count;
+    uint16_t reserved2;         /* 0 */
+    uint32_t length;            /* bytes of the whole image */
+    uint32_t crc32;             /* IEEE CRC-32 of the rooms and segments */
+    uint32_t revision;          /* chosen by the image builder, shown on the console */
+} light_schedule_header_t;
+
+typedef struct {
+    uint64_t lights;            /* light_mask_t: registry slots of the lights in the room */
+    uint16_t first;             /* index of the room's first segment */
+    uint16_t count;             /* at least one */
+    uint32_t reserved;          /* 0 */
+} light_schedule_room_t;
+
+typedef struct {
+    uint32_t start_s;           /* seconds after midnight, below LIGHT_SCHEDULE_DAY_S */
+    uint16_t color_x;           /* CIE x, 0..65279 */
+    uint16_t color_y;           /* CIE y, 0..65279 */
+    uint16_t fade_s;            /* time to reach the segment's values from the previous ones */
+    uint8_t level;              /* 1..254, 0 to leave the level alone */
+    uint8_t flags;              /* LIGHT_SCHEDULE_SEGMENT_* bits */
+} light_schedule_segment_t;
+
+_Static_assert(sizeof(light_schedule_header_t) == 24, "schedule header layout");
+_Static_assert(sizeof(light_schedule_room_t) == 16, "schedule room layout");
+_Static_assert(sizeof(light_schedule_segment_t) == 12, "schedule segment layout");
+
+/* a validated image, pointing into the mapped data */
+typedef struct {
+    const light_schedule_header_t *header;
+    const light_schedule_room_t *rooms;
+    const light_schedule_segment_t *segments;
+} light_schedule_image_t;
+
+/**
+ * @brief IEEE CRC-32 (as zlib) of a buffer
+ */
+uint32_t light_schedule_crc32(const void *data, size_t len);
+
+/**
+ * @brief Check an image and point an image view into it
+ *
+ * @param image     view to fill in, pointing into data.
+ * @param data      mapped image, 4-byte aligned; may be longer than the image.
+ * @param size      bytes mapped.
+ * @param error     set to what is wrong with the image when it is rejected, may be NULL.
+ *
+ * @return true for a valid image.
+ */
+bool light_schedule_image_open(light_schedule_image_t *image, const void *data, size_t size, const char **error);
+
+/**
+ * @brief Segment of a room active at a time of day, by binary search
+ *
+ * @param room      room index, below the image's room count.
+ * @param day_s     seconds after midnight, below LIGHT_SCHEDULE_DAY_S.
+ *
+ * @return index into the image's segments.
+ */
+uint16_t light_schedule_image_active(const light_schedule_image_t *image, uint8_t room, uint32_t day_s);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
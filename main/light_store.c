@@ -0,0 +1,168 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Lamp controller light table persistence
+ *
+ * This example code is in the Public Domain (or CC0 licensed, at your option.)
+ *
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#include <stddef.h>
+#include <string.h>
+#include "esp_check.h"
+#include "esp_log.h"
+#include "nvs.h"
+#include "lamp_mem.h"
+#include "light_registry.h"
+#include "light_store.h"
+
+/**
+ * @brief:
+ * The table is stored as one blob: a small header followed by a packed record
+ * per light. Only what is needed to address and trust a light without asking
+ * the network again is kept; flags describing this boot are not.
+ */
+
+#define LIGHT_STORE_VERSION     5
+
+/* record flags that describe the light rather than this boot */
+#define LIGHT_STORE_FLAGS       (LIGHT_FLAG_GROUP_MEMBER | LIGHT_FLAG_GROUP_REJECTED)
+
+typedef struct __attribute__((packed)) {
+    uint8_t version;
+    uint8_t count;
+} light_store_header_t;
+
+/* every version appends fields, older records are a prefix of the current one */
+typedef struct __attribute__((packed)) {
+    esp_zb_ieee_addr_t ieee_addr;
+    uint16_t short_addr;
+    uint8_t endpoint;
+    uint8_t bound_clusters;
+    uint16_t color_capabilities;
+    uint16_t group_id;          /* version 2 */
+    uint8_t flags;
+    uint8_t scene_revision;     /* version 3 */
+    uint16_t reported_attrs;    /* version 4 */
+    uint8_t mac_capability;     /* version 5 */
+} light_store_record_t;
+
+static const size_t s_record_size[LIGHT_STORE_VERSION + 1] = {
+    [1] = offsetof(light_store_record_t, group_id),
+    [2] = offsetof(light_store_record_t, scene_revision),
+    [3] = offsetof(light_store_record_t, reported_attrs),
+    [4] = offsetof(light_store_record_t, mac_capability),
+    [5] = sizeof(light_store_record_t),
+};
+
+typedef struct __attribute__((packed)) {
+    light_store_header_t header;
+    light_store_record_t records[LIGHT_REGISTRY_CAPACITY];
+} light_store_blob_t;
+
+static const char *TAG = "LIGHT_STORE";
+
+static light_store_blob_t s_blob;
+static bool s_save_pending;
+
+esp_err_t light_store_load(void)
+{
+    nvs_handle_t handle;
+    esp_err_t ret = nvs_open(LIGHT_STORE_NAMESPACE, NVS_READONLY, &handle);
+    if (ret == ESP_ERR_NVS_NOT_FOUND) {
+        return ESP_OK;
+    }
+    ESP_RETURN_ON_ERROR(ret, TAG, "Failed to open NVS namespace");
+
+    size_t length = sizeof(s_blob);
+    ret = nvs_get_blob(handle, LIGHT_STORE_KEY, &s_blob, &length);
+    nvs_close(handle);
+    if (ret == ESP_ERR_NVS_NOT_FOUND) {
+        return ESP_OK;
+    }
+    ESP_RETURN_ON_ERROR(ret, TAG, "Failed to read light table");
+    ESP_RETURN_ON_FALSE(length >= sizeof(light_store_header_t) && s_blob.header.version >= 1 &&
+                        s_blob.header.version <= LIGHT_STORE_VERSION,
+                        ESP_ERR_INVALID_VERSION, TAG, "Ignoring light table with unknown layout");
+    const size_t record_size = s_record_size[s_blob.header.version];
+    ESP_RETURN_ON_FALSE(length == sizeof(light_store_header_t) + s_blob.header.count * record_size,
+                        ESP_ERR_INVALID_SIZE, TAG, "Ignoring truncated light table");
+
+    const uint8_t *records = (const uint8_t *)s_blob.records;
+    for (uint8_t i = 0; i < s_blob.header.count; ++i) {
+        light_store_record_t record = {0};
+        /* fields newer than the stored version stay zero */
+        memcpy(&record, records + i * record_size, record_size);
+        const uint8_t index = light_registry_add(record.ieee_addr, record.short_addr, record.endpoint);
+        if (index == LIGHT_REGISTRY_INVALID) {
+            break;
+        }
+        light_bulb_device_params_t *light = light_registry_get(index);
+        light->bound_clusters = record.bound_clusters;
+        light->color_capabilities = record.color_capabilities;
+        light->group_id = record.group_id;
+        light->scene_revision = record.scene_revision;
+        light->reported_attrs = record.reported_attrs;
+        light->mac_capability = record.mac_capability;
+        light->flags = (record.flags & LIGHT_STORE_FLAGS) | LIGHT_FLAG_STALE;
+    }
+    ESP_LOGI(TAG, "Restored %d lights", light_registry_count());
+    return ESP_OK;
+}
+
+esp_err_t light_store_save(void)
+{
+    uint8_t index;
+    uint8_t count = 0;
+    LIGHT_MASK_FOR_EACH(index, light_registry_all()) {
+        const light_bulb_device_params_t *light = light_registry_get(index);
+        light_store_record_t *record = &s_blob.records[count++];
+        memcpy(record->ieee_addr, light->ieee_addr, sizeof(esp_zb_ieee_addr_t));
+        record->short_addr = light->short_addr;
+        record->endpoint = light->endpoint;
+        record->bound_clusters = light->bound_clusters;
+        record->color_capabilities = light->color_capabilities;
+        record->group_id = light->group_id;
+        record->flags = light->flags & LIGHT_STORE_FLAGS;
+        record->scene_revision = light->scene_revision;
+        record->reported_attrs = light->reported_attrs;
+        record->mac_capability = light->mac_capability;
+    }
+    s_blob.header.version = LIGHT_STORE_VERSION;
+    s_blob.header.count = count;
+
+    /* NVS allocates its handle and page bookkeeping internally */
+    lamp_mem_allow_begin();
+    nvs_handle_t handle;
+    esp_err_t ret = nvs_open(LIGHT_STORE_NAMESPACE, NVS_READWRITE, &handle);
+    if (ret == ESP_OK) {
+        ret = nvs_set_blob(handle, LIGHT_STORE_KEY, &s_blob,
+                           sizeof(light_store_header_t) + count * sizeof(light_store_record_t));
+        if (ret == ESP_OK) {
+            ret = nvs_commit(handle);
+        }
+        nvs_close(handle);
+    }
+    lamp_mem_allow_end();
+    ESP_RETURN_ON_ERROR(ret, TAG, "Failed to write light table");
+    ESP_LOGI(TAG, "Saved %d lights", count);
+    return ESP_OK;
+}
+
+static void light_store_save_cb(uint8_t param)
+{
+    (void)param;
+    s_save_pending = false;
+    light_store_save();
+}
+
+void light_store_schedule_save(void)
+{
+    if (!s_save_pending) {
+        s_save_pending = true;
+        esp_zb_scheduler_alarm(light_store_save_cb, 0, LIGHT_STORE_SAVE_DELAY_MS);
+    }
+}
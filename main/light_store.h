@@ -0,0 +1,58 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Lamp controller light table persistence
+ *
+ * This example code is in the Public Domain (or CC0 licensed, at your option.)
+ *
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#pragma once
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* NVS location of the light table, in the default "nvs" partition */
+#define LIGHT_STORE_NAMESPACE       "lamp_ctrl"
+#define LIGHT_STORE_KEY             "lights"
+
+/* changes are batched for this long before the table is written to flash */
+#define LIGHT_STORE_SAVE_DELAY_MS   2000
+
+/**
+ * @brief Restore the light table from NVS into the light registry
+ *
+ * Restored lights are flagged LIGHT_FLAG_STALE until they are seen again on
+ * this boot. Call after nvs_flash_init() and before the Zigbee task starts.
+ *
+ * @return
+ *      - ESP_OK on success, including when nothing was stored yet
+ *      - ESP_ERR_INVALID_VERSION if the stored table has an unknown layout
+ *      - other NVS errors
+ */
+esp_err_t light_store_load(void);
+
+/**
+ * @brief Write the light registry to NVS now
+ *
+ * @return ESP_OK on success, NVS error otherwise
+ */
+esp_err_t light_store_save(void);
+
+/**
+ * @brief Request a deferred write of the light registry
+ *
+ * Repeated requests within LIGHT_STORE_SAVE_DELAY_MS collapse into a single
+ * flash write. Must be called from the Zigbee task context.
+ */
+void light_store_schedule_save(void);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
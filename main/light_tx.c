@@ -0,0 +1,318 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Lamp controller transmit scheduler
+ *
+ * This example code is in the Public Domain (or CC0 licensed, at your option.)
+ *
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "esp_timer.h"
+#include "lamp_mem.h"
+#include "lamp_trace.h"
+#include "light_tx.h"
+
+/**
+ * @brief:
+ * esp-zigbee-lib queues every request it is given and sends them in order,
+ * so a button press issued behind a fan-out of reads or fade setpoints waits
+ * for all of them. The scheduler keeps that queue short instead: it counts
+ * what is on the air, each unicast until its send status and each groupcast
+ * for as long as the routers relay it, and lets a lane send only while the
+ * total stays under its share. The background lanes leave room for an
+ * interactive groupcast or a few unicasts at all times, so a press goes out
+ * at once and only competes with the handful of frames already in flight.
+ *
+ * Senders keep their own state (the mailbox its pending values, the setup
+ * sequences their step), so a sender that has to wait leaves a callback
+ * rather than a copy of the request, and sends whatever is current when
+ * it runs. Send statuses run the waiting callbacks, and so do the alarms
+ * that free the place of a groupcast, or of a unicast whose send status
+ * never came. A fan-out goes out a share at a time, the next request as a
+ * send status comes back. There is deliberately no pause between requests:
+ * every decision follows an input or an alarm rather than how long a
+ * handler took. Whether an expiry ran before or after an input depends on
+ * the stack's timing, so each expiry is recorded as an input of its own and
+ * a trace replays the scheduler's decisions in their recorded order.
+ */
+
+/* an expiry alarm's parameter holds the slot and the slot's generation, so the alarm of a reused slot does nothing */
+#define SLOT_BITS       3
+#define SLOT_MASK       ((1 << SLOT_BITS) - 1)
+
+_Static_assert(LIGHT_TX_INFLIGHT_MAX <= 1 << SLOT_BITS, "slot numbers must fit SLOT_BITS");
+
+typedef struct {
+    int64_t expire_us;
+    uint8_t index;              /* light, LIGHT_TX_GROUP for a groupcast */
+    uint8_t tsn;
+    uint8_t cost;               /* 0 when the place is free */
+    uint8_t lane;
+    uint8_t generation;         /* counts the slot's uses, upper bits of its alarm parameter */
+} light_tx_slot_t;
+
+typedef struct {
+    esp_zb_callback_t cb;
+    uint8_t param;
+} light_tx_waiter_t;
+
+typedef struct {
+    light_tx_waiter_t list[LIGHT_TX_WAITERS];
+    uint8_t count;
+} light_tx_waiters_t;
+
+static const char *const s_lane_names[LIGHT_TX_LANE_COUNT] = {
+    [LIGHT_TX_INTERACTIVE] = "interactive",
+    [LIGHT_TX_BULK] = "bulk",
+    [LIGHT_TX_MAINTENANCE] = "maintenance",
+};
+
+static const uint8_t s_shares[LIGHT_TX_LANE_COUNT] = {
+    [LIGHT_TX_INTERACTIVE] = LIGHT_TX_INFLIGHT_MAX,
+    [LIGHT_TX_BULK] = LIGHT_TX_BULK_SHARE,
+    [LIGHT_TX_MAINTENANCE] = LIGHT_TX_MAINTENANCE_SHARE,
+};
+
+static const uint8_t s_per_light[LIGHT_TX_LANE_COUNT] = {
+    [LIGHT_TX_INTERACTIVE] = LIGHT_TX_INTERACTIVE_PER_LIGHT,
+    [LIGHT_TX_BULK] = LIGHT_TX_BACKGROUND_PER_LIGHT,
+    [LIGHT_TX_MAINTENANCE] = LIGHT_TX_BACKGROUND_PER_LIGHT,
+};
+
+static light_tx_slot_t s_slots[LIGHT_TX_INFLIGHT_MAX];
+static uint8_t s_inflight;                              /* sum of the slots' cost */
+static uint8_t s_light_inflight[LIGHT_REGISTRY_CAPACITY];
+static light_tx_waiters_t s_waiters[LIGHT_TX_LANE_COUNT];
+static light_tx_stats_t s_stats;
+
+static void light_tx_release(light_tx_slot_t *slot)
+{
+    s_inflight -= slot->cost;
+    if (slot->index < LIGHT_REGISTRY_CAPACITY && s_light_inflight[slot->index]) {
+        s_light_inflight[slot->index]--;
+    }
+    slot->cost = 0;
+}
+
+/* Room for at least one more unicast on a lane, whatever its light */
+static bool light_tx_room(light_tx_lane_t lane)
+{
+    return s_inflight < s_shares[lane];
+}
+
+static void light_tx_pump(void);
+
+void light_tx_expire_cb(uint8_t param)
+{
+    light_tx_slot_t *slot = &s_slots[param & SLOT_MASK];
+    if (!slot->cost || slot->generation != param >> SLOT_BITS) {
+        return;
+    }
+    const int64_t left_us = slot->expire_us - esp_timer_get_time();
+    if (left_us > 0) {
+        /* the stack rounds alarms to its own ticks */
+        esp_zb_scheduler_alarm(light_tx_expire_cb, param, (uint32_t)(left_us + 999) / 1000);
+        return;
+    }
+    lamp_trace_tx_expire(param);
+    if (slot->index != LIGHT_TX_GROUP) {
+        s_stats.timeouts++;
+    }
+    light_tx_release(slot);
+    light_tx_pump();
+}
+
+/* Waiters over all lanes, the peak adds up the lanes' own and may not have happened at once */
+static void light_tx_usage(lamp_mem_usage_t *usage)
+{
+    usage->used = 0;
+    usage->peak = 0;
+    for (unsigned lane = 0; lane < LIGHT_TX_LANE_COUNT; ++lane) {
+        usage->used += s_waiters[lane].count;
+        usage->peak += s_stats.lanes[lane].max_waiting;
+    }
+}
+
+void light_tx_init(void)
+{
+    memset(s_slots, 0, sizeof(s_slots));
+    memset(s_light_inflight, 0, sizeof(s_light_inflight));
+    memset(s_waiters, 0, sizeof(s_waiters));
+    memset(&s_stats, 0, sizeof(s_stats));
+    s_inflight = 0;
+    lamp_mem_add_pool("tx waiters", LIGHT_TX_LANE_COUNT * LIGHT_TX_WAITERS, sizeof(light_tx_waiter_t), light_tx_usage);
+}
+
+bool light_tx_ready(light_tx_lane_t lane, uint8_t index)
+{
+    return light_tx_ready_for(lane, index, 1);
+}
+
+bool light_tx_ready_for(light_tx_lane_t lane, uint8_t index, uint8_t requests)
+{
+    if (lane >= LIGHT_TX_LANE_COUNT || !requests) {
+        return false;
+    }
+    if (index == LIGHT_TX_GROUP) {
+        return s_inflight + requests * LIGHT_TX_BROADCAST_COST <= s_shares[lane];
+    }
+    return index < LIGHT_REGISTRY_CAPACITY && s_inflight + requests <= s_shares[lane] &&
+           s_light_inflight[index] + requests <= s_per_light[lane];
+}
+
+void light_tx_sent_zdo(light_tx_lane_t lane)
+{
+    if (lane >= LIGHT_TX_LANE_COUNT) {
+        return;
+    }
+    s_stats.lanes[lane].sent++;
+}
+
+void light_tx_sent(light_tx_lane_t lane, uint8_t index, uint8_t tsn)
+{
+    if (lane >= LIGHT_TX_LANE_COUNT) {
+        return;
+    }
+    s_stats.lanes[lane].sent++;
+    const uint8_t cost = index == LIGHT_TX_GROUP ? LIGHT_TX_BROADCAST_COST : 1;
+    unsigned i = 0;
+    while (i < LIGHT_TX_INFLIGHT_MAX && s_slots[i].cost) {
+        ++i;
+    }
+    if (i == LIGHT_TX_INFLIGHT_MAX || s_inflight + cost > LIGHT_TX_INFLIGHT_MAX) {
+        /* sent without asking, or asked for a light and sent to a group */
+        s_stats.untracked++;
+        return;
+    }
+    const uint32_t hold_ms = index == LIGHT_TX_GROUP ? LIGHT_TX_BROADCAST_HOLD_MS : LIGHT_TX_INFLIGHT_TIMEOUT_MS;
+    light_tx_slot_t *slot = &s_slots[i];
+    *slot = (light_tx_slot_t){
+        .expire_us = esp_timer_get_time() + hold_ms * 1000,
+        .index = index,
+        .tsn = tsn,
+        .cost = cost,
+        .lane = (uint8_t)lane,
+        .generation = (uint8_t)((slot->generation + 1) & (0xff >> SLOT_BITS)),
+    };
+    esp_zb_scheduler_alarm(light_tx_expire_cb, (uint8_t)(i | slot->generation << SLOT_BITS), hold_ms);
+    s_inflight += cost;
+    if (index < LIGHT_REGISTRY_CAPACITY) {
+        s_light_inflight[index]++;
+    }
+    if (s_inflight > s_stats.max_inflight) {
+        s_stats.max_inflight = s_inflight;
+    }
+}
+
+/* Run waiting senders while their lane has room, each at most once: one that defers again goes to the back */
+static void light_tx_pump(void)
+{
+    for (int lane = 0; lane < LIGHT_TX_LANE_COUNT; ++lane) {
+        light_tx_waiters_t *waiters = &s_waiters[lane];
+        for (uint8_t runs = waiters->count; runs && waiters->count; --runs) {
+            if (!light_tx_room(lane)) {
+                break;
+            }
+            const light_tx_waiter_t waiter = waiters->list[0];
+            waiters->count--;
+            memmove(&waiters->list[0], &waiters->list[1], waiters->count * sizeof(waiters->list[0]));
+            s_stats.lanes[lane].woken++;
+            waiter.cb(waiter.param);
+        }
+    }
+}
+
+void light_tx_defer(light_tx_lane_t lane, esp_zb_callback_t cb, uint8_t param)
+{
+    if (lane >= LIGHT_TX_LANE_COUNT || !cb) {
+        return;
+    }
+    light_tx_waiters_t *waiters = &s_waiters[lane];
+    for (uint8_t i = 0; i < waiters->count; ++i) {
+        if (waiters->list[i].cb == cb && waiters->list[i].param == param) {
+            return;
+        }
+    }
+    s_stats.lanes[lane].deferred++;
+    if (waiters->count == LIGHT_TX_WAITERS) {
+        s_stats.lanes[lane].overflow++;
+        esp_zb_scheduler_alarm(cb, param, LIGHT_TX_RETRY_MS);
+        return;
+    }
+    waiters->list[waiters->count++] = (light_tx_waiter_t){.cb = cb, .param = param};
+    if (waiters->count > s_stats.lanes[lane].max_waiting) {
+        s_stats.lanes[lane].max_waiting = waiters->count;
+    }
+}
+
+void light_tx_send_status(const esp_zb_zcl_command_send_status_message_t *message)
+{
+    if (!message || message->dst_addr.addr_type != ESP_ZB_ZCL_ADDR_TYPE_SHORT) {
+        return;
+    }
+    const uint8_t index = light_registry_find_short(message->dst_addr.u.short_addr);
+    /*
+     * A status whose sequence number matches nothing, that of a request sent
+     * without asking or of one replayed in another order, answers the light's
+     * oldest request.
+     */
+    light_tx_slot_t *found = NULL;
+    for (unsigned i = 0; i < LIGHT_TX_INFLIGHT_MAX; ++i) {
+        light_tx_slot_t *slot = &s_slots[i];
+        if (!slot->cost || slot->index != index) {
+            continue;
+        }
+        if (slot->tsn == message->tsn) {
+            found = slot;
+            break;
+        }
+        if (!found || slot->expire_us < found->expire_us) {
+            found = slot;
+        }
+    }
+    if (found) {
+        light_tx_release(found);
+        s_stats.delivered++;
+        light_tx_pump();
+    }
+}
+
+void light_tx_get_stats(light_tx_stats_t *stats)
+{
+    *stats = s_stats;
+    stats->inflight = s_inflight;
+}
+
+void light_tx_dump(void)
+{
+    const int64_t now = esp_timer_get_time();
+    printf("%-12s %5s %8s %8s %8s %8s %7s %7s\n", "lane", "share", "sent", "deferred", "woken", "overflow", "waiting",
+           "max");
+    for (int lane = 0; lane < LIGHT_TX_LANE_COUNT; ++lane) {
+        const light_tx_lane_stats_t *stats = &s_stats.lanes[lane];
+        printf("%-12s %5u %8lu %8lu %8lu %8lu %7u %7u\n", s_lane_names[lane], s_shares[lane],
+               (unsigned long)stats->sent, (unsigned long)stats->deferred, (unsigned long)stats->woken,
+               (unsigned long)stats->overflow, s_waiters[lane].count, stats->max_waiting);
+    }
+    printf("in flight %u/%u (max %u), released by send status %lu, timed out %lu, untracked %lu\n", s_inflight,
+           LIGHT_TX_INFLIGHT_MAX, s_stats.max_inflight, (unsigned long)s_stats.delivered,
+           (unsigned long)s_stats.timeouts, (unsigned long)s_stats.untracked);
+    for (unsigned i = 0; i < LIGHT_TX_INFLIGHT_MAX; ++i) {
+        const light_tx_slot_t *slot = &s_slots[i];
+        if (!slot->cost) {
+            continue;
+        }
+        if (slot->index == LIGHT_TX_GROUP) {
+            printf("  groupcast    %-12s releases in %lu ms\n", s_lane_names[slot->lane],
+                   (unsigned long)((slot->expire_us - now) / 1000));
+        } else {
+            printf("  light %2u tsn %3u %-12s times out in %lu ms\n", slot->index, slot->tsn, s_lane_names[slot->lane],
+                   (unsigned long)((slot->expire_us - now) / 1000));
+        }
+    }
+}
@@ -0,0 +1,173 @@
+/*
+ * SPDX-License-Identifier: CC0-1.0
+ *
+ * Lamp controller transmit scheduler
+ *
+ * This example code is in the Public Domain (or CC0 licensed, at your option.)
+ *
+ * Unless required by applicable law or agreed to in writing, this
+ * software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_zigbee_core.h"
+#include "light_registry.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* frames on the air at once over all lights: unicasts awaiting their send status, groupcasts being relayed */
+#define LIGHT_TX_INFLIGHT_MAX           8
+
+/* how far a lane may fill LIGHT_TX_INFLIGHT_MAX, the rest stays free for the lanes above it */
+#define LIGHT_TX_BULK_SHARE             4
+#define LIGHT_TX_MAINTENANCE_SHARE      3
+
+/*
+ * Unicasts in flight to one light: the background lanes only send to a light
+ * with nothing in flight, interactive writes may add one per mailbox lane.
+ */
+#define LIGHT_TX_BACKGROUND_PER_LIGHT   1
+#define LIGHT_TX_INTERACTIVE_PER_LIGHT  (LIGHT_TX_BACKGROUND_PER_LIGHT + 2)
+
+/*
+ * A groupcast is relayed by every router (see light_fade.h), it takes
+ * LIGHT_TX_BROADCAST_COST of LIGHT_TX_INFLIGHT_MAX until it has died down.
+ */
+#define LIGHT_TX_BROADCAST_COST         4
+#define LIGHT_TX_BROADCAST_HOLD_MS      100
+
+/* a unicast whose send status never came frees its place after this long, beyond the stack's last APS retry */
+#define LIGHT_TX_INFLIGHT_TIMEOUT_MS    1000
+
+/*
+ * Callbacks waiting for room per lane: senders keep which lights they hold
+ * back themselves and wait with one callback each. A callback that finds the
+ * list full is run again by alarm after LIGHT_TX_RETRY_MS.
+ */
+#define LIGHT_TX_WAITERS                8
+#define LIGHT_TX_RETRY_MS               10
+
+/* light_tx_ready() and light_tx_sent() index of a groupcast */
+#define LIGHT_TX_GROUP                  0xfe
+
+_Static_assert(LIGHT_TX_GROUP >= LIGHT_REGISTRY_CAPACITY && LIGHT_TX_GROUP != LIGHT_REGISTRY_INVALID,
+               "LIGHT_TX_GROUP must not be a light");
+_Static_assert(LIGHT_TX_BROADCAST_COST <= LIGHT_TX_BULK_SHARE && LIGHT_TX_MAINTENANCE_SHARE <= LIGHT_TX_BULK_SHARE,
+               "fades groupcast in the bulk lane, lower lanes get less");
+_Static_assert(LIGHT_TX_BULK_SHARE + LIGHT_TX_BROADCAST_COST <= LIGHT_TX_INFLIGHT_MAX,
+               "an interactive groupcast must always find room next to background traffic");
+_Static_assert(LIGHT_TX_INTERACTIVE_PER_LIGHT >= 2 && 2 * LIGHT_TX_BROADCAST_COST <= LIGHT_TX_INFLIGHT_MAX,
+               "a preset replayed as a color and a level write must fit the interactive lane at once");
+
+/* lanes in priority order */
+typedef enum {
+    LIGHT_TX_INTERACTIVE,       /* writes caused by a button, the serial port or the console */
+    LIGHT_TX_BULK,              /* fade setpoints and attribute reads */
+    LIGHT_TX_MAINTENANCE,       /* group, scene and reporting setup */
+    LIGHT_TX_LANE_COUNT,
+} light_tx_lane_t;
+
+typedef struct {
+    uint32_t sent;              /* requests let through */
+    uint32_t deferred;          /* senders told to wait */
+    uint32_t woken;             /* waiting senders run again */
+    uint32_t overflow;          /* waiters that found the list full and were retried by alarm */
+    uint8_t max_waiting;
+} light_tx_lane_stats_t;
+
+typedef struct {
+    light_tx_lane_stats_t lanes[LIGHT_TX_LANE_COUNT];
+    uint32_t delivered;         /* unicasts released by their send status */
+    uint32_t timeouts;          /* unicasts released by LIGHT_TX_INFLIGHT_TIMEOUT_MS */
+    uint32_t untracked;         /* requests sent with every place taken, not counted in flight */
+    uint8_t inflight;           /* places taken right now */
+    uint8_t max_inflight;
+} light_tx_stats_t;
+
+/*
+ * Senders ask light_tx_ready() before every request and report it with
+ * light_tx_sent() right after. A sender that is told to wait registers a
+ * callback with light_tx_defer() and runs it again once there is room; it
+ * decides then what is still worth sending.
+ *
+ * Like the registry, the scheduler is not locked: call from the Zigbee task.
+ */
+
+/**
+ * @brief Forget every frame in flight and every waiting sender
+ */
+void light_tx_init(void);
+
+/**
+ * @brief Whether a lane may send a request now
+ *
+ * @param lane      light_tx_lane_t of the request.
+ * @param index     slot index of the light, LIGHT_TX_GROUP for a groupcast.
+ */
+bool light_tx_ready(light_tx_lane_t lane, uint8_t index);
+
+/**
+ * @brief Whether a lane may send several requests to the same light, or groupcasts, now
+ *
+ * For requests that only make sense together: a sender that sends the first
+ * after this said yes finds room for the rest.
+ */
+bool light_tx_ready_for(light_tx_lane_t lane, uint8_t index, uint8_t requests);
+
+/**
+ * @brief Count a request handed to the stack
+ *
+ * @param lane      as for light_tx_ready().
+ * @param index     as for light_tx_ready().
+ * @param tsn       ZCL sequence number the request returned, its send status releases the place.
+ */
+void light_tx_sent(light_tx_lane_t lane, uint8_t index, uint8_t tsn);
+
+/**
+ * @brief Count a ZDO request, which has no ZCL send status and takes no place in flight
+ */
+void light_tx_sent_zdo(light_tx_lane_t lane);
+
+/**
+ * @brief Run a callback once the lane may send again
+ *
+ * Callbacks run in the order they were deferred, lanes in priority order. A
+ * callback already waiting on the lane with the same parameter is not added
+ * twice.
+ */
+void light_tx_defer(light_tx_lane_t lane, esp_zb_callback_t cb, uint8_t param);
+
+/**
+ * @brief Release the place of an answered unicast and run waiting senders, from the ZCL send status handler
+ */
+void light_tx_send_status(const esp_zb_zcl_command_send_status_message_t *message);
+
+/**
+ * @brief Expiry alarm of a frame in flight: frees its place and runs waiting senders
+ *
+ * Recorded in the trace when it frees a place; the host replay runs it from
+ * there instead of from the clock.
+ *
+ * @param param     slot and the slot's generation, an alarm for a slot reused since does nothing.
+ */
+void light_tx_expire_cb(uint8_t param);
+
+/**
+ * @brief Snapshot of the counters
+ */
+void light_tx_get_stats(light_tx_stats_t *stats);
+
+/**
+ * @brief Print the counters and the frames in flight
+ */
+void light_tx_dump(void);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -13,52 +13,270 @@
  */
 
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
+#include "lamp_mem.h"
 #include "switch_driver.h"
 
 /**
  * @brief:
  * This example code shows how to configure light switch with attribute as well as button switch handler.
  *
- * @note:
-   Currently only support toggle switch functionality is available
+ * Buttons interrupt on both edges. The ISR timestamps the edge, masks only
+ * that button's interrupt and wakes the button task, which acts on the edge
+ * straight away and arms a one-shot timer for the debounce window. When the
+ * window ends the interrupt is unmasked and the level sampled once: bounces
+ * inside the window never reach the task, and other buttons keep working.
  *
- * @note:
- * For other possible switch functions (on/off,level up/down,step up/down). User need to implement and create them by themselves
+ * Gestures are built on the debounced presses and releases with a second
+ * one-shot timer per button: started on a press it times the hold, started
+ * on the release of a short press (SWITCH_PRESS_ARMED) it times the window
+ * for a second press.
  */
 
+typedef enum {
+    SWITCH_EVT_EDGE,            /* ISR saw an edge, the button interrupt is masked */
+    SWITCH_EVT_SETTLED,         /* debounce window of the button ended */
+    SWITCH_EVT_GESTURE,         /* hold or double press timer of the button ran out */
+} switch_evt_kind_t;
+
+typedef struct {
+    uint8_t button;
+    uint8_t kind;               /* switch_evt_kind_t */
+    int64_t time_us;            /* edge timestamp taken in the ISR, or when the timer ran out */
+} switch_evt_t;
+
+typedef struct {
+    switch_func_pair_t *pair;
+    esp_timer_handle_t timer;
+    esp_timer_handle_t gesture_timer;
+    int64_t gesture_due_us;     /* when the gesture timer runs out, 0 if stopped */
+    switch_state_t state;
+    bool decided;               /* the current press already made its gesture */
+    bool held;                  /* a hold was reported, its release is due */
+} switch_button_t;
+
+/* room for an edge and two timer events per button */
+#define SWITCH_EVT_QUEUE_LEN    (3 * SWITCH_MAX_BUTTONS)
+
 static QueueHandle_t gpio_evt_queue = NULL;
-/* button function pair, should be defined in switch example source file */
-static switch_func_pair_t *switch_func_pair;
+static StaticQueue_t s_evt_queue;
+static uint8_t s_evt_storage[SWITCH_EVT_QUEUE_LEN * sizeof(switch_evt_t)];
+static StackType_t s_task_stack[SWITCH_TASK_STACK];
+static StaticTask_t s_task;
+static switch_button_t s_buttons[SWITCH_MAX_BUTTONS];
 /* call back function pointer */
 static esp_switch_callback_t func_ptr;
-/* which button is pressed */
+/* number of buttons */
 static uint8_t switch_num;
+static switch_driver_stats_t s_stats;
+static int64_t s_decided_us;
 static const char *TAG = "ESP_ZB_SWITCH";
 
-static void switch_driver_gpios_intr_enabled(bool enabled);
-
 static void IRAM_ATTR gpio_isr_handler(void *arg)
 {
-    switch_driver_gpios_intr_enabled(false);
-    xQueueSendFromISR(gpio_evt_queue, (switch_func_pair_t *)arg, NULL);
+    const uint8_t button = (uint8_t)(uintptr_t)arg;
+    switch_evt_t evt = {
+        .button = button,
+        .kind = SWITCH_EVT_EDGE,
+        .time_us = esp_timer_get_time(),
+    };
+    BaseType_t woken = pdFALSE;
+    /* bounces stay masked until the debounce window of this button ends */
+    gpio_intr_disable(s_buttons[button].pair->pin);
+    xQueueSendFromISR(gpio_evt_queue, &evt, &woken);
+    portYIELD_FROM_ISR(woken);
+}
+
+static void switch_driver_timer_post(uint8_t button, switch_evt_kind_t kind)
+{
+    switch_evt_t evt = {
+        .button = button,
+        .kind = kind,
+        .time_us = esp_timer_get_time(),
+    };
+    xQueueSend(gpio_evt_queue, &evt, portMAX_DELAY);
+}
+
+static void switch_driver_timer_cb(void *arg)
+{
+    switch_driver_timer_post((uint8_t)(uintptr_t)arg, SWITCH_EVT_SETTLED);
+}
+
+static void switch_driver_gesture_timer_cb(void *arg)
+{
+    switch_driver_timer_post((uint8_t)(uintptr_t)arg, SWITCH_EVT_GESTURE);
+}
+
+static bool switch_driver_wants(const switch_button_t *button, switch_gesture_t gesture)
+{
+    return button->pair->gestures & SWITCH_GESTURE_BIT(gesture);
+}
+
+static void switch_driver_gesture_start(switch_button_t *button, uint32_t timeout_ms)
+{
+    esp_timer_stop(button->gesture_timer);
+    button->gesture_due_us = esp_timer_get_time() + timeout_ms * 1000;
+    esp_timer_start_once(button->gesture_timer, timeout_ms * 1000);
+}
+
+static void switch_driver_gesture_stop(switch_button_t *button)
+{
+    esp_timer_stop(button->gesture_timer);
+    button->gesture_due_us = 0;
+}
+
+/**
+ * @brief Report a gesture
+ *
+ * @param button        the button.
+ * @param gesture       the gesture.
+ * @param decided_us    the edge or timeout that decided the gesture.
+ */
+static void switch_driver_fire(switch_button_t *button, switch_gesture_t gesture, int64_t decided_us)
+{
+    s_decided_us = decided_us;
+    (*func_ptr)(button->pair, gesture);
+    const uint32_t latency_us = (uint32_t)(esp_timer_get_time() - decided_us);
+    s_stats.callbacks++;
+    s_stats.gestures[gesture]++;
+    s_stats.latency_last_us = latency_us;
+    s_stats.latency_total_us += latency_us;
+    if (latency_us > s_stats.latency_max_us) {
+        s_stats.latency_max_us = latency_us;
+    }
 }
 
 /**
- * @brief Enable GPIO (switches refer to) isr
+ * @brief A debounced press started
  *
- * @param enabled      enable isr if true.
+ * @param button    the button, in SWITCH_IDLE or SWITCH_PRESS_ARMED.
+ * @param time_us   the press edge.
  */
-static void switch_driver_gpios_intr_enabled(bool enabled)
+static void switch_driver_pressed(switch_button_t *button, int64_t time_us)
 {
-    for (int i = 0; i < switch_num; ++i) {
-        if (enabled) {
-            gpio_intr_enable((switch_func_pair + i)->pin);
-        } else {
-            gpio_intr_disable((switch_func_pair + i)->pin);
+    const bool second = button->state == SWITCH_PRESS_ARMED;
+    button->state = SWITCH_PRESS_DETECTED;
+    button->decided = false;
+    button->held = false;
+    s_stats.presses++;
+    switch_driver_gesture_stop(button);
+    if (second) {
+        /* the second press decides on its edge, holding it changes nothing */
+        button->decided = true;
+        switch_driver_fire(button, SWITCH_GESTURE_DOUBLE_PRESS, time_us);
+    } else if (switch_driver_wants(button, SWITCH_GESTURE_HOLD)) {
+        switch_driver_gesture_start(button, SWITCH_HOLD_MS);
+    } else if (!switch_driver_wants(button, SWITCH_GESTURE_DOUBLE_PRESS) && !button->pair->fire_on_release) {
+        /* take a lock-out window after acting on the first edge */
+        button->decided = true;
+        switch_driver_fire(button, SWITCH_GESTURE_PRESS, time_us);
+    }
+}
+
+/**
+ * @brief A debounced release ended a press
+ *
+ * @param button    the button.
+ * @param time_us   when the release was confirmed.
+ */
+static void switch_driver_released(switch_button_t *button, int64_t time_us)
+{
+    button->state = SWITCH_IDLE;
+    if (button->held) {
+        button->held = false;
+        switch_driver_fire(button, SWITCH_GESTURE_HOLD_RELEASE, time_us);
+        return;
+    }
+    if (button->decided) {
+        return;
+    }
+    switch_driver_gesture_stop(button);
+    if (switch_driver_wants(button, SWITCH_GESTURE_DOUBLE_PRESS)) {
+        button->state = SWITCH_PRESS_ARMED;
+        switch_driver_gesture_start(button, SWITCH_DOUBLE_PRESS_MS);
+        return;
+    }
+    switch_driver_fire(button, SWITCH_GESTURE_PRESS, time_us);
+}
+
+/**
+ * @brief Start debouncing an edge that changed the state of a button
+ *
+ * @param button    the button, its interrupt masked by the ISR.
+ * @param evt       the edge.
+ */
+static void switch_driver_edge(switch_button_t *button, const switch_evt_t *evt)
+{
+    const bool pressed = gpio_get_level(button->pair->pin) == GPIO_INPUT_LEVEL_ON;
+    if ((button->state == SWITCH_IDLE || button->state == SWITCH_PRESS_ARMED) && pressed) {
+        switch_driver_pressed(button, evt->time_us);
+    } else if (button->state == SWITCH_PRESSED && !pressed) {
+        button->state = SWITCH_RELEASE_DETECTED;
+    } else {
+        /* a glitch that was over before the task looked */
+        s_stats.bounces++;
+        gpio_intr_enable(button->pair->pin);
+        return;
+    }
+    esp_timer_start_once(button->timer, SWITCH_DEBOUNCE_MS * 1000);
+}
+
+/**
+ * @brief Resolve a button once its debounce window ended
+ *
+ * @param button    the button.
+ * @param evt       the end of the window.
+ */
+static void switch_driver_settled(switch_button_t *button, const switch_evt_t *evt)
+{
+    /* unmask first, so an edge right after sampling is not lost */
+    gpio_intr_enable(button->pair->pin);
+    const bool pressed = gpio_get_level(button->pair->pin) == GPIO_INPUT_LEVEL_ON;
+    switch (button->state) {
+    case SWITCH_PRESS_DETECTED:
+        if (pressed) {
+            button->state = SWITCH_PRESSED;
+            break;
         }
+        /* released within the window: the press and its release in one */
+        switch_driver_released(button, evt->time_us);
+        break;
+    case SWITCH_RELEASE_DETECTED:
+        if (pressed) {
+            button->state = SWITCH_PRESSED;
+            s_stats.bounces++;
+            break;
+        }
+        switch_driver_released(button, evt->time_us);
+        break;
+    default:
+        break;
+    }
+}
+
+/**
+ * @brief Decide a hold or a lone short press once the gesture timer ran out
+ *
+ * @param button    the button.
+ * @param evt       the timeout.
+ */
+static void switch_driver_gesture_timeout(switch_button_t *button, const switch_evt_t *evt)
+{
+    /* drop a timeout queued before the timer was stopped or restarted */
+    if (!button->gesture_due_us || evt->time_us < button->gesture_due_us) {
+        return;
+    }
+    button->gesture_due_us = 0;
+    if (button->state == SWITCH_PRESS_ARMED) {
+        button->state = SWITCH_IDLE;
+        switch_driver_fire(button, SWITCH_GESTURE_PRESS, evt->time_us);
+    } else if (button->state != SWITCH_IDLE && !button->decided) {
+        button->decided = true;
+        button->held = true;
+        switch_driver_fire(button, SWITCH_GESTURE_HOLD, evt->time_us);
     }
 }
 
@@ -69,41 +287,22 @@ static void switch_driver_gpios_intr_enabled(bool enabled)
  */
 static void switch_driver_button_detected(void *arg)
 {
-    gpio_num_t io_num = GPIO_NUM_NC;
-    switch_func_pair_t button_func_pair;
-    static switch_state_t switch_state = SWITCH_IDLE;
-    bool evt_flag = false;
-
+    switch_evt_t evt;
     for (;;) {
-        /* check if there is any queue received, if yes read out the button_func_pair */
-        if (xQueueReceive(gpio_evt_queue, &button_func_pair, portMAX_DELAY)) {
-            io_num =  button_func_pair.pin;
-            switch_driver_gpios_intr_enabled(false);
-            evt_flag = true;
+        if (!xQueueReceive(gpio_evt_queue, &evt, portMAX_DELAY) || evt.button >= switch_num) {
+            continue;
         }
-        while (evt_flag) {
-            bool value = gpio_get_level(io_num);
-            switch (switch_state) {
-            case SWITCH_IDLE:
-                switch_state = (value == GPIO_INPUT_LEVEL_ON) ? SWITCH_PRESS_DETECTED : SWITCH_IDLE;
-                break;
-            case SWITCH_PRESS_DETECTED:
-                switch_state = (value == GPIO_INPUT_LEVEL_ON) ? SWITCH_PRESS_DETECTED : SWITCH_RELEASE_DETECTED;
-                break;
-            case SWITCH_RELEASE_DETECTED:
-                switch_state = SWITCH_IDLE;
-                /* callback to button_handler */
-                (*func_ptr)(&button_func_pair);
-                break;
-            default:
-                break;
-            }
-            if (switch_state == SWITCH_IDLE) {
-                switch_driver_gpios_intr_enabled(true);
-                evt_flag = false;
-                break;
-            }
-            vTaskDelay(10 / portTICK_PERIOD_MS);
+        switch_button_t *button = &s_buttons[evt.button];
+        switch (evt.kind) {
+        case SWITCH_EVT_EDGE:
+            switch_driver_edge(button, &evt);
+            break;
+        case SWITCH_EVT_SETTLED:
+            switch_driver_settled(button, &evt);
+            break;
+        default:
+            switch_driver_gesture_timeout(button, &evt);
+            break;
         }
     }
 }
@@ -117,16 +316,38 @@ static void switch_driver_button_detected(void *arg)
 static bool switch_driver_gpio_init(switch_func_pair_t *button_func_pair, uint8_t button_num)
 {
     gpio_config_t io_conf = {};
-    switch_func_pair = button_func_pair;
-    switch_num = button_num;
     uint64_t pin_bit_mask = 0;
 
-    /* set up button func pair pin mask */
+    if (button_num > SWITCH_MAX_BUTTONS) {
+        ESP_LOGE(TAG, "At most %d buttons are supported", SWITCH_MAX_BUTTONS);
+        return false;
+    }
+    switch_num = button_num;
+    /* set up button func pair pin mask, the debounce and the gesture timers */
     for (int i = 0; i < button_num; ++i) {
         pin_bit_mask |= (1ULL << (button_func_pair + i)->pin);
+        s_buttons[i].pair = button_func_pair + i;
+        s_buttons[i].state = SWITCH_IDLE;
+        const esp_timer_create_args_t timer_args = {
+            .callback = switch_driver_timer_cb,
+            .arg = (void *)(uintptr_t)i,
+            .dispatch_method = ESP_TIMER_TASK,
+            .name = "switch_debounce",
+        };
+        const esp_timer_create_args_t gesture_timer_args = {
+            .callback = switch_driver_gesture_timer_cb,
+            .arg = (void *)(uintptr_t)i,
+            .dispatch_method = ESP_TIMER_TASK,
+            .name = "switch_gesture",
+        };
+        if (esp_timer_create(&timer_args, &s_buttons[i].timer) != ESP_OK ||
+            esp_timer_create(&gesture_timer_args, &s_buttons[i].gesture_timer) != ESP_OK) {
+            ESP_LOGE(TAG, "Button timers were not created");
+            return false;
+        }
     }
-    /* interrupt of falling edge */
-    io_conf.intr_type = GPIO_INTR_LOW_LEVEL;
+    /* interrupt of both edges, a held button does not re-fire */
+    io_conf.intr_type = GPIO_INTR_ANYEDGE;
     io_conf.pin_bit_mask = pin_bit_mask;
     io_conf.mode = GPIO_MODE_INPUT;
     io_conf.pull_down_en = 0;
@@ -134,26 +355,39 @@ static bool switch_driver_gpio_init(switch_func_pair_t *button_func_pair, uint8_
     /* configure GPIO with the given settings */
     gpio_config(&io_conf);
     /* create a queue to handle gpio event from isr */
-    gpio_evt_queue = xQueueCreate(10, sizeof(switch_func_pair_t));
+    gpio_evt_queue = xQueueCreateStatic(SWITCH_EVT_QUEUE_LEN, sizeof(switch_evt_t), s_evt_storage, &s_evt_queue);
     if ( gpio_evt_queue == 0) {
         ESP_LOGE(TAG, "Queue was not created and must not be used");
         return false;
     }
     /* start gpio task */
-    xTaskCreate(switch_driver_button_detected, "button_detected", 4096, NULL, 10, NULL);
+    TaskHandle_t task = xTaskCreateStatic(switch_driver_button_detected, "button_detected", SWITCH_TASK_STACK, NULL,
+                                          SWITCH_TASK_PRIORITY, s_task_stack, &s_task);
+    if (!task) {
+        ESP_LOGE(TAG, "Button task was not created");
+        return false;
+    }
+    lamp_mem_add_task(task, SWITCH_TASK_STACK, true);
     /* install gpio isr service */
     gpio_install_isr_service(ESP_INTR_FLAG_DEFAULT);
     for (int i = 0; i < button_num; ++i) {
-        gpio_isr_handler_add((button_func_pair + i)->pin, gpio_isr_handler, (void *) (button_func_pair + i));
+        gpio_isr_handler_add((button_func_pair + i)->pin, gpio_isr_handler, (void *)(uintptr_t)i);
     }
     return true;
 }
 
 bool switch_driver_init(switch_func_pair_t *button_func_pair, uint8_t button_num, esp_switch_callback_t cb)
 {
-    if (!switch_driver_gpio_init(button_func_pair, button_num)) {
-        return false;
-    }
     func_ptr = cb;
-    return true;
+    return switch_driver_gpio_init(button_func_pair, button_num);
+}
+
+void switch_driver_get_stats(switch_driver_stats_t *stats)
+{
+    *stats = s_stats;
+}
+
+int64_t switch_driver_decided_us(void)
+{
+    return s_decided_us;
 }
@@ -23,6 +23,10 @@ extern "C" {
 /* user should configure which I/O port as toggle switch input, default is GPIO9 */
 #define GPIO_INPUT_IO_TOGGLE_SWITCH  GPIO_NUM_9
 
+/* dimming buttons, pulled up like the toggle so an unwired pin reads as released */
+#define GPIO_INPUT_IO_LEVEL_UP_SWITCH    GPIO_NUM_18
+#define GPIO_INPUT_IO_LEVEL_DOWN_SWITCH  GPIO_NUM_19
+
 /* config button level depends on the pull up/down setting
    push button level is on level = 1 when pull-down enable
    push button level is on level = 0 when pull-up enable
@@ -31,6 +35,22 @@ extern "C" {
 
 #define ESP_INTR_FLAG_DEFAULT   0
 
+/* an edge starts a debounce window, the level is sampled once it ends */
+#define SWITCH_DEBOUNCE_MS      20
+
+/* a press still down after this long is a hold */
+#define SWITCH_HOLD_MS          400
+
+/* a press starting this soon after a short press was released makes a double press */
+#define SWITCH_DOUBLE_PRESS_MS  250
+
+/* most buttons one driver instance handles */
+#define SWITCH_MAX_BUTTONS      8
+
+/* the button task runs the callback, which only posts to the mailbox */
+#define SWITCH_TASK_PRIORITY    10
+#define SWITCH_TASK_STACK       3072
+
 #define PAIR_SIZE(TYPE_STR_PAIR) (sizeof(TYPE_STR_PAIR) / sizeof(TYPE_STR_PAIR[0]))
 
 typedef enum {
@@ -51,12 +71,41 @@ typedef enum {
     SWITCH_COLOR_CONTROL,
 } switch_func_t;
 
+typedef enum {
+    SWITCH_GESTURE_PRESS,           /* short press */
+    SWITCH_GESTURE_DOUBLE_PRESS,    /* second press within SWITCH_DOUBLE_PRESS_MS of a short press */
+    SWITCH_GESTURE_HOLD,            /* still pressed after SWITCH_HOLD_MS */
+    SWITCH_GESTURE_HOLD_RELEASE,    /* released after a hold */
+    SWITCH_GESTURE_COUNT,
+} switch_gesture_t;
+
+#define SWITCH_GESTURE_BIT(gesture)  (1U << (gesture))
+
+/*
+ * A button recognizes a short press always, and a double press or a hold only
+ * if it asks for them: a short press is reported as soon as it cannot become
+ * one of the gestures the button recognizes. That is the press edge for a
+ * press-only button, the release for one that recognizes holds, and the end
+ * of the double press window for one that recognizes double presses.
+ */
 typedef struct {
     uint32_t pin;
     switch_func_t func;
+    bool fire_on_release;   /* press-only button: call back on the debounced release instead of the press */
+    uint8_t gestures;       /* SWITCH_GESTURE_BIT() of SWITCH_GESTURE_DOUBLE_PRESS and SWITCH_GESTURE_HOLD */
 } switch_func_pair_t;
 
-typedef void (*esp_switch_callback_t)(switch_func_pair_t *param);
+typedef void (*esp_switch_callback_t)(switch_func_pair_t *param, switch_gesture_t gesture);
+
+typedef struct {
+    uint32_t presses;           /* debounced presses */
+    uint32_t bounces;           /* edges let through the debounce window that did not change the debounced state */
+    uint32_t callbacks;
+    uint32_t gestures[SWITCH_GESTURE_COUNT];    /* callbacks per gesture */
+    uint32_t latency_last_us;   /* from the edge or timeout that decided the gesture until the callback was entered */
+    uint32_t latency_max_us;
+    uint64_t latency_total_us;
+} switch_driver_stats_t;
 
 /**
  * @brief init function for switch and callback setup
@@ -67,6 +116,20 @@ typedef void (*esp_switch_callback_t)(switch_func_pair_t *param);
  */
 bool switch_driver_init(switch_func_pair_t *button_func_pair, uint8_t button_num, esp_switch_callback_t cb);
 
+/**
+ * @brief get press counters and edge-to-callback latency
+ *
+ * @param stats                 filled with a snapshot of the counters.
+ */
+void switch_driver_get_stats(switch_driver_stats_t *stats);
+
+/**
+ * @brief time of the edge or timeout that decided the gesture being called back
+ *
+ * @return esp_timer_get_time() of the decision, only meaningful inside the callback.
+ */
+int64_t switch_driver_decided_us(void);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
@@ -15,6 +15,7 @@
 #include "stdio.h"
 #include "string.h"
 #include "zcl_utility.h"
+#include <math.h>
 #include <stdint.h>
 
 static const char *TAG = "ZCL_UTILITY";
@@ -35,3 +36,156 @@ esp_err_t esp_zcl_utility_add_ep_basic_manufacturer_info(esp_zb_ep_list_t *ep_li
     ESP_ERROR_CHECK(esp_zb_basic_cluster_add_attr(basic_cluster, ESP_ZB_ZCL_ATTR_BASIC_MODEL_IDENTIFIER_ID, info->model_identifier));
     return ret;
 }
+
+/* Fixed size of a ZCL data type in bytes, 0 for variable length types */
+static uint16_t zcl_type_size(esp_zb_zcl_attr_type_t type)
+{
+    switch (type) {
+    case ESP_ZB_ZCL_ATTR_TYPE_8BIT ... ESP_ZB_ZCL_ATTR_TYPE_64BIT:
+        return type - ESP_ZB_ZCL_ATTR_TYPE_8BIT + 1;
+    case ESP_ZB_ZCL_ATTR_TYPE_BOOL:
+    case ESP_ZB_ZCL_ATTR_TYPE_8BIT_ENUM:
+        return 1;
+    case ESP_ZB_ZCL_ATTR_TYPE_8BITMAP ... ESP_ZB_ZCL_ATTR_TYPE_64BITMAP:
+        return type - ESP_ZB_ZCL_ATTR_TYPE_8BITMAP + 1;
+    case ESP_ZB_ZCL_ATTR_TYPE_U8 ... ESP_ZB_ZCL_ATTR_TYPE_U64:
+        return type - ESP_ZB_ZCL_ATTR_TYPE_U8 + 1;
+    case ESP_ZB_ZCL_ATTR_TYPE_S8 ... ESP_ZB_ZCL_ATTR_TYPE_S64:
+        return type - ESP_ZB_ZCL_ATTR_TYPE_S8 + 1;
+    case ESP_ZB_ZCL_ATTR_TYPE_16BIT_ENUM:
+    case ESP_ZB_ZCL_ATTR_TYPE_SEMI:
+    case ESP_ZB_ZCL_ATTR_TYPE_CLUSTER_ID:
+    case ESP_ZB_ZCL_ATTR_TYPE_ATTRIBUTE_ID:
+        return 2;
+    case ESP_ZB_ZCL_ATTR_TYPE_SINGLE:
+    case ESP_ZB_ZCL_ATTR_TYPE_TIME_OF_DAY:
+    case ESP_ZB_ZCL_ATTR_TYPE_DATE:
+    case ESP_ZB_ZCL_ATTR_TYPE_UTC_TIME:
+    case ESP_ZB_ZCL_ATTR_TYPE_BACNET_OID:
+        return 4;
+    case ESP_ZB_ZCL_ATTR_TYPE_DOUBLE:
+    case ESP_ZB_ZCL_ATTR_TYPE_IEEE_ADDR:
+        return 8;
+    case ESP_ZB_ZCL_ATTR_TYPE_128_BIT_KEY:
+        return 16;
+    default:
+        return 0;
+    }
+}
+
+static uint64_t zcl_read_le(const uint8_t *bytes, uint16_t size)
+{
+    uint64_t value = 0;
+    for (uint16_t i = size; i > 0; --i) {
+        value = value << 8 | bytes[i - 1];
+    }
+    return value;
+}
+
+/* IEEE 754 binary16 to double, including subnormals, infinities and NaN */
+static double zcl_semi_to_double(uint16_t half)
+{
+    const int exponent = (half >> 10) & 0x1f;
+    const double mantissa = half & 0x3ff;
+    double value;
+    if (exponent == 0) {
+        value = ldexp(mantissa, -24);
+    } else if (exponent == 0x1f) {
+        value = mantissa ? NAN : INFINITY;
+    } else {
+        value = ldexp(mantissa + 1024, exponent - 25);
+    }
+    return (half & 0x8000) ? -value : value;
+}
+
+/* (Long) string after a `prefix` byte length, which must fit in the attribute when the stack gives its size */
+static esp_err_t zcl_decode_string(const esp_zb_zcl_attribute_data_t *data, uint8_t prefix, zcl_value_t *value)
+{
+    const uint8_t *bytes = data->value;
+    ESP_RETURN_ON_FALSE(data->size == 0 || data->size >= prefix, ESP_ERR_INVALID_SIZE, TAG,
+                        "String of type 0x%x has %d bytes, no room for its length", data->type, data->size);
+    uint16_t length = (uint16_t)zcl_read_le(bytes, prefix);
+    /* all ones marks an invalid string */
+    if (length == (prefix == 1 ? 0xff : 0xffff)) {
+        length = 0;
+    }
+    ESP_RETURN_ON_FALSE(data->size == 0 || length <= data->size - prefix, ESP_ERR_INVALID_SIZE, TAG,
+                        "String of type 0x%x claims %d bytes, has %d", data->type, length, data->size - prefix);
+    value->kind = ZCL_VALUE_STRING;
+    value->bytes.length = length;
+    value->bytes.data = bytes + prefix;
+    return ESP_OK;
+}
+
+esp_err_t esp_zcl_utility_decode_value(const esp_zb_zcl_attribute_data_t *data, zcl_value_t *value)
+{
+    ESP_RETURN_ON_FALSE(data && value, ESP_ERR_INVALID_ARG, TAG, "Invalid argument");
+    memset(value, 0, sizeof(*value));
+    if (data->type == ESP_ZB_ZCL_ATTR_TYPE_NULL) {
+        return ESP_OK;
+    }
+    ESP_RETURN_ON_FALSE(data->value, ESP_ERR_INVALID_ARG, TAG, "Attribute of type 0x%x has no value", data->type);
+    const uint8_t *bytes = data->value;
+    const uint16_t size = zcl_type_size(data->type);
+
+    switch (data->type) {
+    case ESP_ZB_ZCL_ATTR_TYPE_OCTET_STRING:
+    case ESP_ZB_ZCL_ATTR_TYPE_CHAR_STRING:
+        return zcl_decode_string(data, 1, value);
+    case ESP_ZB_ZCL_ATTR_TYPE_LONG_OCTET_STRING:
+    case ESP_ZB_ZCL_ATTR_TYPE_LONG_CHAR_STRING:
+        return zcl_decode_string(data, 2, value);
+    case ESP_ZB_ZCL_ATTR_TYPE_ARRAY:
+    case ESP_ZB_ZCL_ATTR_TYPE_16BIT_ARRAY:
+    case ESP_ZB_ZCL_ATTR_TYPE_32BIT_ARRAY:
+    case ESP_ZB_ZCL_ATTR_TYPE_STRUCTURE:
+    case ESP_ZB_ZCL_ATTR_TYPE_SET:
+    case ESP_ZB_ZCL_ATTR_TYPE_BAG:
+        value->kind = ZCL_VALUE_RAW;
+        value->bytes.data = bytes;
+        value->bytes.length = data->size;
+        return ESP_OK;
+    case ESP_ZB_ZCL_ATTR_TYPE_128_BIT_KEY:
+        value->kind = ZCL_VALUE_RAW;
+        value->bytes.data = bytes;
+        value->bytes.length = size;
+        return ESP_OK;
+    default:
+        break;
+    }
+
+    ESP_RETURN_ON_FALSE(size, ESP_ERR_INVALID_ARG, TAG, "Unknown attribute type 0x%x", data->type);
+    /* a zero size means the stack did not report one, trust the type */
+    ESP_RETURN_ON_FALSE(data->size == 0 || data->size >= size, ESP_ERR_INVALID_SIZE, TAG,
+                        "Attribute of type 0x%x has %d bytes, needs %d", data->type, data->size, size);
+    const uint64_t raw = zcl_read_le(bytes, size);
+    switch (data->type) {
+    case ESP_ZB_ZCL_ATTR_TYPE_S8 ... ESP_ZB_ZCL_ATTR_TYPE_S64: {
+        const unsigned shift = 64 - 8 * size;
+        value->kind = ZCL_VALUE_SIGNED;
+        value->s = (int64_t)(raw << shift) >> shift;
+        break;
+    }
+    case ESP_ZB_ZCL_ATTR_TYPE_SEMI:
+        value->kind = ZCL_VALUE_FLOAT;
+        value->f = zcl_semi_to_double((uint16_t)raw);
+        break;
+    case ESP_ZB_ZCL_ATTR_TYPE_SINGLE: {
+        const uint32_t bits = (uint32_t)raw;
+        float single;
+        memcpy(&single, &bits, sizeof(single));
+        value->kind = ZCL_VALUE_FLOAT;
+        value->f = single;
+        break;
+    }
+    case ESP_ZB_ZCL_ATTR_TYPE_DOUBLE:
+        value->kind = ZCL_VALUE_FLOAT;
+        memcpy(&value->f, &raw, sizeof(value->f));
+        break;
+    default:
+        value->kind = ZCL_VALUE_UNSIGNED;
+        value->u = raw;
+        break;
+    }
+    return ESP_OK;
+}
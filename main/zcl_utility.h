@@ -46,6 +46,42 @@ typedef struct zcl_basic_manufacturer_info_s {
  */
 esp_err_t esp_zcl_utility_add_ep_basic_manufacturer_info(esp_zb_ep_list_t *ep_list, uint8_t endpoint_id, zcl_basic_manufacturer_info_t *info);
 
+/** kind of value an attribute decodes to */
+typedef enum {
+    ZCL_VALUE_NONE,         /*!< no value: NULL type, or no data */
+    ZCL_VALUE_UNSIGNED,     /*!< data, boolean, bitmap, unsigned, enumeration, time, identifier and IEEE address types */
+    ZCL_VALUE_SIGNED,       /*!< signed integer types */
+    ZCL_VALUE_FLOAT,        /*!< semi, single and double precision */
+    ZCL_VALUE_STRING,       /*!< octet and character strings, length prefix removed */
+    ZCL_VALUE_RAW,          /*!< arrays, structures, sets, bags and keys, left undecoded */
+} zcl_value_kind_t;
+
+/** attribute value decoded according to its ZCL data type */
+typedef struct zcl_value_s {
+    zcl_value_kind_t kind;
+    union {
+        uint64_t u;         /*!< ZCL_VALUE_UNSIGNED, zero extended */
+        int64_t s;          /*!< ZCL_VALUE_SIGNED, sign extended */
+        double f;           /*!< ZCL_VALUE_FLOAT */
+        struct {
+            const uint8_t *data;
+            uint16_t length;
+        } bytes;            /*!< ZCL_VALUE_STRING and ZCL_VALUE_RAW, points into the attribute data */
+    };
+} zcl_value_t;
+
+/**
+ * @brief Decodes attribute data received in a read attribute response or a report
+ *
+ * @param[in] data The attribute data, value stored little endian as received
+ * @param[out] value The decoded value
+ * @return
+ *      - ESP_OK: On success
+ *      - ESP_ERR_INVALID_ARG: Missing value or invalid type
+ *      - ESP_ERR_INVALID_SIZE: Data shorter than its type requires, or a string shorter than its length prefix says
+ */
+esp_err_t esp_zcl_utility_decode_value(const esp_zb_zcl_attribute_data_t *data, zcl_value_t *value);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif